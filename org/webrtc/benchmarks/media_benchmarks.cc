@@ -0,0 +1,1022 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+// Microbenchmarks of the media hot paths, on synthetic input.  Writes
+// one JSON object to stdout, or to the --output file, so that the
+// results of two releases can be diffed:
+// {"benchmarks":[{"name":"H264Encoder.Encode/720p","iterations":300,
+// "meanNs":...,"minNs":...,"p50Ns":...,"p90Ns":...,"p99Ns":...,
+// "maxNs":...}],"stages":...}
+// The percentiles are exact, "stages" holds the pipeline stage timings
+// of the runs, see GetPipelineStageTimingsJson().
+// The loopback call harness runs --calls 720p calls between
+// PeerConnections of the process, and reports the latency of the stamped
+// frames, the frames lost, the frame rate and the CPU of each thread.
+//
+// Options:
+//   --filter=<text>       only runs the benchmarks whose name contains it
+//   --scale=<n>           multiplies the iterations, 1 by default
+//   --output=<path>       writes the results to a file
+//   --calls=<n>           calls of the loopback harness, 1 by default
+//   --call-seconds=<n>    time the calls are measured, 20 s by default
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <mfapi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "third_party/winuwp_h264/H264Encoder/H264Encoder.h"
+#include "third_party/winuwp_h264/Utils/NalScanner.h"
+#include "third_party/winuwp_h264/Utils/PipelineTrace.h"
+#include "third_party/winuwp_h264/Utils/ResourceSampler.h"
+#include "third_party/winuwp_h264/Utils/SampleAttributeQueue.h"
+#include "third_party/winuwp_h264/winuwp_h264_factory.h"
+#include "webrtc/api/peerconnectioninterface.h"
+#include "webrtc/api/video/i420_buffer.h"
+#include "webrtc/api/video/video_frame.h"
+#include "webrtc/common_video/include/i420_buffer_pool.h"
+#include "webrtc/media/base/adaptedvideotracksource.h"
+#include "webrtc/rtc_base/event.h"
+#include "webrtc/rtc_base/ssladapter.h"
+#include "webrtc/rtc_base/thread.h"
+#include "webrtc/rtc_base/timeutils.h"
+#include "../stats/webrtc_stats_network_sender.h"
+#include "../wrapper/FrameStamp.h"
+
+#pragma comment(lib, "ws2_32")
+
+namespace webrtc {
+
+namespace {
+
+struct Resolution {
+  const char* name;
+  int width;
+  int height;
+  // Typical size of an encoded frame at 30 fps, for the bitstreams.
+  size_t frameBytes;
+};
+
+const Resolution kResolutions[] = {
+  { "360p", 640, 360, 6 * 1024 },
+  { "720p", 1280, 720, 20 * 1024 },
+  { "1080p", 1920, 1080, 45 * 1024 },
+};
+
+class BenchmarkRunner {
+ public:
+  BenchmarkRunner(const std::string& filter, int scale)
+    : filter_(filter), scale_(std::max(scale, 1)) {}
+
+  bool ShouldRun(const std::string& name) const {
+    return filter_.empty() || name.find(filter_) != std::string::npos;
+  }
+
+  // Times |iterations| runs of |body|, after a few to warm up.  Each run
+  // does |opsPerIteration| operations, the times are per operation.  A
+  // run returning false isn't counted.
+  void Run(const std::string& name, int iterations, int opsPerIteration,
+    const std::function<bool()>& body) {
+    if (!ShouldRun(name)) {
+      return;
+    }
+    iterations *= scale_;
+    for (int i = 0; i < std::min(iterations / 10 + 1, 10); ++i) {
+      body();
+    }
+    std::vector<int64_t> samplesNs;
+    samplesNs.reserve(iterations);
+    int failures = 0;
+    for (int i = 0; i < iterations; ++i) {
+      int64_t startNs = rtc::TimeNanos();
+      bool succeeded = body();
+      int64_t durationNs = rtc::TimeNanos() - startNs;
+      if (succeeded) {
+        samplesNs.push_back(durationNs / opsPerIteration);
+      } else {
+        ++failures;
+      }
+    }
+    Add(name, &samplesNs, failures);
+  }
+
+  // A result of a benchmark not run by Run(), a JSON object.
+  void AddResult(const std::string& result) {
+    results_.push_back(result);
+    fprintf(stderr, "%s\n", result.c_str());
+  }
+
+  std::string ToJson(const std::string& stages) const {
+    std::ostringstream json;
+    json << "{\"benchmarks\":[";
+    for (size_t i = 0; i < results_.size(); ++i) {
+      if (i > 0) {
+        json << ",";
+      }
+      json << results_[i];
+    }
+    json << "],\"stages\":" << stages << "}";
+    return json.str();
+  }
+
+ private:
+  void Add(const std::string& name, std::vector<int64_t>* samplesNs,
+    int failures) {
+    std::ostringstream result;
+    result << "{\"name\":\"" << name << "\""
+      << ",\"iterations\":" << samplesNs->size()
+      << ",\"failures\":" << failures;
+    if (!samplesNs->empty()) {
+      std::sort(samplesNs->begin(), samplesNs->end());
+      int64_t totalNs = 0;
+      for (int64_t sampleNs : *samplesNs) {
+        totalNs += sampleNs;
+      }
+      auto percentile = [samplesNs](int percent) {
+        size_t rank = (samplesNs->size() * percent + 99) / 100;
+        return (*samplesNs)[std::max<size_t>(rank, 1) - 1];
+      };
+      result << ",\"meanNs\":" << totalNs / (int64_t)samplesNs->size()
+        << ",\"minNs\":" << samplesNs->front()
+        << ",\"p50Ns\":" << percentile(50)
+        << ",\"p90Ns\":" << percentile(90)
+        << ",\"p99Ns\":" << percentile(99)
+        << ",\"maxNs\":" << samplesNs->back();
+    }
+    result << "}";
+    AddResult(result.str());
+  }
+
+  const std::string filter_;
+  const int scale_;
+  std::vector<std::string> results_;
+};
+
+// Annex-B access unit of about |size| bytes: SPS, PPS and IDR slices of
+// 1200 bytes, like the encoder writes for a key frame.  The payload is
+// random with no start code in it.
+std::vector<uint8_t> MakeAccessUnit(size_t size, uint32_t seed) {
+  std::mt19937 random(seed);
+  std::vector<uint8_t> data;
+  auto addNalUnit = [&data, &random](uint8_t header, size_t length) {
+    static const uint8_t kStartCode[] = { 0, 0, 0, 1 };
+    data.insert(data.end(), kStartCode, kStartCode + sizeof(kStartCode));
+    data.push_back(header);
+    for (size_t i = 1; i < length; ++i) {
+      uint8_t byte = static_cast<uint8_t>(random());
+      data.push_back(byte == 0 ? 1 : byte);
+    }
+  };
+  addNalUnit(0x67, 16);
+  addNalUnit(0x68, 4);
+  while (data.size() < size) {
+    addNalUnit(0x65, std::min<size_t>(1200, size - data.size() + 1));
+  }
+  return data;
+}
+
+void RunNalScannerBenchmarks(BenchmarkRunner* runner) {
+  for (const Resolution& resolution : kResolutions) {
+    std::vector<uint8_t> data = MakeAccessUnit(resolution.frameBytes, 1);
+    std::vector<NalUnit> nalUnits;
+    runner->Run(std::string("NalScanner.ScanNalUnits/") + resolution.name,
+      2000, 1, [&data, &nalUnits] {
+        ScanNalUnits(data.data(), data.size(), &nalUnits);
+        return !nalUnits.empty();
+      });
+  }
+}
+
+void RunSampleAttributeQueueBenchmarks(BenchmarkRunner* runner) {
+  struct Attributes {
+    uint32_t rtpTimestamp;
+    int64_t captureTimeMs;
+  };
+  const int kOps = 1000;
+  SampleAttributeQueue<Attributes> queue;
+  uint64_t id = 0;
+  // Like the encoder, a sample popped as soon as it is pushed.
+  runner->Run("SampleAttributeQueue.PushPop", 1000, kOps, [&queue, &id] {
+    Attributes attributes = {};
+    for (int i = 0; i < kOps; ++i) {
+      queue.push(++id, attributes);
+      queue.pop(id, attributes);
+    }
+    return true;
+  });
+  // A few samples in flight, one of them lost every so often: the pop
+  // bisects over the older entries.
+  runner->Run("SampleAttributeQueue.PushPopLossy", 1000, kOps, [&queue, &id] {
+    Attributes attributes = {};
+    for (int i = 0; i < kOps; ++i) {
+      queue.push(++id, attributes);
+      if (i % 4 == 3) {
+        queue.pop(id, attributes);
+      }
+    }
+    return true;
+  });
+}
+
+// Accepts the connections of the stats sender and reads what they send.
+class DiscardServer {
+ public:
+  DiscardServer() : socket_(INVALID_SOCKET), port_(0) {}
+  ~DiscardServer() {
+    if (socket_ != INVALID_SOCKET) {
+      closesocket(socket_);
+    }
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+  bool Start() {
+    socket_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int length = sizeof(address);
+    if (socket_ == INVALID_SOCKET ||
+      bind(socket_, (sockaddr*)&address, sizeof(address)) != 0 ||
+      listen(socket_, 1) != 0 ||
+      getsockname(socket_, (sockaddr*)&address, &length) != 0) {
+      return false;
+    }
+    port_ = ntohs(address.sin_port);
+    SOCKET listening = socket_;
+    thread_ = std::thread([listening] {
+      SOCKET connection;
+      // Ends when the listening socket is closed.
+      while ((connection = accept(listening, nullptr, nullptr)) !=
+        INVALID_SOCKET) {
+        char buffer[64 * 1024];
+        while (recv(connection, buffer, sizeof(buffer), 0) > 0) {
+        }
+        closesocket(connection);
+      }
+    });
+    return true;
+  }
+
+  int port() const { return port_; }
+
+ private:
+  SOCKET socket_;
+  int port_;
+  std::thread thread_;
+};
+
+// Threads and factory of the PeerConnections, shared by the calls as in
+// an app, with the Media Foundation H.264 codecs.
+class CallFactory {
+ public:
+  bool Create() {
+    network_ = rtc::Thread::CreateWithSocketServer();
+    worker_ = rtc::Thread::Create();
+    signaling_ = rtc::Thread::Create();
+    if (!network_->Start() || !worker_->Start() || !signaling_->Start()) {
+      return false;
+    }
+    // Sampled under the names the app uses.
+    for (auto& thread : { std::make_pair(network_.get(), "WebRtcNetwork"),
+      std::make_pair(worker_.get(), "WebRtcWorker"),
+      std::make_pair(signaling_.get(), "WebRtcSignaling") }) {
+      const char* name = thread.second;
+      thread.first->Invoke<void>(RTC_FROM_HERE, [name] {
+        ResourceSampler::RegisterCurrentThread(name);
+      });
+    }
+    factory_ = CreatePeerConnectionFactory(network_.get(), worker_.get(),
+      signaling_.get(), nullptr, new WinUWPH264EncoderFactory(),
+      new WinUWPH264DecoderFactory());
+    return factory_ != nullptr;
+  }
+
+  PeerConnectionFactoryInterface* factory() const { return factory_.get(); }
+
+ private:
+  std::unique_ptr<rtc::Thread> network_;
+  std::unique_ptr<rtc::Thread> worker_;
+  std::unique_ptr<rtc::Thread> signaling_;
+  rtc::scoped_refptr<PeerConnectionFactoryInterface> factory_;
+};
+
+class NullPeerConnectionObserver : public PeerConnectionObserver {
+ public:
+  void OnSignalingChange(
+    PeerConnectionInterface::SignalingState new_state) override {}
+  void OnAddStream(rtc::scoped_refptr<MediaStreamInterface> stream) override {}
+  void OnRemoveStream(
+    rtc::scoped_refptr<MediaStreamInterface> stream) override {}
+  void OnDataChannel(
+    rtc::scoped_refptr<DataChannelInterface> data_channel) override {}
+  void OnRenegotiationNeeded() override {}
+  void OnIceConnectionChange(
+    PeerConnectionInterface::IceConnectionState new_state) override {}
+  void OnIceGatheringChange(
+    PeerConnectionInterface::IceGatheringState new_state) override {}
+  void OnIceCandidate(const IceCandidateInterface* candidate) override {}
+};
+
+// The reports of a call with an audio and a video stream each way, about
+// the size of what the stats observer polls.
+std::vector<std::unique_ptr<StatsReport>> MakeStatsReports() {
+  std::vector<std::unique_ptr<StatsReport>> reports;
+  const double timestamp = 1.5e12;
+  for (int i = 0; i < 4; ++i) {
+    std::unique_ptr<StatsReport> report(new StatsReport(
+      StatsReport::NewTypedId(StatsReport::kStatsReportTypeSsrc,
+        std::to_string(1000 + i))));
+    report->set_timestamp(timestamp);
+    report->AddString(StatsReport::kStatsValueNameMediaType,
+      i % 2 == 0 ? "audio" : "video");
+    report->AddString(StatsReport::kStatsValueNameCodecName, "H264");
+    report->AddInt64(StatsReport::kStatsValueNameBytesSent, 123456789);
+    report->AddInt64(StatsReport::kStatsValueNameBytesReceived, 987654321);
+    report->AddInt(StatsReport::kStatsValueNamePacketsSent, 123456);
+    report->AddInt(StatsReport::kStatsValueNamePacketsReceived, 654321);
+    report->AddInt(StatsReport::kStatsValueNamePacketsLost, 12);
+    report->AddInt(StatsReport::kStatsValueNameJitterReceived, 8);
+    report->AddInt(StatsReport::kStatsValueNameFrameWidthSent, 1280);
+    report->AddInt(StatsReport::kStatsValueNameFrameHeightSent, 720);
+    report->AddInt(StatsReport::kStatsValueNameFrameRateSent, 30);
+    report->AddInt(StatsReport::kStatsValueNameFrameRateOutput, 30);
+    report->AddInt(StatsReport::kStatsValueNameAvgEncodeMs, 6);
+    report->AddInt(StatsReport::kStatsValueNameDecodeMs, 4);
+    report->AddFloat(StatsReport::kStatsValueNameAudioOutputLevel, 0.5f);
+    report->AddBoolean(StatsReport::kStatsValueNameTypingNoiseState, false);
+    reports.push_back(std::move(report));
+  }
+  for (int i = 0; i < 4; ++i) {
+    std::unique_ptr<StatsReport> report(new StatsReport(
+      StatsReport::NewCandidatePairId(std::to_string(i), i)));
+    report->set_timestamp(timestamp);
+    report->AddBoolean(StatsReport::kStatsValueNameActiveConnection, i == 0);
+    report->AddInt64(StatsReport::kStatsValueNameBytesSent, 123456789);
+    report->AddInt64(StatsReport::kStatsValueNameBytesReceived, 987654321);
+    report->AddInt64(StatsReport::kStatsValueNameRtt, 45);
+    report->AddString(StatsReport::kStatsValueNameLocalAddress,
+      "192.168.1.10:50000");
+    report->AddString(StatsReport::kStatsValueNameRemoteAddress,
+      "203.0.113.20:3478");
+    reports.push_back(std::move(report));
+  }
+  std::unique_ptr<StatsReport> bwe(
+    new StatsReport(StatsReport::NewBandwidthEstimationId()));
+  bwe->set_timestamp(timestamp);
+  bwe->AddInt(StatsReport::kStatsValueNameAvailableSendBandwidth, 2500000);
+  bwe->AddInt(StatsReport::kStatsValueNameAvailableReceiveBandwidth, 2500000);
+  bwe->AddInt(StatsReport::kStatsValueNameTargetEncBitrate, 2000000);
+  bwe->AddInt(StatsReport::kStatsValueNameActualEncBitrate, 1900000);
+  reports.push_back(std::move(bwe));
+  return reports;
+}
+
+void RunStatsBenchmarks(BenchmarkRunner* runner) {
+  const char* const kNames[] = {
+    "WebRTCStatsNetworkSender.ProcessStats/json",
+    "WebRTCStatsNetworkSender.ProcessStats/binary",
+  };
+  if (!runner->ShouldRun(kNames[0]) && !runner->ShouldRun(kNames[1])) {
+    return;
+  }
+
+  // The sender only takes the reports of a PeerConnection, used as a key.
+  CallFactory factory;
+  NullPeerConnectionObserver observer;
+  rtc::scoped_refptr<PeerConnectionInterface> pci = !factory.Create() ?
+    nullptr : factory.factory()->CreatePeerConnection(
+      PeerConnectionInterface::RTCConfiguration(), nullptr, nullptr, nullptr,
+      &observer);
+  if (pci == nullptr) {
+    fprintf(stderr, "No PeerConnection, skipping the stats benchmarks\n");
+    return;
+  }
+
+  std::vector<std::unique_ptr<StatsReport>> reportObjects = MakeStatsReports();
+  StatsReports reports;
+  for (const auto& report : reportObjects) {
+    reports.push_back(report.get());
+  }
+
+  const StatsNetworkFormat kFormats[] = {
+    kStatsNetworkFormatJson, kStatsNetworkFormatBinary };
+  for (int i = 0; i < 2; ++i) {
+    if (!runner->ShouldRun(kNames[i])) {
+      continue;
+    }
+    DiscardServer server;
+    WebRTCStatsNetworkSender sender;
+    if (!server.Start() ||
+      !sender.Start("127.0.0.1", server.port(), kFormats[i])) {
+      fprintf(stderr, "Stats sender not started, skipping %s\n", kNames[i]);
+      continue;
+    }
+    // The binary reports are only queued once connected.
+    int64_t deadlineMs = rtc::TimeMillis() + 5000;
+    while (!sender.ProcessStats(reports, pci) &&
+      rtc::TimeMillis() < deadlineMs) {
+      rtc::Thread::SleepMs(10);
+    }
+    runner->Run(kNames[i], 2000, 1, [&sender, &reports, &pci] {
+      return sender.ProcessStats(reports, pci);
+    });
+    sender.Stop();
+  }
+  pci->Close();
+}
+
+// Waits for the frames of the encoder, one at a time.
+class EncodedFrameWaiter : public EncodedImageCallback {
+ public:
+  EncodedFrameWaiter() : encoded_(false, false), expectedTimestamp_(0) {}
+
+  void Expect(uint32_t rtpTimestamp) {
+    expectedTimestamp_ = rtpTimestamp;
+    encoded_.Reset();
+  }
+  bool Wait() { return encoded_.Wait(2000); }
+
+  Result OnEncodedImage(const EncodedImage& encoded_image,
+    const CodecSpecificInfo* codec_specific_info,
+    const RTPFragmentationHeader* fragmentation) override {
+    if (encoded_image._timeStamp == expectedTimestamp_) {
+      encoded_.Set();
+    }
+    return Result(Result::OK);
+  }
+
+ private:
+  rtc::Event encoded_;
+  std::atomic<uint32_t> expectedTimestamp_;
+};
+
+// From the I420 frame to the frame delivered by the encoder, one frame
+// in flight.  A frame dropped by the encoder counts as a failure.
+void RunEncoderBenchmarks(BenchmarkRunner* runner) {
+  for (const Resolution& resolution : kResolutions) {
+    std::string name = std::string("H264Encoder.Encode/") + resolution.name;
+    if (!runner->ShouldRun(name)) {
+      continue;
+    }
+    VideoCodec codec;
+    codec.codecType = kVideoCodecH264;
+    codec.width = static_cast<uint16_t>(resolution.width);
+    codec.height = static_cast<uint16_t>(resolution.height);
+    codec.startBitrate = codec.targetBitrate = codec.maxBitrate =
+      static_cast<unsigned int>(resolution.frameBytes * 8 * 30 / 1024);
+    codec.maxFramerate = 30;
+    codec.mode = kRealtimeVideo;
+
+    WinUWPH264EncoderImpl encoder;
+    EncodedFrameWaiter waiter;
+    if (encoder.InitEncode(&codec, 1, 1200) != WEBRTC_VIDEO_CODEC_OK) {
+      fprintf(stderr, "Encoder not initialized, skipping %s\n", name.c_str());
+      continue;
+    }
+    encoder.RegisterEncodeCompleteCallback(&waiter);
+
+    // A few frames with moving content, converted ahead of time.
+    std::vector<rtc::scoped_refptr<I420Buffer>> buffers;
+    for (int i = 0; i < 8; ++i) {
+      rtc::scoped_refptr<I420Buffer> buffer =
+        I420Buffer::Create(resolution.width, resolution.height);
+      for (int y = 0; y < resolution.height; ++y) {
+        uint8_t* row = buffer->MutableDataY() + y * buffer->StrideY();
+        for (int x = 0; x < resolution.width; ++x) {
+          row[x] = static_cast<uint8_t>(x + y + i * 8);
+        }
+      }
+      memset(buffer->MutableDataU(), 128,
+        buffer->StrideU() * ((resolution.height + 1) / 2));
+      memset(buffer->MutableDataV(), 128,
+        buffer->StrideV() * ((resolution.height + 1) / 2));
+      buffers.push_back(buffer);
+    }
+
+    uint32_t rtpTimestamp = 0;
+    size_t frameIndex = 0;
+    runner->Run(name, 300, 1, [&] {
+      rtpTimestamp += 90000 / 30;
+      VideoFrame frame(buffers[frameIndex++ % buffers.size()], rtpTimestamp,
+        rtc::TimeMillis(), kVideoRotation_0);
+      waiter.Expect(rtpTimestamp);
+      return encoder.Encode(frame, nullptr, nullptr) == WEBRTC_VIDEO_CODEC_OK &&
+        waiter.Wait();
+    });
+    encoder.Release();
+  }
+}
+
+// = Loopback calls ============================================================
+
+const int kCallWidth = 1280;
+const int kCallHeight = 720;
+const int kCallFps = 30;
+
+// Frames of a moving pattern stamped with their number and the time
+// they were generated, see WriteFrameStamp().
+class TestPatternSource : public rtc::AdaptedVideoTrackSource {
+ public:
+  TestPatternSource() : running_(false), framesGenerated_(0) {}
+  ~TestPatternSource() override { Stop(); }
+
+  void Start() {
+    running_ = true;
+    thread_ = std::thread([this] { Run(); });
+  }
+  void Stop() {
+    running_ = false;
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+  uint32_t frames_generated() const { return framesGenerated_; }
+
+  // VideoTrackSourceInterface
+  SourceState state() const override { return kLive; }
+  bool remote() const override { return false; }
+  bool is_screencast() const override { return false; }
+  rtc::Optional<bool> needs_denoising() const override {
+    return rtc::Optional<bool>(false);
+  }
+
+ private:
+  void Run() {
+    int64_t nextFrameUs = rtc::TimeMicros();
+    while (running_) {
+      uint32_t frameId = framesGenerated_++;
+      int64_t timeUs = rtc::TimeMicros();
+      int width, height, cropWidth, cropHeight, cropX, cropY;
+      // Drawn at the size the sinks want, nothing to crop or scale.
+      if (AdaptFrame(kCallWidth, kCallHeight, timeUs, &width, &height,
+        &cropWidth, &cropHeight, &cropX, &cropY)) {
+        rtc::scoped_refptr<I420Buffer> buffer =
+          bufferPool_.CreateBuffer(width, height);
+        for (int y = 0; y < height; ++y) {
+          uint8_t* line = buffer->MutableDataY() + y * buffer->StrideY();
+          for (int x = 0; x < width; ++x) {
+            line[x] = static_cast<uint8_t>(64 + ((x + y + frameId * 4) & 0x7f));
+          }
+        }
+        memset(buffer->MutableDataU(), 128,
+          buffer->StrideU() * ((height + 1) / 2));
+        memset(buffer->MutableDataV(), 128,
+          buffer->StrideV() * ((height + 1) / 2));
+        Org::WebRtc::Internal::WriteFrameStamp(buffer.get(), frameId,
+          static_cast<uint32_t>(rtc::TimeMillis()));
+        OnFrame(VideoFrame(buffer, kVideoRotation_0, timeUs));
+      }
+      nextFrameUs += rtc::kNumMicrosecsPerSec / kCallFps;
+      int64_t waitUs = nextFrameUs - rtc::TimeMicros();
+      if (waitUs > 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(waitUs));
+      }
+    }
+  }
+
+  std::atomic<bool> running_;
+  std::atomic<uint32_t> framesGenerated_;
+  I420BufferPool bufferPool_;
+  std::thread thread_;
+};
+
+class CreateDescriptionObserver : public CreateSessionDescriptionObserver {
+ public:
+  explicit CreateDescriptionObserver(
+    std::function<void(SessionDescriptionInterface*)> onSuccess)
+    : onSuccess_(onSuccess) {}
+
+  void OnSuccess(SessionDescriptionInterface* desc) override {
+    onSuccess_(desc);
+  }
+  void OnFailure(const std::string& error) override {
+    fprintf(stderr, "Creating a description failed: %s\n", error.c_str());
+  }
+
+ private:
+  std::function<void(SessionDescriptionInterface*)> onSuccess_;
+};
+
+class SetDescriptionObserver : public SetSessionDescriptionObserver {
+ public:
+  explicit SetDescriptionObserver(std::function<void()> onSuccess)
+    : onSuccess_(onSuccess) {}
+
+  void OnSuccess() override { onSuccess_(); }
+  void OnFailure(const std::string& error) override {
+    fprintf(stderr, "Setting a description failed: %s\n", error.c_str());
+  }
+
+ private:
+  std::function<void()> onSuccess_;
+};
+
+// Moves the payload types of |codec| to the front of the video m-line,
+// the other end then picks it.
+std::string PreferVideoCodec(const std::string& sdp, const std::string& codec) {
+  std::vector<std::string> lines;
+  for (size_t start = 0; start < sdp.size();) {
+    size_t end = sdp.find("\r\n", start);
+    if (end == std::string::npos) {
+      end = sdp.size();
+    }
+    lines.push_back(sdp.substr(start, end - start));
+    start = end + 2;
+  }
+  int videoLine = -1;
+  std::vector<std::string> preferred;
+  for (size_t i = 0; i < lines.size(); ++i) {
+    const std::string& line = lines[i];
+    if (line.compare(0, 2, "m=") == 0) {
+      if (videoLine >= 0) {
+        break;
+      }
+      if (line.compare(0, 8, "m=video ") == 0) {
+        videoLine = static_cast<int>(i);
+      }
+    } else if (videoLine >= 0 && line.compare(0, 9, "a=rtpmap:") == 0 &&
+      line.find(" " + codec + "/") != std::string::npos) {
+      preferred.push_back(line.substr(9, line.find(' ') - 9));
+    }
+  }
+  if (preferred.empty()) {
+    return sdp;
+  }
+  // m=video <port> <proto> <payload types>
+  std::istringstream fields(lines[videoLine]);
+  std::vector<std::string> mline;
+  std::string field;
+  while (fields >> field) {
+    mline.push_back(field);
+  }
+  std::string reordered = mline[0] + " " + mline[1] + " " + mline[2];
+  for (const std::string& payloadType : preferred) {
+    reordered += " " + payloadType;
+  }
+  for (size_t i = 3; i < mline.size(); ++i) {
+    if (std::find(preferred.begin(), preferred.end(), mline[i]) ==
+      preferred.end()) {
+      reordered += " " + mline[i];
+    }
+  }
+  lines[videoLine] = reordered;
+  std::string munged;
+  for (const std::string& line : lines) {
+    if (!line.empty()) {
+      munged += line + "\r\n";
+    }
+  }
+  return munged;
+}
+
+// One end of a loopback call.  The signaling is in memory: the
+// descriptions and the candidates are handed to the other end, on the
+// signaling thread both ends share.
+class CallEndpoint : public PeerConnectionObserver {
+ public:
+  explicit CallEndpoint(Org::WebRtc::Internal::LatencySink* sink)
+    : remote(nullptr), connected(false), sink_(sink),
+    remoteDescriptionSet_(false) {}
+
+  void SetRemoteDescription(const std::string& type, const std::string& sdp,
+    std::function<void()> done) {
+    pc->SetRemoteDescription(new rtc::RefCountedObject<SetDescriptionObserver>(
+      [this, done] {
+        remoteDescriptionSet_ = true;
+        for (const auto& candidate : pendingCandidates_) {
+          pc->AddIceCandidate(candidate.get());
+        }
+        pendingCandidates_.clear();
+        done();
+      }), CreateSessionDescription(type, sdp, nullptr));
+  }
+
+  // PeerConnectionObserver
+  void OnSignalingChange(
+    PeerConnectionInterface::SignalingState new_state) override {}
+  void OnAddStream(rtc::scoped_refptr<MediaStreamInterface> stream) override {
+    VideoTrackVector tracks = stream->GetVideoTracks();
+    if (sink_ != nullptr && !tracks.empty()) {
+      tracks[0]->AddOrUpdateSink(sink_, rtc::VideoSinkWants());
+    }
+  }
+  void OnRemoveStream(
+    rtc::scoped_refptr<MediaStreamInterface> stream) override {}
+  void OnDataChannel(
+    rtc::scoped_refptr<DataChannelInterface> data_channel) override {}
+  void OnRenegotiationNeeded() override {}
+  void OnIceConnectionChange(
+    PeerConnectionInterface::IceConnectionState new_state) override {
+    connected = new_state == PeerConnectionInterface::kIceConnectionConnected ||
+      new_state == PeerConnectionInterface::kIceConnectionCompleted;
+  }
+  void OnIceGatheringChange(
+    PeerConnectionInterface::IceGatheringState new_state) override {}
+  void OnIceCandidate(const IceCandidateInterface* candidate) override {
+    std::string sdp;
+    if (!candidate->ToString(&sdp)) {
+      return;
+    }
+    std::unique_ptr<IceCandidateInterface> copy(CreateIceCandidate(
+      candidate->sdp_mid(), candidate->sdp_mline_index(), sdp, nullptr));
+    if (copy != nullptr) {
+      remote->AddRemoteCandidate(std::move(copy));
+    }
+  }
+
+  rtc::scoped_refptr<PeerConnectionInterface> pc;
+  CallEndpoint* remote;
+  std::atomic<bool> connected;
+
+ private:
+  // The candidates arriving before the remote description wait for it.
+  void AddRemoteCandidate(std::unique_ptr<IceCandidateInterface> candidate) {
+    if (remoteDescriptionSet_) {
+      pc->AddIceCandidate(candidate.get());
+    } else {
+      pendingCandidates_.push_back(std::move(candidate));
+    }
+  }
+
+  Org::WebRtc::Internal::LatencySink* sink_;
+  // On the signaling thread.
+  bool remoteDescriptionSet_;
+  std::vector<std::unique_ptr<IceCandidateInterface>> pendingCandidates_;
+};
+
+struct LoopbackCall {
+  LoopbackCall() : sink(true), caller(nullptr), callee(&sink) {
+    caller.remote = &callee;
+    callee.remote = &caller;
+  }
+
+  rtc::scoped_refptr<TestPatternSource> source;
+  Org::WebRtc::Internal::LatencySink sink;
+  CallEndpoint caller;
+  CallEndpoint callee;
+  uint32_t firstFrame;
+};
+
+bool StartLoopbackCall(PeerConnectionFactoryInterface* factory,
+  LoopbackCall* call) {
+  PeerConnectionInterface::RTCConfiguration config;
+  call->caller.pc = factory->CreatePeerConnection(config, nullptr, nullptr,
+    nullptr, &call->caller);
+  call->callee.pc = factory->CreatePeerConnection(config, nullptr, nullptr,
+    nullptr, &call->callee);
+  if (call->caller.pc == nullptr || call->callee.pc == nullptr) {
+    return false;
+  }
+  call->source = new rtc::RefCountedObject<TestPatternSource>();
+  rtc::scoped_refptr<MediaStreamInterface> stream =
+    factory->CreateLocalMediaStream("pattern");
+  stream->AddTrack(factory->CreateVideoTrack("pattern_video", call->source));
+  call->caller.pc->AddStream(stream);
+
+  CallEndpoint* caller = &call->caller;
+  CallEndpoint* callee = &call->callee;
+  caller->pc->CreateOffer(new rtc::RefCountedObject<CreateDescriptionObserver>(
+    [caller, callee](SessionDescriptionInterface* offer) {
+      std::string sdp;
+      offer->ToString(&sdp);
+      delete offer;
+      sdp = PreferVideoCodec(sdp, "H264");
+      caller->pc->SetLocalDescription(
+        new rtc::RefCountedObject<SetDescriptionObserver>([] {}),
+        CreateSessionDescription(SessionDescriptionInterface::kOffer, sdp,
+          nullptr));
+      callee->SetRemoteDescription(SessionDescriptionInterface::kOffer, sdp,
+        [caller, callee] {
+        callee->pc->CreateAnswer(
+          new rtc::RefCountedObject<CreateDescriptionObserver>(
+            [caller, callee](SessionDescriptionInterface* answer) {
+          std::string sdp;
+          answer->ToString(&sdp);
+          callee->pc->SetLocalDescription(
+            new rtc::RefCountedObject<SetDescriptionObserver>([] {}), answer);
+          caller->SetRemoteDescription(SessionDescriptionInterface::kAnswer,
+            sdp, [] {});
+        }), PeerConnectionInterface::RTCOfferAnswerOptions());
+      });
+    }), PeerConnectionInterface::RTCOfferAnswerOptions());
+  return true;
+}
+
+// |callCount| calls of 720p at 30 fps over loopback in the process, for
+// the latency from generation to rendering, the frames lost and the CPU
+// used.  The calls run together, to find how many the process holds.
+// Not a timed loop like the others, the result has its own fields:
+// {"name":"LoopbackCall/2x720p","calls":2,"seconds":20,"framesSent":...,
+// "framesReceived":...,"framesMissing":...,"invalidStamps":...,
+// "receivedFpsPerCall":...,"latencyMs":{"mean":...,"p50":...,"p90":...,
+// "p99":...,"max":...},"processCpu":...,"threadCpu":{"WebRtcWorker":...}}
+void RunLoopbackCallBenchmark(BenchmarkRunner* runner, int callCount,
+  int seconds) {
+  std::string name = "LoopbackCall/" + std::to_string(callCount) + "x720p";
+  if (!runner->ShouldRun(name)) {
+    return;
+  }
+  CallFactory factory;
+  if (!factory.Create()) {
+    fprintf(stderr, "No PeerConnection factory, skipping %s\n", name.c_str());
+    return;
+  }
+  std::vector<std::unique_ptr<LoopbackCall>> calls;
+  for (int i = 0; i < callCount; ++i) {
+    std::unique_ptr<LoopbackCall> call(new LoopbackCall());
+    if (!StartLoopbackCall(factory.factory(), call.get())) {
+      fprintf(stderr, "Call %d not started, skipping %s\n", i, name.c_str());
+      return;
+    }
+    calls.push_back(std::move(call));
+  }
+  int64_t deadlineMs = rtc::TimeMillis() + 10000;
+  auto allConnected = [&calls] {
+    for (const auto& call : calls) {
+      if (!call->caller.connected || !call->callee.connected) {
+        return false;
+      }
+    }
+    return true;
+  };
+  while (!allConnected() && rtc::TimeMillis() < deadlineMs) {
+    rtc::Thread::SleepMs(50);
+  }
+  if (!allConnected()) {
+    fprintf(stderr, "Calls not connected, skipping %s\n", name.c_str());
+    return;
+  }
+
+  for (const auto& call : calls) {
+    call->source->Start();
+  }
+  // The encoders ramp up and the jitter buffers fill first.
+  rtc::Thread::SleepMs(3000);
+  for (const auto& call : calls) {
+    call->sink.Reset();
+    call->firstFrame = call->source->frames_generated();
+  }
+  ResourceSampler* sampler = ResourceSampler::Instance();
+  sampler->Start(1000);
+  int cpuSamples = 0;
+  double processCpu = 0;
+  std::map<std::string, double> threadCpu;
+  int64_t lastSampleMs = 0;
+  int64_t endMs = rtc::TimeMillis() + seconds * 1000;
+  while (rtc::TimeMillis() < endMs) {
+    rtc::Thread::SleepMs(250);
+    ResourceUsage usage = sampler->GetLastUsage();
+    if (usage.timestampMs == 0 || usage.timestampMs == lastSampleMs) {
+      continue;
+    }
+    lastSampleMs = usage.timestampMs;
+    ++cpuSamples;
+    processCpu += usage.processCpuUsage;
+    for (const auto& thread : usage.threadCpuUsage) {
+      threadCpu[thread.first] += thread.second;
+    }
+  }
+  sampler->Stop();
+
+  uint64_t framesSent = 0;
+  uint64_t framesReceived = 0;
+  uint64_t framesMissing = 0;
+  uint64_t invalidStamps = 0;
+  std::vector<uint32_t> latenciesMs;
+  for (const auto& call : calls) {
+    call->source->Stop();
+    framesSent += call->source->frames_generated() - call->firstFrame;
+    rtc::CritScope lock(&call->sink.critSect);
+    framesReceived += call->sink.framesReceived;
+    framesMissing += call->sink.framesMissing;
+    invalidStamps += call->sink.invalidStamps;
+    latenciesMs.insert(latenciesMs.end(), call->sink.latenciesMs.begin(),
+      call->sink.latenciesMs.end());
+  }
+  for (const auto& call : calls) {
+    call->caller.pc->Close();
+    call->callee.pc->Close();
+  }
+
+  std::ostringstream result;
+  result << "{\"name\":\"" << name << "\""
+    << ",\"calls\":" << callCount
+    << ",\"seconds\":" << seconds
+    << ",\"framesSent\":" << framesSent
+    << ",\"framesReceived\":" << framesReceived
+    << ",\"framesMissing\":" << framesMissing
+    << ",\"invalidStamps\":" << invalidStamps
+    << ",\"receivedFpsPerCall\":"
+    << (double)framesReceived / seconds / callCount;
+  if (!latenciesMs.empty()) {
+    std::sort(latenciesMs.begin(), latenciesMs.end());
+    uint64_t totalMs = 0;
+    for (uint32_t latencyMs : latenciesMs) {
+      totalMs += latencyMs;
+    }
+    auto percentile = [&latenciesMs](int percent) {
+      size_t rank = (latenciesMs.size() * percent + 99) / 100;
+      return latenciesMs[std::max<size_t>(rank, 1) - 1];
+    };
+    result << ",\"latencyMs\":{\"mean\":"
+      << (double)totalMs / latenciesMs.size()
+      << ",\"p50\":" << percentile(50)
+      << ",\"p90\":" << percentile(90)
+      << ",\"p99\":" << percentile(99)
+      << ",\"max\":" << latenciesMs.back() << "}";
+  }
+  if (cpuSamples > 0) {
+    result << ",\"processCpu\":" << processCpu / cpuSamples
+      << ",\"threadCpu\":{";
+    bool first = true;
+    for (const auto& thread : threadCpu) {
+      result << (first ? "" : ",") << "\"" << thread.first << "\":"
+        << thread.second / cpuSamples;
+      first = false;
+    }
+    result << "}";
+  }
+  result << "}";
+  runner->AddResult(result.str());
+}
+
+}  // namespace
+
+}  // namespace webrtc
+
+int main(int argc, char* argv[]) {
+  std::string filter;
+  std::string output;
+  int scale = 1;
+  int calls = 1;
+  int callSeconds = 20;
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    if (strncmp(arg, "--filter=", 9) == 0) {
+      filter = arg + 9;
+    } else if (strncmp(arg, "--scale=", 8) == 0) {
+      scale = atoi(arg + 8);
+    } else if (strncmp(arg, "--output=", 9) == 0) {
+      output = arg + 9;
+    } else if (strncmp(arg, "--calls=", 8) == 0) {
+      calls = std::max(atoi(arg + 8), 1);
+    } else if (strncmp(arg, "--call-seconds=", 15) == 0) {
+      callSeconds = std::max(atoi(arg + 15), 1);
+    } else {
+      fprintf(stderr, "Usage: %s [--filter=<text>] [--scale=<n>] "
+        "[--output=<path>] [--calls=<n>] [--call-seconds=<n>]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  WSADATA wsaData;
+  WSAStartup(MAKEWORD(2, 2), &wsaData);
+  CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+  MFStartup(MF_VERSION);
+  rtc::InitializeSSL();
+  webrtc::SetPipelineStageTimingEnabled(true);
+
+  webrtc::BenchmarkRunner runner(filter, scale);
+  webrtc::RunNalScannerBenchmarks(&runner);
+  webrtc::RunSampleAttributeQueueBenchmarks(&runner);
+  webrtc::RunStatsBenchmarks(&runner);
+  webrtc::RunEncoderBenchmarks(&runner);
+  webrtc::RunLoopbackCallBenchmark(&runner, calls, callSeconds);
+
+  std::string json =
+    runner.ToJson(webrtc::GetPipelineStageTimingsJson(true)) + "\n";
+  FILE* file = output.empty() ? stdout : fopen(output.c_str(), "w");
+  if (file == nullptr) {
+    fprintf(stderr, "Can't write %s\n", output.c_str());
+    return 1;
+  }
+  fputs(json.c_str(), file);
+  if (file != stdout) {
+    fclose(file);
+  }
+
+  rtc::CleanupSSL();
+  MFShutdown();
+  CoUninitialize();
+  WSACleanup();
+  return 0;
+}
@@ -215,27 +215,29 @@ Remarks:
 #endif
 #endif // MCGEN_DISABLE_PROVIDER_CODE_GENERATION
 //+
-// Provider WebRTCInternals Event Count 7
+// Provider WebRTCInternals Event Count 8
 //+
 EXTERN_C __declspec(selectany) const GUID WebRTCInternalsGUID = {0xbda496d1, 0x3663, 0x4a3e, {0xb0, 0x12, 0x66, 0x2f, 0xf5, 0xdc, 0xcd, 0x62}};
 
 //
 // Event Descriptors
 //
-EXTERN_C __declspec(selectany) const EVENT_DESCRIPTOR StatsReportInt32 = {0x65, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0};
+EXTERN_C __declspec(selectany) const EVENT_DESCRIPTOR StatsReportInt32 = {0x65, 0x0, 0x0, 0x0, 0x0, 0x0, 0x1};
 #define StatsReportInt32_value 0x65
-EXTERN_C __declspec(selectany) const EVENT_DESCRIPTOR StatsReportInt64 = {0x66, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0};
+EXTERN_C __declspec(selectany) const EVENT_DESCRIPTOR StatsReportInt64 = {0x66, 0x0, 0x0, 0x0, 0x0, 0x0, 0x1};
 #define StatsReportInt64_value 0x66
-EXTERN_C __declspec(selectany) const EVENT_DESCRIPTOR StatsReportFloat = {0x67, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0};
+EXTERN_C __declspec(selectany) const EVENT_DESCRIPTOR StatsReportFloat = {0x67, 0x0, 0x0, 0x0, 0x0, 0x0, 0x1};
 #define StatsReportFloat_value 0x67
-EXTERN_C __declspec(selectany) const EVENT_DESCRIPTOR StatsReportString = {0x68, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0};
+EXTERN_C __declspec(selectany) const EVENT_DESCRIPTOR StatsReportString = {0x68, 0x0, 0x0, 0x0, 0x0, 0x0, 0x1};
 #define StatsReportString_value 0x68
-EXTERN_C __declspec(selectany) const EVENT_DESCRIPTOR StatsReportBool = {0x69, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0};
+EXTERN_C __declspec(selectany) const EVENT_DESCRIPTOR StatsReportBool = {0x69, 0x0, 0x0, 0x0, 0x0, 0x0, 0x1};
 #define StatsReportBool_value 0x69
 EXTERN_C __declspec(selectany) const EVENT_DESCRIPTOR Command = {0x6a, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0};
 #define Command_value 0x6a
 EXTERN_C __declspec(selectany) const EVENT_DESCRIPTOR Mark = {0x6b, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0};
 #define Mark_value 0x6b
+EXTERN_C __declspec(selectany) const EVENT_DESCRIPTOR StatsReportPacked = {0x6c, 0x0, 0x0, 0x0, 0x0, 0x0, 0x2};
+#define StatsReportPacked_value 0x6c
 
 //
 // Note on Generate Code from Manifest for Windows Vista and above
@@ -265,9 +267,9 @@ EXTERN_C __declspec(selectany) const EVENT_DESCRIPTOR Mark = {0x6b, 0x0, 0x0, 0x
 //
 
 EXTERN_C __declspec(selectany) DECLSPEC_CACHEALIGN ULONG WebRTCInternalsEnableBits[1];
-EXTERN_C __declspec(selectany) const ULONGLONG WebRTCInternalsKeywords[1] = {0x0};
-EXTERN_C __declspec(selectany) const UCHAR WebRTCInternalsLevels[1] = {0};
-EXTERN_C __declspec(selectany) MCGEN_TRACE_CONTEXT WebRTCInternalsGUID_Context = {0, 0, 0, 0, 0, 0, 0, 0, 1, WebRTCInternalsEnableBits, WebRTCInternalsKeywords, WebRTCInternalsLevels};
+EXTERN_C __declspec(selectany) const ULONGLONG WebRTCInternalsKeywords[3] = {0x1, 0x0, 0x2};
+EXTERN_C __declspec(selectany) const UCHAR WebRTCInternalsLevels[3] = {0, 0, 0};
+EXTERN_C __declspec(selectany) MCGEN_TRACE_CONTEXT WebRTCInternalsGUID_Context = {0, 0, 0, 0, 0, 0, 0, 0, 3, WebRTCInternalsEnableBits, WebRTCInternalsKeywords, WebRTCInternalsLevels};
 
 EXTERN_C __declspec(selectany) REGHANDLE WebRTCInternalsHandle = (REGHANDLE)0;
 
@@ -441,7 +443,7 @@ Remarks:
 // Enablement check macro for Command
 //
 
-#define EventEnabledCommand() ((WebRTCInternalsEnableBits[0] & 0x00000001) != 0)
+#define EventEnabledCommand() ((WebRTCInternalsEnableBits[0] & 0x00000002) != 0)
 
 //
 // Event Macro for Command
@@ -455,7 +457,7 @@ Remarks:
 // Enablement check macro for Mark
 //
 
-#define EventEnabledMark() ((WebRTCInternalsEnableBits[0] & 0x00000001) != 0)
+#define EventEnabledMark() ((WebRTCInternalsEnableBits[0] & 0x00000002) != 0)
 
 //
 // Event Macro for Mark
@@ -465,6 +467,20 @@ Remarks:
         Template_sg(WebRTCInternalsHandle, &Mark, mark_name, timestamp)\
         : ERROR_SUCCESS\
 
+//
+// Enablement check macro for StatsReportPacked
+//
+
+#define EventEnabledStatsReportPacked() ((WebRTCInternalsEnableBits[0] & 0x00000004) != 0)
+
+//
+// Event Macro for StatsReportPacked
+//
+#define EventWriteStatsReportPacked(stat_group_name, timestamp, stat_count, stat_values)\
+        EventEnabledStatsReportPacked() ?\
+        Template_sgqs(WebRTCInternalsHandle, &StatsReportPacked, stat_group_name, timestamp, stat_count, stat_values)\
+        : ERROR_SUCCESS\
+
 #endif // MCGEN_DISABLE_PROVIDER_CODE_GENERATION
 
 
@@ -658,6 +674,42 @@ Template_sgst(
 }
 #endif
 
+//
+//Template from manifest : T_StatsReportPacked
+//
+#ifndef Template_sgqs_def
+#define Template_sgqs_def
+ETW_INLINE
+ULONG
+Template_sgqs(
+    _In_ REGHANDLE RegHandle,
+    _In_ PCEVENT_DESCRIPTOR Descriptor,
+    _In_opt_ LPCSTR  _Arg0,
+    _In_ const double  _Arg1,
+    _In_ const unsigned int  _Arg2,
+    _In_opt_ LPCSTR  _Arg3
+    )
+{
+#define ARGUMENT_COUNT_sgqs 4
+
+    EVENT_DATA_DESCRIPTOR EventData[ARGUMENT_COUNT_sgqs];
+
+    EventDataDescCreate(&EventData[0], 
+                        (_Arg0 != NULL) ? _Arg0 : "NULL",
+                        (_Arg0 != NULL) ? (ULONG)((strlen(_Arg0) + 1) * sizeof(CHAR)) : (ULONG)sizeof("NULL"));
+
+    EventDataDescCreate(&EventData[1], &_Arg1, sizeof(const double)  );
+
+    EventDataDescCreate(&EventData[2], &_Arg2, sizeof(const unsigned int)  );
+
+    EventDataDescCreate(&EventData[3], 
+                        (_Arg3 != NULL) ? _Arg3 : "NULL",
+                        (_Arg3 != NULL) ? (ULONG)((strlen(_Arg3) + 1) * sizeof(CHAR)) : (ULONG)sizeof("NULL"));
+
+    return EventWrite(RegHandle, Descriptor, ARGUMENT_COUNT_sgqs, EventData);
+}
+#endif
+
 //
 //Template from manifest : T_Command
 //
@@ -0,0 +1,256 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#include <string.h>
+
+#include "webrtc_stats_histograms.h"
+#include "webrtc/rtc_base/timeutils.h"
+
+namespace webrtc {
+
+namespace {
+// Reads a value whatever its type, the counters aren't all the same.
+bool GetNumber(const StatsReport* report, StatsReport::StatsValueName name,
+  int64_t* number) {
+  const StatsReport::Value* v = report->FindValue(name);
+  if (!v) {
+    return false;
+  }
+  switch (v->type()) {
+  case StatsReport::Value::kInt:
+    *number = v->int_val();
+    return true;
+  case StatsReport::Value::kInt64:
+    *number = v->int64_val();
+    return true;
+  case StatsReport::Value::kFloat:
+    *number = static_cast<int64_t>(v->float_val() + 0.5f);
+    return true;
+  default:
+    return false;
+  }
+}
+
+void Summarize(const QualityHistogram& histogram,
+  QualityMetricSummary* summary) {
+  summary->count = histogram.count();
+  if (summary->count == 0) {
+    return;
+  }
+  summary->min = histogram.min();
+  summary->max = histogram.max();
+  summary->mean = histogram.Mean();
+  summary->p50 = histogram.Percentile(50);
+  summary->p95 = histogram.Percentile(95);
+  summary->p99 = histogram.Percentile(99);
+}
+}  // namespace
+
+QualityHistogram::QualityHistogram() {
+  Reset();
+}
+
+void QualityHistogram::Reset() {
+  memset(buckets_, 0, sizeof(buckets_));
+  count_ = 0;
+  min_ = 0;
+  max_ = 0;
+  sum_ = 0;
+}
+
+void QualityHistogram::Add(int64_t value) {
+  if (value < 0) {
+    return;
+  }
+  ++buckets_[Buckets::Index(value)];
+  if (count_ == 0 || value < min_) {
+    min_ = value;
+  }
+  if (count_ == 0 || value > max_) {
+    max_ = value;
+  }
+  ++count_;
+  sum_ += value;
+}
+
+double QualityHistogram::Mean() const {
+  return count_ > 0 ? static_cast<double>(sum_) / count_ : 0;
+}
+
+int64_t QualityHistogram::Percentile(int percent) const {
+  if (count_ == 0) {
+    return 0;
+  }
+  return Buckets::Percentile(buckets_, count_, min_, max_, percent);
+}
+
+const char* QualityMetricName(QualityMetric metric) {
+  switch (metric) {
+  case kQualityMetricRtt:
+    return "rttMs";
+  case kQualityMetricJitter:
+    return "jitterMs";
+  case kQualityMetricPacketLoss:
+    return "packetLossPermille";
+  case kQualityMetricSendKbps:
+    return "sendKbps";
+  case kQualityMetricReceiveKbps:
+    return "receiveKbps";
+  case kQualityMetricRenderFps:
+    return "renderFps";
+  case kQualityMetricEncodeMs:
+    return "encodeMs";
+  case kQualityMetricDecodeMs:
+    return "decodeMs";
+  default:
+    return "unknown";
+  }
+}
+
+QualityMetricSummary::QualityMetricSummary() : count(0), min(0), max(0),
+  mean(0), p50(0), p95(0), p99(0) {
+}
+
+QualitySummary::QualitySummary() : timestamp(0), duration_ms(0),
+  is_final(false) {
+}
+
+ConnectionQualityHistograms::ConnectionQualityHistograms() {
+  Reset();
+}
+
+void ConnectionQualityHistograms::Reset() {
+  rtc::CritScope lock(&crit_sect_);
+  for (int i = 0; i < kQualityMetricCount; ++i) {
+    window_[i].Reset();
+    call_[i].Reset();
+  }
+  window_start_ms_ = call_start_ms_ = rtc::TimeMillis();
+  prev_pair_timestamp_ = 0;
+  prev_bytes_sent_ = 0;
+  prev_bytes_received_ = 0;
+  prev_packets_.clear();
+}
+
+void ConnectionQualityHistograms::Add(QualityMetric metric, int64_t value) {
+  window_[metric].Add(value);
+  call_[metric].Add(value);
+}
+
+void ConnectionQualityHistograms::AddCandidatePair(const StatsReport* report) {
+  int64_t value;
+  if (GetNumber(report, StatsReport::kStatsValueNameRtt, &value)) {
+    Add(kQualityMetricRtt, value);
+  }
+  int64_t bytes_sent = 0;
+  int64_t bytes_received = 0;
+  GetNumber(report, StatsReport::kStatsValueNameBytesSent, &bytes_sent);
+  GetNumber(report, StatsReport::kStatsValueNameBytesReceived, &bytes_received);
+  double timestamp = report->timestamp();
+  // The counters go back to 0 when another pair becomes active.
+  if (prev_pair_timestamp_ != 0 && timestamp > prev_pair_timestamp_ &&
+      bytes_sent >= prev_bytes_sent_ &&
+      bytes_received >= prev_bytes_received_) {
+    int64_t elapsed_ms = static_cast<int64_t>(timestamp - prev_pair_timestamp_);
+    if (elapsed_ms > 0) {
+      // Same units as the ConnectionHealthStats.
+      Add(kQualityMetricSendKbps,
+        8 * 1000 * (bytes_sent - prev_bytes_sent_) / elapsed_ms / 1024);
+      Add(kQualityMetricReceiveKbps,
+        8 * 1000 * (bytes_received - prev_bytes_received_) / elapsed_ms / 1024);
+    }
+  }
+  prev_pair_timestamp_ = timestamp;
+  prev_bytes_sent_ = bytes_sent;
+  prev_bytes_received_ = bytes_received;
+}
+
+void ConnectionQualityHistograms::AddReports(const StatsReports& reports) {
+  rtc::CritScope lock(&crit_sect_);
+  std::map<std::string, PacketCounters> packets;
+  int64_t lost = 0;
+  int64_t expected = 0;
+  bool pair_found = false;
+  for (auto report : reports) {
+    auto stat_type = report->id()->type();
+    if (stat_type == StatsReport::kStatsReportTypeCandidatePair) {
+      const StatsReport::Value* active = report->FindValue(
+        StatsReport::kStatsValueNameActiveConnection);
+      if (!pair_found && active && active->bool_val()) {
+        AddCandidatePair(report);
+        pair_found = true;
+      }
+      continue;
+    }
+    if (stat_type != StatsReport::kStatsReportTypeSsrc) {
+      continue;
+    }
+
+    int64_t value;
+    PacketCounters counters;
+    if (!GetNumber(report, StatsReport::kStatsValueNamePacketsReceived,
+        &counters.received)) {
+      // A sent stream.
+      if (GetNumber(report, StatsReport::kStatsValueNameAvgEncodeMs, &value)) {
+        Add(kQualityMetricEncodeMs, value);
+      }
+      continue;
+    }
+    if (GetNumber(report, StatsReport::kStatsValueNameJitterReceived, &value)) {
+      Add(kQualityMetricJitter, value);
+    }
+    if (GetNumber(report, StatsReport::kStatsValueNameFrameRateOutput, &value)) {
+      Add(kQualityMetricRenderFps, value);
+    }
+    if (GetNumber(report, StatsReport::kStatsValueNameDecodeMs, &value)) {
+      Add(kQualityMetricDecodeMs, value);
+    }
+    if (!GetNumber(report, StatsReport::kStatsValueNamePacketsLost,
+        &counters.lost)) {
+      continue;
+    }
+    std::string id = report->id()->ToString();
+    auto prev = prev_packets_.find(id);
+    if (prev != prev_packets_.end() &&
+        counters.lost >= prev->second.lost &&
+        counters.received >= prev->second.received) {
+      int64_t stream_lost = counters.lost - prev->second.lost;
+      lost += stream_lost;
+      expected += stream_lost + counters.received - prev->second.received;
+    }
+    packets[id] = counters;
+  }
+  // The streams gone are forgotten.
+  prev_packets_.swap(packets);
+  if (expected > 0) {
+    Add(kQualityMetricPacketLoss, 1000 * lost / expected);
+  }
+}
+
+int64_t ConnectionQualityHistograms::WindowDurationMs() {
+  rtc::CritScope lock(&crit_sect_);
+  return rtc::TimeMillis() - window_start_ms_;
+}
+
+QualitySummary ConnectionQualityHistograms::TakeSummary(bool is_final) {
+  rtc::CritScope lock(&crit_sect_);
+  int64_t now = rtc::TimeMillis();
+  QualitySummary summary;
+  summary.timestamp =
+    static_cast<double>(rtc::TimeUTCMicros()) / rtc::kNumMicrosecsPerMillisec;
+  summary.is_final = is_final;
+  summary.duration_ms = now - (is_final ? call_start_ms_ : window_start_ms_);
+  for (int i = 0; i < kQualityMetricCount; ++i) {
+    Summarize(is_final ? call_[i] : window_[i], &summary.metrics[i]);
+    window_[i].Reset();
+  }
+  window_start_ms_ = now;
+  return summary;
+}
+
+}  // namespace webrtc
@@ -0,0 +1,134 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#ifndef WEBRTC_BUILD_WINUWP_GYP_STATS_WEBRTC_STATS_HISTOGRAMS_H_
+#define WEBRTC_BUILD_WINUWP_GYP_STATS_WEBRTC_STATS_HISTOGRAMS_H_
+
+#include <stdint.h>
+#include <map>
+#include <string>
+
+#include "third_party/winuwp_h264/Utils/LogLinearHistogram.h"
+#include "webrtc/api/statstypes.h"
+#include "webrtc/rtc_base/criticalsection.h"
+
+namespace webrtc {
+
+// Distribution of a metric in the buckets of LogLinearBuckets, nothing
+// is allocated once built.  Negative values are ignored and the values
+// from 2^24 on share the last bucket.
+class QualityHistogram {
+ public:
+  QualityHistogram();
+
+  void Add(int64_t value);
+  void Reset();
+
+  uint32_t count() const { return count_; }
+  int64_t min() const { return min_; }
+  int64_t max() const { return max_; }
+  double Mean() const;
+  // Upper bound of the bucket holding the |percent| percentile, within
+  // the min and max added.  0 if empty.
+  int64_t Percentile(int percent) const;
+
+ private:
+  typedef LogLinearBuckets<24> Buckets;
+
+  uint32_t buckets_[Buckets::kCount];
+  uint32_t count_;
+  int64_t min_;
+  int64_t max_;
+  int64_t sum_;
+};
+
+// The metrics of the quality summaries.
+enum QualityMetric {
+  // Round trip time of the active candidate pair, ms.
+  kQualityMetricRtt = 0,
+  // Jitter of each received audio stream, ms.
+  kQualityMetricJitter,
+  // Packets lost over the received streams between two samples, 1/1000.
+  kQualityMetricPacketLoss,
+  // Bitrates of the active candidate pair, kbps.
+  kQualityMetricSendKbps,
+  kQualityMetricReceiveKbps,
+  // Frame rate of each received video stream.
+  kQualityMetricRenderFps,
+  // Encode time of each sent and decode time of each received video
+  // stream, ms.
+  kQualityMetricEncodeMs,
+  kQualityMetricDecodeMs,
+  kQualityMetricCount
+};
+
+// Name of |metric| in the ETW summaries.
+const char* QualityMetricName(QualityMetric metric);
+
+struct QualityMetricSummary {
+  QualityMetricSummary();
+  uint32_t count;
+  int64_t min;
+  int64_t max;
+  double mean;
+  int64_t p50;
+  int64_t p95;
+  int64_t p99;
+};
+
+struct QualitySummary {
+  QualitySummary();
+  // Milliseconds since the epoch, like the stats reports.
+  double timestamp;
+  // Time covered by the summary.
+  int64_t duration_ms;
+  // Covers the whole call instead of the time since the previous one.
+  bool is_final;
+  QualityMetricSummary metrics[kQualityMetricCount];
+};
+
+// Quality histograms of a PeerConnection, fed with the polled reports.
+// The periodic summaries cover the time since the previous one, the
+// final summary the whole call.  The rates are computed from the
+// counters of two consecutive polls.  Thread safe.
+class ConnectionQualityHistograms {
+ public:
+  ConnectionQualityHistograms();
+
+  void AddReports(const StatsReports& reports);
+  // The samples of the periodic summary start over.
+  QualitySummary TakeSummary(bool is_final);
+  // Milliseconds since the periodic samples started.
+  int64_t WindowDurationMs();
+  void Reset();
+
+ private:
+  struct PacketCounters {
+    int64_t lost;
+    int64_t received;
+  };
+
+  void Add(QualityMetric metric, int64_t value);
+  void AddCandidatePair(const StatsReport* report);
+
+  rtc::CriticalSection crit_sect_;
+  // Guarded by |crit_sect_|.
+  QualityHistogram window_[kQualityMetricCount];
+  QualityHistogram call_[kQualityMetricCount];
+  int64_t window_start_ms_;
+  int64_t call_start_ms_;
+  // Counters of the previous poll.
+  double prev_pair_timestamp_;
+  int64_t prev_bytes_sent_;
+  int64_t prev_bytes_received_;
+  std::map<std::string, PacketCounters> prev_packets_;
+};
+
+}  // namespace webrtc
+
+#endif  //  WEBRTC_BUILD_WINUWP_GYP_STATS_WEBRTC_STATS_HISTOGRAMS_H_
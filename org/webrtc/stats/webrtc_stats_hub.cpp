@@ -0,0 +1,134 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#include "webrtc_stats_hub.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include "webrtc_stats_observer.h"
+#include "webrtc/rtc_base/logging.h"
+#include "webrtc/rtc_base/thread.h"
+#include "webrtc/rtc_base/timeutils.h"
+
+// generated by message compiler
+#include "etw_providers.h"
+
+namespace webrtc {
+
+const int WebRTCStatsHub::kMinInterval = 50;
+enum {
+  MSG_HUB_TICK,
+};
+
+WebRTCStatsHub* WebRTCStatsHub::Instance() {
+  static WebRTCStatsHub* instance = new WebRTCStatsHub();
+  return instance;
+}
+
+WebRTCStatsHub::WebRTCStatsHub() {
+}
+
+WebRTCStatsHub::~WebRTCStatsHub() {
+}
+
+void WebRTCStatsHub::AddObserver(WebRTCStatsObserver* observer) {
+  rtc::CritScope lock(&crit_sect_);
+  if (observers_.empty()) {
+    EventRegisterWebRTCInternals();
+  }
+  observers_.insert(observer);
+  if (timer_thread_ == nullptr) {
+    timer_thread_ = rtc::Thread::Create();
+    timer_thread_->SetName("WebRTCStatsHub", nullptr);
+    timer_thread_->Start();
+  }
+}
+
+void WebRTCStatsHub::RemoveObserver(WebRTCStatsObserver* observer) {
+  rtc::CritScope lock(&crit_sect_);
+  if (observers_.erase(observer) != 0 && observers_.empty()) {
+    EventWriteCommand("stop");
+    EventUnregisterWebRTCInternals();
+  }
+}
+
+void WebRTCStatsHub::Wake() {
+  rtc::CritScope lock(&crit_sect_);
+  if (timer_thread_ == nullptr) {
+    return;
+  }
+  timer_thread_->Clear(this, MSG_HUB_TICK);
+  timer_thread_->Post(RTC_FROM_HERE, this, MSG_HUB_TICK);
+}
+
+std::string WebRTCStatsHub::AcquireNetworkSender(
+  const std::string& remote_hostname, int remote_port,
+  StatsNetworkFormat format) {
+  std::ostringstream key;
+  key << remote_hostname << ":" << remote_port << ":" << format;
+
+  rtc::CritScope lock(&senders_crit_sect_);
+  NetworkSender& sender = senders_[key.str()];
+  if (sender.sender == nullptr) {
+    sender.sender.reset(new WebRTCStatsNetworkSender());
+    sender.sender->Start(remote_hostname, remote_port, format);
+  }
+  ++sender.users;
+  return key.str();
+}
+
+void WebRTCStatsHub::ReleaseNetworkSender(const std::string& key) {
+  rtc::CritScope lock(&senders_crit_sect_);
+  auto it = senders_.find(key);
+  if (it == senders_.end()) {
+    return;
+  }
+  if (--it->second.users == 0) {
+    it->second.sender->Stop();
+    senders_.erase(it);
+  }
+}
+
+bool WebRTCStatsHub::SendStats(const std::string& key,
+  const StatsReports& reports,
+  rtc::scoped_refptr<PeerConnectionInterface> pci) {
+  // The observers of different signaling threads share the connection.
+  rtc::CritScope lock(&senders_crit_sect_);
+  auto it = senders_.find(key);
+  if (it == senders_.end()) {
+    return false;
+  }
+  return it->second.sender->ProcessStats(reports, pci);
+}
+
+void WebRTCStatsHub::OnMessage(rtc::Message* msg) {
+  if (msg->message_id != MSG_HUB_TICK) {
+    return;
+  }
+  rtc::CritScope lock(&crit_sect_);
+  // The polls only get posted to the signaling threads of the
+  // observers, the timer doesn't wait for the stats.
+  int64_t now = rtc::TimeMillis();
+  int64_t next = -1;
+  for (auto observer : observers_) {
+    int64_t due = observer->RequestPoll(now);
+    if (due >= 0 && (next < 0 || due < next)) {
+      next = due;
+    }
+  }
+  if (next < 0) {
+    // Nothing to poll until an observer starts and wakes the timer.
+    LOG(LS_INFO) << "WebRTCStatsHub timer stopped";
+    return;
+  }
+  int delay = static_cast<int>(std::max<int64_t>(next - now, kMinInterval));
+  timer_thread_->PostDelayed(RTC_FROM_HERE, delay, this, MSG_HUB_TICK);
+}
+
+}  //  namespace webrtc
@@ -0,0 +1,82 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#ifndef WEBRTC_BUILD_WINUWP_GYP_STATS_WEBRTC_STATS_HUB_H_
+#define WEBRTC_BUILD_WINUWP_GYP_STATS_WEBRTC_STATS_HUB_H_
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+
+#include "webrtc_stats_network_sender.h"
+#include "webrtc/api/statstypes.h"
+#include "webrtc/rtc_base/criticalsection.h"
+#include "webrtc/rtc_base/messagehandler.h"
+#include "webrtc/rtc_base/scoped_ref_ptr.h"
+
+namespace rtc {
+  class Thread;
+}
+namespace webrtc {
+class PeerConnectionInterface;
+class WebRTCStatsObserver;
+
+// Process-wide part of the stats collection, shared by the
+// WebRTCStatsObserver of every PeerConnection.  One timer triggers the
+// polls of all the observers, firing when the next one is due.  The ETW
+// provider is registered once and observers sending to the same
+// collector share its TCP connection.
+class WebRTCStatsHub : public rtc::MessageHandler {
+ public:
+  static WebRTCStatsHub* Instance();
+
+  // Called by the observers when they are created and destroyed.
+  void AddObserver(WebRTCStatsObserver* observer);
+  void RemoveObserver(WebRTCStatsObserver* observer);
+  // Reevaluates the timer now, called when an observer starts or
+  // shortens its interval.  Must not be called with an observer lock held.
+  void Wake();
+
+  // Returns the key of the connection to the collector, which is opened
+  // by the first observer using it and closed with the last one.
+  std::string AcquireNetworkSender(const std::string& remote_hostname,
+    int remote_port, StatsNetworkFormat format);
+  void ReleaseNetworkSender(const std::string& key);
+  // Sends the reports of |pci| over the connection |key|.
+  bool SendStats(const std::string& key, const StatsReports& reports,
+    rtc::scoped_refptr<PeerConnectionInterface> pci);
+
+  // MessageHandler
+  void OnMessage(rtc::Message* msg);
+
+ private:
+  WebRTCStatsHub();
+  ~WebRTCStatsHub();
+
+  struct NetworkSender {
+    NetworkSender() : users(0) {}
+    std::unique_ptr<WebRTCStatsNetworkSender> sender;
+    int users;
+  };
+
+  // Lower bound of the timer, against bursts of wakes.
+  static const int kMinInterval;
+
+  rtc::CriticalSection crit_sect_;
+  std::set<WebRTCStatsObserver*> observers_;
+  // Runs the poll timer while an observer is started.
+  std::unique_ptr<rtc::Thread> timer_thread_;
+
+  rtc::CriticalSection senders_crit_sect_;
+  std::map<std::string, NetworkSender> senders_;
+};
+
+}  // namespace webrtc
+
+#endif  //  WEBRTC_BUILD_WINUWP_GYP_STATS_WEBRTC_STATS_HUB_H_
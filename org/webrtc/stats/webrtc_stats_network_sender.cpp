@@ -9,16 +9,77 @@
 #include "webrtc_stats_network_sender.h"
 #include "etw_providers.h"
 
+#include <algorithm>
+
 #include "webrtc/api/peerconnectioninterface.h"
 #include "webrtc/rtc_base/asynctcpsocket.h" 
 #include "webrtc/rtc_base/json.h"
 #include "webrtc/rtc_base/logging.h"
 #include "webrtc/rtc_base/physicalsocketserver.h"
+#include "webrtc/rtc_base/thread.h"
 
 namespace webrtc {
  
+namespace {
+
+const char kBinaryMagic[] = { 'W', 'R', 'S' };
+const uint8_t kBinaryVersion = 2;
+enum BinaryMessageType {
+  kBinaryMessageHello = 1,
+  kBinaryMessageName = 2,
+  kBinaryMessageSample = 3,
+  kBinaryMessageReset = 4
+};
+// Data kept for a collector that doesn't read, the oldest polls are
+// dropped beyond that.
+const size_t kMaxQueuedBytes = 1024 * 1024;
+const int kReconnectMinDelayMs = 1000;
+const int kReconnectMaxDelayMs = 30000;
+
+enum {
+  MSG_CONNECT = 1,
+  MSG_SEND
+};
+
+void WriteVarint(uint64_t value, std::string* out) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+void WriteSignedVarint(int64_t value, std::string* out) {
+  WriteVarint((static_cast<uint64_t>(value) << 1) ^
+    static_cast<uint64_t>(value >> 63), out);
+}
+
+void WriteString(const std::string& value, std::string* out) {
+  WriteVarint(value.size(), out);
+  out->append(value);
+}
+
+void WriteMessage(uint8_t type, const std::string& payload, std::string* out) {
+  out->push_back(static_cast<char>(type));
+  WriteVarint(payload.size(), out);
+  out->append(payload);
+}
+
+}  // namespace
+
+StatsNetworkCounters::StatsNetworkCounters() :
+  bytes_sent(0), bytes_dropped(0), messages_dropped(0), reconnects(0) {
+}
+
 WebRTCStatsNetworkSender::WebRTCStatsNetworkSender() : 
-  thread_(nullptr),
+  reconnect_delay_ms_(kReconnectMinDelayMs),
+  format_(kStatsNetworkFormatJson),
+  connected_(false),
+  stream_bytes_sent_(0),
+  hello_sent_(false),
+  reset_needed_(false),
+  queued_bytes_(0),
+  front_sent_(0),
   message_start_marker_(0x02 /*STX*/),
   message_end_marker_(0x03 /*ETX*/) {
 }
@@ -29,7 +90,8 @@ WebRTCStatsNetworkSender::~WebRTCStatsNetworkSender() {
   }
 }
 
-bool WebRTCStatsNetworkSender::Start(std::string remote_hostname, int remote_port) {
+bool WebRTCStatsNetworkSender::Start(std::string remote_hostname, int remote_port,
+  StatsNetworkFormat format) {
   if (IsRunning()) {
     LOG(LS_INFO) << "WebRTCStatsNetworkSender already started";
     return false;
@@ -43,22 +105,31 @@ bool WebRTCStatsNetworkSender::Start(std::string remote_hostname, int remote_por
     local_host_name_ = "N/A";
   }
 
-  rtc::PhysicalSocketServer* pss = new rtc::PhysicalSocketServer();
-  thread_ = new rtc::Thread(pss);
-  thread_->SetName("WebRTCStatsNetworkSender", nullptr);
-
-  rtc::SocketAddress localAddress(INADDR_ANY, 0);
-  rtc::SocketAddress remoteAddress(remote_hostname, remote_port);
-
-  socket_.reset(
-    thread_->socketserver()->CreateAsyncSocket(AF_INET, SOCK_STREAM));
+  format_ = format;
+  remote_address_ = rtc::SocketAddress(remote_hostname, remote_port);
+  reconnect_delay_ms_ = kReconnectMinDelayMs;
+  {
+    rtc::CritScope lock(&crit_sect_);
+    connected_ = false;
+    hello_sent_ = false;
+    reset_needed_ = false;
+    names_.clear();
+    sources_.clear();
+    queue_.clear();
+    queued_bytes_ = 0;
+    front_sent_ = 0;
+    counters_ = StatsNetworkCounters();
+  }
 
-  if (socket_ == nullptr) {
+  thread_.reset(new rtc::Thread(std::unique_ptr<rtc::SocketServer>(
+    new rtc::PhysicalSocketServer())));
+  thread_->SetName("WebRTCStatsNetworkSender", nullptr);
+  if (!thread_->Start()) {
     LOG(LS_ERROR) << "WebRTCStatsNetworkSender failed to start";
+    thread_.reset();
     return false;
   }
-  socket_->Connect(remoteAddress);
-  thread_->Start();
+  thread_->Post(RTC_FROM_HERE, this, MSG_CONNECT);
   return true;
 }
 
@@ -68,30 +139,231 @@ bool WebRTCStatsNetworkSender::Stop() {
     return false;
   }
 
-  if (thread_ != nullptr) {
-    thread_->Stop();
-  }
+  thread_->Clear(this);
+  thread_->Invoke<void>(RTC_FROM_HERE, [this] {
+    if (socket_ != nullptr) {
+      socket_->Close();
+      socket_.reset();
+    }
+  });
+  thread_->Stop();
+  thread_.reset();
 
-  socket_->Close();
-  socket_.reset();
+  StatsNetworkCounters counters = GetCounters();
+  LOG(LS_INFO) << "WebRTCStatsNetworkSender stopped, sent "
+    << counters.bytes_sent << " bytes, dropped " << counters.bytes_dropped
+    << " bytes in " << counters.messages_dropped << " messages, "
+    << counters.reconnects << " reconnects";
   return true;
 }
 
 bool WebRTCStatsNetworkSender::IsRunning() {
-  return socket_ != nullptr;
+  return thread_ != nullptr;
+}
+
+StatsNetworkCounters WebRTCStatsNetworkSender::GetCounters() {
+  rtc::CritScope lock(&crit_sect_);
+  return counters_;
 }
 
 bool WebRTCStatsNetworkSender::ProcessStats(const StatsReports& reports,
   rtc::scoped_refptr<webrtc::PeerConnectionInterface> pci) {
-  if (socket_ == nullptr || socket_->GetState() != rtc::Socket::CS_CONNECTED) {
+  if (!IsRunning() || pci == nullptr) {
     return false;
   }
-  if (pci == nullptr) {
-    return false;
+
+  {
+    rtc::CritScope lock(&crit_sect_);
+    std::string message;
+    if (format_ == kStatsNetworkFormatBinary) {
+      // The binary stream is relative to the connection, nothing to
+      // encode against until there is one.
+      if (!connected_) {
+        return false;
+      }
+      if (reset_needed_) {
+        WriteMessage(kBinaryMessageReset, std::string(), &message);
+        reset_needed_ = false;
+      }
+      WriteBinary(reports, pci, &message);
+    } else {
+      WriteJson(reports, pci, &message);
+    }
+    queued_bytes_ += message.size();
+    queue_.push_back(std::move(message));
+    TrimQueue();
+  }
+
+  thread_->Post(RTC_FROM_HERE, this, MSG_SEND);
+  return true;
+}
+
+void WebRTCStatsNetworkSender::TrimQueue() {
+  if (queued_bytes_ <= kMaxQueuedBytes) {
+    return;
+  }
+  if (counters_.messages_dropped == 0) {
+    LOG(LS_WARNING) << "WebRTCStatsNetworkSender collector too slow, "
+      "dropping stats";
+  }
+  // A partially sent message has to be completed.
+  size_t first = front_sent_ != 0 ? 1 : 0;
+  if (format_ == kStatsNetworkFormatBinary) {
+    // The queued messages depend on each other, they all go and the
+    // stream starts over with a reset.
+    DropQueued(first);
+    names_.clear();
+    sources_.clear();
+    if (stream_bytes_sent_ == 0 && front_sent_ == 0) {
+      // The hello didn't make it to the socket either.
+      hello_sent_ = false;
+      reset_needed_ = false;
+    } else {
+      reset_needed_ = true;
+    }
+    return;
+  }
+  // The JSON messages stand on their own, the newest one is kept.
+  while (queued_bytes_ > kMaxQueuedBytes && queue_.size() > first + 1) {
+    counters_.bytes_dropped += queue_[first].size();
+    ++counters_.messages_dropped;
+    queued_bytes_ -= queue_[first].size();
+    queue_.erase(queue_.begin() + first);
+  }
+}
+
+void WebRTCStatsNetworkSender::DropQueued(size_t first) {
+  while (queue_.size() > first) {
+    counters_.bytes_dropped += queue_.back().size();
+    ++counters_.messages_dropped;
+    queued_bytes_ -= queue_.back().size();
+    queue_.pop_back();
   }
+}
 
+void WebRTCStatsNetworkSender::OnMessage(rtc::Message* msg) {
+  switch (msg->message_id) {
+  case MSG_CONNECT:
+    Connect();
+    break;
+  case MSG_SEND:
+    SendQueued();
+    break;
+  default:
+    break;
+  }
+}
+
+void WebRTCStatsNetworkSender::Connect() {
+  socket_.reset(
+    thread_->socketserver()->CreateAsyncSocket(AF_INET, SOCK_STREAM));
+  if (socket_ != nullptr) {
+    socket_->SignalConnectEvent.connect(this,
+      &WebRTCStatsNetworkSender::OnConnectEvent);
+    socket_->SignalWriteEvent.connect(this,
+      &WebRTCStatsNetworkSender::OnWriteEvent);
+    socket_->SignalCloseEvent.connect(this,
+      &WebRTCStatsNetworkSender::OnCloseEvent);
+    if (socket_->Connect(remote_address_) == 0 || socket_->IsBlocking()) {
+      return;
+    }
+  }
+  LOG(LS_WARNING) << "WebRTCStatsNetworkSender can't connect to "
+    << remote_address_.ToString();
+  Disconnect();
+}
+
+void WebRTCStatsNetworkSender::Disconnect() {
+  {
+    rtc::CritScope lock(&crit_sect_);
+    if (connected_) {
+      ++counters_.reconnects;
+    }
+    connected_ = false;
+    // The next connection is a new stream.
+    hello_sent_ = false;
+    reset_needed_ = false;
+    names_.clear();
+    sources_.clear();
+    if (format_ == kStatsNetworkFormatBinary) {
+      DropQueued(0);
+    }
+    // What the collector got of a partial message is lost with the
+    // connection, it is sent again from the start.
+    front_sent_ = 0;
+  }
+  if (socket_ != nullptr) {
+    socket_->Close();
+    // Deleting the socket from its own signal isn't safe.
+    thread_->Dispose(socket_.release());
+  }
+  thread_->PostDelayed(RTC_FROM_HERE, reconnect_delay_ms_, this, MSG_CONNECT);
+  reconnect_delay_ms_ = std::min(reconnect_delay_ms_ * 2, kReconnectMaxDelayMs);
+}
+
+void WebRTCStatsNetworkSender::SendQueued() {
+  if (socket_ == nullptr || socket_->GetState() != rtc::Socket::CS_CONNECTED) {
+    return;
+  }
+  bool failed = false;
+  {
+    rtc::CritScope lock(&crit_sect_);
+    while (!queue_.empty()) {
+      const std::string& front = queue_.front();
+      int sent = socket_->Send(front.data() + front_sent_,
+        front.size() - front_sent_);
+      if (sent < 0) {
+        // Resumed by OnWriteEvent when the socket would block.
+        failed = !socket_->IsBlocking();
+        break;
+      }
+      front_sent_ += static_cast<size_t>(sent);
+      stream_bytes_sent_ += static_cast<uint64_t>(sent);
+      counters_.bytes_sent += static_cast<uint64_t>(sent);
+      if (front_sent_ < front.size()) {
+        break;
+      }
+      queued_bytes_ -= front.size();
+      queue_.pop_front();
+      front_sent_ = 0;
+    }
+  }
+  if (failed) {
+    LOG(LS_WARNING) << "WebRTCStatsNetworkSender send failed, error "
+      << socket_->GetError();
+    Disconnect();
+  }
+}
+
+void WebRTCStatsNetworkSender::OnConnectEvent(rtc::AsyncSocket* socket) {
+  LOG(LS_INFO) << "WebRTCStatsNetworkSender connected to "
+    << remote_address_.ToString();
+  reconnect_delay_ms_ = kReconnectMinDelayMs;
+  {
+    rtc::CritScope lock(&crit_sect_);
+    connected_ = true;
+    stream_bytes_sent_ = 0;
+  }
+  SendQueued();
+}
+
+void WebRTCStatsNetworkSender::OnWriteEvent(rtc::AsyncSocket* socket) {
+  SendQueued();
+}
+
+void WebRTCStatsNetworkSender::OnCloseEvent(rtc::AsyncSocket* socket,
+  int error) {
+  LOG(LS_WARNING) << "WebRTCStatsNetworkSender connection closed, error "
+    << error;
+  Disconnect();
+}
+
+void WebRTCStatsNetworkSender::WriteJson(const StatsReports& reports,
+  rtc::scoped_refptr<webrtc::PeerConnectionInterface> pci, std::string* out) {
   Json::Value jmessage;
   jmessage["hostname"] = local_host_name_;
+  // Several peer connections share the sender.
+  jmessage["source"] = GetSource(pci.get()).id;
 
   std::vector<Json::Value> jreports;
   size_t stats_count = 0;
@@ -99,31 +371,8 @@ bool WebRTCStatsNetworkSender::ProcessStats(const StatsReports& reports,
   for (auto report : reports) {
     std::string sgn = report->id()->ToString();
     auto stat_group_name = sgn.c_str();
-    auto stat_type = report->id()->type();
     auto timestamp = report->timestamp();
 
-    bool send = false;
-    if (stat_type == StatsReport::kStatsReportTypeSession ||
-      stat_type == StatsReport::kStatsReportTypeTrack ||
-      stat_type == StatsReport::kStatsReportTypeBwe) {
-      send = true;
-    }
-    else if (stat_type == StatsReport::kStatsReportTypeSsrc) {
-      const StatsReport::Value* v = report->FindValue(
-        StatsReport::kStatsValueNameTrackId);
-      if (v) {
-        const std::string& id = v->string_val();
-        auto ls = pci->local_streams();
-        auto rs = pci->remote_streams();
-        if (ls->FindAudioTrack(id) || ls->FindVideoTrack(id) ||
-          rs->FindAudioTrack(id) || rs->FindVideoTrack(id)) {
-          send = true;
-        }
-      }
-    }
-    if (!send) {
-      continue;
-    }
     Json::Value jreport;
     jreport["gr_n"] = stat_group_name;
     jreport["ts"] = timestamp;
@@ -175,11 +424,143 @@ bool WebRTCStatsNetworkSender::ProcessStats(const StatsReports& reports,
   jmessage["stat_cnt"] = stats_count;
   /*Json::StyledWriter writer;*/
   Json::FastWriter writer;
-  auto data = writer.write(jmessage);
-  socket_->Send(&message_start_marker_, 1);
-  socket_->Send(data.c_str(), data.length());
-  socket_->Send(&message_end_marker_, 1);
-  return true;
+  out->push_back(message_start_marker_);
+  out->append(writer.write(jmessage));
+  out->push_back(message_end_marker_);
+}
+
+uint32_t WebRTCStatsNetworkSender::InternName(const std::string& name,
+  std::string* out) {
+  auto it = names_.find(name);
+  if (it != names_.end()) {
+    return it->second;
+  }
+  uint32_t id = static_cast<uint32_t>(names_.size());
+  names_[name] = id;
+  std::string payload;
+  WriteVarint(id, &payload);
+  WriteString(name, &payload);
+  WriteMessage(kBinaryMessageName, payload, out);
+  return id;
+}
+
+WebRTCStatsNetworkSender::SourceState& WebRTCStatsNetworkSender::GetSource(
+  PeerConnectionInterface* pci) {
+  auto source = sources_.find(pci);
+  if (source == sources_.end()) {
+    source = sources_.insert(std::make_pair(pci,
+      SourceState(static_cast<uint32_t>(sources_.size())))).first;
+  }
+  return source->second;
+}
+
+void WebRTCStatsNetworkSender::WriteBinary(const StatsReports& reports,
+  rtc::scoped_refptr<webrtc::PeerConnectionInterface> pci, std::string* out) {
+  if (!hello_sent_) {
+    out->append(kBinaryMagic, sizeof(kBinaryMagic));
+    out->push_back(static_cast<char>(kBinaryVersion));
+    std::string payload;
+    WriteString(local_host_name_, &payload);
+    WriteMessage(kBinaryMessageHello, payload, out);
+    hello_sent_ = true;
+  }
+
+  SourceState& source = GetSource(pci.get());
+
+  // The name messages have to come before the sample using them.
+  std::string groups;
+  size_t group_count = 0;
+  for (auto report : reports) {
+    std::string group_name = report->id()->ToString();
+    SentGroup& sent_group = source.groups[group_name];
+
+    std::string values;
+    size_t value_count = 0;
+    for (auto value : report->values()) {
+      std::string stat_name = value.second->display_name();
+      auto sent = sent_group.values.find(stat_name);
+      bool known = sent != sent_group.values.end();
+      SentValue& sent_value = sent_group.values[stat_name];
+      if (known && sent_value.type != value.second->type()) {
+        known = false;
+        sent_value = SentValue();
+      }
+      sent_value.type = value.second->type();
+
+      std::string data;
+      uint8_t type;
+      switch (value.second->type()) {
+      case StatsReport::Value::kInt:
+      case StatsReport::Value::kInt64: {
+        int64_t current = value.second->type() == StatsReport::Value::kInt ?
+          value.second->int_val() : value.second->int64_val();
+        if (known && current == sent_value.int_val) {
+          continue;
+        }
+        type = static_cast<uint8_t>(
+          value.second->type() == StatsReport::Value::kInt ?
+          StatsReportInt32.Id : StatsReportInt64.Id);
+        WriteSignedVarint(current - sent_value.int_val, &data);
+        sent_value.int_val = current;
+        break;
+      }
+      case StatsReport::Value::kFloat: {
+        float current = value.second->float_val();
+        if (known && current == sent_value.float_val) {
+          continue;
+        }
+        type = static_cast<uint8_t>(StatsReportFloat.Id);
+        data.append(reinterpret_cast<const char*>(&current), sizeof(current));
+        sent_value.float_val = current;
+        break;
+      }
+      case StatsReport::Value::kBool: {
+        bool current = value.second->bool_val();
+        if (known && current == sent_value.bool_val) {
+          continue;
+        }
+        type = static_cast<uint8_t>(StatsReportBool.Id);
+        data.push_back(current ? 1 : 0);
+        sent_value.bool_val = current;
+        break;
+      }
+      case StatsReport::Value::kStaticString:
+      case StatsReport::Value::kString: {
+        std::string current = value.second->type() == StatsReport::Value::kString ?
+          value.second->string_val() : value.second->static_string_val();
+        if (known && current == sent_value.string_val) {
+          continue;
+        }
+        type = static_cast<uint8_t>(StatsReportString.Id);
+        WriteString(current, &data);
+        sent_value.string_val = current;
+        break;
+      }
+      default:
+        continue;
+      }
+      WriteVarint(InternName(stat_name, out), &values);
+      values.push_back(static_cast<char>(type));
+      values.append(data);
+      ++value_count;
+    }
+    if (value_count == 0) {
+      continue;
+    }
+    int64_t timestamp = static_cast<int64_t>(report->timestamp());
+    WriteVarint(InternName(group_name, out), &groups);
+    WriteSignedVarint(timestamp - sent_group.timestamp, &groups);
+    sent_group.timestamp = timestamp;
+    WriteVarint(value_count, &groups);
+    groups.append(values);
+    ++group_count;
+  }
+
+  std::string payload;
+  WriteVarint(source.id, &payload);
+  WriteVarint(group_count, &payload);
+  payload.append(groups);
+  WriteMessage(kBinaryMessageSample, payload, out);
 }
 
-}  // namespace webrtc
\ No newline at end of file
+}  // namespace webrtc
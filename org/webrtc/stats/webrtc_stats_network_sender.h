@@ -9,10 +9,16 @@
 #ifndef WEBRTC_BUILD_WINUWP_GYP_STATS_WEBRTC_STATS_NETWORK_SENDER_H_
 #define WEBRTC_BUILD_WINUWP_GYP_STATS_WEBRTC_STATS_NETWORK_SENDER_H_
 
+#include <deque>
+#include <map>
+#include <memory>
 #include <string>
 #include "webrtc/api/statstypes.h"
+#include "webrtc/rtc_base/criticalsection.h"
+#include "webrtc/rtc_base/messagehandler.h"
 #include "webrtc/rtc_base/sigslot.h"
 #include "webrtc/rtc_base/scoped_ref_ptr.h"
+#include "webrtc/rtc_base/socketaddress.h"
 
 namespace rtc {
   class AsyncSocket;
@@ -21,21 +27,134 @@ namespace rtc {
 namespace webrtc {
 class PeerConnectionInterface;
 
-class WebRTCStatsNetworkSender : public sigslot::has_slots<sigslot::multi_threaded_local> {
+// Wire format of the stats sent to the collector.
+//
+// kStatsNetworkFormatJson: one JSON object per poll between STX and ETX,
+// with the "hostname" and the "source" id of the peer connection, the same
+// as in the binary samples.
+//
+// kStatsNetworkFormatBinary: integers are LEB128 varints, signed ones are
+// zigzag encoded first, strings are a length followed by UTF-8 bytes.
+//   stream  := "WRS" version(u8) message*
+//   message := type(u8) length payload
+//   hello   (1): hostname                    first message of the stream
+//   name    (2): id name                     interns a group or stat name
+//   sample  (3): source group_count group*   one per poll and connection
+//   reset   (4): (empty)                     samples were dropped, forget
+//                                            the names and the bases
+//   group   := name_id timestamp_delta_ms(signed) value_count value*
+//   value   := name_id type(u8) data
+// The value types are the ETW event ids of StatsReportInt32 to
+// StatsReportBool.  Integers are sent as the difference with the previous
+// value of the stat, floats as 4 bytes little endian, bools as a byte.
+// The base of a stat is 0 the first time it is sent and when its type
+// changes.  Values that didn't change since the previous sample are left
+// out.  Names are interned once per TCP connection, or until a reset.
+enum StatsNetworkFormat {
+  kStatsNetworkFormatJson = 0,
+  kStatsNetworkFormatBinary = 1
+};
+
+// Totals since Start().
+struct StatsNetworkCounters {
+  StatsNetworkCounters();
+  uint64_t bytes_sent;
+  uint64_t bytes_dropped;
+  uint64_t messages_dropped;
+  uint64_t reconnects;
+};
+
+// Sends the stats to a collector over TCP.  The socket lives on the
+// sender's own thread, ProcessStats() only serializes the reports and
+// queues them, so a slow or dead collector never delays the caller.  The
+// queue is bounded, the oldest messages are dropped first, and the
+// connection is retried with an exponential backoff.
+class WebRTCStatsNetworkSender : public sigslot::has_slots<sigslot::multi_threaded_local>,
+  public rtc::MessageHandler {
 public:
   WebRTCStatsNetworkSender();
   virtual ~WebRTCStatsNetworkSender();
 
-  bool Start(std::string remote_hostname, int remote_port);
+  bool Start(std::string remote_hostname, int remote_port,
+    StatsNetworkFormat format = kStatsNetworkFormatJson);
   bool Stop();
   bool IsRunning();
+  // |reports| are sent as they are, the caller filters them.  Returns
+  // false if they couldn't be queued.
   bool ProcessStats(const StatsReports& reports, rtc::scoped_refptr<webrtc::PeerConnectionInterface> pci);
+  StatsNetworkCounters GetCounters();
+
+  // MessageHandler
+  void OnMessage(rtc::Message* msg) override;
 
 private:
-	std::unique_ptr<rtc::AsyncSocket> socket_;
-  rtc::Thread* thread_;
+  // Last value sent for a stat, the base of the next delta.
+  struct SentValue {
+    SentValue() : type(StatsReport::Value::kInt), int_val(0), float_val(0),
+      bool_val(false) {}
+    StatsReport::Value::Type type;
+    int64_t int_val;
+    float float_val;
+    bool bool_val;
+    std::string string_val;
+  };
+  struct SentGroup {
+    SentGroup() : timestamp(0) {}
+    int64_t timestamp;
+    std::map<std::string, SentValue> values;
+  };
+  // Binary state of one peer connection, only the id in JSON.
+  struct SourceState {
+    explicit SourceState(uint32_t id) : id(id) {}
+    uint32_t id;
+    std::map<std::string, SentGroup> groups;
+  };
+
+  void WriteJson(const StatsReports& reports,
+    rtc::scoped_refptr<webrtc::PeerConnectionInterface> pci, std::string* out);
+  void WriteBinary(const StatsReports& reports,
+    rtc::scoped_refptr<webrtc::PeerConnectionInterface> pci, std::string* out);
+  uint32_t InternName(const std::string& name, std::string* out);
+  // Numbered in the order the peer connections are first seen on the
+  // connection.
+  SourceState& GetSource(PeerConnectionInterface* pci);
+  // Drops the oldest queued messages beyond kMaxQueuedBytes.
+  void TrimQueue();
+  void DropQueued(size_t first);
+
+  // On |thread_|.
+  void Connect();
+  void Disconnect();
+  void SendQueued();
+  void OnConnectEvent(rtc::AsyncSocket* socket);
+  void OnWriteEvent(rtc::AsyncSocket* socket);
+  void OnCloseEvent(rtc::AsyncSocket* socket, int error);
+
+  std::unique_ptr<rtc::Thread> thread_;
+  // Only used on |thread_|.
+  std::unique_ptr<rtc::AsyncSocket> socket_;
+  rtc::SocketAddress remote_address_;
+  int reconnect_delay_ms_;
 
   std::string local_host_name_;
+  StatsNetworkFormat format_;
+
+  rtc::CriticalSection crit_sect_;
+  // Protected by crit_sect_.
+  bool connected_;
+  // Bytes sent on the current connection.
+  uint64_t stream_bytes_sent_;
+  // Binary format state, reset for each connection.
+  bool hello_sent_;
+  bool reset_needed_;
+  std::map<std::string, uint32_t> names_;
+  std::map<PeerConnectionInterface*, SourceState> sources_;
+  // Serialized polls waiting for the socket, the front one may be
+  // partially sent already.
+  std::deque<std::string> queue_;
+  size_t queued_bytes_;
+  size_t front_sent_;
+  StatsNetworkCounters counters_;
 
   const char message_start_marker_;
   const char message_end_marker_;
@@ -43,4 +162,4 @@ private:
 
 }  // namespace webrtc
 
-#endif  //  WEBRTC_BUILD_WINUWP_GYP_STATS_WEBRTC_STATS_NETWORK_SENDER_H_
\ No newline at end of file
+#endif  //  WEBRTC_BUILD_WINUWP_GYP_STATS_WEBRTC_STATS_NETWORK_SENDER_H_
@@ -8,12 +8,17 @@
 // be found in the AUTHORS file in the root of the source tree.
 
 #include <collection.h>
+#include <algorithm>
 #include <string>
+#include <vector>
 
 #include "webrtc_stats_observer.h"
-#include "webrtc_stats_network_sender.h"
+#include "webrtc_stats_hub.h"
+#include "webrtc/rtc_base/stringencode.h"
 #include "webrtc/rtc_base/thread.h"
+#include "webrtc/rtc_base/timeutils.h"
 #include "webrtc/modules/video_coding/timing.h"
+#include "third_party/winuwp_h264/Utils/ResourceSampler.h"
 #include "../wrapper/RTCStatsReport.h"
 #include "../wrapper/Marshalling.h"
 
@@ -24,14 +29,100 @@ using Platform::Collections::Vector;
 
 namespace webrtc {
 
-// The time interval of requesting statistics
-const int WebRTCStatsObserver::kInterval = 1000;
 enum {
   MSG_POLL_STATS,
 };
 
+StatsTrackIdCache::StatsTrackIdCache() : dirty_(false) {
+}
+
+// The stream proxies call the signaling thread, which can be waiting for
+// crit_sect_ in Contains(), so they are (un)registered without the lock.
+StatsTrackIdCache::~StatsTrackIdCache() {
+  for (auto& stream : streams_) {
+    stream.second->UnregisterObserver(this);
+  }
+}
+
+void StatsTrackIdCache::AddStream(
+  rtc::scoped_refptr<MediaStreamInterface> stream) {
+  if (stream == nullptr) {
+    return;
+  }
+  {
+    rtc::CritScope lock(&crit_sect_);
+    if (streams_.find(stream.get()) != streams_.end()) {
+      return;
+    }
+    streams_[stream.get()] = stream;
+    dirty_ = true;
+  }
+  stream->RegisterObserver(this);
+}
+
+void StatsTrackIdCache::RemoveStream(
+  rtc::scoped_refptr<MediaStreamInterface> stream) {
+  if (stream == nullptr) {
+    return;
+  }
+  {
+    rtc::CritScope lock(&crit_sect_);
+    auto it = streams_.find(stream.get());
+    if (it == streams_.end()) {
+      return;
+    }
+    streams_.erase(it);
+    dirty_ = true;
+  }
+  stream->UnregisterObserver(this);
+}
+
+// Rebuilt only after a stream or one of its tracks changed.  The tracks
+// are enumerated through the stream proxies, on the signaling thread,
+// so without the lock like the (un)registrations.
+bool StatsTrackIdCache::Contains(const std::string& track_id) {
+  std::vector<rtc::scoped_refptr<MediaStreamInterface>> streams;
+  {
+    rtc::CritScope lock(&crit_sect_);
+    if (!dirty_) {
+      return track_ids_.find(track_id) != track_ids_.end();
+    }
+    for (auto& stream : streams_) {
+      streams.push_back(stream.second);
+    }
+    // A change while enumerating marks it again.
+    dirty_ = false;
+  }
+  std::set<std::string> track_ids;
+  for (auto& stream : streams) {
+    for (auto& track : stream->GetAudioTracks()) {
+      track_ids.insert(track->id());
+    }
+    for (auto& track : stream->GetVideoTracks()) {
+      track_ids.insert(track->id());
+    }
+  }
+  bool found = track_ids.find(track_id) != track_ids.end();
+  rtc::CritScope lock(&crit_sect_);
+  track_ids_.swap(track_ids);
+  return found;
+}
+
+void StatsTrackIdCache::OnChanged() {
+  rtc::CritScope lock(&crit_sect_);
+  dirty_ = true;
+}
+
+StatsPollingConfig::StatsPollingConfig() : adaptive(false),
+  adaptive_fast_ms(200), adaptive_slow_ms(5000) {
+  for (int i = 0; i < kStatsConsumerCount; ++i) {
+    interval_ms[i] = 1000;
+  }
+}
+
 ConnectionHealthStats::ConnectionHealthStats() : timestamp(0),
-  received_bytes(0), received_kbps(0), sent_bytes(0), sent_kbps(0), rtt(0) {
+  received_bytes(0), received_kbps(0), sent_bytes(0), sent_kbps(0), rtt(0),
+  cpu_usage(0), memory_usage(0) {
 }
 
 void ConnectionHealthStats::Reset() {
@@ -43,26 +134,75 @@ void ConnectionHealthStats::Reset() {
   rtt = 0;
   local_candidate_type = "";
   remote_candidate_type = "";
+  cpu_usage = 0;
+  memory_usage = 0;
+  thread_cpu_usage.clear();
 }
 
 WebRTCStatsObserver::WebRTCStatsObserver(
   rtc::scoped_refptr<webrtc::PeerConnectionInterface> pci) :
-  pci_(pci), status_(kStopped),
+  pci_(pci), poll_thread_(rtc::Thread::Current()), status_(kStopped),
   webrtc_stats_observer_winuwp_(NULL), etw_stats_enabled_(false),
   rtc_stats_enabled_(false), conn_health_stats_enabled_(false),
+  quality_histograms_enabled_(false),
+  quality_summary_interval_ms_(5 * 60 * 1000),
   rtc_stats_to_remote_host_enabled_(false), 
-  stats_network_destination_port_(-1) {
-  EventRegisterWebRTCInternals();
+  stats_network_destination_port_(-1),
+  stats_network_format_(kStatsNetworkFormatJson),
+  next_poll_ms_(0), last_send_bandwidth_(0) {
+  adaptive_interval_ms_ = polling_config_.adaptive_fast_ms;
+  for (int i = 0; i < kStatsConsumerCount; ++i) {
+    last_delivery_ms_[i] = 0;
+  }
+  if (pci_ != nullptr) {
+    // Later changes come through OnStreamAdded/OnStreamRemoved.
+    auto ls = pci_->local_streams();
+    for (size_t i = 0; i < ls->count(); ++i) {
+      track_ids_.AddStream(ls->at(i));
+    }
+    auto rs = pci_->remote_streams();
+    for (size_t i = 0; i < rs->count(); ++i) {
+      track_ids_.AddStream(rs->at(i));
+    }
+  }
+  WebRTCStatsHub::Instance()->AddObserver(this);
 }
 
 WebRTCStatsObserver::~WebRTCStatsObserver() {
-  EventWriteCommand("stop");
-  EventUnregisterWebRTCInternals();
+  // The final summary was exported when the connection closed, the
+  // WebRTCStatsObserverWinUWP may be gone.
+  quality_histograms_enabled_ = false;
   // Will trigger Stop()
   ToggleETWStats(false);
   ToggleConnectionHealthStats(false);
   ToggleRTCStats(false);
   ToggleStatsSendToRemoteHost(false);
+  WebRTCStatsHub::Instance()->RemoveObserver(this);
+}
+
+void WebRTCStatsObserver::OnStreamAdded(
+  rtc::scoped_refptr<MediaStreamInterface> stream) {
+  track_ids_.AddStream(stream);
+}
+
+void WebRTCStatsObserver::OnStreamRemoved(
+  rtc::scoped_refptr<MediaStreamInterface> stream) {
+  track_ids_.RemoveStream(stream);
+}
+
+bool WebRTCStatsObserver::IsTrackedReport(const StatsReport* report) {
+  auto stat_type = report->id()->type();
+  if (stat_type == StatsReport::kStatsReportTypeSession ||
+      stat_type == StatsReport::kStatsReportTypeTrack ||
+      stat_type == StatsReport::kStatsReportTypeBwe) {
+    return true;
+  }
+  if (stat_type == StatsReport::kStatsReportTypeSsrc) {
+    const StatsReport::Value* v = report->FindValue(
+      StatsReport::kStatsValueNameTrackId);
+    return v && track_ids_.Contains(v->string_val());
+  }
+  return false;
 }
 
 void WebRTCStatsObserver::Start() {
@@ -71,21 +211,149 @@ void WebRTCStatsObserver::Start() {
     rtc::CritScope lock(&crit_sect_);
     if (status_ == kStopped) {
       performStart = true;
+      next_poll_ms_ = 0;
       LOG(LS_INFO) << "WebRTCStatsObserver starting";
     }
     status_ = kStarted;
   }
 
   if (performStart) {
-    PollStats();
+    // The first poll is posted right away.
+    WebRTCStatsHub::Instance()->Wake();
   }
 }
 
 void WebRTCStatsObserver::Stop() {
   rtc::CritScope lock(&crit_sect_);
   if (status_ == kStarted) {
-    status_ = kStopping;
-    LOG(LS_INFO) << "WebRTCStatsObserver stopping";
+    status_ = kStopped;
+    LOG(LS_INFO) << "WebRTCStatsObserver stopped";
+  }
+}
+
+int64_t WebRTCStatsObserver::RequestPoll(int64_t now_ms) {
+  rtc::CritScope lock(&crit_sect_);
+  if (status_ != kStarted || poll_thread_ == nullptr) {
+    return -1;
+  }
+  if (now_ms >= next_poll_ms_) {
+    poll_thread_->Post(RTC_FROM_HERE, this, MSG_POLL_STATS);
+    next_poll_ms_ = now_ms + CurrentInterval();
+  }
+  return next_poll_ms_;
+}
+
+int WebRTCStatsObserver::CurrentInterval() {
+  if (polling_config_.adaptive) {
+    return adaptive_interval_ms_;
+  }
+  const bool enabled[kStatsConsumerCount] = {
+    etw_stats_enabled_,
+    conn_health_stats_enabled_,
+    rtc_stats_enabled_,
+    rtc_stats_to_remote_host_enabled_,
+    quality_histograms_enabled_
+  };
+  int interval = 0;
+  for (int i = 0; i < kStatsConsumerCount; ++i) {
+    if (enabled[i] && (interval == 0 || polling_config_.interval_ms[i] < interval)) {
+      interval = polling_config_.interval_ms[i];
+    }
+  }
+  return interval > 0 ? interval : polling_config_.interval_ms[kStatsConsumerRtcStats];
+}
+
+void WebRTCStatsObserver::SetPollingConfig(const StatsPollingConfig& config) {
+  {
+    rtc::CritScope lock(&crit_sect_);
+    polling_config_ = config;
+    adaptive_interval_ms_ = config.adaptive_fast_ms;
+    next_poll_ms_ = 0;
+  }
+  WebRTCStatsHub::Instance()->Wake();
+}
+
+namespace {
+std::shared_ptr<const StatsFilter> MakeFilter(const StatsFilter& filter) {
+  if (filter.report_types.empty() && filter.value_names.empty()) {
+    return nullptr;
+  }
+  return std::make_shared<StatsFilter>(filter);
+}
+
+// The value events share one keyword, checking one of them is enough.
+bool IsETWStatsSessionListening() {
+  return EventEnabledStatsReportPacked() || EventEnabledStatsReportInt32();
+}
+}  // namespace
+
+bool StatsFilter::HasType(StatsReport::StatsType type) const {
+  return report_types.empty() || report_types.count(type) != 0;
+}
+
+bool StatsFilter::HasValue(StatsReport::StatsValueName name) const {
+  return value_names.empty() || value_names.count(name) != 0;
+}
+
+void WebRTCStatsObserver::SetRTCStatsFilter(const StatsFilter& filter) {
+  std::shared_ptr<const StatsFilter> rtc_stats_filter = MakeFilter(filter);
+  rtc::CritScope lock(&crit_sect_);
+  rtc_stats_filter_ = rtc_stats_filter;
+}
+
+void WebRTCStatsObserver::SetETWStatsFilter(const StatsFilter& filter) {
+  std::shared_ptr<const StatsFilter> etw_stats_filter = MakeFilter(filter);
+  rtc::CritScope lock(&crit_sect_);
+  etw_stats_filter_ = etw_stats_filter;
+}
+
+void WebRTCStatsObserver::NotifyActivity() {
+  {
+    rtc::CritScope lock(&crit_sect_);
+    if (!polling_config_.adaptive ||
+      adaptive_interval_ms_ == polling_config_.adaptive_fast_ms) {
+      return;
+    }
+    adaptive_interval_ms_ = polling_config_.adaptive_fast_ms;
+    next_poll_ms_ = 0;
+  }
+  WebRTCStatsHub::Instance()->Wake();
+}
+
+void WebRTCStatsObserver::UpdateAdaptiveInterval(const StatsReports& reports) {
+  int64_t send_bandwidth = last_send_bandwidth_;
+  for (auto report : reports) {
+    if (report->id()->type() == StatsReport::kStatsReportTypeBwe) {
+      const StatsReport::Value* v = report->FindValue(
+        StatsReport::kStatsValueNameAvailableSendBandwidth);
+      if (v) {
+        send_bandwidth = v->int_val();
+      }
+      break;
+    }
+  }
+  // More than 10% off the previous estimate counts as a change.
+  int64_t difference = send_bandwidth - last_send_bandwidth_;
+  bool changed = (difference < 0 ? -difference : difference) * 10 >
+    last_send_bandwidth_;
+  last_send_bandwidth_ = send_bandwidth;
+
+  bool wake = false;
+  {
+    rtc::CritScope lock(&crit_sect_);
+    if (changed) {
+      wake = adaptive_interval_ms_ != polling_config_.adaptive_fast_ms;
+      adaptive_interval_ms_ = polling_config_.adaptive_fast_ms;
+      if (wake) {
+        next_poll_ms_ = rtc::TimeMillis() + adaptive_interval_ms_;
+      }
+    } else {
+      adaptive_interval_ms_ = std::min(adaptive_interval_ms_ * 2,
+        polling_config_.adaptive_slow_ms);
+    }
+  }
+  if (wake) {
+    WebRTCStatsHub::Instance()->Wake();
   }
 }
 
@@ -107,23 +375,21 @@ void WebRTCStatsObserver::ToggleStatsSendToRemoteHost(bool enable) {
 
   rtc_stats_to_remote_host_enabled_ = enable;
   if (enable) {
-    if (network_sender_ == nullptr) {
-      network_sender_.reset(new WebRTCStatsNetworkSender());
-    }
-    network_sender_->Start(stats_network_destination_hostname_,
-                           stats_network_destination_port_);
-  } else {
-    if (network_sender_ != nullptr) {
-      network_sender_->Stop();
-      network_sender_.reset();
-    }
+    network_sender_key_ = WebRTCStatsHub::Instance()->AcquireNetworkSender(
+      stats_network_destination_hostname_, stats_network_destination_port_,
+      stats_network_format_);
+  } else if (!network_sender_key_.empty()) {
+    WebRTCStatsHub::Instance()->ReleaseNetworkSender(network_sender_key_);
+    network_sender_key_.clear();
   }
   EvaluatePollNecessity();
 }
 
-void WebRTCStatsObserver::SetStatsNetworkDestination(std::string remote_hostname, int remote_port) {
+void WebRTCStatsObserver::SetStatsNetworkDestination(std::string remote_hostname, int remote_port,
+  StatsNetworkFormat format) {
   stats_network_destination_hostname_ = remote_hostname;
   stats_network_destination_port_ = remote_port;
+  stats_network_format_ = format;
 }
 
 void WebRTCStatsObserver::ToggleConnectionHealthStats(
@@ -151,69 +417,114 @@ void WebRTCStatsObserver::ToggleRTCStats(WebRTCStatsObserverWinUWP* observer) {
   EvaluatePollNecessity();
 }
 
+void WebRTCStatsObserver::ToggleQualityHistograms(
+  WebRTCStatsObserverWinUWP* observer) {
+  if (observer) {
+    webrtc_stats_observer_winuwp_ = observer;
+    if (!quality_histograms_enabled_) {
+      LOG(LS_INFO) << "WebRTCStatsObserver enabling quality histograms";
+      quality_histograms_.Reset();
+      quality_histograms_enabled_ = true;
+    }
+  } else if (quality_histograms_enabled_) {
+    LOG(LS_INFO) << "WebRTCStatsObserver disabling quality histograms";
+    ExportQualitySummary(true);
+    quality_histograms_enabled_ = false;
+  }
+  EvaluatePollNecessity();
+}
+
+void WebRTCStatsObserver::SetQualitySummaryInterval(int interval_ms) {
+  quality_summary_interval_ms_ = interval_ms;
+}
+
+void WebRTCStatsObserver::ExportQualitySummary(bool is_final) {
+  QualitySummary summary = quality_histograms_.TakeSummary(is_final);
+  if (EventEnabledStatsReportPacked()) {
+    // "metric.count=value" lines, same layout as the packed reports.
+    std::string packed;
+    packed.reserve(kQualityMetricCount * 7 * 24);
+    uint32_t count = 0;
+    auto append = [&packed, &count](const char* metric, const char* name,
+      const std::string& value) {
+      packed.append(metric);
+      packed.append(".");
+      packed.append(name);
+      packed.append("=");
+      packed.append(value);
+      packed.append("\n");
+      ++count;
+    };
+    for (int i = 0; i < kQualityMetricCount; ++i) {
+      const QualityMetricSummary& metric = summary.metrics[i];
+      if (metric.count == 0) {
+        continue;
+      }
+      const char* name = QualityMetricName(static_cast<QualityMetric>(i));
+      append(name, "count", rtc::ToString(metric.count));
+      append(name, "min", rtc::ToString(metric.min));
+      append(name, "max", rtc::ToString(metric.max));
+      append(name, "mean", rtc::ToString(metric.mean));
+      append(name, "p50", rtc::ToString(metric.p50));
+      append(name, "p95", rtc::ToString(metric.p95));
+      append(name, "p99", rtc::ToString(metric.p99));
+    }
+    append("summary", "durationMs", rtc::ToString(summary.duration_ms));
+    EventWriteStatsReportPacked(
+      is_final ? "quality_final" : "quality_summary", summary.timestamp,
+      count, packed.c_str());
+  }
+  if (webrtc_stats_observer_winuwp_) {
+    webrtc_stats_observer_winuwp_->OnQualitySummary(summary);
+  }
+}
+
 void WebRTCStatsObserver::OnComplete(const StatsReports& reports) {
+  // Each consumer gets the polls on its own interval.
+  bool deliver[kStatsConsumerCount];
+  std::shared_ptr<const StatsFilter> rtc_stats_filter;
+  std::shared_ptr<const StatsFilter> etw_stats_filter;
+  {
+    int64_t now = rtc::TimeMillis();
+    rtc::CritScope lock(&crit_sect_);
+    rtc_stats_filter = rtc_stats_filter_;
+    etw_stats_filter = etw_stats_filter_;
+    for (int i = 0; i < kStatsConsumerCount; ++i) {
+      // Some slack, the polls don't fire exactly on time.
+      deliver[i] = polling_config_.adaptive ||
+        now - last_delivery_ms_[i] >= polling_config_.interval_ms[i] * 9 / 10;
+      if (deliver[i]) {
+        last_delivery_ms_[i] = now;
+      }
+    }
+  }
+  if (polling_config_.adaptive) {
+    UpdateAdaptiveInterval(reports);
+  }
+
   Org::WebRtc::RTCStatsReports rtcStatsReports =
                 ref new Vector<Org::WebRtc::RTCStatsReport^>();
+  // Nothing is formatted unless a session listens.
+  bool send_to_etw = etw_stats_enabled_ && deliver[kStatsConsumerEtw] &&
+    IsETWStatsSessionListening();
+  bool send_to_remote_host = !network_sender_key_.empty() &&
+    deliver[kStatsConsumerRemoteHost];
+  StatsReports remote_host_reports;
 
   for (auto report : reports) {
-    std::string sgn = report->id()->ToString();
-    auto stat_group_name = sgn.c_str();
     auto stat_type = report->id()->type();
     auto timestamp = report->timestamp();
 
-    if (etw_stats_enabled_) {
-      bool sendToEtwPlugin = false;
-      if (stat_type == StatsReport::kStatsReportTypeSession ||
-          stat_type == StatsReport::kStatsReportTypeTrack ||
-		      stat_type == StatsReport::kStatsReportTypeBwe) {
-        sendToEtwPlugin = true;
-      } else if (stat_type == StatsReport::kStatsReportTypeSsrc) {
-        const StatsReport::Value* v = report->FindValue(
-          StatsReport::kStatsValueNameTrackId);
-        if (v) {
-          const std::string& id = v->string_val();
-          auto ls = pci_->local_streams();
-          auto rs = pci_->remote_streams();
-          if (ls->FindAudioTrack(id) || ls->FindVideoTrack(id) ||
-              rs->FindAudioTrack(id) || rs->FindVideoTrack(id)) {
-            sendToEtwPlugin = true;
-          }
-        }
-      }
+    // Filtered once for both the ETW session and the remote host.
+    bool tracked = (send_to_etw || send_to_remote_host) &&
+      IsTrackedReport(report);
+    if (tracked && send_to_remote_host) {
+      remote_host_reports.push_back(report);
+    }
 
-      if (sendToEtwPlugin) {
-        for (auto value : report->values()) {
-          auto stat_name = value.second->display_name();
-          switch (value.second->type()) {
-          case StatsReport::Value::kInt:
-            EventWriteStatsReportInt32(stat_group_name, timestamp, stat_name,
-              value.second->int_val());
-            break;
-          case StatsReport::Value::kInt64:
-            EventWriteStatsReportInt64(stat_group_name, timestamp, stat_name,
-              value.second->int64_val());
-            break;
-          case StatsReport::Value::kFloat:
-            EventWriteStatsReportFloat(stat_group_name, timestamp, stat_name,
-              value.second->float_val());
-            break;
-          case StatsReport::Value::kBool:
-            EventWriteStatsReportBool(stat_group_name, timestamp, stat_name,
-              value.second->bool_val());
-            break;
-          case StatsReport::Value::kStaticString:
-            EventWriteStatsReportString(stat_group_name, timestamp, stat_name,
-              value.second->static_string_val());
-            break;
-          case StatsReport::Value::kString:
-            EventWriteStatsReportString(stat_group_name, timestamp, stat_name,
-              value.second->string_val().c_str());
-            break;
-          default:
-            break;
-          }
-        }
-      }
+    if (send_to_etw && tracked &&
+        (!etw_stats_filter || etw_stats_filter->HasType(stat_type))) {
+      WriteETWStats(report, etw_stats_filter.get());
     }
     if (conn_health_stats_enabled_ && webrtc_stats_observer_winuwp_) {
       if (stat_type == StatsReport::kStatsReportTypeCandidatePair) {
@@ -242,17 +553,28 @@ void WebRTCStatsObserver::OnComplete(const StatsReports& reports) {
       }
     }
 
-    if (rtc_stats_enabled_ && webrtc_stats_observer_winuwp_) {
-      Org::WebRtc::RTCStatsReport^ rtcReport;
-			Org::WebRtc::Internal::ToCx(report, &rtcReport);
-      rtcStatsReports->Append(rtcReport);
+    if (rtc_stats_enabled_ && webrtc_stats_observer_winuwp_ &&
+        deliver[kStatsConsumerRtcStats]) {
+      const std::set<StatsReport::StatsValueName>* value_names = nullptr;
+      bool wanted = true;
+      if (rtc_stats_filter) {
+        wanted = rtc_stats_filter->HasType(stat_type);
+        if (!rtc_stats_filter->value_names.empty()) {
+          value_names = &rtc_stats_filter->value_names;
+        }
+      }
+      if (wanted) {
+        rtcStatsReports->Append(
+          Org::WebRtc::RTCStatsReport::CreateFromNative(report, value_names));
+      }
     }
   }
 
   if (rtcStatsReports->Size != 0) {
     webrtc_stats_observer_winuwp_->OnRTCStatsReportsReady(rtcStatsReports);
   }
-  if (conn_health_stats_enabled_ && webrtc_stats_observer_winuwp_) {
+  if (conn_health_stats_enabled_ && webrtc_stats_observer_winuwp_ &&
+      deliver[kStatsConsumerConnectionHealth]) {
     if (conn_health_stats_prev.timestamp != 0 &&
         conn_health_stats_.timestamp != conn_health_stats_prev.timestamp) {
       int64 time_elapsed_ms = static_cast<int64>(conn_health_stats_.timestamp -
@@ -271,11 +593,90 @@ void WebRTCStatsObserver::OnComplete(const StatsReports& reports) {
           time_elapsed_ms / 1024;
       }
     }
+    ResourceUsage usage = ResourceSampler::Instance()->GetLastUsage();
+    conn_health_stats_.cpu_usage = usage.processCpuUsage;
+    conn_health_stats_.memory_usage = usage.workingSetBytes;
+    conn_health_stats_.thread_cpu_usage = std::move(usage.threadCpuUsage);
     webrtc_stats_observer_winuwp_->OnConnectionHealthStats(conn_health_stats_);
   }
 
-  if (network_sender_ != nullptr) {
-    network_sender_->ProcessStats(reports, pci_);
+  if (send_to_remote_host) {
+    WebRTCStatsHub::Instance()->SendStats(network_sender_key_,
+      remote_host_reports, pci_);
+  }
+
+  if (quality_histograms_enabled_ && deliver[kStatsConsumerQuality]) {
+    quality_histograms_.AddReports(reports);
+    if (quality_summary_interval_ms_ > 0 &&
+        quality_histograms_.WindowDurationMs() >= quality_summary_interval_ms_) {
+      ExportQualitySummary(false);
+    }
+  }
+}
+
+void WebRTCStatsObserver::WriteETWStats(const StatsReport* report,
+  const StatsFilter* filter) {
+  std::string sgn = report->id()->ToString();
+  auto stat_group_name = sgn.c_str();
+  auto timestamp = report->timestamp();
+
+  if (EventEnabledStatsReportPacked()) {
+    // "name=value" lines, a single event for the whole report.
+    std::string packed;
+    packed.reserve(report->values().size() * 32);
+    uint32_t count = 0;
+    for (auto value : report->values()) {
+      if (filter && !filter->HasValue(value.first)) {
+        continue;
+      }
+      packed.append(value.second->display_name());
+      packed.append("=");
+      packed.append(value.second->ToString());
+      packed.append("\n");
+      ++count;
+    }
+    if (count != 0) {
+      EventWriteStatsReportPacked(stat_group_name, timestamp, count,
+        packed.c_str());
+    }
+  }
+
+  if (!EventEnabledStatsReportInt32()) {
+    return;
+  }
+  for (auto value : report->values()) {
+    if (filter && !filter->HasValue(value.first)) {
+      continue;
+    }
+    auto stat_name = value.second->display_name();
+    switch (value.second->type()) {
+    case StatsReport::Value::kInt:
+      EventWriteStatsReportInt32(stat_group_name, timestamp, stat_name,
+        value.second->int_val());
+      break;
+    case StatsReport::Value::kInt64:
+      EventWriteStatsReportInt64(stat_group_name, timestamp, stat_name,
+        value.second->int64_val());
+      break;
+    case StatsReport::Value::kFloat:
+      EventWriteStatsReportFloat(stat_group_name, timestamp, stat_name,
+        value.second->float_val());
+      break;
+    case StatsReport::Value::kBool:
+      EventWriteStatsReportBool(stat_group_name, timestamp, stat_name,
+        value.second->bool_val());
+      break;
+    case StatsReport::Value::kStaticString:
+      EventWriteStatsReportString(stat_group_name, timestamp, stat_name,
+        value.second->static_string_val());
+      break;
+    case StatsReport::Value::kString:
+      EventWriteStatsReportString(stat_group_name, timestamp, stat_name,
+        value.second->string_val().c_str());
+      break;
+    default:
+      break;
+    }
   }
 }
 
@@ -294,24 +695,28 @@ void WebRTCStatsObserver::PollStats() {
     return;
   }
 
-  GetAllStats();
-  /*auto lss = pci_->local_streams();
-  GetStreamCollectionStats(lss);*/
-
   {
     rtc::CritScope lock(&crit_sect_);
     if (status_ != kStarted) {
-      LOG(LS_INFO) << "WebRTCStatsObserver stopped";
-      status_ = kStopped;
       return;
     }
-    rtc::Thread::Current()->PostDelayed(RTC_FROM_HERE, kInterval, this, MSG_POLL_STATS);
   }
+
+  // Don't collect stats only an absent ETW session would get.
+  if (etw_stats_enabled_ && !conn_health_stats_enabled_ &&
+      !rtc_stats_enabled_ && !rtc_stats_to_remote_host_enabled_ &&
+      !quality_histograms_enabled_ && !IsETWStatsSessionListening()) {
+    return;
+  }
+
+  GetAllStats();
+  /*auto lss = pci_->local_streams();
+  GetStreamCollectionStats(lss);*/
 }
 void WebRTCStatsObserver::EvaluatePollNecessity() {
   if (etw_stats_enabled_ || webrtc_stats_observer_winuwp_ ||
       rtc_stats_enabled_ || conn_health_stats_enabled_ ||
-      rtc_stats_to_remote_host_enabled_) {
+      rtc_stats_to_remote_host_enabled_ || quality_histograms_enabled_) {
     Start();
   } else {
     Stop();
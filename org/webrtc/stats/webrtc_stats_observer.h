@@ -10,16 +10,23 @@
 #ifndef WEBRTC_BUILD_WINUWP_GYP_STATS_WEBRTC_STATS_OBSERVER_H_
 #define WEBRTC_BUILD_WINUWP_GYP_STATS_WEBRTC_STATS_OBSERVER_H_
 
+#include <map>
+#include <memory>
+#include <set>
 #include <string>
 
 #include "webrtc/api/peerconnectioninterface.h"
 #include "../wrapper/RTCStatsReport.h"
+#include "webrtc_stats_histograms.h"
+#include "webrtc_stats_network_sender.h"
 #include "webrtc/rtc_base/criticalsection.h"
 
+namespace rtc {
+  class Thread;
+}
 namespace webrtc {
 class CriticalSectionWrapper;
 class WebRTCStatsObserverWinUWP;
-class WebRTCStatsNetworkSender;
 
 struct ConnectionHealthStats {
   ConnectionHealthStats();
@@ -32,11 +39,76 @@ struct ConnectionHealthStats {
   int64 rtt;
   std::string local_candidate_type;
   std::string remote_candidate_type;
+  // Last sample of the ResourceSampler, shared by all the connections.
+  double cpu_usage;
+  int64 memory_usage;
+  std::map<std::string, double> thread_cpu_usage;
+};
+
+// Ids of the tracks of the local and remote streams of a connection, the
+// SSRC reports of other tracks are left out of the ETW and remote host
+// stats.  Follows the stream changes instead of looking the tracks up for
+// every report.
+class StatsTrackIdCache : public ObserverInterface {
+ public:
+  StatsTrackIdCache();
+  virtual ~StatsTrackIdCache();
+
+  void AddStream(rtc::scoped_refptr<MediaStreamInterface> stream);
+  void RemoveStream(rtc::scoped_refptr<MediaStreamInterface> stream);
+  bool Contains(const std::string& track_id);
+
+  // ObserverInterface, a track was added to or removed from a stream.
+  void OnChanged() override;
+
+ private:
+  rtc::CriticalSection crit_sect_;
+  std::map<MediaStreamInterface*, rtc::scoped_refptr<MediaStreamInterface>>
+    streams_;
+  std::set<std::string> track_ids_;
+  // |track_ids_| has to be rebuilt from |streams_|.
+  bool dirty_;
+};
+
+// The users of the polled stats, each can have its own interval.
+enum StatsConsumer {
+  kStatsConsumerEtw = 0,
+  kStatsConsumerConnectionHealth,
+  kStatsConsumerRtcStats,
+  kStatsConsumerRemoteHost,
+  // The samples of the quality histograms.
+  kStatsConsumerQuality,
+  kStatsConsumerCount
+};
+
+struct StatsPollingConfig {
+  StatsPollingConfig();
+  // Milliseconds between two deliveries to each consumer.
+  int interval_ms[kStatsConsumerCount];
+  // Ignores |interval_ms|: polls every |adaptive_fast_ms| while the ICE
+  // state or the bandwidth estimate changes, then backs off up to
+  // |adaptive_slow_ms| while the call is stable.
+  bool adaptive;
+  int adaptive_fast_ms;
+  int adaptive_slow_ms;
+};
+
+// Reports and values passed to a consumer, an empty set lets everything
+// through.  Used for the RTCStatsReportsReady subscribers, the reports and
+// values filtered out are never converted to CX objects, and for the ETW
+// session.
+struct StatsFilter {
+  bool HasType(StatsReport::StatsType type) const;
+  bool HasValue(StatsReport::StatsValueName name) const;
+
+  std::set<StatsReport::StatsType> report_types;
+  std::set<StatsReport::StatsValueName> value_names;
 };
 
 // A webrtc::StatsObserver implementation used to receive statistics about the
 // current PeerConnection. The statistics are logged to an ETW session and/or
-// sent to a WebRTCStatsObserverWinUWP.
+// sent to a WebRTCStatsObserverWinUWP.  Polled by the WebRTCStatsHub timer,
+// the stats are requested on the thread the observer was created on.
 class WebRTCStatsObserver : public StatsObserver, public rtc::MessageHandler {
  public:
   enum Status {
@@ -50,8 +122,28 @@ class WebRTCStatsObserver : public StatsObserver, public rtc::MessageHandler {
   void ToggleStatsSendToRemoteHost(bool enable);
   void ToggleConnectionHealthStats(WebRTCStatsObserverWinUWP* observer);
   void ToggleRTCStats(WebRTCStatsObserverWinUWP* observer);
-  
-  void SetStatsNetworkDestination(std::string remote_hostname, int remote_port);
+  // Disabling exports the final summary of the histograms.
+  void ToggleQualityHistograms(WebRTCStatsObserverWinUWP* observer);
+  // Milliseconds between two periodic quality summaries, 0 only exports
+  // the final one.
+  void SetQualitySummaryInterval(int interval_ms);
+
+  void SetStatsNetworkDestination(std::string remote_hostname, int remote_port,
+    StatsNetworkFormat format);
+
+  // Streams sent or received by the connection.
+  void OnStreamAdded(rtc::scoped_refptr<MediaStreamInterface> stream);
+  void OnStreamRemoved(rtc::scoped_refptr<MediaStreamInterface> stream);
+
+  void SetPollingConfig(const StatsPollingConfig& config);
+  void SetRTCStatsFilter(const StatsFilter& filter);
+  void SetETWStatsFilter(const StatsFilter& filter);
+  // Something changed in the connection, adaptive polling speeds up.
+  void NotifyActivity();
+
+  // Called by WebRTCStatsHub on each tick, posts a poll if it is due.
+  // Returns when the next one is due, -1 if stopped.
+  int64_t RequestPoll(int64_t now_ms);
 
   // StatsObserver
   virtual void OnComplete(const StatsReports& reports);
@@ -71,10 +163,34 @@ class WebRTCStatsObserver : public StatsObserver, public rtc::MessageHandler {
   void PollStats();
 
   void EvaluatePollNecessity();
+  // Session, track and BWE reports, and the SSRC reports of the tracks
+  // of the connection.
+  bool IsTrackedReport(const StatsReport* report);
+  // Writes |report| to the ETW session, as one packed event or one event
+  // per value depending on the enabled keywords.
+  void WriteETWStats(const StatsReport* report, const StatsFilter* filter);
+  // Poll interval, the shortest one of the enabled consumers.
+  int CurrentInterval();
+  void UpdateAdaptiveInterval(const StatsReports& reports);
+  // Sends a summary of the quality histograms to the ETW session, if one
+  // listens, and to the WebRTCStatsObserverWinUWP.
+  void ExportQualitySummary(bool is_final);
 
  private:
-  static const int kInterval;
   rtc::scoped_refptr<webrtc::PeerConnectionInterface> pci_;
+  rtc::Thread* poll_thread_;
+  StatsTrackIdCache track_ids_;
+
+  // Protected by crit_sect_.
+  StatsPollingConfig polling_config_;
+  int64_t next_poll_ms_;
+  int adaptive_interval_ms_;
+  // Replaced as a whole, OnComplete() keeps a reference on the one it uses.
+  std::shared_ptr<const StatsFilter> rtc_stats_filter_;
+  std::shared_ptr<const StatsFilter> etw_stats_filter_;
+  // Only used on the signaling thread.
+  int64_t last_delivery_ms_[kStatsConsumerCount];
+  int64_t last_send_bandwidth_;
 
   rtc::CriticalSection crit_sect_;
   Status status_;
@@ -85,10 +201,16 @@ class WebRTCStatsObserver : public StatsObserver, public rtc::MessageHandler {
   bool rtc_stats_enabled_;
   bool conn_health_stats_enabled_;
 
+  bool quality_histograms_enabled_;
+  int quality_summary_interval_ms_;
+  ConnectionQualityHistograms quality_histograms_;
+
   bool rtc_stats_to_remote_host_enabled_;
   std::string stats_network_destination_hostname_;
   int stats_network_destination_port_;
-  std::unique_ptr<WebRTCStatsNetworkSender> network_sender_;
+  StatsNetworkFormat stats_network_format_;
+  // Connection shared through WebRTCStatsHub, empty if not sending.
+  std::string network_sender_key_;
 };
 
 class WebRTCStatsObserverWinUWP {
@@ -97,6 +219,8 @@ class WebRTCStatsObserverWinUWP {
 
   virtual void OnRTCStatsReportsReady(
     const Org::WebRtc::RTCStatsReports& rtcStatsReports) = 0;
+
+  virtual void OnQualitySummary(const QualitySummary& summary) = 0;
 };
 
 }  // namespace webrtc
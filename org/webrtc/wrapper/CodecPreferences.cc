@@ -0,0 +1,92 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#include "CodecPreferences.h"
+#include <algorithm>
+#include "webrtc/media/base/codec.h"
+#include "webrtc/pc/mediasession.h"
+#include "webrtc/rtc_base/logging.h"
+#include "third_party/winuwp_h264/Utils/MftCapabilities.h"
+
+namespace {
+	using Org::WebRtc::Internal::CodecPreferences;
+
+	// Index of the first preference |codec| matches, the number of
+	// preferences if none.
+	size_t GetCodecRank(const CodecPreferences& preferences,
+		const cricket::Codec& codec) {
+		for (size_t i = 0; i < preferences.size(); ++i) {
+			if (cricket::CodecNamesEq(preferences[i].name, codec.name) &&
+				(preferences[i].clockrate == 0 ||
+					preferences[i].clockrate == codec.clockrate)) {
+				return i;
+			}
+		}
+		return preferences.size();
+	}
+
+	template <class C>
+	bool SortCodecs(const CodecPreferences& preferences,
+		cricket::MediaContentDescriptionImpl<C>* content) {
+		std::vector<C> codecs = content->codecs();
+		std::stable_sort(codecs.begin(), codecs.end(),
+			[&preferences](const C& a, const C& b) {
+			return GetCodecRank(preferences, a) < GetCodecRank(preferences, b);
+		});
+		bool changed = !codecs.empty() && codecs[0].id != content->codecs()[0].id;
+		content->set_codecs(codecs);
+		return changed;
+	}
+}
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			CodecPreferences GetHardwareCodecPreferences() {
+				CodecPreferences preferences;
+				webrtc::H264MftCapabilities capabilities =
+					webrtc::GetH264MftCapabilities();
+				// Either end of the call is worth it, the encoder saves the
+				// most.
+				if (capabilities.encoder.hardware || capabilities.decoder.hardware) {
+					preferences.push_back(CodecPreference(cricket::kH264CodecName, 0));
+				}
+				return preferences;
+			}
+
+			void ApplyCodecPreferences(const CodecPreferences& preferences,
+				webrtc::SessionDescriptionInterface* desc) {
+				if (preferences.empty() || desc == nullptr ||
+					desc->description() == nullptr) {
+					return;
+				}
+				cricket::SessionDescription* session = desc->description();
+				for (const cricket::ContentInfo& content : session->contents()) {
+					if (content.rejected) {
+						continue;
+					}
+					cricket::ContentDescription* description =
+						session->GetContentDescriptionByName(content.name);
+					bool changed = false;
+					if (cricket::IsVideoContent(&content)) {
+						changed = SortCodecs(preferences,
+							static_cast<cricket::VideoContentDescription*>(description));
+					} else if (cricket::IsAudioContent(&content)) {
+						changed = SortCodecs(preferences,
+							static_cast<cricket::AudioContentDescription*>(description));
+					}
+					if (changed) {
+						LOG(LS_INFO) << "Codec preferences applied to the "
+							<< content.name << " section of the " << desc->type();
+					}
+				}
+			}
+		}
+	}
+}  // namespace Org.WebRtc.Internal
@@ -0,0 +1,50 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#ifndef ORG_WEBRTC_CODECPREFERENCES_H_
+#define ORG_WEBRTC_CODECPREFERENCES_H_
+
+#include <string>
+#include <vector>
+#include "webrtc/api/jsep.h"
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			struct CodecPreference {
+				CodecPreference(const std::string& name, int clockrate) :
+					name(name), clockrate(clockrate) {
+				}
+
+				std::string name;
+				// 0 matches any clock rate.
+				int clockrate;
+			};
+
+			// Most preferred first.
+			typedef std::vector<CodecPreference> CodecPreferences;
+
+			// The codecs the probe of the MFTs found accelerated on this
+			// device.  Empty before the probe completes, or if nothing is
+			// accelerated.  Only H264 can be, VP8 and VP9 are always
+			// software.
+			CodecPreferences GetHardwareCodecPreferences();
+
+			// Moves the codecs of |preferences| to the front of the audio
+			// and video sections of |desc|, in the order of |preferences|.
+			// The other codecs, RTX and FEC included, keep their order after
+			// them.  Nothing is removed, so the remote end can still pick
+			// any codec it supports.
+			void ApplyCodecPreferences(const CodecPreferences& preferences,
+				webrtc::SessionDescriptionInterface* desc);
+		}
+	}
+}  // namespace Org.WebRtc.Internal
+
+#endif  // ORG_WEBRTC_CODECPREFERENCES_H_
@@ -0,0 +1,526 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#include "CustomVideoSource.h"
+#include <mfapi.h>
+#include <windows.graphics.directx.direct3d11.interop.h>
+#include <algorithm>
+#include "PeerConnectionInterface.h"
+#include "libyuv/convert.h"
+#include "libyuv/planar_functions.h"
+#include "libyuv/scale.h"
+#include "webrtc/rtc_base/helpers.h"
+#include "webrtc/rtc_base/logging.h"
+#include "webrtc/rtc_base/timeutils.h"
+#include "third_party/winuwp_h264/H264Decoder/H264Decoder.h"
+#include "third_party/winuwp_h264/Utils/GpuPipeline.h"
+
+using Windows::Graphics::DirectX::Direct3D11::IDirect3DDxgiInterfaceAccess;
+
+namespace {
+	const char kCustomVideoLabel[] = "custom_video_%llx";
+	const uint32 kDefaultMaxOutstandingFrames = 3;
+
+	// True if |object| has no other reference than the |expected| ones.
+	bool HasReferences(IUnknown* object, ULONG expected) {
+		object->AddRef();
+		return object->Release() == expected;
+	}
+}
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			CustomVideoCapturer::CustomVideoCapturer(int width, int height,
+				int framerate, bool screencast) :
+				_screencast(screencast),
+				_running(false) {
+				std::vector<cricket::VideoFormat> formats;
+				formats.push_back(cricket::VideoFormat(width, height,
+					cricket::VideoFormat::FpsToInterval(framerate), cricket::FOURCC_I420));
+				SetSupportedFormats(formats);
+			}
+
+			CustomVideoCapturer::~CustomVideoCapturer() {
+			}
+
+			bool CustomVideoCapturer::Adapt(int width, int height, int64_t* timeUs,
+				int* outWidth, int* outHeight, RECT* crop) {
+				if (!_running) {
+					return false;
+				}
+				int cropWidth, cropHeight, cropX, cropY;
+				int64_t translatedTimeUs;
+				if (!AdaptFrame(width, height, *timeUs, *timeUs, outWidth, outHeight,
+					&cropWidth, &cropHeight, &cropX, &cropY, &translatedTimeUs)) {
+					return false;
+				}
+				// NV12 and I420 need even sizes and offsets.
+				*outWidth = std::max(2, *outWidth & ~1);
+				*outHeight = std::max(2, *outHeight & ~1);
+				crop->left = cropX & ~1;
+				crop->top = cropY & ~1;
+				crop->right = crop->left + std::max(2, cropWidth & ~1);
+				crop->bottom = crop->top + std::max(2, cropHeight & ~1);
+				*timeUs = translatedTimeUs;
+				return true;
+			}
+
+			void CustomVideoCapturer::Deliver(const webrtc::VideoFrame& frame,
+				int width, int height) {
+				OnFrame(frame, width, height);
+			}
+
+			cricket::CaptureState CustomVideoCapturer::Start(
+				const cricket::VideoFormat& format) {
+				SetCaptureFormat(&format);
+				_running = true;
+				SetCaptureState(cricket::CS_RUNNING);
+				return cricket::CS_RUNNING;
+			}
+
+			void CustomVideoCapturer::Stop() {
+				_running = false;
+				SetCaptureFormat(nullptr);
+				SetCaptureState(cricket::CS_STOPPED);
+			}
+
+			bool CustomVideoCapturer::IsRunning() {
+				return _running;
+			}
+
+			bool CustomVideoCapturer::IsScreencast() const {
+				return _screencast;
+			}
+
+			bool CustomVideoCapturer::GetPreferredFourccs(
+				std::vector<uint32_t>* fourccs) {
+				fourccs->push_back(cricket::FOURCC_I420);
+				fourccs->push_back(cricket::FOURCC_NV12);
+				return true;
+			}
+
+			MediaVideoTrack^ CreateCustomVideoTrack(CustomVideoCapturer* capturer) {
+				return globals::RunOnGlobalThread<MediaVideoTrack^>(
+					[capturer]()->MediaVideoTrack^ {
+					char videoLabel[32];
+					_snprintf(videoLabel, sizeof(videoLabel), kCustomVideoLabel,
+						rtc::CreateRandomId64());
+					rtc::scoped_refptr<webrtc::VideoTrackInterface> track(
+						globals::gPeerConnectionFactory->CreateVideoTrack(videoLabel,
+							globals::gPeerConnectionFactory->CreateVideoSource(capturer, nullptr)));
+					return GetMediaVideoTrack(track);
+				});
+			}
+
+			TextureConverter::TextureConverter() :
+				_inputWidth(0), _inputHeight(0),
+				_outputWidth(0), _outputHeight(0),
+				_maxTextures(kDefaultMaxOutstandingFrames) {
+			}
+
+			TextureConverter::~TextureConverter() {
+				Reset();
+			}
+
+			void TextureConverter::SetMaxTextures(size_t maxTextures) {
+				_maxTextures = maxTextures;
+			}
+
+			void TextureConverter::Reset() {
+				if (_deviceManager != nullptr) {
+					RemoveEncoderDXGIDeviceManager(_deviceManager.Get());
+				}
+				_pool.clear();
+				_processor.Reset();
+				_enumerator.Reset();
+				_deviceManager.Reset();
+				_videoContext.Reset();
+				_videoDevice.Reset();
+				_multithread.Reset();
+				_device.Reset();
+				_inputWidth = _inputHeight = 0;
+				_outputWidth = _outputHeight = 0;
+			}
+
+			HRESULT TextureConverter::SetDevice(ID3D11Device* device) {
+				Reset();
+				HRESULT hr = S_OK;
+				ComPtr<ID3D11DeviceContext> context;
+				device->GetImmediateContext(&context);
+				ComPtr<ID3D11VideoDevice> videoDevice;
+				ComPtr<ID3D11VideoContext> videoContext;
+				ComPtr<ID3D10Multithread> multithread;
+				if (SUCCEEDED(hr)) hr = device->QueryInterface(IID_PPV_ARGS(&videoDevice));
+				if (SUCCEEDED(hr)) hr = context.As(&videoContext);
+				if (SUCCEEDED(hr)) hr = device->QueryInterface(IID_PPV_ARGS(&multithread));
+				// The encoder uses the device on its own threads.
+				if (SUCCEEDED(hr)) multithread->SetMultithreadProtected(TRUE);
+				UINT resetToken = 0;
+				ComPtr<IMFDXGIDeviceManager> deviceManager;
+				if (SUCCEEDED(hr)) hr = MFCreateDXGIDeviceManager(&resetToken, &deviceManager);
+				if (SUCCEEDED(hr)) hr = deviceManager->ResetDevice(device, resetToken);
+				if (FAILED(hr)) {
+					LOG(LS_WARNING) << "CustomVideoSource: can't use the device of the surfaces, hr="
+						<< hr;
+					return hr;
+				}
+				_device = device;
+				_videoDevice = videoDevice;
+				_videoContext = videoContext;
+				_multithread = multithread;
+				_deviceManager = deviceManager;
+				AddEncoderDXGIDeviceManager(_deviceManager.Get());
+				return S_OK;
+			}
+
+			HRESULT TextureConverter::UpdateProcessor(
+				const D3D11_TEXTURE2D_DESC& inputDesc, int width, int height) {
+				if (_processor != nullptr && inputDesc.Width == _inputWidth &&
+					inputDesc.Height == _inputHeight &&
+					width == _outputWidth && height == _outputHeight) {
+					return S_OK;
+				}
+				_processor.Reset();
+				_enumerator.Reset();
+				// The output views belong to the enumerator.
+				_pool.clear();
+
+				D3D11_VIDEO_PROCESSOR_CONTENT_DESC contentDesc = {};
+				contentDesc.InputFrameFormat = D3D11_VIDEO_FRAME_FORMAT_PROGRESSIVE;
+				contentDesc.InputWidth = inputDesc.Width;
+				contentDesc.InputHeight = inputDesc.Height;
+				contentDesc.OutputWidth = width;
+				contentDesc.OutputHeight = height;
+				contentDesc.Usage = D3D11_VIDEO_USAGE_OPTIMAL_SPEED;
+				HRESULT hr = _videoDevice->CreateVideoProcessorEnumerator(
+					&contentDesc, &_enumerator);
+				if (SUCCEEDED(hr)) {
+					hr = _videoDevice->CreateVideoProcessor(_enumerator.Get(), 0, &_processor);
+				}
+				if (FAILED(hr)) {
+					_enumerator.Reset();
+					return hr;
+				}
+				_videoContext->VideoProcessorSetStreamFrameFormat(_processor.Get(), 0,
+					D3D11_VIDEO_FRAME_FORMAT_PROGRESSIVE);
+				_videoContext->VideoProcessorSetStreamAutoProcessingMode(
+					_processor.Get(), 0, FALSE);
+				_inputWidth = inputDesc.Width;
+				_inputHeight = inputDesc.Height;
+				_outputWidth = width;
+				_outputHeight = height;
+				return S_OK;
+			}
+
+			TextureConverter::PooledTexture* TextureConverter::GetFreeTexture(
+				int width, int height) {
+				for (auto& pooled : _pool) {
+					// Held by the pool and by the sample only.
+					if (HasReferences(pooled.sample.Get(), 1) &&
+						HasReferences(pooled.buffer.Get(), 2)) {
+						return &pooled;
+					}
+				}
+				if (_pool.size() >= _maxTextures) {
+					return nullptr;
+				}
+
+				PooledTexture pooled;
+				D3D11_TEXTURE2D_DESC desc = {};
+				desc.Width = width;
+				desc.Height = height;
+				desc.MipLevels = 1;
+				desc.ArraySize = 1;
+				desc.Format = DXGI_FORMAT_NV12;
+				desc.SampleDesc.Count = 1;
+				desc.Usage = D3D11_USAGE_DEFAULT;
+				desc.BindFlags = D3D11_BIND_RENDER_TARGET;
+				HRESULT hr = _device->CreateTexture2D(&desc, nullptr, &pooled.texture);
+				D3D11_VIDEO_PROCESSOR_OUTPUT_VIEW_DESC viewDesc = {};
+				viewDesc.ViewDimension = D3D11_VPOV_DIMENSION_TEXTURE2D;
+				if (SUCCEEDED(hr)) {
+					hr = _videoDevice->CreateVideoProcessorOutputView(pooled.texture.Get(),
+						_enumerator.Get(), &viewDesc, &pooled.outputView);
+				}
+				if (SUCCEEDED(hr)) {
+					hr = MFCreateDXGISurfaceBuffer(__uuidof(ID3D11Texture2D),
+						pooled.texture.Get(), 0, FALSE, &pooled.buffer);
+				}
+				if (SUCCEEDED(hr)) {
+					hr = pooled.buffer->SetCurrentLength(width * height * 3 / 2);
+				}
+				if (SUCCEEDED(hr)) hr = MFCreateSample(&pooled.sample);
+				if (SUCCEEDED(hr)) hr = pooled.sample->AddBuffer(pooled.buffer.Get());
+				if (FAILED(hr)) {
+					LOG(LS_WARNING) << "CustomVideoSource: can't create a texture, hr=" << hr;
+					return nullptr;
+				}
+				_pool.push_back(pooled);
+				return &_pool.back();
+			}
+
+			rtc::scoped_refptr<webrtc::VideoFrameBuffer> TextureConverter::Convert(
+				ID3D11Texture2D* texture, const RECT& crop, int width, int height) {
+				ComPtr<ID3D11Device> device;
+				texture->GetDevice(&device);
+				if (device != _device && FAILED(SetDevice(device.Get()))) {
+					return nullptr;
+				}
+				if (_pool.size() > _maxTextures) {
+					_pool.resize(_maxTextures);
+				}
+
+				D3D11_TEXTURE2D_DESC inputDesc;
+				texture->GetDesc(&inputDesc);
+				_multithread->Enter();
+				HRESULT hr = UpdateProcessor(inputDesc, width, height);
+				PooledTexture* pooled = nullptr;
+				if (SUCCEEDED(hr)) {
+					pooled = GetFreeTexture(width, height);
+				}
+				ComPtr<ID3D11VideoProcessorInputView> inputView;
+				if (pooled != nullptr) {
+					D3D11_VIDEO_PROCESSOR_INPUT_VIEW_DESC viewDesc = {};
+					viewDesc.ViewDimension = D3D11_VPIV_DIMENSION_TEXTURE2D;
+					hr = _videoDevice->CreateVideoProcessorInputView(texture,
+						_enumerator.Get(), &viewDesc, &inputView);
+				}
+				if (pooled != nullptr && SUCCEEDED(hr)) {
+					_videoContext->VideoProcessorSetStreamSourceRect(_processor.Get(), 0,
+						TRUE, &crop);
+					D3D11_VIDEO_PROCESSOR_STREAM stream = {};
+					stream.Enable = TRUE;
+					stream.pInputSurface = inputView.Get();
+					hr = _videoContext->VideoProcessorBlt(_processor.Get(),
+						pooled->outputView.Get(), 0, 1, &stream);
+				}
+				_multithread->Leave();
+
+				if (pooled == nullptr || FAILED(hr)) {
+					if (FAILED(hr)) {
+						LOG(LS_WARNING) << "CustomVideoSource: can't convert the surface, hr="
+							<< hr;
+					}
+					return nullptr;
+				}
+				return new rtc::RefCountedObject<webrtc::DecodedSampleBuffer>(
+					pooled->sample, width, height);
+			}
+		}
+
+		CustomVideoSource::CustomVideoSource(uint32 width, uint32 height,
+			uint32 framerate) :
+			_capturer(nullptr),
+			_maxOutstandingFrames(kDefaultMaxOutstandingFrames),
+			_lastFrameTimeUs(0),
+			_maxFramerate(framerate),
+			_droppedFrames(0) {
+			width = std::max(2u, width & ~1u);
+			height = std::max(2u, height & ~1u);
+			framerate = std::min(std::max(framerate, 1u), 60u);
+			_bufferPool.reset(new webrtc::I420BufferPool(false, _maxOutstandingFrames));
+
+			_capturer = new Internal::CustomVideoCapturer(width, height, framerate, false);
+			_track = Internal::CreateCustomVideoTrack(_capturer);
+		}
+
+		CustomVideoSource::~CustomVideoSource() {
+			rtc::CritScope lock(&_critSect);
+			_textureConverter.reset();
+		}
+
+		MediaVideoTrack^ CustomVideoSource::Track::get() {
+			return _track;
+		}
+
+		bool CustomVideoSource::AdaptFrame(uint32 width, uint32 height,
+			int64_t* timeUs, int* outWidth, int* outHeight, RECT* crop) {
+			*timeUs = rtc::TimeMicros();
+			uint32 maxFramerate = _maxFramerate;
+			// Some slack for the jitter of the application.
+			if (maxFramerate > 0 && _lastFrameTimeUs > 0 &&
+				*timeUs - _lastFrameTimeUs < rtc::kNumMicrosecsPerSec * 9 / 10 / maxFramerate) {
+				return false;
+			}
+			if (width < 2 || height < 2 ||
+				!_capturer->Adapt(width, height, timeUs, outWidth, outHeight, crop)) {
+				return false;
+			}
+			return true;
+		}
+
+		bool CustomVideoSource::DeliverFrame(
+			rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer, int64_t timeUs,
+			uint32 width, uint32 height) {
+			if (buffer == nullptr) {
+				return false;
+			}
+			_lastFrameTimeUs = rtc::TimeMicros();
+			_capturer->Deliver(webrtc::VideoFrame(buffer, webrtc::kVideoRotation_0, timeUs),
+				width, height);
+			return true;
+		}
+
+		bool CustomVideoSource::PushI420Frame(uint32 width, uint32 height,
+			const Platform::Array<uint8>^ y, uint32 strideY,
+			const Platform::Array<uint8>^ u, uint32 strideU,
+			const Platform::Array<uint8>^ v, uint32 strideV) {
+			uint32 chromaWidth = (width + 1) / 2;
+			uint32 chromaHeight = (height + 1) / 2;
+			if (strideY < width || strideU < chromaWidth || strideV < chromaWidth) {
+				throw ref new Platform::InvalidArgumentException("Invalid I420 strides");
+			}
+			if (y == nullptr || u == nullptr || v == nullptr ||
+				y->Length < (uint64)strideY * height ||
+				u->Length < (uint64)strideU * chromaHeight ||
+				v->Length < (uint64)strideV * chromaHeight) {
+				throw ref new Platform::InvalidArgumentException("Invalid I420 planes");
+			}
+			rtc::CritScope lock(&_critSect);
+			int64_t timeUs;
+			int outWidth, outHeight;
+			RECT crop;
+			rtc::scoped_refptr<webrtc::I420Buffer> buffer;
+			if (AdaptFrame(width, height, &timeUs, &outWidth, &outHeight, &crop)) {
+				buffer = _bufferPool->CreateBuffer(outWidth, outHeight);
+			}
+			if (buffer == nullptr) {
+				++_droppedFrames;
+				return false;
+			}
+			const uint8* dataY = y->Data + crop.top * strideY + crop.left;
+			const uint8* dataU = u->Data + crop.top / 2 * strideU + crop.left / 2;
+			const uint8* dataV = v->Data + crop.top / 2 * strideV + crop.left / 2;
+			libyuv::I420Scale(dataY, strideY, dataU, strideU, dataV, strideV,
+				crop.right - crop.left, crop.bottom - crop.top,
+				buffer->MutableDataY(), buffer->StrideY(),
+				buffer->MutableDataU(), buffer->StrideU(),
+				buffer->MutableDataV(), buffer->StrideV(),
+				outWidth, outHeight, libyuv::kFilterBox);
+			return DeliverFrame(buffer, timeUs, width, height);
+		}
+
+		bool CustomVideoSource::PushNV12Frame(uint32 width, uint32 height,
+			const Platform::Array<uint8>^ y, uint32 strideY,
+			const Platform::Array<uint8>^ uv, uint32 strideUV) {
+			// The UV rows interleave a byte of each for every two pixels.
+			if (strideY < width || strideUV < (width + 1) / 2 * 2) {
+				throw ref new Platform::InvalidArgumentException("Invalid NV12 strides");
+			}
+			if (y == nullptr || uv == nullptr ||
+				y->Length < (uint64)strideY * height ||
+				uv->Length < (uint64)strideUV * ((height + 1) / 2)) {
+				throw ref new Platform::InvalidArgumentException("Invalid NV12 planes");
+			}
+			rtc::CritScope lock(&_critSect);
+			int64_t timeUs;
+			int outWidth, outHeight;
+			RECT crop;
+			rtc::scoped_refptr<webrtc::I420Buffer> buffer;
+			if (AdaptFrame(width, height, &timeUs, &outWidth, &outHeight, &crop)) {
+				buffer = _bufferPool->CreateBuffer(outWidth, outHeight);
+			}
+			if (buffer == nullptr) {
+				++_droppedFrames;
+				return false;
+			}
+			const uint8* dataY = y->Data + crop.top * strideY + crop.left;
+			const uint8* dataUV = uv->Data + crop.top / 2 * strideUV + crop.left;
+			int cropWidth = crop.right - crop.left;
+			int cropHeight = crop.bottom - crop.top;
+			if (cropWidth == outWidth && cropHeight == outHeight) {
+				libyuv::NV12ToI420(dataY, strideY, dataUV, strideUV,
+					buffer->MutableDataY(), buffer->StrideY(),
+					buffer->MutableDataU(), buffer->StrideU(),
+					buffer->MutableDataV(), buffer->StrideV(),
+					outWidth, outHeight);
+			}
+			else {
+				// libyuv doesn't scale NV12, deinterleaved first.
+				if (_scratchBuffer == nullptr || _scratchBuffer->width() != cropWidth ||
+					_scratchBuffer->height() != cropHeight) {
+					_scratchBuffer = webrtc::I420Buffer::Create(cropWidth, cropHeight);
+				}
+				libyuv::NV12ToI420(dataY, strideY, dataUV, strideUV,
+					_scratchBuffer->MutableDataY(), _scratchBuffer->StrideY(),
+					_scratchBuffer->MutableDataU(), _scratchBuffer->StrideU(),
+					_scratchBuffer->MutableDataV(), _scratchBuffer->StrideV(),
+					cropWidth, cropHeight);
+				buffer->ScaleFrom(*_scratchBuffer);
+			}
+			return DeliverFrame(buffer, timeUs, width, height);
+		}
+
+		bool CustomVideoSource::PushSurface(
+			Windows::Graphics::DirectX::Direct3D11::IDirect3DSurface^ surface) {
+			if (surface == nullptr) {
+				THROW_WEBRTC_NULL_REFERENCE_EXCEPTION("Invalid surface");
+			}
+			ComPtr<IDirect3DDxgiInterfaceAccess> access;
+			ComPtr<ID3D11Texture2D> texture;
+			HRESULT hr = reinterpret_cast<IInspectable*>(surface)->QueryInterface(
+				IID_PPV_ARGS(&access));
+			if (SUCCEEDED(hr)) {
+				hr = access->GetInterface(IID_PPV_ARGS(&texture));
+			}
+			if (FAILED(hr)) {
+				throw ref new Platform::InvalidArgumentException("Not a Direct3D 11 surface");
+			}
+			D3D11_TEXTURE2D_DESC desc;
+			texture->GetDesc(&desc);
+
+			rtc::CritScope lock(&_critSect);
+			int64_t timeUs;
+			int outWidth, outHeight;
+			RECT crop;
+			rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer;
+			if (AdaptFrame(desc.Width, desc.Height, &timeUs, &outWidth, &outHeight, &crop)) {
+				if (_textureConverter == nullptr) {
+					_textureConverter.reset(new Internal::TextureConverter());
+				}
+				_textureConverter->SetMaxTextures(_maxOutstandingFrames);
+				buffer = _textureConverter->Convert(texture.Get(), crop,
+					outWidth, outHeight);
+			}
+			if (buffer == nullptr) {
+				++_droppedFrames;
+				return false;
+			}
+			return DeliverFrame(buffer, timeUs, desc.Width, desc.Height);
+		}
+
+		uint32 CustomVideoSource::MaxOutstandingFrames::get() {
+			rtc::CritScope lock(&_critSect);
+			return _maxOutstandingFrames;
+		}
+
+		void CustomVideoSource::MaxOutstandingFrames::set(uint32 value) {
+			rtc::CritScope lock(&_critSect);
+			value = std::max(value, 1u);
+			if (value != _maxOutstandingFrames) {
+				_maxOutstandingFrames = value;
+				// The buffers in flight are freed by the frames holding them.
+				_bufferPool.reset(new webrtc::I420BufferPool(false, value));
+			}
+		}
+
+		uint32 CustomVideoSource::MaxFramerate::get() {
+			return _maxFramerate;
+		}
+
+		void CustomVideoSource::MaxFramerate::set(uint32 value) {
+			_maxFramerate = value;
+		}
+
+		uint64 CustomVideoSource::DroppedFrames::get() {
+			return _droppedFrames;
+		}
+	}
+}  // namespace Org.WebRtc
@@ -0,0 +1,215 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#ifndef ORG_WEBRTC_CUSTOMVIDEOSOURCE_H_
+#define ORG_WEBRTC_CUSTOMVIDEOSOURCE_H_
+
+#include <wrl.h>
+#include <d3d10.h>
+#include <d3d11.h>
+#include <mfidl.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "Media.h"
+#include "webrtc/api/video/i420_buffer.h"
+#include "webrtc/common_video/include/i420_buffer_pool.h"
+#include "webrtc/media/base/videocapturer.h"
+#include "webrtc/rtc_base/criticalsection.h"
+
+#pragma comment(lib, "d3d11")
+
+using Microsoft::WRL::ComPtr;
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			// Capturer of the frames a CustomVideoSource is given.  Owned
+			// by the video source of the track, which starts and stops it
+			// with the sinks.  The frames are adapted to what the sinks
+			// want and delivered on the thread pushing them.  A screencast
+			// has the encoders favor resolution over frame rate.
+			class CustomVideoCapturer : public cricket::VideoCapturer {
+			public:
+				CustomVideoCapturer(int width, int height, int framerate,
+					bool screencast);
+				virtual ~CustomVideoCapturer();
+
+				// Size to scale a |width|x|height| frame to, and the part of
+				// it to keep.  Returns false if the frame is to be dropped.
+				// |timeUs| becomes the timestamp of the frame.
+				bool Adapt(int width, int height, int64_t* timeUs,
+					int* outWidth, int* outHeight, RECT* crop);
+				void Deliver(const webrtc::VideoFrame& frame, int width, int height);
+
+				// VideoCapturer
+				cricket::CaptureState Start(const cricket::VideoFormat& format) override;
+				void Stop() override;
+				bool IsRunning() override;
+				bool IsScreencast() const override;
+
+			protected:
+				bool GetPreferredFourccs(std::vector<uint32_t>* fourccs) override;
+
+			private:
+				const bool _screencast;
+				std::atomic<bool> _running;
+			};
+
+			// Local track with |capturer| as its source, which takes
+			// ownership of it.
+			MediaVideoTrack^ CreateCustomVideoTrack(CustomVideoCapturer* capturer);
+
+			// Converts the textures of an application to NV12 textures of a
+			// small pool, on the GPU.  Registers the device of the textures
+			// with the H264 encoders so the converted textures are encoded
+			// without being read back.  Not thread safe.
+			class TextureConverter {
+			public:
+				TextureConverter();
+				~TextureConverter();
+
+				// Buffer of a |width|x|height| NV12 texture holding |crop| of
+				// |texture|.  Null if all the textures of the pool are in use
+				// or the texture can't be converted.
+				rtc::scoped_refptr<webrtc::VideoFrameBuffer> Convert(
+					ID3D11Texture2D* texture, const RECT& crop,
+					int width, int height);
+
+				void SetMaxTextures(size_t maxTextures);
+
+			private:
+				struct PooledTexture {
+					ComPtr<ID3D11Texture2D> texture;
+					ComPtr<ID3D11VideoProcessorOutputView> outputView;
+					ComPtr<IMFMediaBuffer> buffer;
+					ComPtr<IMFSample> sample;
+				};
+
+				HRESULT SetDevice(ID3D11Device* device);
+				HRESULT UpdateProcessor(const D3D11_TEXTURE2D_DESC& inputDesc,
+					int width, int height);
+				// A texture of the pool no frame uses anymore, a new one if
+				// there is room.  Null if none.
+				PooledTexture* GetFreeTexture(int width, int height);
+				void Reset();
+
+				ComPtr<ID3D11Device> _device;
+				ComPtr<ID3D10Multithread> _multithread;
+				ComPtr<ID3D11VideoDevice> _videoDevice;
+				ComPtr<ID3D11VideoContext> _videoContext;
+				ComPtr<IMFDXGIDeviceManager> _deviceManager;
+				ComPtr<ID3D11VideoProcessorEnumerator> _enumerator;
+				ComPtr<ID3D11VideoProcessor> _processor;
+				UINT _inputWidth;
+				UINT _inputHeight;
+				int _outputWidth;
+				int _outputHeight;
+				size_t _maxTextures;
+				std::vector<PooledTexture> _pool;
+			};
+		}
+
+		/// <summary>
+		/// Video track fed with frames the application pushes, rendered or
+		/// captured by itself.  Frames are given as I420 or NV12 planes or
+		/// as Direct3D 11 surfaces, and are scaled and dropped to match what
+		/// the peer connections and renderers of the track want.  The frames
+		/// are timestamped when pushed.
+		/// </summary>
+		/// <remarks>
+		/// Surfaces are converted to NV12 on the GPU.  A hardware H264
+		/// encoder takes the converted surfaces as they are, without reading
+		/// them back, when its peer connection was created after the first
+		/// surface was pushed, and as long as the surfaces come from the same
+		/// device.  The device should be created with
+		/// D3D11_CREATE_DEVICE_VIDEO_SUPPORT, and is put in multithreaded
+		/// mode.
+		/// </remarks>
+		public ref class CustomVideoSource sealed {
+		internal:
+			CustomVideoSource(uint32 width, uint32 height, uint32 framerate);
+
+		public:
+			virtual ~CustomVideoSource();
+
+			/// <summary>
+			/// Track of the pushed frames, to be added to a media stream.
+			/// </summary>
+			property MediaVideoTrack^ Track { MediaVideoTrack^ get(); }
+
+			/// <summary>
+			/// Pushes an I420 frame.  The planes are copied before the
+			/// method returns.
+			/// </summary>
+			/// <returns>False if the frame was dropped.</returns>
+			bool PushI420Frame(uint32 width, uint32 height,
+				const Platform::Array<uint8>^ y, uint32 strideY,
+				const Platform::Array<uint8>^ u, uint32 strideU,
+				const Platform::Array<uint8>^ v, uint32 strideV);
+
+			/// <summary>
+			/// Pushes an NV12 frame.  The planes are copied before the
+			/// method returns.
+			/// </summary>
+			/// <returns>False if the frame was dropped.</returns>
+			bool PushNV12Frame(uint32 width, uint32 height,
+				const Platform::Array<uint8>^ y, uint32 strideY,
+				const Platform::Array<uint8>^ uv, uint32 strideUV);
+
+			/// <summary>
+			/// Pushes a Direct3D 11 surface of any format the video processor
+			/// of its device can read.  The surface is converted before the
+			/// method returns and can be reused right away.
+			/// </summary>
+			/// <returns>False if the frame was dropped.</returns>
+			bool PushSurface(
+				Windows::Graphics::DirectX::Direct3D11::IDirect3DSurface^ surface);
+
+			/// <summary>
+			/// Number of frames the track may have in flight, from the
+			/// renderers to the encoders, before new frames are dropped.
+			/// Default value: 3
+			/// </summary>
+			property uint32 MaxOutstandingFrames { uint32 get(); void set(uint32 value); }
+			/// <summary>
+			/// Frames pushed faster are dropped, 0 for no limit.
+			/// Default value: the frame rate the source was created with
+			/// </summary>
+			property uint32 MaxFramerate { uint32 get(); void set(uint32 value); }
+			/// <summary>
+			/// Number of frames dropped, because of the frame rate or of
+			/// the frames in flight.
+			/// </summary>
+			property uint64 DroppedFrames { uint64 get(); }
+
+		private:
+			// Size and crop of a pushed frame, false to drop it.
+			bool AdaptFrame(uint32 width, uint32 height, int64_t* timeUs,
+				int* outWidth, int* outHeight, RECT* crop);
+			bool DeliverFrame(rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer,
+				int64_t timeUs, uint32 width, uint32 height);
+
+			MediaVideoTrack^ _track;
+			Internal::CustomVideoCapturer* _capturer;
+			// Serializes the pushes.
+			rtc::CriticalSection _critSect;
+			uint32 _maxOutstandingFrames;
+			std::unique_ptr<webrtc::I420BufferPool> _bufferPool;
+			std::unique_ptr<Internal::TextureConverter> _textureConverter;
+			// Cropped NV12 frames converted before being scaled.
+			rtc::scoped_refptr<webrtc::I420Buffer> _scratchBuffer;
+			int64_t _lastFrameTimeUs;
+			std::atomic<uint32> _maxFramerate;
+			std::atomic<uint64> _droppedFrames;
+		};
+	}
+}  // namespace Org.WebRtc
+
+#endif  // ORG_WEBRTC_CUSTOMVIDEOSOURCE_H_
@@ -11,15 +11,75 @@
 
 #include "DataChannel.h"
 #include "Marshalling.h"
+#include "DataChannelBuffer.h"
 
+using Org::WebRtc::Internal::FromCx;
 using Org::WebRtc::Internal::ToCx;
+using Windows::System::Threading::ThreadPoolTimer;
+using Windows::System::Threading::TimerElapsedHandler;
+
+namespace {
+	// Null if the message can't be sent.
+	std::unique_ptr<webrtc::DataBuffer> ToDataBuffer(
+		Org::WebRtc::IDataChannelMessage^ message) {
+		using Org::WebRtc::RTCDataChannelMessageType;
+		if (message->DataType == RTCDataChannelMessageType::String) {
+			Org::WebRtc::StringDataChannelMessage^ stringMessage =
+				(Org::WebRtc::StringDataChannelMessage^)message;
+
+			return std::unique_ptr<webrtc::DataBuffer>(new webrtc::DataBuffer(
+				FromCx(stringMessage->StringData)));
+		}
+		else if (message->DataType == RTCDataChannelMessageType::Binary) {
+			Org::WebRtc::BinaryDataChannelMessage^ binaryMessage =
+				(Org::WebRtc::BinaryDataChannelMessage^)message;
+
+			// Read the vector straight into the send buffer.
+			unsigned int size = binaryMessage->BinaryData->Size;
+			rtc::CopyOnWriteBuffer rtcBuffer(size);
+			if (size > 0) {
+				binaryMessage->BinaryData->GetMany(0,
+					Platform::ArrayReference<byte>(rtcBuffer.data<byte>(), size));
+			}
+			return std::unique_ptr<webrtc::DataBuffer>(
+				new webrtc::DataBuffer(rtcBuffer, true));
+		}
+		else if (message->DataType == RTCDataChannelMessageType::Buffer) {
+			Org::WebRtc::BufferDataChannelMessage^ bufferMessage =
+				(Org::WebRtc::BufferDataChannelMessage^)message;
+
+			const uint8_t* data = Org::WebRtc::Internal::GetIBufferData(
+				bufferMessage->BufferData);
+			if (data == nullptr) {
+				LOG(LS_ERROR) << "Tried to send data channel buffer without byte access";
+				return nullptr;
+			}
+			// The only copy, the native channel owns what it sends.
+			const rtc::CopyOnWriteBuffer rtcBuffer(data,
+				bufferMessage->BufferData->Length);
+			return std::unique_ptr<webrtc::DataBuffer>(
+				new webrtc::DataBuffer(rtcBuffer, true));
+		}
+		LOG(LS_ERROR) << "Tried to send data channel message of unknown data type";
+		return nullptr;
+	}
+}
 
 namespace Org {
 	namespace WebRtc {
 
 		RTCDataChannel::RTCDataChannel(
 			rtc::scoped_refptr<webrtc::DataChannelInterface> impl)
-			: _impl(impl) {
+			: _impl(impl),
+			_messageDelivery((int)RTCDataChannelMessageDelivery::Dispatcher),
+			_receiveBinaryAsBuffer(false),
+			_receiveCoalesced(false),
+			_bufferedAmountLowThreshold(0),
+			_draining(false),
+			_coalescingWindowMs(0),
+			_coalescingMaxBytes(1200),
+			_coalesceFlushScheduled(false),
+			_sendingOutgoing(false) {
 		}
 
 		rtc::scoped_refptr<webrtc::DataChannelInterface> RTCDataChannel::GetImpl() {
@@ -76,37 +136,242 @@ namespace Org {
 			BinaryData = data;
 		}
 
+		BufferDataChannelMessage::BufferDataChannelMessage(
+			Windows::Storage::Streams::IBuffer^ data) {
+			BufferData = data;
+		}
+
 		unsigned int RTCDataChannel::BufferedAmount::get() {
 			return _impl->buffered_amount();
 		}
 
+		unsigned int RTCDataChannel::BufferedAmountLowThreshold::get() {
+			return _bufferedAmountLowThreshold;
+		}
+
+		void RTCDataChannel::BufferedAmountLowThreshold::set(unsigned int value) {
+			_bufferedAmountLowThreshold = value;
+			// A higher threshold may let waiting messages go.
+			DrainPendingSends();
+		}
+
+		RTCDataChannelMessageDelivery RTCDataChannel::MessageDelivery::get() {
+			return (RTCDataChannelMessageDelivery)_messageDelivery.load();
+		}
+
+		void RTCDataChannel::MessageDelivery::set(RTCDataChannelMessageDelivery value) {
+			_messageDelivery = (int)value;
+		}
+
+		bool RTCDataChannel::ReceiveBinaryAsBuffer::get() {
+			return _receiveBinaryAsBuffer;
+		}
+
+		void RTCDataChannel::ReceiveBinaryAsBuffer::set(bool value) {
+			_receiveBinaryAsBuffer = value;
+		}
+
+		bool RTCDataChannel::ReceiveCoalesced::get() {
+			return _receiveCoalesced;
+		}
+
+		void RTCDataChannel::ReceiveCoalesced::set(bool value) {
+			_receiveCoalesced = value;
+		}
+
+		unsigned int RTCDataChannel::CoalescingWindowMs::get() {
+			return _coalescingWindowMs;
+		}
+
+		void RTCDataChannel::CoalescingWindowMs::set(unsigned int value) {
+			_coalescingWindowMs = value;
+			if (value == 0) {
+				// What was coalesced goes out before the next messages.
+				{
+					rtc::CritScope lock(&_coalesceCritSect);
+					FlushCoalescedLocked();
+				}
+				SendOutgoing();
+			}
+		}
+
+		unsigned int RTCDataChannel::CoalescingMaxBytes::get() {
+			return _coalescingMaxBytes;
+		}
+
+		void RTCDataChannel::CoalescingMaxBytes::set(unsigned int value) {
+			_coalescingMaxBytes = value;
+		}
+
 		void RTCDataChannel::Send(IDataChannelMessage^ message) {
-			if (message->DataType == RTCDataChannelMessageType::String) {
-				StringDataChannelMessage^ stringMessage =
-					(StringDataChannelMessage^)message;
+			std::unique_ptr<webrtc::DataBuffer> buffer = ToDataBuffer(message);
+			if (buffer == nullptr) {
+				return;
+			}
+			unsigned int windowMs = _coalescingWindowMs;
+			bool coalescing;
+			bool scheduleFlush = false;
+			{
+				rtc::CritScope lock(&_coalesceCritSect);
+				coalescing = windowMs > 0 || !_outgoing.empty() ||
+					_coalesced.size() > 0;
+				if (coalescing) {
+					size_t entrySize = Internal::kCoalescedEntryHeaderSize + buffer->size();
+					size_t maxBytes = _coalescingMaxBytes;
+					if (_coalesced.size() > 0 && _coalesced.size() + entrySize > maxBytes) {
+						FlushCoalescedLocked();
+					}
+					if (windowMs == 0) {
+						// The coalescing was just disabled, the message goes
+						// after the pack to keep the order.
+						FlushCoalescedLocked();
+						_outgoing.push_back(std::move(buffer));
+					} else if (Internal::kCoalescedHeaderSize + entrySize > maxBytes) {
+						// In a pack of its own, the receiver unpacks them all.
+						FlushCoalescedLocked();
+						_outgoing.push_back(std::unique_ptr<webrtc::DataBuffer>(
+							new webrtc::DataBuffer(
+								Internal::WrapCoalescedMessage(*buffer))));
+					} else {
+						Internal::AppendCoalescedMessage(*buffer, &_coalesced);
+						// The first message of the pack starts the window.
+						scheduleFlush = !_coalesceFlushScheduled;
+						_coalesceFlushScheduled = true;
+					}
+				}
+			}
+			if (!coalescing) {
+				_impl->Send(*buffer);
+				return;
+			}
+			if (scheduleFlush) {
+				RTCDataChannel^ channel = this;
+				Windows::Foundation::TimeSpan delay;
+				delay.Duration = windowMs * 10000ll;  // hns
+				ThreadPoolTimer::CreateTimer(
+					ref new TimerElapsedHandler([channel](ThreadPoolTimer^) {
+					{
+						rtc::CritScope lock(&channel->_coalesceCritSect);
+						channel->FlushCoalescedLocked();
+					}
+					channel->SendOutgoing();
+				}), delay);
+			}
+			SendOutgoing();
+		}
 
-				webrtc::DataBuffer buffer(rtc::ToUtf8(stringMessage->StringData->Data()));
-				_impl->Send(buffer);
+		void RTCDataChannel::FlushCoalescedLocked() {
+			_coalesceFlushScheduled = false;
+			if (_coalesced.size() == 0) {
+				return;
 			}
-			else if (message->DataType == RTCDataChannelMessageType::Binary) {
-				BinaryDataChannelMessage^ binaryMessage =
-					(BinaryDataChannelMessage^)message;
+			_outgoing.push_back(std::unique_ptr<webrtc::DataBuffer>(
+				new webrtc::DataBuffer(_coalesced, true)));
+			_coalesced = rtc::CopyOnWriteBuffer();
+		}
 
-				std::vector<byte> binaryDataVector;
-				binaryDataVector.reserve(binaryMessage->BinaryData->Size);
+		void RTCDataChannel::SendOutgoing() {
+			// The lock isn't held while sending, like DrainPendingSends().
+			bool sending = false;
+			while (true) {
+				std::unique_ptr<webrtc::DataBuffer> buffer;
+				{
+					rtc::CritScope lock(&_coalesceCritSect);
+					if (!sending) {
+						if (_sendingOutgoing) {
+							return;
+						}
+						_sendingOutgoing = true;
+						sending = true;
+					}
+					if (_outgoing.empty()) {
+						_sendingOutgoing = false;
+						return;
+					}
+					buffer = std::move(_outgoing.front());
+					_outgoing.pop_front();
+				}
+				_impl->Send(*buffer);
+			}
+		}
 
-				// convert IVector to std::vector
-				Org::WebRtc::Internal::FromCx(binaryMessage->BinaryData,
-					&binaryDataVector);
+		IAsyncAction^ RTCDataChannel::SendAsync(IDataChannelMessage^ message) {
+			PendingSend send;
+			send.buffer = ToDataBuffer(message);
+			Concurrency::task_completion_event<void> tce = send.tce;
+			if (send.buffer == nullptr) {
+				tce.set_exception(std::string("Invalid data channel message"));
+			} else {
+				{
+					rtc::CritScope lock(&_sendCritSect);
+					_pendingSends.push_back(std::move(send));
+				}
+				DrainPendingSends();
+			}
+			auto tceTask = Concurrency::task<void>(tce);
+			return Concurrency::create_async([tceTask] {
+				return tceTask;
+			});
+		}
 
-				byte* byteArr = (&binaryDataVector[0]);
-				const rtc::CopyOnWriteBuffer rtcBuffer(byteArr, binaryDataVector.size());
-				webrtc::DataBuffer buffer(rtcBuffer, true);
+		void RTCDataChannel::DrainPendingSends() {
+			{
+				rtc::CritScope lock(&_sendCritSect);
+				if (_draining || _pendingSends.empty()) {
+					return;
+				}
+				_draining = true;
+			}
+			// The lock isn't held while sending, the native calls block on
+			// the signaling thread, which calls us back from the observer.
+			while (true) {
+				if (_impl->buffered_amount() > _bufferedAmountLowThreshold) {
+					{
+						rtc::CritScope lock(&_sendCritSect);
+						_draining = false;
+					}
+					// The observer may have been called before |_draining| was
+					// cleared, and returned.  Look once more after clearing it.
+					if (_impl->buffered_amount() > _bufferedAmountLowThreshold) {
+						return;
+					}
+					rtc::CritScope lock(&_sendCritSect);
+					if (_draining || _pendingSends.empty()) {
+						return;
+					}
+					_draining = true;
+					continue;
+				}
+				PendingSend send;
+				{
+					rtc::CritScope lock(&_sendCritSect);
+					if (_pendingSends.empty()) {
+						_draining = false;
+						return;
+					}
+					send = std::move(_pendingSends.front());
+					_pendingSends.pop_front();
+				}
+				// Packed alone while coalescing, like the large messages.
+				bool sent = _coalescingWindowMs > 0 ?
+					_impl->Send(Internal::WrapCoalescedMessage(*send.buffer)) :
+					_impl->Send(*send.buffer);
+				if (sent) {
+					send.tce.set();
+				} else {
+					send.tce.set_exception(std::string("Data channel send failed"));
+				}
+			}
+		}
 
-				_impl->Send(buffer);
+		void RTCDataChannel::FailPendingSends() {
+			std::deque<PendingSend> sends;
+			{
+				rtc::CritScope lock(&_sendCritSect);
+				sends.swap(_pendingSends);
 			}
-			else {
-				LOG(LS_ERROR) << "Tried to send data channel message of unknown data type";
+			for (auto& send : sends) {
+				send.tce.set_exception(std::string("Data channel closed"));
 			}
 		}
 	}
@@ -12,12 +12,17 @@
 #define ORG_WEBRTC_DATACHANNEL_H_
 
 #include <collection.h>
+#include <ppltasks.h>
+#include <atomic>
+#include <deque>
+#include <memory>
 #include "GlobalObserver.h"
 #include "webrtc/api/peerconnectioninterface.h"
 #include "Delegates.h"
 
 using Platform::String;
 using Platform::IBox;
+using Windows::Foundation::IAsyncAction;
 using Windows::Foundation::Collections::IVector;
 
 namespace Org {
@@ -64,12 +69,34 @@ namespace Org {
 			property IBox<uint16>^ Id;
 		};
 
+		/// <summary>
+		/// Thread on which <see cref="RTCDataChannel::OnMessage"/> is raised.
+		/// </summary>
+		public enum class RTCDataChannelMessageDelivery {
+			/// <summary>
+			/// Messages are raised on the UI dispatcher together with
+			/// the other events of the peer connection.
+			/// </summary>
+			Dispatcher,
+			/// <summary>
+			/// Messages are raised in order on a thread pool worker.
+			/// </summary>
+			Worker,
+			/// <summary>
+			/// Messages are raised on the WebRTC signaling thread as they
+			/// are received. The handler must return quickly and must not
+			/// call blocking RTCPeerConnection methods.
+			/// </summary>
+			SignalingThread
+		};
+
 		/// <summary>
 		/// Type of messages for a <see cref="RTCDataChannel"/>.
 		/// </summary>
 		public enum class RTCDataChannelMessageType {
 			String,
-			Binary
+			Binary,
+			Buffer
 		};
 
 		/// <summary>
@@ -109,6 +136,23 @@ namespace Org {
 			};
 		};
 
+		/// <summary>
+		/// Message type used for sending binary data over a data channel
+		/// without marshalling it byte by byte. Received buffers point
+		/// straight at the memory of the received message.
+		/// </summary>
+		public ref class BufferDataChannelMessage sealed : IDataChannelMessage {
+		public:
+			BufferDataChannelMessage(Windows::Storage::Streams::IBuffer^ data);
+			property Windows::Storage::Streams::IBuffer^ BufferData;
+			property RTCDataChannelMessageType DataType {
+				virtual RTCDataChannelMessageType get() {
+					return RTCDataChannelMessageType::Buffer;
+				}
+				virtual void set(RTCDataChannelMessageType) { }
+			};
+		};
+
 		/// <summary>
 		/// Event data received from a data channel.
 		/// </summary>
@@ -125,6 +169,18 @@ namespace Org {
 			RTCDataChannel(rtc::scoped_refptr<webrtc::DataChannelInterface> impl);
 			rtc::scoped_refptr<webrtc::DataChannelInterface> GetImpl();
 			friend class Org::WebRtc::Internal::DataChannelObserver;
+			// Sends the messages waiting in SendAsync() while the buffered
+			// amount is at most the threshold.  Only one thread sends them
+			// at a time, the others return at once.
+			void DrainPendingSends();
+			// The channel closed, the messages waiting fail.
+			void FailPendingSends();
+			// Moves the coalesced messages to the outgoing messages.
+			// Called with |_coalesceCritSect| held.
+			void FlushCoalescedLocked();
+			// Sends the outgoing messages in order.  Only one thread sends
+			// them at a time, the others return at once.
+			void SendOutgoing();
 
 		public:
 			/// <summary>
@@ -175,6 +231,73 @@ namespace Org {
 			/// </summary>
 			property unsigned int BufferedAmount { unsigned int get(); }
 
+			/// <summary>
+			/// Buffered amount, in bytes, at or under which
+			/// <see cref="OnBufferedAmountLow"/> is raised and the messages
+			/// of <see cref="SendAsync"/> are sent.
+			/// Default value: 0
+			/// </summary>
+			property unsigned int BufferedAmountLowThreshold {
+				unsigned int get();
+				void set(unsigned int value);
+			}
+
+			/// <summary>
+			/// Selects the thread <see cref="OnMessage"/> is raised on.
+			/// Headless consumers can avoid the UI dispatcher entirely.
+			/// Default value: Dispatcher
+			/// </summary>
+			property RTCDataChannelMessageDelivery MessageDelivery {
+				RTCDataChannelMessageDelivery get();
+				void set(RTCDataChannelMessageDelivery value);
+			}
+
+			/// <summary>
+			/// When true, binary messages are received as
+			/// <see cref="BufferDataChannelMessage"/> instead of
+			/// <see cref="BinaryDataChannelMessage"/>.
+			/// Default value: false
+			/// </summary>
+			property bool ReceiveBinaryAsBuffer { bool get(); void set(bool value); }
+
+			/// <summary>
+			/// When true, the packs of a remote end coalescing its messages
+			/// are unpacked before <see cref="OnMessage"/> is raised, once
+			/// per message.  Only to be set when the remote end sets
+			/// <see cref="CoalescingWindowMs"/>, as agreed on with the
+			/// label or the protocol of the channel: a binary message of
+			/// its own looking like a pack would be unpacked.
+			/// Default value: false
+			/// </summary>
+			property bool ReceiveCoalesced { bool get(); void set(bool value); }
+
+			/// <summary>
+			/// Window, in milliseconds, the messages of <see cref="Send"/>
+			/// are packed into one transport message over, for streams of
+			/// small messages.  While it isn't 0 every message sent is
+			/// packed, the large ones and those of <see cref="SendAsync"/>
+			/// in a pack of their own, so the remote end, which sets
+			/// <see cref="ReceiveCoalesced"/>, unpacks them all.  0 disables
+			/// the coalescing.
+			/// Default value: 0
+			/// </summary>
+			property unsigned int CoalescingWindowMs {
+				unsigned int get();
+				void set(unsigned int value);
+			}
+
+			/// <summary>
+			/// Largest transport message the coalesced messages are packed
+			/// into, in bytes.  A full pack is sent without waiting for the
+			/// end of the window, a larger message is sent in a pack of
+			/// its own.
+			/// Default value: 1200
+			/// </summary>
+			property unsigned int CoalescingMaxBytes {
+				unsigned int get();
+				void set(unsigned int value);
+			}
+
 			/// <summary>
 			/// Event triggered when a message is successfully received.
 			/// </summary>
@@ -195,6 +318,12 @@ namespace Org {
 			/// </summary>
 			event EventDelegate^ OnError;
 
+			/// <summary>
+			/// Event triggered when the buffered amount falls to
+			/// <see cref="BufferedAmountLowThreshold"/> or under.
+			/// </summary>
+			event EventDelegate^ OnBufferedAmountLow;
+
 			/// <summary>
 			/// Closes the data channel connection.
 			/// </summary>
@@ -202,12 +331,49 @@ namespace Org {
 
 			/// <summary>
 			/// Attempts to send data on channel's underlying data transport.
+			/// Packed with the other messages of the window if
+			/// <see cref="CoalescingWindowMs"/> is set.
 			/// </summary>
 			/// <param name="data">Message to be sent.</param>
 			void Send(IDataChannelMessage^ data);
 
+			/// <summary>
+			/// Sends data once the buffered amount is at most
+			/// <see cref="BufferedAmountLowThreshold"/>, in the order of the
+			/// calls.  Awaiting each call keeps the channel busy without
+			/// queueing more than the threshold in the transport, which
+			/// would delay the media.  Messages sent with
+			/// <see cref="Send"/> may pass those waiting.
+			/// </summary>
+			/// <param name="data">Message to be sent.</param>
+			/// <returns>Completes when the message was handed to the
+			/// transport, fails if the channel closed first or refused it.
+			/// </returns>
+			IAsyncAction^ SendAsync(IDataChannelMessage^ data);
+
 		private:
+			struct PendingSend {
+				std::unique_ptr<webrtc::DataBuffer> buffer;
+				Concurrency::task_completion_event<void> tce;
+			};
+
 			rtc::scoped_refptr<webrtc::DataChannelInterface> _impl;
+			std::atomic<int> _messageDelivery;
+			std::atomic<bool> _receiveBinaryAsBuffer;
+			std::atomic<bool> _receiveCoalesced;
+			std::atomic<unsigned int> _bufferedAmountLowThreshold;
+			rtc::CriticalSection _sendCritSect;
+			// Guarded by |_sendCritSect|.
+			std::deque<PendingSend> _pendingSends;
+			bool _draining;
+			std::atomic<unsigned int> _coalescingWindowMs;
+			std::atomic<unsigned int> _coalescingMaxBytes;
+			rtc::CriticalSection _coalesceCritSect;
+			// Guarded by |_coalesceCritSect|.
+			rtc::CopyOnWriteBuffer _coalesced;
+			bool _coalesceFlushScheduled;
+			std::deque<std::unique_ptr<webrtc::DataBuffer>> _outgoing;
+			bool _sendingOutgoing;
 		};
 
 		/// <summary>
@@ -0,0 +1,158 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#include "DataChannelBuffer.h"
+#include <string.h>
+
+using Microsoft::WRL::MakeAndInitialize;
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			DataChannelBuffer::DataChannelBuffer() {
+			}
+
+			DataChannelBuffer::~DataChannelBuffer() {
+			}
+
+			HRESULT DataChannelBuffer::RuntimeClassInitialize(
+				const rtc::CopyOnWriteBuffer& data) {
+				_data = data;
+				return S_OK;
+			}
+
+			IFACEMETHODIMP DataChannelBuffer::get_Capacity(UINT32* value) {
+				if (value == nullptr) {
+					return E_POINTER;
+				}
+				*value = (UINT32)_data.capacity();
+				return S_OK;
+			}
+
+			IFACEMETHODIMP DataChannelBuffer::get_Length(UINT32* value) {
+				if (value == nullptr) {
+					return E_POINTER;
+				}
+				*value = (UINT32)_data.size();
+				return S_OK;
+			}
+
+			IFACEMETHODIMP DataChannelBuffer::put_Length(UINT32 value) {
+				if (value > _data.capacity()) {
+					return E_INVALIDARG;
+				}
+				_data.SetSize(value);
+				return S_OK;
+			}
+
+			IFACEMETHODIMP DataChannelBuffer::Buffer(byte** value) {
+				if (value == nullptr) {
+					return E_POINTER;
+				}
+				// Clones the memory only if it is still shared.
+				*value = _data.data<byte>();
+				return S_OK;
+			}
+
+			Windows::Storage::Streams::IBuffer^ ToIBuffer(
+				const rtc::CopyOnWriteBuffer& data) {
+				ComPtr<DataChannelBuffer> buffer;
+				if (FAILED(MakeAndInitialize<DataChannelBuffer>(&buffer, data))) {
+					return nullptr;
+				}
+				return reinterpret_cast<Windows::Storage::Streams::IBuffer^>(
+					static_cast<ABI::Windows::Storage::Streams::IBuffer*>(buffer.Get()));
+			}
+
+			const uint8_t* GetIBufferData(Windows::Storage::Streams::IBuffer^ buffer) {
+				ComPtr<Windows::Storage::Streams::IBufferByteAccess> byteAccess;
+				if (FAILED(reinterpret_cast<IInspectable*>(buffer)->QueryInterface(
+					IID_PPV_ARGS(&byteAccess)))) {
+					return nullptr;
+				}
+				byte* data;
+				if (FAILED(byteAccess->Buffer(&data))) {
+					return nullptr;
+				}
+				return data;
+			}
+
+			namespace {
+				const uint8_t kCoalescedMagic[kCoalescedHeaderSize] = {
+					0xc0, 0xa1, 0xe5, 0xce };
+				const uint8_t kCoalescedText = 0;
+				const uint8_t kCoalescedBinary = 1;
+			}
+
+			void AppendCoalescedMessage(const webrtc::DataBuffer& message,
+				rtc::CopyOnWriteBuffer* pack) {
+				if (pack->size() == 0) {
+					pack->AppendData(kCoalescedMagic, kCoalescedHeaderSize);
+				}
+				uint32_t size = (uint32_t)message.size();
+				const uint8_t entryHeader[kCoalescedEntryHeaderSize] = {
+					message.binary ? kCoalescedBinary : kCoalescedText,
+					(uint8_t)(size >> 24), (uint8_t)(size >> 16),
+					(uint8_t)(size >> 8), (uint8_t)size };
+				pack->AppendData(entryHeader, kCoalescedEntryHeaderSize);
+				pack->AppendData(message.data.data(), message.size());
+			}
+
+			webrtc::DataBuffer WrapCoalescedMessage(const webrtc::DataBuffer& message) {
+				rtc::CopyOnWriteBuffer pack;
+				pack.EnsureCapacity(kCoalescedHeaderSize + kCoalescedEntryHeaderSize +
+					message.size());
+				AppendCoalescedMessage(message, &pack);
+				return webrtc::DataBuffer(pack, true);
+			}
+
+			bool UnpackCoalescedMessages(const webrtc::DataBuffer& message,
+				std::vector<webrtc::DataBuffer>* messages) {
+				const uint8_t* data = message.data.data();
+				size_t size = message.size();
+				if (!message.binary || size < kCoalescedHeaderSize ||
+					memcmp(data, kCoalescedMagic, kCoalescedHeaderSize) != 0) {
+					return false;
+				}
+				// Checked in full first, a message which only looks like a
+				// pack is delivered as it is.
+				size_t count = 0;
+				size_t offset = kCoalescedHeaderSize;
+				while (offset < size) {
+					if (size - offset < kCoalescedEntryHeaderSize ||
+						data[offset] > kCoalescedBinary) {
+						return false;
+					}
+					size_t length = (size_t)data[offset + 1] << 24 |
+						(size_t)data[offset + 2] << 16 |
+						(size_t)data[offset + 3] << 8 | data[offset + 4];
+					offset += kCoalescedEntryHeaderSize;
+					if (length > size - offset) {
+						return false;
+					}
+					offset += length;
+					++count;
+				}
+				messages->reserve(messages->size() + count);
+				offset = kCoalescedHeaderSize;
+				while (offset < size) {
+					bool binary = data[offset] == kCoalescedBinary;
+					size_t length = (size_t)data[offset + 1] << 24 |
+						(size_t)data[offset + 2] << 16 |
+						(size_t)data[offset + 3] << 8 | data[offset + 4];
+					offset += kCoalescedEntryHeaderSize;
+					messages->push_back(webrtc::DataBuffer(
+						rtc::CopyOnWriteBuffer(data + offset, length), binary));
+					offset += length;
+				}
+				return true;
+			}
+		}
+	}
+}  // namespace Org.WebRtc.Internal
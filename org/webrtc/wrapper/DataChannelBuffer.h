@@ -0,0 +1,81 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#ifndef ORG_WEBRTC_DATACHANNELBUFFER_H_
+#define ORG_WEBRTC_DATACHANNELBUFFER_H_
+
+#include <wrl.h>
+#include <robuffer.h>
+#include <windows.storage.streams.h>
+#include <vector>
+#include "webrtc/api/datachannelinterface.h"
+#include "webrtc/rtc_base/copyonwritebuffer.h"
+
+using Microsoft::WRL::ComPtr;
+using Microsoft::WRL::RuntimeClass;
+using Microsoft::WRL::RuntimeClassFlags;
+using Microsoft::WRL::RuntimeClassType;
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			// IBuffer exposing the memory of a received data channel message
+			// to the application without copying it.  The buffer shares the
+			// CopyOnWriteBuffer, the memory is only duplicated if the
+			// application writes to it while another reference exists.
+			class DataChannelBuffer :
+				public RuntimeClass<RuntimeClassFlags<RuntimeClassType::WinRtClassicComMix>,
+				ABI::Windows::Storage::Streams::IBuffer,
+				Windows::Storage::Streams::IBufferByteAccess> {
+				InspectableClass(L"Org.WebRtc.Internal.DataChannelBuffer", BaseTrust)
+			public:
+				DataChannelBuffer();
+				virtual ~DataChannelBuffer();
+				HRESULT RuntimeClassInitialize(const rtc::CopyOnWriteBuffer& data);
+
+				// IBuffer
+				IFACEMETHOD(get_Capacity)(UINT32* value);
+				IFACEMETHOD(get_Length)(UINT32* value);
+				IFACEMETHOD(put_Length)(UINT32 value);
+
+				// IBufferByteAccess
+				IFACEMETHOD(Buffer)(byte** value);
+
+			private:
+				rtc::CopyOnWriteBuffer _data;
+			};
+
+			// Wraps |data| in an IBuffer, see DataChannelBuffer.
+			Windows::Storage::Streams::IBuffer^ ToIBuffer(
+				const rtc::CopyOnWriteBuffer& data);
+
+			// Returns the memory behind |buffer| or nullptr if it can't be
+			// accessed directly.
+			const uint8_t* GetIBufferData(Windows::Storage::Streams::IBuffer^ buffer);
+
+			// Coalesced messages: several data channel messages packed in
+			// one binary message, a 4 byte magic followed by, for each
+			// message, a type byte, its length on 4 bytes big endian and
+			// its data.
+			const size_t kCoalescedHeaderSize = 4;
+			const size_t kCoalescedEntryHeaderSize = 5;
+			// Starts |pack| if it is empty and appends |message| to it.
+			void AppendCoalescedMessage(const webrtc::DataBuffer& message,
+				rtc::CopyOnWriteBuffer* pack);
+			// A pack holding only |message|.
+			webrtc::DataBuffer WrapCoalescedMessage(const webrtc::DataBuffer& message);
+			// False if |message| isn't a valid pack, it is then a message
+			// of its own.
+			bool UnpackCoalescedMessages(const webrtc::DataBuffer& message,
+				std::vector<webrtc::DataBuffer>* messages);
+		}
+	}
+}  // namespace Org.WebRtc.Internal
+
+#endif  // ORG_WEBRTC_DATACHANNELBUFFER_H_
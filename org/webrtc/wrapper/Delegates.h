@@ -26,6 +26,20 @@ namespace Org {
 			const Platform::Array<uint8>^, uint32,
 			const Platform::Array<uint8>^, uint32);
 
+		ref class RawVideoFrame;
+		/// <summary>
+		/// Delegate for receiving refcounted video frames from RawVideoSource.
+		/// </summary>
+		public delegate void RawVideoFrameDelegate(RawVideoFrame^);
+
+		/// <summary>
+		/// Delegate for receiving audio frames from RawAudioSource: the
+		/// interleaved 16 bit samples, the sample rate and the number of
+		/// channels.
+		/// </summary>
+		public delegate void RawAudioSourceDelegate(
+			const Platform::Array<int16>^, uint32, uint32);
+
 		/// <summary>
 		/// Delegate for receiving video frames from EncodedVideoSource.
 		/// </summary>
@@ -40,6 +54,13 @@ namespace Org {
 		public delegate void RTCPeerConnectionIceEventDelegate(
 			RTCPeerConnectionIceEvent^);
 
+		ref class RTCPeerConnectionIceCandidatesEvent;
+		/// <summary>
+		/// Delegate for receiving batches of ICE candidates.
+		/// </summary>
+		public delegate void RTCPeerConnectionIceCandidatesEventDelegate(
+			RTCPeerConnectionIceCandidatesEvent^);
+
 		// ------------------
 		ref class RTCPeerConnectionIceStateChangeEvent;
 		/// <summary>
@@ -62,6 +83,13 @@ namespace Org {
 		public delegate void RTCStatsReportsReadyEventDelegate(
 			RTCStatsReportsReadyEvent^);
 
+		ref class RTCQualitySummary;
+		/// <summary>
+		/// Delegate for receiving the quality summaries of a connection.
+		/// </summary>
+		public delegate void RTCQualitySummaryDelegate(
+			RTCQualitySummary^);
+
 		// ------------------
 		ref class MediaStreamEvent;
 		/// <summary>
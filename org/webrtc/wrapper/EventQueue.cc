@@ -0,0 +1,149 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#include "EventQueue.h"
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include "webrtc/common_video/video_common_winuwp.h"
+#include "webrtc/rtc_base/trace_event.h"
+
+using Windows::System::Threading::ThreadPool;
+using Windows::System::Threading::ThreadPoolTimer;
+using Windows::System::Threading::TimerElapsedHandler;
+using Windows::System::Threading::WorkItemHandler;
+using Windows::UI::Core::CoreDispatcher;
+using Windows::UI::Core::CoreDispatcherPriority;
+using Windows::UI::Core::DispatchedHandler;
+
+namespace {
+	// Ids of the trace flows, from a post to the drain it scheduled,
+	// unique across the queues.
+	std::atomic<uint64_t> gNextDrainFlowId(0);
+}
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			EventQueue::EventQueue(Target target) :
+				_target(target),
+				_drainScheduled(false),
+				_maxBatchSize(kDefaultMaxBatchSize),
+				_maxLatencyMs(kDefaultMaxLatencyMs) {
+			}
+
+			EventQueue::~EventQueue() {
+			}
+
+			void EventQueue::Post(Event event) {
+				TRACE_EVENT0("webrtc", "EventQueue::Post");
+				if (_target == kTargetDispatcher &&
+					webrtc::VideoCommonWinUWP::GetCoreDispatcher() == nullptr) {
+					event();
+					return;
+				}
+				int delayMs;
+				{
+					rtc::CritScope lock(&_critSect);
+					_events.push_back(std::move(event));
+					if (_drainScheduled) {
+						return;
+					}
+					_drainScheduled = true;
+					delayMs = _maxLatencyMs;
+				}
+				ScheduleDrain(delayMs);
+			}
+
+			void EventQueue::SetMaxBatchSize(size_t maxBatchSize) {
+				rtc::CritScope lock(&_critSect);
+				_maxBatchSize = maxBatchSize > 0 ? maxBatchSize : 1;
+			}
+
+			size_t EventQueue::GetMaxBatchSize() {
+				rtc::CritScope lock(&_critSect);
+				return _maxBatchSize;
+			}
+
+			void EventQueue::SetMaxLatencyMs(int maxLatencyMs) {
+				rtc::CritScope lock(&_critSect);
+				_maxLatencyMs = maxLatencyMs > 0 ? maxLatencyMs : 0;
+			}
+
+			int EventQueue::GetMaxLatencyMs() {
+				rtc::CritScope lock(&_critSect);
+				return _maxLatencyMs;
+			}
+
+			void EventQueue::ScheduleDrain(int delayMs) {
+				rtc::scoped_refptr<EventQueue> self(this);
+				uint64_t flowId = ++gNextDrainFlowId;
+				TRACE_EVENT_FLOW_BEGIN0("webrtc", "EventQueue::Drain", flowId);
+				auto dispatch = [self, flowId] {
+					if (self->_target == kTargetThreadPool) {
+						ThreadPool::RunAsync(ref new WorkItemHandler(
+							[self, flowId](Windows::Foundation::IAsyncAction^) {
+							self->Drain(flowId);
+						}));
+						return;
+					}
+					CoreDispatcher^ dispatcher = webrtc::VideoCommonWinUWP::GetCoreDispatcher();
+					if (dispatcher == nullptr) {
+						self->Drain(flowId);
+						return;
+					}
+					dispatcher->RunAsync(CoreDispatcherPriority::Normal,
+						ref new DispatchedHandler([self, flowId] {
+						self->Drain(flowId);
+					}));
+				};
+				if (delayMs <= 0) {
+					dispatch();
+					return;
+				}
+				Windows::Foundation::TimeSpan delay;
+				delay.Duration = delayMs * 1000 * 10;  // hns
+				ThreadPoolTimer::CreateTimer(
+					ref new TimerElapsedHandler([dispatch](ThreadPoolTimer^) {
+					dispatch();
+				}), delay);
+			}
+
+			void EventQueue::Drain(uint64_t flowId) {
+				TRACE_EVENT0("webrtc", "EventQueue::Drain");
+				TRACE_EVENT_FLOW_END0("webrtc", "EventQueue::Drain", flowId);
+				std::vector<Event> batch;
+				{
+					rtc::CritScope lock(&_critSect);
+					size_t count = std::min(_events.size(), _maxBatchSize);
+					batch.reserve(count);
+					for (size_t i = 0; i < count; ++i) {
+						batch.push_back(std::move(_events.front()));
+						_events.pop_front();
+					}
+				}
+				for (auto& event : batch) {
+					event();
+				}
+				// |_drainScheduled| stays set while the batch runs, so that
+				// a thread pool drain never overlaps with the next one and
+				// the events keep their order.
+				{
+					rtc::CritScope lock(&_critSect);
+					if (_events.empty()) {
+						_drainScheduled = false;
+						return;
+					}
+				}
+				// Give the dispatcher a turn before the rest.
+				ScheduleDrain(0);
+			}
+		}
+	}
+}  // namespace Org.WebRtc.Internal
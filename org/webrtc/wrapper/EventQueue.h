@@ -0,0 +1,79 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#ifndef ORG_WEBRTC_EVENTQUEUE_H_
+#define ORG_WEBRTC_EVENTQUEUE_H_
+
+#include <deque>
+#include <functional>
+#include "webrtc/rtc_base/criticalsection.h"
+#include "webrtc/rtc_base/refcount.h"
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			// Collects the events raised by a peer connection and delivers
+			// them on the UI dispatcher, draining as many as it can in a
+			// single dispatcher callback instead of one callback per event.
+			// Events are raised in the order they were posted.
+			class EventQueue : public rtc::RefCountInterface {
+			public:
+				typedef std::function<void()> Event;
+
+				enum Target {
+					// Events are raised on the UI dispatcher.
+					kTargetDispatcher,
+					// Events are raised on the thread pool, one batch at a time.
+					kTargetThreadPool
+				};
+
+				static const size_t kDefaultMaxBatchSize = 64;
+				static const int kDefaultMaxLatencyMs = 0;
+
+				explicit EventQueue(Target target = kTargetDispatcher);
+
+				// Queues |event|, or runs it right away when the target is
+				// the UI dispatcher and there is none.  Can be called from
+				// any thread.
+				void Post(Event event);
+
+				// Maximum number of events raised per dispatcher callback.
+				// Left over events are drained in the next callback so the
+				// UI thread gets a chance to process input in between.
+				void SetMaxBatchSize(size_t maxBatchSize);
+				size_t GetMaxBatchSize();
+
+				// Time the first event of a batch may wait for more events
+				// to arrive before the batch is dispatched.  0 dispatches
+				// immediately, coalescing only the events posted until the
+				// dispatcher gets to the callback.
+				void SetMaxLatencyMs(int maxLatencyMs);
+				int GetMaxLatencyMs();
+
+			protected:
+				virtual ~EventQueue();
+
+			private:
+				void ScheduleDrain(int delayMs);
+				// |flowId| links the trace of the drain to the post that
+				// scheduled it.
+				void Drain(uint64_t flowId);
+
+				const Target _target;
+				rtc::CriticalSection _critSect;
+				std::deque<Event> _events;
+				bool _drainScheduled;
+				size_t _maxBatchSize;
+				int _maxLatencyMs;
+			};
+		}
+	}
+}  // namespace Org.WebRtc.Internal
+
+#endif  // ORG_WEBRTC_EVENTQUEUE_H_
@@ -0,0 +1,230 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#include "FileLogSink.h"
+#include <ppltasks.h>
+#include <sstream>
+#include "webrtc/rtc_base/win32.h"
+
+using Windows::Storage::CreationCollisionOption;
+using Windows::Storage::FileAccessMode;
+using Windows::Storage::StorageFile;
+using Windows::Storage::StorageFolder;
+using Windows::Storage::Compression::CompressAlgorithm;
+using Windows::Storage::Compression::Compressor;
+using Windows::Storage::Streams::RandomAccessStream;
+
+namespace {
+	// Messages beyond this are dropped until the writer catches up.
+	const size_t kMaxPendingBytes = 1024 * 1024;
+	// The writer is woken up once this much is pending, and at least
+	// every kWriteIntervalMs otherwise.
+	const size_t kWriteThresholdBytes = 64 * 1024;
+	const int kWriteIntervalMs = 1000;
+	const wchar_t kCompressedExtension[] = L".mszip";
+
+	// <name>.<index><ext>
+	std::wstring SegmentPath(const std::wstring& path, uint32_t index) {
+		size_t dot = path.find_last_of(L'.');
+		size_t separator = path.find_last_of(L'\\');
+		if (dot == std::wstring::npos ||
+			(separator != std::wstring::npos && dot < separator)) {
+			return path + L"." + std::to_wstring(index);
+		}
+		return path.substr(0, dot) + L"." + std::to_wstring(index) + path.substr(dot);
+	}
+
+	void MoveSegment(const std::wstring& from, const std::wstring& to) {
+		MoveFileExW(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING);
+	}
+
+	// Replaces |path| by |path|.mszip, the file is kept if it fails.
+	void CompressSegment(const std::wstring& path) {
+		try {
+			StorageFile^ file = Concurrency::create_task(
+				StorageFile::GetFileFromPathAsync(ref new Platform::String(path.c_str()))).get();
+			StorageFolder^ folder = Concurrency::create_task(file->GetParentAsync()).get();
+			StorageFile^ target = Concurrency::create_task(folder->CreateFileAsync(
+				file->Name + ref new Platform::String(kCompressedExtension),
+				CreationCollisionOption::ReplaceExisting)).get();
+			auto input = Concurrency::create_task(file->OpenReadAsync()).get();
+			auto output = Concurrency::create_task(
+				target->OpenAsync(FileAccessMode::ReadWrite)).get();
+			Compressor^ compressor = ref new Compressor(
+				output->GetOutputStreamAt(0), CompressAlgorithm::Mszip, 0);
+			Concurrency::create_task(RandomAccessStream::CopyAsync(input, compressor)).get();
+			Concurrency::create_task(compressor->FinishAsync()).get();
+			delete compressor;
+			delete output;
+			delete input;
+			Concurrency::create_task(file->DeleteAsync()).get();
+		}
+		catch (Platform::Exception^ e) {
+			// Can't log from the log writer.
+			OutputDebugStringW((L"Failed to compress " + path + L": " +
+				e->Message->Data() + L"\n").c_str());
+		}
+	}
+}
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			FileLogSink::FileLogSink(const std::string& path, size_t maxFileSize,
+				uint32_t maxSegments, bool compressSegments) :
+				_path(path),
+				_maxFileSize(maxFileSize),
+				_maxSegments(maxSegments),
+				_compressSegments(compressSegments),
+				_droppedMessages(0),
+				_droppedMessagesTotal(0),
+				_stopping(false),
+				_wakeUp(false, false),
+				_fileSize(0) {
+				_pending.reserve(kMaxPendingBytes);
+				_writing.reserve(kMaxPendingBytes);
+				// The log of the previous session becomes the first segment.
+				if (_maxFileSize > 0 && _maxSegments > 0) {
+					Rotate();
+				}
+				if (!OpenFile()) {
+					return;
+				}
+				_thread = std::thread([this] { WriterThread(); });
+			}
+
+			FileLogSink::~FileLogSink() {
+				{
+					rtc::CritScope lock(&_critSect);
+					_stopping = true;
+				}
+				_wakeUp.Set();
+				if (_thread.joinable()) {
+					_thread.join();
+				}
+				if (_file != nullptr) {
+					_file->Close();
+				}
+			}
+
+			bool FileLogSink::IsOpen() const {
+				return _file != nullptr;
+			}
+
+			uint64_t FileLogSink::DroppedMessages() const {
+				rtc::CritScope lock(&_critSect);
+				return _droppedMessagesTotal + _droppedMessages;
+			}
+
+			void FileLogSink::OnLogMessage(const std::string& message) {
+				bool wakeUp;
+				{
+					rtc::CritScope lock(&_critSect);
+					if (_pending.size() + message.size() > kMaxPendingBytes) {
+						++_droppedMessages;
+						return;
+					}
+					_pending.append(message);
+					wakeUp = _pending.size() >= kWriteThresholdBytes &&
+						_pending.size() - message.size() < kWriteThresholdBytes;
+				}
+				if (wakeUp) {
+					_wakeUp.Set();
+				}
+			}
+
+			void FileLogSink::WriterThread() {
+				// Left to this thread by the constructor, which can run on
+				// the UI thread.
+				if (_compressSegments) {
+					CompressFirstSegment();
+				}
+				bool stopping = false;
+				while (!stopping) {
+					_wakeUp.Wait(kWriteIntervalMs);
+					{
+						rtc::CritScope lock(&_critSect);
+						stopping = _stopping;
+					}
+					WritePending();
+				}
+			}
+
+			void FileLogSink::WritePending() {
+				uint64_t dropped;
+				{
+					// The buffers are swapped, logging threads only wait
+					// for the swap.
+					rtc::CritScope lock(&_critSect);
+					_writing.swap(_pending);
+					dropped = _droppedMessages;
+					_droppedMessagesTotal += _droppedMessages;
+					_droppedMessages = 0;
+				}
+				if (dropped > 0) {
+					std::ostringstream note;
+					note << "(FileLogSink) " << dropped
+						<< " log messages dropped, the log is written too slowly\n";
+					_writing.append(note.str());
+				}
+				if (_writing.empty() || _file == nullptr) {
+					_writing.clear();
+					return;
+				}
+				_file->WriteAll(_writing.data(), _writing.size(), nullptr, nullptr);
+				_fileSize += _writing.size();
+				_writing.clear();
+
+				if (_maxFileSize > 0 && _fileSize >= _maxFileSize) {
+					_file->Close();
+					_file.reset();
+					if (_maxSegments > 0) {
+						Rotate();
+					}
+					OpenFile();
+					if (_compressSegments) {
+						CompressFirstSegment();
+					}
+				}
+			}
+
+			bool FileLogSink::OpenFile() {
+				std::unique_ptr<rtc::FileStream> file(new rtc::FileStream());
+				if (!file->Open(_path, "wb", nullptr)) {
+					return false;
+				}
+				// Only large writes are made.
+				file->DisableBuffering();
+				_file = std::move(file);
+				_fileSize = 0;
+				return true;
+			}
+
+			void FileLogSink::Rotate() {
+				std::wstring path = rtc::ToUtf16(_path);
+				std::wstring compressed = kCompressedExtension;
+				DeleteFileW(SegmentPath(path, _maxSegments).c_str());
+				DeleteFileW((SegmentPath(path, _maxSegments) + compressed).c_str());
+				for (uint32_t i = _maxSegments - 1; i > 0; --i) {
+					MoveSegment(SegmentPath(path, i), SegmentPath(path, i + 1));
+					MoveSegment(SegmentPath(path, i) + compressed,
+						SegmentPath(path, i + 1) + compressed);
+				}
+				MoveSegment(path, SegmentPath(path, 1));
+			}
+
+			void FileLogSink::CompressFirstSegment() {
+				std::wstring segment = SegmentPath(rtc::ToUtf16(_path), 1);
+				if (GetFileAttributesW(segment.c_str()) != INVALID_FILE_ATTRIBUTES) {
+					CompressSegment(segment);
+				}
+			}
+		}
+	}
+}  // namespace Org.WebRtc
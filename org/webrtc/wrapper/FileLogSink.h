@@ -0,0 +1,77 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#ifndef ORG_WEBRTC_FILELOGSINK_H_
+#define ORG_WEBRTC_FILELOGSINK_H_
+
+#include <memory>
+#include <string>
+#include <thread>
+#include "webrtc/rtc_base/criticalsection.h"
+#include "webrtc/rtc_base/event.h"
+#include "webrtc/rtc_base/logging.h"
+#include "webrtc/rtc_base/stream.h"
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			// Writes the log to a file without blocking the logging threads.
+			// Messages are appended to a memory buffer and written by a
+			// background thread in large writes.  Messages arriving while
+			// the buffer is full are dropped and their count is written
+			// to the file instead.  The file is rotated once it reaches
+			// |maxFileSize|, the previous segments are kept as
+			// <name>.1<ext> (the most recent) up to <name>.<maxSegments><ext>,
+			// compressed with MSZIP if |compressSegments| is set.
+			class FileLogSink : public rtc::LogSink {
+			public:
+				// |maxFileSize| 0 disables the rotation.
+				FileLogSink(const std::string& path, size_t maxFileSize,
+					uint32_t maxSegments, bool compressSegments);
+				// Writes what is left in the buffer.
+				virtual ~FileLogSink();
+
+				bool IsOpen() const;
+
+				// Number of messages dropped since the sink was created.
+				uint64_t DroppedMessages() const;
+
+			private:
+				void OnLogMessage(const std::string& message) override;
+
+				void WriterThread();
+				void WritePending();
+				bool OpenFile();
+				void Rotate();
+				void CompressFirstSegment();
+
+				const std::string _path;
+				const size_t _maxFileSize;
+				const uint32_t _maxSegments;
+				const bool _compressSegments;
+
+				// Guards the buffer only, it is never held during I/O.
+				mutable rtc::CriticalSection _critSect;
+				std::string _pending;
+				uint64_t _droppedMessages;
+				uint64_t _droppedMessagesTotal;
+				bool _stopping;
+				rtc::Event _wakeUp;
+
+				// Only used by the writer thread.
+				std::string _writing;
+				std::unique_ptr<rtc::FileStream> _file;
+				size_t _fileSize;
+				std::thread _thread;
+			};
+		}
+	}
+}  // namespace Org.WebRtc
+
+#endif  // ORG_WEBRTC_FILELOGSINK_H_
@@ -0,0 +1,368 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#include "FlightRecorder.h"
+#include <Windows.h>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <vector>
+#include "webrtc/rtc_base/criticalsection.h"
+#include "webrtc/rtc_base/event_tracer.h"
+#include "webrtc/rtc_base/logging.h"
+#include "webrtc/rtc_base/platform_thread.h"
+#include "webrtc/rtc_base/timeutils.h"
+#include "webrtc/rtc_base/trace_event.h"
+
+namespace {
+	const int kMaxArgs = 2;
+	const size_t kMaxCopiedName = 48;
+	const size_t kMaxCopiedString = 32;
+	const char kDisabledCategoryPrefix[] = "disabled-by-default-";
+
+	// Plain data, copied as a whole by the readers.  The categories, the
+	// names not copied and the argument names are the literals of the
+	// macros.
+	struct TraceRecordData {
+		int64_t timestampUs;
+		unsigned long long id;
+		const char* category;
+		const char* name;
+		uint32_t threadId;
+		char phase;
+		unsigned char flags;
+		unsigned char numArgs;
+		const char* argNames[kMaxArgs];
+		unsigned char argTypes[kMaxArgs];
+		unsigned long long argValues[kMaxArgs];
+		// Name of the event if the tracer is asked to copy it.
+		char copiedName[kMaxCopiedName];
+		// The string arguments, truncated.  Copied whatever their type,
+		// a string may not outlive the event.
+		char argStrings[kMaxArgs][kMaxCopiedString];
+	};
+
+	// 200 bytes on x64.
+	struct TraceRecord {
+		// Even when the record is complete, odd while it is written.
+		std::atomic<uint64_t> sequence;
+		TraceRecordData data;
+	};
+
+	// Plain copy of a record, for the capture and the dumps.
+	struct TraceEvent {
+		int64_t timestampUs;
+		unsigned long long id;
+		const char* category;
+		std::string name;
+		uint32_t threadId;
+		char phase;
+		unsigned char flags;
+		unsigned char numArgs;
+		const char* argNames[kMaxArgs];
+		unsigned char argTypes[kMaxArgs];
+		unsigned long long argValues[kMaxArgs];
+		std::string argStrings[kMaxArgs];
+	};
+
+	std::unique_ptr<TraceRecord[]> gRing;
+	uint32_t gRingCapacity = 0;
+	std::atomic<uint64_t> gNextRecord(0);
+	std::atomic<bool> gRecording(false);
+
+	rtc::CriticalSection gCaptureLock;
+	std::atomic<bool> gCapturing(false);
+	std::string gCapturePath;
+	std::vector<TraceEvent> gCapture;
+
+	void CopyString(char* dest, size_t size, const char* source) {
+		strncpy_s(dest, size, source, _TRUNCATE);
+	}
+
+	bool IsStringArg(unsigned char type) {
+		return type == TRACE_VALUE_TYPE_STRING ||
+			type == TRACE_VALUE_TYPE_COPY_STRING;
+	}
+
+	// Only called on a snapshot, checked to be complete.
+	TraceEvent ToTraceEvent(const TraceRecordData& record) {
+		TraceEvent event;
+		event.timestampUs = record.timestampUs;
+		event.id = record.id;
+		event.category = record.category;
+		event.name = (record.flags & TRACE_EVENT_FLAG_COPY) ?
+			record.copiedName : record.name;
+		event.threadId = record.threadId;
+		event.phase = record.phase;
+		event.flags = record.flags;
+		event.numArgs = record.numArgs;
+		for (int i = 0; i < record.numArgs; ++i) {
+			event.argNames[i] = record.argNames[i];
+			event.argTypes[i] = record.argTypes[i];
+			event.argValues[i] = record.argValues[i];
+			if (IsStringArg(record.argTypes[i])) {
+				event.argStrings[i] = record.argStrings[i];
+			}
+		}
+		return event;
+	}
+
+	const unsigned char* GetCategoryEnabled(const char* name) {
+		static const unsigned char kDisabled = 0;
+		if (strncmp(name, kDisabledCategoryPrefix,
+			sizeof(kDisabledCategoryPrefix) - 1) == 0) {
+			return &kDisabled;
+		}
+		// Kept by the macros for good, whether events are recorded is
+		// decided in AddTraceEvent().  Non zero, and gives back the
+		// category there.
+		return reinterpret_cast<const unsigned char*>(name);
+	}
+
+	void AddTraceEvent(char phase, const unsigned char* categoryEnabled,
+		const char* name, unsigned long long id, int numArgs,
+		const char** argNames, const unsigned char* argTypes,
+		const unsigned long long* argValues, unsigned char flags) {
+		int64_t timestampUs = rtc::TimeMicros();
+		uint32_t threadId = (uint32_t)rtc::CurrentThreadId();
+		numArgs = std::min(numArgs, kMaxArgs);
+
+		if (gRecording.load(std::memory_order_relaxed)) {
+			uint64_t index = gNextRecord.fetch_add(1, std::memory_order_relaxed);
+			TraceRecord& slot = gRing[index % gRingCapacity];
+			slot.sequence.store(index * 2 + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			TraceRecordData& record = slot.data;
+			record.timestampUs = timestampUs;
+			record.id = id;
+			record.category = reinterpret_cast<const char*>(categoryEnabled);
+			record.name = name;
+			record.threadId = threadId;
+			record.phase = phase;
+			record.flags = flags;
+			record.numArgs = (unsigned char)numArgs;
+			if (flags & TRACE_EVENT_FLAG_COPY) {
+				CopyString(record.copiedName, kMaxCopiedName, name);
+			}
+			for (int i = 0; i < numArgs; ++i) {
+				// Copied argument names can't be kept.
+				record.argNames[i] = (flags & TRACE_EVENT_FLAG_COPY) ?
+					"arg" : argNames[i];
+				record.argTypes[i] = argTypes[i];
+				record.argValues[i] = argValues[i];
+				if (IsStringArg(argTypes[i])) {
+					CopyString(record.argStrings[i], kMaxCopiedString,
+						reinterpret_cast<const char*>(argValues[i]));
+				}
+			}
+			slot.sequence.store(index * 2 + 2, std::memory_order_release);
+		}
+
+		if (gCapturing.load(std::memory_order_relaxed)) {
+			TraceEvent event;
+			event.timestampUs = timestampUs;
+			event.id = id;
+			event.category = reinterpret_cast<const char*>(categoryEnabled);
+			event.name = name;
+			event.threadId = threadId;
+			event.phase = phase;
+			event.flags = flags;
+			event.numArgs = (unsigned char)numArgs;
+			for (int i = 0; i < numArgs; ++i) {
+				event.argNames[i] = (flags & TRACE_EVENT_FLAG_COPY) ?
+					"arg" : argNames[i];
+				event.argTypes[i] = argTypes[i];
+				event.argValues[i] = argValues[i];
+				if (IsStringArg(argTypes[i])) {
+					event.argStrings[i] = reinterpret_cast<const char*>(argValues[i]);
+				}
+			}
+			rtc::CritScope lock(&gCaptureLock);
+			if (gCapturing) {
+				gCapture.push_back(std::move(event));
+			}
+		}
+	}
+
+	void WriteJsonString(std::ostream& out, const std::string& value) {
+		out << '"';
+		for (char c : value) {
+			switch (c) {
+			case '"': out << "\\\""; break;
+			case '\\': out << "\\\\"; break;
+			case '\n': out << "\\n"; break;
+			case '\r': out << "\\r"; break;
+			case '\t': out << "\\t"; break;
+			default:
+				if ((unsigned char)c < 0x20) {
+					char escaped[8];
+					sprintf_s(escaped, "\\u%04x", c);
+					out << escaped;
+				}
+				else {
+					out << c;
+				}
+			}
+		}
+		out << '"';
+	}
+
+	void WriteArgValue(std::ostream& out, const TraceEvent& event, int i) {
+		union {
+			unsigned long long value;
+			double asDouble;
+			long long asInt;
+		} arg;
+		arg.value = event.argValues[i];
+		switch (event.argTypes[i]) {
+		case TRACE_VALUE_TYPE_BOOL:
+			out << (arg.value ? "true" : "false");
+			break;
+		case TRACE_VALUE_TYPE_UINT:
+			out << arg.value;
+			break;
+		case TRACE_VALUE_TYPE_INT:
+			out << arg.asInt;
+			break;
+		case TRACE_VALUE_TYPE_DOUBLE:
+			out << arg.asDouble;
+			break;
+		case TRACE_VALUE_TYPE_POINTER:
+			out << "\"0x" << std::hex << arg.value << std::dec << "\"";
+			break;
+		default:
+			WriteJsonString(out, event.argStrings[i]);
+			break;
+		}
+	}
+
+	bool WriteTrace(const std::string& path, const std::vector<TraceEvent>& events) {
+		std::ofstream out(path, std::ios::trunc);
+		if (!out) {
+			LOG(LS_WARNING) << "Can't write the trace to " << path;
+			return false;
+		}
+		DWORD processId = GetCurrentProcessId();
+		out << "{\"traceEvents\":[";
+		bool first = true;
+		for (auto& event : events) {
+			out << (first ? "\n" : ",\n");
+			first = false;
+			out << "{\"name\":";
+			WriteJsonString(out, event.name);
+			out << ",\"cat\":";
+			WriteJsonString(out, event.category);
+			out << ",\"ph\":\"" << event.phase << "\""
+				<< ",\"ts\":" << event.timestampUs
+				<< ",\"pid\":" << processId
+				<< ",\"tid\":" << event.threadId;
+			if (event.flags & TRACE_EVENT_FLAG_HAS_ID) {
+				out << ",\"id\":\"0x" << std::hex << event.id << std::dec << "\"";
+			}
+			if (event.phase == TRACE_EVENT_PHASE_FLOW_END) {
+				// The flow ends in the slice it is traced in, not the next one.
+				out << ",\"bp\":\"e\"";
+			}
+			out << ",\"args\":{";
+			for (int i = 0; i < event.numArgs; ++i) {
+				if (i > 0) {
+					out << ",";
+				}
+				WriteJsonString(out, event.argNames[i]);
+				out << ":";
+				WriteArgValue(out, event, i);
+			}
+			out << "}}";
+		}
+		out << "]}\n";
+		return (bool)out;
+	}
+}
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			void InstallFlightRecorder(uint32_t capacity) {
+				if (capacity > 0) {
+					gRing.reset(new TraceRecord[capacity]);
+					for (uint32_t i = 0; i < capacity; ++i) {
+						gRing[i].sequence.store(0, std::memory_order_relaxed);
+					}
+					gRingCapacity = capacity;
+					gRecording = true;
+				}
+				webrtc::SetupEventTracer(&GetCategoryEnabled, &AddTraceEvent);
+			}
+
+			void SetFlightRecorderEnabled(bool enabled) {
+				gRecording = enabled && gRingCapacity > 0;
+			}
+
+			bool IsFlightRecorderEnabled() {
+				return gRecording;
+			}
+
+			bool DumpFlightRecorder(const std::string& path, int64_t lastUs) {
+				if (gRingCapacity == 0) {
+					return false;
+				}
+				int64_t sinceUs = lastUs > 0 ? rtc::TimeMicros() - lastUs : 0;
+				uint64_t end = gNextRecord.load(std::memory_order_acquire);
+				uint64_t begin = end > gRingCapacity ? end - gRingCapacity : 0;
+				std::vector<TraceEvent> events;
+				events.reserve((size_t)(end - begin));
+				TraceRecordData snapshot;
+				for (uint64_t index = begin; index < end; ++index) {
+					const TraceRecord& slot = gRing[index % gRingCapacity];
+					// Skips the records overwritten or being written while
+					// they are copied, the copy is only read once checked.
+					if (slot.sequence.load(std::memory_order_acquire) != index * 2 + 2) {
+						continue;
+					}
+					memcpy(&snapshot, &slot.data, sizeof(snapshot));
+					std::atomic_thread_fence(std::memory_order_acquire);
+					if (slot.sequence.load(std::memory_order_relaxed) != index * 2 + 2) {
+						continue;
+					}
+					if (snapshot.timestampUs >= sinceUs) {
+						events.push_back(ToTraceEvent(snapshot));
+					}
+				}
+				return WriteTrace(path, events);
+			}
+
+			bool StartTraceCapture(const std::string& path) {
+				rtc::CritScope lock(&gCaptureLock);
+				if (gCapturing) {
+					return false;
+				}
+				gCapturePath = path;
+				gCapture.clear();
+				gCapturing = true;
+				return true;
+			}
+
+			void StopTraceCapture() {
+				std::vector<TraceEvent> events;
+				std::string path;
+				{
+					rtc::CritScope lock(&gCaptureLock);
+					if (!gCapturing) {
+						return;
+					}
+					gCapturing = false;
+					events.swap(gCapture);
+					path = gCapturePath;
+				}
+				WriteTrace(path, events);
+			}
+		}
+	}
+}  // namespace Org.WebRtc
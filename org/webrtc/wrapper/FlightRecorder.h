@@ -0,0 +1,44 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#ifndef ORG_WEBRTC_FLIGHTRECORDER_H_
+#define ORG_WEBRTC_FLIGHTRECORDER_H_
+
+#include <stdint.h>
+#include <string>
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			// Trace backend of the WebRTC TRACE_EVENT macros, installed in
+			// place of the rtc::tracing internal tracer.  The last
+			// |capacity| events are always kept in a circular buffer, a
+			// fixed size record each, so a stall can be written out after
+			// it happened with DumpFlightRecorder().  Recording an event
+			// takes no lock, the buffer is read while it is written.
+			// |capacity| 0 only installs the backend for the captures.
+			void InstallFlightRecorder(uint32_t capacity);
+
+			// Stops or resumes recording into the circular buffer.
+			void SetFlightRecorderEnabled(bool enabled);
+			bool IsFlightRecorderEnabled();
+
+			// Writes the events of the last |lastUs| microseconds, 0 for
+			// all of them, to |path| in the Chrome trace format.
+			bool DumpFlightRecorder(const std::string& path, int64_t lastUs);
+
+			// Records every event until StopTraceCapture() writes them to
+			// |path|, what rtc::tracing::StartInternalCapture() does.
+			bool StartTraceCapture(const std::string& path);
+			void StopTraceCapture();
+		}
+	}
+}  // namespace Org.WebRtc
+
+#endif  // ORG_WEBRTC_FLIGHTRECORDER_H_
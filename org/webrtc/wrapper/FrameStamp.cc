@@ -0,0 +1,163 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#include "FrameStamp.h"
+#include <algorithm>
+#include "libyuv/planar_functions.h"
+#include "webrtc/rtc_base/timeutils.h"
+
+namespace {
+	const int kStampBitsPerRow = 32;
+	const uint8_t kStampBlack = 16;
+	const uint8_t kStampWhite = 235;
+	const uint32_t kFrameIdMask = 0xffffff;
+	// The blocks span the width minus a 16th on each side, the rows are
+	// a 24th of the height each, below a 32nd of margin.
+	const int kStampMarginDivisor = 16;
+	const int kStampTopDivisor = 32;
+	const int kStampRowDivisor = 24;
+	// Smallest block, in pixels, the center of a block must be clear of
+	// the coding artifacts of its edges.
+	const int kMinStampBlock = 2;
+
+	uint8_t StampChecksum(uint32_t frameId, uint32_t timeMs) {
+		return (uint8_t)((frameId ^ (frameId >> 8) ^ (frameId >> 16) ^
+			timeMs ^ (timeMs >> 8) ^ (timeMs >> 16) ^ (timeMs >> 24)) ^ 0x5a);
+	}
+
+	// Left edge of |bit| in a frame |width| wide, |bit| up to
+	// kStampBitsPerRow for the right edge of the last block.
+	int StampBitLeft(int width, int bit) {
+		int margin = width / kStampMarginDivisor;
+		return margin + bit * (width - 2 * margin) / kStampBitsPerRow;
+	}
+
+	// Top edge of |row|, |row| up to 2 for the bottom of the stamp.
+	int StampRowTop(int height, int row) {
+		return height / kStampTopDivisor + row * height / kStampRowDivisor;
+	}
+
+	bool StampFits(int width, int height) {
+		return StampBitLeft(width, 1) - StampBitLeft(width, 0) >= kMinStampBlock &&
+			StampRowTop(height, 1) - StampRowTop(height, 0) >= kMinStampBlock;
+	}
+}
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			void WriteFrameStamp(webrtc::I420Buffer* buffer, uint32_t frameId,
+				uint32_t timeMs) {
+				int width = buffer->width();
+				int height = buffer->height();
+				if (!StampFits(width, height)) {
+					return;
+				}
+				frameId &= kFrameIdMask;
+				uint32_t rows[2] = {
+					frameId << 8 | StampChecksum(frameId, timeMs), timeMs };
+				for (int row = 0; row < 2; ++row) {
+					int top = StampRowTop(height, row);
+					int bottom = StampRowTop(height, row + 1);
+					for (int bit = 0; bit < kStampBitsPerRow; ++bit) {
+						bool set = (rows[row] >> (kStampBitsPerRow - 1 - bit)) & 1;
+						int left = StampBitLeft(width, bit);
+						libyuv::SetPlane(buffer->MutableDataY() +
+							top * buffer->StrideY() + left,
+							buffer->StrideY(), StampBitLeft(width, bit + 1) - left,
+							bottom - top, set ? kStampWhite : kStampBlack);
+					}
+				}
+			}
+
+			bool ReadFrameStamp(const webrtc::I420BufferInterface& buffer,
+				uint32_t* frameId, uint32_t* timeMs) {
+				int width = buffer.width();
+				int height = buffer.height();
+				if (!StampFits(width, height)) {
+					return false;
+				}
+				uint32_t rows[2] = { 0, 0 };
+				for (int row = 0; row < 2; ++row) {
+					// The centers of the blocks, away from the coding artifacts
+					// of the edges.
+					int y = (StampRowTop(height, row) +
+						StampRowTop(height, row + 1)) / 2;
+					const uint8_t* line = buffer.DataY() + y * buffer.StrideY();
+					for (int bit = 0; bit < kStampBitsPerRow; ++bit) {
+						int x = (StampBitLeft(width, bit) +
+							StampBitLeft(width, bit + 1)) / 2;
+						int value = (line[x - 1] + line[x]) / 2;
+						rows[row] = rows[row] << 1 |
+							(value > (kStampBlack + kStampWhite) / 2 ? 1 : 0);
+					}
+				}
+				uint32_t id = rows[0] >> 8;
+				if ((uint8_t)rows[0] != StampChecksum(id, rows[1])) {
+					return false;
+				}
+				*frameId = id;
+				*timeMs = rows[1];
+				return true;
+			}
+
+			LatencySink::LatencySink(bool keepLatencies) :
+				framesReceived(0), framesMissing(0), invalidStamps(0),
+				totalLatencyMs(0), lastLatencyMs(0), maxLatencyMs(0),
+				lastFrameId(-1), keepLatencies(keepLatencies) {
+			}
+
+			void LatencySink::OnFrame(const webrtc::VideoFrame& frame) {
+				// Read before the conversion, which takes time as well.
+				uint32_t nowMs = (uint32_t)rtc::TimeMillis();
+				rtc::scoped_refptr<webrtc::I420BufferInterface> buffer =
+					frame.video_frame_buffer()->ToI420();
+				uint32_t frameId, timeMs;
+				bool stamped = buffer != nullptr &&
+					ReadFrameStamp(*buffer, &frameId, &timeMs);
+				rtc::CritScope lock(&critSect);
+				if (!stamped) {
+					++invalidStamps;
+					return;
+				}
+				// Both wrap, the differences don't.
+				uint32_t latencyMs = nowMs - timeMs;
+				if (lastFrameId >= 0) {
+					uint32_t gap = (frameId - (uint32_t)lastFrameId) & kFrameIdMask;
+					if (gap == 0 || gap > kFrameIdMask / 2) {
+						// Repeated or reordered, not a new frame.
+						return;
+					}
+					framesMissing += gap - 1;
+				}
+				lastFrameId = frameId;
+				++framesReceived;
+				totalLatencyMs += latencyMs;
+				lastLatencyMs = latencyMs;
+				maxLatencyMs = std::max(maxLatencyMs, latencyMs);
+				if (keepLatencies) {
+					latenciesMs.push_back(latencyMs);
+				}
+			}
+
+			void LatencySink::Reset() {
+				rtc::CritScope lock(&critSect);
+				framesReceived = 0;
+				framesMissing = 0;
+				invalidStamps = 0;
+				totalLatencyMs = 0;
+				lastLatencyMs = 0;
+				maxLatencyMs = 0;
+				// The next frame isn't compared with the previous ones.
+				lastFrameId = -1;
+				latenciesMs.clear();
+			}
+		}
+	}
+}  // namespace Org.WebRtc
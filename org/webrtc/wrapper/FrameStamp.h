@@ -0,0 +1,63 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#ifndef ORG_WEBRTC_FRAMESTAMP_H_
+#define ORG_WEBRTC_FRAMESTAMP_H_
+
+#include <stdint.h>
+#include <vector>
+#include "webrtc/api/video/i420_buffer.h"
+#include "webrtc/api/video/video_frame.h"
+#include "webrtc/media/base/videosinkinterface.h"
+#include "webrtc/rtc_base/criticalsection.h"
+
+// Plain C++, shared by the latency probe and the native benchmarks.
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			// Writes |frameId| and |timeMs| in the top of the luma plane, as
+			// two rows of 32 black or white blocks with a checksum.  The
+			// blocks are placed in fractions of the frame size, with margins,
+			// so that the stamp reads the same whatever the size the frame
+			// is scaled to, and survive the encoding of the frame.
+			void WriteFrameStamp(webrtc::I420Buffer* buffer, uint32_t frameId,
+				uint32_t timeMs);
+			// False if the frame is too small or the stamp doesn't check.
+			// |frameId| only has 24 significant bits.
+			bool ReadFrameStamp(const webrtc::I420BufferInterface& buffer,
+				uint32_t* frameId, uint32_t* timeMs);
+
+			// Latency of the stamped frames a track renders.
+			class LatencySink : public rtc::VideoSinkInterface<webrtc::VideoFrame> {
+			public:
+				// The latency of each frame is kept in |latenciesMs| if
+				// |keepLatencies|, for the percentiles.
+				explicit LatencySink(bool keepLatencies = false);
+
+				void OnFrame(const webrtc::VideoFrame& frame) override;
+				// Starts the counts over.
+				void Reset();
+
+				rtc::CriticalSection critSect;
+				uint64_t framesReceived;
+				uint64_t framesMissing;
+				uint64_t invalidStamps;
+				int64_t totalLatencyMs;
+				uint32_t lastLatencyMs;
+				uint32_t maxLatencyMs;
+				// 24 bits, -1 before the first frame.
+				int64_t lastFrameId;
+				const bool keepLatencies;
+				std::vector<uint32_t> latenciesMs;
+			};
+		}
+	}
+}  // namespace Org.WebRtc
+
+#endif  // ORG_WEBRTC_FRAMESTAMP_H_
@@ -9,6 +9,7 @@
 
 // Class1.cpp
 #include <ppltasks.h>
+#include <algorithm>
 #include <vector>
 
 #include "GlobalObserver.h"
@@ -16,7 +17,10 @@
 #include "Marshalling.h"
 #include "Media.h"
 #include "DataChannel.h"
-#include "webrtc/common_video/video_common_winuwp.h"
+#include "DataChannelBuffer.h"
+#include "MediaSourceHelper.h"
+#include "webrtc/rtc_base/stringencode.h"
+#include "webrtc/rtc_base/timeutils.h"
 
 using Platform::Collections::Vector;
 
@@ -26,44 +30,35 @@ namespace Org {
 
 #define POST_PC_EVENT(fn, evt) \
   auto pc = _pc;\
-  Windows::UI::Core::CoreDispatcher^ _windowDispatcher = webrtc::VideoCommonWinUWP::GetCoreDispatcher();\
-  if (_windowDispatcher != nullptr) {\
-    _windowDispatcher->RunAsync(\
-      Windows::UI::Core::CoreDispatcherPriority::Normal, \
-      ref new Windows::UI::Core::DispatchedHandler([pc, evt] {\
-      if (pc != nullptr) {\
-        pc->##fn(evt);\
-      }\
-    }));\
-  } else {\
+  _eventQueue->Post([pc, evt] {\
+    TRACE_EVENT0("webrtc", "RTCPeerConnection::" #fn);\
     if (pc != nullptr) {\
       pc->##fn(evt);\
     }\
-  }
+  });
 
 #define POST_PC_ACTION(fn) \
   auto pc = _pc;\
-  Windows::UI::Core::CoreDispatcher^ _windowDispatcher = webrtc::VideoCommonWinUWP::GetCoreDispatcher();\
-  if (_windowDispatcher != nullptr) {\
-    _windowDispatcher->RunAsync(\
-      Windows::UI::Core::CoreDispatcherPriority::Normal, \
-      ref new Windows::UI::Core::DispatchedHandler([pc] {\
-      if (pc != nullptr) {\
-        pc->##fn();\
-      }\
-    }));\
-  } else {\
+  _eventQueue->Post([pc] {\
+    TRACE_EVENT0("webrtc", "RTCPeerConnection::" #fn);\
     if (pc != nullptr) {\
       pc->##fn();\
     }\
-  }
+  });
 
-			GlobalObserver::GlobalObserver() {
+			GlobalObserver::GlobalObserver() :
+				_eventQueue(new rtc::RefCountedObject<EventQueue>()),
+				_iceCandidateBatch(std::make_shared<IceCandidateBatch>()),
+				_iceCandidateBatchMs(0) {
 				ResetStatsConfig();
 			}
 
 			void GlobalObserver::SetPeerConnection(
 				Org::WebRtc::RTCPeerConnection^ pc) {
+				if (pc == nullptr && _stats_observer) {
+					// The summary of the call, raised while |_pc| is set.
+					_stats_observer->ToggleQualityHistograms(NULL);
+				}
 				_pc = pc;
 				if (_pc == nullptr) {
 					_stats_observer = nullptr;
@@ -75,9 +70,15 @@ namespace Org {
 				_etwStatsEnabled = false;
 				_connectionHealthStatsEnabled = false;
 				_rtcStatsEnabled = false;
+				_qualityHistogramsEnabled = false;
+				_qualitySummaryIntervalMs = 5 * 60 * 1000;
 				_sendRtcStatsToRemoteHostEnabled = false;
 				_rtcStatsDestinationHost = "localhost";
 				_rtcStatsDestinationPort = 47005;
+				_rtcStatsDestinationFormat = webrtc::kStatsNetworkFormatJson;
+				_statsPollingConfig = webrtc::StatsPollingConfig();
+				_rtcStatsFilter = webrtc::StatsFilter();
+				_etwStatsFilter = webrtc::StatsFilter();
 			}
 
 			void GlobalObserver::EnableETWStats(bool enable) {
@@ -113,12 +114,35 @@ namespace Org {
 				return _rtcStatsEnabled;
 			}
 
+			void GlobalObserver::EnableQualityHistograms(bool enable) {
+				_qualityHistogramsEnabled = enable;
+				if (_stats_observer) {
+					_stats_observer->ToggleQualityHistograms(enable ? this : NULL);
+				}
+			}
+
+			bool GlobalObserver::AreQualityHistogramsEnabled() {
+				return _qualityHistogramsEnabled;
+			}
+
+			void GlobalObserver::SetQualitySummaryInterval(int intervalMs) {
+				_qualitySummaryIntervalMs = intervalMs;
+				if (_stats_observer) {
+					_stats_observer->SetQualitySummaryInterval(intervalMs);
+				}
+			}
+
+			int GlobalObserver::GetQualitySummaryInterval() {
+				return _qualitySummaryIntervalMs;
+			}
+
 			void GlobalObserver::EnableSendRtcStatsToRemoteHost(bool enable) {
 				_sendRtcStatsToRemoteHostEnabled = enable;
 				if (_stats_observer) {
 					if (enable) {
 						_stats_observer->SetStatsNetworkDestination(
-							_rtcStatsDestinationHost, _rtcStatsDestinationPort);
+							_rtcStatsDestinationHost, _rtcStatsDestinationPort,
+							_rtcStatsDestinationFormat);
 					}
 					_stats_observer->ToggleStatsSendToRemoteHost(enable);
 				}
@@ -143,6 +167,61 @@ namespace Org {
 				return _rtcStatsDestinationPort;
 			}
 
+			void GlobalObserver::SetRtcStatsDestinationFormat(
+				webrtc::StatsNetworkFormat format) {
+				_rtcStatsDestinationFormat = format;
+			}
+
+			webrtc::StatsNetworkFormat GlobalObserver::GetRtcStatsDestinationFormat() {
+				return _rtcStatsDestinationFormat;
+			}
+
+			void GlobalObserver::SetStatsPollingConfig(
+				const webrtc::StatsPollingConfig& config) {
+				_statsPollingConfig = config;
+				if (_stats_observer) {
+					_stats_observer->SetPollingConfig(config);
+				}
+			}
+
+			webrtc::StatsPollingConfig GlobalObserver::GetStatsPollingConfig() {
+				return _statsPollingConfig;
+			}
+
+			void GlobalObserver::SetRtcStatsFilter(
+				const webrtc::StatsFilter& filter) {
+				_rtcStatsFilter = filter;
+				if (_stats_observer) {
+					_stats_observer->SetRTCStatsFilter(filter);
+				}
+			}
+
+			void GlobalObserver::SetEtwStatsFilter(
+				const webrtc::StatsFilter& filter) {
+				_etwStatsFilter = filter;
+				if (_stats_observer) {
+					_stats_observer->SetETWStatsFilter(filter);
+				}
+			}
+
+			void GlobalObserver::OnLocalStreamAdded(
+				rtc::scoped_refptr<webrtc::MediaStreamInterface> stream) {
+				if (_stats_observer) {
+					_stats_observer->OnStreamAdded(stream);
+				}
+			}
+
+			void GlobalObserver::OnLocalStreamRemoved(
+				rtc::scoped_refptr<webrtc::MediaStreamInterface> stream) {
+				if (_stats_observer) {
+					_stats_observer->OnStreamRemoved(stream);
+				}
+			}
+
+			rtc::scoped_refptr<EventQueue> GlobalObserver::GetEventQueue() {
+				return _eventQueue;
+			}
+
 
 			// Triggered when the SignalingState changed.
 			void GlobalObserver::OnSignalingChange(
@@ -157,15 +236,21 @@ namespace Org {
 
 			// Triggered when media is received on a new stream from remote peer.
 			void GlobalObserver::OnAddStream(rtc::scoped_refptr<webrtc::MediaStreamInterface> stream) {
+				if (_stats_observer) {
+					_stats_observer->OnStreamAdded(stream);
+				}
 				auto evt = ref new Org::WebRtc::MediaStreamEvent();
-				evt->Stream = ref new Org::WebRtc::MediaStream(stream);
+				evt->Stream = Org::WebRtc::Internal::GetMediaStream(stream);
 				POST_PC_EVENT(OnAddStream, evt);
 			}
 
 			// Triggered when a remote peer close a stream.
 			void GlobalObserver::OnRemoveStream(rtc::scoped_refptr<webrtc::MediaStreamInterface> stream) {
+				if (_stats_observer) {
+					_stats_observer->OnStreamRemoved(stream);
+				}
 				auto evt = ref new Org::WebRtc::MediaStreamEvent();
-				evt->Stream = ref new Org::WebRtc::MediaStream(stream);
+				evt->Stream = Org::WebRtc::Internal::GetMediaStream(stream);
 				POST_PC_EVENT(OnRemoveStream, evt);
 			}
 
@@ -175,7 +260,7 @@ namespace Org {
 				evt->Channel = ref new Org::WebRtc::RTCDataChannel(data_channel);
 				// This observer is deleted when the channel closes.
 				// See DataChannelObserver::OnStateChange().
-				data_channel->RegisterObserver(new DataChannelObserver(evt->Channel));
+				data_channel->RegisterObserver(new DataChannelObserver(evt->Channel, _eventQueue));
 				POST_PC_EVENT(OnDataChannel, evt);
 			}
 
@@ -187,20 +272,30 @@ namespace Org {
 			// Called any time the IceConnectionState changes
 			void GlobalObserver::OnIceConnectionChange(
 				webrtc::PeerConnectionInterface::IceConnectionState new_state) {
+				if (_stats_observer) {
+					_stats_observer->NotifyActivity();
+				}
 				if (new_state == webrtc::PeerConnectionInterface::kIceConnectionConnected) {
 					if (!_stats_observer.get()) {
 						auto temp_impl = _pc->_impl;
 						_stats_observer =
 							new rtc::RefCountedObject<webrtc::WebRTCStatsObserver>(temp_impl);
+						_stats_observer->SetPollingConfig(_statsPollingConfig);
+						_stats_observer->SetRTCStatsFilter(_rtcStatsFilter);
+						_stats_observer->SetETWStatsFilter(_etwStatsFilter);
+						_stats_observer->SetQualitySummaryInterval(_qualitySummaryIntervalMs);
 					}
 					_stats_observer->ToggleETWStats(_etwStatsEnabled);
 					_stats_observer->ToggleConnectionHealthStats(
 						_connectionHealthStatsEnabled ? this : NULL);
 					_stats_observer->ToggleRTCStats(
 						_rtcStatsEnabled ? this : NULL);
+					_stats_observer->ToggleQualityHistograms(
+						_qualityHistogramsEnabled ? this : NULL);
 					if (_sendRtcStatsToRemoteHostEnabled) {
 						_stats_observer->SetStatsNetworkDestination(
-							_rtcStatsDestinationHost, _rtcStatsDestinationPort);
+							_rtcStatsDestinationHost, _rtcStatsDestinationPort,
+							_rtcStatsDestinationFormat);
 					}
 					_stats_observer->ToggleStatsSendToRemoteHost(_sendRtcStatsToRemoteHostEnabled);
 				}
@@ -215,6 +310,9 @@ namespace Org {
 			void GlobalObserver::OnIceGatheringChange(
 				webrtc::PeerConnectionInterface::IceGatheringState new_state) {
 				LOG(LS_INFO) << "OnIceGatheringChange";
+				if (new_state == webrtc::PeerConnectionInterface::kIceGatheringComplete) {
+					PostIceCandidateBatch(_iceCandidateBatch, _pc, _eventQueue);
+				}
 			}
 
 			// New Ice candidate have been found.
@@ -223,21 +321,76 @@ namespace Org {
 				std::string c;
 				candidate->ToString(&c);
 				LOG(LS_INFO) << "Ice candidate = " << c;
-				auto evt = ref new Org::WebRtc::RTCPeerConnectionIceEvent();
 				Org::WebRtc::RTCIceCandidate^ cxCandidate;
-				if (candidate == nullptr) {
-					evt->Candidate = nullptr;
-				}
-				else {
+				if (candidate != nullptr) {
 					ToCx(*candidate, &cxCandidate);
-					evt->Candidate = cxCandidate;
 				}
+				int batchMs = _iceCandidateBatchMs;
+				if (cxCandidate != nullptr && batchMs > 0) {
+					std::shared_ptr<IceCandidateBatch> batch = _iceCandidateBatch;
+					bool schedule;
+					{
+						rtc::CritScope lock(&batch->critSect);
+						batch->candidates.push_back(cxCandidate);
+						schedule = !batch->scheduled;
+						batch->scheduled = true;
+					}
+					if (schedule) {
+						auto pc = _pc;
+						auto eventQueue = _eventQueue;
+						Windows::Foundation::TimeSpan delay;
+						delay.Duration = batchMs * 10000LL;  // hns
+						Windows::System::Threading::ThreadPoolTimer::CreateTimer(
+							ref new Windows::System::Threading::TimerElapsedHandler(
+								[batch, pc, eventQueue](Windows::System::Threading::ThreadPoolTimer^) {
+							PostIceCandidateBatch(batch, pc, eventQueue);
+						}), delay);
+					}
+					return;
+				}
+				// Raised after the candidates found before it, the timer
+				// can't post them in between.
+				rtc::CritScope lock(&_iceCandidateBatch->critSect);
+				PostIceCandidateBatch(_iceCandidateBatch, _pc, _eventQueue);
+				auto evt = ref new Org::WebRtc::RTCPeerConnectionIceEvent();
+				evt->Candidate = cxCandidate;
 				POST_PC_EVENT(OnIceCandidate, evt);
 			}
 
+			void GlobalObserver::PostIceCandidateBatch(
+				const std::shared_ptr<IceCandidateBatch>& batch,
+				Org::WebRtc::RTCPeerConnection^ pc,
+				rtc::scoped_refptr<EventQueue> eventQueue) {
+				// Posted with the lock held, the candidates taken are
+				// queued before any found after them.
+				rtc::CritScope lock(&batch->critSect);
+				batch->scheduled = false;
+				if (batch->candidates.empty() || pc == nullptr) {
+					batch->candidates.clear();
+					return;
+				}
+				auto evt = ref new Org::WebRtc::RTCPeerConnectionIceCandidatesEvent();
+				evt->Candidates = ref new Vector<Org::WebRtc::RTCIceCandidate^>(
+					std::move(batch->candidates));
+				batch->candidates.clear();
+				eventQueue->Post([pc, evt] {
+					pc->OnIceCandidates(evt);
+				});
+			}
+
+			void GlobalObserver::SetIceCandidateBatchMs(int batchMs) {
+				_iceCandidateBatchMs = std::max(batchMs, 0);
+			}
+
+			int GlobalObserver::GetIceCandidateBatchMs() {
+				return _iceCandidateBatchMs;
+			}
+
 			// TODO(bemasc): Remove this once callers transition to OnIceGatheringChange.
 			// All Ice candidates have been found.
 			void GlobalObserver::OnIceComplete() {
+				rtc::CritScope lock(&_iceCandidateBatch->critSect);
+				PostIceCandidateBatch(_iceCandidateBatch, _pc, _eventQueue);
 				auto evt = ref new Org::WebRtc::RTCPeerConnectionIceEvent();
 				evt->Candidate = nullptr;
 				POST_PC_EVENT(OnIceCandidate, evt);
@@ -251,122 +404,276 @@ namespace Org {
 				evt->SentBytes = stats.sent_bytes;
 				evt->SentKbps = stats.sent_kbps;
 				evt->RTT = stats.rtt;
-				evt->LocalCandidateType = ToCx(stats.local_candidate_type);
-				evt->RemoteCandidateType = ToCx(stats.remote_candidate_type);
+				evt->LocalCandidateType = ToCxInterned(stats.local_candidate_type);
+				evt->RemoteCandidateType = ToCxInterned(stats.remote_candidate_type);
+				evt->CpuUsage = stats.cpu_usage;
+				evt->MemoryUsage = stats.memory_usage;
+				auto threadCpuUsage = ref new Platform::Collections::Map<String^, double>();
+				for (auto& thread : stats.thread_cpu_usage) {
+					threadCpuUsage->Insert(ToCxInterned(thread.first), thread.second);
+				}
+				evt->ThreadCpuUsage = threadCpuUsage->GetView();
 				POST_PC_EVENT(OnConnectionHealthStats, evt);
 			}
 
 			void GlobalObserver::OnRTCStatsReportsReady(
 				const Org::WebRtc::RTCStatsReports& rtcStatsReports) {
+				// Renderers don't belong to a connection, their statistics
+				// come along with the reports of each one.
+				std::vector<std::pair<std::string, RendererStatsData>> rendererStats;
+				MediaSourceHelper::GetAllStats(&rendererStats);
+				double timestamp = (double)rtc::TimeUTCMicros() / rtc::kNumMicrosecsPerMillisec;
+				for (auto& entry : rendererStats) {
+					auto report = ref new Org::WebRtc::RTCStatsReport();
+					report->ReportId = ToCx("renderer_" + entry.first);
+					report->Timestamp = timestamp;
+					report->StatsType = Org::WebRtc::RTCStatsType::StatsReportTypeRenderer;
+					auto values = report->Values;
+					const RendererStatsData& stats = entry.second;
+					values->Insert(RTCStatsValueName::StatsValueNameRendererFramesQueued,
+						(int64)stats.framesQueued);
+					values->Insert(RTCStatsValueName::StatsValueNameRendererFramesRendered,
+						(int64)stats.framesRendered);
+					values->Insert(RTCStatsValueName::StatsValueNameRendererFramesReplaced,
+						(int64)stats.framesReplaced);
+					values->Insert(RTCStatsValueName::StatsValueNameRendererFramesDroppedToIdr,
+						(int64)stats.framesDroppedToIdr);
+					values->Insert(RTCStatsValueName::StatsValueNameRendererFramesLost,
+						(int64)stats.framesLost);
+					values->Insert(RTCStatsValueName::StatsValueNameRendererReceiveToQueueMs,
+						(float)stats.receiveToQueueMs);
+					values->Insert(RTCStatsValueName::StatsValueNameRendererMaxReceiveToQueueMs,
+						(float)stats.maxReceiveToQueueMs);
+					values->Insert(RTCStatsValueName::StatsValueNameRendererQueueResidencyMs,
+						(float)stats.queueResidencyMs);
+					values->Insert(RTCStatsValueName::StatsValueNameRendererMaxQueueResidencyMs,
+						(float)stats.maxQueueResidencyMs);
+					values->Insert(RTCStatsValueName::StatsValueNameRendererSampleRequestWaitMs,
+						(float)stats.sampleRequestWaitMs);
+					values->Insert(RTCStatsValueName::StatsValueNameRendererMaxSampleRequestWaitMs,
+						(float)stats.maxSampleRequestWaitMs);
+					values->Insert(RTCStatsValueName::StatsValueNameRendererConversionMs,
+						(float)stats.conversionMs);
+					values->Insert(RTCStatsValueName::StatsValueNameRendererMaxConversionMs,
+						(float)stats.maxConversionMs);
+					rtcStatsReports->Append(report);
+				}
+
+				globals::ThreadShardStats shardStats;
+				if (_pc != nullptr &&
+					globals::GetThreadShardStats(_pc->_threadShard, &shardStats)) {
+					auto report = ref new Org::WebRtc::RTCStatsReport();
+					report->ReportId = ToCx("threadshard_" + rtc::ToString(shardStats.index));
+					report->Timestamp = timestamp;
+					report->StatsType = Org::WebRtc::RTCStatsType::StatsReportTypeThreadShard;
+					auto values = report->Values;
+					values->Insert(RTCStatsValueName::StatsValueNameThreadShardIndex,
+						(int64)shardStats.index);
+					values->Insert(RTCStatsValueName::StatsValueNameThreadShardPeerConnections,
+						(int64)shardStats.peerConnections);
+					values->Insert(RTCStatsValueName::StatsValueNameThreadShardNetworkQueueSize,
+						(int64)shardStats.networkQueueSize);
+					values->Insert(RTCStatsValueName::StatsValueNameThreadShardWorkerQueueSize,
+						(int64)shardStats.workerQueueSize);
+					values->Insert(RTCStatsValueName::StatsValueNameThreadShardSignalingQueueSize,
+						(int64)shardStats.signalingQueueSize);
+					rtcStatsReports->Append(report);
+				}
+
 				auto evt = ref new Org::WebRtc::RTCStatsReportsReadyEvent();
 				evt->rtcStatsReports = rtcStatsReports;
 				POST_PC_EVENT(OnRTCStatsReportsReady, evt);
 			}
 
+			void GlobalObserver::OnQualitySummary(
+				const webrtc::QualitySummary& summary) {
+				auto evt = ref new Org::WebRtc::RTCQualitySummary();
+				evt->Timestamp = summary.timestamp;
+				evt->Duration = summary.duration_ms;
+				evt->IsFinal = summary.is_final;
+				auto metrics = ref new Platform::Collections::Map<
+					Org::WebRtc::RTCQualityMetric, Org::WebRtc::RTCQualityMetricSummary^>();
+				for (int i = 0; i < webrtc::kQualityMetricCount; ++i) {
+					const webrtc::QualityMetricSummary& metric = summary.metrics[i];
+					if (metric.count == 0) {
+						continue;
+					}
+					auto cxMetric = ref new Org::WebRtc::RTCQualityMetricSummary();
+					cxMetric->Count = metric.count;
+					cxMetric->Min = metric.min;
+					cxMetric->Max = metric.max;
+					cxMetric->Mean = metric.mean;
+					cxMetric->P50 = metric.p50;
+					cxMetric->P95 = metric.p95;
+					cxMetric->P99 = metric.p99;
+					// Same order as webrtc::QualityMetric.
+					metrics->Insert((Org::WebRtc::RTCQualityMetric)i, cxMetric);
+				}
+				evt->Metrics = metrics->GetView();
+				POST_PC_EVENT(OnQualitySummary, evt);
+			}
+
 			//============================================================================
 
 			CreateSdpObserver::CreateSdpObserver(
-				Concurrency::task_completion_event<webrtc::SessionDescriptionInterface*> tce)
-				: _tce(tce) {
+				Concurrency::task_completion_event<webrtc::SessionDescriptionInterface*> tce,
+				const CodecPreferences& preferences, const char* traceName)
+				: _tce(tce), _preferences(preferences), _traceName(traceName) {
+				TRACE_EVENT_ASYNC_BEGIN0("webrtc", _traceName, this);
 			}
 
 			void CreateSdpObserver::OnSuccess(webrtc::SessionDescriptionInterface* desc) {
+				TRACE_EVENT_ASYNC_END0("webrtc", _traceName, this);
+				ApplyCodecPreferences(_preferences, desc);
 				_tce.set(desc);
 			}
 
 			void CreateSdpObserver::OnFailure(const std::string& error) {
+				TRACE_EVENT_ASYNC_END0("webrtc", _traceName, this);
 				_tce.set_exception(error);
 			}
 
 			//============================================================================
 
-			SetSdpObserver::SetSdpObserver(Concurrency::task_completion_event<void> tce)
-				: _tce(tce) {
+			SetSdpObserver::SetSdpObserver(Concurrency::task_completion_event<void> tce,
+				const char* traceName)
+				: _tce(tce), _traceName(traceName) {
+				TRACE_EVENT_ASYNC_BEGIN0("webrtc", _traceName, this);
 			}
 
 			void SetSdpObserver::OnSuccess() {
+				TRACE_EVENT_ASYNC_END0("webrtc", _traceName, this);
 				_tce.set();
 			}
 
 			void SetSdpObserver::OnFailure(const std::string& error) {
+				TRACE_EVENT_ASYNC_END0("webrtc", _traceName, this);
 				_tce.set_exception(error);
 			}
 
 			//============================================================================
 
 			DataChannelObserver::DataChannelObserver(
-				Org::WebRtc::RTCDataChannel^ channel)
-				: _channel(channel) {
+				Org::WebRtc::RTCDataChannel^ channel,
+				rtc::scoped_refptr<EventQueue> eventQueue)
+				: _channel(channel), _eventQueue(eventQueue),
+				_workerQueue(new rtc::RefCountedObject<EventQueue>(
+					EventQueue::kTargetThreadPool)) {
 			}
 
 			void DataChannelObserver::OnStateChange() {
-				Windows::UI::Core::CoreDispatcher^ _windowDispatcher = webrtc::VideoCommonWinUWP::GetCoreDispatcher();
 				switch (_channel->GetImpl()->state()) {
 				case webrtc::DataChannelInterface::kOpen:
-					if (_windowDispatcher != nullptr) {
-						_windowDispatcher->RunAsync(
-							Windows::UI::Core::CoreDispatcherPriority::Normal,
-							ref new Windows::UI::Core::DispatchedHandler([this] {
-							_channel->OnOpen();
-						}));
-					}
-					else {
+					_eventQueue->Post([this] {
 						_channel->OnOpen();
-					}
+					});
 					break;
 				case webrtc::DataChannelInterface::kClosed:
 					_channel->_impl->UnregisterObserver();
-					if (_windowDispatcher != nullptr) {
-						_windowDispatcher->RunAsync(
-							Windows::UI::Core::CoreDispatcherPriority::Normal,
-							ref new Windows::UI::Core::DispatchedHandler([this] {
-							_channel->OnClose();
-							delete this;
-						}));
-					}
-					else {
+					_channel->FailPendingSends();
+					_eventQueue->Post([this] {
 						_channel->OnClose();
 						delete this;
-					}
+					});
 					break;
 				}
 			}
 
+			void DataChannelObserver::OnBufferedAmountChange(uint64_t previous_amount) {
+				uint64_t amount = _channel->_impl->buffered_amount();
+				uint64_t threshold = _channel->BufferedAmountLowThreshold;
+				if (previous_amount > threshold && amount <= threshold) {
+					auto channel = _channel;
+					_eventQueue->Post([channel] {
+						channel->OnBufferedAmountLow();
+					});
+				}
+				_channel->DrainPendingSends();
+			}
+
 			void DataChannelObserver::OnMessage(const webrtc::DataBuffer& buffer) {
+				auto channel = _channel;
+				std::vector<webrtc::DataBuffer> messages;
+				if (!channel->ReceiveCoalesced ||
+					!UnpackCoalescedMessages(buffer, &messages)) {
+					DeliverMessage(ToMessageEvent(buffer));
+					return;
+				}
+				// One event per message, delivered together.
+				auto events = std::make_shared<
+					std::vector<Org::WebRtc::RTCDataChannelMessageEvent^>>();
+				events->reserve(messages.size());
+				for (auto& message : messages) {
+					events->push_back(ToMessageEvent(message));
+				}
+				switch (channel->MessageDelivery) {
+				case Org::WebRtc::RTCDataChannelMessageDelivery::SignalingThread:
+					for (auto evt : *events) {
+						channel->OnMessage(evt);
+					}
+					break;
+				case Org::WebRtc::RTCDataChannelMessageDelivery::Worker:
+					_workerQueue->Post([channel, events] {
+						for (auto evt : *events) {
+							channel->OnMessage(evt);
+						}
+					});
+					break;
+				default:
+					_eventQueue->Post([channel, events] {
+						for (auto evt : *events) {
+							channel->OnMessage(evt);
+						}
+					});
+					break;
+				}
+			}
+
+			Org::WebRtc::RTCDataChannelMessageEvent^ DataChannelObserver::ToMessageEvent(
+				const webrtc::DataBuffer& buffer) {
 				auto evt = ref new Org::WebRtc::RTCDataChannelMessageEvent();
 
 				if (!buffer.binary) {
 					// convert buffer data from uint_8[] to char*
-					String^ receivedString = ToCx(std::string(
+					String^ receivedString = ToCx(
 						reinterpret_cast<const char*>(buffer.data.data()),
-						buffer.size()));
+						buffer.size());
 
 					evt->Data = ref new Org::WebRtc::StringDataChannelMessage(
 						receivedString);
 				}
+				else if (_channel->ReceiveBinaryAsBuffer) {
+					evt->Data = ref new Org::WebRtc::BufferDataChannelMessage(
+						ToIBuffer(buffer.data));
+				}
 				else {
-					// convert byte[] from buffer to Vector
-					std::vector<byte> bytesFromBuffer = std::vector<byte>();
-					bytesFromBuffer.insert(bytesFromBuffer.end(), buffer.data.data(),
-						buffer.data.data() + buffer.size());
-					Vector<byte>^ convertedBytes = ref new Vector<byte>();
-					ToCx(&bytesFromBuffer, convertedBytes);
+					const byte* data = buffer.data.data();
+					Vector<byte>^ convertedBytes = ref new Vector<byte>(
+						data, data + buffer.size());
 
 					evt->Data = ref new Org::WebRtc::BinaryDataChannelMessage(
 						convertedBytes);
 				}
+				return evt;
+			}
 
-
-				Windows::UI::Core::CoreDispatcher^ _windowDispatcher = webrtc::VideoCommonWinUWP::GetCoreDispatcher();
-				if (_windowDispatcher != nullptr) {
-					_windowDispatcher->RunAsync(
-						Windows::UI::Core::CoreDispatcherPriority::Normal,
-						ref new Windows::UI::Core::DispatchedHandler([this, evt] {
-						_channel->OnMessage(evt);
-					}));
-				}
-				else {
-					_channel->OnMessage(evt);
+			void DataChannelObserver::DeliverMessage(
+				Org::WebRtc::RTCDataChannelMessageEvent^ evt) {
+				auto channel = _channel;
+				switch (channel->MessageDelivery) {
+				case Org::WebRtc::RTCDataChannelMessageDelivery::SignalingThread:
+					channel->OnMessage(evt);
+					break;
+				case Org::WebRtc::RTCDataChannelMessageDelivery::Worker:
+					_workerQueue->Post([channel, evt] {
+						channel->OnMessage(evt);
+					});
+					break;
+				default:
+					_eventQueue->Post([channel, evt] {
+						channel->OnMessage(evt);
+					});
+					break;
 				}
 			}
 		}
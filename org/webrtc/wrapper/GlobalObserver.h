@@ -11,17 +11,24 @@
 #define ORG_WEBRTC_GLOBALOBSERVER_H_
 
 #include <ppltasks.h>
+#include <atomic>
 #include <functional>
+#include <memory>
 #include <string>
+#include <vector>
 #include "webrtc/api/peerconnectioninterface.h"
 #include "webrtc/rtc_base/event.h"
 #include "webrtc/rtc_base/scoped_ref_ptr.h"
+#include "webrtc/rtc_base/trace_event.h"
 #include "../stats/webrtc_stats_observer.h"
+#include "CodecPreferences.h"
+#include "EventQueue.h"
 
 namespace Org {
 	namespace WebRtc {
 		ref class RTCPeerConnection;
 		ref class RTCDataChannel;
+		ref class RTCIceCandidate;
 	}
 }  // namespace Org::WebRtc
 
@@ -45,12 +52,39 @@ namespace Org {
 				void EnableRTCStats(bool enable);
 				bool AreRTCStatsEnabled();
 
+				// Disabling raises the final summary.
+				void EnableQualityHistograms(bool enable);
+				bool AreQualityHistogramsEnabled();
+				void SetQualitySummaryInterval(int intervalMs);
+				int GetQualitySummaryInterval();
+
 				void EnableSendRtcStatsToRemoteHost(bool enable);
 				bool IsSendRtcStatsToRemoteHostEnabled();
 				void SetRtcStatsDestinationHost(std::string hostname);
 				std::string GetRtcStatsDestinationHost();
 				void SetRtcStatsDestinationPort(int port);
 				int GetRtcStatsDestinationPort();
+				void SetRtcStatsDestinationFormat(webrtc::StatsNetworkFormat format);
+				webrtc::StatsNetworkFormat GetRtcStatsDestinationFormat();
+				void SetStatsPollingConfig(const webrtc::StatsPollingConfig& config);
+				webrtc::StatsPollingConfig GetStatsPollingConfig();
+				void SetRtcStatsFilter(const webrtc::StatsFilter& filter);
+				void SetEtwStatsFilter(const webrtc::StatsFilter& filter);
+
+				// Keep the track filter of the stats up to date, the remote
+				// streams are followed from OnAddStream/OnRemoveStream.
+				void OnLocalStreamAdded(rtc::scoped_refptr<webrtc::MediaStreamInterface> stream);
+				void OnLocalStreamRemoved(rtc::scoped_refptr<webrtc::MediaStreamInterface> stream);
+
+				// Queue the events of the peer connection and its data
+				// channels are delivered through.
+				rtc::scoped_refptr<EventQueue> GetEventQueue();
+
+				// Candidates found within |batchMs| of the first one are
+				// raised together through OnIceCandidates, 0 raises each
+				// one through OnIceCandidate.
+				void SetIceCandidateBatchMs(int batchMs);
+				int GetIceCandidateBatchMs();
 
 				// PeerConnectionObserver functions
 				virtual void OnSignalingChange(
@@ -81,9 +115,26 @@ namespace Org {
 					const webrtc::ConnectionHealthStats& stats);
 				virtual void OnRTCStatsReportsReady(
 					const Org::WebRtc::RTCStatsReports& rtcStatsReports);
+				virtual void OnQualitySummary(const webrtc::QualitySummary& summary);
 
 			private:
+				// Candidates waiting for their batch to be raised, shared
+				// with the timer raising it.
+				struct IceCandidateBatch {
+					IceCandidateBatch() : scheduled(false) {}
+					rtc::CriticalSection critSect;
+					std::vector<Org::WebRtc::RTCIceCandidate^> candidates;
+					bool scheduled;
+				};
+
 				void ResetStatsConfig();
+				// Raises the candidates of |batch|, if any.  The events to
+				// be raised after them are posted with |batch->critSect|
+				// held as well, it is reentrant.
+				static void PostIceCandidateBatch(
+					const std::shared_ptr<IceCandidateBatch>& batch,
+					Org::WebRtc::RTCPeerConnection^ pc,
+					rtc::scoped_refptr<EventQueue> eventQueue);
 
 			private:
 				Org::WebRtc::RTCPeerConnection^ _pc;
@@ -91,17 +142,33 @@ namespace Org {
 				bool _etwStatsEnabled;
 				bool _connectionHealthStatsEnabled;
 				bool _rtcStatsEnabled;
+				bool _qualityHistogramsEnabled;
+				int _qualitySummaryIntervalMs;
 
 				bool _sendRtcStatsToRemoteHostEnabled;
 				std::string _rtcStatsDestinationHost;
 				int _rtcStatsDestinationPort;
+				webrtc::StatsNetworkFormat _rtcStatsDestinationFormat;
+				webrtc::StatsPollingConfig _statsPollingConfig;
+				webrtc::StatsFilter _rtcStatsFilter;
+				webrtc::StatsFilter _etwStatsFilter;
+
+				rtc::scoped_refptr<EventQueue> _eventQueue;
+				std::shared_ptr<IceCandidateBatch> _iceCandidateBatch;
+				// Set from the application thread, read once per candidate
+				// on the signaling thread.
+				std::atomic<int> _iceCandidateBatchMs;
 			};
 
 			// There is one of those per call to CreateOffer().
 			class CreateSdpObserver : public webrtc::CreateSessionDescriptionObserver {
 			public:
+				// |preferences| reorder the codecs of the description created,
+				// if not empty.  The call is traced as an async event named
+				// |traceName|, a literal, up to the callback.
 				CreateSdpObserver(Concurrency::task_completion_event
-					<webrtc::SessionDescriptionInterface*> tce);
+					<webrtc::SessionDescriptionInterface*> tce,
+					const CodecPreferences& preferences, const char* traceName);
 
 				// CreateSessionDescriptionObserver implementation
 				virtual void OnSuccess(webrtc::SessionDescriptionInterface* desc);
@@ -109,12 +176,16 @@ namespace Org {
 
 			private:
 				Concurrency::task_completion_event<webrtc::SessionDescriptionInterface*> _tce;
+				const CodecPreferences _preferences;
+				const char* const _traceName;
 			};
 
 			// There is one of those per call to CreateOffer().
 			class SetSdpObserver : public webrtc::SetSessionDescriptionObserver {
 			public:
-				explicit SetSdpObserver(Concurrency::task_completion_event<void> tce);
+				// Traced like CreateSdpObserver.
+				SetSdpObserver(Concurrency::task_completion_event<void> tce,
+					const char* traceName);
 
 				// SetSessionDescriptionObserver implementation
 				virtual void OnSuccess();
@@ -122,19 +193,29 @@ namespace Org {
 
 			private:
 				Concurrency::task_completion_event<void> _tce;
+				const char* const _traceName;
 			};
 
 			// There is one of those per call to CreateDataChannel().
 			class DataChannelObserver : public webrtc::DataChannelObserver {
 			public:
-				explicit DataChannelObserver(Org::WebRtc::RTCDataChannel^ channel);
+				DataChannelObserver(Org::WebRtc::RTCDataChannel^ channel,
+					rtc::scoped_refptr<EventQueue> eventQueue);
 
 				// DataChannelObserver implementation
 				virtual void OnStateChange();
 				virtual void OnMessage(const webrtc::DataBuffer& buffer);
+				virtual void OnBufferedAmountChange(uint64_t previous_amount);
 
 			private:
+				Org::WebRtc::RTCDataChannelMessageEvent^ ToMessageEvent(
+					const webrtc::DataBuffer& buffer);
+				void DeliverMessage(Org::WebRtc::RTCDataChannelMessageEvent^ evt);
+
 				Org::WebRtc::RTCDataChannel^ _channel;
+				rtc::scoped_refptr<EventQueue> _eventQueue;
+				// Keeps the messages delivered off the UI thread in order.
+				rtc::scoped_refptr<EventQueue> _workerQueue;
 			};
 		}
 	}
@@ -0,0 +1,45 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#ifndef ORG_WEBRTC_KEYFRAMEREQUEST_H_
+#define ORG_WEBRTC_KEYFRAMEREQUEST_H_
+
+#include <Windows.h>
+
+namespace webrtc {
+	namespace vcm {
+		// How we trigger a key frame request when
+		// registering an H264 renderer. We render
+		// encoded samples so we have to request a
+		// key frame as fast as possible otherwise
+		// we don't render anything until the next
+		// key frame.
+		// A plain bool defined and reset by the video receiver of the
+		// webrtc tree, only set through RequestGlobalKeyFrame().
+		extern bool globalRequestKeyFrame;
+	}
+}
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			// Has the video receiver request a key frame.  Set from the
+			// UI, the media sources as well as the render threads, with
+			// a full barrier.
+			inline void RequestGlobalKeyFrame() {
+				static_assert(sizeof(webrtc::vcm::globalRequestKeyFrame) ==
+					sizeof(char), "Set as a char");
+				InterlockedExchange8(reinterpret_cast<volatile char*>(
+					&webrtc::vcm::globalRequestKeyFrame), 1);
+			}
+		}
+	}
+}  // namespace Org.WebRtc.Internal
+
+#endif  // ORG_WEBRTC_KEYFRAMEREQUEST_H_
@@ -0,0 +1,155 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#include "LatencyProbe.h"
+#include <algorithm>
+#include "libyuv/planar_functions.h"
+#include "webrtc/rtc_base/timeutils.h"
+
+using Windows::System::Threading::TimerElapsedHandler;
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			TestPatternState::TestPatternState(int width, int height) :
+				width(width), height(height),
+				capturer(nullptr),
+				nextFrameId(0),
+				droppedFrames(0),
+				closed(false) {
+			}
+
+			void TestPatternState::OnTimer() {
+				rtc::CritScope lock(&critSect);
+				if (closed) {
+					return;
+				}
+				int64_t timeUs = rtc::TimeMicros();
+				int outWidth, outHeight;
+				RECT crop;
+				rtc::scoped_refptr<webrtc::I420Buffer> buffer;
+				// The pattern is drawn at the size the sinks want, nothing
+				// to crop or scale.
+				if (capturer->Adapt(width, height, &timeUs, &outWidth, &outHeight, &crop)) {
+					buffer = bufferPool.CreateBuffer(outWidth, outHeight);
+				}
+				uint32_t frameId = nextFrameId++;
+				if (buffer == nullptr) {
+					++droppedFrames;
+					return;
+				}
+				// Diagonal bands moving by 4 pixels per frame, for the
+				// encoder to have motion to code.
+				uint8_t* y = buffer->MutableDataY();
+				for (int row = 0; row < outHeight; ++row) {
+					uint8_t* line = y + row * buffer->StrideY();
+					for (int x = 0; x < outWidth; ++x) {
+						line[x] = (uint8_t)(64 + ((x + row + frameId * 4) & 0x7f));
+					}
+				}
+				libyuv::SetPlane(buffer->MutableDataU(), buffer->StrideU(),
+					buffer->ChromaWidth(), buffer->ChromaHeight(), 128);
+				libyuv::SetPlane(buffer->MutableDataV(), buffer->StrideV(),
+					buffer->ChromaWidth(), buffer->ChromaHeight(), 128);
+				WriteFrameStamp(buffer.get(), frameId, (uint32_t)rtc::TimeMillis());
+				capturer->Deliver(webrtc::VideoFrame(buffer, webrtc::kVideoRotation_0, timeUs),
+					width, height);
+			}
+		}
+
+		// = TestPatternVideoSource ==================================================
+
+		TestPatternVideoSource::TestPatternVideoSource(uint32 width,
+			uint32 height, uint32 framerate) {
+			framerate = std::min(std::max(framerate, 1u), 60u);
+			_state = std::make_shared<Internal::TestPatternState>(
+				std::max(128u, width & ~1u), std::max(64u, height & ~1u));
+			_state->capturer = new Internal::CustomVideoCapturer(_state->width,
+				_state->height, framerate, false);
+			_track = Internal::CreateCustomVideoTrack(_state->capturer);
+
+			std::shared_ptr<Internal::TestPatternState> state = _state;
+			Windows::Foundation::TimeSpan period;
+			period.Duration = 10000000 / framerate;  // hns
+			_timer = ThreadPoolTimer::CreatePeriodicTimer(
+				ref new TimerElapsedHandler([state](ThreadPoolTimer^) {
+				state->OnTimer();
+			}), period);
+		}
+
+		TestPatternVideoSource::~TestPatternVideoSource() {
+			_timer->Cancel();
+			rtc::CritScope lock(&_state->critSect);
+			_state->closed = true;
+		}
+
+		MediaVideoTrack^ TestPatternVideoSource::Track::get() {
+			return _track;
+		}
+
+		uint64 TestPatternVideoSource::FramesGenerated::get() {
+			rtc::CritScope lock(&_state->critSect);
+			return _state->nextFrameId;
+		}
+
+		uint64 TestPatternVideoSource::DroppedFrames::get() {
+			return _state->droppedFrames;
+		}
+
+		// = VideoLatencyProbe =======================================================
+
+		VideoLatencyProbe::VideoLatencyProbe(MediaVideoTrack^ track) :
+			_track(track),
+			_sink(new Internal::LatencySink()) {
+			if (track == nullptr) {
+				THROW_WEBRTC_NULL_REFERENCE_EXCEPTION("Invalid video track");
+			}
+			_track->SetRenderer(_sink.get());
+		}
+
+		VideoLatencyProbe::~VideoLatencyProbe() {
+			_track->UnsetRenderer(_sink.get());
+		}
+
+		uint64 VideoLatencyProbe::FramesReceived::get() {
+			rtc::CritScope lock(&_sink->critSect);
+			return _sink->framesReceived;
+		}
+
+		uint64 VideoLatencyProbe::FramesMissing::get() {
+			rtc::CritScope lock(&_sink->critSect);
+			return _sink->framesMissing;
+		}
+
+		uint64 VideoLatencyProbe::InvalidStamps::get() {
+			rtc::CritScope lock(&_sink->critSect);
+			return _sink->invalidStamps;
+		}
+
+		uint32 VideoLatencyProbe::LastLatencyMs::get() {
+			rtc::CritScope lock(&_sink->critSect);
+			return _sink->lastLatencyMs;
+		}
+
+		double VideoLatencyProbe::AverageLatencyMs::get() {
+			rtc::CritScope lock(&_sink->critSect);
+			return _sink->framesReceived > 0 ?
+				(double)_sink->totalLatencyMs / _sink->framesReceived : 0;
+		}
+
+		uint32 VideoLatencyProbe::MaxLatencyMs::get() {
+			rtc::CritScope lock(&_sink->critSect);
+			return _sink->maxLatencyMs;
+		}
+
+		void VideoLatencyProbe::Reset() {
+			_sink->Reset();
+		}
+	}
+}  // namespace Org.WebRtc
@@ -0,0 +1,124 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#ifndef ORG_WEBRTC_LATENCYPROBE_H_
+#define ORG_WEBRTC_LATENCYPROBE_H_
+
+#include <memory>
+#include "CustomVideoSource.h"
+#include "FrameStamp.h"
+
+using Windows::System::Threading::ThreadPoolTimer;
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			// Shared with the timer, which can still fire while the source
+			// is destroyed.
+			struct TestPatternState {
+				TestPatternState(int width, int height);
+
+				const int width;
+				const int height;
+				rtc::CriticalSection critSect;
+				CustomVideoCapturer* capturer;
+				webrtc::I420BufferPool bufferPool;
+				uint32_t nextFrameId;
+				std::atomic<uint64> droppedFrames;
+				bool closed;
+
+				void OnTimer();
+			};
+		}
+
+		/// <summary>
+		/// Video track of a synthetic moving pattern, each frame stamped
+		/// with its number and the time it was generated.  Fed to one end
+		/// of a call, a <see cref="VideoLatencyProbe"/> on the other end
+		/// measures the latency and the frames lost.  Both ends must run
+		/// in the same process, or on clocks in sync to the millisecond.
+		/// </summary>
+		public ref class TestPatternVideoSource sealed {
+		internal:
+			TestPatternVideoSource(uint32 width, uint32 height, uint32 framerate);
+
+		public:
+			virtual ~TestPatternVideoSource();
+
+			/// <summary>
+			/// Track of the generated frames, to be added to a media stream.
+			/// </summary>
+			property MediaVideoTrack^ Track { MediaVideoTrack^ get(); }
+			/// <summary>
+			/// Number of frames generated, the next frame number.
+			/// </summary>
+			property uint64 FramesGenerated { uint64 get(); }
+			/// <summary>
+			/// Number of frames the sinks of the track didn't take.
+			/// </summary>
+			property uint64 DroppedFrames { uint64 get(); }
+
+		private:
+			std::shared_ptr<Internal::TestPatternState> _state;
+			MediaVideoTrack^ _track;
+			ThreadPoolTimer^ _timer;
+		};
+
+		/// <summary>
+		/// Measures the latency of the frames of a
+		/// <see cref="TestPatternVideoSource"/>, from generation to
+		/// rendering, on a remote track.  The measures include the
+		/// encoding, the transport, the jitter buffer and the decoding.
+		/// </summary>
+		public ref class VideoLatencyProbe sealed {
+		internal:
+			VideoLatencyProbe(MediaVideoTrack^ track);
+
+		public:
+			virtual ~VideoLatencyProbe();
+
+			/// <summary>
+			/// Number of stamped frames received.
+			/// </summary>
+			property uint64 FramesReceived { uint64 get(); }
+			/// <summary>
+			/// Number of frames skipped between the received ones, dropped
+			/// by the sender, lost or not decoded.
+			/// </summary>
+			property uint64 FramesMissing { uint64 get(); }
+			/// <summary>
+			/// Number of frames whose stamp couldn't be read.
+			/// </summary>
+			property uint64 InvalidStamps { uint64 get(); }
+			/// <summary>
+			/// Latency of the last frame received, in milliseconds.
+			/// </summary>
+			property uint32 LastLatencyMs { uint32 get(); }
+			/// <summary>
+			/// Average latency of the frames received, in milliseconds.
+			/// </summary>
+			property double AverageLatencyMs { double get(); }
+			/// <summary>
+			/// Highest latency of a frame received, in milliseconds.
+			/// </summary>
+			property uint32 MaxLatencyMs { uint32 get(); }
+
+			/// <summary>
+			/// Starts the counts over.
+			/// </summary>
+			void Reset();
+
+		private:
+			MediaVideoTrack^ _track;
+			std::unique_ptr<Internal::LatencySink> _sink;
+		};
+	}
+}  // namespace Org.WebRtc
+
+#endif  // ORG_WEBRTC_LATENCYPROBE_H_
@@ -0,0 +1,1113 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#include "LowLatencyAudioDevice.h"
+#include <mmdeviceapi.h>
+#include <ksmedia.h>
+#include <ppltasks.h>
+#include <algorithm>
+#include "webrtc/rtc_base/logging.h"
+#include "webrtc/rtc_base/win32.h"  // ToUtf8
+
+#pragma comment(lib, "mmdevapi.lib")
+
+using Microsoft::WRL::FtmBase;
+using Microsoft::WRL::Make;
+using Microsoft::WRL::RuntimeClass;
+using Microsoft::WRL::RuntimeClassFlags;
+using Microsoft::WRL::ClassicCom;
+using Windows::Devices::Enumeration::DeviceClass;
+using Windows::Devices::Enumeration::DeviceInformation;
+using Windows::Devices::Enumeration::DeviceInformationCollection;
+using Windows::Media::Devices::AudioDeviceRole;
+
+namespace {
+	// WebRTC exchanges audio 10ms at a time.
+	const int kChunksPerSecond = 100;
+	const DWORD kEventTimeoutMs = 200;
+	const uint32_t kMaxVolume = 255;
+
+	// Completion of ActivateAudioInterfaceAsync, called on a thread of
+	// the MTA.
+	class ActivateAudioHandler : public RuntimeClass<
+		RuntimeClassFlags<ClassicCom>, FtmBase,
+		IActivateAudioInterfaceCompletionHandler> {
+	public:
+		ActivateAudioHandler() : _event(CreateEventEx(nullptr, nullptr, 0,
+			EVENT_ALL_ACCESS)) {}
+		~ActivateAudioHandler() { CloseHandle(_event); }
+
+		STDMETHOD(ActivateCompleted)(
+			IActivateAudioInterfaceAsyncOperation* operation) {
+			SetEvent(_event);
+			return S_OK;
+		}
+
+		HANDLE Event() const { return _event; }
+
+	private:
+		HANDLE _event;
+	};
+
+	HRESULT ActivateAudioClient(const std::wstring& deviceId,
+		ComPtr<IAudioClient>* audioClient) {
+		ComPtr<ActivateAudioHandler> handler = Make<ActivateAudioHandler>();
+		ComPtr<IActivateAudioInterfaceAsyncOperation> operation;
+		HRESULT hr = ActivateAudioInterfaceAsync(deviceId.c_str(),
+			__uuidof(IAudioClient), nullptr, handler.Get(), &operation);
+		if (FAILED(hr)) {
+			return hr;
+		}
+		WaitForSingleObjectEx(handler->Event(), INFINITE, FALSE);
+		HRESULT activateHr = S_OK;
+		ComPtr<IUnknown> audioInterface;
+		hr = operation->GetActivateResult(&activateHr, &audioInterface);
+		if (FAILED(hr)) {
+			return hr;
+		}
+		if (FAILED(activateHr)) {
+			return activateHr;
+		}
+		return audioInterface.As(audioClient);
+	}
+
+	std::wstring DefaultDeviceId(bool capture) {
+		Platform::String^ id = capture ?
+			Windows::Media::Devices::MediaDevice::GetDefaultAudioCaptureId(
+				AudioDeviceRole::Communications) :
+			Windows::Media::Devices::MediaDevice::GetDefaultAudioRenderId(
+				AudioDeviceRole::Communications);
+		return id != nullptr ? std::wstring(id->Data()) : std::wstring();
+	}
+
+	// The ids and names the device manager enumerates.  Waits for the
+	// enumeration, called on the worker thread.
+	std::vector<std::pair<std::string, std::string>> FindAudioDevices(
+		bool capture) {
+		std::vector<std::pair<std::string, std::string>> devices;
+		try {
+			DeviceInformationCollection^ collection = Concurrency::create_task(
+				DeviceInformation::FindAllAsync(capture ?
+					DeviceClass::AudioCapture : DeviceClass::AudioRender)).get();
+			for (unsigned int i = 0; i < collection->Size; ++i) {
+				DeviceInformation^ info = collection->GetAt(i);
+				devices.push_back(std::make_pair(
+					rtc::ToUtf8(info->Id->Data(), info->Id->Length()),
+					rtc::ToUtf8(info->Name->Data(), info->Name->Length())));
+			}
+		}
+		catch (Platform::Exception^ e) {
+			LOG(LS_ERROR) << "Can't enumerate the audio devices: "
+				<< rtc::ToUtf8(e->Message->Data());
+		}
+		return devices;
+	}
+
+	bool IsFloatFormat(const WAVEFORMATEX* format) {
+		if (format->wFormatTag == WAVE_FORMAT_IEEE_FLOAT) {
+			return true;
+		}
+		return format->wFormatTag == WAVE_FORMAT_EXTENSIBLE &&
+			reinterpret_cast<const WAVEFORMATEXTENSIBLE*>(format)->SubFormat ==
+			KSDATAFORMAT_SUBTYPE_IEEE_FLOAT;
+	}
+
+	bool IsPcm16Format(const WAVEFORMATEX* format) {
+		if (format->wBitsPerSample != 16) {
+			return false;
+		}
+		if (format->wFormatTag == WAVE_FORMAT_PCM) {
+			return true;
+		}
+		return format->wFormatTag == WAVE_FORMAT_EXTENSIBLE &&
+			reinterpret_cast<const WAVEFORMATEXTENSIBLE*>(format)->SubFormat ==
+			KSDATAFORMAT_SUBTYPE_PCM;
+	}
+
+	int16_t FloatToInt16(float value) {
+		value = std::max(-1.0f, std::min(1.0f, value));
+		return (int16_t)(value * 32767.0f);
+	}
+}
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			AudioClientStream::AudioClientStream(bool capture, int channels) :
+				_capture(capture),
+				_channels(channels),
+				_event(CreateEventEx(nullptr, nullptr, 0, EVENT_ALL_ACCESS)),
+				_sampleRate(0),
+				_mixChannels(0),
+				_mixFloat(false),
+				_bufferFrames(0),
+				_latencyMs(0),
+				_running(false) {
+			}
+
+			AudioClientStream::~AudioClientStream() {
+				Close();
+				CloseHandle(_event);
+			}
+
+			HRESULT AudioClientStream::Open(const std::wstring& deviceId,
+				uint32_t periodFrames) {
+				Close();
+				std::wstring id = deviceId.empty() ? DefaultDeviceId(_capture) : deviceId;
+				if (id.empty()) {
+					return E_NOTFOUND;
+				}
+				ComPtr<IAudioClient> audioClient;
+				HRESULT hr = ActivateAudioClient(id, &audioClient);
+				if (FAILED(hr)) {
+					return hr;
+				}
+				WAVEFORMATEX* mixFormat = nullptr;
+				hr = audioClient->GetMixFormat(&mixFormat);
+				if (FAILED(hr)) {
+					return hr;
+				}
+				std::unique_ptr<WAVEFORMATEX, decltype(&CoTaskMemFree)> mixFormatPtr(
+					mixFormat, &CoTaskMemFree);
+				if (!IsFloatFormat(mixFormat) && !IsPcm16Format(mixFormat)) {
+					LOG(LS_ERROR) << "Unsupported audio mix format "
+						<< mixFormat->wFormatTag << ", " << mixFormat->wBitsPerSample << " bits";
+					return AUDCLNT_E_UNSUPPORTED_FORMAT;
+				}
+
+				UINT32 streamPeriodFrames = 0;
+				ComPtr<IAudioClient3> audioClient3;
+				if (SUCCEEDED(audioClient.As(&audioClient3))) {
+					UINT32 defaultPeriod, fundamentalPeriod, minPeriod, maxPeriod;
+					hr = audioClient3->GetSharedModeEnginePeriod(mixFormat,
+						&defaultPeriod, &fundamentalPeriod, &minPeriod, &maxPeriod);
+					if (SUCCEEDED(hr)) {
+						streamPeriodFrames = minPeriod;
+						if (periodFrames > 0) {
+							// A multiple of the fundamental period from the
+							// minimum one.
+							UINT32 steps = (std::max((UINT32)periodFrames, minPeriod) -
+								minPeriod + fundamentalPeriod / 2) / fundamentalPeriod;
+							streamPeriodFrames = std::min(minPeriod +
+								steps * fundamentalPeriod, maxPeriod);
+						}
+						hr = audioClient3->InitializeSharedAudioStream(
+							AUDCLNT_STREAMFLAGS_EVENTCALLBACK, streamPeriodFrames,
+							mixFormat, nullptr);
+					}
+					if (FAILED(hr)) {
+						// The client can't be initialized again.
+						LOG(LS_WARNING) << "Low latency audio stream not available: "
+							<< hr << ", using the default period";
+						streamPeriodFrames = 0;
+						audioClient3 = nullptr;
+						audioClient = nullptr;
+						hr = ActivateAudioClient(id, &audioClient);
+						if (FAILED(hr)) {
+							return hr;
+						}
+					}
+				}
+				if (audioClient3 == nullptr) {
+					REFERENCE_TIME defaultPeriod = 0, minPeriod = 0;
+					audioClient->GetDevicePeriod(&defaultPeriod, &minPeriod);
+					hr = audioClient->Initialize(AUDCLNT_SHAREMODE_SHARED,
+						AUDCLNT_STREAMFLAGS_EVENTCALLBACK, 0, 0, mixFormat, nullptr);
+					if (FAILED(hr)) {
+						return hr;
+					}
+					streamPeriodFrames = (UINT32)(defaultPeriod *
+						mixFormat->nSamplesPerSec / 10000000);
+				}
+
+				hr = audioClient->SetEventHandle(_event);
+				if (FAILED(hr)) {
+					return hr;
+				}
+				hr = audioClient->GetBufferSize(&_bufferFrames);
+				if (FAILED(hr)) {
+					return hr;
+				}
+				if (_capture) {
+					hr = audioClient->GetService(IID_PPV_ARGS(&_captureClient));
+				}
+				else {
+					hr = audioClient->GetService(IID_PPV_ARGS(&_renderClient));
+				}
+				if (FAILED(hr)) {
+					return hr;
+				}
+				audioClient->GetService(IID_PPV_ARGS(&_volume));
+
+				REFERENCE_TIME streamLatency = 0;
+				audioClient->GetStreamLatency(&streamLatency);
+				_sampleRate = mixFormat->nSamplesPerSec;
+				_mixChannels = mixFormat->nChannels;
+				_mixFloat = IsFloatFormat(mixFormat);
+				_latencyMs = (int)(streamPeriodFrames * 1000 / _sampleRate +
+					streamLatency / 10000);
+				_audioClient = audioClient;
+				LOG(LS_INFO) << (_capture ? "Capture" : "Render")
+					<< " audio stream opened at " << _sampleRate << " Hz, "
+					<< _mixChannels << " channels, period of "
+					<< streamPeriodFrames << " frames, latency " << _latencyMs << "ms";
+				return S_OK;
+			}
+
+			HRESULT AudioClientStream::Start(Callback callback) {
+				if (_audioClient == nullptr) {
+					return E_NOT_VALID_STATE;
+				}
+				if (_running) {
+					return S_OK;
+				}
+				_callback = callback;
+				if (!_capture) {
+					// Silence until the first event, or the start glitches.
+					BYTE* data = nullptr;
+					if (SUCCEEDED(_renderClient->GetBuffer(_bufferFrames, &data))) {
+						_renderClient->ReleaseBuffer(_bufferFrames, AUDCLNT_BUFFERFLAGS_SILENT);
+					}
+				}
+				HRESULT hr = _audioClient->Start();
+				if (FAILED(hr)) {
+					return hr;
+				}
+				_running = true;
+				_thread = std::thread(&AudioClientStream::Run, this);
+				return S_OK;
+			}
+
+			void AudioClientStream::Stop() {
+				if (!_running) {
+					return;
+				}
+				_running = false;
+				SetEvent(_event);
+				_thread.join();
+				_audioClient->Stop();
+				_audioClient->Reset();
+			}
+
+			void AudioClientStream::Close() {
+				Stop();
+				_volume = nullptr;
+				_captureClient = nullptr;
+				_renderClient = nullptr;
+				_audioClient = nullptr;
+			}
+
+			void AudioClientStream::Run() {
+				CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+				// MMCSS isn't available to UWP apps, the audio engine
+				// period is met with the highest thread priority.
+				SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+				while (_running) {
+					if (WaitForSingleObjectEx(_event, kEventTimeoutMs, FALSE) !=
+						WAIT_OBJECT_0 || !_running) {
+						continue;
+					}
+					if (_capture) {
+						Capture();
+					}
+					else {
+						Render();
+					}
+				}
+				CoUninitialize();
+			}
+
+			void AudioClientStream::Capture() {
+				UINT32 packetFrames = 0;
+				while (SUCCEEDED(_captureClient->GetNextPacketSize(&packetFrames)) &&
+					packetFrames > 0) {
+					BYTE* data = nullptr;
+					UINT32 frames = 0;
+					DWORD flags = 0;
+					if (FAILED(_captureClient->GetBuffer(&data, &frames, &flags,
+						nullptr, nullptr))) {
+						return;
+					}
+					if (flags & AUDCLNT_BUFFERFLAGS_SILENT) {
+						_samples.assign(frames * _channels, 0);
+					}
+					else {
+						FromMixFormat(data, frames);
+					}
+					_captureClient->ReleaseBuffer(frames);
+					_callback(_samples.data(), frames);
+				}
+			}
+
+			void AudioClientStream::Render() {
+				UINT32 padding = 0;
+				if (FAILED(_audioClient->GetCurrentPadding(&padding))) {
+					return;
+				}
+				UINT32 frames = _bufferFrames - padding;
+				if (frames == 0) {
+					return;
+				}
+				_samples.resize(frames * _channels);
+				_callback(_samples.data(), frames);
+				BYTE* data = nullptr;
+				if (FAILED(_renderClient->GetBuffer(frames, &data))) {
+					return;
+				}
+				ToMixFormat(data, frames);
+				_renderClient->ReleaseBuffer(frames, 0);
+			}
+
+			void AudioClientStream::FromMixFormat(const BYTE* data, size_t frames) {
+				_samples.resize(frames * _channels);
+				const float* floats = reinterpret_cast<const float*>(data);
+				const int16_t* ints = reinterpret_cast<const int16_t*>(data);
+				for (size_t frame = 0; frame < frames; ++frame) {
+					size_t in = frame * _mixChannels;
+					if (_channels == 1) {
+						// Downmix of every channel.
+						float sum = 0;
+						for (int c = 0; c < _mixChannels; ++c) {
+							sum += _mixFloat ? floats[in + c] : ints[in + c] / 32768.0f;
+						}
+						_samples[frame] = FloatToInt16(sum / _mixChannels);
+						continue;
+					}
+					for (int c = 0; c < _channels; ++c) {
+						int mixChannel = std::min(c, _mixChannels - 1);
+						_samples[frame * _channels + c] = _mixFloat ?
+							FloatToInt16(floats[in + mixChannel]) : ints[in + mixChannel];
+					}
+				}
+			}
+
+			void AudioClientStream::ToMixFormat(BYTE* data, size_t frames) {
+				float* floats = reinterpret_cast<float*>(data);
+				int16_t* ints = reinterpret_cast<int16_t*>(data);
+				for (size_t frame = 0; frame < frames; ++frame) {
+					const int16_t* in = &_samples[frame * _channels];
+					size_t out = frame * _mixChannels;
+					for (int c = 0; c < _mixChannels; ++c) {
+						int16_t sample;
+						if (_mixChannels == 1) {
+							sample = _channels == 1 ? in[0] : (int16_t)((in[0] + in[1]) / 2);
+						}
+						else if (c < 2) {
+							// Front left and right, the others stay silent.
+							sample = in[std::min(c, _channels - 1)];
+						}
+						else {
+							sample = 0;
+						}
+						if (_mixFloat) {
+							floats[out + c] = sample / 32768.0f;
+						}
+						else {
+							ints[out + c] = sample;
+						}
+					}
+				}
+			}
+
+			LowLatencyAudioDeviceModule::LowLatencyAudioDeviceModule(
+				uint32_t periodFrames) :
+				_periodFrames(periodFrames),
+				_initialized(false),
+				_recording(false),
+				_playing(false),
+				_stereoPlayout(false),
+				_microphoneMute(false),
+				_playoutDelayMs(0),
+				_audioTransport(nullptr),
+				_recordedFrames(0),
+				_playoutFifoStart(0) {
+			}
+
+			LowLatencyAudioDeviceModule::~LowLatencyAudioDeviceModule() {
+				Terminate();
+			}
+
+			void LowLatencyAudioDeviceModule::SetRecordingDeviceId(const std::string& id) {
+				bool restart;
+				{
+					rtc::CritScope lock(&_critSect);
+					if (_recordingDeviceId == id) {
+						return;
+					}
+					_recordingDeviceId = id;
+					restart = _recording;
+				}
+				if (restart) {
+					StopRecording();
+					InitRecording();
+					StartRecording();
+				}
+			}
+
+			void LowLatencyAudioDeviceModule::SetPlayoutDeviceId(const std::string& id) {
+				bool restart;
+				{
+					rtc::CritScope lock(&_critSect);
+					if (_playoutDeviceId == id) {
+						return;
+					}
+					_playoutDeviceId = id;
+					restart = _playing;
+				}
+				if (restart) {
+					StopPlayout();
+					InitPlayout();
+					StartPlayout();
+				}
+			}
+
+			int32_t LowLatencyAudioDeviceModule::ActiveAudioLayer(
+				AudioLayer* audioLayer) const {
+				*audioLayer = kWindowsCoreAudio;
+				return 0;
+			}
+
+			webrtc::AudioDeviceModule::ErrorCode
+				LowLatencyAudioDeviceModule::LastError() const {
+				return kAdmErrNone;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::RegisterEventObserver(
+				webrtc::AudioDeviceObserver* eventCallback) {
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::RegisterAudioCallback(
+				webrtc::AudioTransport* audioCallback) {
+				rtc::CritScope lock(&_transportCritSect);
+				_audioTransport = audioCallback;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::Init() {
+				rtc::CritScope lock(&_critSect);
+				_initialized = true;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::Terminate() {
+				StopRecording();
+				StopPlayout();
+				rtc::CritScope lock(&_critSect);
+				_recordingStream.reset();
+				_playoutStream.reset();
+				_initialized = false;
+				return 0;
+			}
+
+			bool LowLatencyAudioDeviceModule::Initialized() const {
+				rtc::CritScope lock(&_critSect);
+				return _initialized;
+			}
+
+			int16_t LowLatencyAudioDeviceModule::PlayoutDevices() {
+				return (int16_t)FindAudioDevices(false).size();
+			}
+
+			int16_t LowLatencyAudioDeviceModule::RecordingDevices() {
+				return (int16_t)FindAudioDevices(true).size();
+			}
+
+			int32_t LowLatencyAudioDeviceModule::PlayoutDeviceName(uint16_t index,
+				char name[webrtc::kAdmMaxDeviceNameSize],
+				char guid[webrtc::kAdmMaxGuidSize]) {
+				auto devices = FindAudioDevices(false);
+				if (index >= devices.size()) {
+					return -1;
+				}
+				strncpy_s(name, webrtc::kAdmMaxDeviceNameSize,
+					devices[index].second.c_str(), _TRUNCATE);
+				if (guid != nullptr) {
+					strncpy_s(guid, webrtc::kAdmMaxGuidSize,
+						devices[index].first.c_str(), _TRUNCATE);
+				}
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::RecordingDeviceName(uint16_t index,
+				char name[webrtc::kAdmMaxDeviceNameSize],
+				char guid[webrtc::kAdmMaxGuidSize]) {
+				auto devices = FindAudioDevices(true);
+				if (index >= devices.size()) {
+					return -1;
+				}
+				strncpy_s(name, webrtc::kAdmMaxDeviceNameSize,
+					devices[index].second.c_str(), _TRUNCATE);
+				if (guid != nullptr) {
+					strncpy_s(guid, webrtc::kAdmMaxGuidSize,
+						devices[index].first.c_str(), _TRUNCATE);
+				}
+				return 0;
+			}
+
+			std::string LowLatencyAudioDeviceModule::DeviceIdAt(bool capture,
+				uint16_t index) {
+				auto devices = FindAudioDevices(capture);
+				return index < devices.size() ? devices[index].first : std::string();
+			}
+
+			int32_t LowLatencyAudioDeviceModule::SetPlayoutDevice(uint16_t index) {
+				SetPlayoutDeviceId(DeviceIdAt(false, index));
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::SetPlayoutDevice(
+				WindowsDeviceType device) {
+				// The voice engine asks for the default device when it
+				// starts, the device the app selected stays.
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::SetRecordingDevice(uint16_t index) {
+				SetRecordingDeviceId(DeviceIdAt(true, index));
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::SetRecordingDevice(
+				WindowsDeviceType device) {
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::PlayoutIsAvailable(bool* available) {
+				*available = true;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::InitPlayout() {
+				rtc::CritScope lock(&_critSect);
+				if (_playing) {
+					return -1;
+				}
+				if (_playoutStream != nullptr && _playoutStream->IsOpen()) {
+					return 0;
+				}
+				_playoutStream.reset(new AudioClientStream(false, _stereoPlayout ? 2 : 1));
+				HRESULT hr = _playoutStream->Open(
+					rtc::ToUtf16(_playoutDeviceId), _periodFrames);
+				if (FAILED(hr)) {
+					LOG(LS_ERROR) << "Can't open the audio playout device: " << hr;
+					_playoutStream.reset();
+					return -1;
+				}
+				return 0;
+			}
+
+			bool LowLatencyAudioDeviceModule::PlayoutIsInitialized() const {
+				rtc::CritScope lock(&_critSect);
+				return _playoutStream != nullptr && _playoutStream->IsOpen();
+			}
+
+			int32_t LowLatencyAudioDeviceModule::RecordingIsAvailable(bool* available) {
+				*available = true;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::InitRecording() {
+				rtc::CritScope lock(&_critSect);
+				if (_recording) {
+					return -1;
+				}
+				if (_recordingStream != nullptr && _recordingStream->IsOpen()) {
+					return 0;
+				}
+				_recordingStream.reset(new AudioClientStream(true, 1));
+				HRESULT hr = _recordingStream->Open(
+					rtc::ToUtf16(_recordingDeviceId), _periodFrames);
+				if (FAILED(hr)) {
+					LOG(LS_ERROR) << "Can't open the audio recording device: " << hr;
+					_recordingStream.reset();
+					return -1;
+				}
+				return 0;
+			}
+
+			bool LowLatencyAudioDeviceModule::RecordingIsInitialized() const {
+				rtc::CritScope lock(&_critSect);
+				return _recordingStream != nullptr && _recordingStream->IsOpen();
+			}
+
+			int32_t LowLatencyAudioDeviceModule::StartPlayout() {
+				rtc::CritScope lock(&_critSect);
+				if (_playing) {
+					return 0;
+				}
+				if (_playoutStream == nullptr || !_playoutStream->IsOpen()) {
+					return -1;
+				}
+				int channels = _playoutStream->Channels();
+				_playoutChunk.resize(_playoutStream->SampleRate() / kChunksPerSecond * channels);
+				_playoutFifo.clear();
+				_playoutFifoStart = 0;
+				HRESULT hr = _playoutStream->Start([this](int16_t* data, size_t frames) {
+					OnRender(data, frames);
+				});
+				if (FAILED(hr)) {
+					LOG(LS_ERROR) << "Can't start the audio playout: " << hr;
+					return -1;
+				}
+				_playoutDelayMs = _playoutStream->LatencyMs();
+				_playing = true;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::StopPlayout() {
+				rtc::CritScope lock(&_critSect);
+				if (_playoutStream != nullptr) {
+					_playoutStream->Close();
+				}
+				_playoutDelayMs = 0;
+				_playing = false;
+				return 0;
+			}
+
+			bool LowLatencyAudioDeviceModule::Playing() const {
+				rtc::CritScope lock(&_critSect);
+				return _playing;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::StartRecording() {
+				rtc::CritScope lock(&_critSect);
+				if (_recording) {
+					return 0;
+				}
+				if (_recordingStream == nullptr || !_recordingStream->IsOpen()) {
+					return -1;
+				}
+				_recordedChunk.resize(_recordingStream->SampleRate() / kChunksPerSecond *
+					_recordingStream->Channels());
+				_recordedFrames = 0;
+				HRESULT hr = _recordingStream->Start([this](int16_t* data, size_t frames) {
+					OnCaptured(data, frames);
+				});
+				if (FAILED(hr)) {
+					LOG(LS_ERROR) << "Can't start the audio recording: " << hr;
+					return -1;
+				}
+				_recording = true;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::StopRecording() {
+				rtc::CritScope lock(&_critSect);
+				if (_recordingStream != nullptr) {
+					_recordingStream->Close();
+				}
+				_recording = false;
+				return 0;
+			}
+
+			bool LowLatencyAudioDeviceModule::Recording() const {
+				rtc::CritScope lock(&_critSect);
+				return _recording;
+			}
+
+			void LowLatencyAudioDeviceModule::OnCaptured(int16_t* data, size_t frames) {
+				// The streams are only replaced with the thread stopped.
+				AudioClientStream* stream = _recordingStream.get();
+				int channels = stream->Channels();
+				size_t chunkFrames = _recordedChunk.size() / channels;
+				uint32_t delayMs = stream->LatencyMs() + _playoutDelayMs;
+				while (frames > 0) {
+					size_t copied = std::min(frames, chunkFrames - _recordedFrames);
+					std::copy(data, data + copied * channels,
+						&_recordedChunk[_recordedFrames * channels]);
+					data += copied * channels;
+					frames -= copied;
+					_recordedFrames += copied;
+					if (_recordedFrames < chunkFrames) {
+						break;
+					}
+					_recordedFrames = 0;
+					if (_microphoneMute) {
+						std::fill(_recordedChunk.begin(), _recordedChunk.end(), 0);
+					}
+					rtc::CritScope lock(&_transportCritSect);
+					if (_audioTransport != nullptr) {
+						uint32_t newMicLevel = 0;
+						_audioTransport->RecordedDataIsAvailable(_recordedChunk.data(),
+							chunkFrames, sizeof(int16_t) * channels, channels,
+							stream->SampleRate(), delayMs, 0, 0, false, newMicLevel);
+					}
+				}
+			}
+
+			void LowLatencyAudioDeviceModule::OnRender(int16_t* data, size_t frames) {
+				AudioClientStream* stream = _playoutStream.get();
+				int channels = stream->Channels();
+				size_t chunkFrames = _playoutChunk.size() / channels;
+				size_t needed = frames * channels;
+				while (_playoutFifo.size() - _playoutFifoStart < needed) {
+					size_t samplesOut = 0;
+					{
+						rtc::CritScope lock(&_transportCritSect);
+						if (_audioTransport != nullptr) {
+							int64_t elapsedTimeMs = 0;
+							int64_t ntpTimeMs = 0;
+							_audioTransport->NeedMorePlayData(chunkFrames,
+								sizeof(int16_t) * channels, channels, stream->SampleRate(),
+								_playoutChunk.data(), samplesOut, &elapsedTimeMs, &ntpTimeMs);
+						}
+					}
+					if (samplesOut < chunkFrames) {
+						std::fill(_playoutChunk.begin() + samplesOut * channels,
+							_playoutChunk.end(), 0);
+					}
+					_playoutFifo.insert(_playoutFifo.end(), _playoutChunk.begin(),
+						_playoutChunk.end());
+				}
+				std::copy(_playoutFifo.begin() + _playoutFifoStart,
+					_playoutFifo.begin() + _playoutFifoStart + needed, data);
+				_playoutFifoStart += needed;
+				// Less than 10ms stay, moved to the front once consumed.
+				if (_playoutFifoStart >= _playoutChunk.size()) {
+					_playoutFifo.erase(_playoutFifo.begin(),
+						_playoutFifo.begin() + _playoutFifoStart);
+					_playoutFifoStart = 0;
+				}
+			}
+
+			int32_t LowLatencyAudioDeviceModule::SetAGC(bool enable) {
+				return enable ? -1 : 0;
+			}
+
+			bool LowLatencyAudioDeviceModule::AGC() const {
+				return false;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::InitSpeaker() {
+				return 0;
+			}
+
+			bool LowLatencyAudioDeviceModule::SpeakerIsInitialized() const {
+				return true;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::InitMicrophone() {
+				return 0;
+			}
+
+			bool LowLatencyAudioDeviceModule::MicrophoneIsInitialized() const {
+				return true;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::SpeakerVolumeIsAvailable(bool* available) {
+				rtc::CritScope lock(&_critSect);
+				*available = _playoutStream != nullptr && _playoutStream->Volume() != nullptr;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::SetSpeakerVolume(uint32_t volume) {
+				rtc::CritScope lock(&_critSect);
+				if (_playoutStream == nullptr || _playoutStream->Volume() == nullptr) {
+					return -1;
+				}
+				float level = (float)std::min(volume, kMaxVolume) / kMaxVolume;
+				return SUCCEEDED(_playoutStream->Volume()->SetMasterVolume(
+					level, nullptr)) ? 0 : -1;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::SpeakerVolume(uint32_t* volume) const {
+				rtc::CritScope lock(&_critSect);
+				float level = 0;
+				if (_playoutStream == nullptr || _playoutStream->Volume() == nullptr ||
+					FAILED(_playoutStream->Volume()->GetMasterVolume(&level))) {
+					return -1;
+				}
+				*volume = (uint32_t)(level * kMaxVolume + 0.5f);
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::MaxSpeakerVolume(uint32_t* maxVolume) const {
+				*maxVolume = kMaxVolume;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::MinSpeakerVolume(uint32_t* minVolume) const {
+				*minVolume = 0;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::MicrophoneVolumeIsAvailable(bool* available) {
+				*available = false;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::SetMicrophoneVolume(uint32_t volume) {
+				return -1;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::MicrophoneVolume(uint32_t* volume) const {
+				return -1;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::MaxMicrophoneVolume(uint32_t* maxVolume) const {
+				*maxVolume = kMaxVolume;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::MinMicrophoneVolume(uint32_t* minVolume) const {
+				*minVolume = 0;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::SpeakerMuteIsAvailable(bool* available) {
+				rtc::CritScope lock(&_critSect);
+				*available = _playoutStream != nullptr && _playoutStream->Volume() != nullptr;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::SetSpeakerMute(bool enable) {
+				rtc::CritScope lock(&_critSect);
+				if (_playoutStream == nullptr || _playoutStream->Volume() == nullptr) {
+					return -1;
+				}
+				return SUCCEEDED(_playoutStream->Volume()->SetMute(
+					enable, nullptr)) ? 0 : -1;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::SpeakerMute(bool* enabled) const {
+				rtc::CritScope lock(&_critSect);
+				BOOL mute = FALSE;
+				if (_playoutStream == nullptr || _playoutStream->Volume() == nullptr ||
+					FAILED(_playoutStream->Volume()->GetMute(&mute))) {
+					return -1;
+				}
+				*enabled = mute != FALSE;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::MicrophoneMuteIsAvailable(bool* available) {
+				*available = true;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::SetMicrophoneMute(bool enable) {
+				// Read on the capture thread, a stale value only mutes a
+				// chunk late.
+				_microphoneMute = enable;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::MicrophoneMute(bool* enabled) const {
+				*enabled = _microphoneMute;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::StereoPlayoutIsAvailable(
+				bool* available) const {
+				*available = true;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::SetStereoPlayout(bool enable) {
+				rtc::CritScope lock(&_critSect);
+				if (_playoutStream != nullptr && _playoutStream->IsOpen() &&
+					enable != _stereoPlayout) {
+					return -1;
+				}
+				_stereoPlayout = enable;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::StereoPlayout(bool* enabled) const {
+				rtc::CritScope lock(&_critSect);
+				*enabled = _stereoPlayout;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::StereoRecordingIsAvailable(
+				bool* available) const {
+				*available = false;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::SetStereoRecording(bool enable) {
+				return enable ? -1 : 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::StereoRecording(bool* enabled) const {
+				*enabled = false;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::PlayoutDelay(uint16_t* delayMS) const {
+				rtc::CritScope lock(&_critSect);
+				*delayMS = _playoutStream != nullptr ?
+					(uint16_t)_playoutStream->LatencyMs() : 0;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::RecordingDelay(uint16_t* delayMS) const {
+				rtc::CritScope lock(&_critSect);
+				*delayMS = _recordingStream != nullptr ?
+					(uint16_t)_recordingStream->LatencyMs() : 0;
+				return 0;
+			}
+
+			bool LowLatencyAudioDeviceModule::BuiltInAECIsAvailable() const {
+				return false;
+			}
+
+			bool LowLatencyAudioDeviceModule::BuiltInAGCIsAvailable() const {
+				return false;
+			}
+
+			bool LowLatencyAudioDeviceModule::BuiltInNSIsAvailable() const {
+				return false;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::EnableBuiltInAEC(bool enable) {
+				return -1;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::EnableBuiltInAGC(bool enable) {
+				return -1;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::EnableBuiltInNS(bool enable) {
+				return -1;
+			}
+
+			int64_t LowLatencyAudioDeviceModule::TimeUntilNextProcess() {
+				return 1000;
+			}
+
+			void LowLatencyAudioDeviceModule::Process() {
+			}
+
+			int32_t LowLatencyAudioDeviceModule::SetWaveOutVolume(uint16_t volumeLeft,
+				uint16_t volumeRight) {
+				return -1;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::WaveOutVolume(uint16_t* volumeLeft,
+				uint16_t* volumeRight) const {
+				return -1;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::SpeakerVolumeStepSize(
+				uint16_t* stepSize) const {
+				*stepSize = 1;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::MicrophoneVolumeStepSize(
+				uint16_t* stepSize) const {
+				*stepSize = 1;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::MicrophoneBoostIsAvailable(bool* available) {
+				*available = false;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::SetMicrophoneBoost(bool enable) {
+				return enable ? -1 : 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::MicrophoneBoost(bool* enabled) const {
+				*enabled = false;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::SetRecordingChannel(
+				const ChannelType channel) {
+				return channel == kChannelBoth ? 0 : -1;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::RecordingChannel(
+				ChannelType* channel) const {
+				*channel = kChannelBoth;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::SetPlayoutBuffer(const BufferType type,
+				uint16_t sizeMS) {
+				return -1;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::PlayoutBuffer(BufferType* type,
+				uint16_t* sizeMS) const {
+				*type = kAdaptiveBufferSize;
+				return PlayoutDelay(sizeMS);
+			}
+
+			int32_t LowLatencyAudioDeviceModule::CPULoad(uint16_t* load) const {
+				*load = 0;
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::StartRawOutputFileRecording(
+				const char pcmFileNameUTF8[webrtc::kAdmMaxFileNameSize]) {
+				return -1;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::StopRawOutputFileRecording() {
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::StartRawInputFileRecording(
+				const char pcmFileNameUTF8[webrtc::kAdmMaxFileNameSize]) {
+				return -1;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::StopRawInputFileRecording() {
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::SetRecordingSampleRate(
+				const uint32_t samplesPerSec) {
+				return -1;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::RecordingSampleRate(
+				uint32_t* samplesPerSec) const {
+				rtc::CritScope lock(&_critSect);
+				if (_recordingStream == nullptr || !_recordingStream->IsOpen()) {
+					return -1;
+				}
+				*samplesPerSec = _recordingStream->SampleRate();
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::SetPlayoutSampleRate(
+				const uint32_t samplesPerSec) {
+				return -1;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::PlayoutSampleRate(
+				uint32_t* samplesPerSec) const {
+				rtc::CritScope lock(&_critSect);
+				if (_playoutStream == nullptr || !_playoutStream->IsOpen()) {
+					return -1;
+				}
+				*samplesPerSec = _playoutStream->SampleRate();
+				return 0;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::ResetAudioDevice() {
+				return -1;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::SetLoudspeakerStatus(bool enable) {
+				return -1;
+			}
+
+			int32_t LowLatencyAudioDeviceModule::GetLoudspeakerStatus(bool* enabled) const {
+				return -1;
+			}
+		}
+	}
+}  // namespace Org.WebRtc
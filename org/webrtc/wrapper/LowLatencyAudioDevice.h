@@ -0,0 +1,253 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#ifndef ORG_WEBRTC_LOWLATENCYAUDIODEVICE_H_
+#define ORG_WEBRTC_LOWLATENCYAUDIODEVICE_H_
+
+#include <wrl.h>
+#include <Audioclient.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "webrtc/modules/audio_device/include/audio_device.h"
+#include "webrtc/rtc_base/criticalsection.h"
+
+using Microsoft::WRL::ComPtr;
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			// One shared mode WASAPI stream, capture or render, driven by
+			// the audio engine events on a thread of its own.  Uses the
+			// smallest engine period of IAudioClient3 when available, the
+			// default 10ms period of IAudioClient otherwise.
+			class AudioClientStream {
+			public:
+				// Called on the stream thread with the frames captured or
+				// to render, 16 bit interleaved with |channels| channels.
+				typedef std::function<void(int16_t* data, size_t frames)> Callback;
+
+				AudioClientStream(bool capture, int channels);
+				~AudioClientStream();
+
+				// Opens |deviceId|, the default communication device if
+				// empty.  |periodFrames| 0 asks for the smallest period.
+				HRESULT Open(const std::wstring& deviceId, uint32_t periodFrames);
+				HRESULT Start(Callback callback);
+				void Stop();
+				void Close();
+
+				bool IsOpen() const { return _audioClient != nullptr; }
+				int SampleRate() const { return _sampleRate; }
+				int Channels() const { return _channels; }
+				// Engine period and stream latency.
+				int LatencyMs() const { return _latencyMs; }
+				ISimpleAudioVolume* Volume() const { return _volume.Get(); }
+
+			private:
+				void Run();
+				void Capture();
+				void Render();
+				// Converts between the mix format and 16 bit samples of
+				// |_channels| channels.
+				void FromMixFormat(const BYTE* data, size_t frames);
+				void ToMixFormat(BYTE* data, size_t frames);
+
+				const bool _capture;
+				const int _channels;
+				ComPtr<IAudioClient> _audioClient;
+				ComPtr<IAudioCaptureClient> _captureClient;
+				ComPtr<IAudioRenderClient> _renderClient;
+				ComPtr<ISimpleAudioVolume> _volume;
+				HANDLE _event;
+				int _sampleRate;
+				int _mixChannels;
+				bool _mixFloat;
+				UINT32 _bufferFrames;
+				int _latencyMs;
+				std::vector<int16_t> _samples;
+				Callback _callback;
+				std::atomic<bool> _running;
+				std::thread _thread;
+			};
+
+			// AudioDeviceModule on WASAPI low latency shared mode streams.
+			// Created once by WebRTC::Initialize and used by every peer
+			// connection of the first shard.  WebRTC works on 10ms of
+			// audio, the streams use smaller periods: captured audio is
+			// delivered as soon as 10ms are collected and rendered audio
+			// is requested 10ms at a time when the device needs more.
+			// Devices are selected by the ids the device manager
+			// enumerates.
+			class LowLatencyAudioDeviceModule : public webrtc::AudioDeviceModule {
+			public:
+				explicit LowLatencyAudioDeviceModule(uint32_t periodFrames);
+
+				// Empty selects the default communication device.  Applies
+				// at once to a running stream.  Called on the worker thread
+				// of the voice engine, like the other methods.
+				void SetRecordingDeviceId(const std::string& id);
+				void SetPlayoutDeviceId(const std::string& id);
+
+				// AudioDeviceModule
+				int32_t ActiveAudioLayer(AudioLayer* audioLayer) const override;
+				ErrorCode LastError() const override;
+				int32_t RegisterEventObserver(webrtc::AudioDeviceObserver* eventCallback) override;
+				int32_t RegisterAudioCallback(webrtc::AudioTransport* audioCallback) override;
+
+				int32_t Init() override;
+				int32_t Terminate() override;
+				bool Initialized() const override;
+
+				int16_t PlayoutDevices() override;
+				int16_t RecordingDevices() override;
+				int32_t PlayoutDeviceName(uint16_t index,
+					char name[webrtc::kAdmMaxDeviceNameSize],
+					char guid[webrtc::kAdmMaxGuidSize]) override;
+				int32_t RecordingDeviceName(uint16_t index,
+					char name[webrtc::kAdmMaxDeviceNameSize],
+					char guid[webrtc::kAdmMaxGuidSize]) override;
+
+				int32_t SetPlayoutDevice(uint16_t index) override;
+				int32_t SetPlayoutDevice(WindowsDeviceType device) override;
+				int32_t SetRecordingDevice(uint16_t index) override;
+				int32_t SetRecordingDevice(WindowsDeviceType device) override;
+
+				int32_t PlayoutIsAvailable(bool* available) override;
+				int32_t InitPlayout() override;
+				bool PlayoutIsInitialized() const override;
+				int32_t RecordingIsAvailable(bool* available) override;
+				int32_t InitRecording() override;
+				bool RecordingIsInitialized() const override;
+
+				int32_t StartPlayout() override;
+				int32_t StopPlayout() override;
+				bool Playing() const override;
+				int32_t StartRecording() override;
+				int32_t StopRecording() override;
+				bool Recording() const override;
+
+				int32_t SetAGC(bool enable) override;
+				bool AGC() const override;
+
+				int32_t InitSpeaker() override;
+				bool SpeakerIsInitialized() const override;
+				int32_t InitMicrophone() override;
+				bool MicrophoneIsInitialized() const override;
+
+				int32_t SpeakerVolumeIsAvailable(bool* available) override;
+				int32_t SetSpeakerVolume(uint32_t volume) override;
+				int32_t SpeakerVolume(uint32_t* volume) const override;
+				int32_t MaxSpeakerVolume(uint32_t* maxVolume) const override;
+				int32_t MinSpeakerVolume(uint32_t* minVolume) const override;
+
+				int32_t MicrophoneVolumeIsAvailable(bool* available) override;
+				int32_t SetMicrophoneVolume(uint32_t volume) override;
+				int32_t MicrophoneVolume(uint32_t* volume) const override;
+				int32_t MaxMicrophoneVolume(uint32_t* maxVolume) const override;
+				int32_t MinMicrophoneVolume(uint32_t* minVolume) const override;
+
+				int32_t SpeakerMuteIsAvailable(bool* available) override;
+				int32_t SetSpeakerMute(bool enable) override;
+				int32_t SpeakerMute(bool* enabled) const override;
+				int32_t MicrophoneMuteIsAvailable(bool* available) override;
+				int32_t SetMicrophoneMute(bool enable) override;
+				int32_t MicrophoneMute(bool* enabled) const override;
+
+				int32_t StereoPlayoutIsAvailable(bool* available) const override;
+				int32_t SetStereoPlayout(bool enable) override;
+				int32_t StereoPlayout(bool* enabled) const override;
+				int32_t StereoRecordingIsAvailable(bool* available) const override;
+				int32_t SetStereoRecording(bool enable) override;
+				int32_t StereoRecording(bool* enabled) const override;
+
+				int32_t PlayoutDelay(uint16_t* delayMS) const override;
+				int32_t RecordingDelay(uint16_t* delayMS) const override;
+
+				bool BuiltInAECIsAvailable() const override;
+				bool BuiltInAGCIsAvailable() const override;
+				bool BuiltInNSIsAvailable() const override;
+				int32_t EnableBuiltInAEC(bool enable) override;
+				int32_t EnableBuiltInAGC(bool enable) override;
+				int32_t EnableBuiltInNS(bool enable) override;
+
+				// Declared by older versions of AudioDeviceModule and of
+				// Module, not overrides with the newer ones.
+				int64_t TimeUntilNextProcess();
+				void Process();
+				int32_t SetWaveOutVolume(uint16_t volumeLeft, uint16_t volumeRight);
+				int32_t WaveOutVolume(uint16_t* volumeLeft, uint16_t* volumeRight) const;
+				int32_t SpeakerVolumeStepSize(uint16_t* stepSize) const;
+				int32_t MicrophoneVolumeStepSize(uint16_t* stepSize) const;
+				int32_t MicrophoneBoostIsAvailable(bool* available);
+				int32_t SetMicrophoneBoost(bool enable);
+				int32_t MicrophoneBoost(bool* enabled) const;
+				int32_t SetRecordingChannel(const ChannelType channel);
+				int32_t RecordingChannel(ChannelType* channel) const;
+				int32_t SetPlayoutBuffer(const BufferType type, uint16_t sizeMS);
+				int32_t PlayoutBuffer(BufferType* type, uint16_t* sizeMS) const;
+				int32_t CPULoad(uint16_t* load) const;
+				int32_t StartRawOutputFileRecording(
+					const char pcmFileNameUTF8[webrtc::kAdmMaxFileNameSize]);
+				int32_t StopRawOutputFileRecording();
+				int32_t StartRawInputFileRecording(
+					const char pcmFileNameUTF8[webrtc::kAdmMaxFileNameSize]);
+				int32_t StopRawInputFileRecording();
+				int32_t SetRecordingSampleRate(const uint32_t samplesPerSec);
+				int32_t RecordingSampleRate(uint32_t* samplesPerSec) const;
+				int32_t SetPlayoutSampleRate(const uint32_t samplesPerSec);
+				int32_t PlayoutSampleRate(uint32_t* samplesPerSec) const;
+				int32_t ResetAudioDevice();
+				int32_t SetLoudspeakerStatus(bool enable);
+				int32_t GetLoudspeakerStatus(bool* enabled) const;
+
+			protected:
+				virtual ~LowLatencyAudioDeviceModule();
+
+			private:
+				void OnCaptured(int16_t* data, size_t frames);
+				void OnRender(int16_t* data, size_t frames);
+				// Id of the device |index| of the enumeration, empty for
+				// the default one.
+				std::string DeviceIdAt(bool capture, uint16_t index);
+
+				const uint32_t _periodFrames;
+				mutable rtc::CriticalSection _critSect;
+				bool _initialized;
+				std::string _recordingDeviceId;
+				std::string _playoutDeviceId;
+				std::unique_ptr<AudioClientStream> _recordingStream;
+				std::unique_ptr<AudioClientStream> _playoutStream;
+				bool _recording;
+				bool _playing;
+				bool _stereoPlayout;
+				// Read by the capture thread.
+				std::atomic<bool> _microphoneMute;
+				std::atomic<int> _playoutDelayMs;
+
+				// Guards the transport, taken by the stream threads.
+				rtc::CriticalSection _transportCritSect;
+				webrtc::AudioTransport* _audioTransport;
+
+				// Only used on the capture thread.
+				std::vector<int16_t> _recordedChunk;
+				size_t _recordedFrames;
+				// Only used on the render thread.
+				std::vector<int16_t> _playoutFifo;
+				size_t _playoutFifoStart;
+				std::vector<int16_t> _playoutChunk;
+			};
+		}
+	}
+}  // namespace Org.WebRtc
+
+#endif  // ORG_WEBRTC_LOWLATENCYAUDIODEVICE_H_
@@ -10,10 +10,15 @@
 // be found in the AUTHORS file in the root of the source tree.
 
 #include "Marshalling.h"
+#include <string.h>
+#include <algorithm>
 #include <map>
+#include <unordered_map>
 
 #include "webrtc/p2p/base/candidate.h"
 #include "webrtc/api/webrtcsdp.h"
+#include "webrtc/rtc_base/criticalsection.h"
+#include "webrtc/rtc_base/win32.h"
 #include "RTCStatsReport.h"
 
 using Org::WebRtc::RTCBundlePolicy;
@@ -396,22 +401,112 @@ namespace Org {
 			DEFINE_MARSHALLED_ENUM_END(StatsValueName)
 
 			std::string FromCx(String^ inObj) {
-				return rtc::ToUtf8(inObj->Data());
+				std::string ret;
+				FromCx(inObj, &ret);
+				return ret;
+			}
+
+			void FromCx(String^ inObj, std::string* outObj) {
+				const wchar_t* data = inObj->Data();
+				unsigned int length = inObj->Length();
+				outObj->resize(length);
+				unsigned int index = 0;
+				for (; index < length && data[index] < 0x80; ++index) {
+					(*outObj)[index] = (char)data[index];
+				}
+				if (index == length) {
+					return;
+				}
+				// Up to 3 bytes per UTF-16 unit, a surrogate pair takes 4 for 2.
+				int maxLength = (int)(length - index) * 3;
+				outObj->resize(index + maxLength);
+				int converted = ::WideCharToMultiByte(CP_UTF8, 0, data + index,
+					(int)(length - index), &(*outObj)[index], maxLength, nullptr, nullptr);
+				outObj->resize(index + std::max(converted, 0));
 			}
 
 			String^ ToCx(std::string const& inObj) {
-				return ref new String(rtc::ToUtf16(inObj).c_str());
+				return ToCx(inObj.data(), inObj.size());
+			}
+
+			String^ ToCx(const char* data, size_t length) {
+				// Most strings fit, only the SDP and the large messages are
+				// converted in an allocated buffer.
+				const size_t kStackLength = 512;
+				wchar_t stackBuffer[kStackLength];
+				std::vector<wchar_t> heapBuffer;
+				wchar_t* buffer = stackBuffer;
+				if (length > kStackLength) {
+					heapBuffer.resize(length);
+					buffer = heapBuffer.data();
+				}
+				size_t index = 0;
+				for (; index < length && (uint8_t)data[index] < 0x80; ++index) {
+					buffer[index] = data[index];
+				}
+				size_t outLength = index;
+				if (index < length) {
+					// Never more UTF-16 units than UTF-8 bytes.
+					int converted = ::MultiByteToWideChar(CP_UTF8, 0, data + index,
+						(int)(length - index), buffer + index, (int)(length - index));
+					outLength += std::max(converted, 0);
+				}
+				return ref new String(buffer, (unsigned int)outLength);
+			}
+
+			namespace {
+				const size_t kMaxInternedStrings = 1024;
+
+				rtc::CriticalSection gInternedCritSect;
+				// Never destroyed, the strings would be released after the
+				// runtime is gone at exit.
+				std::unordered_map<std::string, String^>& InternedStrings() {
+					static auto strings = new std::unordered_map<std::string, String^>();
+					return *strings;
+				}
+				std::unordered_map<const char*, String^>& InternedLiterals() {
+					static auto literals = new std::unordered_map<const char*, String^>();
+					return *literals;
+				}
+			}
+
+			String^ ToCxInterned(std::string const& inObj) {
+				rtc::CritScope lock(&gInternedCritSect);
+				auto& strings = InternedStrings();
+				auto it = strings.find(inObj);
+				if (it != strings.end()) {
+					return it->second;
+				}
+				String^ ret = ToCx(inObj);
+				if (strings.size() < kMaxInternedStrings) {
+					strings.emplace(inObj, ret);
+				}
+				return ret;
+			}
+
+			String^ ToCxInterned(const char* inObj) {
+				rtc::CritScope lock(&gInternedCritSect);
+				auto& literals = InternedLiterals();
+				auto it = literals.find(inObj);
+				if (it != literals.end()) {
+					return it->second;
+				}
+				String^ ret = ToCx(inObj, strlen(inObj));
+				if (literals.size() < kMaxInternedStrings) {
+					literals.emplace(inObj, ret);
+				}
+				return ret;
 			}
 
 			void FromCx(
 									RTCIceServer^ inObj,
 									webrtc::PeerConnectionInterface::IceServer* outObj) {
 				if (inObj->Url != nullptr)
-					outObj->uri = rtc::ToUtf8(inObj->Url->Data());
+					FromCx(inObj->Url, &outObj->uri);
 				if (inObj->Username != nullptr)
-					outObj->username = rtc::ToUtf8(inObj->Username->Data());
+					FromCx(inObj->Username, &outObj->username);
 				if (inObj->Credential != nullptr)
-					outObj->password = rtc::ToUtf8(inObj->Credential->Data());
+					FromCx(inObj->Credential, &outObj->password);
 			}
 
 			void FromCx(
@@ -441,6 +536,33 @@ namespace Org {
 				if (inObj->IceServers != nullptr) {
 					FromCx(inObj->IceServers, &outObj->servers);
 				}
+
+				// The ignored network types and the port range are
+				// applied by RTCPeerConnection, on a port allocator of its
+				// own.
+				if (inObj->IceCandidatePoolSize != nullptr) {
+					outObj->ice_candidate_pool_size =
+						std::max(inObj->IceCandidatePoolSize->Value, 0);
+				}
+				if (inObj->ContinualGathering != nullptr &&
+					inObj->ContinualGathering->Value) {
+					outObj->continual_gathering_policy =
+						webrtc::PeerConnectionInterface::GATHER_CONTINUALLY;
+				}
+				if (inObj->IceCheckMinIntervalMs != nullptr) {
+					outObj->ice_check_min_interval =
+						rtc::Optional<int>(inObj->IceCheckMinIntervalMs->Value);
+				}
+				if (inObj->DisableTcpCandidates != nullptr &&
+					inObj->DisableTcpCandidates->Value) {
+					outObj->tcp_candidate_policy =
+						webrtc::PeerConnectionInterface::kTcpCandidatePolicyDisabled;
+				}
+				if (inObj->LowCostNetworksOnly != nullptr &&
+					inObj->LowCostNetworksOnly->Value) {
+					outObj->candidate_network_policy =
+						webrtc::PeerConnectionInterface::kCandidateNetworkPolicyLowCost;
+				}
 			}
 
 			void FromCx(
@@ -524,49 +646,35 @@ namespace Org {
 			void ToCx(
 							  const webrtc::StatsReport* inObj,
 							  Org::WebRtc::RTCStatsReport^* outObj) {
-				(*outObj) = ref new Org::WebRtc::RTCStatsReport();
+				(*outObj) = Org::WebRtc::RTCStatsReport::CreateFromNative(
+					inObj, nullptr);
+			}
 
-				if (inObj->id() != nullptr) {
-					(*outObj)->ReportId = ToCx(inObj->id()->ToString());
-				}
-				(*outObj)->Timestamp = inObj->timestamp();
-
-				Org::WebRtc::RTCStatsType type;
-				ToCx(inObj->id()->type(), &type);
-				(*outObj)->StatsType = type;
-
-				for (auto value : inObj->values()) {
-					Org::WebRtc::RTCStatsValueName stat_name;
-					ToCx(value.first, &stat_name);
-					Platform::Object^ val = nullptr;
-					switch (value.second->type()) {
-						case webrtc::StatsReport::Value::kInt:
-							val = value.second->int_val();
-							break;
-						case webrtc::StatsReport::Value::kInt64:
-							val = value.second->int64_val();
-							break;
-						case webrtc::StatsReport::Value::kFloat:
-							val = value.second->float_val();
-							break;
-						case webrtc::StatsReport::Value::kBool:
-							val = value.second->bool_val();
-							break;
-						case webrtc::StatsReport::Value::kStaticString: {
-							val = ToCx(value.second->static_string_val());
-							}
-							break;
-						case webrtc::StatsReport::Value::kString: {
-							val = ToCx(value.second->string_val().c_str());
-							}
-							break;
-						default:
-							break;
-					}
-
-					if (val != nullptr) {
-						(*outObj)->Values->Insert(stat_name, val);
-					}
+			void ToCx(
+				const webrtc::StatsReport::Value* inObj,
+				Platform::Object^* outObj) {
+				(*outObj) = nullptr;
+				switch (inObj->type()) {
+					case webrtc::StatsReport::Value::kInt:
+						(*outObj) = inObj->int_val();
+						break;
+					case webrtc::StatsReport::Value::kInt64:
+						(*outObj) = inObj->int64_val();
+						break;
+					case webrtc::StatsReport::Value::kFloat:
+						(*outObj) = inObj->float_val();
+						break;
+					case webrtc::StatsReport::Value::kBool:
+						(*outObj) = inObj->bool_val();
+						break;
+					case webrtc::StatsReport::Value::kStaticString:
+						(*outObj) = ToCxInterned(inObj->static_string_val());
+						break;
+					case webrtc::StatsReport::Value::kString:
+						(*outObj) = ToCx(inObj->string_val());
+						break;
+					default:
+						break;
 				}
 			}
 		}
@@ -29,8 +29,23 @@ namespace Org {
 	namespace WebRtc {
 		namespace Internal {
 
+			// ASCII, the common case of SDP, candidates and ids, is copied
+			// without a transcode.  One allocation for the result.
 			std::string FromCx(String^ inObj);
+			// Into |outObj|, whose capacity is reused.
+			void FromCx(String^ inObj, std::string* outObj);
 			String^ ToCx(std::string const& inObj);
+			String^ ToCx(const char* data, size_t length);
+
+			// For the strings of a small set, such as the kind of a track or
+			// a candidate type: one String^ per distinct value is kept for
+			// the lifetime of the process and returned without converting
+			// anything.  Not for ids or SDP, the cache is bounded and the
+			// values past its size are converted each time.
+			String^ ToCxInterned(std::string const& inObj);
+			// |inObj| is a literal or lives as long as the process, it is
+			// looked up by address.
+			String^ ToCxInterned(const char* inObj);
 
 			DECLARE_MARSHALLED_ENUM(Org::WebRtc::RTCBundlePolicy,
 			webrtc::PeerConnectionInterface::BundlePolicy);
@@ -49,26 +64,36 @@ namespace Org {
 			DECLARE_MARSHALLED_ENUM(Org::WebRtc::RTCStatsValueName,
 			webrtc::StatsReport::StatsValueName);
 
+			// The elements are read in one GetMany() call instead of one
+			// call across the ABI each.
 			template <typename I, typename O>
 			void FromCx(
 				IVector<I>^ inArray,
 				std::vector<O>* outArray) {
-
-				outArray->resize(inArray->Size);
-				int index = 0;
-				for (I inObj : inArray) {
-					FromCx(inObj, &(*outArray)[index]);
-					index++;
+				auto items = ref new Platform::Array<I>(inArray->Size);
+				unsigned int size = items->Length > 0 ? inArray->GetMany(0, items) : 0;
+				outArray->resize(size);
+				for (unsigned int index = 0; index < size; ++index) {
+					FromCx(items[index], &(*outArray)[index]);
 				}
 			}
 
+			// Appended to |outArray|, in one ReplaceAll() call if it is empty.
 			template <typename I, typename O>
 			void ToCx(
 				std::vector<I>* inArray,
 				IVector<O>^ outArray) {
-				for (auto it = (*inArray).begin(); it != (*inArray).end(); ++it) {
+				auto items = ref new Platform::Array<O>((unsigned int)inArray->size());
+				for (unsigned int index = 0; index < items->Length; ++index) {
 					O outObj;
-					ToCx((*it), &outObj);
+					ToCx((*inArray)[index], &outObj);
+					items[index] = outObj;
+				}
+				if (outArray->Size == 0) {
+					outArray->ReplaceAll(items);
+					return;
+				}
+				for (O outObj : items) {
 					outArray->Append(outObj);
 				}
 			}
@@ -126,6 +151,10 @@ namespace Org {
 			void ToCx(
 				const webrtc::StatsReport* inObj,
 				Org::WebRtc::RTCStatsReport^* outObj);
+			// nullptr for the types that have no CX equivalent.
+			void ToCx(
+				const webrtc::StatsReport::Value* inObj,
+				Platform::Object^* outObj);
 		}
 	}
 }  // namespace Org.WebRtc.Internal
@@ -11,11 +11,23 @@
 #include <stdio.h>
 #include <ppltasks.h>
 #include <mfapi.h>
+#include <algorithm>
+#include <map>
+#include <tuple>
 #include <vector>
 #include <string>
 #include <set>
 #include "PeerConnectionInterface.h"
+#include "LowLatencyAudioDevice.h"
+#include "CustomVideoSource.h"
+#include "KeyFrameRequest.h"
+#include "LatencyProbe.h"
 #include "Marshalling.h"
+#include "MediaRecorder.h"
+#include "MediaSourceHelper.h"
+#include "ScreenCaptureSource.h"
+#include "VideoCompositor.h"
+#include "WrapperCache.h"
 #include "webrtc/rtc_base/logging.h"
 #include "webrtc/media/base/videosourceinterface.h"
 #include "webrtc/pc/channelmanager.h"
@@ -24,12 +36,16 @@
 #include "webrtc/modules/video_capture/windows/device_info_winuwp.h"
 #include "webrtc/modules/video_capture/windows/video_capture_winuwp.h"
 #include "webrtc/rtc_base/criticalsection.h"
+#include "webrtc/rtc_base/event.h"
 #include "webrtc/common_video/video_common_winuwp.h"
 #include "third_party/winuwp_h264/H264Decoder/H264Decoder.h"
+#include "third_party/winuwp_h264/Utils/AppSuspend.h"
+#include "third_party/winuwp_h264/Utils/PipelineTrace.h"
 
 using Platform::Collections::Vector;
 using Org::WebRtc::Internal::ToCx;
 using Org::WebRtc::Internal::FromCx;
+using Org::WebRtc::Internal::ToCxInterned;
 using Windows::Media::Capture::MediaStreamType;
 using Windows::Devices::Enumeration::DeviceClass;
 using Windows::Devices::Enumeration::DeviceInformation;
@@ -44,10 +60,44 @@ namespace {
   IVector<Org::WebRtc::MediaDevice^>^ g_videoDevices = ref new Vector<Org::WebRtc::MediaDevice^>();
 
   rtc::CriticalSection g_videoDevicesCritSect;
+
+  // Capabilities of the video capture devices by device id, filled the
+  // first time they are requested and dropped by the device watcher.
+  std::map<std::wstring, std::vector<Org::WebRtc::CaptureCapability^>>
+    g_videoCapabilities;
+  rtc::CriticalSection g_videoCapabilitiesCritSect;
+
+  void InvalidateVideoCapabilities(Platform::String^ deviceId) {
+    rtc::CritScope lock(&g_videoCapabilitiesCritSect);
+    g_videoCapabilities.erase(deviceId->Data());
+  }
+
+  Org::WebRtc::Internal::WrapperCache<Org::WebRtc::MediaStream,
+    webrtc::MediaStreamInterface> g_streamWrappers;
+  Org::WebRtc::Internal::WrapperCache<Org::WebRtc::MediaAudioTrack,
+    webrtc::AudioTrackInterface> g_audioTrackWrappers;
+  Org::WebRtc::Internal::WrapperCache<Org::WebRtc::MediaVideoTrack,
+    webrtc::VideoTrackInterface> g_videoTrackWrappers;
 }
 
 namespace Org {
 	namespace WebRtc {
+		namespace Internal {
+			MediaStream^ GetMediaStream(
+				rtc::scoped_refptr<webrtc::MediaStreamInterface> impl) {
+				return g_streamWrappers.Get(impl);
+			}
+
+			MediaAudioTrack^ GetMediaAudioTrack(
+				rtc::scoped_refptr<webrtc::AudioTrackInterface> impl) {
+				return g_audioTrackWrappers.Get(impl);
+			}
+
+			MediaVideoTrack^ GetMediaVideoTrack(
+				rtc::scoped_refptr<webrtc::VideoTrackInterface> impl) {
+				return g_videoTrackWrappers.Get(impl);
+			}
+		}
 
 		// = MediaVideoTrack =========================================================
 
@@ -64,7 +114,7 @@ namespace Org {
 			if (_impl == nullptr)
 				THROW_WEBRTC_NULL_REFERENCE_EXCEPTION("Invalid video track object");
 
-			return ToCx(_impl->kind());
+			return ToCxInterned(_impl->kind());
 		}
 
 		String^ MediaVideoTrack::Id::get() {
@@ -117,7 +167,7 @@ namespace Org {
 			if (_impl == nullptr)
 				THROW_WEBRTC_NULL_REFERENCE_EXCEPTION("Invalid audio track object");
 
-			return ToCx(_impl->kind());
+			return ToCxInterned(_impl->kind());
 		}
 
 		String^ MediaAudioTrack::Id::get() {
@@ -165,11 +215,13 @@ namespace Org {
 			if (_impl == nullptr)
 				return nullptr;
 
-			auto ret = ref new Vector<MediaAudioTrack^>();
-			for (auto track : _impl->GetAudioTracks()) {
-				ret->Append(ref new MediaAudioTrack(track));
+			webrtc::AudioTrackVector tracks = _impl->GetAudioTracks();
+			std::vector<MediaAudioTrack^> ret;
+			ret.reserve(tracks.size());
+			for (auto& track : tracks) {
+				ret.push_back(Internal::GetMediaAudioTrack(track));
 			}
-			return ret;
+			return ref new Vector<MediaAudioTrack^>(std::move(ret));
 		}
 
 		String^ MediaStream::Id::get() {
@@ -182,25 +234,30 @@ namespace Org {
 			if (_impl == nullptr)
 				return nullptr;
 
-			auto ret = ref new Vector<MediaVideoTrack^>();
-			for (auto track : _impl->GetVideoTracks()) {
-				ret->Append(ref new MediaVideoTrack(track));
+			webrtc::VideoTrackVector tracks = _impl->GetVideoTracks();
+			std::vector<MediaVideoTrack^> ret;
+			ret.reserve(tracks.size());
+			for (auto& track : tracks) {
+				ret.push_back(Internal::GetMediaVideoTrack(track));
 			}
-			return ret;
+			return ref new Vector<MediaVideoTrack^>(std::move(ret));
 		}
 
 		IVector<IMediaStreamTrack^>^ MediaStream::GetTracks() {
 			if (_impl == nullptr)
 				return nullptr;
 
-			auto ret = ref new Vector<IMediaStreamTrack^>();
-			for (auto track : _impl->GetAudioTracks()) {
-				ret->Append(ref new MediaAudioTrack(track));
+			webrtc::AudioTrackVector audioTracks = _impl->GetAudioTracks();
+			webrtc::VideoTrackVector videoTracks = _impl->GetVideoTracks();
+			std::vector<IMediaStreamTrack^> ret;
+			ret.reserve(audioTracks.size() + videoTracks.size());
+			for (auto& track : audioTracks) {
+				ret.push_back(Internal::GetMediaAudioTrack(track));
 			}
-			for (auto track : _impl->GetVideoTracks()) {
-				ret->Append(ref new MediaVideoTrack(track));
+			for (auto& track : videoTracks) {
+				ret.push_back(Internal::GetMediaVideoTrack(track));
 			}
-			return ret;
+			return ref new Vector<IMediaStreamTrack^>(std::move(ret));
 		}
 
 		IMediaStreamTrack^ MediaStream::GetTrackById(String^ trackId) {
@@ -211,13 +268,13 @@ namespace Org {
 			// Search the audio tracks.
 			auto audioTrack = _impl->FindAudioTrack(trackIdStr);
 			if (audioTrack != nullptr) {
-				ret = ref new MediaAudioTrack(audioTrack);
+				ret = Internal::GetMediaAudioTrack(audioTrack);
 			}
 			else {
 				// Search the video tracks.
 				auto videoTrack = _impl->FindVideoTrack(trackIdStr);
 				if (videoTrack != nullptr) {
-					ret = ref new MediaVideoTrack(videoTrack);
+					ret = Internal::GetMediaVideoTrack(videoTrack);
 				}
 			}
 			return ret;
@@ -285,8 +342,26 @@ namespace Org {
 		}
 
 		void RawVideoStream::RenderFrame(const webrtc::VideoFrame* frame) {
-			rtc::scoped_refptr<webrtc::PlanarYuvBuffer> frameBuffer =
-				static_cast<webrtc::PlanarYuvBuffer*>(frame->video_frame_buffer().get());
+			// Encoded frames have no planes, they are delivered when the
+			// codec is switched to H264 in passthrough mode.
+			if (webrtc::IsEncodedNativeBuffer(frame->video_frame_buffer().get())) {
+				return;
+			}
+			if (_videoSource->FrameObjectDelivery) {
+				rtc::scoped_refptr<webrtc::I420BufferInterface> frameBuffer =
+					frame->video_frame_buffer()->ToI420();
+				if (frameBuffer != nullptr) {
+					_videoSource->RawVideoFrameReady(frameBuffer);
+				}
+				return;
+			}
+			// The I420 buffers are returned as they are, the decoded
+			// native samples and the other planar formats converted.
+			rtc::scoped_refptr<webrtc::I420BufferInterface> frameBuffer =
+				frame->video_frame_buffer()->ToI420();
+			if (frameBuffer == nullptr) {
+				return;
+			}
 			_videoSource->RawVideoFrame((uint32)frame->width(), (uint32)frame->height(),
 				Platform::ArrayReference<uint8>((uint8*)frameBuffer->DataY(),
 				(unsigned int)(frameBuffer->StrideY() * frame->height())),
@@ -303,10 +378,46 @@ namespace Org {
 
 		RawVideoSource::RawVideoSource(MediaVideoTrack^ track) :
 			_videoStream(new RawVideoStream(this)),
-			_track(track) {
+			_track(track),
+			_frameObjectDelivery(false),
+			_maxOutstandingFrames(2),
+			_droppedFrames(0),
+			_outstandingFrames(std::make_shared<std::atomic<uint32>>(0)) {
 			_track->SetRenderer(_videoStream.get());
 		}
 
+		void RawVideoSource::RawVideoFrameReady(
+			rtc::scoped_refptr<webrtc::I420BufferInterface> frameBuffer) {
+			// Drop rather than wait for a slow consumer, waiting would
+			// stall the decoder thread.
+			if (*_outstandingFrames >= _maxOutstandingFrames) {
+				++_droppedFrames;
+				return;
+			}
+			OnVideoFrame(ref new Org::WebRtc::RawVideoFrame(frameBuffer,
+				_outstandingFrames));
+		}
+
+		bool RawVideoSource::FrameObjectDelivery::get() {
+			return _frameObjectDelivery;
+		}
+
+		void RawVideoSource::FrameObjectDelivery::set(bool value) {
+			_frameObjectDelivery = value;
+		}
+
+		uint32 RawVideoSource::MaxOutstandingFrames::get() {
+			return _maxOutstandingFrames;
+		}
+
+		void RawVideoSource::MaxOutstandingFrames::set(uint32 value) {
+			_maxOutstandingFrames = value > 0 ? value : 1;
+		}
+
+		uint64 RawVideoSource::DroppedFrames::get() {
+			return _droppedFrames;
+		}
+
 		void RawVideoSource::RawVideoFrame(uint32 width, uint32 height,
 			const Platform::Array<uint8>^ yPlane, uint32 yPitch,
 			const Platform::Array<uint8>^ vPlane, uint32 vPitch,
@@ -318,18 +429,371 @@ namespace Org {
 			_track->UnsetRenderer(_videoStream.get());
 		}
 
+		// = RawAudioStream =============================================================
+
+		RawAudioStream::RawAudioStream(RawAudioSource^ audioSource) :
+			_audioSource(audioSource),
+			_delivering(false),
+			_maxQueuedFrames(50),
+			_droppedFrames(0),
+			_sampleRate(0),
+			_channels(0) {
+		}
+
+		RawAudioStream::~RawAudioStream() {
+		}
+
+		void RawAudioStream::OnData(const void* audio_data, int bits_per_sample,
+			int sample_rate, size_t number_of_channels, size_t number_of_frames) {
+			if (bits_per_sample != 16 || number_of_channels == 0) {
+				return;
+			}
+			size_t sampleCount = number_of_channels * number_of_frames;
+			const int16_t* samples = static_cast<const int16_t*>(audio_data);
+			rtc::CritScope lock(&_critSect);
+			std::unique_ptr<AudioFrame> frame;
+			if (_frames.size() >= _maxQueuedFrames) {
+				frame = std::move(_frames.front());
+				_frames.pop_front();
+				++_droppedFrames;
+			}
+			else if (!_freeFrames.empty()) {
+				frame = std::move(_freeFrames.back());
+				_freeFrames.pop_back();
+			}
+			else {
+				frame.reset(new AudioFrame());
+			}
+			// The vectors of the pool keep their capacity, no allocation
+			// once the format is stable.
+			frame->samples.assign(samples, samples + sampleCount);
+			frame->sampleRate = sample_rate;
+			frame->channels = number_of_channels;
+			_frames.push_back(std::move(frame));
+			if (_delivering) {
+				return;
+			}
+			_delivering = true;
+			rtc::scoped_refptr<RawAudioStream> self(this);
+			Windows::System::Threading::ThreadPool::RunAsync(
+				ref new Windows::System::Threading::WorkItemHandler(
+				[self](Windows::Foundation::IAsyncAction^) {
+				self->Deliver();
+			}));
+		}
+
+		void RawAudioStream::Deliver() {
+			while (true) {
+				std::unique_ptr<AudioFrame> frame;
+				uint32 sampleRate;
+				uint32 channels;
+				{
+					rtc::CritScope lock(&_critSect);
+					if (_frames.empty()) {
+						_delivering = false;
+						return;
+					}
+					frame = std::move(_frames.front());
+					_frames.pop_front();
+					sampleRate = _sampleRate;
+					channels = _channels;
+				}
+				RawAudioSource^ audioSource = _audioSource.Resolve<RawAudioSource>();
+				size_t outputChannels = 0;
+				if (audioSource != nullptr &&
+					Convert(*frame, sampleRate, channels, &outputChannels)) {
+					audioSource->RawAudioFrame(
+						Platform::ArrayReference<int16>(_output.data(), (unsigned int)_output.size()),
+						sampleRate != 0 ? sampleRate : frame->sampleRate, (uint32)outputChannels);
+				}
+				rtc::CritScope lock(&_critSect);
+				if (_freeFrames.size() < _maxQueuedFrames) {
+					_freeFrames.push_back(std::move(frame));
+				}
+			}
+		}
+
+		bool RawAudioStream::Convert(const AudioFrame& frame, uint32 sampleRate,
+			uint32 channels, size_t* outputChannels) {
+			size_t inputChannels = frame.channels;
+			size_t frames = frame.samples.size() / inputChannels;
+			*outputChannels = channels != 0 ? channels : inputChannels;
+			const std::vector<int16_t>* mixed = &frame.samples;
+			if (*outputChannels != inputChannels) {
+				_mixed.resize(frames * *outputChannels);
+				for (size_t i = 0; i < frames; ++i) {
+					const int16_t* in = &frame.samples[i * inputChannels];
+					int16_t* out = &_mixed[i * *outputChannels];
+					if (*outputChannels == 1) {
+						int sum = 0;
+						for (size_t c = 0; c < inputChannels; ++c) {
+							sum += in[c];
+						}
+						out[0] = (int16_t)(sum / (int)inputChannels);
+					}
+					else {
+						for (size_t c = 0; c < *outputChannels; ++c) {
+							out[c] = in[std::min(c, inputChannels - 1)];
+						}
+					}
+				}
+				mixed = &_mixed;
+			}
+			if (sampleRate == 0 || (int)sampleRate == frame.sampleRate) {
+				_output.assign(mixed->begin(), mixed->end());
+				return true;
+			}
+			if (_resampler.InitializeIfNeeded(frame.sampleRate, sampleRate,
+				*outputChannels) != 0) {
+				LOG(LS_WARNING) << "Can't resample the audio from " << frame.sampleRate
+					<< " to " << sampleRate << " Hz";
+				return false;
+			}
+			_output.resize((frames * sampleRate / frame.sampleRate + 1) * *outputChannels);
+			int length = _resampler.Resample(mixed->data(), mixed->size(),
+				_output.data(), _output.size());
+			if (length < 0) {
+				return false;
+			}
+			_output.resize(length);
+			return true;
+		}
+
+		void RawAudioStream::SetFormat(uint32 sampleRate, uint32 channels) {
+			rtc::CritScope lock(&_critSect);
+			_sampleRate = sampleRate;
+			_channels = channels;
+		}
+
+		void RawAudioStream::SetMaxQueuedFrames(uint32 maxQueuedFrames) {
+			rtc::CritScope lock(&_critSect);
+			_maxQueuedFrames = maxQueuedFrames > 0 ? maxQueuedFrames : 1;
+		}
+
+		uint32 RawAudioStream::GetMaxQueuedFrames() {
+			rtc::CritScope lock(&_critSect);
+			return _maxQueuedFrames;
+		}
+
+		uint64 RawAudioStream::GetDroppedFrames() {
+			rtc::CritScope lock(&_critSect);
+			return _droppedFrames;
+		}
+
+		// = RawAudioSource =============================================================
+
+		RawAudioSource::RawAudioSource(MediaAudioTrack^ track) :
+			_track(track->GetImpl()),
+			_audioStream(new rtc::RefCountedObject<RawAudioStream>(this)),
+			_sampleRate(0),
+			_channels(0) {
+			if (_track == nullptr)
+				THROW_WEBRTC_NULL_REFERENCE_EXCEPTION("Invalid audio track object");
+
+			_track->AddSink(_audioStream.get());
+		}
+
+		void RawAudioSource::RawAudioFrame(const Platform::Array<int16>^ samples,
+			uint32 sampleRate, uint32 channels) {
+			OnRawAudioFrame(samples, sampleRate, channels);
+		}
+
+		uint32 RawAudioSource::SampleRate::get() {
+			return _sampleRate;
+		}
+
+		void RawAudioSource::SampleRate::set(uint32 value) {
+			if (value != 0) {
+				value = std::max(8000u, std::min(value, 48000u));
+			}
+			_sampleRate = value;
+			_audioStream->SetFormat(_sampleRate, _channels);
+		}
+
+		uint32 RawAudioSource::Channels::get() {
+			return _channels;
+		}
+
+		void RawAudioSource::Channels::set(uint32 value) {
+			_channels = std::min(value, 2u);
+			_audioStream->SetFormat(_sampleRate, _channels);
+		}
+
+		uint32 RawAudioSource::MaxQueuedFrames::get() {
+			return _audioStream->GetMaxQueuedFrames();
+		}
+
+		void RawAudioSource::MaxQueuedFrames::set(uint32 value) {
+			_audioStream->SetMaxQueuedFrames(value);
+		}
+
+		uint64 RawAudioSource::DroppedFrames::get() {
+			return _audioStream->GetDroppedFrames();
+		}
+
+		RawAudioSource::~RawAudioSource() {
+			_track->RemoveSink(_audioStream.get());
+		}
+
+		// = EncodedFrameQueue =============================================================
+
+		EncodedFrameQueue::EncodedFrameQueue(EncodedVideoSource^ videoSource) :
+			_videoSource(videoSource),
+			_delivering(false),
+			_maxQueuedFrames(30),
+			_dropPolicy(EncodedVideoDropPolicy::DropNonIdrFirst),
+			_droppedFrames(0),
+			_needsIdr(false) {
+		}
+
+		EncodedFrameQueue::~EncodedFrameQueue() {
+		}
+
+		void EncodedFrameQueue::Push(ComPtr<IMFSample> sample, uint32 width,
+			uint32 height) {
+			rtc::CritScope lock(&_critSect);
+			if (_needsIdr) {
+				if (!Internal::IsSampleIDR(sample.Get())) {
+					++_droppedFrames;
+					return;
+				}
+				_needsIdr = false;
+			}
+			while (_frames.size() >= _maxQueuedFrames) {
+				DropFrames();
+			}
+			PendingFrame frame;
+			frame.sample = sample;
+			frame.width = width;
+			frame.height = height;
+			_frames.push_back(frame);
+			if (_delivering) {
+				return;
+			}
+			_delivering = true;
+			rtc::scoped_refptr<EncodedFrameQueue> self(this);
+			Windows::System::Threading::ThreadPool::RunAsync(
+				ref new Windows::System::Threading::WorkItemHandler(
+				[self](Windows::Foundation::IAsyncAction^) {
+				self->Deliver();
+			}));
+		}
+
+		void EncodedFrameQueue::DropFrames() {
+			if (_dropPolicy == EncodedVideoDropPolicy::DropNonIdrFirst) {
+				auto it = _frames.begin();
+				while (it != _frames.end() && Internal::IsSampleIDR(it->sample.Get())) {
+					++it;
+				}
+				if (it != _frames.end()) {
+					// The following frames depend on the dropped one,
+					// drop them as well up to the next IDR frame.
+					auto end = it;
+					while (end != _frames.end() && !Internal::IsSampleIDR(end->sample.Get())) {
+						++end;
+					}
+					// The frames still to come depend on the dropped ones
+					// if no IDR frame is queued after them.
+					_needsIdr = end == _frames.end();
+					_droppedFrames += end - it;
+					_frames.erase(it, end);
+					return;
+				}
+			}
+			_frames.pop_front();
+			++_droppedFrames;
+		}
+
+		void EncodedFrameQueue::Deliver() {
+			while (true) {
+				PendingFrame frame;
+				{
+					rtc::CritScope lock(&_critSect);
+					if (_frames.empty()) {
+						_delivering = false;
+						return;
+					}
+					frame = _frames.front();
+					_frames.pop_front();
+				}
+				EncodedVideoSource^ videoSource = _videoSource.Resolve<EncodedVideoSource>();
+				if (videoSource == nullptr) {
+					continue;
+				}
+				ComPtr<IMFMediaBuffer> pBuffer;
+				if (FAILED(frame.sample->GetBufferByIndex(0, &pBuffer))) {
+					LOG(LS_ERROR) << "Failed to retrieve buffer.";
+					continue;
+				}
+				BYTE* pBytes;
+				DWORD maxLength, curLength;
+				if (FAILED(pBuffer->Lock(&pBytes, &maxLength, &curLength))) {
+					LOG(LS_ERROR) << "Failed to lock buffer.";
+					continue;
+				}
+				videoSource->EncodedVideoFrame(frame.width, frame.height,
+					Platform::ArrayReference<uint8>((uint8*)pBytes, curLength));
+				if (FAILED(pBuffer->Unlock())) {
+					LOG(LS_ERROR) << "Failed to unlock buffer";
+				}
+			}
+		}
+
+		void EncodedFrameQueue::SetMaxQueuedFrames(uint32 maxQueuedFrames) {
+			rtc::CritScope lock(&_critSect);
+			_maxQueuedFrames = maxQueuedFrames > 0 ? maxQueuedFrames : 1;
+		}
+
+		uint32 EncodedFrameQueue::GetMaxQueuedFrames() {
+			rtc::CritScope lock(&_critSect);
+			return _maxQueuedFrames;
+		}
+
+		void EncodedFrameQueue::SetDropPolicy(EncodedVideoDropPolicy dropPolicy) {
+			rtc::CritScope lock(&_critSect);
+			_dropPolicy = dropPolicy;
+		}
+
+		EncodedVideoDropPolicy EncodedFrameQueue::GetDropPolicy() {
+			rtc::CritScope lock(&_critSect);
+			return _dropPolicy;
+		}
+
+		uint32 EncodedFrameQueue::GetQueueDepth() {
+			rtc::CritScope lock(&_critSect);
+			return (uint32)_frames.size();
+		}
+
+		uint64 EncodedFrameQueue::GetDroppedFrames() {
+			rtc::CritScope lock(&_critSect);
+			return _droppedFrames;
+		}
+
 		// = EncodedVideoStream =============================================================
 
 		EncodedVideoStream::EncodedVideoStream(EncodedVideoSource^ videoSource) :
-			_videoSource(videoSource) {
+			_videoSource(videoSource),
+			_frameQueue(new rtc::RefCountedObject<EncodedFrameQueue>(videoSource)) {
+		}
+
+		rtc::scoped_refptr<EncodedFrameQueue> EncodedVideoStream::GetFrameQueue() {
+			return _frameQueue;
 		}
 
 		void EncodedVideoStream::RenderFrame(const webrtc::VideoFrame* frame) {
+			if (!webrtc::IsEncodedNativeBuffer(frame->video_frame_buffer().get())) {
+				return;
+			}
 			rtc::scoped_refptr<webrtc::NativeHandleBuffer> frameBuffer =
 				static_cast<webrtc::NativeHandleBuffer*>(frame->video_frame_buffer().get());
 			ComPtr<IMFSample> pSample = (IMFSample*)frameBuffer->native_handle();
 			if (pSample == nullptr)
 				return;
+			if (_videoSource->AsyncDelivery) {
+				// The sample is kept alive by the queue, no copy needed.
+				_frameQueue->Push(pSample, (uint32)frame->width(), (uint32)frame->height());
+				return;
+			}
 			ComPtr<IMFMediaBuffer> pBuffer;
 			if (FAILED(pSample->GetBufferByIndex(0, &pBuffer))) {
 				LOG(LS_ERROR) << "Failed to retrieve buffer.";
@@ -353,7 +817,8 @@ namespace Org {
 
 		EncodedVideoSource::EncodedVideoSource(MediaVideoTrack^ track) :
 			_videoStream(new EncodedVideoStream(this)),
-			_track(track) {
+			_track(track),
+			_asyncDelivery(false) {
 			_track->SetRenderer(_videoStream.get());
 		}
 
@@ -362,46 +827,287 @@ namespace Org {
 			OnEncodedVideoFrame(width, height, frameData);
 		}
 
+		bool EncodedVideoSource::AsyncDelivery::get() {
+			return _asyncDelivery;
+		}
+
+		void EncodedVideoSource::AsyncDelivery::set(bool value) {
+			_asyncDelivery = value;
+		}
+
+		uint32 EncodedVideoSource::MaxQueuedFrames::get() {
+			return _videoStream->GetFrameQueue()->GetMaxQueuedFrames();
+		}
+
+		void EncodedVideoSource::MaxQueuedFrames::set(uint32 value) {
+			_videoStream->GetFrameQueue()->SetMaxQueuedFrames(value);
+		}
+
+		EncodedVideoDropPolicy EncodedVideoSource::DropPolicy::get() {
+			return _videoStream->GetFrameQueue()->GetDropPolicy();
+		}
+
+		void EncodedVideoSource::DropPolicy::set(EncodedVideoDropPolicy value) {
+			_videoStream->GetFrameQueue()->SetDropPolicy(value);
+		}
+
+		uint32 EncodedVideoSource::QueueDepth::get() {
+			return _videoStream->GetFrameQueue()->GetQueueDepth();
+		}
+
+		uint64 EncodedVideoSource::DroppedFrames::get() {
+			return _videoStream->GetFrameQueue()->GetDroppedFrames();
+		}
+
 		EncodedVideoSource::~EncodedVideoSource() {
 			_track->UnsetRenderer(_videoStream.get());
 		}
 
 		// = Media ===================================================================
 
+		namespace globals {
+			extern uint32 gRenderMaxFramerate;
+		}
+
+		namespace {
+			// Runs |handler| on the window thread, right away if already
+			// on it.
+			void RunOnWindowThread(DispatchedHandler^ handler) {
+				Windows::UI::Core::CoreDispatcher^ windowDispatcher =
+					webrtc::VideoCommonWinUWP::GetCoreDispatcher();
+				if (windowDispatcher != nullptr && !windowDispatcher->HasThreadAccess) {
+					windowDispatcher->RunAsync(CoreDispatcherPriority::Normal, handler);
+				}
+				else {
+					handler->Invoke();
+				}
+			}
+
+			// Frames are only scaled down when it saves at least a quarter
+			// of the pixels, scaling costs more than it saves otherwise.
+			const int kMinScaledPixelsPercent = 75;
+		}
+
 		const char kAudioLabel[] = "audio_label_%llx";
 		const char kVideoLabel[] = "video_label_%llx";
 		const char kStreamLabel[] = "stream_label_%llx";
 		// we will append current time (uint32 in Hex, e.g.:
 		// 8chars to the end to generate a unique string)
 
-		Media::VideoFrameSink::VideoFrameSink(MediaElement^ mediaElement, String^ id) :
+		Media::VideoFrameSink::VideoFrameSink(MediaElement^ mediaElement, String^ id,
+			Internal::VideoFrameType expectedFrameType) :
 			_mediaElement(mediaElement),
-			_id(id) { }
+			_id(id),
+			_state(std::make_shared<SourceState>()) {
+			CreateMediaSource(expectedFrameType);
+			TrackRenderSize();
+		}
 
-		void Media::VideoFrameSink::OnFrame(const webrtc::VideoFrame& frame) {
-			if (_mediaSource == nullptr) {
-				if (frame.video_frame_buffer()->ToI420() != nullptr)
-					_frameType = Internal::FrameTypeI420;
-				else
-					_frameType = Internal::FrameTypeH264;
-
-				auto handler = ref new DispatchedHandler([this]() {
-					_mediaSource = Internal::RTMediaStreamSource::CreateMediaSource(_frameType, _id);
-					_mediaElement->SetMediaStreamSource(_mediaSource->GetMediaStreamSource());
+		Media::VideoFrameSink::~VideoFrameSink() {
+			rtc::CritScope lock(&_state->critSect);
+			_state->closed = true;
+			_state->pendingFrames.clear();
+			if (_state->sizeChangedRegistered) {
+				MediaElement^ mediaElement = _mediaElement;
+				Windows::Foundation::EventRegistrationToken token =
+					_state->sizeChangedToken;
+				RunOnWindowThread(ref new DispatchedHandler([mediaElement, token]() {
+					mediaElement->SizeChanged -= token;
+				}));
+			}
+		}
+
+		void Media::VideoFrameSink::TrackRenderSize() {
+			std::shared_ptr<SourceState> state = _state;
+			MediaElement^ mediaElement = _mediaElement;
+			RunOnWindowThread(ref new DispatchedHandler([state, mediaElement]() {
+				double scale = Windows::Graphics::Display::DisplayInformation::
+					GetForCurrentView()->RawPixelsPerViewPixel;
+				auto setRenderSize = [state, scale](Windows::Foundation::Size size) {
+					rtc::CritScope lock(&state->critSect);
+					state->renderWidth = (int)(size.Width * scale + 0.5);
+					state->renderHeight = (int)(size.Height * scale + 0.5);
+				};
+				rtc::CritScope lock(&state->critSect);
+				if (state->closed) {
+					return;
+				}
+				state->sizeChangedToken = mediaElement->SizeChanged +=
+					ref new Windows::UI::Xaml::SizeChangedEventHandler(
+						[setRenderSize](Platform::Object^,
+							Windows::UI::Xaml::SizeChangedEventArgs^ args) {
+					setRenderSize(args->NewSize);
 				});
+				state->sizeChangedRegistered = true;
+				state->renderWidth = (int)(mediaElement->ActualWidth * scale + 0.5);
+				state->renderHeight = (int)(mediaElement->ActualHeight * scale + 0.5);
+			}));
+		}
 
-				Windows::UI::Core::CoreDispatcher^ windowDispatcher =
-					webrtc::VideoCommonWinUWP::GetCoreDispatcher();
-				if (windowDispatcher != nullptr) {
-					auto dispatcher_action = windowDispatcher->RunAsync(
-						CoreDispatcherPriority::Normal, handler);
-					Concurrency::create_task(dispatcher_action).wait();
+		void Media::VideoFrameSink::CreateMediaSource(
+			Internal::VideoFrameType frameType) {
+			{
+				rtc::CritScope lock(&_state->critSect);
+				_state->frameType = frameType;
+				_state->mediaSource = nullptr;
+			}
+
+			std::shared_ptr<SourceState> state = _state;
+			MediaElement^ mediaElement = _mediaElement;
+			String^ id = _id;
+			auto handler = ref new DispatchedHandler([state, mediaElement, id, frameType]() {
+				{
+					rtc::CritScope lock(&state->critSect);
+					// Superseded by a source of another type.
+					if (state->closed || state->frameType != frameType) {
+						return;
+					}
 				}
-				else {
-					handler->Invoke();
+				Internal::RTMediaStreamSource^ mediaSource =
+					Internal::RTMediaStreamSource::CreateMediaSource(frameType, id);
+				mediaElement->SetMediaStreamSource(mediaSource->GetMediaStreamSource());
+
+				// Flushed under the lock so that they stay in order with
+				// the frames received from now on.
+				rtc::CritScope lock(&state->critSect);
+				if (state->closed || state->frameType != frameType) {
+					return;
+				}
+				state->mediaSource = mediaSource;
+				for (auto& frame : state->pendingFrames) {
+					mediaSource->RenderFrame(&frame);
+				}
+				state->pendingFrames.clear();
+			});
+			RunOnWindowThread(handler);
+		}
+
+		bool Media::VideoFrameSink::AdaptFrame(const webrtc::VideoFrame& frame,
+			rtc::scoped_refptr<webrtc::I420Buffer>* scaledBuffer) {
+			int renderWidth;
+			int renderHeight;
+			{
+				rtc::CritScope lock(&_state->critSect);
+				uint32 maxFramerate = globals::gRenderMaxFramerate;
+				if (maxFramerate > 0 && _state->lastFrameTimeUs >= 0) {
+					// A little slack so that a source running right at
+					// the limit isn't halved by jitter.
+					int64_t minIntervalUs = 900000 / maxFramerate;
+					if (frame.timestamp_us() - _state->lastFrameTimeUs < minIntervalUs &&
+						frame.timestamp_us() >= _state->lastFrameTimeUs) {
+						return false;
+					}
+				}
+				_state->lastFrameTimeUs = frame.timestamp_us();
+				renderWidth = _state->renderWidth;
+				renderHeight = _state->renderHeight;
+			}
+			if (renderWidth <= 0 || renderHeight <= 0) {
+				return true;
+			}
+
+			// The renderer applies the rotation, the element size is in
+			// rotated coordinates.
+			if (frame.rotation() == webrtc::kVideoRotation_90 ||
+				frame.rotation() == webrtc::kVideoRotation_270) {
+				std::swap(renderWidth, renderHeight);
+			}
+			double scale = std::min((double)renderWidth / frame.width(),
+				(double)renderHeight / frame.height());
+			int width = std::max(2, (int)(frame.width() * scale) & ~1);
+			int height = std::max(2, (int)(frame.height() * scale) & ~1);
+			if ((int64_t)width * height * 100 >
+				(int64_t)frame.width() * frame.height() * kMinScaledPixelsPercent) {
+				return true;
+			}
+
+			*scaledBuffer = webrtc::I420Buffer::Create(width, height);
+			(*scaledBuffer)->ScaleFrom(*frame.video_frame_buffer()->ToI420());
+			return true;
+		}
+
+		void Media::VideoFrameSink::OnFrame(const webrtc::VideoFrame& frame) {
+			TRACE_EVENT1("webrtc", "Media::VideoFrameSink::OnFrame",
+				"timestamp", frame.timestamp());
+			webrtc::TraceFrameFlowStep(webrtc::kReceiveFrameFlow, frame.timestamp());
+			if (webrtc::IsEncodedNativeBuffer(frame.video_frame_buffer().get())) {
+				RenderFrame(frame);
+				return;
+			}
+			rtc::scoped_refptr<webrtc::I420Buffer> scaledBuffer;
+			if (!AdaptFrame(frame, &scaledBuffer)) {
+				return;
+			}
+			if (scaledBuffer == nullptr) {
+				RenderFrame(frame);
+				return;
+			}
+			webrtc::VideoFrame scaledFrame(scaledBuffer, frame.timestamp(),
+				frame.render_time_ms(), frame.rotation());
+			scaledFrame.set_ntp_time_ms(frame.ntp_time_ms());
+			RenderFrame(scaledFrame);
+		}
+
+		namespace {
+			bool IsEncodedIDR(const webrtc::VideoFrame& frame) {
+				if (!webrtc::IsEncodedNativeBuffer(frame.video_frame_buffer().get())) {
+					return false;
 				}
+				IMFSample* sample = (IMFSample*)static_cast<webrtc::NativeHandleBuffer*>(
+					frame.video_frame_buffer().get())->native_handle();
+				return sample != nullptr && Internal::IsSampleIDR(sample);
 			}
-			_mediaSource->RenderFrame(&frame);
+		}
+
+		void Media::VideoFrameSink::DropOldestPendingFrames() {
+			std::deque<webrtc::VideoFrame>& frames = _state->pendingFrames;
+			if (!webrtc::IsEncodedNativeBuffer(frames.front().video_frame_buffer().get())) {
+				frames.pop_front();
+				return;
+			}
+			// The encoded frames up to the next IDR can't be decoded
+			// without the ones before.
+			do {
+				frames.pop_front();
+			} while (!frames.empty() && !IsEncodedIDR(frames.front()));
+			if (frames.empty()) {
+				// The frames still to come need the dropped ones, IDR or
+				// not.  They are dropped as well until the key frame.
+				LOG(LS_INFO) << "Pending frames dropped, requesting a key frame";
+				_state->needsIdr = true;
+				Internal::RequestGlobalKeyFrame();
+			}
+		}
+
+		void Media::VideoFrameSink::RenderFrame(const webrtc::VideoFrame& frame) {
+			Internal::VideoFrameType frameType =
+				webrtc::IsEncodedNativeBuffer(frame.video_frame_buffer().get()) ?
+				Internal::FrameTypeH264 : Internal::FrameTypeI420;
+			{
+				rtc::CritScope lock(&_state->critSect);
+				if (_state->frameType == frameType) {
+					if (_state->mediaSource != nullptr) {
+						_state->mediaSource->RenderFrame(&frame);
+						return;
+					}
+					if (_state->needsIdr) {
+						if (frameType == Internal::FrameTypeH264 && !IsEncodedIDR(frame)) {
+							return;
+						}
+						_state->needsIdr = false;
+					}
+					if (_state->pendingFrames.size() >= kMaxPendingFrames) {
+						DropOldestPendingFrames();
+					}
+					_state->pendingFrames.push_back(frame);
+					return;
+				}
+				LOG(LS_INFO) << "Unexpected frame type, recreating the media source";
+				_state->pendingFrames.clear();
+				_state->needsIdr = false;
+				_state->pendingFrames.push_back(frame);
+			}
+			CreateMediaSource(frameType);
 		}
 
 		Media::Media() :
@@ -435,9 +1141,11 @@ namespace Org {
 		IAsyncOperation<MediaStream^>^ Media::GetUserMedia(
 			RTCMediaStreamConstraints^ mediaStreamConstraints) {
 
+			// The tracks are created on gThread, the returned operation
+			// completes from there without blocking a thread pool thread.
 			IAsyncOperation<MediaStream^>^ asyncOp = Concurrency::create_async(
-				[this, mediaStreamConstraints]() -> MediaStream^ {
-				return globals::RunOnGlobalThread<MediaStream^>([this,
+				[this, mediaStreamConstraints]() -> Concurrency::task<MediaStream^> {
+				return globals::RunOnGlobalThreadAsync<MediaStream^>([this,
 					mediaStreamConstraints]()->MediaStream^ {
 					// This is the stream returned.
 					char streamLabel[32];
@@ -446,7 +1154,7 @@ namespace Org {
 					rtc::scoped_refptr<webrtc::MediaStreamInterface> stream =
 						globals::gPeerConnectionFactory->CreateLocalMediaStream(streamLabel);
 
-					auto ret = ref new MediaStream(stream);
+					auto ret = Internal::GetMediaStream(stream);
 
 					if (mediaStreamConstraints->audioEnabled) {
 						LOG(LS_INFO) << "Creating audio track.";
@@ -458,7 +1166,7 @@ namespace Org {
 								audioLabel,
 								globals::gPeerConnectionFactory->CreateAudioSource(NULL)));
 						LOG(LS_INFO) << "Adding audio track to stream.";
-						auto audioTrack = ref new MediaAudioTrack(audio_track);
+						auto audioTrack = Internal::GetMediaAudioTrack(audio_track);
 						ret->AddTrack(audioTrack);
 					}
 
@@ -523,7 +1231,7 @@ namespace Org {
 									globals::gPeerConnectionFactory->CreateVideoSource(
 										videoCapturer, &constraints)));
 							LOG(LS_INFO) << "Adding video track to stream.";
-							auto videoTrack = ref new MediaVideoTrack(video_track);
+							auto videoTrack = Internal::GetMediaVideoTrack(video_track);
 							ret->AddTrack(videoTrack);
 						}
 					}
@@ -544,11 +1252,20 @@ namespace Org {
 		}
 
 		void Media::AddVideoTrackMediaElementPair(MediaVideoTrack^ track, MediaElement^ mediaElement, String^ id) {
+			// Remote H264 tracks deliver the encoded samples unless they
+			// are decoded by the MFT, everything else is I420.
+			Internal::VideoFrameType expectedFrameType = Internal::FrameTypeI420;
+			webrtc::VideoTrackSourceInterface* source = track->GetImpl()->GetSource();
+			if (source != nullptr && source->remote() &&
+				webrtc::GetH264DecoderMode() == webrtc::H264DecoderMode::kPassthrough) {
+				expectedFrameType = Internal::FrameTypeH264;
+			}
+
 			std::list<std::unique_ptr<VideoTrackMediaElementPair>>::iterator iter =
 				_videoTrackMediaElementPairList.begin();
 			while (iter != _videoTrackMediaElementPairList.end()) {
 				if ((*iter)->_videoTrack == track) {
-					(*iter)->_videoSink.reset(new VideoFrameSink(mediaElement, id));
+					(*iter)->_videoSink.reset(new VideoFrameSink(mediaElement, id, expectedFrameType));
 					(*iter)->_mediaElement = mediaElement;
 					track->SetRenderer((*iter)->_videoSink.get());
 					return;
@@ -558,7 +1275,7 @@ namespace Org {
 			_videoTrackMediaElementPairList.push_back(
 				std::unique_ptr<VideoTrackMediaElementPair>(new VideoTrackMediaElementPair()));
 			_videoTrackMediaElementPairList.back()->_videoTrack = track;
-			_videoTrackMediaElementPairList.back()->_videoSink.reset(new VideoFrameSink(mediaElement, id));
+			_videoTrackMediaElementPairList.back()->_videoSink.reset(new VideoFrameSink(mediaElement, id, expectedFrameType));
 			_videoTrackMediaElementPairList.back()->_mediaElement = mediaElement;
 			track->SetRenderer(_videoTrackMediaElementPairList.back()->_videoSink.get());
 		}
@@ -582,26 +1299,60 @@ namespace Org {
 			return ref new RawVideoSource(track);
 		}
 
+		RawAudioSource^ Media::CreateRawAudioSource(MediaAudioTrack^ track) {
+			return ref new RawAudioSource(track);
+		}
+
 		EncodedVideoSource^ Media::CreateEncodedVideoSource(MediaVideoTrack^ track) {
 			return ref new EncodedVideoSource(track);
 		}
 
+		VideoCompositor^ Media::CreateVideoCompositor(MediaElement^ mediaElement,
+			String^ id, uint32 width, uint32 height, uint32 framerate) {
+			return ref new VideoCompositor(mediaElement, id, width, height, framerate);
+		}
+
+		CustomVideoSource^ Media::CreateCustomVideoSource(uint32 width,
+			uint32 height, uint32 framerate) {
+			return ref new CustomVideoSource(width, height, framerate);
+		}
+
+		ScreenCaptureSource^ Media::CreateScreenCaptureSource(
+			Windows::Graphics::Capture::GraphicsCaptureItem^ item,
+			uint32 maxWidth, uint32 maxHeight, uint32 framerate) {
+			return ref new ScreenCaptureSource(item, maxWidth, maxHeight, framerate);
+		}
+
+		TestPatternVideoSource^ Media::CreateTestPatternVideoSource(uint32 width,
+			uint32 height, uint32 framerate) {
+			return ref new TestPatternVideoSource(width, height, framerate);
+		}
+
+		VideoLatencyProbe^ Media::CreateVideoLatencyProbe(MediaVideoTrack^ track) {
+			return ref new VideoLatencyProbe(track);
+		}
+
+		MediaRecorder^ Media::CreateMediaRecorder(
+			Windows::Storage::Streams::IRandomAccessStream^ stream,
+			MediaVideoTrack^ videoTrack, MediaAudioTrack^ audioTrack) {
+			return ref new MediaRecorder(stream, videoTrack, audioTrack);
+		}
+
 		IVector<MediaDevice^>^ Media::GetVideoCaptureDevices() {
 			rtc::CritScope lock(&g_videoDevicesCritSect);
-			std::vector<cricket::Device> videoDevices;
-			DeviceInformationCollection^ dev_info_collection = nullptr;
 
 			if (_videoCaptureDeviceChanged) {
-				// Get list of devices from device manager.
-				globals::RunOnGlobalThread<void>([this, &videoDevices, &dev_info_collection] {
-					if (!_dev_manager->GetVideoCaptureDevices(&videoDevices)) {
-						LOG(LS_ERROR) << "Can't enumerate video capture devices";
-					}
-
-					// Obtain also the list of devices directly from the OS API.
-					// Only device location will be used from this list.
+				// Obtain also the list of devices directly from the OS API.
+				// Only device location will be used from this list.  Waited
+				// for on a thread pool thread, gThread must not block on it
+				// and a task can't be waited for on the UI thread.
+				DeviceInformationCollection^ dev_info_collection = nullptr;
+				rtc::Event found(false, false);
+				Windows::System::Threading::ThreadPool::RunAsync(
+					ref new Windows::System::Threading::WorkItemHandler(
+					[&dev_info_collection, &found](Windows::Foundation::IAsyncAction^) {
 					Concurrency::create_task(DeviceInformation::FindAllAsync(
-						DeviceClass::VideoCapture)).then([this, &dev_info_collection](
+						DeviceClass::VideoCapture)).then([&dev_info_collection](
 							Concurrency::task<DeviceInformationCollection^> find_task) {
 						try {
 							dev_info_collection = find_task.get();
@@ -612,26 +1363,81 @@ namespace Org {
 								<< rtc::ToUtf8(e->Message->Data());
 						}
 					}).wait();
+					found.Set();
+				}));
+				found.Wait(rtc::Event::kForever);
+
+				// Get list of devices from device manager.
+				std::vector<cricket::Device> videoDevices;
+				globals::RunOnGlobalThread<void>([this, &videoDevices] {
+					if (!_dev_manager->GetVideoCaptureDevices(&videoDevices)) {
+						LOG(LS_ERROR) << "Can't enumerate video capture devices";
+					}
 				});
 
+				UpdateVideoCaptureDevices(videoDevices, dev_info_collection);
+			}
+			return g_videoDevices;
+		}
 
-				g_videoDevices->Clear();
-				for (auto videoDev : videoDevices) {
-					EnclosureLocation^ location = nullptr;
-					if (dev_info_collection != nullptr) {
-						for (unsigned int i = 0; i < dev_info_collection->Size; i++) {
-							auto dev_info = dev_info_collection->GetAt(i);
-							if (rtc::ToUtf8(dev_info->Id->Data()) == videoDev.id) {
-								location = dev_info->EnclosureLocation;
-								break;
-							}
+		IAsyncOperation<IVector<MediaDevice^>^>^ Media::GetVideoCaptureDevicesAsync() {
+			return Concurrency::create_async(
+				[this]() -> Concurrency::task<IVector<MediaDevice^>^> {
+				{
+					rtc::CritScope lock(&g_videoDevicesCritSect);
+					if (!_videoCaptureDeviceChanged) {
+						return Concurrency::task_from_result(g_videoDevices);
+					}
+				}
+
+				auto dev_info_collection =
+					std::make_shared<DeviceInformationCollection^>(nullptr);
+				return Concurrency::create_task(DeviceInformation::FindAllAsync(
+					DeviceClass::VideoCapture)).then([dev_info_collection](
+						Concurrency::task<DeviceInformationCollection^> find_task) {
+					try {
+						*dev_info_collection = find_task.get();
+					}
+					catch (Platform::Exception^ e) {
+						LOG(LS_ERROR)
+							<< "Failed to retrieve device info collection. "
+							<< rtc::ToUtf8(e->Message->Data());
+					}
+				}).then([this] {
+					return globals::RunOnGlobalThreadAsync<std::vector<cricket::Device>>([this] {
+						std::vector<cricket::Device> videoDevices;
+						if (!_dev_manager->GetVideoCaptureDevices(&videoDevices)) {
+							LOG(LS_ERROR) << "Can't enumerate video capture devices";
+						}
+						return videoDevices;
+					});
+				}).then([this, dev_info_collection](
+						std::vector<cricket::Device> videoDevices) {
+					rtc::CritScope lock(&g_videoDevicesCritSect);
+					UpdateVideoCaptureDevices(videoDevices, *dev_info_collection);
+					return g_videoDevices;
+				});
+			});
+		}
+
+		void Media::UpdateVideoCaptureDevices(
+			const std::vector<cricket::Device>& videoDevices,
+			DeviceInformationCollection^ devInfoCollection) {
+			g_videoDevices->Clear();
+			for (auto videoDev : videoDevices) {
+				EnclosureLocation^ location = nullptr;
+				if (devInfoCollection != nullptr) {
+					for (unsigned int i = 0; i < devInfoCollection->Size; i++) {
+						auto dev_info = devInfoCollection->GetAt(i);
+						if (rtc::ToUtf8(dev_info->Id->Data()) == videoDev.id) {
+							location = dev_info->EnclosureLocation;
+							break;
 						}
 					}
-					g_videoDevices->Append(ref new MediaDevice(ToCx(videoDev.id), ToCx(videoDev.name), location));
 				}
-				_videoCaptureDeviceChanged = false;
+				g_videoDevices->Append(ref new MediaDevice(ToCx(videoDev.id), ToCx(videoDev.name), location));
 			}
-			return g_videoDevices;
+			_videoCaptureDeviceChanged = false;
 		}
 
 		void Media::SelectVideoDevice(MediaDevice^ device) {
@@ -647,6 +1453,56 @@ namespace Org {
 			}
 		}
 
+		IAsyncOperation<IVector<MediaDevice^>^>^ Media::ToMediaDevicesAsync(
+			Concurrency::task<std::vector<cricket::Device>> devicesTask) {
+			return Concurrency::create_async([devicesTask] {
+				return devicesTask.then([](std::vector<cricket::Device> devices) {
+					IVector<MediaDevice^>^ mediaDevices = ref new Vector<MediaDevice^>();
+					for (auto& device : devices) {
+						mediaDevices->Append(ref new MediaDevice(ToCx(device.id), ToCx(device.name)));
+					}
+					return mediaDevices;
+				});
+			});
+		}
+
+		IAsyncOperation<IVector<MediaDevice^>^>^ Media::GetAudioCaptureDevicesAsync() {
+			return ToMediaDevicesAsync(_dev_manager->GetAudioInputDevicesAsync());
+		}
+
+		IAsyncOperation<IVector<MediaDevice^>^>^ Media::GetAudioPlayoutDevicesAsync() {
+			return ToMediaDevicesAsync(_dev_manager->GetAudioOutputDevicesAsync());
+		}
+
+		void Media::SelectAudioCaptureDevice(MediaDevice^ device) {
+			if (globals::gAudioDeviceModule == nullptr) {
+				LOG(LS_WARNING) << "Audio devices are only selected with WebRTC::LowLatencyAudio";
+				return;
+			}
+			std::string id = device != nullptr ? FromCx(device->Id) : std::string();
+			// Opening the device waits for the audio service, not done
+			// on the UI thread.  The device is restarted on the worker
+			// thread, where the voice engine starts and stops it.
+			globals::PostOnGlobalThread([id] {
+				globals::AudioDeviceWorkerThread()->Invoke<void>(RTC_FROM_HERE, [id] {
+					globals::gAudioDeviceModule->SetRecordingDeviceId(id);
+				});
+			});
+		}
+
+		void Media::SelectAudioPlayoutDevice(MediaDevice^ device) {
+			if (globals::gAudioDeviceModule == nullptr) {
+				LOG(LS_WARNING) << "Audio devices are only selected with WebRTC::LowLatencyAudio";
+				return;
+			}
+			std::string id = device != nullptr ? FromCx(device->Id) : std::string();
+			globals::PostOnGlobalThread([id] {
+				globals::AudioDeviceWorkerThread()->Invoke<void>(RTC_FROM_HERE, [id] {
+					globals::gAudioDeviceModule->SetPlayoutDeviceId(id);
+				});
+			});
+		}
+
 		void Media::OnAppSuspending() {
 			// https://msdn.microsoft.com/library/windows/apps/br241124
 			// Note  For Windows Phone Store apps, music and media apps should clean up
@@ -654,6 +1510,15 @@ namespace Org {
 			// handler and recreate them in the Resuming event handler.
 			webrtc::videocapturemodule::MediaCaptureDevicesWinUWP::Instance()->
 				ClearCaptureDevicesCache();
+			webrtc::NotifyAppSuspending();
+			Internal::MediaSourceHelper::TrimAll();
+		}
+
+		void Media::OnAppResuming() {
+			webrtc::NotifyAppResuming();
+			// The renderers of passthrough decoders see no decoding
+			// error, ask for a key frame as a new media source does.
+			Internal::RequestGlobalKeyFrame();
 		}
 
 		void Media::SetDisplayOrientation(
@@ -664,6 +1529,16 @@ namespace Org {
 
 		IAsyncOperation<IVector<CaptureCapability^>^>^
 			MediaDevice::GetVideoCaptureCapabilities() {
+			{
+				rtc::CritScope lock(&g_videoCapabilitiesCritSect);
+				auto cached = g_videoCapabilities.find(_id->Data());
+				if (cached != g_videoCapabilities.end()) {
+					// A copy, the callers can modify what they get.
+					IVector<CaptureCapability^>^ ret =
+						ref new Vector<CaptureCapability^>(cached->second);
+					return concurrency::create_async([ret] { return ret; });
+				}
+			}
 			auto op = concurrency::create_async([this]() -> IVector<CaptureCapability^>^ {
 				auto mediaCapture =
 					webrtc::videocapturemodule::MediaCaptureDevicesWinUWP::Instance()->
@@ -677,8 +1552,8 @@ namespace Org {
 				if (streamProperties == nullptr) {
 					return nullptr;
 				}
-				auto ret = ref new Vector<CaptureCapability^>();
-				std::set<std::wstring> descSet;
+				std::vector<CaptureCapability^> capabilities;
+				std::set<std::tuple<unsigned int, unsigned int, unsigned int>> seen;
 				for (auto prop : streamProperties) {
 					if (prop->Type != L"Video") {
 						continue;
@@ -692,15 +1567,21 @@ namespace Org {
 						(videoProp->Width == 0) || (videoProp->Height == 0)) {
 						continue;
 					}
-					auto cap = ref new CaptureCapability(videoProp->Width, videoProp->Height,
-						videoProp->FrameRate->Numerator / videoProp->FrameRate->Denominator,
-						videoProp->PixelAspectRatio);
-					if (descSet.find(cap->FullDescription->Data()) == descSet.end()) {
-						ret->Append(cap);
-						descSet.insert(cap->FullDescription->Data());
+					unsigned int fps =
+						videoProp->FrameRate->Numerator / videoProp->FrameRate->Denominator;
+					// Same thing as comparing the descriptions, without
+					// formatting them.
+					if (seen.insert(std::make_tuple(videoProp->Width,
+						videoProp->Height, fps)).second) {
+						capabilities.push_back(ref new CaptureCapability(videoProp->Width,
+							videoProp->Height, fps, videoProp->PixelAspectRatio));
 					}
 				}
-				return ret;
+				{
+					rtc::CritScope lock(&g_videoCapabilitiesCritSect);
+					g_videoCapabilities[_id->Data()] = capabilities;
+				}
+				return ref new Vector<CaptureCapability^>(std::move(capabilities));
 			});
 			return op;
 		}
@@ -731,6 +1612,8 @@ namespace Org {
 				return;
 			if (sender == _videoCaptureWatcher) {
 				LOG(LS_INFO) << "OnVideoCaptureAdded";
+				// A device plugged back in may come with other formats.
+				InvalidateVideoCapabilities(args->Id);
 				_videoCaptureDeviceChanged = true;
 				OnMediaDevicesChanged(MediaDeviceType::MediaDeviceType_VideoCapture);
 				LOG(LS_INFO) << "OnVideoCaptureAdded END";
@@ -748,6 +1631,7 @@ namespace Org {
 				// (event handlers are not called each time)
 				webrtc::videocapturemodule::MediaCaptureDevicesWinUWP::Instance()->
 					RemoveMediaCapture(updateInfo->Id);
+				InvalidateVideoCapabilities(updateInfo->Id);
 				_videoCaptureDeviceChanged = true;
 				OnMediaDevicesChanged(MediaDeviceType::MediaDeviceType_VideoCapture);
 			}
@@ -12,13 +12,17 @@
 
 #include <mfidl.h>
 #include <collection.h>
+#include <deque>
 #include "webrtc/api/peerconnectioninterface.h"
 #include "webrtc/api/mediastreaminterface.h"
 #include "webrtc/api/mediaconstraintsinterface.h"
+#include "webrtc/api/video/i420_buffer.h"
 #include "GlobalObserver.h"
 #include "WinUWPDeviceManager.h"
 #include "webrtc/modules/audio_device/include/audio_device.h"
+#include "webrtc/common_audio/resampler/include/push_resampler.h"
 #include "Delegates.h"
+#include "RawVideoFrame.h"
 #include "RTMediaStreamSource.h"
 
 using Platform::String;
@@ -226,6 +230,17 @@ namespace Org {
 			rtc::scoped_refptr<webrtc::MediaStreamInterface> _impl;
 		};
 
+		namespace Internal {
+			// The wrapper of a native object, the same one as long as the
+			// application holds it.  Null if |impl| is.
+			MediaStream^ GetMediaStream(
+				rtc::scoped_refptr<webrtc::MediaStreamInterface> impl);
+			MediaAudioTrack^ GetMediaAudioTrack(
+				rtc::scoped_refptr<webrtc::AudioTrackInterface> impl);
+			MediaVideoTrack^ GetMediaVideoTrack(
+				rtc::scoped_refptr<webrtc::VideoTrackInterface> impl);
+		}
+
 		/// <summary>
 		/// Represents video camera capture capabilities.
 		/// </summary>
@@ -246,16 +261,15 @@ namespace Org {
 				_height = height;
 				_fps = fps;
 				_pixelAspectRatio = pixelAspect;
+				// Formatted here, the capabilities are read from any
+				// thread and the descriptions never change.
 				wchar_t resolutionDesc[64];
-				swprintf_s(resolutionDesc, 64, L"%u x %u",
-					_width, _height);
+				swprintf_s(resolutionDesc, 64, L"%u x %u", _width, _height);
 				_resolutionDescription = ref new String(resolutionDesc);
 				wchar_t fpsDesc[64];
 				swprintf_s(fpsDesc, 64, L"%u fps", _fps);
 				_fpsDescription = ref new String(fpsDesc);
-				wchar_t desc[128];
-				swprintf_s(desc, 128, L"%s %s", resolutionDesc, fpsDesc);
-				_description = ref new String(desc);
+				_description = _resolutionDescription + L" " + _fpsDescription;
 			}
 			/// <summary>
 			/// Gets the width in pixes of a video capture device capibility.
@@ -431,18 +445,216 @@ namespace Org {
 					const Platform::Array<uint8>^ yPlane, uint32 yPitch,
 					const Platform::Array<uint8>^ vPlane, uint32 vPitch,
 					const Platform::Array<uint8>^ uPlane, uint32 uPitch);
+				void RawVideoFrameReady(rtc::scoped_refptr<webrtc::I420BufferInterface> frameBuffer);
 			public:
 				/// <summary>
 				/// Raw video frame has been received.
+				/// The planes are only valid during the call.
 				/// </summary>
 				event RawVideoSourceDelegate^ OnRawVideoFrame;
+				/// <summary>
+				/// Raw video frame has been received, raised instead of
+				/// <see cref="OnRawVideoFrame"/> when
+				/// <see cref="FrameObjectDelivery"/> is set.
+				/// </summary>
+				event RawVideoFrameDelegate^ OnVideoFrame;
+				/// <summary>
+				/// Deliver frames as <see cref="RawVideoFrame"/> objects
+				/// which can be kept and processed asynchronously.
+				/// Default value: false
+				/// </summary>
+				property bool FrameObjectDelivery { bool get(); void set(bool value); }
+				/// <summary>
+				/// Number of frames the application may hold before new
+				/// frames are dropped.
+				/// Default value: 2
+				/// </summary>
+				property uint32 MaxOutstandingFrames { uint32 get(); void set(uint32 value); }
+				/// <summary>
+				/// Number of frames dropped because too many were outstanding.
+				/// </summary>
+				property uint64 DroppedFrames { uint64 get(); }
 				virtual ~RawVideoSource();
 			private:
 				std::unique_ptr<RawVideoStream> _videoStream;
 				MediaVideoTrack^ _track;
+				std::atomic<bool> _frameObjectDelivery;
+				std::atomic<uint32> _maxOutstandingFrames;
+				std::atomic<uint64> _droppedFrames;
+				std::shared_ptr<std::atomic<uint32>> _outstandingFrames;
+		};
+
+		ref class RawAudioSource;
+
+		/// <summary>
+		/// Sink of an audio track feeding a <see cref="RawAudioSource"/>.
+		/// The audio thread only copies the 10ms frames into buffers of a
+		/// pool, they are converted and delivered on the thread pool.
+		/// </summary>
+		class RawAudioStream : public webrtc::AudioTrackSinkInterface,
+			public rtc::RefCountInterface {
+		public:
+			explicit RawAudioStream(RawAudioSource^ audioSource);
+
+			// AudioTrackSinkInterface
+			void OnData(const void* audio_data, int bits_per_sample,
+				int sample_rate, size_t number_of_channels,
+				size_t number_of_frames) override;
+
+			// 0 keeps the rate and the channels of the track.
+			void SetFormat(uint32 sampleRate, uint32 channels);
+			void SetMaxQueuedFrames(uint32 maxQueuedFrames);
+			uint32 GetMaxQueuedFrames();
+			uint64 GetDroppedFrames();
+
+		protected:
+			virtual ~RawAudioStream();
+
+		private:
+			struct AudioFrame {
+				std::vector<int16_t> samples;
+				int sampleRate;
+				size_t channels;
+			};
+
+			void Deliver();
+			// Downmixes and resamples |frame| into |_output|, returns
+			// false if it can't be converted.
+			bool Convert(const AudioFrame& frame, uint32 sampleRate,
+				uint32 channels, size_t* outputChannels);
+
+			Platform::WeakReference _audioSource;
+			rtc::CriticalSection _critSect;
+			std::deque<std::unique_ptr<AudioFrame>> _frames;
+			std::vector<std::unique_ptr<AudioFrame>> _freeFrames;
+			bool _delivering;
+			uint32 _maxQueuedFrames;
+			uint64 _droppedFrames;
+			uint32 _sampleRate;
+			uint32 _channels;
+
+			// Only used by the delivery.
+			webrtc::PushResampler<int16_t> _resampler;
+			std::vector<int16_t> _mixed;
+			std::vector<int16_t> _output;
+		};
+
+		/// <summary>
+		/// Source of raw audio samples of a local or remote audio track,
+		/// 10ms at a time.  The audio of a local track only flows while the
+		/// track is sent by a peer connection.
+		/// </summary>
+		public ref class RawAudioSource sealed {
+			internal:
+				RawAudioSource(MediaAudioTrack^ track);
+				void RawAudioFrame(const Platform::Array<int16>^ samples,
+					uint32 sampleRate, uint32 channels);
+			public:
+				/// <summary>
+				/// Raw audio frame has been received, raised on the thread
+				/// pool.  The samples are only valid during the call.
+				/// </summary>
+				event RawAudioSourceDelegate^ OnRawAudioFrame;
+				/// <summary>
+				/// Sample rate the frames are resampled to, 8000 to 48000,
+				/// 0 for the rate of the track.
+				/// Default value: 0
+				/// </summary>
+				property uint32 SampleRate { uint32 get(); void set(uint32 value); }
+				/// <summary>
+				/// Number of channels the frames are mixed to, 1 or 2, 0 for
+				/// the channels of the track.
+				/// Default value: 0
+				/// </summary>
+				property uint32 Channels { uint32 get(); void set(uint32 value); }
+				/// <summary>
+				/// Maximum number of frames waiting for delivery, the oldest
+				/// ones are dropped.
+				/// Default value: 50
+				/// </summary>
+				property uint32 MaxQueuedFrames { uint32 get(); void set(uint32 value); }
+				/// <summary>
+				/// Number of frames dropped because the delivery queue was full.
+				/// </summary>
+				property uint64 DroppedFrames { uint64 get(); }
+				virtual ~RawAudioSource();
+			private:
+				rtc::scoped_refptr<webrtc::AudioTrackInterface> _track;
+				rtc::scoped_refptr<RawAudioStream> _audioStream;
+				std::atomic<uint32> _sampleRate;
+				std::atomic<uint32> _channels;
 		};
 
 		ref class EncodedVideoSource;
+		ref class VideoCompositor;
+		ref class CustomVideoSource;
+		ref class ScreenCaptureSource;
+		ref class TestPatternVideoSource;
+		ref class VideoLatencyProbe;
+		ref class MediaRecorder;
+
+		/// <summary>
+		/// Frames an <see cref="EncodedVideoSource"/> drops first when its
+		/// delivery queue is full.
+		/// </summary>
+		public enum class EncodedVideoDropPolicy {
+			/// <summary>
+			/// The oldest queued frame is dropped.
+			/// </summary>
+			DropOldest,
+			/// <summary>
+			/// The oldest queued non-IDR frame is dropped, together with the
+			/// frames depending on it up to the next IDR frame, the ones
+			/// pushed after the drop included.
+			/// </summary>
+			DropNonIdrFirst
+		};
+
+		/// <summary>
+		/// Bounded queue delivering encoded samples to an
+		/// <see cref="EncodedVideoSource"/> on the thread pool, so a slow
+		/// subscriber doesn't stall the decoder thread.
+		/// </summary>
+		class EncodedFrameQueue : public rtc::RefCountInterface {
+		public:
+			explicit EncodedFrameQueue(EncodedVideoSource^ videoSource);
+
+			// Queues |sample| without copying it, dropping frames
+			// according to the drop policy if the queue is full.
+			void Push(ComPtr<IMFSample> sample, uint32 width, uint32 height);
+
+			void SetMaxQueuedFrames(uint32 maxQueuedFrames);
+			uint32 GetMaxQueuedFrames();
+			void SetDropPolicy(EncodedVideoDropPolicy dropPolicy);
+			EncodedVideoDropPolicy GetDropPolicy();
+			uint32 GetQueueDepth();
+			uint64 GetDroppedFrames();
+
+		protected:
+			virtual ~EncodedFrameQueue();
+
+		private:
+			struct PendingFrame {
+				ComPtr<IMFSample> sample;
+				uint32 width;
+				uint32 height;
+			};
+
+			// Makes room for one frame.  Called with _critSect held.
+			void DropFrames();
+			void Deliver();
+
+			Platform::WeakReference _videoSource;
+			rtc::CriticalSection _critSect;
+			std::deque<PendingFrame> _frames;
+			bool _delivering;
+			uint32 _maxQueuedFrames;
+			EncodedVideoDropPolicy _dropPolicy;
+			uint64 _droppedFrames;
+			// Set when frames were dropped up to the end of the queue, the
+			// non-IDR frames pushed until the next IDR one are dropped.
+			bool _needsIdr;
+		};
 
 		/// <summary>
 		/// Encoded video stream used as a sink for encoded frames in webrtc engine.
@@ -454,8 +666,10 @@ namespace Org {
 			void OnFrame(const webrtc::VideoFrame& frame) override {
 				RenderFrame(&frame);
 			}
+			rtc::scoped_refptr<EncodedFrameQueue> GetFrameQueue();
 		private:
 			EncodedVideoSource^ _videoSource;
+			rtc::scoped_refptr<EncodedFrameQueue> _frameQueue;
 		};
 
 		/// <summary>
@@ -471,10 +685,38 @@ namespace Org {
 			/// Raw video frame has been received.
 			/// </summary>
 			event EncodedVideoSourceDelegate^ OnEncodedVideoFrame;
+			/// <summary>
+			/// Raise <see cref="OnEncodedVideoFrame"/> on the thread pool
+			/// instead of the decoder thread. Frames are queued without
+			/// being copied.
+			/// Default value: false
+			/// </summary>
+			property bool AsyncDelivery { bool get(); void set(bool value); }
+			/// <summary>
+			/// Maximum number of frames waiting for asynchronous delivery.
+			/// Default value: 30
+			/// </summary>
+			property uint32 MaxQueuedFrames { uint32 get(); void set(uint32 value); }
+			/// <summary>
+			/// Frames dropped first when the delivery queue is full.
+			/// Default value: DropNonIdrFirst
+			/// </summary>
+			property EncodedVideoDropPolicy DropPolicy {
+				EncodedVideoDropPolicy get(); void set(EncodedVideoDropPolicy value);
+			}
+			/// <summary>
+			/// Number of frames currently waiting for asynchronous delivery.
+			/// </summary>
+			property uint32 QueueDepth { uint32 get(); }
+			/// <summary>
+			/// Number of frames dropped because the delivery queue was full.
+			/// </summary>
+			property uint64 DroppedFrames { uint64 get(); }
 			virtual ~EncodedVideoSource();
 		private:
 			std::unique_ptr<EncodedVideoStream> _videoStream;
 			MediaVideoTrack^ _track;
+			std::atomic<bool> _asyncDelivery;
 		};
 
 		/// <summary>
@@ -488,15 +730,64 @@ namespace Org {
 		public ref class Media sealed {
 
 		private:
+			// Renders a track into a MediaElement.  The media source is
+			// created on the UI thread without the decode thread waiting
+			// for it, frames received in the meantime are buffered.
+			// Raw frames larger than the element on screen are scaled down
+			// before being converted, and thinned out to
+			// WebRTC::RenderMaxFramerate.
 			class VideoFrameSink : public rtc::VideoSinkInterface<webrtc::VideoFrame> {
 			public:
-				VideoFrameSink(MediaElement^ mediaElement, String^ id);
+				// Starts creating the media source for |expectedFrameType|,
+				// it is recreated if the first frame is of another type.
+				VideoFrameSink(MediaElement^ mediaElement, String^ id,
+					Internal::VideoFrameType expectedFrameType);
+				virtual ~VideoFrameSink();
 				virtual void OnFrame(const webrtc::VideoFrame& frame) override;
 			private:
-				Internal::VideoFrameType _frameType;
+				// Shared with the handlers queued on the UI thread, which
+				// can run after the sink is destroyed.
+				struct SourceState {
+					SourceState() : frameType(Internal::FrameTypeI420), closed(false),
+						renderWidth(0), renderHeight(0), lastFrameTimeUs(-1),
+						sizeChangedRegistered(false), needsIdr(false) {}
+					rtc::CriticalSection critSect;
+					Internal::VideoFrameType frameType;
+					Internal::RTMediaStreamSource^ mediaSource;
+					std::deque<webrtc::VideoFrame> pendingFrames;
+					bool closed;
+					// Size of the element in physical pixels, 0 until it
+					// is laid out.
+					int renderWidth;
+					int renderHeight;
+					int64_t lastFrameTimeUs;
+					bool sizeChangedRegistered;
+					Windows::Foundation::EventRegistrationToken sizeChangedToken;
+					// Set when all the pending encoded frames were dropped,
+					// the next ones are dropped until an IDR frame.
+					bool needsIdr;
+				};
+				// Frames kept until the media source is ready, the oldest
+				// ones are dropped.
+				static const size_t kMaxPendingFrames = 8;
+
+				// Makes room in the pending frames, called with the lock of
+				// |_state| held.  The encoded frames are dropped up to the
+				// next IDR frame, a key frame is requested if none is
+				// pending.
+				void DropOldestPendingFrames();
+
+				void CreateMediaSource(Internal::VideoFrameType frameType);
+				void TrackRenderSize();
+				// Returns false if the frame is dropped, sets |scaledBuffer|
+				// if it must be rendered smaller.
+				bool AdaptFrame(const webrtc::VideoFrame& frame,
+					rtc::scoped_refptr<webrtc::I420Buffer>* scaledBuffer);
+				void RenderFrame(const webrtc::VideoFrame& frame);
+
 				MediaElement^ _mediaElement;
 				String^ _id;
-				Internal::RTMediaStreamSource^ _mediaSource;
+				std::shared_ptr<SourceState> _state;
 			};
 
 			struct VideoTrackMediaElementPair {
@@ -567,6 +858,14 @@ namespace Org {
 			/// <returns>Raw video source.</returns>
 			RawVideoSource^ CreateRawVideoSource(MediaVideoTrack^ track);
 
+			/// <summary>
+			/// Creates a <see cref="RawAudioSource"/> for an audio track.
+			/// </summary>
+			/// <param name="track">Audio track to create a <see cref="RawAudioSource"/>
+			/// from</param>
+			/// <returns>Raw audio source.</returns>
+			RawAudioSource^ CreateRawAudioSource(MediaAudioTrack^ track);
+
 			/// <summary>
 			/// Creates an <see cref="EncodedVideoSource"/> for a video track.
 			/// </summary>
@@ -575,6 +874,82 @@ namespace Org {
 			/// <returns>Encoded video source.</returns>
 			EncodedVideoSource^ CreateEncodedVideoSource(MediaVideoTrack^ track);
 
+			/// <summary>
+			/// Creates a <see cref="VideoCompositor"/> rendering several
+			/// video tracks into one media element.
+			/// </summary>
+			/// <param name="mediaElement">Element showing the picture</param>
+			/// <param name="id">Id of the media source, as for
+			/// <see cref="CreateMediaStreamSource"/></param>
+			/// <param name="width">Width of the picture</param>
+			/// <param name="height">Height of the picture</param>
+			/// <param name="framerate">Maximum frame rate of the picture,
+			/// 1 to 60</param>
+			/// <returns>Video compositor.</returns>
+			VideoCompositor^ CreateVideoCompositor(MediaElement^ mediaElement,
+				String^ id, uint32 width, uint32 height, uint32 framerate);
+
+			/// <summary>
+			/// Creates a <see cref="CustomVideoSource"/>, a video track fed
+			/// with the frames the application pushes.
+			/// </summary>
+			/// <param name="width">Width of the pushed frames</param>
+			/// <param name="height">Height of the pushed frames</param>
+			/// <param name="framerate">Frame rate of the pushed frames,
+			/// 1 to 60</param>
+			/// <returns>Custom video source.</returns>
+			CustomVideoSource^ CreateCustomVideoSource(uint32 width,
+				uint32 height, uint32 framerate);
+
+			/// <summary>
+			/// Creates a <see cref="ScreenCaptureSource"/>, a video track of
+			/// a display or of a window.
+			/// </summary>
+			/// <param name="item">Display or window to capture, from a
+			/// GraphicsCapturePicker</param>
+			/// <param name="maxWidth">Frames are scaled down to fit in
+			/// maxWidth x maxHeight</param>
+			/// <param name="maxHeight">See maxWidth</param>
+			/// <param name="framerate">Maximum frame rate, 1 to 30</param>
+			/// <returns>Screen capture source.</returns>
+			ScreenCaptureSource^ CreateScreenCaptureSource(
+				Windows::Graphics::Capture::GraphicsCaptureItem^ item,
+				uint32 maxWidth, uint32 maxHeight, uint32 framerate);
+
+			/// <summary>
+			/// Creates a <see cref="TestPatternVideoSource"/>, a video track
+			/// of stamped synthetic frames to measure a call with.
+			/// </summary>
+			/// <param name="width">Width of the frames, at least 64</param>
+			/// <param name="height">Height of the frames, at least 64</param>
+			/// <param name="framerate">Frame rate, 1 to 60</param>
+			/// <returns>Test pattern video source.</returns>
+			TestPatternVideoSource^ CreateTestPatternVideoSource(uint32 width,
+				uint32 height, uint32 framerate);
+
+			/// <summary>
+			/// Creates a <see cref="VideoLatencyProbe"/> measuring the
+			/// frames of a <see cref="TestPatternVideoSource"/> received on
+			/// a track.
+			/// </summary>
+			/// <param name="track">Remote video track</param>
+			/// <returns>Latency probe.</returns>
+			VideoLatencyProbe^ CreateVideoLatencyProbe(MediaVideoTrack^ track);
+
+			/// <summary>
+			/// Creates a <see cref="MediaRecorder"/> writing the tracks to
+			/// a fragmented MP4 file as they are received.
+			/// </summary>
+			/// <param name="stream">Stream of the file, written from its
+			/// current position</param>
+			/// <param name="videoTrack">Remote video track in H264
+			/// passthrough mode, or null</param>
+			/// <param name="audioTrack">Audio track, or null</param>
+			/// <returns>Recorder, recording.</returns>
+			MediaRecorder^ CreateMediaRecorder(
+				Windows::Storage::Streams::IRandomAccessStream^ stream,
+				MediaVideoTrack^ videoTrack, MediaAudioTrack^ audioTrack);
+
 			/// <summary>
 			/// Retrieves system devices that can be used for video capturing (webcams).
 			/// </summary>
@@ -582,6 +957,17 @@ namespace Org {
 			/// (webcams).</returns>
 			IVector<MediaDevice^>^ GetVideoCaptureDevices();
 
+			/// <summary>
+			/// Asynchronous version of <see cref="GetVideoCaptureDevices"/>,
+			/// doesn't block the calling thread while the devices are
+			/// enumerated. Prefer it on the UI thread.
+			/// </summary>
+			/// <returns>
+			/// This is an asynchronous method. The result upon completion is the
+			/// vector of system devices that can be used for video capturing.
+			/// </returns>
+			IAsyncOperation<IVector<MediaDevice^>^>^ GetVideoCaptureDevicesAsync();
+
 			/// <summary>
 			/// Allows switching between webcams.
 			/// </summary>
@@ -589,10 +975,58 @@ namespace Org {
 			void SelectVideoDevice(MediaDevice^ device);
 
 			/// <summary>
-			/// App suspending event handler.
+			/// Retrieves the microphones of the system.
+			/// </summary>
+			/// <returns>
+			/// This is an asynchronous method. The result upon completion is the
+			/// vector of system devices that can be used for audio capturing.
+			/// </returns>
+			IAsyncOperation<IVector<MediaDevice^>^>^ GetAudioCaptureDevicesAsync();
+
+			/// <summary>
+			/// Retrieves the speakers and headsets of the system.
+			/// </summary>
+			/// <returns>
+			/// This is an asynchronous method. The result upon completion is the
+			/// vector of system devices that can be used for audio playout.
+			/// </returns>
+			IAsyncOperation<IVector<MediaDevice^>^>^ GetAudioPlayoutDevicesAsync();
+
+			/// <summary>
+			/// Selects the microphone of the calls, switched at once when
+			/// the audio is already captured.  Only available with
+			/// <see cref="WebRTC::LowLatencyAudio"/>.
+			/// </summary>
+			/// <param name="device">Microphone from
+			/// <see cref="GetAudioCaptureDevicesAsync"/>, null for the default
+			/// communication device.</param>
+			void SelectAudioCaptureDevice(MediaDevice^ device);
+
+			/// <summary>
+			/// Selects the speaker of the calls, switched at once when the
+			/// audio is already played.  Only available with
+			/// <see cref="WebRTC::LowLatencyAudio"/>.
+			/// </summary>
+			/// <param name="device">Speaker from
+			/// <see cref="GetAudioPlayoutDevicesAsync"/>, null for the default
+			/// communication device.</param>
+			void SelectAudioPlayoutDevice(MediaDevice^ device);
+
+			/// <summary>
+			/// App suspending event handler.  Releases the capture devices,
+			/// and the queued frames and pooled samples of the codecs and
+			/// the renderers.  The codecs and the media sources are kept for
+			/// <see cref="OnAppResuming"/>.
 			/// </summary>
 			static void OnAppSuspending();
 
+			/// <summary>
+			/// App resuming event handler.  The encoders send a key frame
+			/// and the decoders request one, so the calls go on without
+			/// rebuilding their pipelines.
+			/// </summary>
+			static void OnAppResuming();
+
 			/// <summary>
 			/// Set display orientation, used to rotate captured video in case the
 			/// capturer is attached to the enclosure.
@@ -619,6 +1053,15 @@ namespace Org {
 			void OnMediaDeviceRemoved(DeviceWatcher^ sender,
 				DeviceInformationUpdate^ args);
 
+			// Rebuilds g_videoDevices, |devInfoCollection| only provides the
+			// enclosure locations and can be null.
+			void UpdateVideoCaptureDevices(
+				const std::vector<cricket::Device>& videoDevices,
+				DeviceInformationCollection^ devInfoCollection);
+
+			static IAsyncOperation<IVector<MediaDevice^>^>^ ToMediaDevicesAsync(
+				Concurrency::task<std::vector<cricket::Device>> devicesTask);
+
 			std::unique_ptr<Internal::WinUWPDeviceManager> _dev_manager;
 			cricket::Device _selectedVideoDevice;
 
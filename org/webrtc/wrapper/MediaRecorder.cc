@@ -0,0 +1,645 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#include "MediaRecorder.h"
+#include <mfapi.h>
+#include <mferror.h>
+#include <string.h>
+#include <algorithm>
+#include "MediaSourceHelper.h"
+#include "webrtc/common_video/video_common_winuwp.h"
+#include "webrtc/rtc_base/logging.h"
+#include "webrtc/rtc_base/timeutils.h"
+#include "third_party/winuwp_h264/Utils/NalScanner.h"
+
+namespace {
+	// About a second and a half of video and audio.
+	const size_t kMaxQueuedEntries = 200;
+	const int kAudioSampleRate = 48000;
+	const UINT32 kAudioChannels = 2;
+	// 128kbps.
+	const UINT32 kAacBytesPerSecond = 16000;
+	const uint8_t kNalUnitTypeSps = 7;
+	const uint8_t kNalUnitTypePps = 8;
+	const uint8_t kStartCode[] = { 0, 0, 0, 1 };
+	const int64_t kRtpTicksPerSecond = 90000;
+	// Until a second frame gives the frame rate.
+	const UINT32 kDefaultFrameRate = 30;
+
+	// The SPS and the PPS of |sample|, with their start codes.
+	std::vector<uint8_t> GetSequenceHeader(IMFSample* sample) {
+		std::vector<uint8_t> header;
+		std::vector<NalUnit> nalUnits;
+		ComPtr<IMFMediaBuffer> buffer;
+		BYTE* data;
+		DWORD maxLength, length;
+		if (FAILED(GetSampleNalUnits(sample, &nalUnits)) ||
+			FAILED(sample->GetBufferByIndex(0, &buffer)) ||
+			FAILED(buffer->Lock(&data, &maxLength, &length))) {
+			return header;
+		}
+		for (auto& nalUnit : nalUnits) {
+			if ((nalUnit.type == kNalUnitTypeSps || nalUnit.type == kNalUnitTypePps) &&
+				nalUnit.offset + nalUnit.length <= length) {
+				header.insert(header.end(), kStartCode, kStartCode + sizeof(kStartCode));
+				header.insert(header.end(), data + nalUnit.offset,
+					data + nalUnit.offset + nalUnit.length);
+			}
+		}
+		buffer->Unlock();
+		return header;
+	}
+}
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			RecorderState::RecorderState(ComPtr<IMFByteStream> byteStream,
+				bool hasVideo, bool hasAudio) :
+				videoFramesWritten(0), audioFramesWritten(0), droppedFrames(0),
+				formatChanged(false),
+				_byteStream(byteStream),
+				_hasVideo(hasVideo), _hasAudio(hasAudio),
+				_writeScheduled(false), _closed(false),
+				_videoNeedsIdr(true), _videoQueued(false),
+				_audioDiscontinuity(false), _unsupportedLogged(false),
+				_rtpTime(-1), _lastRtpTimestamp(0),
+				_videoStreamIndex(0), _audioStreamIndex(0),
+				_writeFailed(false), _startTimeUs(0), _startRtpTime(0),
+				_videoWidth(0), _videoHeight(0), _frameDurationHns(0),
+				_lastVideoTimeHns(-1), _audioStartHns(-1), _audioSamples(0) {
+			}
+
+			void RecorderState::OnVideoFrame(const webrtc::VideoFrame& frame) {
+				webrtc::VideoFrameBuffer* frameBuffer = frame.video_frame_buffer().get();
+				if (!webrtc::IsEncodedNativeBuffer(frameBuffer)) {
+					rtc::CritScope lock(&_critSect);
+					if (!_unsupportedLogged) {
+						_unsupportedLogged = true;
+						LOG(LS_WARNING) << "MediaRecorder only records encoded H264 frames, "
+							"the video track has decoded ones";
+					}
+					return;
+				}
+				IMFSample* sample = (IMFSample*)
+					static_cast<webrtc::NativeHandleBuffer*>(frameBuffer)->native_handle();
+				if (sample == nullptr) {
+					return;
+				}
+				// The same IDR detection as the renderers, cached on the sample.
+				bool idr = IsSampleIDR(sample);
+				Entry entry;
+				entry.type = EntryType::Video;
+				entry.sample = sample;
+				entry.width = (uint32)frame.width();
+				entry.height = (uint32)frame.height();
+				entry.timeUs = rtc::TimeMicros();
+				entry.discontinuity = false;
+
+				rtc::CritScope lock(&_critSect);
+				if (_closed) {
+					return;
+				}
+				// The dropped frames are unwrapped as well, the gaps
+				// between two of them stay below half the range.
+				uint32 rtpTimestamp = frame.timestamp();
+				if (_rtpTime < 0) {
+					_rtpTime = rtpTimestamp;
+				} else {
+					_rtpTime += (int32_t)(rtpTimestamp - _lastRtpTimestamp);
+				}
+				_lastRtpTimestamp = rtpTimestamp;
+				entry.rtpTime = _rtpTime;
+				if (_videoNeedsIdr && !idr) {
+					if (_videoQueued) {
+						++droppedFrames;
+					}
+					return;
+				}
+				_videoNeedsIdr = false;
+				_videoQueued = true;
+				Push(std::move(entry));
+			}
+
+			void RecorderState::OnAudioData(const int16_t* samples, int sampleRate,
+				size_t channels, size_t frames) {
+				if (channels < 1 || channels > 2 || sampleRate <= 0) {
+					return;
+				}
+				{
+					rtc::CritScope lock(&_critSect);
+					// Nothing to sync the audio with before the first IDR frame.
+					if (_closed || (_hasVideo && !_videoQueued)) {
+						return;
+					}
+				}
+				const int16_t* converted = samples;
+				size_t convertedFrames = frames;
+				if (sampleRate != kAudioSampleRate) {
+					_resampler.InitializeIfNeeded(sampleRate, kAudioSampleRate, channels);
+					_resampled.resize((frames * kAudioSampleRate / sampleRate + 1) * channels);
+					int length = _resampler.Resample(samples, frames * channels,
+						_resampled.data(), _resampled.size());
+					if (length <= 0) {
+						return;
+					}
+					converted = _resampled.data();
+					convertedFrames = length / channels;
+				}
+
+				DWORD size = (DWORD)(convertedFrames * kAudioChannels * sizeof(int16_t));
+				ComPtr<IMFMediaBuffer> buffer;
+				ComPtr<IMFSample> sample;
+				BYTE* data;
+				if (FAILED(MFCreateMemoryBuffer(size, &buffer)) ||
+					FAILED(buffer->Lock(&data, nullptr, nullptr))) {
+					return;
+				}
+				if (channels == kAudioChannels) {
+					memcpy(data, converted, size);
+				} else {
+					// Mono to both channels.
+					int16_t* stereo = (int16_t*)data;
+					for (size_t i = 0; i < convertedFrames; ++i) {
+						stereo[2 * i] = converted[i];
+						stereo[2 * i + 1] = converted[i];
+					}
+				}
+				buffer->Unlock();
+				buffer->SetCurrentLength(size);
+				if (FAILED(MFCreateSample(&sample)) || FAILED(sample->AddBuffer(buffer.Get()))) {
+					return;
+				}
+				Entry entry;
+				entry.type = EntryType::Audio;
+				entry.sample = sample;
+				entry.width = 0;
+				entry.height = 0;
+				entry.timeUs = rtc::TimeMicros();
+				entry.rtpTime = 0;
+
+				rtc::CritScope lock(&_critSect);
+				if (_closed) {
+					return;
+				}
+				entry.discontinuity = _audioDiscontinuity;
+				_audioDiscontinuity = false;
+				Push(std::move(entry));
+			}
+
+			void RecorderState::Push(Entry entry) {
+				if (_entries.size() >= kMaxQueuedEntries) {
+					++droppedFrames;
+					if (entry.type == EntryType::Video) {
+						_videoNeedsIdr = true;
+					} else {
+						_audioDiscontinuity = true;
+					}
+					return;
+				}
+				_entries.push_back(std::move(entry));
+				if (_writeScheduled) {
+					return;
+				}
+				_writeScheduled = true;
+				std::shared_ptr<RecorderState> self = shared_from_this();
+				Windows::System::Threading::ThreadPool::RunAsync(
+					ref new Windows::System::Threading::WorkItemHandler(
+					[self](Windows::Foundation::IAsyncAction^) {
+					self->WritePending();
+				}));
+			}
+
+			void RecorderState::WritePending() {
+				rtc::CritScope writeLock(&_writeCritSect);
+				while (true) {
+					Entry entry;
+					{
+						rtc::CritScope lock(&_critSect);
+						if (_entries.empty()) {
+							_writeScheduled = false;
+							return;
+						}
+						entry = std::move(_entries.front());
+						_entries.pop_front();
+					}
+					WriteEntry(entry);
+				}
+			}
+
+			HRESULT RecorderState::StartWriting(const Entry& entry, int64_t frameTicks) {
+				ComPtr<IMFAttributes> attributes;
+				HRESULT hr = MFCreateAttributes(&attributes, 3);
+				if (SUCCEEDED(hr)) {
+					hr = attributes->SetGUID(MF_TRANSCODE_CONTAINERTYPE,
+						MFTranscodeContainerType_FMPEG4);
+				}
+				if (SUCCEEDED(hr)) {
+					// Live sources, the writer mustn't wait for them.
+					hr = attributes->SetUINT32(MF_SINK_WRITER_DISABLE_THROTTLING, TRUE);
+				}
+				if (SUCCEEDED(hr)) {
+					hr = attributes->SetUINT32(MF_READWRITE_ENABLE_HARDWARE_TRANSFORMS, TRUE);
+				}
+				ComPtr<IMFSinkWriter> sinkWriter;
+				if (SUCCEEDED(hr)) {
+					hr = MFCreateSinkWriterFromURL(L".mp4", _byteStream.Get(),
+						attributes.Get(), &sinkWriter);
+				}
+
+				if (SUCCEEDED(hr) && _hasVideo) {
+					// Same type in and out, the samples are only muxed.
+					ComPtr<IMFMediaType> videoType;
+					hr = MFCreateMediaType(&videoType);
+					if (SUCCEEDED(hr)) {
+						hr = videoType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+					}
+					if (SUCCEEDED(hr)) {
+						hr = videoType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_H264);
+					}
+					if (SUCCEEDED(hr)) {
+						hr = MFSetAttributeSize(videoType.Get(), MF_MT_FRAME_SIZE,
+							entry.width, entry.height);
+					}
+					// The rate of the first two frames, the sample times
+					// are those of the frames anyway.
+					if (frameTicks <= 0 || frameTicks > kRtpTicksPerSecond) {
+						frameTicks = kRtpTicksPerSecond / kDefaultFrameRate;
+					}
+					_frameDurationHns = (LONGLONG)(frameTicks * 10000000 / kRtpTicksPerSecond);
+					if (SUCCEEDED(hr)) {
+						hr = MFSetAttributeRatio(videoType.Get(), MF_MT_FRAME_RATE,
+							(UINT32)kRtpTicksPerSecond, (UINT32)frameTicks);
+					}
+					if (SUCCEEDED(hr)) {
+						hr = MFSetAttributeRatio(videoType.Get(), MF_MT_PIXEL_ASPECT_RATIO, 1, 1);
+					}
+					if (SUCCEEDED(hr)) {
+						hr = videoType->SetUINT32(MF_MT_INTERLACE_MODE,
+							MFVideoInterlace_Progressive);
+					}
+					// The sample description of the track, from the IDR frame.
+					_sequenceHeader = GetSequenceHeader(entry.sample.Get());
+					if (SUCCEEDED(hr) && !_sequenceHeader.empty()) {
+						hr = videoType->SetBlob(MF_MT_MPEG_SEQUENCE_HEADER,
+							_sequenceHeader.data(), (UINT32)_sequenceHeader.size());
+					}
+					if (SUCCEEDED(hr)) {
+						hr = sinkWriter->AddStream(videoType.Get(), &_videoStreamIndex);
+					}
+					if (SUCCEEDED(hr)) {
+						hr = sinkWriter->SetInputMediaType(_videoStreamIndex,
+							videoType.Get(), nullptr);
+					}
+				}
+
+				if (SUCCEEDED(hr) && _hasAudio) {
+					ComPtr<IMFMediaType> aacType;
+					hr = MFCreateMediaType(&aacType);
+					if (SUCCEEDED(hr)) {
+						hr = aacType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Audio);
+					}
+					if (SUCCEEDED(hr)) {
+						hr = aacType->SetGUID(MF_MT_SUBTYPE, MFAudioFormat_AAC);
+					}
+					if (SUCCEEDED(hr)) {
+						hr = aacType->SetUINT32(MF_MT_AUDIO_BITS_PER_SAMPLE, 16);
+					}
+					if (SUCCEEDED(hr)) {
+						hr = aacType->SetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, kAudioSampleRate);
+					}
+					if (SUCCEEDED(hr)) {
+						hr = aacType->SetUINT32(MF_MT_AUDIO_NUM_CHANNELS, kAudioChannels);
+					}
+					if (SUCCEEDED(hr)) {
+						hr = aacType->SetUINT32(MF_MT_AUDIO_AVG_BYTES_PER_SECOND,
+							kAacBytesPerSecond);
+					}
+					if (SUCCEEDED(hr)) {
+						hr = sinkWriter->AddStream(aacType.Get(), &_audioStreamIndex);
+					}
+
+					ComPtr<IMFMediaType> pcmType;
+					if (SUCCEEDED(hr)) {
+						hr = MFCreateMediaType(&pcmType);
+					}
+					if (SUCCEEDED(hr)) {
+						hr = pcmType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Audio);
+					}
+					if (SUCCEEDED(hr)) {
+						hr = pcmType->SetGUID(MF_MT_SUBTYPE, MFAudioFormat_PCM);
+					}
+					if (SUCCEEDED(hr)) {
+						hr = pcmType->SetUINT32(MF_MT_AUDIO_BITS_PER_SAMPLE, 16);
+					}
+					if (SUCCEEDED(hr)) {
+						hr = pcmType->SetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, kAudioSampleRate);
+					}
+					if (SUCCEEDED(hr)) {
+						hr = pcmType->SetUINT32(MF_MT_AUDIO_NUM_CHANNELS, kAudioChannels);
+					}
+					if (SUCCEEDED(hr)) {
+						hr = pcmType->SetUINT32(MF_MT_AUDIO_BLOCK_ALIGNMENT,
+							kAudioChannels * sizeof(int16_t));
+					}
+					if (SUCCEEDED(hr)) {
+						hr = pcmType->SetUINT32(MF_MT_AUDIO_AVG_BYTES_PER_SECOND,
+							kAudioSampleRate * kAudioChannels * sizeof(int16_t));
+					}
+					if (SUCCEEDED(hr)) {
+						hr = sinkWriter->SetInputMediaType(_audioStreamIndex,
+							pcmType.Get(), nullptr);
+					}
+				}
+
+				if (SUCCEEDED(hr)) {
+					hr = sinkWriter->BeginWriting();
+				}
+				if (SUCCEEDED(hr)) {
+					_sinkWriter = sinkWriter;
+					_startTimeUs = entry.timeUs;
+					_startRtpTime = entry.rtpTime;
+					_videoWidth = entry.width;
+					_videoHeight = entry.height;
+					LOG(LS_INFO) << "MediaRecorder started"
+						<< (_hasVideo ? ", video " : "")
+						<< (_hasVideo ? std::to_string(entry.width) + "x" +
+							std::to_string(entry.height) : "")
+						<< (_hasAudio ? ", audio" : "");
+				}
+				return hr;
+			}
+
+			void RecorderState::WriteEntry(const Entry& entry) {
+				if (_writeFailed) {
+					return;
+				}
+				if (_sinkWriter != nullptr) {
+					WriteSample(entry);
+					return;
+				}
+				HRESULT hr;
+				if (!_hasVideo) {
+					hr = StartWriting(entry, 0);
+				} else if (_heldEntries.empty()) {
+					// The audio before the first IDR frame isn't recorded.
+					if (entry.type == EntryType::Video) {
+						_heldEntries.push_back(entry);
+					}
+					return;
+				} else if (entry.type == EntryType::Audio) {
+					_heldEntries.push_back(entry);
+					return;
+				} else {
+					hr = StartWriting(_heldEntries.front(),
+						entry.rtpTime - _heldEntries.front().rtpTime);
+				}
+				if (FAILED(hr)) {
+					LOG(LS_ERROR) << "MediaRecorder can't start writing, hr=" << hr;
+					_writeFailed = true;
+					_heldEntries.clear();
+					return;
+				}
+				std::vector<Entry> held;
+				held.swap(_heldEntries);
+				for (auto& heldEntry : held) {
+					WriteSample(heldEntry);
+				}
+				WriteSample(entry);
+			}
+
+			void RecorderState::StopOnFormatChange(const Entry& entry) {
+				LOG(LS_WARNING) << "MediaRecorder stopped, the video changed from "
+					<< _videoWidth << "x" << _videoHeight << " to "
+					<< entry.width << "x" << entry.height
+					<< " or its sequence parameters changed";
+				{
+					rtc::CritScope lock(&_critSect);
+					_closed = true;
+					_entries.clear();
+				}
+				formatChanged = true;
+				_writeFailed = true;
+				HRESULT hr = _sinkWriter->Finalize();
+				if (FAILED(hr)) {
+					LOG(LS_ERROR) << "MediaRecorder finalize failed, hr=" << hr;
+				}
+				_sinkWriter.Reset();
+			}
+
+			void RecorderState::WriteSample(const Entry& entry) {
+				if (_writeFailed) {
+					return;
+				}
+				HRESULT hr;
+				LONGLONG timeHns = std::max<int64_t>(0, entry.timeUs - _startTimeUs) * 10;
+				if (entry.type == EntryType::Video) {
+					bool idr = IsSampleIDR(entry.sample.Get());
+					if (entry.width != _videoWidth || entry.height != _videoHeight) {
+						StopOnFormatChange(entry);
+						return;
+					}
+					if (idr) {
+						std::vector<uint8_t> sequenceHeader =
+							GetSequenceHeader(entry.sample.Get());
+						if (!sequenceHeader.empty() && sequenceHeader != _sequenceHeader) {
+							StopOnFormatChange(entry);
+							return;
+						}
+					}
+					// Placed with the RTP timestamps, the arrival times
+					// carry the network jitter.
+					timeHns = std::max<int64_t>(0, entry.rtpTime - _startRtpTime) *
+						10000000 / kRtpTicksPerSecond;
+					// A sample of our own on the same buffer, the received
+					// one is shared with the renderers.
+					ComPtr<IMFMediaBuffer> buffer;
+					ComPtr<IMFSample> sample;
+					hr = entry.sample->GetBufferByIndex(0, &buffer);
+					if (SUCCEEDED(hr)) {
+						hr = MFCreateSample(&sample);
+					}
+					if (SUCCEEDED(hr)) {
+						hr = sample->AddBuffer(buffer.Get());
+					}
+					if (SUCCEEDED(hr)) {
+						timeHns = std::max(timeHns, _lastVideoTimeHns + 1);
+						sample->SetSampleTime(timeHns);
+						// The duration of the previous frame, the best guess.
+						sample->SetSampleDuration(_lastVideoTimeHns >= 0 ?
+							timeHns - _lastVideoTimeHns : _frameDurationHns);
+						if (idr) {
+							sample->SetUINT32(MFSampleExtension_CleanPoint, TRUE);
+						}
+						_lastVideoTimeHns = timeHns;
+						hr = _sinkWriter->WriteSample(_videoStreamIndex, sample.Get());
+					}
+					if (SUCCEEDED(hr)) {
+						++videoFramesWritten;
+					}
+				} else {
+					if (_audioStartHns < 0 || entry.discontinuity) {
+						_audioStartHns = timeHns;
+						_audioSamples = 0;
+					}
+					DWORD length = 0;
+					entry.sample->GetTotalLength(&length);
+					uint64 frames = length / (kAudioChannels * sizeof(int16_t));
+					entry.sample->SetSampleTime(_audioStartHns +
+						(LONGLONG)(_audioSamples * 10000000 / kAudioSampleRate));
+					entry.sample->SetSampleDuration(
+						(LONGLONG)(frames * 10000000 / kAudioSampleRate));
+					_audioSamples += frames;
+					hr = _sinkWriter->WriteSample(_audioStreamIndex, entry.sample.Get());
+					if (SUCCEEDED(hr)) {
+						++audioFramesWritten;
+					}
+				}
+				if (FAILED(hr)) {
+					LOG(LS_ERROR) << "MediaRecorder write failed, hr=" << hr;
+					_writeFailed = true;
+				}
+			}
+
+			void RecorderState::Finish() {
+				{
+					rtc::CritScope lock(&_critSect);
+					_closed = true;
+				}
+				rtc::CritScope writeLock(&_writeCritSect);
+				WritePending();
+				if (_sinkWriter == nullptr && !_heldEntries.empty() && !_writeFailed) {
+					// A single frame recorded, at the default frame rate.
+					HRESULT hr = StartWriting(_heldEntries.front(), 0);
+					std::vector<Entry> held;
+					held.swap(_heldEntries);
+					if (FAILED(hr)) {
+						LOG(LS_ERROR) << "MediaRecorder can't start writing, hr=" << hr;
+						_writeFailed = true;
+					} else {
+						for (auto& heldEntry : held) {
+							WriteSample(heldEntry);
+						}
+					}
+				}
+				if (_sinkWriter != nullptr) {
+					HRESULT hr = _sinkWriter->Finalize();
+					if (FAILED(hr)) {
+						LOG(LS_ERROR) << "MediaRecorder finalize failed, hr=" << hr;
+					}
+					LOG(LS_INFO) << "MediaRecorder stopped, video frames="
+						<< videoFramesWritten << " audio frames=" << audioFramesWritten
+						<< " dropped=" << droppedFrames;
+					_sinkWriter.Reset();
+				}
+			}
+
+			RecorderVideoSink::RecorderVideoSink(std::shared_ptr<RecorderState> state) :
+				_state(state) {
+			}
+
+			void RecorderVideoSink::OnFrame(const webrtc::VideoFrame& frame) {
+				_state->OnVideoFrame(frame);
+			}
+
+			RecorderAudioSink::RecorderAudioSink(std::shared_ptr<RecorderState> state) :
+				_state(state) {
+			}
+
+			void RecorderAudioSink::OnData(const void* audio_data, int bits_per_sample,
+				int sample_rate, size_t number_of_channels, size_t number_of_frames) {
+				if (bits_per_sample != 16) {
+					return;
+				}
+				_state->OnAudioData((const int16_t*)audio_data, sample_rate,
+					number_of_channels, number_of_frames);
+			}
+		}
+
+		// = MediaRecorder ===========================================================
+
+		MediaRecorder::MediaRecorder(IRandomAccessStream^ stream,
+			MediaVideoTrack^ videoTrack, MediaAudioTrack^ audioTrack) :
+			_videoTrack(videoTrack),
+			_detached(false) {
+			if (stream == nullptr) {
+				THROW_WEBRTC_NULL_REFERENCE_EXCEPTION("Invalid stream");
+			}
+			if (videoTrack == nullptr && audioTrack == nullptr) {
+				THROW_WEBRTC_NULL_REFERENCE_EXCEPTION("No track to record");
+			}
+			ComPtr<IMFByteStream> byteStream;
+			HRESULT hr = MFCreateMFByteStreamOnStreamEx(
+				reinterpret_cast<IUnknown*>(stream), &byteStream);
+			if (FAILED(hr)) {
+				LOG(LS_ERROR) << "MediaRecorder: can't use the stream, hr=" << hr;
+				throw ref new Platform::COMException(hr);
+			}
+			_state = std::make_shared<Internal::RecorderState>(byteStream,
+				videoTrack != nullptr, audioTrack != nullptr);
+			if (videoTrack != nullptr) {
+				_videoSink.reset(new Internal::RecorderVideoSink(_state));
+				_videoTrack->SetRenderer(_videoSink.get());
+			}
+			if (audioTrack != nullptr) {
+				_audioTrack = audioTrack->GetImpl();
+				_audioSink.reset(new Internal::RecorderAudioSink(_state));
+				_audioTrack->AddSink(_audioSink.get());
+			}
+		}
+
+		MediaRecorder::~MediaRecorder() {
+			Detach();
+			// Not stopped, the file is finalized in the background.
+			std::shared_ptr<Internal::RecorderState> state = _state;
+			Windows::System::Threading::ThreadPool::RunAsync(
+				ref new Windows::System::Threading::WorkItemHandler(
+				[state](Windows::Foundation::IAsyncAction^) {
+				state->Finish();
+			}));
+		}
+
+		void MediaRecorder::Detach() {
+			if (_detached) {
+				return;
+			}
+			_detached = true;
+			if (_videoSink != nullptr) {
+				_videoTrack->UnsetRenderer(_videoSink.get());
+			}
+			if (_audioSink != nullptr) {
+				_audioTrack->RemoveSink(_audioSink.get());
+			}
+		}
+
+		IAsyncAction^ MediaRecorder::StopAsync() {
+			Detach();
+			std::shared_ptr<Internal::RecorderState> state = _state;
+			return Concurrency::create_async([state] {
+				state->Finish();
+			});
+		}
+
+		uint64 MediaRecorder::VideoFramesWritten::get() {
+			return _state->videoFramesWritten;
+		}
+
+		uint64 MediaRecorder::AudioFramesWritten::get() {
+			return _state->audioFramesWritten;
+		}
+
+		uint64 MediaRecorder::DroppedFrames::get() {
+			return _state->droppedFrames;
+		}
+
+		bool MediaRecorder::StoppedOnFormatChange::get() {
+			return _state->formatChanged;
+		}
+	}
+}  // namespace Org.WebRtc
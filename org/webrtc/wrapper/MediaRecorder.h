@@ -0,0 +1,211 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#ifndef ORG_WEBRTC_MEDIARECORDER_H_
+#define ORG_WEBRTC_MEDIARECORDER_H_
+
+#include <mfidl.h>
+#include <mfreadwrite.h>
+#include <wrl.h>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+#include "Media.h"
+
+#pragma comment(lib, "mfreadwrite")
+#pragma comment(lib, "mfplat")
+#pragma comment(lib, "mfuuid")
+
+using Microsoft::WRL::ComPtr;
+using Windows::Foundation::IAsyncAction;
+using Windows::Storage::Streams::IRandomAccessStream;
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			// Shared by the sinks of the tracks and the writing on the
+			// thread pool, outlives the recorder until the file is
+			// finalized.
+			class RecorderState : public std::enable_shared_from_this<RecorderState> {
+			public:
+				RecorderState(ComPtr<IMFByteStream> byteStream, bool hasVideo,
+					bool hasAudio);
+
+				// Decoder thread.  Only encoded frames are recorded.
+				void OnVideoFrame(const webrtc::VideoFrame& frame);
+				// Audio thread.
+				void OnAudioData(const int16_t* samples, int sampleRate,
+					size_t channels, size_t frames);
+				// No more frames are taken, writes the queued ones and
+				// finalizes the file.  Blocks on the writing.
+				void Finish();
+
+				std::atomic<uint64> videoFramesWritten;
+				std::atomic<uint64> audioFramesWritten;
+				std::atomic<uint64> droppedFrames;
+				// The recording stopped at a change of the video format.
+				std::atomic<bool> formatChanged;
+
+			private:
+				enum class EntryType { Video, Audio };
+				struct Entry {
+					EntryType type;
+					ComPtr<IMFSample> sample;
+					uint32 width;
+					uint32 height;
+					// Arrival time, the audio is placed with it.
+					int64_t timeUs;
+					// Of a video frame, unwrapped, in 90kHz ticks.
+					int64_t rtpTime;
+					// Audio was dropped before this frame.
+					bool discontinuity;
+				};
+
+				// Called with |_critSect| held.
+				void Push(Entry entry);
+				void WritePending();
+				// Builds the sink writer when the frame after the first IDR
+				// frame, or the first audio without a video track, is
+				// written.  |frameTicks| is the RTP interval of the first
+				// two frames, 0 if unknown.
+				HRESULT StartWriting(const Entry& entry, int64_t frameTicks);
+				void WriteEntry(const Entry& entry);
+				void WriteSample(const Entry& entry);
+				// A sample description can't change within the file, it
+				// is finalized and the recording stops.
+				void StopOnFormatChange(const Entry& entry);
+
+				const ComPtr<IMFByteStream> _byteStream;
+				const bool _hasVideo;
+				const bool _hasAudio;
+
+				rtc::CriticalSection _critSect;
+				// Guarded by |_critSect|.
+				std::deque<Entry> _entries;
+				bool _writeScheduled;
+				bool _closed;
+				// Frames are dropped up to the next IDR frame, the first
+				// one included.
+				bool _videoNeedsIdr;
+				bool _videoQueued;
+				bool _audioDiscontinuity;
+				bool _unsupportedLogged;
+				// Unwraps the RTP timestamps of the frames, -1 before the
+				// first one.
+				int64_t _rtpTime;
+				uint32 _lastRtpTimestamp;
+
+				// Audio thread only.
+				webrtc::PushResampler<int16_t> _resampler;
+				std::vector<int16_t> _resampled;
+
+				// Guards the writing, taken by the thread pool and Finish().
+				rtc::CriticalSection _writeCritSect;
+				ComPtr<IMFSinkWriter> _sinkWriter;
+				DWORD _videoStreamIndex;
+				DWORD _audioStreamIndex;
+				bool _writeFailed;
+				// The first IDR frame and the audio after it, written
+				// once the frame rate is known from the next frame.
+				std::vector<Entry> _heldEntries;
+				// Of the first IDR frame, the video samples are placed
+				// with their RTP timestamps from it.
+				int64_t _startTimeUs;
+				int64_t _startRtpTime;
+				// The sample description of the video track.
+				uint32 _videoWidth;
+				uint32 _videoHeight;
+				std::vector<uint8_t> _sequenceHeader;
+				LONGLONG _frameDurationHns;
+				int64_t _lastVideoTimeHns;
+				// The audio timeline is continuous, in samples from its
+				// start, -1 until the first audio.
+				int64_t _audioStartHns;
+				uint64 _audioSamples;
+			};
+
+			class RecorderVideoSink : public rtc::VideoSinkInterface<webrtc::VideoFrame> {
+			public:
+				explicit RecorderVideoSink(std::shared_ptr<RecorderState> state);
+				void OnFrame(const webrtc::VideoFrame& frame) override;
+
+			private:
+				std::shared_ptr<RecorderState> _state;
+			};
+
+			class RecorderAudioSink : public webrtc::AudioTrackSinkInterface {
+			public:
+				explicit RecorderAudioSink(std::shared_ptr<RecorderState> state);
+				void OnData(const void* audio_data, int bits_per_sample,
+					int sample_rate, size_t number_of_channels,
+					size_t number_of_frames) override;
+
+			private:
+				std::shared_ptr<RecorderState> _state;
+			};
+		}
+
+		/// <summary>
+		/// Records a call to a fragmented MP4 file without transcoding the
+		/// video: the H.264 samples of the video track are written as they
+		/// were received, starting with an IDR frame.  The audio is encoded
+		/// to AAC, 48kHz stereo.  The video track must carry the encoded
+		/// frames, a remote track with <see cref="WebRTC::H264DecodingMode"/>
+		/// set to Passthrough.  A fragmented file stays playable up to the
+		/// last fragment if the recording is interrupted.
+		/// </summary>
+		public ref class MediaRecorder sealed {
+		internal:
+			MediaRecorder(IRandomAccessStream^ stream, MediaVideoTrack^ videoTrack,
+				MediaAudioTrack^ audioTrack);
+
+		public:
+			virtual ~MediaRecorder();
+
+			/// <summary>
+			/// Stops recording and finalizes the file.
+			/// </summary>
+			IAsyncAction^ StopAsync();
+
+			/// <summary>
+			/// Number of video frames written.
+			/// </summary>
+			property uint64 VideoFramesWritten { uint64 get(); }
+			/// <summary>
+			/// Number of 10ms audio frames written.
+			/// </summary>
+			property uint64 AudioFramesWritten { uint64 get(); }
+			/// <summary>
+			/// Number of frames dropped because the writing didn't keep
+			/// up, the video resumes from the next IDR frame.
+			/// </summary>
+			property uint64 DroppedFrames { uint64 get(); }
+			/// <summary>
+			/// True if the recording stopped because the resolution or the
+			/// sequence parameters of the video changed, which a track of
+			/// the file can't.  The file is finalized up to the change.
+			/// </summary>
+			property bool StoppedOnFormatChange { bool get(); }
+
+		private:
+			// Detaches the sinks, once.
+			void Detach();
+
+			std::shared_ptr<Internal::RecorderState> _state;
+			MediaVideoTrack^ _videoTrack;
+			rtc::scoped_refptr<webrtc::AudioTrackInterface> _audioTrack;
+			std::unique_ptr<Internal::RecorderVideoSink> _videoSink;
+			std::unique_ptr<Internal::RecorderAudioSink> _audioSink;
+			bool _detached;
+		};
+	}
+}  // namespace Org.WebRtc
+
+#endif  // ORG_WEBRTC_MEDIARECORDER_H_
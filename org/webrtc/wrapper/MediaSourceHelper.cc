@@ -7,13 +7,20 @@
 // be found in the AUTHORS file in the root of the source tree.
 
 #include "MediaSourceHelper.h"
+#include "Marshalling.h"
 #include <mfapi.h>
 #include <ppltasks.h>
 #include <mfidl.h>
+#include <algorithm>
+#include <cmath>
 #include "webrtc/media/base/videosourceinterface.h"
 #include "libyuv/convert.h"
 #include "webrtc/modules/video_coding/timing.h"
+#include "webrtc/rtc_base/logging.h"
+#include "webrtc/rtc_base/timeutils.h"
+#include "../stats/etw_providers.h"
 #include "third_party/winuwp_h264/H264Decoder/H264Decoder.h"
+#include "third_party/winuwp_h264/Utils/NalScanner.h"
 
 using Microsoft::WRL::ComPtr;
 using Platform::Collections::Vector;
@@ -32,18 +39,156 @@ namespace Org {
 		namespace Internal {
 
 			// Helper functions defined below.
-			bool IsSampleIDR(IMFSample* sample);
-			bool DropFramesToIDR(std::list<webrtc::VideoFrame*>& frames);
+			bool IsFrameIDR(webrtc::VideoFrame* frame);
 
 
 			SampleData::SampleData()
 				: sizeHasChanged(false)
 				, size({ -1, -1 })
 				, rotationHasChanged(false)
-				, rotation(-1) {
+				, rotation(-1)
+				, rtpTimestamp(0)
+				, arrivalTimeUs(0) {
+			}
+
+			namespace {
+				const double kDefaultFrameIntervalMs = 1000.0 / 30;
+				const double kMinFrameIntervalMs = 5;
+				const double kMaxFrameIntervalMs = 200;
+				// Gaps longer than this are pauses, not jitter.
+				const int64_t kMaxArrivalGapMs = 1000;
+				const int kMinFutureOffsetMs = 15;
+				const int kMaxFutureOffsetMs = 150;
+				const size_t kMinBacklog = 2;
+				// The trimming stops once the frames wait less than this
+				// part of the budget.
+				const double kTrimmingEndRatio = 0.75;
+			}
+
+			RenderLatencyController::RenderLatencyController() {
+				Reset();
+			}
+
+			void RenderLatencyController::Reset() {
+				_lastArrivalTimeMs = 0;
+				_frameIntervalMs = kDefaultFrameIntervalMs;
+				_jitterMs = 0;
+				_residencyMs = 0;
+				_trimming = false;
+			}
+
+			void RenderLatencyController::OnFrameDequeued(int64_t arrivalTimeMs,
+				int64_t nowMs, int framesSkipped) {
+				_residencyMs += ((double)(nowMs - arrivalTimeMs) - _residencyMs) / 16;
+				if (_lastArrivalTimeMs != 0) {
+					int64_t gapMs = arrivalTimeMs - _lastArrivalTimeMs;
+					if (gapMs >= 0 && gapMs < kMaxArrivalGapMs) {
+						double intervalMs = (double)gapMs / (framesSkipped + 1);
+						// Same smoothing as the RTP interarrival jitter.
+						_jitterMs += (std::abs(intervalMs - _frameIntervalMs) - _jitterMs) / 16;
+						_frameIntervalMs += (intervalMs - _frameIntervalMs) / 16;
+						_frameIntervalMs = std::max(kMinFrameIntervalMs,
+							std::min(kMaxFrameIntervalMs, _frameIntervalMs));
+					}
+				}
+				_lastArrivalTimeMs = arrivalTimeMs;
+				double budgetMs = GetBacklogBudgetMs();
+				if (_residencyMs > budgetMs) {
+					_trimming = true;
+				} else if (_residencyMs < budgetMs * kTrimmingEndRatio) {
+					_trimming = false;
+				}
+			}
+
+			int RenderLatencyController::GetFutureOffsetMs() const {
+				// Enough to absorb a late frame without holding an on time one.
+				int offsetMs = (int)(_frameIntervalMs / 2 + 2 * _jitterMs);
+				return std::max(kMinFutureOffsetMs, std::min(kMaxFutureOffsetMs, offsetMs));
+			}
+
+			LONGLONG RenderLatencyController::GetFrameDurationHns() const {
+				return (LONGLONG)(_frameIntervalMs * 1000 * 10);
+			}
+
+			double RenderLatencyController::GetBacklogBudgetMs() const {
+				return GetFutureOffsetMs() + 4 * _jitterMs;
+			}
+
+			size_t RenderLatencyController::GetMaxBacklog() const {
+				// Frames covering the offset and the jitter, plus the one
+				// being rendered.
+				size_t backlog = (size_t)std::ceil(
+					GetBacklogBudgetMs() / _frameIntervalMs) + 1;
+				if (_trimming) {
+					// Frames already wait longer than the budget, trim harder.
+					backlog /= 2;
+				}
+				return std::max(kMinBacklog, backlog);
+			}
+
+			LatencyStat::LatencyStat() :
+				_count(0), _totalUs(0), _maxUs(0) {
+			}
+
+			void LatencyStat::Add(int64_t latencyUs) {
+				if (latencyUs < 0) {
+					return;
+				}
+				++_count;
+				_totalUs += latencyUs;
+				int64_t maxUs = _maxUs.load();
+				while (latencyUs > maxUs &&
+					!_maxUs.compare_exchange_weak(maxUs, latencyUs)) {
+				}
+			}
+
+			uint64_t LatencyStat::GetCount() const {
+				return _count.load();
+			}
+
+			double LatencyStat::GetAverageMs() const {
+				uint64_t count = _count.load();
+				if (count == 0) {
+					return 0;
+				}
+				return (double)_totalUs.load() / count / rtc::kNumMicrosecsPerMillisec;
+			}
+
+			double LatencyStat::GetMaxMs() const {
+				return (double)_maxUs.load() / rtc::kNumMicrosecsPerMillisec;
+			}
+
+			RendererStatsData::RendererStatsData()
+				: framesQueued(0)
+				, framesRendered(0)
+				, framesReplaced(0)
+				, framesDroppedToIdr(0)
+				, framesLost(0)
+				, receiveToQueueMs(0)
+				, maxReceiveToQueueMs(0)
+				, queueResidencyMs(0)
+				, maxQueueResidencyMs(0)
+				, sampleRequestWaitMs(0)
+				, maxSampleRequestWaitMs(0)
+				, conversionMs(0)
+				, maxConversionMs(0) {
+			}
+
+			namespace {
+				// Live helpers, for the renderer statistics.
+				rtc::CriticalSection& HelpersLock() {
+					static rtc::CriticalSection lock;
+					return lock;
+				}
+
+				std::vector<MediaSourceHelper*>& Helpers() {
+					static std::vector<MediaSourceHelper*> helpers;
+					return helpers;
+				}
 			}
 
 			MediaSourceHelper::MediaSourceHelper(
+				const std::string& id,
 				VideoFrameType frameType,
 				std::function<HRESULT(webrtc::VideoFrame* frame, IMFSample** sample)> mkSample,
 				std::function<void(int)> fpsCallback)
@@ -51,56 +196,137 @@ namespace Org {
 				, _fpsCallback(fpsCallback)
 				, _frameType(frameType)
 				, _isFirstFrame(true)
-				, _futureOffsetMs(45)
 				, _lastSampleTime(0)
 				, _lastSize({ 0, 0 })
 				, _lastRotation(-1)
 				, _frameCounter(0)
 				, _startTime(0)
-				, _lastTimeFPSCalculated(rtc::TimeMillis()) {
-
+				, _lastTimeFPSCalculated(rtc::TimeMillis())
+				, _h264Frames(MaxQueuedH264Frames)
+				, _h264FramesLost(false)
+				, _i420Frame(nullptr)
+				, _i420FramesSkipped(0)
+				, _frameMemory("Renderer")
+				, _id(id)
+				, _framesQueued(0)
+				, _framesReplaced(0)
+				, _framesLost(0)
+				, _wrongTypeLogged(false)
+				, _framesRendered(0)
+				, _framesDroppedToIdr(0)
+				, _sampleRequestTimeUs(0) {
+				if (_frameType == FrameTypeI420) {
+					_samplePool = Microsoft::WRL::Make<SamplePool>();
+				}
+				rtc::CritScope lock(&HelpersLock());
+				Helpers().push_back(this);
 			}
 			MediaSourceHelper::~MediaSourceHelper() {
+				{
+					// Before taking our own lock, GetAllStats() takes them
+					// in that order.
+					rtc::CritScope lock(&HelpersLock());
+					auto& helpers = Helpers();
+					helpers.erase(std::remove(helpers.begin(), helpers.end(), this),
+						helpers.end());
+				}
 				rtc::CritScope lock(&_critSect);
+				if (_samplePool != nullptr) {
+					LOG(LS_INFO) << "MediaSourceHelper sample pool hits="
+						<< _samplePool->GetHitCount()
+						<< " misses=" << _samplePool->GetMissCount();
+					// Samples still held by Media Foundation keep the pool
+					// alive, make sure they are not recycled anymore.
+					_samplePool->Shutdown();
+				}
 				// Clear the buffered frames.
-				while (!_frames.empty()) {
-					std::unique_ptr<webrtc::VideoFrame> frame(_frames.front());
-					_frames.pop_front();
+				FlushFrames();
+			}
+
+			// Bytes |frame| holds while it is queued.
+			static size_t GetFrameBytes(const webrtc::VideoFrame* frame) {
+				webrtc::VideoFrameBuffer* buffer = frame->video_frame_buffer().get();
+				if (webrtc::IsEncodedNativeBuffer(buffer)) {
+					IMFSample* sample = (IMFSample*)
+						static_cast<webrtc::NativeHandleBuffer*>(buffer)->native_handle();
+					DWORD length = 0;
+					if (sample != nullptr) {
+						sample->GetTotalLength(&length);
+					}
+					return length;
 				}
+				return (size_t)frame->width() * frame->height() * 3 / 2;
 			}
 
 			void MediaSourceHelper::QueueFrame(webrtc::VideoFrame* frame) {
-				rtc::CritScope lock(&_critSect);
-
+				// The arrival time is queued with the frame for the consumer
+				// to measure jitter and queue residency.  The renderers
+				// stamp the frame with the time they received it.
+				int64_t nowUs = rtc::TimeMicros();
+				if (frame->timestamp_us() != 0) {
+					_receiveToQueue.Add(nowUs - frame->timestamp_us());
+				}
+				++_framesQueued;
 				if (_frameType == FrameTypeH264) {
 					// Check it is really a H.264 frame, the codec might have been switched within the call, in this case just ignore frames
-					if (frame->video_frame_buffer()->ToI420() == nullptr) {
+					if (webrtc::IsEncodedNativeBuffer(frame->video_frame_buffer().get())) {
 						// For H264 we keep all frames since they are encoded.
-						_frames.push_back(frame);
+						// Over the memory budget, the queue is full as soon as
+						// a frame is waiting.
+						size_t bytes = GetFrameBytes(frame);
+						bool overBudget = _h264Frames.size() >= 2 &&
+							_frameMemory.WouldExceedBudget(bytes);
+						QueuedFrame* queued = new QueuedFrame(frame, nowUs);
+						if (overBudget || !_h264Frames.push(queued)) {
+							// The consumer is stalled, it will have to resume from an IDR frame.
+							_h264FramesLost = true;
+							++_framesLost;
+							if (overBudget) {
+								_frameMemory.OnFrameDropped();
+							}
+							delete queued;
+						} else {
+							_frameMemory.Add(bytes);
+						}
 					} else {
-						// Delete the frame, it's not the expected codec
-						delete frame;
+						DiscardWrongTypeFrame(frame);
 					}
 				} else {
 					// Check it is not H.264 frame, the codec might have been switched within the call, in this case just ignore frames
-					if (frame->video_frame_buffer()->ToI420() != nullptr) {
+					// Decoded native samples are rendered like I420 frames.
+					if (!webrtc::IsEncodedNativeBuffer(frame->video_frame_buffer().get())) {
 						// For I420 frame, keep only the latest.
-						for (auto oldFrame : _frames) {
-							delete oldFrame;
+						_frameMemory.Add(GetFrameBytes(frame));
+						QueuedFrame* replaced =
+							_i420Frame.exchange(new QueuedFrame(frame, nowUs));
+						if (replaced != nullptr) {
+							++_i420FramesSkipped;
+							++_framesReplaced;
+							_frameMemory.Remove(GetFrameBytes(replaced->frame.get()));
+							delete replaced;
 						}
-						_frames.clear();
-						_frames.push_back(frame);
 					} else {
-						// Delete the frame, it's not the expected codec
-						delete frame;
+						DiscardWrongTypeFrame(frame);
 					}
 				}
 			}
 
+			void MediaSourceHelper::DiscardWrongTypeFrame(webrtc::VideoFrame* frame) {
+				// The codec was switched within the call, the owner of the
+				// media source has to recreate it for the new frame type.
+				if (!_wrongTypeLogged.exchange(true)) {
+					LOG(LS_WARNING) << "Renderer " << _id << " expects "
+						<< (_frameType == FrameTypeH264 ? "H264" : "I420")
+						<< " frames, discarding the frames of the new codec";
+				}
+				++_framesLost;
+				delete frame;
+			}
+
 			std::unique_ptr<SampleData> MediaSourceHelper::DequeueFrame() {
 				rtc::CritScope lock(&_critSect);
 
-				if (_frames.size() == 0) {
+				if (!HasFrames()) {
 					return nullptr;
 				}
 
@@ -111,6 +337,16 @@ namespace Org {
 					data = DequeueI420Frame();
 				}
 
+				if (data == nullptr) {
+					return nullptr;
+				}
+
+				++_framesRendered;
+				if (_sampleRequestTimeUs != 0) {
+					_sampleRequestWait.Add(rtc::TimeMicros() - _sampleRequestTimeUs);
+					_sampleRequestTimeUs = 0;
+				}
+
 				if (_frameType == FrameTypeI420) {
 					// Set the timestamp property
 					if (_isFirstFrame) {
@@ -130,8 +366,8 @@ namespace Org {
 							data->sample->SetSampleDuration(frameTime - _lastSampleTime);
 						}
 						else {
-							LONGLONG duration = (LONGLONG)((1.0 / 30) * 1000 * 1000 * 10);
-							data->sample->SetSampleDuration(duration);
+							data->sample->SetSampleDuration(
+								_latencyController.GetFrameDurationHns());
 						}
 						_lastSampleTime = frameTime;
 					}
@@ -143,21 +379,108 @@ namespace Org {
 			}
 
 			bool MediaSourceHelper::HasFrames() {
+				if (_frameType == FrameTypeH264) {
+					return !_h264Frames.empty();
+				}
+				return _i420Frame.load() != nullptr;
+			}
+
+			SamplePool* MediaSourceHelper::GetSamplePool() {
+				return _samplePool.Get();
+			}
+
+			void MediaSourceHelper::OnSampleRequested() {
+				rtc::CritScope lock(&_critSect);
+				// A request stays pending until a frame is dequeued,
+				// repeated requests don't restart the wait.
+				if (_sampleRequestTimeUs == 0) {
+					_sampleRequestTimeUs = rtc::TimeMicros();
+				}
+			}
+
+			RendererStatsData MediaSourceHelper::GetStats() {
 				rtc::CritScope lock(&_critSect);
-				return _frames.size() > 0;
+				RendererStatsData stats;
+				stats.framesQueued = _framesQueued.load();
+				stats.framesRendered = _framesRendered;
+				stats.framesReplaced = _framesReplaced.load();
+				stats.framesDroppedToIdr = _framesDroppedToIdr;
+				stats.framesLost = _framesLost.load();
+				stats.receiveToQueueMs = _receiveToQueue.GetAverageMs();
+				stats.maxReceiveToQueueMs = _receiveToQueue.GetMaxMs();
+				stats.queueResidencyMs = _queueResidency.GetAverageMs();
+				stats.maxQueueResidencyMs = _queueResidency.GetMaxMs();
+				stats.sampleRequestWaitMs = _sampleRequestWait.GetAverageMs();
+				stats.maxSampleRequestWaitMs = _sampleRequestWait.GetMaxMs();
+				stats.conversionMs = _conversion.GetAverageMs();
+				stats.maxConversionMs = _conversion.GetMaxMs();
+				return stats;
+			}
+
+			void MediaSourceHelper::GetAllStats(
+				std::vector<std::pair<std::string, RendererStatsData>>* stats) {
+				rtc::CritScope lock(&HelpersLock());
+				for (auto helper : Helpers()) {
+					stats->push_back(std::make_pair(helper->_id, helper->GetStats()));
+				}
+			}
+
+			void MediaSourceHelper::TrimAll() {
+				rtc::CritScope lock(&HelpersLock());
+				for (auto helper : Helpers()) {
+					rtc::CritScope helperLock(&helper->_critSect);
+					helper->FlushFrames();
+					if (helper->_samplePool != nullptr) {
+						helper->_samplePool->Reset();
+					}
+					// The frames after the resume depend on the flushed ones.
+					helper->_h264FramesLost = true;
+					helper->_latencyController.Reset();
+				}
 			}
 
 			// === Private functions below ===
 
 			std::unique_ptr<SampleData> MediaSourceHelper::DequeueH264Frame() {
 
-				if (_frames.size() > 15)
-					DropFramesToIDR(_frames);
+				// Trim as soon as the backlog exceeds what the measured
+				// jitter requires rather than waiting for a fixed depth.
+				// Over the frame memory budget as well.
+				bool framesLost = _h264FramesLost.exchange(false);
+				if ((framesLost ||
+					_h264Frames.size() > _latencyController.GetMaxBacklog() ||
+					(_h264Frames.size() > 1 && _frameMemory.WouldExceedBudget(0))) &&
+					!DropFramesToIDR() && framesLost) {
+					// None of the queued frames decodes without the lost
+					// ones, they are refused until an IDR frame arrives.
+					QueuedFrame* queued;
+					while (_h264Frames.peek(0, queued) && !IsFrameIDR(queued->frame.get())) {
+						_h264Frames.pop(queued);
+						++_framesDroppedToIdr;
+						_frameMemory.Remove(GetFrameBytes(queued->frame.get()));
+						delete queued;
+					}
+					if (_h264Frames.size() == 0) {
+						_h264FramesLost = true;
+						return nullptr;
+					}
+				}
 
-				std::unique_ptr<webrtc::VideoFrame> frame(_frames.front());
-				_frames.pop_front();
+				QueuedFrame* queuedFrame;
+				if (!_h264Frames.pop(queuedFrame)) {
+					return nullptr;
+				}
+				std::unique_ptr<QueuedFrame> queued(queuedFrame);
+				webrtc::VideoFrame* frame = queued->frame.get();
+				_frameMemory.Remove(GetFrameBytes(frame));
 
 				std::unique_ptr<SampleData> data(new SampleData);
+				data->rtpTimestamp = frame->timestamp();
+				data->arrivalTimeUs = queued->arrivalTimeUs;
+				_queueResidency.Add(rtc::TimeMicros() - data->arrivalTimeUs);
+				_latencyController.OnFrameDequeued(
+					data->arrivalTimeUs / rtc::kNumMicrosecsPerMillisec,
+					rtc::TimeMillis(), 0);
 
 				// Get the IMFSample in the frame.
 				{
@@ -177,17 +500,41 @@ namespace Org {
 					}
 				}
 
-				CheckForAttributeChanges(frame.get(), data.get());
+				CheckForAttributeChanges(frame, data.get());
 				return data;
 			}
 
 			std::unique_ptr<SampleData> MediaSourceHelper::DequeueI420Frame() {
-				std::unique_ptr<webrtc::VideoFrame> frame(_frames.front());
-				_frames.pop_front();
+				std::unique_ptr<QueuedFrame> queued(_i420Frame.exchange(nullptr));
+				if (queued == nullptr) {
+					return nullptr;
+				}
+				webrtc::VideoFrame* frame = queued->frame.get();
+				_frameMemory.Remove(GetFrameBytes(frame));
 
 				std::unique_ptr<SampleData> data(new SampleData);
+				data->rtpTimestamp = frame->timestamp();
+				data->arrivalTimeUs = queued->arrivalTimeUs;
+				_queueResidency.Add(rtc::TimeMicros() - data->arrivalTimeUs);
+				_latencyController.OnFrameDequeued(
+					data->arrivalTimeUs / rtc::kNumMicrosecsPerMillisec,
+					rtc::TimeMillis(), _i420FramesSkipped.exchange(0));
+
+				// Pooled samples of the previous size are of no use anymore.
+				CheckForAttributeChanges(frame, data.get());
+				if (data->sizeHasChanged && _samplePool != nullptr) {
+					_samplePool->Reset();
+				}
 
-				if (FAILED(_mkSample(frame.get(), &data->sample))) {
+				int64_t conversionStartUs = rtc::TimeMicros();
+				HRESULT hr = _mkSample(frame, &data->sample);
+				_conversion.Add(rtc::TimeMicros() - conversionStartUs);
+				if (FAILED(hr)) {
+					// Make sure the changes are reported with the next frame.
+					if (data->sizeHasChanged)
+						_lastSize = { 0, 0 };
+					if (data->rotationHasChanged)
+						_lastRotation = -1;
 					return nullptr;
 				}
 
@@ -196,7 +543,6 @@ namespace Org {
 				sampleAttributes->SetUINT32(MFSampleExtension_CleanPoint, TRUE);
 				sampleAttributes->SetUINT32(MFSampleExtension_Discontinuity, TRUE);
 
-				CheckForAttributeChanges(frame.get(), data.get());
 				return data;
 			}
 
@@ -212,81 +558,88 @@ namespace Org {
 					return isIdr > 0;
 				}
 
-				ComPtr<IMFMediaBuffer> pBuffer;
-				sample->GetBufferByIndex(0, &pBuffer);
-				BYTE* pBytes;
-				DWORD maxLength, curLength;
-				if (FAILED(pBuffer->Lock(&pBytes, &maxLength, &curLength))) {
+				// The NAL unit table gets cached on the sample as well,
+				// so the bitstream is scanned at most once.
+				std::vector<NalUnit> nalUnits;
+				if (FAILED(GetSampleNalUnits(sample, &nalUnits))) {
 					return false;
 				}
 
-				// Search for the beginnings of nal units.
-				for (DWORD i = 0; i < curLength - 5; ++i) {
-					BYTE* ptr = pBytes + i;
-					int prefixLengthFound = 0;
-					if (ptr[0] == 0x00 && ptr[1] == 0x00 && ptr[2] == 0x00 && ptr[3] == 0x01) {
-						prefixLengthFound = 4;
-					} else if (ptr[0] == 0x00 && ptr[1] == 0x00 && ptr[2] == 0x01) {
-						prefixLengthFound = 3;
-					}
-
-					if (prefixLengthFound > 0 && (ptr[prefixLengthFound] & 0x1f) == 0x05) {
+				for (auto& nalUnit : nalUnits) {
+					if (nalUnit.type == kNalUnitTypeIdr) {
 						// Found IDR NAL unit
-						pBuffer->Unlock();
 						sampleAttributes->SetUINT32(GUID_IS_IDR, 1);  // Cache result
 						return true;
 					}
 				}
-				pBuffer->Unlock();
 				sampleAttributes->SetUINT32(GUID_IS_IDR, 0);  // Cache result
 				return false;
 			}
 
-			bool DropFramesToIDR(std::list<webrtc::VideoFrame*>& frames) {
-				webrtc::VideoFrame* idrFrame = nullptr;
+			bool IsFrameIDR(webrtc::VideoFrame* frame) {
+				if (!webrtc::IsEncodedNativeBuffer(frame->video_frame_buffer().get())) {
+					return false; // Frame type is I420, skip it
+				}
+				rtc::scoped_refptr<webrtc::NativeHandleBuffer> frameBuffer =
+					static_cast<webrtc::NativeHandleBuffer*>(frame->video_frame_buffer().get());
+				IMFSample* pSample = (IMFSample*)frameBuffer->native_handle();
+				if (pSample == nullptr) {
+					return false;  // I don't expect this will ever happen.
+				}
+				return IsSampleIDR(pSample);
+			}
+
+			bool MediaSourceHelper::DropFramesToIDR() {
+				// Only the consumer removes frames, so everything up to the
+				// snapshot size stays valid while we look at it.
+				size_t count = _h264Frames.size();
+				size_t idrIndex = count;
 				// Go through the frames in reverse order (from newest to oldest) and look
 				// for an IDR frame.
-				for (auto it = frames.rbegin(); it != frames.rend(); ++it) {
-					if ((*it)->video_frame_buffer()->ToI420() != nullptr) {
-						continue; // Frame type is I420, skip it
-					}
-					rtc::scoped_refptr<webrtc::NativeHandleBuffer> frameBuffer =
-						static_cast<webrtc::NativeHandleBuffer*>((*it)->video_frame_buffer().get());
-					IMFSample* pSample = (IMFSample*)frameBuffer->native_handle();
-					if (pSample == nullptr) {
-						continue;  // I don't expect this will ever happen.
-					}
-
-					if (IsSampleIDR(pSample)) {
-						idrFrame = *it;
+				for (size_t i = count; i > 0; --i) {
+					QueuedFrame* queued;
+					if (_h264Frames.peek(i - 1, queued) && IsFrameIDR(queued->frame.get())) {
+						idrIndex = i - 1;
 						break;
 					}
 				}
 
 				// If we have an IDR frame, drop all older frames.
-				if (idrFrame != nullptr) {
-					OutputDebugString(L"IDR found, dropping all other samples.\r\n");
-					while (!frames.empty()) {
-						if (frames.front() == idrFrame) {
-							break;
-						}
-						auto frame = frames.front();
-						frames.pop_front();
-						delete frame;
+				if (idrIndex == count) {
+					return false;
+				}
+				OutputDebugString(L"IDR found, dropping all other samples.\r\n");
+				for (size_t i = 0; i < idrIndex; ++i) {
+					QueuedFrame* queued;
+					if (_h264Frames.pop(queued)) {
+						++_framesDroppedToIdr;
+						_frameMemory.Remove(GetFrameBytes(queued->frame.get()));
+						delete queued;
 					}
 				}
-				return idrFrame != nullptr;
+				return true;
+			}
+
+			void MediaSourceHelper::FlushFrames() {
+				QueuedFrame* queued;
+				while (_h264Frames.pop(queued)) {
+					_frameMemory.Remove(GetFrameBytes(queued->frame.get()));
+					delete queued;
+				}
+				queued = _i420Frame.exchange(nullptr);
+				if (queued != nullptr) {
+					_frameMemory.Remove(GetFrameBytes(queued->frame.get()));
+					delete queued;
+				}
 			}
 
 			void MediaSourceHelper::SetStartTimeNow() {
 				rtc::CritScope lock(&_critSect);
 				_startTickTime = rtc::TimeMillis();
-				if (!DropFramesToIDR(_frames)) {
+				_latencyController.Reset();
+				if (!DropFramesToIDR()) {
 					// Flush all frames then.
-					while (!_frames.empty()) {
-						std::unique_ptr<webrtc::VideoFrame> frame(_frames.front());
-						_frames.pop_front();
-					}
+					FlushFrames();
 				}
 			}
 
@@ -298,7 +651,8 @@ namespace Org {
 						_startTickTime = rtc::TimeMillis();
 						return 0;
 					}
-					LONGLONG frameTime = ((rtc::TimeMillis() - _startTickTime) + _futureOffsetMs) * 1000 * 10;
+					LONGLONG frameTime = ((rtc::TimeMillis() - _startTickTime) +
+						_latencyController.GetFutureOffsetMs()) * 1000 * 10;
 #else
 					if (_startTime == 0) {
 
@@ -308,7 +662,8 @@ namespace Org {
 						return 0;
 					}
 
-					LONGLONG frameTime = (frameRenderTime - _startTime) / 100 + (_futureOffsetMs * 1000 * 10);
+					LONGLONG frameTime = (frameRenderTime - _startTime) / 100 +
+						(_latencyController.GetFutureOffsetMs() * 1000 * 10);
 #endif
 
 					return frameTime;
@@ -349,8 +704,34 @@ namespace Org {
 					_fpsCallback(_frameCounter);
 					_frameCounter = 0;
 					_lastTimeFPSCalculated = now;
+					TraceStats();
 				}
 			}
+
+			void MediaSourceHelper::TraceStats() {
+				RendererStatsData stats = GetStats();
+				std::string group = "renderer_" + _id;
+				const char* groupName = group.c_str();
+				double timestamp = (double)rtc::TimeUTCMicros() / rtc::kNumMicrosecsPerMillisec;
+				EventWriteStatsReportInt64(groupName, timestamp, "framesQueued",
+					(int64_t)stats.framesQueued);
+				EventWriteStatsReportInt64(groupName, timestamp, "framesRendered",
+					(int64_t)stats.framesRendered);
+				EventWriteStatsReportInt64(groupName, timestamp, "framesReplaced",
+					(int64_t)stats.framesReplaced);
+				EventWriteStatsReportInt64(groupName, timestamp, "framesDroppedToIdr",
+					(int64_t)stats.framesDroppedToIdr);
+				EventWriteStatsReportInt64(groupName, timestamp, "framesLost",
+					(int64_t)stats.framesLost);
+				EventWriteStatsReportFloat(groupName, timestamp, "receiveToQueueMs",
+					(float)stats.receiveToQueueMs);
+				EventWriteStatsReportFloat(groupName, timestamp, "queueResidencyMs",
+					(float)stats.queueResidencyMs);
+				EventWriteStatsReportFloat(groupName, timestamp, "sampleRequestWaitMs",
+					(float)stats.sampleRequestWaitMs);
+				EventWriteStatsReportFloat(groupName, timestamp, "conversionMs",
+					(float)stats.conversionMs);
+			}
 		}
 	}
 }  // namespace Org.WebRtc.Internal
@@ -358,3 +739,29 @@ namespace Org {
 void Org::WebRtc::FirstFrameRenderHelper::FireEvent(double timestamp) {
 		FirstFrameRendered(timestamp);
 }
+
+Windows::Foundation::Collections::IVector<Org::WebRtc::RendererStats^>^
+Org::WebRtc::RendererStatsHelper::GetRendererStats() {
+	std::vector<std::pair<std::string, Internal::RendererStatsData>> stats;
+	Internal::MediaSourceHelper::GetAllStats(&stats);
+	auto ret = ref new Vector<RendererStats^>();
+	for (auto& entry : stats) {
+		auto rendererStats = ref new RendererStats();
+		rendererStats->Id = Internal::ToCx(entry.first);
+		rendererStats->FramesQueued = entry.second.framesQueued;
+		rendererStats->FramesRendered = entry.second.framesRendered;
+		rendererStats->FramesReplaced = entry.second.framesReplaced;
+		rendererStats->FramesDroppedToIdr = entry.second.framesDroppedToIdr;
+		rendererStats->FramesLost = entry.second.framesLost;
+		rendererStats->ReceiveToQueueMs = entry.second.receiveToQueueMs;
+		rendererStats->MaxReceiveToQueueMs = entry.second.maxReceiveToQueueMs;
+		rendererStats->QueueResidencyMs = entry.second.queueResidencyMs;
+		rendererStats->MaxQueueResidencyMs = entry.second.maxQueueResidencyMs;
+		rendererStats->SampleRequestWaitMs = entry.second.sampleRequestWaitMs;
+		rendererStats->MaxSampleRequestWaitMs = entry.second.maxSampleRequestWaitMs;
+		rendererStats->ConversionMs = entry.second.conversionMs;
+		rendererStats->MaxConversionMs = entry.second.maxConversionMs;
+		ret->Append(rendererStats);
+	}
+	return ret;
+}
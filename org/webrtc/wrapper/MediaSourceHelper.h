@@ -15,6 +15,13 @@
 #include <mfidl.h>
 #include "webrtc/api/mediastreaminterface.h"
 #include "webrtc/rtc_base/criticalsection.h"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include "third_party/winuwp_h264/Utils/FrameMemoryBudget.h"
+#include "third_party/winuwp_h264/Utils/SamplePool.h"
+#include "third_party/winuwp_h264/Utils/SpscQueue.h"
 
 using Microsoft::WRL::ComPtr;
 
@@ -34,6 +41,64 @@ namespace Org {
 		internal:
 			static void FireEvent(double timestamp);
 		};
+
+		/// <summary>
+		/// Render queue statistics of a video stream rendered through
+		/// <see cref="Media::CreateMediaStreamSource"/> or
+		/// <see cref="Media::AddVideoTrackMediaElementPair"/>.
+		/// Counters and averages cover the lifetime of the renderer,
+		/// latencies are in milliseconds.
+		/// </summary>
+		public ref class RendererStats sealed {
+		public:
+			/// <summary>
+			/// Id the renderer was created with.
+			/// </summary>
+			property Platform::String^ Id;
+			property uint64 FramesQueued;
+			property uint64 FramesRendered;
+			/// <summary>
+			/// Frames replaced by a newer frame before being rendered.
+			/// </summary>
+			property uint64 FramesReplaced;
+			/// <summary>
+			/// Encoded frames dropped to resume from an IDR frame.
+			/// </summary>
+			property uint64 FramesDroppedToIdr;
+			/// <summary>
+			/// Frames lost because the render queue was full, or because
+			/// they were not of the type the renderer was created for.
+			/// </summary>
+			property uint64 FramesLost;
+			/// <summary>
+			/// Time from the frame reaching the renderer to it being queued.
+			/// </summary>
+			property double ReceiveToQueueMs;
+			property double MaxReceiveToQueueMs;
+			/// <summary>
+			/// Time a frame waits in the queue before being rendered.
+			/// </summary>
+			property double QueueResidencyMs;
+			property double MaxQueueResidencyMs;
+			/// <summary>
+			/// Time a sample request of the media element waits for a frame.
+			/// </summary>
+			property double SampleRequestWaitMs;
+			property double MaxSampleRequestWaitMs;
+			/// <summary>
+			/// Time spent converting a frame to a render sample.
+			/// </summary>
+			property double ConversionMs;
+			property double MaxConversionMs;
+		};
+
+		public ref class RendererStatsHelper sealed {
+		public:
+			/// <summary>
+			/// Returns the statistics of all active renderers.
+			/// </summary>
+			static Windows::Foundation::Collections::IVector<RendererStats^>^ GetRendererStats();
+		};
 	}
 }
 namespace Org {
@@ -53,30 +118,160 @@ namespace Org {
 				bool rotationHasChanged;
 				int rotation;
 				LONGLONG renderTime;
+				// Of the frame, to trace it.
+				uint32_t rtpTimestamp;
+				// When the frame was queued, for the queue residency.
+				int64_t arrivalTimeUs;
+			};
+
+			// Estimates the frame rate, arrival jitter and queue residency
+			// of a stream from the frames it renders, and derives the
+			// presentation offset, frame duration and backlog limit from
+			// them.  Only used on the consumer side.
+			class RenderLatencyController {
+			public:
+				RenderLatencyController();
+				void Reset();
+
+				// |arrivalTimeMs| is when the frame was queued, |framesSkipped|
+				// the number of frames replaced by it before being rendered.
+				void OnFrameDequeued(int64_t arrivalTimeMs, int64_t nowMs,
+					int framesSkipped);
+
+				// How far in the future a sample is timestamped.
+				int GetFutureOffsetMs() const;
+				// Duration of a sample at the measured frame rate.
+				LONGLONG GetFrameDurationHns() const;
+				// Number of queued frames above which the backlog is trimmed.
+				size_t GetMaxBacklog() const;
+
+			private:
+				// Time the backlog should cover.
+				double GetBacklogBudgetMs() const;
+
+				int64_t _lastArrivalTimeMs;
+				double _frameIntervalMs;
+				double _jitterMs;
+				double _residencyMs;
+				// Set once the frames wait longer than the budget, cleared
+				// once they wait well below it, so that the limit doesn't
+				// flip with each frame around the budget.
+				bool _trimming;
 			};
 
+			// Latency samples of one render pipeline stage.  Can be added
+			// to from any thread.
+			class LatencyStat {
+			public:
+				LatencyStat();
+				void Add(int64_t latencyUs);
+				uint64_t GetCount() const;
+				double GetAverageMs() const;
+				double GetMaxMs() const;
+
+			private:
+				std::atomic<uint64_t> _count;
+				std::atomic<int64_t> _totalUs;
+				std::atomic<int64_t> _maxUs;
+			};
+
+			struct RendererStatsData {
+				RendererStatsData();
+				uint64_t framesQueued;
+				uint64_t framesRendered;
+				uint64_t framesReplaced;
+				uint64_t framesDroppedToIdr;
+				uint64_t framesLost;
+				double receiveToQueueMs;
+				double maxReceiveToQueueMs;
+				double queueResidencyMs;
+				double maxQueueResidencyMs;
+				double sampleRequestWaitMs;
+				double maxSampleRequestWaitMs;
+				double conversionMs;
+				double maxConversionMs;
+			};
+
+			// Returns true if the encoded |sample| holds an IDR picture.
+			// The result is cached in the sample attributes.
+			bool IsSampleIDR(IMFSample* sample);
+
 			class MediaSourceHelper {
 			public:
 				MediaSourceHelper(
+					const std::string& id,
 					VideoFrameType frameType,
 					std::function<HRESULT(webrtc::VideoFrame* frame, IMFSample** sample)> mkSample,
 					std::function<void(int)> fpsCallback);
 				~MediaSourceHelper();
 
+				// QueueFrame() is the producer side and DequeueFrame()/SetStartTimeNow()
+				// the consumer side of a lock-free queue.  Calls on each side
+				// must not overlap, but the two sides may run concurrently.
 				void SetStartTimeNow();
 				void QueueFrame(webrtc::VideoFrame* frame);
 				std::unique_ptr<SampleData> DequeueFrame();
 				bool HasFrames();
+				// Consumer side, the media element asked for a sample.
+				void OnSampleRequested();
+
+				RendererStatsData GetStats();
+				// Statistics of all live helpers, keyed by renderer id.
+				static void GetAllStats(
+					std::vector<std::pair<std::string, RendererStatsData>>* stats);
+				// Called on suspend, drops the queued frames and the pooled
+				// samples of all live helpers.  The media sources are kept,
+				// the H.264 ones resume from the next IDR frame.
+				static void TrimAll();
+
+				// Pool the I420 sample callback should allocate its
+				// NV12 samples from.  Null for H264 sources.
+				SamplePool* GetSamplePool();
 
 			private:
+				// A frame with the time it was queued.  The timestamp of the
+				// frame itself is left as the renderer set it.
+				struct QueuedFrame {
+					QueuedFrame(webrtc::VideoFrame* frame, int64_t arrivalTimeUs)
+						: frame(frame), arrivalTimeUs(arrivalTimeUs) {}
+					std::unique_ptr<webrtc::VideoFrame> frame;
+					int64_t arrivalTimeUs;
+				};
+
+				// Guards the consumer side state.  Never taken by QueueFrame().
 				rtc::CriticalSection _critSect;
-				std::list<webrtc::VideoFrame*> _frames;
+				// Queued h264 frames, all of them are kept in order.
+				static const size_t MaxQueuedH264Frames = 32;
+				SpscQueue<QueuedFrame*> _h264Frames;
+				// Set by the producer when the queue was full and a frame was lost.
+				std::atomic<bool> _h264FramesLost;
+				// Latest I420 frame, a newer frame replaces an older one not yet rendered.
+				std::atomic<QueuedFrame*> _i420Frame;
+				// Number of I420 frames replaced since the last one was rendered.
+				std::atomic<int> _i420FramesSkipped;
+				// Bytes of the queued frames, counted in the frame memory budget.
+				webrtc::FrameMemoryAccount _frameMemory;
+				const std::string _id;
+				// Render statistics, the atomic ones are updated by the producer.
+				std::atomic<uint64_t> _framesQueued;
+				std::atomic<uint64_t> _framesReplaced;
+				std::atomic<uint64_t> _framesLost;
+				std::atomic<bool> _wrongTypeLogged;
+				uint64_t _framesRendered;
+				uint64_t _framesDroppedToIdr;
+				LatencyStat _receiveToQueue;
+				LatencyStat _queueResidency;
+				LatencyStat _sampleRequestWait;
+				LatencyStat _conversion;
+				// When the pending sample request was made, 0 if none.
+				int64_t _sampleRequestTimeUs;
 				VideoFrameType _frameType;
 				bool _isFirstFrame;
 				LONGLONG _startTime;
 				// One peculiarity, the timestamp of a sample should be slightly
 				// in the future for Media Foundation to handle it properly.
-				int _futureOffsetMs;
+				// The controller adapts the offset to the measured jitter.
+				RenderLatencyController _latencyController;
 				// We keep the last sample time to catch cases where samples are
 				// requested so quickly that the sample time doesn't change.
 				// We then increment it slightly to prevent giving MF duplicate times.
@@ -86,8 +281,13 @@ namespace Org {
 				// In degrees.  In practice it can only be 0, 90, 180 or 270.
 				int _lastRotation;
 
+				// Producer side, drops a frame of the other VideoFrameType.
+				void DiscardWrongTypeFrame(webrtc::VideoFrame* frame);
 				std::unique_ptr<SampleData> DequeueH264Frame();
 				std::unique_ptr<SampleData> DequeueI420Frame();
+				// Drops all queued h264 frames older than the newest IDR frame.
+				bool DropFramesToIDR();
+				void FlushFrames();
 
 
 				// Gets the next timestamp using the clock.
@@ -99,8 +299,13 @@ namespace Org {
 				std::function<HRESULT(webrtc::VideoFrame* frame, IMFSample** sample)> _mkSample;
 				std::function<void(int)> _fpsCallback;
 
+				// Recycled render samples, rebuilt when the frame size changes.
+				ComPtr<SamplePool> _samplePool;
+
 				// Called whenever a new sample is sent for rendering.
 				void UpdateFrameRate();
+				// Writes the statistics to the WebRTCInternals ETW provider.
+				void TraceStats();
 				// State related to calculating FPS.
 				int _frameCounter;
 				int64_t _lastTimeFPSCalculated;
@@ -9,7 +9,10 @@
 #include "PeerConnectionInterface.h"
 
 #include <ppltasks.h>
+#include <algorithm>
+#include <atomic>
 #include <map>
+#include <memory>
 #include <string>
 #include <functional>
 #include <codecvt>
@@ -17,6 +20,9 @@
 #include "GlobalObserver.h"
 #include "Marshalling.h"
 #include "DataChannel.h"
+#include "FileLogSink.h"
+#include "FlightRecorder.h"
+#include "LowLatencyAudioDevice.h"
 #include "Media.h"
 #include "webrtc/rtc_base/ssladapter.h"
 #include "webrtc/rtc_base/win32socketinit.h"
@@ -25,16 +31,28 @@
 #include "webrtc/rtc_base/event_tracer.h"
 #include "webrtc/rtc_base/loggingserver.h"
 #include "webrtc/rtc_base/stream.h"
+#include "webrtc/rtc_base/stringencode.h"
 #include "webrtc/test/field_trial.h"
 #include "webrtc/api/test/fakeconstraints.h"
 #include "webrtc/pc/channelmanager.h"
+#include "webrtc/p2p/base/basicpacketsocketfactory.h"
+#include "webrtc/p2p/client/basicportallocator.h"
+#include "webrtc/rtc_base/network.h"
 #include "webrtc/rtc_base/win32.h"
 #include "webrtc/rtc_base/timeutils.h"
 #include "third_party/winuwp_h264/winuwp_h264_factory.h"
+#include "third_party/winuwp_h264/Utils/FrameMemoryBudget.h"
+#include "third_party/winuwp_h264/Utils/GpuPipeline.h"
+#include "third_party/winuwp_h264/Utils/MftCapabilities.h"
+#include "third_party/winuwp_h264/Utils/PipelineTrace.h"
+#include "third_party/winuwp_h264/Utils/ResourceSampler.h"
+#include "third_party/winuwp_h264/H264Encoder/H264Encoder.h"
+#include "third_party/winuwp_h264/H264Decoder/H264Decoder.h"
 #include "webrtc/common_video/video_common_winuwp.h"
 
 using Org::WebRtc::Internal::FromCx;
 using Org::WebRtc::Internal::ToCx;
+using Org::WebRtc::Internal::ToCxInterned;
 using Platform::Collections::Vector;
 using Windows::Media::Capture::MediaCapture;
 using Windows::Media::Capture::MediaCaptureInitializationSettings;
@@ -52,8 +70,18 @@ namespace Org {
 			}
 
 			static const std::string logFileName = "_webrtc_logging.log";
-			double gCurrentCPUUsage = 0.0;
-			uint64 gCurrentMEMUsage = 0;
+			static const std::string mftCapabilitiesFileName = "_webrtc_h264_mfts.txt";
+			bool gDirectI420Rendering = false;
+			bool gPreferHardwareCodecs = false;
+			uint32 gRenderMaxFramerate = 0;
+			uint32 gRenderPacingFramerate = 0;
+			uint32 gLogFileMaxSize = 10 * 1024 * 1024;
+			uint32 gLogFileSegments = 3;
+			bool gCompressLogSegments = false;
+			// 200 bytes each on x64, 6.4 MB.
+			uint32 gFlightRecorderCapacity = 32 * 1024;
+			bool gLowLatencyAudio = false;
+			uint32 gAudioPeriodFrames = 0;
 
 			// helper function to get default output path for the app
 			std::string OutputPath() {
@@ -70,43 +98,299 @@ namespace Org {
 				return p_string;
 			}
 
-			/**
-			 * a private class only used in this file, which implements LogSink for logging to file
-			 */
-			class FileLogSink
-				: public rtc::LogSink {
-			public:
-				explicit FileLogSink(rtc::FileStream* fStream) {
-					fileStream_.reset(fStream);
-				}
-				rtc::FileStream* file() { return fileStream_.get(); }
-			private:
-				void OnLogMessage(const std::string& message) override {
-					fileStream_->WriteAll(
-						message.data(), message.size(), nullptr, nullptr);
-				}
-
-				std::unique_ptr<rtc::FileStream> fileStream_;
-			};
-
 			static bool isInitialized = false;
+			// Initialize() can also be called by WarmUpAsync() off the UI thread.
+			rtc::CriticalSection gInitializeLock;
+			// Probe of the H264 MFTs started by Initialize().
+			Concurrency::task<void> gMftProbeTask;
 
 			rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface>
 				gPeerConnectionFactory;
+			rtc::scoped_refptr<Internal::LowLatencyAudioDeviceModule>
+				gAudioDeviceModule;
 			bool gIsTracing = false;
-			std::unique_ptr<FileLogSink> gLoggingFile;
+			std::unique_ptr<Internal::FileLogSink> gLoggingFile;
 			std::unique_ptr<rtc::LoggingServer> gLoggingServer;
 			// The worker thread for webrtc.
 			rtc::Thread gThread;
-			std::unique_ptr<rtc::Thread> gNetworkThread;
-			std::unique_ptr<rtc::Thread> gWorkerThread;
-			std::unique_ptr<rtc::Thread> gSignalingThread;
+
+			// Runs the functions posted with PostOnGlobalThread.
+			class GlobalThreadTaskHandler : public rtc::MessageHandler {
+			public:
+				struct TaskData : public rtc::MessageData {
+					explicit TaskData(std::function<void()> fn) : fn(std::move(fn)) {}
+					std::function<void()> fn;
+				};
+
+				void OnMessage(rtc::Message* msg) override {
+					std::unique_ptr<TaskData> data(
+						static_cast<TaskData*>(msg->pdata));
+					data->fn();
+				}
+			};
+			GlobalThreadTaskHandler gThreadTaskHandler;
+
+			void PostOnGlobalThread(std::function<void()> fn) {
+				gThread.Post(RTC_FROM_HERE, &gThreadTaskHandler, 0,
+					new GlobalThreadTaskHandler::TaskData(std::move(fn)));
+			}
+
+			// Threads and factory of a group of peer connections.  The
+			// factory of the first shard is gPeerConnectionFactory, the
+			// media tracks are created from it.
+			struct ThreadShard {
+				ThreadShard() : peerConnections(0) {}
+				std::unique_ptr<rtc::Thread> networkThread;
+				std::unique_ptr<rtc::Thread> workerThread;
+				std::unique_ptr<rtc::Thread> signalingThread;
+				rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory;
+				std::atomic<int> peerConnections;
+				// Of the port allocators the connections with a port range
+				// or ignored networks create.  Only used on the network
+				// thread, created with the first of them.
+				std::unique_ptr<rtc::BasicNetworkManager> networkManager;
+				std::unique_ptr<rtc::BasicPacketSocketFactory> socketFactory;
+			};
+
+			// Networks of a shared network manager without the ignored
+			// types.  The factory resets the ignore mask of the port
+			// allocators it is given, the networks are filtered before.
+			// Only used on the network thread.
+			class FilteredNetworkManager : public rtc::NetworkManager,
+				public sigslot::has_slots<> {
+			public:
+				FilteredNetworkManager(rtc::NetworkManager* networkManager,
+					int ignoreMask) :
+					_networkManager(networkManager), _ignoreMask(ignoreMask),
+					_updating(false) {
+				}
+
+				~FilteredNetworkManager() {
+					StopUpdating();
+				}
+
+				void StartUpdating() override {
+					if (_updating) {
+						return;
+					}
+					_updating = true;
+					_networkManager->SignalNetworksChanged.connect(this,
+						&FilteredNetworkManager::OnNetworksChanged);
+					_networkManager->SignalError.connect(this,
+						&FilteredNetworkManager::OnError);
+					// Signals the networks again if it is already started.
+					_networkManager->StartUpdating();
+				}
+
+				void StopUpdating() override {
+					if (!_updating) {
+						return;
+					}
+					_updating = false;
+					_networkManager->SignalNetworksChanged.disconnect(this);
+					_networkManager->SignalError.disconnect(this);
+					_networkManager->StopUpdating();
+				}
+
+				void GetNetworks(NetworkList* networks) const override {
+					NetworkList all;
+					_networkManager->GetNetworks(&all);
+					for (rtc::Network* network : all) {
+						if ((network->type() & _ignoreMask) == 0) {
+							networks->push_back(network);
+						}
+					}
+				}
+
+				void GetAnyAddressNetworks(NetworkList* networks) override {
+					_networkManager->GetAnyAddressNetworks(networks);
+				}
+
+				EnumerationPermission enumeration_permission() const override {
+					return _networkManager->enumeration_permission();
+				}
+
+				bool GetDefaultLocalAddress(int family,
+					rtc::IPAddress* ipaddr) const override {
+					return _networkManager->GetDefaultLocalAddress(family, ipaddr);
+				}
+
+			private:
+				void OnNetworksChanged() {
+					SignalNetworksChanged();
+				}
+
+				void OnError() {
+					SignalError();
+				}
+
+				rtc::NetworkManager* const _networkManager;
+				const int _ignoreMask;
+				bool _updating;
+			};
+
+			// Owns the network manager of a connection.  The manager is a
+			// base declared first so it outlives the sessions of the
+			// allocator.
+			struct NetworkManagerHolder {
+				explicit NetworkManagerHolder(rtc::NetworkManager* networkManager) :
+					networkManager(networkManager) {
+				}
+				std::unique_ptr<rtc::NetworkManager> networkManager;
+			};
+
+			class ConnectionPortAllocator : private NetworkManagerHolder,
+				public cricket::BasicPortAllocator {
+			public:
+				ConnectionPortAllocator(rtc::NetworkManager* networkManager,
+					rtc::PacketSocketFactory* socketFactory) :
+					NetworkManagerHolder(networkManager),
+					cricket::BasicPortAllocator(networkManager, socketFactory) {
+				}
+			};
+
+			// Port allocator for a connection of |shard|, created on its
+			// network thread.  Null if the default one of the factory does.
+			std::unique_ptr<cricket::PortAllocator> CreatePortAllocator(
+				ThreadShard* shard, RTCConfiguration^ configuration) {
+				bool portRange = configuration->MinUdpPort != nullptr &&
+					configuration->MaxUdpPort != nullptr;
+				int ignoreMask = configuration->IgnoredNetworkTypes != nullptr ?
+					(int)configuration->IgnoredNetworkTypes->Value : 0;
+				if (!portRange && ignoreMask == 0) {
+					return nullptr;
+				}
+				int minPort = portRange ? configuration->MinUdpPort->Value : 0;
+				int maxPort = portRange ? configuration->MaxUdpPort->Value : 0;
+				cricket::BasicPortAllocator* allocator =
+					shard->networkThread->Invoke<cricket::BasicPortAllocator*>(RTC_FROM_HERE,
+						[shard, ignoreMask, minPort, maxPort] {
+					if (shard->networkManager == nullptr) {
+						shard->networkManager.reset(new rtc::BasicNetworkManager());
+						shard->socketFactory.reset(
+							new rtc::BasicPacketSocketFactory(shard->networkThread.get()));
+					}
+					cricket::BasicPortAllocator* portAllocator;
+					if (ignoreMask != 0) {
+						portAllocator = new ConnectionPortAllocator(
+							new FilteredNetworkManager(shard->networkManager.get(), ignoreMask),
+							shard->socketFactory.get());
+					} else {
+						portAllocator = new cricket::BasicPortAllocator(
+							shard->networkManager.get(), shard->socketFactory.get());
+					}
+					if (minPort > 0 && maxPort >= minPort) {
+						portAllocator->SetPortRange(minPort, maxPort);
+					}
+					return portAllocator;
+				});
+				return std::unique_ptr<cricket::PortAllocator>(allocator);
+			}
+			// Only changed on the global thread, at initialization.
+			std::vector<std::unique_ptr<ThreadShard>> gThreadShards;
+			RTCThreadShardPolicy gThreadShardPolicy = RTCThreadShardPolicy::RoundRobin;
+			uint32 gNextThreadShard = 0;
 			// Default resolution. If no preferred video capture format is specified,
 			// this is the resolution we will use.
 			cricket::VideoFormat gPreferredVideoCaptureFormat = cricket::VideoFormat(640, 480,
 				cricket::VideoFormat::FpsToInterval(30), cricket::FOURCC_ANY);
+
+			// Called on the global thread.
+			uint32 AcquireThreadShard() {
+				uint32 index = 0;
+				if (gThreadShardPolicy == RTCThreadShardPolicy::LeastConnections) {
+					for (uint32 i = 1; i < gThreadShards.size(); ++i) {
+						if (gThreadShards[i]->peerConnections <
+							gThreadShards[index]->peerConnections) {
+							index = i;
+						}
+					}
+				} else {
+					index = gNextThreadShard;
+					gNextThreadShard = (gNextThreadShard + 1) % gThreadShards.size();
+				}
+				++gThreadShards[index]->peerConnections;
+				return index;
+			}
+
+			void ReleaseThreadShard(uint32 index) {
+				if (index < gThreadShards.size()) {
+					--gThreadShards[index]->peerConnections;
+				}
+			}
+
+			// Loads the H264 MFTs and their drivers once, the codecs created
+			// afterwards for the calls start faster.
+			void WarmUpH264Codecs() {
+				webrtc::VideoCodec settings;
+				settings.codecType = webrtc::kVideoCodecH264;
+				settings.width = 320;
+				settings.height = 240;
+				settings.maxFramerate = 30;
+				settings.startBitrate = 300;
+				settings.targetBitrate = 300;
+				settings.maxBitrate = 1000;
+
+				webrtc::WinUWPH264EncoderFactory encoderFactory;
+				webrtc::VideoEncoder* encoder = encoderFactory.CreateVideoEncoder(
+					cricket::VideoCodec(cricket::kH264CodecName));
+				if (encoder != nullptr) {
+					encoder->InitEncode(&settings, 1, 1200);
+					encoder->Release();
+					encoderFactory.DestroyVideoEncoder(encoder);
+				}
+
+				webrtc::WinUWPH264DecoderFactory decoderFactory;
+				webrtc::VideoDecoder* decoder =
+					decoderFactory.CreateVideoDecoder(webrtc::kVideoCodecH264);
+				if (decoder != nullptr) {
+					decoder->InitDecode(&settings, 1);
+					decoder->Release();
+					decoderFactory.DestroyVideoDecoder(decoder);
+				}
+			}
+
+			bool GetThreadShardStats(uint32 index, ThreadShardStats* stats) {
+				if (index >= gThreadShards.size()) {
+					return false;
+				}
+				ThreadShard* shard = gThreadShards[index].get();
+				stats->index = index;
+				stats->peerConnections = shard->peerConnections;
+				stats->networkQueueSize = shard->networkThread->size();
+				stats->workerQueueSize = shard->workerThread->size();
+				stats->signalingQueueSize = shard->signalingThread->size();
+				return true;
+			}
+
+			rtc::Thread* AudioDeviceWorkerThread() {
+				if (gThreadShards.empty()) {
+					return nullptr;
+				}
+				return gThreadShards[0]->workerThread.get();
+			}
 		}  // namespace globals
 
+		RTCStatsPollingOptions::RTCStatsPollingOptions() {
+			webrtc::StatsPollingConfig defaults;
+			EtwStatsInterval = defaults.interval_ms[webrtc::kStatsConsumerEtw];
+			ConnectionHealthStatsInterval =
+				defaults.interval_ms[webrtc::kStatsConsumerConnectionHealth];
+			RtcStatsInterval = defaults.interval_ms[webrtc::kStatsConsumerRtcStats];
+			RemoteHostStatsInterval =
+				defaults.interval_ms[webrtc::kStatsConsumerRemoteHost];
+			QualityHistogramsInterval =
+				defaults.interval_ms[webrtc::kStatsConsumerQuality];
+			Adaptive = defaults.adaptive;
+			AdaptiveFastInterval = defaults.adaptive_fast_ms;
+			AdaptiveSlowInterval = defaults.adaptive_slow_ms;
+		}
+
+		RTCThreadingOptions::RTCThreadingOptions() {
+			ShardCount = 1;
+			ShardPolicy = RTCThreadShardPolicy::RoundRobin;
+		}
+
 		RTCIceCandidate::RTCIceCandidate() {
 		}
 
@@ -126,23 +410,30 @@ namespace Org {
 		}
 
 		RTCPeerConnection::RTCPeerConnection(RTCConfiguration^ configuration)
-			: _observer(new GlobalObserver()) {
+			: _threadShard(0), _observer(new GlobalObserver()) {
 			webrtc::PeerConnectionInterface::RTCConfiguration cc_configuration;
 			FromCx(configuration, &cc_configuration);
-			globals::RunOnGlobalThread<void>([this, cc_configuration] {
+			globals::RunOnGlobalThread<void>([this, configuration, cc_configuration] {
 				webrtc::FakeConstraints constraints;
 				constraints.SetAllowDtlsSctpDataChannels();
 				constraints.AddOptional(
 					webrtc::MediaConstraintsInterface::kCombinedAudioVideoBwe, "true");
 				_observer->SetPeerConnection(this);
-				LOG(LS_INFO) << "Creating PeerConnection native.";
-				_impl = globals::gPeerConnectionFactory->CreatePeerConnection(
-					cc_configuration, &constraints, nullptr, nullptr, _observer.get());
+				_threadShard = globals::AcquireThreadShard();
+				LOG(LS_INFO) << "Creating PeerConnection native on thread shard "
+					<< _threadShard << ".";
+				globals::ThreadShard* shard = globals::gThreadShards[_threadShard].get();
+				std::unique_ptr<cricket::PortAllocator> allocator =
+					globals::CreatePortAllocator(shard, configuration);
+				_impl = shard->factory->CreatePeerConnection(
+					cc_configuration, &constraints, std::move(allocator), nullptr,
+					_observer.get());
 			});
 		}
 
 		RTCPeerConnection::~RTCPeerConnection() {
 			LOG(LS_INFO) << "RTCPeerConnection::~RTCPeerConnection";
+			globals::ReleaseThreadShard(_threadShard);
 			for (typename std::vector<DataChannelObserver*>::iterator it = _dataChannelObservers.begin();
 				it != _dataChannelObservers.end(); ++it) {
 				delete *it;
@@ -160,11 +451,10 @@ namespace Org {
 			std::function<T2(T1)> onCallback) {
 			Concurrency::task_completion_event<T1> tce;
 
-			// Start the initial async operation
-			Concurrency::create_async([tce, init] {
-				globals::RunOnGlobalThread<void>([tce, init] {
-					init(tce);
-				});
+			// Start the initial async operation, the caller doesn't wait
+			// for gThread.
+			globals::PostOnGlobalThread([tce, init] {
+				init(tce);
 			});
 
 			// Create the task that waits on the completion event.
@@ -174,15 +464,18 @@ namespace Org {
 				return onCallback(arg);
 			});
 
-			// Return an async operation that waits on the return value
-			// of the callback and returns it.
+			// Return an async operation that completes with the return
+			// value of the callback.  Returning a continuation keeps a
+			// thread pool thread from waiting on it.
 			return Concurrency::create_async([tceTask] {
-				try {
-					return tceTask.get();
-				}
-				catch (...) {
-					return (T2)nullptr;
-				}
+				return tceTask.then([](Concurrency::task<T2> result) {
+					try {
+						return result.get();
+					}
+					catch (...) {
+						return (T2)nullptr;
+					}
+				});
 			});
 		}
 
@@ -191,20 +484,19 @@ namespace Org {
 			std::function<void(Concurrency::task_completion_event<void>)> init) {
 			Concurrency::task_completion_event<void> tce;
 
-			// Start the initial async operation
-			Concurrency::create_async([tce, init] {
-				globals::RunOnGlobalThread<void>([tce, init] {
-					init(tce);
-				});
+			// Start the initial async operation, the caller doesn't wait
+			// for gThread.
+			globals::PostOnGlobalThread([tce, init] {
+				init(tce);
 			});
 
 			// Create the task that waits on the completion event.
 			auto tceTask = Concurrency::task<void>(tce);
 
-			// Return an async operation that waits on the
-			// task completetion event.
+			// Return an async operation that completes with the
+			// task completion event.
 			return Concurrency::create_async([tceTask] {
-				return tceTask.get();
+				return tceTask;
 			});
 		}
 
@@ -215,6 +507,7 @@ namespace Org {
 						<webrtc::SessionDescriptionInterface*> tce) {
 				webrtc::PeerConnectionInterface::RTCOfferAnswerOptions options;
 
+				TRACE_EVENT0("webrtc", "RTCPeerConnection::CreateOffer");
 				rtc::CritScope lock(&_critSect);
 				if (_impl == nullptr) {
 					tce.set(nullptr);
@@ -222,7 +515,8 @@ namespace Org {
 				}
 
 				rtc::scoped_refptr<CreateSdpObserver> observer(
-					new rtc::RefCountedObject<CreateSdpObserver>(tce));
+					new rtc::RefCountedObject<CreateSdpObserver>(tce,
+						GetCodecPreferences(), "RTCPeerConnection::CreateOfferAsync"));
 				// The callback is kept for the lifetime of the RTCPeerConnection.
 				_createSdpObservers.push_back(observer);
 
@@ -241,6 +535,7 @@ namespace Org {
 						<webrtc::SessionDescriptionInterface*> tce) {
 				webrtc::PeerConnectionInterface::RTCOfferAnswerOptions options;
 
+				TRACE_EVENT0("webrtc", "RTCPeerConnection::CreateAnswer");
 				rtc::CritScope lock(&_critSect);
 				if (_impl == nullptr) {
 					tce.set(nullptr);
@@ -248,7 +543,8 @@ namespace Org {
 				}
 
 				rtc::scoped_refptr<CreateSdpObserver> observer(
-					new rtc::RefCountedObject<CreateSdpObserver>(tce));
+					new rtc::RefCountedObject<CreateSdpObserver>(tce,
+						GetCodecPreferences(), "RTCPeerConnection::CreateAnswerAsync"));
 				// The callback is kept for the lifetime of the RTCPeerConnection.
 				_createSdpObservers.push_back(observer);
 
@@ -260,12 +556,38 @@ namespace Org {
 			});
 		}
 
+		void RTCPeerConnection::SetCodecPreferences(IVector<CodecInfo^>^ codecs) {
+			Internal::CodecPreferences preferences;
+			if (codecs != nullptr) {
+				for (CodecInfo^ codec : codecs) {
+					if (codec == nullptr || codec->Name == nullptr) {
+						THROW_WEBRTC_NULL_REFERENCE_EXCEPTION("Invalid codec");
+					}
+					preferences.push_back(Internal::CodecPreference(
+						FromCx(codec->Name), codec->ClockRate));
+				}
+			}
+			rtc::CritScope lock(&_critSect);
+			_codecPreferences = preferences;
+		}
+
+		Internal::CodecPreferences RTCPeerConnection::GetCodecPreferences() {
+			if (!_codecPreferences.empty()) {
+				return _codecPreferences;
+			}
+			if (globals::gPreferHardwareCodecs) {
+				return Internal::GetHardwareCodecPreferences();
+			}
+			return Internal::CodecPreferences();
+		}
+
 		IAsyncAction^ RTCPeerConnection::SetLocalDescription(
 			RTCSessionDescription^ description) {
 			return CreateCallbackBridge(
 				[this, description](Concurrency::task_completion_event<void> tce) {
 				webrtc::PeerConnectionInterface::RTCOfferAnswerOptions options;
 
+				TRACE_EVENT0("webrtc", "RTCPeerConnection::SetLocalDescription");
 				rtc::CritScope lock(&_critSect);
 				if (_impl == nullptr) {
 					tce.set();
@@ -273,7 +595,8 @@ namespace Org {
 				}
 
 				rtc::scoped_refptr<SetSdpObserver> observer(
-					new rtc::RefCountedObject<SetSdpObserver>(tce));
+					new rtc::RefCountedObject<SetSdpObserver>(tce,
+						"RTCPeerConnection::SetLocalDescriptionAsync"));
 				// The callback is kept for the lifetime of the RTCPeerConnection.
 				_setSdpObservers.push_back(observer);
 
@@ -290,6 +613,7 @@ namespace Org {
 				[this, description](Concurrency::task_completion_event<void> tce) {
 				webrtc::PeerConnectionInterface::RTCOfferAnswerOptions options;
 
+				TRACE_EVENT0("webrtc", "RTCPeerConnection::SetRemoteDescription");
 				rtc::CritScope lock(&_critSect);
 				if (_impl == nullptr) {
 					tce.set();
@@ -297,7 +621,8 @@ namespace Org {
 				}
 
 				rtc::scoped_refptr<SetSdpObserver> observer(
-					new rtc::RefCountedObject<SetSdpObserver>(tce));
+					new rtc::RefCountedObject<SetSdpObserver>(tce,
+						"RTCPeerConnection::SetRemoteDescriptionAsync"));
 				// The callback is kept for the lifetime of the RTCPeerConnection.
 				_setSdpObservers.push_back(observer);
 
@@ -314,35 +639,37 @@ namespace Org {
 		}
 
 		IVector<MediaStream^>^ RTCPeerConnection::GetLocalStreams() {
-			auto ret = ref new Vector<MediaStream^>();
-			globals::RunOnGlobalThread<void>([this, ret] {
+			std::vector<MediaStream^> ret;
+			globals::RunOnGlobalThread<void>([this, &ret] {
 				rtc::CritScope lock(&_critSect);
 				if (_impl == nullptr) {
 					return;
 				}
 
 				auto streams = _impl->local_streams();
+				ret.reserve(streams->count());
 				for (size_t i = 0; i < streams->count(); ++i) {
-					ret->Append(ref new MediaStream(streams->at(i)));
+					ret.push_back(Internal::GetMediaStream(streams->at(i)));
 				}
 			});
-			return ret;
+			return ref new Vector<MediaStream^>(std::move(ret));
 		}
 
 		IVector<MediaStream^>^ RTCPeerConnection::GetRemoteStreams() {
-			auto ret = ref new Vector<MediaStream^>();
-			globals::RunOnGlobalThread<void>([this, ret] {
+			std::vector<MediaStream^> ret;
+			globals::RunOnGlobalThread<void>([this, &ret] {
 				rtc::CritScope lock(&_critSect);
 				if (_impl == nullptr) {
 					return;
 				}
 
 				auto streams = _impl->remote_streams();
+				ret.reserve(streams->count());
 				for (size_t i = 0; i < streams->count(); ++i) {
-					ret->Append(ref new MediaStream(streams->at(i)));
+					ret.push_back(Internal::GetMediaStream(streams->at(i)));
 				}
 			});
-			return ret;
+			return ref new Vector<MediaStream^>(std::move(ret));
 		}
 
 		MediaStream^ RTCPeerConnection::GetStreamById(String^ streamId) {
@@ -359,7 +686,7 @@ namespace Org {
 				for (size_t i = 0; i < streams->count(); ++i) {
 					auto stream = streams->at(i);
 					if (stream->label() == streamIdStr) {
-						ret = ref new MediaStream(stream);
+						ret = Internal::GetMediaStream(stream);
 						return;
 					}
 				}
@@ -368,7 +695,7 @@ namespace Org {
 				for (size_t i = 0; i < streams->count(); ++i) {
 					auto stream = streams->at(i);
 					if (stream->label() == streamIdStr) {
-						ret = ref new MediaStream(stream);
+						ret = Internal::GetMediaStream(stream);
 						return;
 					}
 				}
@@ -383,7 +710,9 @@ namespace Org {
 					return;
 				}
 
-				_impl->AddStream(stream->GetImpl());
+				if (_impl->AddStream(stream->GetImpl())) {
+					_observer->OnLocalStreamAdded(stream->GetImpl());
+				}
 			});
 		}
 
@@ -395,6 +724,7 @@ namespace Org {
 				}
 
 				_impl->RemoveStream(stream->GetImpl());
+				_observer->OnLocalStreamRemoved(stream->GetImpl());
 			});
 		}
 
@@ -414,7 +744,8 @@ namespace Org {
 				FromCx(label), init != nullptr ? &nativeInit : nullptr);
 			auto ret = ref new RTCDataChannel(channel);
 
-			auto observer = new Org::WebRtc::Internal::DataChannelObserver(ret);
+			auto observer = new Org::WebRtc::Internal::DataChannelObserver(ret,
+				_observer->GetEventQueue());
 			// The callback is kept for the lifetime of the RTCPeerConnection.
 			_dataChannelObservers.push_back(observer);
 			channel->RegisterObserver(observer);
@@ -436,6 +767,38 @@ namespace Org {
 			});
 		}
 
+		IAsyncAction^ RTCPeerConnection::AddIceCandidates(
+			IVector<RTCIceCandidate^>^ candidates) {
+			if (candidates == nullptr) {
+				THROW_WEBRTC_NULL_REFERENCE_EXCEPTION("Invalid candidates");
+			}
+			// Converted on the calling thread, the collection may not be
+			// agile.
+			auto nativeCandidates =
+				std::make_shared<std::vector<std::unique_ptr<webrtc::IceCandidateInterface>>>();
+			for (RTCIceCandidate^ candidate : candidates) {
+				if (candidate == nullptr) {
+					continue;
+				}
+				std::unique_ptr<webrtc::IceCandidateInterface> nativeCandidate;
+				FromCx(candidate, &nativeCandidate);
+				if (nativeCandidate != nullptr) {
+					nativeCandidates->push_back(std::move(nativeCandidate));
+				}
+			}
+			return Concurrency::create_async([this, nativeCandidates] {
+				globals::RunOnGlobalThread<void>([this, nativeCandidates] {
+					rtc::CritScope lock(&_critSect);
+					if (_impl == nullptr) {
+						return;
+					}
+					for (auto& nativeCandidate : *nativeCandidates) {
+						_impl->AddIceCandidate(nativeCandidate.get());
+					}
+				});
+			});
+		}
+
 		void RTCPeerConnection::Close() {
 			globals::RunOnGlobalThread<void>([this] {
 				rtc::CritScope lock(&_critSect);
@@ -451,6 +814,30 @@ namespace Org {
 			});
 		}
 
+		uint32 RTCPeerConnection::EventBatchSize::get() {
+			return (uint32)_observer->GetEventQueue()->GetMaxBatchSize();
+		}
+
+		void RTCPeerConnection::EventBatchSize::set(uint32 value) {
+			_observer->GetEventQueue()->SetMaxBatchSize(value);
+		}
+
+		int RTCPeerConnection::EventBatchLatencyMs::get() {
+			return _observer->GetEventQueue()->GetMaxLatencyMs();
+		}
+
+		void RTCPeerConnection::EventBatchLatencyMs::set(int value) {
+			_observer->GetEventQueue()->SetMaxLatencyMs(value);
+		}
+
+		int RTCPeerConnection::IceCandidateBatchMs::get() {
+			return _observer->GetIceCandidateBatchMs();
+		}
+
+		void RTCPeerConnection::IceCandidateBatchMs::set(int value) {
+			_observer->SetIceCandidateBatchMs(value);
+		}
+
 		bool RTCPeerConnection::EtwStatsEnabled::get() {
 			return globals::RunOnGlobalThread<bool>([this] {
 				return _observer->AreETWStatsEnabled();
@@ -487,6 +874,32 @@ namespace Org {
 			});
 		}
 
+		bool RTCPeerConnection::QualityHistogramsEnabled::get() {
+			return globals::RunOnGlobalThread<bool>([this] {
+				return _observer->AreQualityHistogramsEnabled();
+			});
+		}
+
+		void RTCPeerConnection::QualityHistogramsEnabled::set(bool value) {
+			globals::RunOnGlobalThread<void>([this, value] {
+				_observer->EnableQualityHistograms(value);
+			});
+		}
+
+		uint32 RTCPeerConnection::QualitySummaryIntervalMinutes::get() {
+			return globals::RunOnGlobalThread<uint32>([this] {
+				return (uint32)(_observer->GetQualitySummaryInterval() / 60000);
+			});
+		}
+
+		void RTCPeerConnection::QualitySummaryIntervalMinutes::set(uint32 value) {
+			// A day at most, the final summary covers longer calls.
+			int intervalMs = (int)std::min<uint32>(value, 24 * 60) * 60000;
+			globals::RunOnGlobalThread<void>([this, intervalMs] {
+				_observer->SetQualitySummaryInterval(intervalMs);
+			});
+		}
+
 		bool RTCPeerConnection::SendRtcStatsToRemoteHostEnabled::get() {
 			return globals::RunOnGlobalThread<bool>([this] {
 				return _observer->IsSendRtcStatsToRemoteHostEnabled();
@@ -523,6 +936,108 @@ namespace Org {
 			});
 		}
 
+		RTCStatsFormat RTCPeerConnection::RtcStatsDestinationFormat::get() {
+			return globals::RunOnGlobalThread<RTCStatsFormat>([this] {
+				return _observer->GetRtcStatsDestinationFormat() ==
+					webrtc::kStatsNetworkFormatBinary ?
+					RTCStatsFormat::Binary : RTCStatsFormat::Json;
+			});
+		}
+
+		void RTCPeerConnection::RtcStatsDestinationFormat::set(RTCStatsFormat value) {
+			globals::RunOnGlobalThread<void>([this, value] {
+				_observer->SetRtcStatsDestinationFormat(value == RTCStatsFormat::Binary ?
+					webrtc::kStatsNetworkFormatBinary : webrtc::kStatsNetworkFormatJson);
+			});
+		}
+
+		RTCStatsPollingOptions^ RTCPeerConnection::StatsPollingOptions::get() {
+			webrtc::StatsPollingConfig config =
+				globals::RunOnGlobalThread<webrtc::StatsPollingConfig>([this] {
+				return _observer->GetStatsPollingConfig();
+			});
+			auto options = ref new RTCStatsPollingOptions();
+			options->EtwStatsInterval = config.interval_ms[webrtc::kStatsConsumerEtw];
+			options->ConnectionHealthStatsInterval =
+				config.interval_ms[webrtc::kStatsConsumerConnectionHealth];
+			options->RtcStatsInterval = config.interval_ms[webrtc::kStatsConsumerRtcStats];
+			options->RemoteHostStatsInterval =
+				config.interval_ms[webrtc::kStatsConsumerRemoteHost];
+			options->QualityHistogramsInterval =
+				config.interval_ms[webrtc::kStatsConsumerQuality];
+			options->Adaptive = config.adaptive;
+			options->AdaptiveFastInterval = config.adaptive_fast_ms;
+			options->AdaptiveSlowInterval = config.adaptive_slow_ms;
+			return options;
+		}
+
+		void RTCPeerConnection::StatsPollingOptions::set(RTCStatsPollingOptions^ value) {
+			if (value == nullptr) {
+				return;
+			}
+			// Fast enough for incidents, slow enough to stay cheap.
+			auto clamp = [](uint32 interval) {
+				return (int)std::min<uint32>(std::max<uint32>(interval, 100), 60000);
+			};
+			webrtc::StatsPollingConfig config;
+			config.interval_ms[webrtc::kStatsConsumerEtw] = clamp(value->EtwStatsInterval);
+			config.interval_ms[webrtc::kStatsConsumerConnectionHealth] =
+				clamp(value->ConnectionHealthStatsInterval);
+			config.interval_ms[webrtc::kStatsConsumerRtcStats] = clamp(value->RtcStatsInterval);
+			config.interval_ms[webrtc::kStatsConsumerRemoteHost] =
+				clamp(value->RemoteHostStatsInterval);
+			config.interval_ms[webrtc::kStatsConsumerQuality] =
+				clamp(value->QualityHistogramsInterval);
+			config.adaptive = value->Adaptive;
+			config.adaptive_fast_ms = clamp(value->AdaptiveFastInterval);
+			config.adaptive_slow_ms = std::max(clamp(value->AdaptiveSlowInterval),
+				config.adaptive_fast_ms);
+			globals::RunOnGlobalThread<void>([this, config] {
+				_observer->SetStatsPollingConfig(config);
+			});
+		}
+
+		namespace {
+			webrtc::StatsFilter ToStatsFilter(
+				Windows::Foundation::Collections::IIterable<RTCStatsType>^ reportTypes,
+				Windows::Foundation::Collections::IIterable<RTCStatsValueName>^ valueNames) {
+				webrtc::StatsFilter filter;
+				if (reportTypes != nullptr) {
+					for (RTCStatsType type : reportTypes) {
+						webrtc::StatsReport::StatsType nativeType;
+						FromCx(type, &nativeType);
+						filter.report_types.insert(nativeType);
+					}
+				}
+				if (valueNames != nullptr) {
+					for (RTCStatsValueName name : valueNames) {
+						webrtc::StatsReport::StatsValueName nativeName;
+						FromCx(name, &nativeName);
+						filter.value_names.insert(nativeName);
+					}
+				}
+				return filter;
+			}
+		}
+
+		void RTCPeerConnection::SetRtcStatsFilter(
+			Windows::Foundation::Collections::IIterable<RTCStatsType>^ reportTypes,
+			Windows::Foundation::Collections::IIterable<RTCStatsValueName>^ valueNames) {
+			webrtc::StatsFilter filter = ToStatsFilter(reportTypes, valueNames);
+			globals::RunOnGlobalThread<void>([this, filter] {
+				_observer->SetRtcStatsFilter(filter);
+			});
+		}
+
+		void RTCPeerConnection::SetEtwStatsFilter(
+			Windows::Foundation::Collections::IIterable<RTCStatsType>^ reportTypes,
+			Windows::Foundation::Collections::IIterable<RTCStatsValueName>^ valueNames) {
+			webrtc::StatsFilter filter = ToStatsFilter(reportTypes, valueNames);
+			globals::RunOnGlobalThread<void>([this, filter] {
+				_observer->SetEtwStatsFilter(filter);
+			});
+		}
+
 		RTCSessionDescription^ RTCPeerConnection::LocalDescription::get() {
 			RTCSessionDescription^ ret;
 			globals::RunOnGlobalThread<void>([this, &ret] {
@@ -649,40 +1164,126 @@ namespace Org {
 		}
 
 		void WebRTC::Initialize(Windows::UI::Core::CoreDispatcher^ dispatcher) {
+			Initialize(dispatcher, ref new RTCThreadingOptions());
+		}
+
+		void WebRTC::Initialize(Windows::UI::Core::CoreDispatcher^ dispatcher,
+			RTCThreadingOptions^ options) {
+			rtc::CritScope lock(&globals::gInitializeLock);
 			if (globals::isInitialized)
 				return;
 
+			uint32 shardCount = std::max(options->ShardCount, 1u);
+			RTCThreadShardPolicy shardPolicy = options->ShardPolicy;
+
 			webrtc::VideoCommonWinUWP::SetCoreDispatcher(dispatcher);
 
+			// Probe the H264 MFTs in the background, the encoders created
+			// before it completes use the Media Foundation defaults.
+			std::string mftCapabilitiesFile =
+				globals::OutputPath() + globals::mftCapabilitiesFileName;
+			globals::gMftProbeTask = Concurrency::create_task([mftCapabilitiesFile] {
+				webrtc::ProbeH264MftCapabilities(mftCapabilitiesFile);
+			});
+
 			// Create a worker thread
 			globals::gThread.SetName("WinUWPApiWorker", nullptr);
 			globals::gThread.Start();
-			globals::RunOnGlobalThread<void>([] {
+			globals::RunOnGlobalThread<void>([shardCount, shardPolicy] {
+				webrtc::ResourceSampler::RegisterCurrentThread("WinUWPApiWorker");
 				rtc::EnsureWinsockInit();
 				rtc::InitializeSSL(globals::certificateVerifyCallBack);
 
-				globals::gNetworkThread = rtc::Thread::CreateWithSocketServer();
-				globals::gNetworkThread->Start();
-
-				globals::gWorkerThread = rtc::Thread::Create();
-				globals::gWorkerThread->Start();
+				globals::gThreadShardPolicy = shardPolicy;
+				if (globals::gLowLatencyAudio) {
+					globals::gAudioDeviceModule = new rtc::RefCountedObject<
+						Internal::LowLatencyAudioDeviceModule>(globals::gAudioPeriodFrames);
+				}
+				for (uint32 i = 0; i < shardCount; ++i) {
+					std::unique_ptr<globals::ThreadShard> shard(new globals::ThreadShard());
+					std::string suffix = shardCount > 1 ? "_" + rtc::ToString(i) : "";
+
+					shard->networkThread = rtc::Thread::CreateWithSocketServer();
+					shard->networkThread->SetName("WebRtcNetwork" + suffix, nullptr);
+					shard->networkThread->Start();
+
+					shard->workerThread = rtc::Thread::Create();
+					shard->workerThread->SetName("WebRtcWorker" + suffix, nullptr);
+					shard->workerThread->Start();
+
+					shard->signalingThread = rtc::Thread::Create();
+					shard->signalingThread->SetName("WebRtcSignaling" + suffix, nullptr);
+					shard->signalingThread->Start();
+
+					auto encoderFactory = new webrtc::WinUWPH264EncoderFactory();
+					auto decoderFactory = new webrtc::WinUWPH264DecoderFactory();
+
+					// The voice engine of a factory owns the audio device,
+					// the other shards keep the default one.
+					webrtc::AudioDeviceModule* audioDeviceModule =
+						i == 0 ? globals::gAudioDeviceModule.get() : nullptr;
+
+					LOG(LS_INFO) << "Creating PeerConnectionFactory" << suffix << ".";
+					shard->factory = webrtc::CreatePeerConnectionFactory(
+						shard->networkThread.get(), shard->workerThread.get(),
+						shard->signalingThread.get(),
+						audioDeviceModule, encoderFactory, decoderFactory);
+					// Sampled by name, the shards of a kind add up.
+					for (auto& thread : { std::make_pair(shard->networkThread.get(), "WebRtcNetwork"),
+						std::make_pair(shard->workerThread.get(), "WebRtcWorker"),
+						std::make_pair(shard->signalingThread.get(), "WebRtcSignaling") }) {
+						const char* name = thread.second;
+						thread.first->Invoke<void>(RTC_FROM_HERE, [name] {
+							webrtc::ResourceSampler::RegisterCurrentThread(name);
+						});
+					}
+					globals::gThreadShards.push_back(std::move(shard));
+				}
+				webrtc::ResourceSampler::Instance()->Start(1000);
+				globals::gPeerConnectionFactory = globals::gThreadShards[0]->factory;
 
-				globals::gSignalingThread = rtc::Thread::Create();
-				globals::gSignalingThread->Start();
+				Internal::InstallFlightRecorder(globals::gFlightRecorderCapacity);
+			});
+			globals::isInitialized = true;
+		}
 
-				auto encoderFactory = new webrtc::WinUWPH264EncoderFactory();
-				auto decoderFactory = new webrtc::WinUWPH264DecoderFactory();
+		IAsyncAction^ WebRTC::WarmUpAsync(Windows::UI::Core::CoreDispatcher^ dispatcher,
+			RTCThreadingOptions^ options) {
+			return Concurrency::create_async([dispatcher, options] {
+				int64_t startTime = rtc::TimeMillis();
+				Initialize(dispatcher, options);
+
+				// Held for the lifetime of the process, the MFStartup() of each
+				// encoder and decoder only takes a reference after that.
+				webrtc::KeepMediaFoundationStarted();
+
+				// Enumerated in parallel with the codecs, the OS keeps the
+				// results warm for the device pickers and GetUserMedia.
+				using Windows::Devices::Enumeration::DeviceClass;
+				using Windows::Devices::Enumeration::DeviceInformation;
+				std::vector<Concurrency::task<void>> enumerations;
+				for (DeviceClass deviceClass : { DeviceClass::VideoCapture,
+					DeviceClass::AudioCapture, DeviceClass::AudioRender }) {
+					enumerations.push_back(Concurrency::create_task(
+						DeviceInformation::FindAllAsync(deviceClass)).then(
+						[](Concurrency::task<Windows::Devices::Enumeration::DeviceInformationCollection^> t) {
+						try {
+							t.get();
+						} catch (Platform::Exception^ e) {
+							LOG(LS_WARNING) << "Device enumeration failed: "
+								<< rtc::ToUtf8(e->Message->Data());
+						}
+					}));
+				}
 
-				LOG(LS_INFO) << "Creating PeerConnectionFactory.";
-				globals::gPeerConnectionFactory =
-					webrtc::CreatePeerConnectionFactory(
-						globals::gNetworkThread.get(), globals::gWorkerThread.get(),
-						globals::gSignalingThread.get(),
-						nullptr, encoderFactory, decoderFactory);
+				// The codecs are only loaded once the probe is done with the MFTs.
+				globals::gMftProbeTask.wait();
+				globals::WarmUpH264Codecs();
 
-				rtc::tracing::SetupInternalTracer();
+				Concurrency::when_all(enumerations.begin(), enumerations.end()).wait();
+				LOG(LS_INFO) << "WebRTC warm-up done in "
+					<< (rtc::TimeMillis() - startTime) << "ms";
 			});
-			globals::isInitialized = true;
 		}
 
 		bool WebRTC::IsTracing() {
@@ -692,12 +1293,103 @@ namespace Org {
 		void WebRTC::StartTracing(Platform::String^ filename) {
 			globals::gIsTracing = true;
 			std::string filenameStr = FromCx(filename);
-			rtc::tracing::StartInternalCapture(filenameStr.c_str());
+			Internal::StartTraceCapture(filenameStr);
 		}
 
 		void WebRTC::StopTracing() {
 			globals::gIsTracing = false;
-			rtc::tracing::StopInternalCapture();
+			Internal::StopTraceCapture();
+		}
+
+		uint32 WebRTC::FlightRecorderCapacity::get() {
+			return globals::gFlightRecorderCapacity;
+		}
+
+		void WebRTC::FlightRecorderCapacity::set(uint32 value) {
+			globals::gFlightRecorderCapacity = std::min(value, 1024u * 1024u);
+		}
+
+		bool WebRTC::FlightRecorderEnabled::get() {
+			return Internal::IsFlightRecorderEnabled();
+		}
+
+		void WebRTC::FlightRecorderEnabled::set(bool value) {
+			Internal::SetFlightRecorderEnabled(value);
+		}
+
+		bool WebRTC::PipelineStageTimingEnabled::get() {
+			return webrtc::IsPipelineStageTimingEnabled();
+		}
+
+		void WebRTC::PipelineStageTimingEnabled::set(bool value) {
+			webrtc::SetPipelineStageTimingEnabled(value);
+		}
+
+		String^ WebRTC::GetPipelineStageTimings(bool reset) {
+			return ToCx(webrtc::GetPipelineStageTimingsJson(reset));
+		}
+
+		uint64 WebRTC::FrameMemoryBudgetBytes::get() {
+			return webrtc::GetFrameMemoryBudget();
+		}
+
+		void WebRTC::FrameMemoryBudgetBytes::set(uint64 value) {
+			webrtc::SetFrameMemoryBudget(value);
+		}
+
+		int64 WebRTC::FrameMemoryHeldBytes::get() {
+			return webrtc::GetFrameMemoryHeld();
+		}
+
+		IMapView<String^, int64>^ WebRTC::FrameMemoryHeldBytesByQueue::get() {
+			std::map<std::string, int64_t> accounts;
+			webrtc::GetFrameMemoryAccounts(&accounts);
+			auto ret = ref new Platform::Collections::Map<String^, int64>();
+			for (auto& account : accounts) {
+				ret->Insert(ToCxInterned(account.first), account.second);
+			}
+			return ret->GetView();
+		}
+
+		int64 WebRTC::FrameMemoryPeakBytes::get() {
+			return webrtc::GetFrameMemoryPeak();
+		}
+
+		uint64 WebRTC::FrameMemoryBudgetDrops::get() {
+			return webrtc::GetFrameMemoryBudgetDrops();
+		}
+
+		bool WebRTC::LowLatencyAudio::get() {
+			return globals::gLowLatencyAudio;
+		}
+
+		void WebRTC::LowLatencyAudio::set(bool value) {
+			globals::gLowLatencyAudio = value;
+		}
+
+		uint32 WebRTC::AudioPeriodFrames::get() {
+			return globals::gAudioPeriodFrames;
+		}
+
+		void WebRTC::AudioPeriodFrames::set(uint32 value) {
+			globals::gAudioPeriodFrames = value;
+		}
+
+		IAsyncOperation<String^>^ WebRTC::DumpTraceAsync(uint32 lastSeconds) {
+			return Concurrency::create_async([lastSeconds]() -> String^ {
+				SYSTEMTIME time;
+				GetLocalTime(&time);
+				char fileName[64];
+				sprintf_s(fileName, "_webrtc_trace_%04d%02d%02d_%02d%02d%02d.json",
+					time.wYear, time.wMonth, time.wDay,
+					time.wHour, time.wMinute, time.wSecond);
+				if (!Internal::DumpFlightRecorder(
+					globals::OutputPath() + fileName,
+					(int64_t)lastSeconds * rtc::kNumMicrosecsPerSec)) {
+					return nullptr;
+				}
+				return ToCx(std::string(fileName));
+			});
 		}
 
 		void WebRTC::EnableLogging(LogLevel level) {
@@ -713,23 +1405,26 @@ namespace Org {
 				new rtc::LoggingServer());
 			globals::gLoggingServer->Listen(sa, static_cast<rtc::LoggingSeverity>(level));
 
-			// setup logging to a file
-			rtc::FileStream* fileStream = new rtc::FileStream();
-			fileStream->Open(globals::OutputPath() + globals::logFileName, "wb", NULL);
-			fileStream->DisableBuffering();
-			globals::gLoggingFile = std::unique_ptr<globals::FileLogSink>(
-				new globals::FileLogSink(fileStream));
-			rtc::LogMessage::AddLogToStream(globals::gLoggingFile.get(),
-				static_cast<rtc::LoggingSeverity>(level));
+			// setup logging to a file, written off the logging threads
+			globals::gLoggingFile = std::unique_ptr<Internal::FileLogSink>(
+				new Internal::FileLogSink(globals::OutputPath() + globals::logFileName,
+					globals::gLogFileMaxSize, globals::gLogFileSegments,
+					globals::gCompressLogSegments));
+			if (globals::gLoggingFile->IsOpen()) {
+				rtc::LogMessage::AddLogToStream(globals::gLoggingFile.get(),
+					static_cast<rtc::LoggingSeverity>(level));
+			}
 
 			LOG(LS_INFO) << "WebRTC logging enabled";
 		}
 
 		void WebRTC::DisableLogging() {
 			LOG(LS_INFO) << "WebRTC logging disabled";
-			rtc::LogMessage::RemoveLogToStream(globals::gLoggingFile.get());
-			globals::gLoggingFile.get()->file()->Close();
-			globals::gLoggingFile.reset();
+			if (globals::gLoggingFile != nullptr) {
+				rtc::LogMessage::RemoveLogToStream(globals::gLoggingFile.get());
+				// Writes what is still buffered.
+				globals::gLoggingFile.reset();
+			}
 			globals::gLoggingServer.reset();
 		}
 
@@ -741,6 +1436,37 @@ namespace Org {
 			return globals::toPlatformString(globals::logFileName);
 		}
 
+		uint32 WebRTC::LogFileMaxSize::get() {
+			return globals::gLogFileMaxSize;
+		}
+
+		void WebRTC::LogFileMaxSize::set(uint32 value) {
+			globals::gLogFileMaxSize = value;
+		}
+
+		uint32 WebRTC::LogFileSegments::get() {
+			return globals::gLogFileSegments;
+		}
+
+		void WebRTC::LogFileSegments::set(uint32 value) {
+			globals::gLogFileSegments = std::min(value, 100u);
+		}
+
+		bool WebRTC::CompressLogSegments::get() {
+			return globals::gCompressLogSegments;
+		}
+
+		void WebRTC::CompressLogSegments::set(bool value) {
+			globals::gCompressLogSegments = value;
+		}
+
+		uint64 WebRTC::LogMessagesDropped::get() {
+			if (globals::gLoggingFile == nullptr) {
+				return 0;
+			}
+			return globals::gLoggingFile->DroppedMessages();
+		}
+
 		IVector<CodecInfo^>^ WebRTC::GetAudioCodecs() {
 			auto ret = ref new Vector<CodecInfo^>();
 			globals::RunOnGlobalThread<void>([ret] {
@@ -762,27 +1488,134 @@ namespace Org {
 				ret->Append(ref new CodecInfo(98, 90000, "VP9"));
 				ret->Append(ref new CodecInfo(125, 90000, "H264"));
 			});
+			if (globals::gPreferHardwareCodecs &&
+				!Internal::GetHardwareCodecPreferences().empty()) {
+				// H264, the only one that can be accelerated.
+				CodecInfo^ h264 = ret->GetAt(ret->Size - 1);
+				ret->RemoveAt(ret->Size - 1);
+				ret->InsertAt(0, h264);
+			}
 			return ret;
 		}
 
+		bool WebRTC::PreferHardwareCodecs::get() {
+			return globals::gPreferHardwareCodecs;
+		}
+
+		void WebRTC::PreferHardwareCodecs::set(bool value) {
+			globals::gPreferHardwareCodecs = value;
+		}
+
 		void WebRTC::SynNTPTime(int64 currentNtpTime) {
 			rtc::SyncWithNtp(currentNtpTime);
 		}
 
 		double WebRTC::CpuUsage::get() {
-			return globals::gCurrentCPUUsage;
+			return webrtc::ResourceSampler::Instance()->GetLastUsage().processCpuUsage;
 		}
 
-		void WebRTC::CpuUsage::set(double value) {
-			globals::gCurrentCPUUsage = value;
+		INT64 WebRTC::MemoryUsage::get() {
+			return webrtc::ResourceSampler::Instance()->GetLastUsage().workingSetBytes;
 		}
 
-		INT64 WebRTC::MemoryUsage::get() {
-			return globals::gCurrentMEMUsage;
+		IMapView<String^, double>^ WebRTC::ThreadCpuUsage::get() {
+			auto ret = ref new Platform::Collections::Map<String^, double>();
+			for (auto& thread :
+				webrtc::ResourceSampler::Instance()->GetLastUsage().threadCpuUsage) {
+				ret->Insert(ToCxInterned(thread.first), thread.second);
+			}
+			return ret->GetView();
+		}
+
+		bool WebRTC::DirectI420Rendering::get() {
+			return globals::gDirectI420Rendering;
+		}
+
+		void WebRTC::DirectI420Rendering::set(bool value) {
+			globals::gDirectI420Rendering = value;
+		}
+
+		uint32 WebRTC::RenderMaxFramerate::get() {
+			return globals::gRenderMaxFramerate;
+		}
+
+		void WebRTC::RenderMaxFramerate::set(uint32 value) {
+			globals::gRenderMaxFramerate = value;
+		}
+
+		uint32 WebRTC::RenderPacingFramerate::get() {
+			return globals::gRenderPacingFramerate;
+		}
+
+		void WebRTC::RenderPacingFramerate::set(uint32 value) {
+			globals::gRenderPacingFramerate = std::min(value, 240u);
+		}
+
+		bool WebRTC::GpuVideoPipeline::get() {
+			return IsGpuPipelineEnabled();
+		}
+
+		void WebRTC::GpuVideoPipeline::set(bool value) {
+			SetGpuPipelineEnabled(value);
+		}
+
+		uint32 WebRTC::H264EncoderMaxFramesInFlight::get() {
+			return webrtc::GetH264EncoderMaxFramesInFlight();
+		}
+
+		void WebRTC::H264EncoderMaxFramesInFlight::set(uint32 value) {
+			webrtc::SetH264EncoderMaxFramesInFlight(value);
+		}
+
+		H264EncoderDropPolicy WebRTC::H264EncoderFrameDropPolicy::get() {
+			switch (webrtc::GetH264EncoderDropPolicy()) {
+			case webrtc::H264EncoderDropPolicy::kDropOldest:
+				return H264EncoderDropPolicy::DropOldest;
+			case webrtc::H264EncoderDropPolicy::kKeepKeyFrames:
+				return H264EncoderDropPolicy::KeepKeyFrames;
+			default:
+				return H264EncoderDropPolicy::DropNewest;
+			}
+		}
+
+		void WebRTC::H264EncoderFrameDropPolicy::set(H264EncoderDropPolicy value) {
+			switch (value) {
+			case H264EncoderDropPolicy::DropOldest:
+				webrtc::SetH264EncoderDropPolicy(webrtc::H264EncoderDropPolicy::kDropOldest);
+				break;
+			case H264EncoderDropPolicy::KeepKeyFrames:
+				webrtc::SetH264EncoderDropPolicy(webrtc::H264EncoderDropPolicy::kKeepKeyFrames);
+				break;
+			default:
+				webrtc::SetH264EncoderDropPolicy(webrtc::H264EncoderDropPolicy::kDropNewest);
+				break;
+			}
+		}
+
+		uint32 WebRTC::H264EncoderTemporalLayers::get() {
+			return webrtc::GetH264EncoderTemporalLayerCount();
+		}
+
+		void WebRTC::H264EncoderTemporalLayers::set(uint32 value) {
+			webrtc::SetH264EncoderTemporalLayerCount(value);
+		}
+
+		bool WebRTC::H264EncoderDirectSampleDelivery::get() {
+			return webrtc::GetH264EncoderDirectSampleDelivery();
+		}
+
+		void WebRTC::H264EncoderDirectSampleDelivery::set(bool value) {
+			webrtc::SetH264EncoderDirectSampleDelivery(value);
+		}
+
+		H264DecoderMode WebRTC::H264DecodingMode::get() {
+			return webrtc::GetH264DecoderMode() == webrtc::H264DecoderMode::kDecode ?
+				H264DecoderMode::Decode : H264DecoderMode::Passthrough;
 		}
 
-		void WebRTC::MemoryUsage::set(INT64 value) {
-			globals::gCurrentMEMUsage = value;
+		void WebRTC::H264DecodingMode::set(H264DecoderMode value) {
+			webrtc::SetH264DecoderMode(value == H264DecoderMode::Decode ?
+				webrtc::H264DecoderMode::kDecode : webrtc::H264DecoderMode::kPassthrough);
 		}
 
 		void WebRTC::SetPreferredVideoCaptureFormat(int frameWidth,
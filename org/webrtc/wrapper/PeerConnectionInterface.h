@@ -12,6 +12,8 @@
 #define ORG_WEBRTC_PEERCONNECTIONINTERFACE_H_
 
 #include <collection.h>
+#include <ppltasks.h>
+#include <functional>
 #include <vector>
 #include "webrtc/api/peerconnectioninterface.h"
 #include "webrtc/rtc_base/scoped_ref_ptr.h"
@@ -19,11 +21,13 @@
 #include "GlobalObserver.h"
 #include "DataChannel.h"
 #include "webrtc/rtc_base/criticalsection.h"
+#include "webrtc/rtc_base/trace_event.h"
 #include "RTCStatsReport.h"
 
 using Platform::String;
 using Platform::IBox;
 using Windows::Foundation::Collections::IVector;
+using Windows::Foundation::Collections::IMapView;
 using Windows::Foundation::IAsyncOperation;
 using Windows::Foundation::IAsyncAction;
 using Org::WebRtc::Internal::CreateSdpObserver;
@@ -37,6 +41,10 @@ namespace Org {
 		ref class MediaStream;
 		ref class MediaStreamTrack;
 
+		namespace Internal {
+			class LowLatencyAudioDeviceModule;
+		}
+
 		public enum class LogLevel {
 			LOGLVL_SENSITIVE = rtc::LS_SENSITIVE,
 			LOGLVL_VERBOSE = rtc::LS_VERBOSE,
@@ -94,6 +102,129 @@ namespace Org {
 			}
 		};
 
+		/// <summary>
+		/// How new peer connections are assigned to a thread shard, see
+		/// <see cref="RTCThreadingOptions"/>.
+		/// </summary>
+		public enum class RTCThreadShardPolicy {
+			/// <summary>Each connection goes to the next shard in turn.</summary>
+			RoundRobin,
+			/// <summary>
+			/// Each connection goes to the shard with the fewest open
+			/// connections.
+			/// </summary>
+			LeastConnections
+		};
+
+		/// <summary>
+		/// Threading options of <see cref="WebRTC::Initialize"/>.
+		/// </summary>
+		public ref class RTCThreadingOptions sealed {
+		public:
+			RTCThreadingOptions();
+
+			/// <summary>
+			/// Number of network, worker and signaling thread sets the peer
+			/// connections are spread over, 1 by default.  Use more to host
+			/// many connections in one process.  The media tracks are created
+			/// on the first shard, connections on the other shards open their
+			/// own audio device.
+			/// </summary>
+			property uint32 ShardCount;
+
+			property RTCThreadShardPolicy ShardPolicy;
+		};
+
+		/// <summary>
+		/// How received H264 video is decoded.
+		/// </summary>
+		public enum class H264DecoderMode {
+			/// <summary>
+			/// The encoded frames are handed to the media element, which
+			/// decodes them.  Raw frames and renderers without a media
+			/// element don't see the pictures.
+			/// </summary>
+			Passthrough,
+			/// <summary>
+			/// Decoded by a Media Foundation decoder, hardware accelerated
+			/// when available, and delivered as NV12 frames like any other
+			/// codec.  Falls back to Passthrough without a decoder.
+			/// </summary>
+			Decode
+		};
+
+		/// <summary>
+		/// What the H264 encoder does with a frame arriving while the maximum
+		/// number of frames are being encoded.
+		/// </summary>
+		public enum class H264EncoderDropPolicy {
+			/// <summary>The new frame is dropped.</summary>
+			DropNewest,
+			/// <summary>
+			/// The new frame is kept, replacing an older waiting one, and
+			/// encoded as soon as the encoder has room.
+			/// </summary>
+			DropOldest,
+			/// <summary>
+			/// Like DropNewest, but frames carrying a key frame request are
+			/// always encoded.
+			/// </summary>
+			KeepKeyFrames
+		};
+
+		/// <summary>
+		/// Format of the statistics sent with
+		/// <see cref="RTCPeerConnection::SendRtcStatsToRemoteHostEnabled"/>.
+		/// </summary>
+		public enum class RTCStatsFormat {
+			/// <summary>
+			/// One JSON object per poll, between STX and ETX markers.
+			/// </summary>
+			Json,
+			/// <summary>
+			/// Compact binary stream: the names are sent once per connection
+			/// and the values as deltas from the previous poll. See
+			/// webrtc_stats_network_sender.h for the layout.
+			/// </summary>
+			Binary
+		};
+
+		/// <summary>
+		/// How often the statistics of a connection are collected, see
+		/// <see cref="RTCPeerConnection::StatsPollingOptions"/>. Intervals are
+		/// in milliseconds, 1000 by default.
+		/// </summary>
+		public ref class RTCStatsPollingOptions sealed {
+		public:
+			RTCStatsPollingOptions();
+
+			/// <summary>Interval of the ETW statistics.</summary>
+			property uint32 EtwStatsInterval;
+			/// <summary>Interval of OnConnectionHealthStats.</summary>
+			property uint32 ConnectionHealthStatsInterval;
+			/// <summary>Interval of OnRTCStatsReportsReady.</summary>
+			property uint32 RtcStatsInterval;
+			/// <summary>Interval of the statistics sent to the remote host.</summary>
+			property uint32 RemoteHostStatsInterval;
+			/// <summary>
+			/// Interval of the samples of the quality histograms, see
+			/// <see cref="RTCPeerConnection::QualityHistogramsEnabled"/>.
+			/// </summary>
+			property uint32 QualityHistogramsInterval;
+
+			/// <summary>
+			/// Ignores the intervals above. The statistics are collected every
+			/// <see cref="AdaptiveFastInterval"/> while the ICE state or the
+			/// bandwidth estimate changes, then less and less often up to
+			/// <see cref="AdaptiveSlowInterval"/> while the call is stable.
+			/// </summary>
+			property bool Adaptive;
+			/// <summary>200 by default.</summary>
+			property uint32 AdaptiveFastInterval;
+			/// <summary>5000 by default.</summary>
+			property uint32 AdaptiveSlowInterval;
+		};
+
 		[Windows::Foundation::Metadata::WebHostHidden]
 		/// <summary>
 		/// Defines static methods for handling generic WebRTC operations, for example
@@ -113,6 +244,23 @@ namespace Org {
 			/// </summary>
 			static void Initialize(Windows::UI::Core::CoreDispatcher^ dispatcher);
 
+			/// <summary>
+			/// Initializes WebRTC dispatch and worker threads, the way
+			/// <paramref name="options"/> says.
+			/// </summary>
+			static void Initialize(Windows::UI::Core::CoreDispatcher^ dispatcher,
+				RTCThreadingOptions^ options);
+
+			/// <summary>
+			/// Does the slow part of the first call in the background:
+			/// initializes WebRTC if needed, starts Media Foundation, enumerates
+			/// the devices, and creates and releases an H264 encoder and decoder
+			/// so their drivers load. Call it at app launch. The capture device
+			/// is not opened.
+			/// </summary>
+			static IAsyncAction^ WarmUpAsync(Windows::UI::Core::CoreDispatcher^ dispatcher,
+				RTCThreadingOptions^ options);
+
 			/// <summary>
 			/// Check if WebRTC tracing is currently enabled.
 			/// </summary>
@@ -129,6 +277,76 @@ namespace Org {
 			/// </summary>
 			static void StopTracing();
 
+			/// <summary>
+			/// Number of trace events the flight recorder keeps in memory,
+			/// 128 bytes each.  The recorder always traces into a circular
+			/// buffer, so the moments before a freeze or a quality drop
+			/// can be written out with <see cref="DumpTraceAsync"/> after
+			/// they happened.  Read by <see cref="Initialize"/>, 0 disables
+			/// the recorder.  Defaults to 32768, a few seconds of a call.
+			/// </summary>
+			static property uint32 FlightRecorderCapacity { uint32 get(); void set(uint32 value); }
+
+			/// <summary>
+			/// Pauses or resumes the flight recorder.
+			/// </summary>
+			static property bool FlightRecorderEnabled { bool get(); void set(bool value); }
+
+			/// <summary>
+			/// Writes the events of the flight recorder to a new file of
+			/// <see cref="LogFolder"/>, in the Chrome trace format.
+			/// </summary>
+			/// <param name="lastSeconds">Only the events of the last
+			/// seconds are written, 0 for all of them.</param>
+			/// <returns>The name of the file, null if nothing was recorded.</returns>
+			static IAsyncOperation<String^>^ DumpTraceAsync(uint32 lastSeconds);
+
+			/// <summary>
+			/// Times the stages of the media pipelines: encoding, sample
+			/// delivery, decoder input and rendering.  Off by default.
+			/// </summary>
+			static property bool PipelineStageTimingEnabled { bool get(); void set(bool value); }
+
+			/// <summary>
+			/// Durations of the pipeline stages timed since the last reset,
+			/// as JSON, to compare builds.  For each stage: count, total,
+			/// minimum, maximum and the 50th, 90th and 99th percentiles, in
+			/// microseconds.
+			/// </summary>
+			/// <param name="reset">Starts over after reading them.</param>
+			static String^ GetPipelineStageTimings(bool reset);
+
+			/// <summary>
+			/// Budget of the memory held by the video frames waiting in the
+			/// encoders and the renderers of all the connections, in bytes.
+			/// Once it is exceeded the renderers resume from the next key
+			/// frame and the encoders drop their input frames rather than
+			/// queueing more.  0 for no budget.  Default value: 0
+			/// </summary>
+			static property uint64 FrameMemoryBudgetBytes { uint64 get(); void set(uint64 value); }
+			/// <summary>
+			/// Memory held by the queued video frames, in bytes.
+			/// </summary>
+			static property int64 FrameMemoryHeldBytes { int64 get(); }
+			/// <summary>
+			/// <see cref="FrameMemoryHeldBytes"/> by kind of queue:
+			/// H264Encoder for the samples in the encoders, Renderer for
+			/// the render queues and RenderSamples for the samples being
+			/// handed to the media elements.
+			/// </summary>
+			static property IMapView<String^, int64>^ FrameMemoryHeldBytesByQueue {
+				IMapView<String^, int64>^ get();
+			}
+			/// <summary>
+			/// Highest value of <see cref="FrameMemoryHeldBytes"/>.
+			/// </summary>
+			static property int64 FrameMemoryPeakBytes { int64 get(); }
+			/// <summary>
+			/// Number of video frames dropped because of
+			/// <see cref="FrameMemoryBudgetBytes"/>.
+			/// </summary>
+			static property uint64 FrameMemoryBudgetDrops { uint64 get(); }
+
 			/// <summary>
 			/// Starts WebRTC logging.
 			/// </summary>
@@ -154,6 +372,54 @@ namespace Org {
 				String^ get();
 			}
 
+			/// <summary>
+			/// Size in bytes at which the log file is rotated, 0 to let it
+			/// grow.  The previous segments are kept next to it as
+			/// <c>_webrtc_logging.1.log</c> (the most recent) to
+			/// <c>_webrtc_logging.N.log</c>.  Defaults to 10MB, applies to
+			/// the next <see cref="EnableLogging"/>.
+			/// </summary>
+			static property uint32 LogFileMaxSize { uint32 get(); void set(uint32 value); }
+
+			/// <summary>
+			/// Number of previous log segments kept, 3 by default.
+			/// </summary>
+			static property uint32 LogFileSegments { uint32 get(); void set(uint32 value); }
+
+			/// <summary>
+			/// Compresses the previous log segments with MSZIP, they get a
+			/// <c>.mszip</c> extension.
+			/// The Windows.Storage.Compression.Decompressor reads them.
+			/// </summary>
+			static property bool CompressLogSegments { bool get(); void set(bool value); }
+
+			/// <summary>
+			/// Number of log messages dropped because they came faster than
+			/// they could be written to the file.  Their count is written to
+			/// the file where they are missing.
+			/// </summary>
+			static property uint64 LogMessagesDropped { uint64 get(); }
+
+			/// <summary>
+			/// Captures and plays the audio with WASAPI low latency shared
+			/// mode streams instead of the default audio device of WebRTC.
+			/// The device is opened once and shared by the peer connections
+			/// of the first shard, see <see cref="RTCThreadingOptions"/>,
+			/// and selected with <see cref="Media::SelectAudioCaptureDevice"/>
+			/// and <see cref="Media::SelectAudioPlayoutDevice"/>.  Read by
+			/// <see cref="Initialize"/>.  Default value: false
+			/// </summary>
+			static property bool LowLatencyAudio { bool get(); void set(bool value); }
+
+			/// <summary>
+			/// Audio engine period of the low latency streams in frames, 0
+			/// for the smallest one the device supports.  Rounded to a
+			/// period the device supports, falls back to the default 10ms
+			/// period on drivers without low latency support.  Read by
+			/// <see cref="Initialize"/>.  Default value: 0
+			/// </summary>
+			static property uint32 AudioPeriodFrames { uint32 get(); void set(uint32 value); }
+
 			/// <summary>
 			/// Retrieves the audio codecs supported by the device.
 			/// </summary>
@@ -166,6 +432,18 @@ namespace Org {
 			/// <returns>A vector of supported video codecs.</returns>
 			static IVector<CodecInfo^>^ GetVideoCodecs();
 
+			/// <summary>
+			/// When true, the offers and answers of the connections without
+			/// <see cref="RTCPeerConnection::SetCodecPreferences"/> list the
+			/// video codecs this device encodes or decodes in hardware
+			/// first, H264 if the H264 MFTs found are hardware ones.  The
+			/// other codecs remain offered.  Takes effect once the probe of
+			/// the MFTs started by Initialize() completes.  False by default.
+			/// <see cref="GetVideoCodecs"/> lists the codecs in that order
+			/// as well.
+			/// </summary>
+			static property bool PreferHardwareCodecs { bool get(); void set(bool value); }
+
 			/// <summary>
 			/// This method can be used to overwrite the preferred camera capabilities.
 			/// </summary>
@@ -184,14 +462,102 @@ namespace Org {
 			static void SynNTPTime(int64 currentNtpTime);
 
 			/// <summary>
-			/// CPU usage statistics data (in percents). Should be set by application.
+			/// CPU usage of the process in percent of all the processors,
+			/// measured every second once <see cref="Initialize"/> is done.
+			/// </summary>
+			static property double CpuUsage { double get(); }
+
+			/// <summary>
+			/// Working set of the process in bytes, measured with
+			/// <see cref="CpuUsage"/>.
+			/// </summary>
+			static property INT64 MemoryUsage { INT64 get(); }
+
+			/// <summary>
+			/// CPU usage of the WebRTC threads in percent of one processor,
+			/// by thread name.  The threads of a pool, like the Media
+			/// Foundation threads of the H264 encoders, are summed under
+			/// one name.  Also written to ETW with the WebRTCPipeline
+			/// provider.
+			/// </summary>
+			static property IMapView<String^, double>^ ThreadCpuUsage {
+				IMapView<String^, double>^ get();
+			}
+
+			/// <summary>
+			/// When true, I420 video is rendered as IYUV straight from the WebRTC
+			/// frame buffers instead of being converted to NV12 first.
+			/// Only applies to media sources created afterwards.
 			/// </summary>
-			static property double CpuUsage { double get(); void set(double value); }
+			static property bool DirectI420Rendering { bool get(); void set(bool value); }
 
 			/// <summary>
-			/// Memory usage statistics data (in bytes). Should be set by application.
+			/// Maximum frame rate at which raw video is rendered into a
+			/// MediaElement, 0 (the default) for no limit.  Frames are also
+			/// scaled down to the size of the element on screen.
 			/// </summary>
-			static property INT64 MemoryUsage { INT64 get(); void set(INT64 value); }
+			static property uint32 RenderMaxFramerate { uint32 get(); void set(uint32 value); }
+
+			/// <summary>
+			/// When not 0, raw video is handed to the MediaElement at most
+			/// this many times per second, typically the refresh rate of
+			/// the display.  Frames arriving in a burst replace each other
+			/// instead of being rendered back to back.  0 (the default)
+			/// renders frames as they arrive.  H264 sources are never paced,
+			/// every frame has to be decoded.
+			/// Only applies to media sources created afterwards.
+			/// </summary>
+			static property uint32 RenderPacingFramerate { uint32 get(); void set(uint32 value); }
+
+			/// <summary>
+			/// When enabled, the H264 decoder shares the D3D11 device of the
+			/// media element and decoded pictures are rendered from video
+			/// memory without being read back.  Decodes to system memory while
+			/// the media elements render on different devices.
+			/// Only applies to decoders created afterwards.
+			/// </summary>
+			static property bool GpuVideoPipeline { bool get(); void set(bool value); }
+
+			/// <summary>
+			/// Maximum number of frames the H264 encoder has in flight, 3 by
+			/// default.  More hides encoder hiccups at the cost of latency.
+			/// </summary>
+			static property uint32 H264EncoderMaxFramesInFlight { uint32 get(); void set(uint32 value); }
+
+			/// <summary>
+			/// How the H264 encoder drops frames once
+			/// <see cref="H264EncoderMaxFramesInFlight"/> frames are in flight.
+			/// </summary>
+			static property H264EncoderDropPolicy H264EncoderFrameDropPolicy {
+				H264EncoderDropPolicy get(); void set(H264EncoderDropPolicy value);
+			}
+
+			/// <summary>
+			/// Number of temporal layers produced by the H264 encoder, 1 (the
+			/// default) to 3.  Each layer doubles the frame rate of the one
+			/// below, the layer of a frame is signaled by SVC prefix NAL units
+			/// so that a server can forward fewer layers without transcoding.
+			/// Applies to the encoders created afterwards, ignored by encoders
+			/// that don't support it.
+			/// </summary>
+			static property uint32 H264EncoderTemporalLayers { uint32 get(); void set(uint32 value); }
+
+			/// <summary>
+			/// When enabled, the samples of the H264 encoder are packetized
+			/// on the thread the encoder outputs them on, without a hop
+			/// through a Media Foundation work queue.  Lowers the latency of
+			/// each frame.  Disabled by default.
+			/// Applies to the encoders created afterwards.
+			/// </summary>
+			static property bool H264EncoderDirectSampleDelivery { bool get(); void set(bool value); }
+
+			/// <summary>
+			/// How the H264 decoders created from then on decode, Passthrough
+			/// by default.
+			/// </summary>
+			static property H264DecoderMode H264DecodingMode {
+				H264DecoderMode get(); void set(H264DecoderMode value);
+			}
 
 		private:
 			// This type is not meant to be created.
@@ -223,6 +589,20 @@ namespace Org {
 			All
 		};
 
+		/// <summary>
+		/// Kinds of network adapter, see
+		/// <see cref="RTCConfiguration::IgnoredNetworkTypes"/>.
+		/// </summary>
+		[Platform::Metadata::Flags]
+		public enum class RTCNetworkTypes : unsigned int {
+			None = 0,
+			Ethernet = 1,
+			Wifi = 2,
+			Cellular = 4,
+			Vpn = 8,
+			Loopback = 16
+		};
+
 		public enum class RTCIceGatheringState {
 			New,
 			Gathering,
@@ -293,6 +673,52 @@ namespace Org {
 			/// Get or sets the ICE server transport connection policy.
 			/// </summary>
 			property IBox<RTCBundlePolicy>^ BundlePolicy;
+			/// <summary>
+			/// Number of ICE candidates gathered as soon as the connection
+			/// is created, before SetLocalDescription, ready to be used by
+			/// the first offer or answer.
+			/// Default value: 0
+			/// </summary>
+			property IBox<int>^ IceCandidatePoolSize;
+			/// <summary>
+			/// Keep gathering candidates when the networks change, instead of
+			/// gathering once.
+			/// Default value: false
+			/// </summary>
+			property IBox<bool>^ ContinualGathering;
+			/// <summary>
+			/// Minimum interval in milliseconds between two connectivity
+			/// checks of a candidate pair.  Lower values connect faster,
+			/// at the cost of more packets while connecting.
+			/// Default value: the ICE agent's
+			/// </summary>
+			property IBox<int>^ IceCheckMinIntervalMs;
+			/// <summary>
+			/// Doesn't gather TCP candidates.
+			/// Default value: false
+			/// </summary>
+			property IBox<bool>^ DisableTcpCandidates;
+			/// <summary>
+			/// Doesn't gather candidates on cellular networks when a cheaper
+			/// one is available.
+			/// Default value: false
+			/// </summary>
+			property IBox<bool>^ LowCostNetworksOnly;
+			/// <summary>
+			/// Networks no candidate is gathered on.
+			/// Default value: None
+			/// </summary>
+			property IBox<RTCNetworkTypes>^ IgnoredNetworkTypes;
+			/// <summary>
+			/// Range of the local UDP ports, for firewalls allowing only
+			/// some ports.  Both are needed.
+			/// Default value: any port
+			/// </summary>
+			property IBox<uint16>^ MinUdpPort;
+			/// <summary>
+			/// See <see cref="MinUdpPort"/>.
+			/// </summary>
+			property IBox<uint16>^ MaxUdpPort;
 		};
 
 		/// <summary>
@@ -347,6 +773,18 @@ namespace Org {
 			property RTCIceCandidate^ Candidate;
 		};
 
+		/// <summary>
+		/// Stores the ICE candidates found within
+		/// <see cref="RTCPeerConnection::IceCandidateBatchMs"/>.
+		/// </summary>
+		public ref class RTCPeerConnectionIceCandidatesEvent sealed {
+		public:
+			/// <summary>
+			/// Gets or sets the candidates, in the order they were found.
+			/// </summary>
+			property IVector<RTCIceCandidate^>^ Candidates;
+		};
+
 		/// <summary>
 		/// Stores ICE peer connection state received by an event.
 		/// </summary>
@@ -393,6 +831,20 @@ namespace Org {
 			/// Stores a description of the ICE candidate connected to a remote peer.
 			/// </summary>
 			property String^ RemoteCandidateType;
+			/// <summary>
+			/// CPU usage of the process in percent of all the processors,
+			/// see <see cref="WebRTC::CpuUsage"/>.
+			/// </summary>
+			property double CpuUsage;
+			/// <summary>
+			/// Working set of the process in bytes.
+			/// </summary>
+			property int64 MemoryUsage;
+			/// <summary>
+			/// CPU usage of the WebRTC threads, see
+			/// <see cref="WebRTC::ThreadCpuUsage"/>.
+			/// </summary>
+			property IMapView<String^, double>^ ThreadCpuUsage;
 		};
 
 		/// <summary>
@@ -406,6 +858,81 @@ namespace Org {
 			property RTCStatsReports rtcStatsReports;
 		};
 
+		/// <summary>
+		/// Metrics of the quality histograms, see
+		/// <see cref="RTCPeerConnection::QualityHistogramsEnabled"/>.
+		/// </summary>
+		public enum class RTCQualityMetric {
+			/// <summary>Round trip time of the active candidate pair, ms.</summary>
+			Rtt,
+			/// <summary>Jitter of each received audio stream, ms.</summary>
+			Jitter,
+			/// <summary>
+			/// Packets lost over the received streams between two samples,
+			/// per thousand.
+			/// </summary>
+			PacketLoss,
+			/// <summary>Send bitrate of the active candidate pair, kbps.</summary>
+			SendKbps,
+			/// <summary>Receive bitrate of the active candidate pair, kbps.</summary>
+			ReceiveKbps,
+			/// <summary>Frame rate of each received video stream.</summary>
+			RenderFps,
+			/// <summary>Encode time of each sent video stream, ms.</summary>
+			EncodeMs,
+			/// <summary>Decode time of each received video stream, ms.</summary>
+			DecodeMs
+		};
+
+		/// <summary>
+		/// Distribution of a metric over the time of a
+		/// <see cref="RTCQualitySummary"/>.  The percentiles are the upper
+		/// bounds of the buckets they fall in, at most 12.5% off.
+		/// </summary>
+		public ref class RTCQualityMetricSummary sealed {
+		public:
+			/// <summary>Number of samples, the others are 0 without any.</summary>
+			property uint32 Count;
+			/// <summary>Lowest sample.</summary>
+			property int64 Min;
+			/// <summary>Highest sample.</summary>
+			property int64 Max;
+			/// <summary>Average of the samples.</summary>
+			property double Mean;
+			/// <summary>Median.</summary>
+			property int64 P50;
+			/// <summary>95th percentile.</summary>
+			property int64 P95;
+			/// <summary>99th percentile.</summary>
+			property int64 P99;
+		};
+
+		/// <summary>
+		/// Summary of the quality histograms of a connection, raised by
+		/// <see cref="RTCPeerConnection::OnQualitySummary"/>.
+		/// </summary>
+		public ref class RTCQualitySummary sealed {
+		public:
+			/// <summary>
+			/// Milliseconds since the epoch, like the statistics reports.
+			/// </summary>
+			property double Timestamp;
+			/// <summary>
+			/// Milliseconds covered by the summary.
+			/// </summary>
+			property int64 Duration;
+			/// <summary>
+			/// Summary of the whole call, raised when the histograms are
+			/// disabled or the connection closed.  The periodic summaries
+			/// cover the time since the previous one.
+			/// </summary>
+			property bool IsFinal;
+			/// <summary>
+			/// The metrics sampled during the summary.
+			/// </summary>
+			property IMapView<RTCQualityMetric, RTCQualityMetricSummary^>^ Metrics;
+		};
+
 		// ------------------
 		/// <summary>
 		/// Stores media stream object received by an event.
@@ -449,6 +976,15 @@ namespace Org {
 			/// </summary>
 			event RTCPeerConnectionIceEventDelegate^ OnIceCandidate;
 
+			/// <summary>
+			/// New ICE candidates have been found, raised instead of
+			/// <see cref="OnIceCandidate"/> when
+			/// <see cref="IceCandidateBatchMs"/> is set.  The end of the
+			/// candidates is still raised through OnIceCandidate, after the
+			/// last batch.
+			/// </summary>
+			event RTCPeerConnectionIceCandidatesEventDelegate^ OnIceCandidates;
+
 			/// <summary>
 			/// A state transition has occurred for the <see cref="IceConnectionState"/>.
 			/// </summary>
@@ -490,6 +1026,12 @@ namespace Org {
 			/// </summary>
 			event RTCStatsReportsReadyEventDelegate^ OnRTCStatsReportsReady;
 
+			/// <summary>
+			/// A summary of the quality histograms is ready, see
+			/// <see cref="QualityHistogramsEnabled"/>.
+			/// </summary>
+			event RTCQualitySummaryDelegate^ OnQualitySummary;
+
 
 			/// <summary>
 			/// Generates a blob of SDP that contains an RFC 3264 offer with the
@@ -513,6 +1055,20 @@ namespace Org {
 			/// <returns>An action which completes asynchronously</returns>
 			IAsyncOperation<RTCSessionDescription^>^ CreateAnswer();
 
+			/// <summary>
+			/// Sets the order of the codecs in the offers and answers created
+			/// afterwards, the most preferred first.  The remote end sends
+			/// with the first codec it supports in that order.  The codecs
+			/// are matched by name, and by clock rate if not 0, the ids are
+			/// ignored.  The codecs not listed are still offered, after the
+			/// listed ones.  Overrides <see cref="WebRTC::PreferHardwareCodecs"/>,
+			/// null or an empty list reverts to it.
+			/// </summary>
+			/// <param name="codecs">Audio and video codecs, as listed by
+			/// <see cref="WebRTC::GetAudioCodecs"/> and
+			/// <see cref="WebRTC::GetVideoCodecs"/></param>
+			void SetCodecPreferences(IVector<CodecInfo^>^ codecs);
+
 			/// <summary>
 			/// Instructs the <see cref="RTCPeerConnection"/> to apply the supplied
 			/// <see cref="RTCSessionDescription"/> as the local description.
@@ -605,11 +1161,47 @@ namespace Org {
 			/// <returns>An action which completes asynchronously</returns>
 			IAsyncAction^ AddIceCandidate(RTCIceCandidate^ candidate);
 
+			/// <summary>
+			/// Provides several remote candidates to the ICE Agent at once,
+			/// in a single trip to the signaling thread.  Same as calling
+			/// <see cref="AddIceCandidate"/> for each of them in order.
+			/// </summary>
+			/// <param name="candidates">candidates to be added to the remote
+			/// description</param>
+			/// <returns>An action which completes asynchronously</returns>
+			IAsyncAction^ AddIceCandidates(IVector<RTCIceCandidate^>^ candidates);
+
 			/// <summary>
 			/// Ends any active ICE processing or streaming, releases resources.
 			/// </summary>
 			void Close();
 
+			/// <summary>
+			/// Maximum number of events raised per UI dispatcher callback.
+			/// Events of this connection and its data channels are queued
+			/// and delivered in batches, the rest of a burst is delivered in
+			/// the next callback.
+			/// Default value: 64
+			/// </summary>
+			property uint32 EventBatchSize { uint32 get(); void set(uint32 value); }
+
+			/// <summary>
+			/// Time in milliseconds an event may be held back to be delivered
+			/// in the same batch as the events which follow it.
+			/// Default value: 0, a batch is dispatched as soon as possible.
+			/// </summary>
+			property int EventBatchLatencyMs { int get(); void set(int value); }
+
+			/// <summary>
+			/// Time in milliseconds the local candidates found after a first
+			/// one are collected before being raised together through
+			/// <see cref="OnIceCandidates"/>, so that they can be signaled in
+			/// one message.
+			/// Default value: 0, each candidate is raised through
+			/// <see cref="OnIceCandidate"/>.
+			/// </summary>
+			property int IceCandidateBatchMs { int get(); void set(int value); }
+
 			/// <summary>
 			/// Enable/Disable WebRTC statistics to ETW.
 			/// </summary>;
@@ -628,9 +1220,29 @@ namespace Org {
 			property bool RtcStatsEnabled { bool get(); void set(bool value); }
 
 			/// <summary>
-			/// Enable/Disable send of WebRTC statistics in JSON format to a TCP server.
+			/// Enable/Disable the quality histograms: RTT, jitter, packet
+			/// loss, bitrates, render frame rate and encode/decode time are
+			/// sampled into fixed buckets, and their percentiles raised
+			/// through <see cref="OnQualitySummary"/> every
+			/// <see cref="QualitySummaryIntervalMinutes"/> and when the
+			/// connection closes.  The summaries are also written to the ETW
+			/// session, if one listens to the packed reports.  The other
+			/// statistics can stay disabled.
+			/// </summary>
+			property bool QualityHistogramsEnabled { bool get(); void set(bool value); }
+
+			/// <summary>
+			/// Minutes between two quality summaries, 0 only raises the
+			/// summary of the whole call.
+			/// Default value: 5
+			/// </summary>
+			property uint32 QualitySummaryIntervalMinutes { uint32 get(); void set(uint32 value); }
+
+			/// <summary>
+			/// Enable/Disable send of WebRTC statistics to a TCP server.
 			/// Destination can be configured using <see cref="RtcStatsDestinationHost"/>
-			/// and <see cref="RtcStatsDestinationPort"/>.
+			/// and <see cref="RtcStatsDestinationPort"/>, the format using
+			/// <see cref="RtcStatsDestinationFormat"/>.
 			/// </summary>
 			property bool SendRtcStatsToRemoteHostEnabled { bool get(); void set(bool value); }
 
@@ -648,6 +1260,42 @@ namespace Org {
 			/// </summary>
 			property int RtcStatsDestinationPort { int get(); void set(int value); }
 
+			/// <summary>
+			/// Format of the WebRTC statistics sent to the remote host, applied
+			/// when sending is enabled.
+			/// Default value: Json
+			/// </summary>
+			property RTCStatsFormat RtcStatsDestinationFormat {
+				RTCStatsFormat get(); void set(RTCStatsFormat value); }
+
+			/// <summary>
+			/// How often the statistics are collected. Setting it applies a
+			/// copy of the options, the default polls every second.
+			/// </summary>
+			property RTCStatsPollingOptions^ StatsPollingOptions {
+				RTCStatsPollingOptions^ get(); void set(RTCStatsPollingOptions^ value); }
+
+			/// <summary>
+			/// Limits <see cref="OnRTCStatsReportsReady"/> to the given report
+			/// types and values, the others are never converted. nullptr or an
+			/// empty list lets everything through.
+			/// </summary>
+			void SetRtcStatsFilter(
+				Windows::Foundation::Collections::IIterable<RTCStatsType>^ reportTypes,
+				Windows::Foundation::Collections::IIterable<RTCStatsValueName>^ valueNames);
+
+			/// <summary>
+			/// Limits the statistics written to the ETW session to the given
+			/// report types and values, same rules as
+			/// <see cref="SetRtcStatsFilter"/>. The session picks the format
+			/// with its keywords: 0x1 writes one event per value, 0x2 one
+			/// packed event per report. Nothing is collected for the ETW
+			/// session while no session listens.
+			/// </summary>
+			void SetEtwStatsFilter(
+				Windows::Foundation::Collections::IIterable<RTCStatsType>^ reportTypes,
+				Windows::Foundation::Collections::IIterable<RTCStatsValueName>^ valueNames);
+
 			/// <summary>
 			/// The last <see cref="RTCSessionDescription"/> that was successfully set
 			/// using <see cref="SetLocalDescription"/>, plus any local candidates that
@@ -696,9 +1344,15 @@ namespace Org {
 
 		private:
 			~RTCPeerConnection();
+			// Called with |_critSect| held.
+			Internal::CodecPreferences GetCodecPreferences();
+
 			rtc::scoped_refptr<webrtc::PeerConnectionInterface> _impl;
-			// This lock protects _impl.
+			// Thread shard of the connection, see RTCThreadingOptions.
+			uint32 _threadShard;
+			// This lock protects _impl and _codecPreferences.
 			rtc::CriticalSection _critSect;
+			Internal::CodecPreferences _codecPreferences;
 
 			std::unique_ptr<GlobalObserver> _observer;
 
@@ -714,6 +1368,11 @@ namespace Org {
 			extern rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface>
 				gPeerConnectionFactory;
 
+			// Audio device of the first shard with WebRTC::LowLatencyAudio,
+			// null otherwise.
+			extern rtc::scoped_refptr<Internal::LowLatencyAudioDeviceModule>
+				gAudioDeviceModule;
+
 			/// <summary>
 			/// The worker thread for webrtc.
 			/// </summary>
@@ -721,9 +1380,62 @@ namespace Org {
 
 			template <typename T>
 			T RunOnGlobalThread(std::function<T()> fn) {
+				// The wait for the worker thread included.
+				TRACE_EVENT0("webrtc", "globals::RunOnGlobalThread");
 				return gThread.Invoke<T, std::function<T()>>(RTC_FROM_HERE,fn);
 			}
 
+			// Queues |fn| on gThread and returns immediately.
+			void PostOnGlobalThread(std::function<void()> fn);
+
+			// Non-blocking version of RunOnGlobalThread, the task completes
+			// on gThread once |fn| has run.  Exceptions thrown by |fn| are
+			// rethrown by the task.
+			template <typename T>
+			Concurrency::task<T> RunOnGlobalThreadAsync(std::function<T()> fn) {
+				Concurrency::task_completion_event<T> tce;
+				PostOnGlobalThread([tce, fn] {
+					try {
+						tce.set(fn());
+					}
+					catch (...) {
+						tce.set_exception(std::current_exception());
+					}
+				});
+				return Concurrency::task<T>(tce);
+			}
+
+			template <>
+			inline Concurrency::task<void> RunOnGlobalThreadAsync<void>(
+				std::function<void()> fn) {
+				Concurrency::task_completion_event<void> tce;
+				PostOnGlobalThread([tce, fn] {
+					try {
+						fn();
+						tce.set();
+					}
+					catch (...) {
+						tce.set_exception(std::current_exception());
+					}
+				});
+				return Concurrency::task<void>(tce);
+			}
+
+			// Load of a thread shard, reported with the stats of its
+			// connections.
+			struct ThreadShardStats {
+				uint32 index;
+				int peerConnections;
+				size_t networkQueueSize;
+				size_t workerQueueSize;
+				size_t signalingQueueSize;
+			};
+			bool GetThreadShardStats(uint32 index, ThreadShardStats* stats);
+
+			// Worker thread of the first shard, the voice engine of
+			// gAudioDeviceModule runs on it.  Null before initialization.
+			rtc::Thread* AudioDeviceWorkerThread();
+
 		}  // namespace globals
 	}
 }  // namespace Org.WebRtc
@@ -0,0 +1,288 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#include "PlanarYuvMediaBuffer.h"
+#include <mfapi.h>
+#include <mferror.h>
+#include "libyuv/planar_functions.h"
+
+using Microsoft::WRL::MakeAndInitialize;
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			PlanarYuvMediaBuffer::PlanarYuvMediaBuffer() : _length(0), _bufferLength(0) {
+			}
+
+			PlanarYuvMediaBuffer::~PlanarYuvMediaBuffer() {
+			}
+
+			HRESULT PlanarYuvMediaBuffer::RuntimeClassInitialize(
+				rtc::scoped_refptr<webrtc::I420BufferInterface> frameBuffer) {
+				if (!CanWrap(frameBuffer.get())) {
+					return MF_E_INVALIDMEDIATYPE;
+				}
+				_frameBuffer = frameBuffer;
+				_length = (DWORD)(frameBuffer->width() * frameBuffer->height() * 3 / 2);
+				_bufferLength = (DWORD)(frameBuffer->StrideY() * frameBuffer->height() * 3 / 2);
+				return S_OK;
+			}
+
+			bool PlanarYuvMediaBuffer::CanWrap(webrtc::I420BufferInterface* frameBuffer) {
+				int height = frameBuffer->height();
+				if ((frameBuffer->width() & 1) != 0 || (height & 1) != 0) {
+					return false;
+				}
+				if (frameBuffer->StrideU() * 2 != frameBuffer->StrideY() ||
+					frameBuffer->StrideV() != frameBuffer->StrideU()) {
+					return false;
+				}
+				const uint8_t* expectedU = frameBuffer->DataY() +
+					frameBuffer->StrideY() * height;
+				const uint8_t* expectedV = expectedU +
+					frameBuffer->StrideU() * (height / 2);
+				return frameBuffer->DataU() == expectedU &&
+					frameBuffer->DataV() == expectedV;
+			}
+
+			// IMFMediaBuffer
+			IFACEMETHODIMP PlanarYuvMediaBuffer::Lock(BYTE** ppbBuffer,
+				DWORD* pcbMaxLength, DWORD* pcbCurrentLength) {
+				if (ppbBuffer == nullptr) {
+					return E_POINTER;
+				}
+				// The frame buffer may be shared with other sinks, never written.
+				if (_frameBuffer->StrideY() == _frameBuffer->width()) {
+					*ppbBuffer = const_cast<BYTE*>(_frameBuffer->DataY());
+				} else {
+					// Lock() is contiguous, the padded rows are compacted.
+					rtc::CritScope lock(&_critSect);
+					if (_contiguous.empty()) {
+						_contiguous.resize(_length);
+						HRESULT hr = ContiguousCopyTo(_contiguous.data(), _length);
+						if (FAILED(hr)) {
+							_contiguous.clear();
+							return hr;
+						}
+					}
+					*ppbBuffer = _contiguous.data();
+				}
+				if (pcbMaxLength != nullptr) {
+					*pcbMaxLength = _length;
+				}
+				if (pcbCurrentLength != nullptr) {
+					*pcbCurrentLength = _length;
+				}
+				return S_OK;
+			}
+
+			IFACEMETHODIMP PlanarYuvMediaBuffer::Unlock() {
+				return S_OK;
+			}
+
+			IFACEMETHODIMP PlanarYuvMediaBuffer::GetCurrentLength(DWORD* pcbCurrentLength) {
+				if (pcbCurrentLength == nullptr) {
+					return E_POINTER;
+				}
+				*pcbCurrentLength = _length;
+				return S_OK;
+			}
+
+			IFACEMETHODIMP PlanarYuvMediaBuffer::SetCurrentLength(DWORD cbCurrentLength) {
+				return cbCurrentLength == _length ? S_OK : E_INVALIDARG;
+			}
+
+			IFACEMETHODIMP PlanarYuvMediaBuffer::GetMaxLength(DWORD* pcbMaxLength) {
+				if (pcbMaxLength == nullptr) {
+					return E_POINTER;
+				}
+				*pcbMaxLength = _length;
+				return S_OK;
+			}
+
+			// IMF2DBuffer
+			IFACEMETHODIMP PlanarYuvMediaBuffer::Lock2D(BYTE** ppbScanline0, LONG* plPitch) {
+				return GetScanline0AndPitch(ppbScanline0, plPitch);
+			}
+
+			IFACEMETHODIMP PlanarYuvMediaBuffer::Unlock2D() {
+				return S_OK;
+			}
+
+			IFACEMETHODIMP PlanarYuvMediaBuffer::GetScanline0AndPitch(
+				BYTE** pbScanline0, LONG* plPitch) {
+				if (pbScanline0 == nullptr || plPitch == nullptr) {
+					return E_POINTER;
+				}
+				*pbScanline0 = const_cast<BYTE*>(_frameBuffer->DataY());
+				*plPitch = (LONG)_frameBuffer->StrideY();
+				return S_OK;
+			}
+
+			IFACEMETHODIMP PlanarYuvMediaBuffer::IsContiguousFormat(BOOL* pfIsContiguous) {
+				if (pfIsContiguous == nullptr) {
+					return E_POINTER;
+				}
+				*pfIsContiguous = _frameBuffer->StrideY() == _frameBuffer->width();
+				return S_OK;
+			}
+
+			IFACEMETHODIMP PlanarYuvMediaBuffer::GetContiguousLength(DWORD* pcbLength) {
+				if (pcbLength == nullptr) {
+					return E_POINTER;
+				}
+				*pcbLength = (DWORD)(_frameBuffer->width() * _frameBuffer->height() * 3 / 2);
+				return S_OK;
+			}
+
+			IFACEMETHODIMP PlanarYuvMediaBuffer::ContiguousCopyTo(
+				BYTE* pbDestBuffer, DWORD cbDestBuffer) {
+				int width = _frameBuffer->width();
+				int height = _frameBuffer->height();
+				if (cbDestBuffer < (DWORD)(width * height * 3 / 2)) {
+					return E_INVALIDARG;
+				}
+				BYTE* destU = pbDestBuffer + width * height;
+				BYTE* destV = destU + (width / 2) * (height / 2);
+				libyuv::I420Copy(_frameBuffer->DataY(), _frameBuffer->StrideY(),
+					_frameBuffer->DataU(), _frameBuffer->StrideU(),
+					_frameBuffer->DataV(), _frameBuffer->StrideV(),
+					pbDestBuffer, width,
+					destU, width / 2,
+					destV, width / 2,
+					width, height);
+				return S_OK;
+			}
+
+			IFACEMETHODIMP PlanarYuvMediaBuffer::ContiguousCopyFrom(
+				const BYTE* pbSrcBuffer, DWORD cbSrcBuffer) {
+				return E_ACCESSDENIED;
+			}
+
+			// IMF2DBuffer2
+			IFACEMETHODIMP PlanarYuvMediaBuffer::Lock2DSize(MF2DBuffer_LockFlags lockFlags,
+				BYTE** ppbScanline0, LONG* plPitch, BYTE** ppbBufferStart,
+				DWORD* pcbBufferLength) {
+				if (lockFlags != MF2DBuffer_LockFlags_Read) {
+					return E_ACCESSDENIED;
+				}
+				if (ppbBufferStart == nullptr || pcbBufferLength == nullptr) {
+					return E_POINTER;
+				}
+				HRESULT hr = GetScanline0AndPitch(ppbScanline0, plPitch);
+				if (FAILED(hr)) {
+					return hr;
+				}
+				*ppbBufferStart = *ppbScanline0;
+				*pcbBufferLength = _bufferLength;
+				return S_OK;
+			}
+
+			IFACEMETHODIMP PlanarYuvMediaBuffer::Copy2DTo(IMF2DBuffer2* pDestBuffer) {
+				if (pDestBuffer == nullptr) {
+					return E_POINTER;
+				}
+				BYTE* destScanline0;
+				BYTE* destBufferStart;
+				LONG destPitch;
+				DWORD destLength;
+				HRESULT hr = pDestBuffer->Lock2DSize(MF2DBuffer_LockFlags_Write,
+					&destScanline0, &destPitch, &destBufferStart, &destLength);
+				if (FAILED(hr)) {
+					return hr;
+				}
+				int height = _frameBuffer->height();
+				BYTE* destU = destScanline0 + destPitch * height;
+				BYTE* destV = destU + (destPitch / 2) * (height / 2);
+				libyuv::I420Copy(_frameBuffer->DataY(), _frameBuffer->StrideY(),
+					_frameBuffer->DataU(), _frameBuffer->StrideU(),
+					_frameBuffer->DataV(), _frameBuffer->StrideV(),
+					destScanline0, destPitch,
+					destU, destPitch / 2,
+					destV, destPitch / 2,
+					_frameBuffer->width(), height);
+				return pDestBuffer->Unlock2D();
+			}
+
+			HRESULT CreateI420Sample(const webrtc::VideoFrame* frame, IMFSample** sample,
+				LONG* pitch) {
+				// The I420 buffers are returned as they are.
+				rtc::scoped_refptr<webrtc::I420BufferInterface> frameBuffer =
+					frame->video_frame_buffer()->ToI420();
+				if (frameBuffer == nullptr ||
+					!PlanarYuvMediaBuffer::CanWrap(frameBuffer.get())) {
+					return MF_E_INVALIDMEDIATYPE;
+				}
+				ComPtr<PlanarYuvMediaBuffer> mediaBuffer;
+				HRESULT hr = MakeAndInitialize<PlanarYuvMediaBuffer>(&mediaBuffer, frameBuffer);
+				if (FAILED(hr)) {
+					return hr;
+				}
+				ComPtr<IMFSample> spSample;
+				hr = MFCreateSample(&spSample);
+				if (FAILED(hr)) {
+					return hr;
+				}
+				hr = spSample->AddBuffer(mediaBuffer.Get());
+				if (FAILED(hr)) {
+					return hr;
+				}
+				if (pitch != nullptr) {
+					*pitch = frameBuffer->StrideY();
+				}
+				*sample = spSample.Detach();
+				return S_OK;
+			}
+
+			HRESULT CopyI420ToSample(const webrtc::VideoFrame* frame, IMFSample* sample,
+				LONG* pitch) {
+				rtc::scoped_refptr<webrtc::I420BufferInterface> frameBuffer =
+					frame->video_frame_buffer()->ToI420();
+				if (frameBuffer == nullptr) {
+					return E_FAIL;
+				}
+				ComPtr<IMFMediaBuffer> mediaBuffer;
+				HRESULT hr = sample->GetBufferByIndex(0, &mediaBuffer);
+				if (FAILED(hr)) {
+					return hr;
+				}
+				ComPtr<IMF2DBuffer2> imageBuffer;
+				hr = mediaBuffer.As(&imageBuffer);
+				if (FAILED(hr)) {
+					return hr;
+				}
+				BYTE* destRawData;
+				BYTE* bufferStart;
+				LONG destPitch;
+				DWORD destMediaBufferSize;
+				hr = imageBuffer->Lock2DSize(MF2DBuffer_LockFlags_Write,
+					&destRawData, &destPitch, &bufferStart, &destMediaBufferSize);
+				if (FAILED(hr)) {
+					return hr;
+				}
+				// Crop one pixel if odd, IYUV needs even dimensions.
+				int width = frameBuffer->width() & ~1;
+				int height = frameBuffer->height() & ~1;
+				BYTE* destU = destRawData + destPitch * height;
+				BYTE* destV = destU + (destPitch / 2) * (height / 2);
+				libyuv::I420Copy(frameBuffer->DataY(), frameBuffer->StrideY(),
+					frameBuffer->DataU(), frameBuffer->StrideU(),
+					frameBuffer->DataV(), frameBuffer->StrideV(),
+					destRawData, destPitch,
+					destU, destPitch / 2,
+					destV, destPitch / 2,
+					width, height);
+				if (pitch != nullptr) {
+					*pitch = destPitch;
+				}
+				return imageBuffer->Unlock2D();
+			}
+		}
+	}
+}  // namespace Org.WebRtc.Internal
@@ -0,0 +1,94 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#ifndef ORG_WEBRTC_PLANARYUVMEDIABUFFER_H_
+#define ORG_WEBRTC_PLANARYUVMEDIABUFFER_H_
+
+#include <wrl.h>
+#include <mfidl.h>
+#include <vector>
+#include "webrtc/api/video/video_frame.h"
+#include "webrtc/api/video/video_frame_buffer.h"
+#include "webrtc/rtc_base/criticalsection.h"
+
+using Microsoft::WRL::ComPtr;
+using Microsoft::WRL::RuntimeClass;
+using Microsoft::WRL::RuntimeClassFlags;
+using Microsoft::WRL::RuntimeClassType;
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			// Read-only IYUV media buffer pointing straight at the planes
+			// of a webrtc I420 frame buffer, which it keeps a reference on.
+			// Only the 2D locks expose the pitch of the planes, Lock() gives
+			// them contiguous, copied once if the rows are padded.
+			class PlanarYuvMediaBuffer :
+				public RuntimeClass<RuntimeClassFlags<RuntimeClassType::ClassicCom>,
+				IMFMediaBuffer, IMF2DBuffer, IMF2DBuffer2> {
+			public:
+				PlanarYuvMediaBuffer();
+				virtual ~PlanarYuvMediaBuffer();
+				HRESULT RuntimeClassInitialize(
+					rtc::scoped_refptr<webrtc::I420BufferInterface> frameBuffer);
+
+				// Returns true if the planes are laid out in memory the way
+				// IYUV expects them: Y, U then V with the chroma pitch being
+				// half of the luma pitch.
+				static bool CanWrap(webrtc::I420BufferInterface* frameBuffer);
+
+				// IMFMediaBuffer
+				IFACEMETHOD(Lock)(BYTE** ppbBuffer, DWORD* pcbMaxLength,
+					DWORD* pcbCurrentLength);
+				IFACEMETHOD(Unlock)();
+				IFACEMETHOD(GetCurrentLength)(DWORD* pcbCurrentLength);
+				IFACEMETHOD(SetCurrentLength)(DWORD cbCurrentLength);
+				IFACEMETHOD(GetMaxLength)(DWORD* pcbMaxLength);
+				// IMF2DBuffer
+				IFACEMETHOD(Lock2D)(BYTE** ppbScanline0, LONG* plPitch);
+				IFACEMETHOD(Unlock2D)();
+				IFACEMETHOD(GetScanline0AndPitch)(BYTE** pbScanline0, LONG* plPitch);
+				IFACEMETHOD(IsContiguousFormat)(BOOL* pfIsContiguous);
+				IFACEMETHOD(GetContiguousLength)(DWORD* pcbLength);
+				IFACEMETHOD(ContiguousCopyTo)(BYTE* pbDestBuffer, DWORD cbDestBuffer);
+				IFACEMETHOD(ContiguousCopyFrom)(const BYTE* pbSrcBuffer, DWORD cbSrcBuffer);
+				// IMF2DBuffer2
+				IFACEMETHOD(Lock2DSize)(MF2DBuffer_LockFlags lockFlags,
+					BYTE** ppbScanline0, LONG* plPitch, BYTE** ppbBufferStart,
+					DWORD* pcbBufferLength);
+				IFACEMETHOD(Copy2DTo)(IMF2DBuffer2* pDestBuffer);
+
+			private:
+				rtc::scoped_refptr<webrtc::I420BufferInterface> _frameBuffer;
+				// Of the contiguous planes.
+				DWORD _length;
+				// Of the planes with their pitch, for Lock2DSize().
+				DWORD _bufferLength;
+				rtc::CriticalSection _critSect;
+				// The planes without padding, made by the first Lock() if
+				// the pitch isn't the width.
+				std::vector<BYTE> _contiguous;
+			};
+
+			// Creates a sample wrapping the I420 planes of |frame| without
+			// copying them.  Fails if the planes can't be wrapped.  The
+			// buffers of another planar format are converted first.
+			// |pitch|, if not null, receives the luma pitch of the sample.
+			HRESULT CreateI420Sample(const webrtc::VideoFrame* frame, IMFSample** sample,
+				LONG* pitch = nullptr);
+
+			// Copies the I420 planes of |frame| into the IYUV 2D buffer of
+			// |sample|.  Used when the planes can't be wrapped.
+			HRESULT CopyI420ToSample(const webrtc::VideoFrame* frame, IMFSample* sample,
+				LONG* pitch = nullptr);
+		}
+	}
+}  // namespace Org.WebRtc.Internal
+
+#endif  // ORG_WEBRTC_PLANARYUVMEDIABUFFER_H_
@@ -0,0 +1,96 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#include "RTCStatsReport.h"
+#include "Marshalling.h"
+
+namespace Org {
+	namespace WebRtc {
+
+		RTCStatsReport::RTCStatsReport() {
+		}
+
+		RTCStatsReport^ RTCStatsReport::CreateFromNative(
+			const webrtc::StatsReport* report,
+			const std::set<webrtc::StatsReport::StatsValueName>* valueNames) {
+			RTCStatsReport^ ret = ref new RTCStatsReport();
+			ret->_nativeId = report->id();
+			ret->Timestamp = report->timestamp();
+
+			RTCStatsType type;
+			Internal::ToCx(report->id()->type(), &type);
+			ret->StatsType = type;
+
+			ret->_nativeValues.reserve(report->values().size());
+			for (auto& value : report->values()) {
+				if (valueNames == nullptr ||
+					valueNames->find(value.first) != valueNames->end()) {
+					ret->_nativeValues.push_back(value.second);
+				}
+			}
+			return ret;
+		}
+
+		Platform::String^ RTCStatsReport::ReportId::get() {
+			if (_reportId == nullptr && _nativeId.get() != nullptr) {
+				_reportId = Internal::ToCx(_nativeId->ToString());
+			}
+			return _reportId;
+		}
+
+		void RTCStatsReport::ReportId::set(Platform::String^ value) {
+			_reportId = value;
+			_nativeId = nullptr;
+		}
+
+		RTCStatsValues RTCStatsReport::Values::get() {
+			MaterializeValues();
+			return _values;
+		}
+
+		void RTCStatsReport::Values::set(RTCStatsValues value) {
+			_values = value;
+			_nativeValues.clear();
+		}
+
+		Platform::Object^ RTCStatsReport::GetValue(RTCStatsValueName name) {
+			if (_values != nullptr) {
+				return _values->HasKey(name) ? _values->Lookup(name) : nullptr;
+			}
+			webrtc::StatsReport::StatsValueName nativeName;
+			Internal::FromCx(name, &nativeName);
+			for (auto& value : _nativeValues) {
+				if (value->name == nativeName) {
+					Platform::Object^ ret;
+					Internal::ToCx(value.get(), &ret);
+					return ret;
+				}
+			}
+			return nullptr;
+		}
+
+		void RTCStatsReport::MaterializeValues() {
+			if (_values != nullptr) {
+				return;
+			}
+			_values = ref new Map<RTCStatsValueName, Platform::Object^>();
+			for (auto& value : _nativeValues) {
+				RTCStatsValueName name;
+				Internal::ToCx(value->name, &name);
+				Platform::Object^ val;
+				Internal::ToCx(value.get(), &val);
+				if (val != nullptr) {
+					_values->Insert(name, val);
+				}
+			}
+			// The map owns the values from now on.
+			_nativeValues.clear();
+			_nativeValues.shrink_to_fit();
+		}
+	}
+}  // namespace Org.WebRtc
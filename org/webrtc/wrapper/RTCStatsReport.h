@@ -14,6 +14,7 @@
 
 #include <vector>
 #include <map>
+#include <set>
 
 
 using Windows::Foundation::Collections::IVector;
@@ -144,6 +145,28 @@ namespace Org {
 			StatsValueNameViewLimitedResolution,
 			StatsValueNameWritable,
 			StatsValueNameCurrentEndToEndDelayMs,
+
+			// Renderer values, see RendererStats.
+			StatsValueNameRendererFramesQueued,
+			StatsValueNameRendererFramesRendered,
+			StatsValueNameRendererFramesReplaced,
+			StatsValueNameRendererFramesDroppedToIdr,
+			StatsValueNameRendererFramesLost,
+			StatsValueNameRendererReceiveToQueueMs,
+			StatsValueNameRendererMaxReceiveToQueueMs,
+			StatsValueNameRendererQueueResidencyMs,
+			StatsValueNameRendererMaxQueueResidencyMs,
+			StatsValueNameRendererSampleRequestWaitMs,
+			StatsValueNameRendererMaxSampleRequestWaitMs,
+			StatsValueNameRendererConversionMs,
+			StatsValueNameRendererMaxConversionMs,
+
+			// Thread shard values, see RTCThreadingOptions.
+			StatsValueNameThreadShardIndex,
+			StatsValueNameThreadShardPeerConnections,
+			StatsValueNameThreadShardNetworkQueueSize,
+			StatsValueNameThreadShardWorkerQueueSize,
+			StatsValueNameThreadShardSignalingQueueSize,
 		};
 
 		public enum class RTCStatsType {
@@ -202,25 +225,68 @@ namespace Org {
 			// A StatsReport of |type| = "datachannel" with statistics for a
 			// particular DataChannel.
 			StatsReportTypeDataChannel,
+
+			// A StatsReport of |type| = "renderer" with the render queue
+			// statistics of a video renderer.  The |id| field is
+			// "renderer_" followed by the id the renderer was created with.
+			// Not produced by webrtc, added by the wrapper.
+			StatsReportTypeRenderer,
+
+			// A StatsReport of |type| = "threadShard" with the load of the
+			// thread shard of the connection.  The |id| field is
+			// "threadshard_" followed by the shard index.
+			// Not produced by webrtc, added by the wrapper.
+			StatsReportTypeThreadShard,
 		};
 
 		typedef IMap< RTCStatsValueName, Platform::Object^>^ RTCStatsValues;
 
 		/// <summary>
-		/// CX object of webrtc::StatsReport
+		/// CX object of webrtc::StatsReport.
+		/// The values are kept in their native form and only converted
+		/// when they are read, so reports nobody looks at cost little.
 		/// </summary>
 		public ref class RTCStatsReport sealed {
 		public:
-			RTCStatsReport() {
-				Values = ref new Platform::Collections::Map<
-					RTCStatsValueName, Platform::Object^>();
-			}
+			RTCStatsReport();
 
-			property Platform::String^ ReportId;
+			property Platform::String^ ReportId {
+				Platform::String^ get();
+				void set(Platform::String^ value);
+			}
 			property double Timestamp;  // Time since 1970-01-01T00:00:00Z
 																	// in milliseconds
 			property RTCStatsType StatsType;
-			property RTCStatsValues Values;
+			/// <summary>
+			/// All the values of the report, converted on first access.
+			/// </summary>
+			property RTCStatsValues Values {
+				RTCStatsValues get();
+				void set(RTCStatsValues value);
+			}
+
+			/// <summary>
+			/// Converts a single value, cheaper than <see cref="Values"/>
+			/// when only a few of them are read.
+			/// </summary>
+			/// <returns>The value, nullptr if the report doesn't have it.
+			/// </returns>
+			Platform::Object^ GetValue(RTCStatsValueName name);
+
+		internal:
+			// Keeps references on the id and the values of |report|, only
+			// the ones in |valueNames| if it isn't null.
+			static RTCStatsReport^ CreateFromNative(
+				const webrtc::StatsReport* report,
+				const std::set<webrtc::StatsReport::StatsValueName>* valueNames);
+
+		private:
+			void MaterializeValues();
+
+			Platform::String^ _reportId;
+			webrtc::StatsReport::Id _nativeId;
+			RTCStatsValues _values;
+			std::vector<webrtc::StatsReport::ValuePtr> _nativeValues;
 		};
 
 		typedef IVector<RTCStatsReport^>^ RTCStatsReports;
@@ -14,7 +14,10 @@
 #include "libyuv/convert.h"
 #include "webrtc/common_video/video_common_winuwp.h"
 #include "webrtc/rtc_base/logging.h"
+#include "webrtc/rtc_base/timeutils.h"
 #include "webrtc/media/base/videocommon.h"
+#include "PlanarYuvMediaBuffer.h"
+#include "third_party/winuwp_h264/Utils/PipelineTrace.h"
 
 using Microsoft::WRL::ComPtr;
 using Platform::Collections::Vector;
@@ -30,6 +33,11 @@ using Windows::System::Threading::ThreadPoolTimer;
 
 namespace Org {
 	namespace WebRtc {
+		namespace globals {
+			extern bool gDirectI420Rendering;
+			extern uint32 gRenderPacingFramerate;
+		}
+
 		/// <summary>
 		/// Delegate used to notify an update of the frame per second on a video stream.
 		/// </summary>
@@ -107,9 +115,7 @@ namespace Org {
 			RTMediaStreamSource^ RTMediaStreamSource::CreateMediaSource(
 				VideoFrameType frameType, String^ id) {
 
-				auto streamState = ref new RTMediaStreamSource(frameType);
-				streamState->_id = id;
-				streamState->_idUtf8 = rtc::ToUtf8(streamState->_id->Data());
+				auto streamState = ref new RTMediaStreamSource(frameType, id);
 				streamState->_rtcRenderer = std::unique_ptr<RTCRenderer>(
 					new RTCRenderer(streamState));
 				VideoEncodingProperties^ videoProperties;
@@ -117,6 +123,11 @@ namespace Org {
 					videoProperties = VideoEncodingProperties::CreateH264();
 					//videoProperties->ProfileId = Windows::Media::MediaProperties::H264ProfileIds::Baseline;
 				}
+				else if (streamState->_directI420) {
+					videoProperties =
+						VideoEncodingProperties::CreateUncompressed(
+							MediaEncodingSubtypes::Iyuv, 10, 10);
+				}
 				else {
 					videoProperties =
 						VideoEncodingProperties::CreateUncompressed(
@@ -192,17 +203,23 @@ namespace Org {
 				//		handler, timespan);
 				//}
 
-				//// Create a timer which ensures we don't display frames faster that expected.
-				//// Required because Media Foundation sometimes requests samples in burst mode
-				//// but we use the wall clock to drive timestamps.
-				//{
-				//	auto handler = ref new TimerElapsedHandler(streamState,
-				//		&RTMediaStreamSource::FPSTimerElapsedExecute);
-				//	auto timespan = Windows::Foundation::TimeSpan();
-				//	timespan.Duration = 15 * 1000 * 10;
-				//	streamState->_fpsTimer = ThreadPoolTimer::CreatePeriodicTimer(handler,
-				//		timespan);
-				//}
+				// Create a timer which ensures we don't display frames faster than
+				// the display.  Frames arriving in a burst after a stall replace
+				// each other instead of being pushed back to back.
+				if (streamState->_paced) {
+					WeakReference weakState(streamState);
+					auto handler = ref new TimerElapsedHandler([weakState](ThreadPoolTimer^ timer) {
+						auto state = weakState.Resolve<RTMediaStreamSource>();
+						if (state != nullptr) {
+							state->FPSTimerElapsedExecute(timer);
+						}
+					});
+					auto timespan = Windows::Foundation::TimeSpan();
+					timespan.Duration = 1000 * 1000 * 10 /
+						Org::WebRtc::globals::gRenderPacingFramerate;
+					streamState->_fpsTimer = ThreadPoolTimer::CreatePeriodicTimer(handler,
+						timespan);
+				}
 
 				return streamState;
 			}
@@ -215,17 +232,25 @@ namespace Org {
 			void RTMediaStreamSource::RenderFrame(const webrtc::VideoFrame *frame) {
 				auto frameCopy = new webrtc::VideoFrame(
 					frame->video_frame_buffer(), frame->rotation(),
-					0);
+					rtc::TimeMicros());
+				// Identifies the frame in the traces.
+				frameCopy->set_timestamp(frame->timestamp());
 				ProcessReceivedFrame(frameCopy);
 			}
 
-			RTMediaStreamSource::RTMediaStreamSource(VideoFrameType frameType) :
+			RTMediaStreamSource::RTMediaStreamSource(VideoFrameType frameType,
+				String^ id) :
+				_id(id),
+				_idUtf8(rtc::ToUtf8(id->Data())),
 				_frameSentThisTime(false),
-				_frameBeingQueued(0) {
+				_paced(frameType == FrameTypeI420 && Org::WebRtc::globals::gRenderPacingFramerate > 0),
+				_frameBeingQueued(0),
+				_directI420(frameType == FrameTypeI420 && Org::WebRtc::globals::gDirectI420Rendering) {
 				LOG(LS_INFO) << "RTMediaStreamSource::RTMediaStreamSource";
 
 				// Create the helper with the callback functions.
 				_helper.reset(new MediaSourceHelper(
+					_idUtf8,
 					frameType,
 					[this](webrtc::VideoFrame* frame, IMFSample** sample) -> HRESULT {
 					return MakeSampleCallback(frame, sample);
@@ -233,6 +258,15 @@ namespace Org {
 					[this](int fps) {
 					return FpsCallback(fps);
 				}));
+
+				if (_directI420) {
+					// Only used for frames which planes can't be wrapped.
+					_helper->GetSamplePool()->SetBufferFactory(
+						[](UINT32 width, UINT32 height, IMFMediaBuffer** buffer) -> HRESULT {
+						return MFCreate2DMediaBuffer(width, height,
+							MFVideoFormat_IYUV.Data1, FALSE, buffer);
+					});
+				}
 			}
 
 			RTMediaStreamSource::~RTMediaStreamSource() {
@@ -302,7 +336,8 @@ namespace Org {
 				if (stream != nullptr) {
 					auto frameCopy = new webrtc::VideoFrame(
 						frame->video_frame_buffer(), frame->rotation(),
-						0);
+						rtc::TimeMicros());
+					frameCopy->set_timestamp(frame->timestamp());
 
 					stream->ProcessReceivedFrame(frameCopy);
 				}
@@ -317,16 +352,20 @@ namespace Org {
 			void RTMediaStreamSource::FPSTimerElapsedExecute(ThreadPoolTimer^ source) {
 				rtc::CritScope lock(&_critSect);
 				_frameSentThisTime = false;
-				if (_request != nullptr) {
+				// Only a deferred request is still waiting for its sample.
+				if (_deferral != nullptr && _helper != nullptr && _helper->HasFrames()) {
 					ReplyToSampleRequest();
 				}
 			}
 
 			void RTMediaStreamSource::ReplyToSampleRequest() {
+				TRACE_EVENT0("webrtc", "RTMediaStreamSource::ReplyToSampleRequest");
 				auto sampleData = _helper->DequeueFrame();
 				if (sampleData == nullptr) {
 					return;
 				}
+				webrtc::TraceFrameFlowEnd(webrtc::kReceiveFrameFlow,
+					sampleData->rtpTimestamp);
 
 				// Update rotation property
 				if (sampleData->rotationHasChanged) {
@@ -354,6 +393,7 @@ namespace Org {
 					spRequest.ReleaseAndGetAddressOf());
 
 				hr = spRequest->SetSample(sampleData->sample.Get());
+				_frameSentThisTime = true;
 
 				if (_deferral != nullptr) {
 					_deferral->Complete();
@@ -364,22 +404,55 @@ namespace Org {
 
 			HRESULT RTMediaStreamSource::MakeSampleCallback(
 				webrtc::VideoFrame* frame, IMFSample** sample) {
+				webrtc::ScopedPipelineStage stage("RTMediaStreamSource.MakeSample",
+					frame->timestamp());
+				webrtc::TraceFrameFlowStep(webrtc::kReceiveFrameFlow, frame->timestamp());
+				// The MediaStreamSource doesn't share its D3D device with us,
+				// decoded native samples have to go through system memory.
+				std::unique_ptr<webrtc::VideoFrame> i420Frame;
+				if (frame->video_frame_buffer()->type() == webrtc::VideoFrameBuffer::Type::kNative) {
+					rtc::scoped_refptr<webrtc::I420BufferInterface> i420Buffer =
+						frame->video_frame_buffer()->ToI420();
+					if (i420Buffer == nullptr) {
+						return E_FAIL;
+					}
+					i420Frame.reset(new webrtc::VideoFrame(i420Buffer, frame->rotation(), 0));
+					frame = i420Frame.get();
+				}
+
+				if (_directI420) {
+					// Try to hand the frame buffer over as is.
+					if (SUCCEEDED(CreateI420Sample(frame, sample))) {
+						return S_OK;
+					}
+					ComPtr<IMFSample> spSample;
+					if (FAILED(_helper->GetSamplePool()->GetSample(
+						(UINT32)(frame->width() & ~1), (UINT32)(frame->height() & ~1),
+						spSample.GetAddressOf()))) {
+						return E_FAIL;
+					}
+					if (FAILED(CopyI420ToSample(frame, spSample.Get()))) {
+						return E_FAIL;
+					}
+					*sample = spSample.Detach();
+					return S_OK;
+				}
+
+				// Samples come from the helper pool and are recycled once
+				// the media element releases them.
 				ComPtr<IMFSample> spSample;
-				HRESULT hr = MFCreateSample(spSample.GetAddressOf());
+				HRESULT hr = _helper->GetSamplePool()->GetSample(
+					(UINT32)frame->width(), (UINT32)frame->height(),
+					spSample.GetAddressOf());
 				if (FAILED(hr)) {
 					return E_FAIL;
 				}
 				ComPtr<IMFMediaBuffer> mediaBuffer;
-				hr = MFCreate2DMediaBuffer(
-					(DWORD)frame->width(), (DWORD)frame->height(),
-					cricket::FOURCC_NV12, FALSE,
-					mediaBuffer.GetAddressOf());
+				hr = spSample->GetBufferByIndex(0, mediaBuffer.GetAddressOf());
 				if (FAILED(hr)) {
 					return E_FAIL;
 				}
 
-				spSample->AddBuffer(mediaBuffer.Get());
-
 				ComPtr<IMF2DBuffer2> imageBuffer;
 				if (FAILED(mediaBuffer.As(&imageBuffer))) {
 					return E_FAIL;
@@ -398,8 +471,12 @@ namespace Org {
 					//TODO Check
 					//frame->MakeExclusive();
 					// Convert to NV12
-					rtc::scoped_refptr<webrtc::PlanarYuvBuffer> frameBuffer =
-						static_cast<webrtc::PlanarYuvBuffer*>(frame->video_frame_buffer().get());
+					rtc::scoped_refptr<webrtc::I420BufferInterface> frameBuffer =
+						frame->video_frame_buffer()->ToI420();
+					if (frameBuffer == nullptr) {
+						imageBuffer->Unlock2D();
+						return E_FAIL;
+					}
 					uint8* uvDest = destRawData + (pitch * frame->height());
 					libyuv::I420ToNV12(frameBuffer->DataY(), frameBuffer->StrideY(),
 						frameBuffer->DataU(), frameBuffer->StrideU(),
@@ -425,6 +502,7 @@ namespace Org {
 
 			void RTMediaStreamSource::OnSampleRequested(
 				MediaStreamSource ^sender, MediaStreamSourceSampleRequestedEventArgs ^args) {
+				TRACE_EVENT0("webrtc", "RTMediaStreamSource::OnSampleRequested");
 				try {
 
 					if (_mediaStreamSource == nullptr)
@@ -439,8 +517,9 @@ namespace Org {
 					if (_helper == nullptr) {  // may be null while tearing down
 						return;
 					}
+					_helper->OnSampleRequested();
 
-					if (_helper->HasFrames()) {
+					if (_helper->HasFrames() && !(_paced && _frameSentThisTime)) {
 						ReplyToSampleRequest();
 						return;
 					}
@@ -479,8 +558,9 @@ namespace Org {
 				}
 				_helper->QueueFrame(frame);
 
-				// If we have a pending request, reply to it now.
-				if (_deferral != nullptr) {
+				// If we have a pending request, reply to it now, or on the
+				// next tick if a sample was already sent during this one.
+				if (_deferral != nullptr && !(_paced && _frameSentThisTime)) {
 					ReplyToSampleRequest();
 				}
 			}
@@ -56,7 +56,7 @@ namespace Org {
 					WeakReference _streamSource;
 				};
 
-				RTMediaStreamSource(VideoFrameType frameType);
+				RTMediaStreamSource(VideoFrameType frameType, String^ id);
 				void ProcessReceivedFrame(webrtc::VideoFrame *frame);
 				bool ConvertFrame(IMFMediaBuffer* mediaBuffer, webrtc::VideoFrame* frame);
 				void ResizeSource(uint32 width, uint32 height);
@@ -76,9 +76,13 @@ namespace Org {
 				ThreadPoolTimer^ _progressTimer;
 				void ProgressTimerElapsedExecute(ThreadPoolTimer^ source);
 
+				// Paces the samples of I420 sources, see
+				// WebRTC::RenderPacingFramerate.  At most one sample is
+				// handed to the media element per tick.
 				ThreadPoolTimer^ _fpsTimer;
 				void FPSTimerElapsedExecute(ThreadPoolTimer^ source);
 				bool _frameSentThisTime;
+				bool _paced;
 
 				Windows::Media::Core::VideoStreamDescriptor^ _videoDesc;
 
@@ -90,6 +94,9 @@ namespace Org {
 				Windows::Media::Core::MediaStreamSourceStartingEventArgs^ _startingArgs;
 
 				ULONG _frameBeingQueued;
+
+				// Renders I420 frames as IYUV without converting them to NV12.
+				bool _directI420;
 			};
 		}
 	}
@@ -0,0 +1,151 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#include "RawVideoFrame.h"
+
+using Microsoft::WRL::MakeAndInitialize;
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			VideoPlaneReference::VideoPlaneReference() :
+				_data(nullptr), _capacity(0) {
+			}
+
+			VideoPlaneReference::~VideoPlaneReference() {
+			}
+
+			HRESULT VideoPlaneReference::RuntimeClassInitialize(
+				rtc::scoped_refptr<webrtc::I420BufferInterface> frameBuffer,
+				const uint8_t* data, UINT32 capacity) {
+				_frameBuffer = frameBuffer;
+				// The frame buffer may be shared with other sinks, it must
+				// be treated as read-only.
+				_data = const_cast<BYTE*>(data);
+				_capacity = capacity;
+				return S_OK;
+			}
+
+			IFACEMETHODIMP VideoPlaneReference::get_Capacity(UINT32* value) {
+				if (value == nullptr) {
+					return E_POINTER;
+				}
+				rtc::CritScope lock(&_critSect);
+				*value = _capacity;
+				return S_OK;
+			}
+
+			IFACEMETHODIMP VideoPlaneReference::add_Closed(
+				MemoryBufferClosedHandler* handler, EventRegistrationToken* token) {
+				return _closedEvent.Add(handler, token);
+			}
+
+			IFACEMETHODIMP VideoPlaneReference::remove_Closed(
+				EventRegistrationToken token) {
+				return _closedEvent.Remove(token);
+			}
+
+			IFACEMETHODIMP VideoPlaneReference::Close() {
+				{
+					rtc::CritScope lock(&_critSect);
+					if (_frameBuffer == nullptr) {
+						return S_OK;
+					}
+					_frameBuffer = nullptr;
+					_data = nullptr;
+					_capacity = 0;
+				}
+				return _closedEvent.InvokeAll(this, nullptr);
+			}
+
+			IFACEMETHODIMP VideoPlaneReference::GetBuffer(BYTE** value, UINT32* capacity) {
+				if (value == nullptr || capacity == nullptr) {
+					return E_POINTER;
+				}
+				rtc::CritScope lock(&_critSect);
+				if (_frameBuffer == nullptr) {
+					return RO_E_CLOSED;
+				}
+				*value = _data;
+				*capacity = _capacity;
+				return S_OK;
+			}
+		}
+
+		RawVideoFrame::RawVideoFrame(
+			rtc::scoped_refptr<webrtc::I420BufferInterface> frameBuffer,
+			std::shared_ptr<std::atomic<uint32>> outstandingFrames) :
+			_frameBuffer(frameBuffer),
+			_outstandingFrames(outstandingFrames) {
+			++(*_outstandingFrames);
+		}
+
+		RawVideoFrame::~RawVideoFrame() {
+			if (_frameBuffer != nullptr) {
+				_frameBuffer = nullptr;
+				--(*_outstandingFrames);
+			}
+		}
+
+		uint32 RawVideoFrame::Width::get() {
+			return _frameBuffer != nullptr ? (uint32)_frameBuffer->width() : 0;
+		}
+
+		uint32 RawVideoFrame::Height::get() {
+			return _frameBuffer != nullptr ? (uint32)_frameBuffer->height() : 0;
+		}
+
+		uint32 RawVideoFrame::StrideY::get() {
+			return _frameBuffer != nullptr ? (uint32)_frameBuffer->StrideY() : 0;
+		}
+
+		uint32 RawVideoFrame::StrideU::get() {
+			return _frameBuffer != nullptr ? (uint32)_frameBuffer->StrideU() : 0;
+		}
+
+		uint32 RawVideoFrame::StrideV::get() {
+			return _frameBuffer != nullptr ? (uint32)_frameBuffer->StrideV() : 0;
+		}
+
+		Windows::Foundation::IMemoryBufferReference^ RawVideoFrame::GetPlaneY() {
+			if (_frameBuffer == nullptr) {
+				return nullptr;
+			}
+			return GetPlane(_frameBuffer->DataY(), _frameBuffer->StrideY(),
+				_frameBuffer->height());
+		}
+
+		Windows::Foundation::IMemoryBufferReference^ RawVideoFrame::GetPlaneU() {
+			if (_frameBuffer == nullptr) {
+				return nullptr;
+			}
+			return GetPlane(_frameBuffer->DataU(), _frameBuffer->StrideU(),
+				_frameBuffer->ChromaHeight());
+		}
+
+		Windows::Foundation::IMemoryBufferReference^ RawVideoFrame::GetPlaneV() {
+			if (_frameBuffer == nullptr) {
+				return nullptr;
+			}
+			return GetPlane(_frameBuffer->DataV(), _frameBuffer->StrideV(),
+				_frameBuffer->ChromaHeight());
+		}
+
+		Windows::Foundation::IMemoryBufferReference^ RawVideoFrame::GetPlane(
+			const uint8_t* data, int stride, int height) {
+			ComPtr<Internal::VideoPlaneReference> plane;
+			if (FAILED(MakeAndInitialize<Internal::VideoPlaneReference>(&plane,
+				_frameBuffer, data, (UINT32)(stride * height)))) {
+				return nullptr;
+			}
+			return reinterpret_cast<Windows::Foundation::IMemoryBufferReference^>(
+				static_cast<ABI::Windows::Foundation::IMemoryBufferReference*>(plane.Get()));
+		}
+	}
+}  // namespace Org.WebRtc
@@ -0,0 +1,109 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#ifndef ORG_WEBRTC_RAWVIDEOFRAME_H_
+#define ORG_WEBRTC_RAWVIDEOFRAME_H_
+
+#include <wrl.h>
+#include <wrl/event.h>
+#include <windows.foundation.h>
+#include <MemoryBuffer.h>
+#include <atomic>
+#include <memory>
+#include "webrtc/api/video/video_frame_buffer.h"
+#include "webrtc/rtc_base/criticalsection.h"
+
+using Microsoft::WRL::ComPtr;
+using Microsoft::WRL::RuntimeClass;
+using Microsoft::WRL::RuntimeClassFlags;
+using Microsoft::WRL::RuntimeClassType;
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			typedef ABI::Windows::Foundation::ITypedEventHandler<
+				ABI::Windows::Foundation::IMemoryBufferReference*, IInspectable*>
+				MemoryBufferClosedHandler;
+
+			// IMemoryBufferReference on one plane of an I420 frame buffer.
+			// Holds a reference on the frame buffer until closed.
+			class VideoPlaneReference :
+				public RuntimeClass<RuntimeClassFlags<RuntimeClassType::WinRtClassicComMix>,
+				ABI::Windows::Foundation::IMemoryBufferReference,
+				ABI::Windows::Foundation::IClosable,
+				Windows::Foundation::IMemoryBufferByteAccess> {
+				InspectableClass(L"Org.WebRtc.Internal.VideoPlaneReference", BaseTrust)
+			public:
+				VideoPlaneReference();
+				virtual ~VideoPlaneReference();
+				HRESULT RuntimeClassInitialize(
+					rtc::scoped_refptr<webrtc::I420BufferInterface> frameBuffer,
+					const uint8_t* data, UINT32 capacity);
+
+				// IMemoryBufferReference
+				IFACEMETHOD(get_Capacity)(UINT32* value);
+				IFACEMETHOD(add_Closed)(MemoryBufferClosedHandler* handler,
+					EventRegistrationToken* token);
+				IFACEMETHOD(remove_Closed)(EventRegistrationToken token);
+
+				// IClosable
+				IFACEMETHOD(Close)();
+
+				// IMemoryBufferByteAccess
+				IFACEMETHOD(GetBuffer)(BYTE** value, UINT32* capacity);
+
+			private:
+				rtc::CriticalSection _critSect;
+				rtc::scoped_refptr<webrtc::I420BufferInterface> _frameBuffer;
+				BYTE* _data;
+				UINT32 _capacity;
+				Microsoft::WRL::EventSource<MemoryBufferClosedHandler> _closedEvent;
+			};
+		}
+
+		/// <summary>
+		/// A decoded video frame delivered by <see cref="RawVideoSource"/>.
+		/// The planes are not copied, the frame keeps the decoder buffer
+		/// alive until it is disposed. Dispose frames as soon as they are
+		/// no longer needed, the source drops new frames while too many
+		/// are outstanding.
+		/// </summary>
+		public ref class RawVideoFrame sealed {
+		internal:
+			RawVideoFrame(rtc::scoped_refptr<webrtc::I420BufferInterface> frameBuffer,
+				std::shared_ptr<std::atomic<uint32>> outstandingFrames);
+
+		public:
+			virtual ~RawVideoFrame();
+
+			property uint32 Width { uint32 get(); }
+			property uint32 Height { uint32 get(); }
+			property uint32 StrideY { uint32 get(); }
+			property uint32 StrideU { uint32 get(); }
+			property uint32 StrideV { uint32 get(); }
+
+			/// <summary>
+			/// Returns a reference on the Y, U or V plane. Each reference
+			/// keeps the frame buffer alive until it is closed.
+			/// </summary>
+			Windows::Foundation::IMemoryBufferReference^ GetPlaneY();
+			Windows::Foundation::IMemoryBufferReference^ GetPlaneU();
+			Windows::Foundation::IMemoryBufferReference^ GetPlaneV();
+
+		private:
+			Windows::Foundation::IMemoryBufferReference^ GetPlane(
+				const uint8_t* data, int stride, int height);
+
+			rtc::scoped_refptr<webrtc::I420BufferInterface> _frameBuffer;
+			std::shared_ptr<std::atomic<uint32>> _outstandingFrames;
+		};
+	}
+}  // namespace Org.WebRtc
+
+#endif  // ORG_WEBRTC_RAWVIDEOFRAME_H_
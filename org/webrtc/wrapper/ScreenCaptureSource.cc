@@ -0,0 +1,286 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#include "ScreenCaptureSource.h"
+#include <dxgi.h>
+#include <windows.graphics.directx.direct3d11.interop.h>
+#include <algorithm>
+#include "webrtc/rtc_base/logging.h"
+#include "webrtc/rtc_base/timeutils.h"
+
+using Windows::Foundation::TypedEventHandler;
+using Windows::Graphics::Capture::Direct3D11CaptureFrame;
+using Windows::Graphics::DirectX::DirectXPixelFormat;
+using Windows::Graphics::DirectX::Direct3D11::IDirect3DDxgiInterfaceAccess;
+using Windows::System::Threading::TimerElapsedHandler;
+
+namespace {
+	// Interval the last frame is repeated at while the content doesn't
+	// change.
+	const int64_t kRepeatIntervalUs = rtc::kNumMicrosecsPerSec;
+	// One for the frame kept to be repeated, one for the frame waiting
+	// for the frame rate, the others in flight.
+	const size_t kMaxTextures = 5;
+	const int32 kFramePoolBuffers = 2;
+
+	// Largest even size of the aspect ratio of |width|x|height| fitting
+	// in |maxWidth|x|maxHeight|.
+	void FitSize(int width, int height, int maxWidth, int maxHeight,
+		int* outWidth, int* outHeight) {
+		if (width > maxWidth || height > maxHeight) {
+			double scale = std::min((double)maxWidth / width,
+				(double)maxHeight / height);
+			width = (int)(width * scale);
+			height = (int)(height * scale);
+		}
+		*outWidth = std::max(2, width & ~1);
+		*outHeight = std::max(2, height & ~1);
+	}
+}
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			ScreenCaptureState::ScreenCaptureState(uint32 maxWidth,
+				uint32 maxHeight, uint32 framerate) :
+				maxWidth(maxWidth), maxHeight(maxHeight),
+				capturer(nullptr),
+				lastWidth(0), lastHeight(0), lastFrameTimeUs(0),
+				pendingWidth(0), pendingHeight(0),
+				maxFramerate(framerate),
+				droppedFrames(0), repeatedFrames(0),
+				closed(false) {
+				poolSize.Width = 0;
+				poolSize.Height = 0;
+				converter.SetMaxTextures(kMaxTextures);
+			}
+
+			void ScreenCaptureState::OnFrameArrived() {
+				rtc::CritScope lock(&critSect);
+				if (closed) {
+					return;
+				}
+				// Only called when the content changed, an unchanged
+				// screen costs nothing until the frame is repeated.
+				Direct3D11CaptureFrame^ frame = framePool->TryGetNextFrame();
+				if (frame == nullptr) {
+					return;
+				}
+				Windows::Graphics::SizeInt32 contentSize = frame->ContentSize;
+				if (contentSize.Width != poolSize.Width ||
+					contentSize.Height != poolSize.Height) {
+					// The next frames get the new size, this one is cropped.
+					poolSize = contentSize;
+					framePool->Recreate(device,
+						DirectXPixelFormat::B8G8R8A8UIntNormalized, kFramePoolBuffers,
+						contentSize);
+				}
+
+				int64_t timeUs = rtc::TimeMicros();
+				int64_t minIntervalUs = GetMinFrameIntervalUs();
+				bool tooSoon = minIntervalUs > 0 && lastFrameTimeUs > 0 &&
+					timeUs - lastFrameTimeUs < minIntervalUs;
+
+				ComPtr<IDirect3DDxgiInterfaceAccess> access;
+				ComPtr<ID3D11Texture2D> texture;
+				HRESULT hr = reinterpret_cast<IInspectable*>(frame->Surface)->QueryInterface(
+					IID_PPV_ARGS(&access));
+				if (SUCCEEDED(hr)) {
+					hr = access->GetInterface(IID_PPV_ARGS(&texture));
+				}
+				if (FAILED(hr)) {
+					delete frame;
+					return;
+				}
+				D3D11_TEXTURE2D_DESC desc;
+				texture->GetDesc(&desc);
+				int width = std::min((int)desc.Width, contentSize.Width) & ~1;
+				int height = std::min((int)desc.Height, contentSize.Height) & ~1;
+
+				int outWidth, outHeight;
+				RECT crop;
+				rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer;
+				if (width >= 2 && height >= 2 &&
+					capturer->Adapt(width, height, &timeUs, &outWidth, &outHeight, &crop)) {
+					FitSize(outWidth, outHeight, maxWidth, maxHeight, &outWidth, &outHeight);
+					buffer = converter.Convert(texture.Get(), crop, outWidth, outHeight);
+				}
+				// The conversion is queued on the device before the surface
+				// goes back to the frame pool.
+				delete frame;
+				if (buffer == nullptr) {
+					++droppedFrames;
+					return;
+				}
+				if (tooSoon) {
+					// Kept so that the screen doesn't stay stale when its
+					// content stops changing, an older pending frame is
+					// dropped.
+					if (pendingBuffer != nullptr) {
+						++droppedFrames;
+					} else {
+						std::shared_ptr<ScreenCaptureState> self = shared_from_this();
+						Windows::Foundation::TimeSpan delay;
+						delay.Duration = (lastFrameTimeUs + minIntervalUs - timeUs) * 10;  // hns
+						ThreadPoolTimer::CreateTimer(
+							ref new TimerElapsedHandler([self](ThreadPoolTimer^) {
+							self->RepeatLastFrame();
+						}), delay);
+					}
+					pendingBuffer = buffer;
+					pendingWidth = width;
+					pendingHeight = height;
+					return;
+				}
+				pendingBuffer = nullptr;
+				lastBuffer = buffer;
+				lastWidth = width;
+				lastHeight = height;
+				lastFrameTimeUs = rtc::TimeMicros();
+				capturer->Deliver(webrtc::VideoFrame(buffer, webrtc::kVideoRotation_0, timeUs),
+					width, height);
+			}
+
+			void ScreenCaptureState::RepeatLastFrame() {
+				rtc::CritScope lock(&critSect);
+				int64_t timeUs = rtc::TimeMicros();
+				if (closed) {
+					return;
+				}
+				if (pendingBuffer != nullptr) {
+					if (timeUs - lastFrameTimeUs < GetMinFrameIntervalUs()) {
+						return;
+					}
+					lastBuffer = pendingBuffer;
+					lastWidth = pendingWidth;
+					lastHeight = pendingHeight;
+					pendingBuffer = nullptr;
+					lastFrameTimeUs = timeUs;
+					capturer->Deliver(webrtc::VideoFrame(lastBuffer, webrtc::kVideoRotation_0, timeUs),
+						lastWidth, lastHeight);
+					return;
+				}
+				if (lastBuffer == nullptr ||
+					timeUs - lastFrameTimeUs < kRepeatIntervalUs) {
+					return;
+				}
+				// The same buffer, encoded as a small P frame.
+				lastFrameTimeUs = timeUs;
+				++repeatedFrames;
+				capturer->Deliver(webrtc::VideoFrame(lastBuffer, webrtc::kVideoRotation_0, timeUs),
+					lastWidth, lastHeight);
+			}
+
+			int64_t ScreenCaptureState::GetMinFrameIntervalUs() const {
+				uint32 framerate = maxFramerate;
+				return framerate > 0 ?
+					rtc::kNumMicrosecsPerSec * 9 / 10 / framerate : 0;
+			}
+		}
+
+		ScreenCaptureSource::ScreenCaptureSource(GraphicsCaptureItem^ item,
+			uint32 maxWidth, uint32 maxHeight, uint32 framerate) {
+			if (item == nullptr) {
+				THROW_WEBRTC_NULL_REFERENCE_EXCEPTION("Invalid capture item");
+			}
+			// Windows 10 1903 and later, the project still targets 1709.
+			if (!Windows::Foundation::Metadata::ApiInformation::IsMethodPresent(
+				"Windows.Graphics.Capture.Direct3D11CaptureFramePool", "CreateFreeThreaded")) {
+				throw ref new Platform::NotImplementedException(
+					"Screen capture needs Windows 10 version 1903");
+			}
+			framerate = std::min(std::max(framerate, 1u), 30u);
+			_state = std::make_shared<Internal::ScreenCaptureState>(
+				std::max(2u, maxWidth & ~1u), std::max(2u, maxHeight & ~1u), framerate);
+
+			// A device of our own, the frame pool can't share the one of
+			// the application.
+			ComPtr<ID3D11Device> d3dDevice;
+			ComPtr<IDXGIDevice> dxgiDevice;
+			ComPtr<IInspectable> inspectable;
+			HRESULT hr = D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_HARDWARE, nullptr,
+				D3D11_CREATE_DEVICE_BGRA_SUPPORT | D3D11_CREATE_DEVICE_VIDEO_SUPPORT,
+				nullptr, 0, D3D11_SDK_VERSION, &d3dDevice, nullptr, nullptr);
+			if (SUCCEEDED(hr)) {
+				hr = d3dDevice.As(&dxgiDevice);
+			}
+			if (SUCCEEDED(hr)) {
+				hr = CreateDirect3D11DeviceFromDXGIDevice(dxgiDevice.Get(), &inspectable);
+			}
+			if (FAILED(hr)) {
+				LOG(LS_ERROR) << "ScreenCaptureSource: can't create the device, hr=" << hr;
+				throw ref new Platform::COMException(hr);
+			}
+			_state->device = reinterpret_cast<IDirect3DDevice^>(inspectable.Get());
+
+			int width, height;
+			FitSize(item->Size.Width, item->Size.Height, _state->maxWidth,
+				_state->maxHeight, &width, &height);
+			_state->capturer = new Internal::CustomVideoCapturer(width, height,
+				framerate, true);
+			_track = Internal::CreateCustomVideoTrack(_state->capturer);
+
+			std::shared_ptr<Internal::ScreenCaptureState> state = _state;
+			state->poolSize = item->Size;
+			state->framePool = Direct3D11CaptureFramePool::CreateFreeThreaded(
+				state->device, DirectXPixelFormat::B8G8R8A8UIntNormalized,
+				kFramePoolBuffers, item->Size);
+			state->framePool->FrameArrived +=
+				ref new TypedEventHandler<Direct3D11CaptureFramePool^, Platform::Object^>(
+					[state](Direct3D11CaptureFramePool^, Platform::Object^) {
+				state->OnFrameArrived();
+			});
+			_session = state->framePool->CreateCaptureSession(item);
+			_session->StartCapture();
+
+			Windows::Foundation::TimeSpan period;
+			period.Duration = kRepeatIntervalUs * 10 / 2;  // hns, twice per interval
+			_timer = ThreadPoolTimer::CreatePeriodicTimer(
+				ref new TimerElapsedHandler([state](ThreadPoolTimer^) {
+				state->RepeatLastFrame();
+			}), period);
+		}
+
+		ScreenCaptureSource::~ScreenCaptureSource() {
+			_timer->Cancel();
+			delete _session;
+			Direct3D11CaptureFramePool^ framePool;
+			{
+				rtc::CritScope lock(&_state->critSect);
+				_state->closed = true;
+				_state->lastBuffer = nullptr;
+				_state->pendingBuffer = nullptr;
+				// Its handler holds the state.
+				framePool = _state->framePool;
+				_state->framePool = nullptr;
+			}
+			delete framePool;
+		}
+
+		MediaVideoTrack^ ScreenCaptureSource::Track::get() {
+			return _track;
+		}
+
+		uint32 ScreenCaptureSource::MaxFramerate::get() {
+			return _state->maxFramerate;
+		}
+
+		void ScreenCaptureSource::MaxFramerate::set(uint32 value) {
+			_state->maxFramerate = value;
+		}
+
+		uint64 ScreenCaptureSource::DroppedFrames::get() {
+			return _state->droppedFrames;
+		}
+
+		uint64 ScreenCaptureSource::RepeatedFrames::get() {
+			return _state->repeatedFrames;
+		}
+	}
+}  // namespace Org.WebRtc
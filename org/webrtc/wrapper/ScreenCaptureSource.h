@@ -0,0 +1,118 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#ifndef ORG_WEBRTC_SCREENCAPTURESOURCE_H_
+#define ORG_WEBRTC_SCREENCAPTURESOURCE_H_
+
+#include <memory>
+#include "CustomVideoSource.h"
+
+using Windows::Graphics::Capture::Direct3D11CaptureFramePool;
+using Windows::Graphics::Capture::GraphicsCaptureItem;
+using Windows::Graphics::Capture::GraphicsCaptureSession;
+using Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice;
+using Windows::System::Threading::ThreadPoolTimer;
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			// Shared with the frame pool and the timer, which can still call
+			// it while the source is destroyed.
+			struct ScreenCaptureState :
+				public std::enable_shared_from_this<ScreenCaptureState> {
+				ScreenCaptureState(uint32 maxWidth, uint32 maxHeight,
+					uint32 framerate);
+
+				const uint32 maxWidth;
+				const uint32 maxHeight;
+				rtc::CriticalSection critSect;
+				CustomVideoCapturer* capturer;
+				IDirect3DDevice^ device;
+				Direct3D11CaptureFramePool^ framePool;
+				Windows::Graphics::SizeInt32 poolSize;
+				TextureConverter converter;
+				// Last frame delivered, repeated while the screen doesn't
+				// change.
+				rtc::scoped_refptr<webrtc::VideoFrameBuffer> lastBuffer;
+				int lastWidth;
+				int lastHeight;
+				int64_t lastFrameTimeUs;
+				// Newest frame that came too soon for the frame rate,
+				// delivered by RepeatLastFrame() once the interval allows.
+				rtc::scoped_refptr<webrtc::VideoFrameBuffer> pendingBuffer;
+				int pendingWidth;
+				int pendingHeight;
+				std::atomic<uint32> maxFramerate;
+				std::atomic<uint64> droppedFrames;
+				std::atomic<uint64> repeatedFrames;
+				bool closed;
+
+				void OnFrameArrived();
+				// Delivers the pending frame, or repeats the last one.
+				void RepeatLastFrame();
+
+			private:
+				// Time the frames are kept apart by the frame rate, 0 for
+				// no limit.
+				int64_t GetMinFrameIntervalUs() const;
+			};
+		}
+
+		/// <summary>
+		/// Video track of a display or of a window, captured with
+		/// Windows.Graphics.Capture.  The captured surfaces are converted and
+		/// scaled to NV12 on the GPU, the H264 encoder takes them as they
+		/// are when it runs on the GPU.  The track is a screencast: the
+		/// encoder keeps the resolution and lowers the frame rate instead.
+		/// </summary>
+		/// <remarks>
+		/// Frames are only captured when the content changes.  While it
+		/// doesn't, the last frame is repeated once a second, which costs
+		/// next to nothing to encode.  The application needs the
+		/// graphicsCapture capability, and gets the item to capture from a
+		/// GraphicsCapturePicker.
+		/// </remarks>
+		public ref class ScreenCaptureSource sealed {
+		internal:
+			ScreenCaptureSource(GraphicsCaptureItem^ item, uint32 maxWidth,
+				uint32 maxHeight, uint32 framerate);
+
+		public:
+			virtual ~ScreenCaptureSource();
+
+			/// <summary>
+			/// Track of the captured frames, to be added to a media stream.
+			/// </summary>
+			property MediaVideoTrack^ Track { MediaVideoTrack^ get(); }
+			/// <summary>
+			/// Frames coming faster are dropped, 0 for no limit.
+			/// Default value: the frame rate the source was created with
+			/// </summary>
+			property uint32 MaxFramerate { uint32 get(); void set(uint32 value); }
+			/// <summary>
+			/// Number of frames dropped, because of the frame rate or of
+			/// the frames in flight.
+			/// </summary>
+			property uint64 DroppedFrames { uint64 get(); }
+			/// <summary>
+			/// Number of times the last frame was repeated because the
+			/// content didn't change.
+			/// </summary>
+			property uint64 RepeatedFrames { uint64 get(); }
+
+		private:
+			std::shared_ptr<Internal::ScreenCaptureState> _state;
+			MediaVideoTrack^ _track;
+			GraphicsCaptureSession^ _session;
+			ThreadPoolTimer^ _timer;
+		};
+	}
+}  // namespace Org.WebRtc
+
+#endif  // ORG_WEBRTC_SCREENCAPTURESOURCE_H_
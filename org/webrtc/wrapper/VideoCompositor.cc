@@ -0,0 +1,244 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#include "VideoCompositor.h"
+#include <algorithm>
+#include "libyuv/planar_functions.h"
+#include "libyuv/scale.h"
+#include "webrtc/rtc_base/logging.h"
+#include "webrtc/rtc_base/timeutils.h"
+#include "webrtc/common_video/video_common_winuwp.h"
+#include "third_party/winuwp_h264/H264Decoder/H264Decoder.h"
+
+using Windows::System::Threading::TimerElapsedHandler;
+using Windows::UI::Core::CoreDispatcherPriority;
+using Windows::UI::Core::DispatchedHandler;
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			CompositorTile::CompositorTile(MediaVideoTrack^ track, int x, int y,
+				int width, int height) :
+				x(x), y(y), width(width), height(height),
+				_track(track),
+				_newFrame(false),
+				_encodedFrameLogged(false) {
+			}
+
+			CompositorTile::~CompositorTile() {
+			}
+
+			void CompositorTile::OnFrame(const webrtc::VideoFrame& frame) {
+				if (webrtc::IsEncodedNativeBuffer(frame.video_frame_buffer().get())) {
+					if (!_encodedFrameLogged) {
+						_encodedFrameLogged = true;
+						LOG(LS_WARNING) << "VideoCompositor: encoded frames can't be composited";
+					}
+					return;
+				}
+				rtc::scoped_refptr<webrtc::I420BufferInterface> frameBuffer =
+					frame.video_frame_buffer()->ToI420();
+				if (frameBuffer == nullptr) {
+					return;
+				}
+				if (frame.rotation() != webrtc::kVideoRotation_0) {
+					frameBuffer = webrtc::I420Buffer::Rotate(*frameBuffer, frame.rotation());
+				}
+				rtc::CritScope lock(&_critSect);
+				_lastFrame = frameBuffer;
+				_newFrame = true;
+			}
+
+			rtc::scoped_refptr<webrtc::I420BufferInterface> CompositorTile::GetLastFrame(
+				bool* newFrame) {
+				rtc::CritScope lock(&_critSect);
+				*newFrame = _newFrame;
+				_newFrame = false;
+				return _lastFrame;
+			}
+
+			void CompositorState::Compose() {
+				struct Layer {
+					int x;
+					int y;
+					int width;
+					int height;
+					rtc::scoped_refptr<webrtc::I420BufferInterface> frame;
+				};
+
+				rtc::CritScope composeLock(&composeCritSect);
+				std::vector<Layer> layers;
+				RTMediaStreamSource^ source;
+				{
+					rtc::CritScope lock(&critSect);
+					if (closed || mediaSource == nullptr) {
+						return;
+					}
+					bool changed = layoutChanged;
+					layoutChanged = false;
+					for (auto& tile : tiles) {
+						bool newFrame = false;
+						Layer layer;
+						layer.frame = tile->GetLastFrame(&newFrame);
+						changed |= newFrame;
+						if (layer.frame == nullptr) {
+							continue;
+						}
+						layer.x = tile->x;
+						layer.y = tile->y;
+						layer.width = tile->width;
+						layer.height = tile->height;
+						layers.push_back(layer);
+					}
+					// The media source repeats the last picture, nothing
+					// to do until a track delivers a new frame.
+					if (!changed) {
+						return;
+					}
+					source = mediaSource;
+				}
+
+				// Pooled buffers are recycled, the whole picture is drawn
+				// each time.
+				rtc::scoped_refptr<webrtc::I420Buffer> canvas =
+					bufferPool.CreateBuffer(width, height);
+				if (canvas == nullptr) {
+					return;
+				}
+				libyuv::I420Rect(canvas->MutableDataY(), canvas->StrideY(),
+					canvas->MutableDataU(), canvas->StrideU(),
+					canvas->MutableDataV(), canvas->StrideV(),
+					0, 0, width, height, 16, 128, 128);
+
+				for (auto& layer : layers) {
+					const webrtc::I420BufferInterface& frame = *layer.frame;
+					double scale = std::min((double)layer.width / frame.width(),
+						(double)layer.height / frame.height());
+					int scaledWidth = std::max(2, (int)(frame.width() * scale) & ~1);
+					int scaledHeight = std::max(2, (int)(frame.height() * scale) & ~1);
+					int x = (layer.x + (layer.width - scaledWidth) / 2) & ~1;
+					int y = (layer.y + (layer.height - scaledHeight) / 2) & ~1;
+					libyuv::I420Scale(frame.DataY(), frame.StrideY(),
+						frame.DataU(), frame.StrideU(),
+						frame.DataV(), frame.StrideV(),
+						frame.width(), frame.height(),
+						canvas->MutableDataY() + y * canvas->StrideY() + x,
+						canvas->StrideY(),
+						canvas->MutableDataU() + (y / 2) * canvas->StrideU() + x / 2,
+						canvas->StrideU(),
+						canvas->MutableDataV() + (y / 2) * canvas->StrideV() + x / 2,
+						canvas->StrideV(),
+						scaledWidth, scaledHeight, libyuv::kFilterBilinear);
+				}
+
+				int64_t nowMs = rtc::TimeMillis();
+				webrtc::VideoFrame frame(canvas, (uint32_t)(nowMs * 90), nowMs,
+					webrtc::kVideoRotation_0);
+				source->RenderFrame(&frame);
+			}
+		}
+
+		VideoCompositor::VideoCompositor(MediaElement^ mediaElement, String^ id,
+			uint32 width, uint32 height, uint32 framerate) :
+			_state(std::make_shared<Internal::CompositorState>(
+				std::max(2, (int)width & ~1), std::max(2, (int)height & ~1))),
+			_framerate(std::min(std::max(framerate, 1u), 60u)) {
+			std::shared_ptr<Internal::CompositorState> state = _state;
+			auto handler = ref new DispatchedHandler([state, mediaElement, id]() {
+				Internal::RTMediaStreamSource^ mediaSource =
+					Internal::RTMediaStreamSource::CreateMediaSource(
+						Internal::FrameTypeI420, id);
+				{
+					rtc::CritScope lock(&state->critSect);
+					if (state->closed) {
+						return;
+					}
+					state->mediaSource = mediaSource;
+					state->layoutChanged = true;
+				}
+				mediaElement->SetMediaStreamSource(mediaSource->GetMediaStreamSource());
+			});
+			Windows::UI::Core::CoreDispatcher^ windowDispatcher =
+				webrtc::VideoCommonWinUWP::GetCoreDispatcher();
+			if (windowDispatcher != nullptr && !windowDispatcher->HasThreadAccess) {
+				windowDispatcher->RunAsync(CoreDispatcherPriority::Normal, handler);
+			}
+			else {
+				handler->Invoke();
+			}
+
+			Windows::Foundation::TimeSpan period;
+			period.Duration = 1000 * 1000 * 10 / _framerate;  // hns
+			_timer = ThreadPoolTimer::CreatePeriodicTimer(
+				ref new TimerElapsedHandler([state](ThreadPoolTimer^) {
+				state->Compose();
+			}), period);
+		}
+
+		VideoCompositor::~VideoCompositor() {
+			_timer->Cancel();
+			rtc::CritScope lock(&_state->critSect);
+			_state->closed = true;
+			for (auto& tile : _state->tiles) {
+				tile->Track()->UnsetRenderer(tile.get());
+			}
+			_state->tiles.clear();
+			_state->mediaSource = nullptr;
+		}
+
+		void VideoCompositor::SetTile(MediaVideoTrack^ track, uint32 x, uint32 y,
+			uint32 width, uint32 height) {
+			// Kept inside the picture, on even coordinates for the chroma
+			// planes.
+			int tileX = std::min((int)x, _state->width - 2) & ~1;
+			int tileY = std::min((int)y, _state->height - 2) & ~1;
+			int tileWidth = std::max(2, std::min((int)width, _state->width - tileX));
+			int tileHeight = std::max(2, std::min((int)height, _state->height - tileY));
+
+			rtc::CritScope lock(&_state->critSect);
+			_state->layoutChanged = true;
+			for (auto& tile : _state->tiles) {
+				if (tile->Track() == track) {
+					tile->x = tileX;
+					tile->y = tileY;
+					tile->width = tileWidth;
+					tile->height = tileHeight;
+					return;
+				}
+			}
+			_state->tiles.push_back(std::unique_ptr<Internal::CompositorTile>(
+				new Internal::CompositorTile(track, tileX, tileY, tileWidth, tileHeight)));
+			track->SetRenderer(_state->tiles.back().get());
+		}
+
+		void VideoCompositor::RemoveTile(MediaVideoTrack^ track) {
+			rtc::CritScope lock(&_state->critSect);
+			for (auto iter = _state->tiles.begin(); iter != _state->tiles.end(); ++iter) {
+				if ((*iter)->Track() == track) {
+					track->UnsetRenderer(iter->get());
+					_state->tiles.erase(iter);
+					_state->layoutChanged = true;
+					return;
+				}
+			}
+		}
+
+		uint32 VideoCompositor::Width::get() {
+			return _state->width;
+		}
+
+		uint32 VideoCompositor::Height::get() {
+			return _state->height;
+		}
+
+		uint32 VideoCompositor::Framerate::get() {
+			return _framerate;
+		}
+	}
+}  // namespace Org.WebRtc
@@ -0,0 +1,117 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#ifndef ORG_WEBRTC_VIDEOCOMPOSITOR_H_
+#define ORG_WEBRTC_VIDEOCOMPOSITOR_H_
+
+#include <memory>
+#include <vector>
+#include "Media.h"
+#include "webrtc/api/video/i420_buffer.h"
+#include "webrtc/common_video/include/i420_buffer_pool.h"
+#include "webrtc/rtc_base/criticalsection.h"
+
+using Windows::System::Threading::ThreadPoolTimer;
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			// Keeps the last frame of one track of a VideoCompositor.
+			class CompositorTile : public rtc::VideoSinkInterface<webrtc::VideoFrame> {
+			public:
+				CompositorTile(MediaVideoTrack^ track, int x, int y,
+					int width, int height);
+				virtual ~CompositorTile();
+				void OnFrame(const webrtc::VideoFrame& frame) override;
+
+				// Returns the last frame, nullptr if none was received yet.
+				// |newFrame| tells whether it arrived since the last call.
+				rtc::scoped_refptr<webrtc::I420BufferInterface> GetLastFrame(
+					bool* newFrame);
+
+				MediaVideoTrack^ Track() const { return _track; }
+
+				int x;
+				int y;
+				int width;
+				int height;
+
+			private:
+				MediaVideoTrack^ _track;
+				rtc::CriticalSection _critSect;
+				rtc::scoped_refptr<webrtc::I420BufferInterface> _lastFrame;
+				bool _newFrame;
+				bool _encodedFrameLogged;
+			};
+
+			// Shared with the timer which can still fire while the
+			// compositor is destroyed.
+			struct CompositorState {
+				CompositorState(int width, int height) :
+					width(width), height(height), layoutChanged(true),
+					closed(false) {}
+				const int width;
+				const int height;
+				rtc::CriticalSection critSect;
+				std::vector<std::unique_ptr<CompositorTile>> tiles;
+				bool layoutChanged;
+				RTMediaStreamSource^ mediaSource;
+				bool closed;
+				// Only used by Compose(), serialized by composeCritSect.
+				rtc::CriticalSection composeCritSect;
+				webrtc::I420BufferPool bufferPool;
+
+				void Compose();
+			};
+		}
+
+		/// <summary>
+		/// Renders several video tracks into one MediaElement, each track
+		/// in its own tile of the picture.  All the tracks share one media
+		/// pipeline instead of one each, which is what limits the number
+		/// of videos an application can show.
+		/// </summary>
+		/// <remarks>
+		/// Encoded frames can't be composited, remote H264 tracks need
+		/// <see cref="WebRTC::H264DecodingMode"/> to decode them.
+		/// </remarks>
+		public ref class VideoCompositor sealed {
+		internal:
+			VideoCompositor(MediaElement^ mediaElement, String^ id,
+				uint32 width, uint32 height, uint32 framerate);
+
+		public:
+			virtual ~VideoCompositor();
+
+			/// <summary>
+			/// Shows a track in the given rectangle of the picture, or
+			/// moves it there if it is already shown.  The video keeps its
+			/// aspect ratio and is centered in the rectangle.
+			/// </summary>
+			void SetTile(MediaVideoTrack^ track, uint32 x, uint32 y,
+				uint32 width, uint32 height);
+
+			/// <summary>
+			/// Stops showing a track.
+			/// </summary>
+			void RemoveTile(MediaVideoTrack^ track);
+
+			property uint32 Width { uint32 get(); }
+			property uint32 Height { uint32 get(); }
+			property uint32 Framerate { uint32 get(); }
+
+		private:
+			std::shared_ptr<Internal::CompositorState> _state;
+			uint32 _framerate;
+			ThreadPoolTimer^ _timer;
+		};
+	}
+}  // namespace Org.WebRtc
+
+#endif  // ORG_WEBRTC_VIDEOCOMPOSITOR_H_
@@ -11,6 +11,8 @@
 #include "Media.h"
 #include <mferror.h>
 #include "webrtc/common_video/video_common_winuwp.h"
+#include "third_party/winuwp_h264/H264Decoder/H264Decoder.h"
+#include "third_party/winuwp_h264/Utils/GpuPipeline.h"
 
 namespace Org {
 	namespace WebRtc {
@@ -63,7 +65,9 @@ namespace Org {
 			}
 
 			void WebRtcMediaSource::WebRtcVideoSink::OnFrame(const webrtc::VideoFrame& frame) {
-				if (frame.video_frame_buffer()->ToI420() != nullptr) {
+				// Decoded native samples go through the I420 stream, which
+				// renders them without a round-trip through system memory.
+				if (!webrtc::IsEncodedNativeBuffer(frame.video_frame_buffer().get())) {
 					if (_frameType == FrameTypeH264) {
 						_videoSinkObserver->OnVideoFormatChanged(FrameTypeI420);
 						_frameType = FrameTypeI420;
@@ -84,6 +88,10 @@ namespace Org {
 			}
 
 			WebRtcMediaSource::~WebRtcMediaSource() {
+				// When destroyed without having been shutdown.
+				if (_deviceManager != nullptr) {
+					RemoveSharedDXGIDeviceManager(_deviceManager.Get());
+				}
 				_webRtcVideoSink.reset();
 			}
 
@@ -289,6 +297,9 @@ namespace Org {
 				RETURN_ON_FAIL(_h264Stream->Shutdown());
 
 				_presDescriptor = nullptr;
+				if (_deviceManager != nullptr) {
+					RemoveSharedDXGIDeviceManager(_deviceManager.Get());
+				}
 				_deviceManager = nullptr;
 				_eventQueue = nullptr;
 				_webRtcVideoSink.reset();
@@ -313,11 +324,18 @@ namespace Org {
 				if (_eventQueue == nullptr) {
 					return MF_E_SHUTDOWN;
 				}
+				if (_deviceManager != nullptr) {
+					RemoveSharedDXGIDeviceManager(_deviceManager.Get());
+				}
 				RETURN_ON_FAIL(pManager->QueryInterface(
 					IID_IMFDXGIDeviceManager,
 					reinterpret_cast<void**>(_deviceManager.ReleaseAndGetAddressOf())));
 
 				RETURN_ON_FAIL(_i420Stream->SetD3DManager(_deviceManager));
+				RETURN_ON_FAIL(_h264Stream->SetD3DManager(_deviceManager));
+
+				// Let the decoder produce textures on the media element's device.
+				AddSharedDXGIDeviceManager(_deviceManager.Get());
 
 				return S_OK;
 			}
@@ -17,26 +17,24 @@
 #include <wrl.h>
 #include <ppltasks.h>
 #include "webrtc/api/video/video_frame.h"
+#include "webrtc/rtc_base/stringutils.h"
+#include "webrtc/rtc_base/timeutils.h"
 #include "webrtc/media/base/videosourceinterface.h"
 #include "libyuv/convert.h"
+#include "KeyFrameRequest.h"
+#include "PlanarYuvMediaBuffer.h"
+#include "third_party/winuwp_h264/H264Decoder/H264Decoder.h"
+#include "third_party/winuwp_h264/Utils/GpuPipeline.h"
 
 using Microsoft::WRL::MakeAndInitialize;
 using Windows::System::Threading::TimerElapsedHandler;
 
-namespace webrtc {
-  namespace vcm {
-    // How we trigger a key frame request when
-    // registering an H264 renderer. We render
-    // encoded samples so we have to request a
-    // key frame as fast as possible otherwise
-    // we don't render anything until the next
-    // key frame.
-    extern bool globalRequestKeyFrame;
-  }
-}
-
 namespace Org {
 	namespace WebRtc {
+		namespace globals {
+			extern bool gDirectI420Rendering;
+		}
+
 		namespace Internal {
 
 #define MAX_FRAME_DELAY_MS 30
@@ -54,10 +52,11 @@ namespace Org {
 
 
 			WebRtcMediaStream::WebRtcMediaStream() :
-				_frameBufferIndex(0), _frameReady(0), _frameCount(0),
-				_gpuVideoBuffer(false),
-				_frameBeingQueued(0), _started(false),_isShutdown(false) {
-				_mediaBuffers.resize(BufferCount);
+				_frameMemory("RenderSamples"),
+				_sampleStride(0), _frameReady(0), _frameCount(0),
+				_gpuVideoBuffer(false), _directI420(false),
+				_frameBeingQueued(0), _deliveryScheduled(false),
+				_started(false),_isShutdown(false) {
 			}
 
 			WebRtcMediaStream::~WebRtcMediaStream() {
@@ -80,9 +79,12 @@ namespace Org {
 				_source = source;
 				_id = id;
 				_frameType = frameType;
+				_directI420 = _frameType == FrameTypeI420 &&
+					Org::WebRtc::globals::gDirectI420Rendering;
 
 				// Create the helper with the callback functions.
 				_helper.reset(new MediaSourceHelper(
+					rtc::ToUtf8(id->Data()),
 					frameType,
 					[this](webrtc::VideoFrame* frame, IMFSample** sample) -> HRESULT {
 					return MakeSampleCallback(frame, sample);
@@ -92,15 +94,16 @@ namespace Org {
 				}));
 
 				DWORD streamIdentifier = _frameType != FrameTypeH264 ? 0 : 1;
-				RETURN_ON_FAIL(CreateMediaType(64, 64, 0, _frameType == FrameTypeH264, &_mediaType));
+				RETURN_ON_FAIL(CreateMediaType(64, 64, 0, 0, _frameType == FrameTypeH264, _directI420, &_mediaType));
 				RETURN_ON_FAIL(MFCreateEventQueue(&_eventQueue));
 				RETURN_ON_FAIL(MFCreateStreamDescriptor(streamIdentifier, 1, _mediaType.GetAddressOf(), &_streamDescriptor));
 				ComPtr<IMFMediaTypeHandler> mediaTypeHandler;
 				RETURN_ON_FAIL(_streamDescriptor->GetMediaTypeHandler(&mediaTypeHandler));
 				RETURN_ON_FAIL(mediaTypeHandler->SetCurrentMediaType(_mediaType.Get()));
+				RETURN_ON_FAIL(ResetMediaBuffers());
 
 				if (_frameType == FrameTypeH264)
-					webrtc::vcm::globalRequestKeyFrame = true;
+					RequestGlobalKeyFrame();
 
 				return S_OK;
 			}
@@ -166,7 +169,10 @@ namespace Org {
 					return E_POINTER;
 				}
 				InterlockedIncrement(&_frameReady);
-				ReplyToSampleRequest();
+				if (_helper != nullptr) {
+					_helper->OnSampleRequested();
+				}
+				ScheduleDelivery();
 
 				return S_OK;
 			}
@@ -178,30 +184,48 @@ namespace Org {
 
 			void WebRtcMediaStream::RenderFrame(
 				const webrtc::VideoFrame *frame) {
+				// Stamped with the receive time, see MediaSourceHelper::QueueFrame().
 				auto frameCopy = new webrtc::VideoFrame(
 					frame->video_frame_buffer(), frame->rotation(),
-					frame->timestamp_us());
+					rtc::TimeMicros());
+				rtc::CritScope lock(&_critSect);
+				if (_helper == nullptr) {
+					delete frameCopy;
+					return;
+				}
+				// Only hands the frame over, the conversion is done by
+				// DeliverSamples().
+				_helper->QueueFrame(frameCopy);
+				ScheduleDelivery();
+			}
+
+			void WebRtcMediaStream::ScheduleDelivery() {
+				if (_deliveryScheduled || _frameReady == 0 ||
+					_helper == nullptr || !_helper->HasFrames()) {
+					return;
+				}
+				_deliveryScheduled = true;
 				InterlockedIncrement(&_frameBeingQueued);
-				// Do the processing async because there's a risk of a deadlock otherwise.
-				Concurrency::create_async([this, frameCopy] {
-					{
-						rtc::CritScope lock(&_critSect);
-						if (_helper != nullptr) {
-							_helper->QueueFrame(frameCopy);
-							ReplyToSampleRequest();
-						}
-					}
+				// Async because there's a risk of a deadlock otherwise, and
+				// to keep the conversion off the decoder thread.
+				Windows::System::Threading::ThreadPool::RunAsync(
+					ref new Windows::System::Threading::WorkItemHandler(
+						[this](Windows::Foundation::IAsyncAction^) {
+					DeliverSamples();
 					InterlockedDecrement(&_frameBeingQueued);
-				});
+				}));
 			}
 
 			HRESULT WebRtcMediaStream::CreateMediaType(
-				unsigned int width, unsigned int height,
-				unsigned int rotation, bool isH264, IMFMediaType** ppType) {
+				unsigned int width, unsigned int height, unsigned int stride,
+				unsigned int rotation, bool isH264, bool isIyuv, IMFMediaType** ppType) {
 				// Create media type
 				// Make sure the dimensions are even
 				width &= ~((unsigned int)1);
 				height &= ~((unsigned int)1);
+				if (stride < width) {
+					stride = width;
+				}
 				ComPtr<IMFMediaType> mediaType;
 				RETURN_ON_FAIL(MFCreateMediaType(&mediaType));
 				RETURN_ON_FAIL(mediaType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video));
@@ -209,11 +233,14 @@ namespace Org {
 				if (isH264) {
 					RETURN_ON_FAIL(mediaType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_H264));
 				} else {
-					RETURN_ON_FAIL(mediaType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_NV12));
+					RETURN_ON_FAIL(mediaType->SetGUID(MF_MT_SUBTYPE,
+						isIyuv ? MFVideoFormat_IYUV : MFVideoFormat_NV12));
 					RETURN_ON_FAIL(mediaType->SetUINT32(MF_MT_FIXED_SIZE_SAMPLES, TRUE));
 					RETURN_ON_FAIL(mediaType->SetUINT32(MF_MT_ALL_SAMPLES_INDEPENDENT, TRUE));
-					RETURN_ON_FAIL(mediaType->SetUINT32(MF_MT_SAMPLE_SIZE, width * height * 3 / 2));
-					RETURN_ON_FAIL(mediaType->SetUINT32(MF_MT_DEFAULT_STRIDE, width));
+					// Both formats are 12 bits per pixel, the chroma rows
+					// half the luma pitch for IYUV and the same for NV12.
+					RETURN_ON_FAIL(mediaType->SetUINT32(MF_MT_SAMPLE_SIZE, stride * height * 3 / 2));
+					RETURN_ON_FAIL(mediaType->SetUINT32(MF_MT_DEFAULT_STRIDE, stride));
 				}
 
 				RETURN_ON_FAIL(MFSetAttributeSize(mediaType.Get(), MF_MT_FRAME_SIZE, width, height));
@@ -226,33 +253,75 @@ namespace Org {
 
 			HRESULT WebRtcMediaStream::MakeSampleCallback(
 				const webrtc::VideoFrame* frame, IMFSample** sample) {
-				ComPtr<IMFSample> spSample;
-				RETURN_ON_FAIL(MFCreateSample(&spSample));
+				SamplePool* samplePool = _helper->GetSamplePool();
+				if (samplePool == nullptr)
+					return E_FAIL;
+
+				// Unknown for the textures handed over.
+				_sampleStride = 0;
 
 				// Make sure the destination buffer in even. Crop one pixel if odd.
 				unsigned int destWidth = (unsigned int)(frame->width() & (~((size_t)1)));
 				unsigned int destHeight = (unsigned int)(frame->height() & (~((size_t)1)));
-				// Make sure the buffers are the right size
+				// Make sure the buffers are the right size, the textures
+				// handed over as well.
 				{
 					unsigned int width, height;
 					RETURN_ON_FAIL(MFGetAttributeSize(
 						_mediaType.Get(), MF_MT_FRAME_SIZE, &width, &height));
 					if (destWidth != width || destHeight != height) {
-						RETURN_ON_FAIL(CreateMediaType(destWidth, destHeight,
-							(unsigned int)frame->rotation(), false, &_mediaType));
+						RETURN_ON_FAIL(CreateMediaType(destWidth, destHeight, 0,
+							(unsigned int)frame->rotation(), false, _directI420, &_mediaType));
 						ResetMediaBuffers();
 					}
 				}
 
-				// Pick the next buffer.
-				ComPtr<IMFMediaBuffer> buffer;
-				buffer = _mediaBuffers[_frameBufferIndex];
-				if (buffer == nullptr)
-					return E_FAIL;
-				_frameBufferIndex++;
-				_frameBufferIndex %= BufferCount;
+				std::unique_ptr<webrtc::VideoFrame> i420Frame;
+				if (frame->video_frame_buffer()->type() == webrtc::VideoFrameBuffer::Type::kNative) {
+					// Decoded on the device shared with the media element,
+					// as an NV12 texture of the size of the media type: hand
+					// it over as is.
+					if (_gpuVideoBuffer && !_directI420) {
+						rtc::scoped_refptr<webrtc::NativeHandleBuffer> frameBuffer =
+							static_cast<webrtc::NativeHandleBuffer*>(frame->video_frame_buffer().get());
+						IMFSample* decodedSample = (IMFSample*)frameBuffer->native_handle();
+						if (decodedSample == nullptr)
+							return E_FAIL;
+						if (GetNV12TextureBuffer(decodedSample, _managerDevice.Get(),
+							destWidth, destHeight) != nullptr) {
+							ComPtr<IMFSample> spSample(decodedSample);
+							*sample = spSample.Detach();
+							return S_OK;
+						}
+					}
+					rtc::scoped_refptr<webrtc::I420BufferInterface> i420Buffer =
+						frame->video_frame_buffer()->ToI420();
+					if (i420Buffer == nullptr)
+						return E_FAIL;
+					i420Frame.reset(new webrtc::VideoFrame(i420Buffer, frame->rotation(), 0));
+					frame = i420Frame.get();
+				}
 
-				RETURN_ON_FAIL(spSample->AddBuffer(buffer.Get()));
+				if (_directI420) {
+					LONG pitch;
+					// Try to hand the frame buffer over as is.
+					if (SUCCEEDED(CreateI420Sample(frame, sample, &pitch))) {
+						_sampleStride = (unsigned int)pitch;
+						return S_OK;
+					}
+					ComPtr<IMFSample> spSample;
+					RETURN_ON_FAIL(samplePool->GetSample(destWidth, destHeight, &spSample));
+					RETURN_ON_FAIL(CopyI420ToSample(frame, spSample.Get(), &pitch));
+					_sampleStride = (unsigned int)pitch;
+					*sample = spSample.Detach();
+					return S_OK;
+				}
+
+				// Get a recycled sample, the pool is rebuilt if the size changed.
+				ComPtr<IMFSample> spSample;
+				RETURN_ON_FAIL(samplePool->GetSample(destWidth, destHeight, &spSample));
+				ComPtr<IMFMediaBuffer> buffer;
+				RETURN_ON_FAIL(spSample->GetBufferByIndex(0, &buffer));
 
 				ComPtr<IMF2DBuffer2> buffer2d;
 				RETURN_ON_FAIL(buffer.As(&buffer2d));
@@ -266,9 +335,13 @@ namespace Org {
 					&destRawData, &pitch, &bufferStart, &destMediaBufferSize));
 				AutoFunction autoUnlockBuffer([buffer2d]() {buffer2d->Unlock2D(); });
 
-				// Convert to NV12
-				rtc::scoped_refptr<webrtc::PlanarYuvBuffer> frameBuffer =
-					static_cast<webrtc::PlanarYuvBuffer*>(frame->video_frame_buffer().get());
+				// Convert to NV12, the I420 buffers are returned as they are.
+				rtc::scoped_refptr<webrtc::I420BufferInterface> frameBuffer =
+					frame->video_frame_buffer()->ToI420();
+				if (frameBuffer == nullptr)
+					return E_FAIL;
+				if (!_gpuVideoBuffer)
+					_sampleStride = (unsigned int)pitch;
 				uint8* uvDest = destRawData + (pitch * destHeight);
 				libyuv::I420ToNV12(frameBuffer->DataY(), frameBuffer->StrideY(),
 					frameBuffer->DataU(), frameBuffer->StrideU(),
@@ -289,22 +362,68 @@ namespace Org {
 				});
 			}
 
-			HRESULT WebRtcMediaStream::ReplyToSampleRequest() {
-				rtc::CritScope lock(&_critSect);
-				if (_frameReady == 0 || !_helper->HasFrames()) {
-					return S_OK;
+			void WebRtcMediaStream::DeliverSamples() {
+				rtc::CritScope convertLock(&_convertCritSect);
+				while (true) {
+					MediaSourceHelper* helper;
+					{
+						rtc::CritScope lock(&_critSect);
+						if (_frameReady == 0 || _helper == nullptr || !_helper->HasFrames()) {
+							_deliveryScheduled = false;
+							return;
+						}
+						helper = _helper.get();
+					}
+
+					// Converted without holding _critSect, the helper can't
+					// go away while _convertCritSect is held.
+					auto sampleData = helper->DequeueFrame();
+					if (sampleData == nullptr) {
+						rtc::CritScope lock(&_critSect);
+						_deliveryScheduled = false;
+						return;
+					}
+					// Held from the conversion until the sample is queued.
+					DWORD bytes = 0;
+					if (sampleData->sample != nullptr) {
+						sampleData->sample->GetTotalLength(&bytes);
+					}
+					// Over the budget, a decoded frame is given up when
+					// a newer one is already waiting.  The H.264 frames
+					// can't be, the helper resumes them from an IDR frame.
+					if (_frameType != FrameTypeH264 &&
+						_frameMemory.WouldExceedBudget(bytes) && helper->HasFrames()) {
+						_frameMemory.OnFrameDropped();
+						continue;
+					}
+					_frameMemory.Add(bytes);
+
+					rtc::CritScope lock(&_critSect);
+					HRESULT hr = QueueSample(sampleData.get());
+					_frameMemory.Remove(bytes);
+					if (FAILED(hr)) {
+						_deliveryScheduled = false;
+						return;
+					}
 				}
+			}
 
+			HRESULT WebRtcMediaStream::QueueSample(SampleData* sampleData) {
+				if (_eventQueue == nullptr) {
+					return MF_E_SHUTDOWN;
+				}
 				_frameCount++;
 
-				auto sampleData = _helper->DequeueFrame();
-
-				if (sampleData == nullptr) {
-					return S_OK;
+				// The pitch of the samples is only known once made.
+				bool strideHasChanged = false;
+				if (_frameType != FrameTypeH264 && _sampleStride != 0) {
+					strideHasChanged = MFGetAttributeUINT32(
+						_mediaType.Get(), MF_MT_DEFAULT_STRIDE, 0) != _sampleStride;
 				}
 
 				// Update rotation property
-				if (sampleData->rotationHasChanged || sampleData->sizeHasChanged) {
+				if (sampleData->rotationHasChanged || sampleData->sizeHasChanged ||
+					strideHasChanged) {
 					unsigned int width, height;
 					if (sampleData->sizeHasChanged) {
 						width = sampleData->size.cx;
@@ -326,7 +445,8 @@ namespace Org {
 							+ width.ToString() + L"x" + height.ToString()
 							+ " rotation:" + rotation.ToString() + L"\r\n")->Data());
 
-					CreateMediaType(width, height, rotation, _frameType == FrameTypeH264, &_mediaType);
+					CreateMediaType(width, height, _sampleStride, rotation,
+						_frameType == FrameTypeH264, _directI420, &_mediaType);
 					_eventQueue->QueueEventParamUnk(MEStreamFormatChanged,
 						GUID_NULL, S_OK, _mediaType.Get());
 					ResetMediaBuffers();
@@ -369,6 +489,8 @@ namespace Org {
 			}
 
 			STDMETHODIMP WebRtcMediaStream::Shutdown() {
+				// Waits for a conversion in progress.
+				rtc::CritScope convertLock(&_convertCritSect);
 				rtc::CritScope lock(&_critSect);
 
 				if (!_isShutdown)
@@ -377,6 +499,7 @@ namespace Org {
 						_eventQueue->Shutdown();
 					}
 					_deviceManager = nullptr;
+					_managerDevice = nullptr;
 					_eventQueue = nullptr;
 
 					_helper.reset();
@@ -388,6 +511,7 @@ namespace Org {
 
 			STDMETHODIMP WebRtcMediaStream::SetD3DManager(
 				ComPtr<IMFDXGIDeviceManager> manager) {
+				rtc::CritScope convertLock(&_convertCritSect);
 				rtc::CritScope lock(&_critSect);
 				_deviceManager = manager;
 				HANDLE deviceHandle;
@@ -398,6 +522,7 @@ namespace Org {
 				_deviceManager->LockDevice(deviceHandle, IID_ID3D11Device, &device, TRUE);
 				AutoFunction autoUnlockDevice([this, deviceHandle]() {
 					_deviceManager->UnlockDevice(deviceHandle, TRUE); });
+				_managerDevice = device;
 				if ((unsigned int)device->GetFeatureLevel() >=
 					(unsigned int)D3D_FEATURE_LEVEL_11_1) {
 					_gpuVideoBuffer = true;
@@ -412,18 +537,31 @@ namespace Org {
 			}
 
 			HRESULT WebRtcMediaStream::ResetMediaBuffers() {
-				for (auto&& buffer : _mediaBuffers) {
-					buffer.Reset();
-				}
+				if (_helper == nullptr)
+					return S_OK;
+				SamplePool* samplePool = _helper->GetSamplePool();
+				if (samplePool == nullptr)
+					return S_OK;
 
-				unsigned int width, height;
-				RETURN_ON_FAIL(MFGetAttributeSize(_mediaType.Get(),
-					MF_MT_FRAME_SIZE, &width, &height));
+				// Drops the pooled samples, new ones get created with
+				// the current buffer type and size on demand.
+				samplePool->SetBufferFactory(
+					[this](UINT32 width, UINT32 height, IMFMediaBuffer** buffer) -> HRESULT {
+					return CreateMediaBuffer(width, height, buffer);
+				});
+				return S_OK;
+			}
 
-				if (_deviceManager == nullptr) {
-					return S_OK;
+			HRESULT WebRtcMediaStream::CreateMediaBuffer(
+				UINT32 width, UINT32 height, IMFMediaBuffer** buffer) {
+				if (_directI420) {
+					// The GPU render buffers are NV12 textures.
+					return MFCreate2DMediaBuffer(
+						width, height,
+						MFVideoFormat_IYUV.Data1, FALSE,
+						buffer);
 				}
-				if (_gpuVideoBuffer) {
+				if (_deviceManager != nullptr && _gpuVideoBuffer) {
 					HANDLE hDevice = NULL;
 					ComPtr<ID3D11Device> device;
 					RETURN_ON_FAIL(_deviceManager->OpenDeviceHandle(&hDevice));
@@ -434,36 +572,29 @@ namespace Org {
 					AutoFunction autoUnlockDevice([this, hDevice]() {
 						_deviceManager->UnlockDevice(hDevice, TRUE); });
 
-					for (auto&& buffer : _mediaBuffers) {
-						D3D11_TEXTURE2D_DESC texDesc;
-						ComPtr<ID3D11Texture2D> frameTexture;
-						ZeroMemory(&texDesc, sizeof(texDesc));
-						texDesc.Width = width;
-						texDesc.Height = height;
-						texDesc.MipLevels = 1;
-						texDesc.ArraySize = 1;
-						texDesc.Format = DXGI_FORMAT_NV12;
-						texDesc.SampleDesc.Count = 1;
-						texDesc.Usage = D3D11_USAGE_DEFAULT;
-						if (FAILED(device->CreateTexture2D(&texDesc, nullptr,
-							frameTexture.ReleaseAndGetAddressOf()))) {
-							_gpuVideoBuffer = false;
-							OutputDebugString(
-								L"Failed to create DirectX 2D texture for video buffers, falling back to main memory buffers\r\n");
-							return ResetMediaBuffers();
-						}
-						RETURN_ON_FAIL(MFCreateDXGISurfaceBuffer(__uuidof(ID3D11Texture2D),
-							frameTexture.Get(), 0, FALSE, &buffer));
-					}
-				} else {
-					for (auto&& buffer : _mediaBuffers) {
-						MFCreate2DMediaBuffer(
-							width, height,
-							MFVideoFormat_NV12.Data1, FALSE,
-							&buffer);
+					D3D11_TEXTURE2D_DESC texDesc;
+					ComPtr<ID3D11Texture2D> frameTexture;
+					ZeroMemory(&texDesc, sizeof(texDesc));
+					texDesc.Width = width;
+					texDesc.Height = height;
+					texDesc.MipLevels = 1;
+					texDesc.ArraySize = 1;
+					texDesc.Format = DXGI_FORMAT_NV12;
+					texDesc.SampleDesc.Count = 1;
+					texDesc.Usage = D3D11_USAGE_DEFAULT;
+					if (SUCCEEDED(device->CreateTexture2D(&texDesc, nullptr,
+						frameTexture.ReleaseAndGetAddressOf()))) {
+						return MFCreateDXGISurfaceBuffer(__uuidof(ID3D11Texture2D),
+							frameTexture.Get(), 0, FALSE, buffer);
 					}
+					_gpuVideoBuffer = false;
+					OutputDebugString(
+						L"Failed to create DirectX 2D texture for video buffers, falling back to main memory buffers\r\n");
 				}
-				return S_OK;
+				return MFCreate2DMediaBuffer(
+					width, height,
+					MFVideoFormat_NV12.Data1, FALSE,
+					buffer);
 			}
 		}
 	}
@@ -107,6 +107,9 @@ namespace Org {
 				STDMETHOD(SetD3DManager)(ComPtr<IMFDXGIDeviceManager> manager);
 
 			private:
+				// Taken before _critSect.  Serializes the conversion of
+				// the frames and guards the media type and the samples.
+				rtc::CriticalSection _convertCritSect;
 				rtc::CriticalSection _critSect;
 
 				ComPtr<IMFMediaEventQueue> _eventQueue;
@@ -115,31 +118,51 @@ namespace Org {
 				String^ _id;
 				VideoFrameType _frameType;
 
+				// |stride| is the luma pitch of the samples, 0 for |width|.
 				static HRESULT CreateMediaType(unsigned int width, unsigned int height,
-					unsigned int rotation, bool isH264, IMFMediaType** ppType);
+					unsigned int stride, unsigned int rotation, bool isH264, bool isIyuv,
+					IMFMediaType** ppType);
 				HRESULT MakeSampleCallback(const webrtc::VideoFrame* frame, IMFSample** sample);
 				void FpsCallback(int fps);
 
-				HRESULT ReplyToSampleRequest();
+				// Called with _critSect held, starts DeliverSamples() on
+				// the thread pool unless it is already pending.
+				void ScheduleDelivery();
+				// Converts the queued frames and queues the samples while
+				// the media element asks for them.
+				void DeliverSamples();
+				HRESULT QueueSample(SampleData* sampleData);
 
 				std::unique_ptr<MediaSourceHelper> _helper;
 
+				// The samples being converted and queued.
+				webrtc::FrameMemoryAccount _frameMemory;
 				ComPtr<IMFMediaType> _mediaType;
+				// Luma pitch of the last sample made, 0 if unknown.  The
+				// buffers are padded, the media type follows it.
+				unsigned int _sampleStride;
 				ComPtr<IMFDXGIDeviceManager> _deviceManager;
+				// Device behind |_deviceManager|, the decoded textures of
+				// other devices can't be handed over.
+				ComPtr<ID3D11Device> _managerDevice;
 				ComPtr<IMFStreamDescriptor> _streamDescriptor;
 				ULONGLONG _startTickCount;
 				ULONGLONG _frameCount;
 				int _index;
 				ULONG _frameReady;
 				ULONG _frameBeingQueued;
+				bool _deliveryScheduled;
 
 				// From the sample manager.
+				// Render samples are drawn from the helper's sample pool,
+				// this selects GPU or main memory buffers for it.
 				HRESULT ResetMediaBuffers();
-				static const int BufferCount = 3;
-				std::vector<ComPtr<IMFMediaBuffer>> _mediaBuffers;
-				int _frameBufferIndex;
+				HRESULT CreateMediaBuffer(UINT32 width, UINT32 height,
+					IMFMediaBuffer** buffer);
 
 				bool _gpuVideoBuffer;
+				// Renders I420 frames as IYUV without converting them to NV12.
+				bool _directI420;
 				bool _started;
 				bool _isShutdown;
 			};
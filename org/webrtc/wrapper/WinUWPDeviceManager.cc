@@ -78,46 +78,48 @@ namespace Org {
 				}
 			}
 
-			bool WinUWPDeviceManager::GetAudioInputDevices(std::vector<cricket::Device>* devices) {
-				devices->clear();
-				auto deviceOp = Windows::Devices::Enumeration::
-				DeviceInformation::FindAllAsync(
+			namespace {
+				concurrency::task<std::vector<cricket::Device>> FindDevicesAsync(
+					Windows::Devices::Enumeration::DeviceClass deviceClass) {
+					auto deviceOp = Windows::Devices::Enumeration::
+						DeviceInformation::FindAllAsync(deviceClass);
+					return concurrency::create_task(deviceOp).then([](
+						Windows::Devices::Enumeration::DeviceInformationCollection^
+						deviceCollection) {
+						std::vector<cricket::Device> devices;
+						for (size_t i = 0; i < deviceCollection->Size; i++) {
+							Windows::Devices::Enumeration::DeviceInformation^ di =
+								deviceCollection->GetAt((unsigned int)i);
+							std::string nameUTF8(rtc::ToUtf8(di->Name->Data(),
+								di->Name->Length()));
+							std::string idUTF8(rtc::ToUtf8(di->Id->Data(), di->Id->Length()));
+							devices.push_back(cricket::Device(nameUTF8, idUTF8));
+						}
+						return devices;
+					});
+				}
+			}  // namespace
+
+			concurrency::task<std::vector<cricket::Device>>
+				WinUWPDeviceManager::GetAudioInputDevicesAsync() {
+				return FindDevicesAsync(
 					Windows::Devices::Enumeration::DeviceClass::AudioCapture);
-				auto deviceEnumTask = concurrency::create_task(deviceOp);
-				deviceEnumTask.then([&devices](
-					Windows::Devices::Enumeration::DeviceInformationCollection^
-					deviceCollection) {
-					for (size_t i = 0; i < deviceCollection->Size; i++) {
-						Windows::Devices::Enumeration::DeviceInformation^ di =
-							deviceCollection->GetAt((unsigned int)i);
-						std::string nameUTF8(rtc::ToUtf8(di->Name->Data(),
-							di->Name->Length()));
-						std::string idUTF8(rtc::ToUtf8(di->Id->Data(), di->Id->Length()));
-						devices->push_back(cricket::Device(nameUTF8, idUTF8));
-					}
-				}).wait();
+			}
+
+			concurrency::task<std::vector<cricket::Device>>
+				WinUWPDeviceManager::GetAudioOutputDevicesAsync() {
+				return FindDevicesAsync(
+					Windows::Devices::Enumeration::DeviceClass::AudioRender);
+			}
+
+			bool WinUWPDeviceManager::GetAudioInputDevices(std::vector<cricket::Device>* devices) {
+				*devices = GetAudioInputDevicesAsync().get();
 				return true;
 			}
 
 			bool WinUWPDeviceManager::GetAudioOutputDevices(
 				std::vector<cricket::Device>* devices) {
-				devices->clear();
-				auto deviceOp =
-					Windows::Devices::Enumeration::DeviceInformation::FindAllAsync(
-				Windows::Devices::Enumeration::DeviceClass::AudioRender);
-				auto deviceEnumTask = concurrency::create_task(deviceOp);
-				deviceEnumTask.then([&devices](
-					Windows::Devices::Enumeration::DeviceInformationCollection^
-					deviceCollection) {
-					for (size_t i = 0; i < deviceCollection->Size; i++) {
-						Windows::Devices::Enumeration::DeviceInformation^ di =
-							deviceCollection->GetAt((unsigned int)i);
-						std::string nameUTF8(rtc::ToUtf8(di->Name->Data(),
-							di->Name->Length()));
-						std::string idUTF8(rtc::ToUtf8(di->Id->Data(), di->Id->Length()));
-						devices->push_back(cricket::Device(nameUTF8, idUTF8));
-					}
-				}).wait();
+				*devices = GetAudioOutputDevicesAsync().get();
 				return true;
 			}
 
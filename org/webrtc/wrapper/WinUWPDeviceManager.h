@@ -13,6 +13,7 @@
 #error Invalid build configuration
 #endif  // WINUWP
 
+#include <ppltasks.h>
 #include <map>
 #include <string>
 #include <vector>
@@ -40,8 +41,12 @@ namespace Org {
 				bool Init();
 				void Terminate();
 
+				// The synchronous versions wait for the enumeration, don't
+				// call them on the UI thread or on gThread.
 				bool GetAudioInputDevices(std::vector<cricket::Device>* devices);
 				bool GetAudioOutputDevices(std::vector<cricket::Device>* devices);
+				concurrency::task<std::vector<cricket::Device>> GetAudioInputDevicesAsync();
+				concurrency::task<std::vector<cricket::Device>> GetAudioOutputDevicesAsync();
 
 				bool GetVideoCaptureDevices(std::vector<cricket::Device>* devs);
 				cricket::VideoCapturer* WinUWPDeviceManager::CreateVideoCapturer(const cricket::Device& device) const;
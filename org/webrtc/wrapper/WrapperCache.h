@@ -0,0 +1,77 @@
+// Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+#ifndef ORG_WEBRTC_WRAPPERCACHE_H_
+#define ORG_WEBRTC_WRAPPERCACHE_H_
+
+#include <algorithm>
+#include <unordered_map>
+#include "webrtc/rtc_base/criticalsection.h"
+#include "webrtc/rtc_base/scoped_ref_ptr.h"
+
+namespace Org {
+	namespace WebRtc {
+		namespace Internal {
+
+			// Wrappers of native objects by native pointer, so the same
+			// wrapper is returned for a native object as long as the
+			// application holds it.  The wrappers are weakly referenced,
+			// the entries of the released ones are swept when the cache
+			// doubles in size.  A wrapper which released its native
+			// object (stopped or disposed) is replaced, which also covers
+			// a native object allocated at the address of a freed one.
+			template <typename Wrapper, typename Native>
+			class WrapperCache {
+			public:
+				WrapperCache() : _sweepSize(kMinSweepSize) {
+				}
+
+				Wrapper^ Get(const rtc::scoped_refptr<Native>& native) {
+					if (native == nullptr) {
+						return nullptr;
+					}
+					rtc::CritScope lock(&_critSect);
+					auto it = _wrappers.find(native.get());
+					if (it != _wrappers.end()) {
+						Wrapper^ wrapper = it->second.Resolve<Wrapper>();
+						if (wrapper != nullptr && wrapper->GetImpl().get() == native.get()) {
+							return wrapper;
+						}
+					}
+					Wrapper^ wrapper = ref new Wrapper(native);
+					_wrappers[native.get()] = Platform::WeakReference(wrapper);
+					if (_wrappers.size() >= _sweepSize) {
+						Sweep();
+						_sweepSize = std::max(kMinSweepSize, _wrappers.size() * 2);
+					}
+					return wrapper;
+				}
+
+			private:
+				static const size_t kMinSweepSize = 64;
+
+				void Sweep() {
+					for (auto it = _wrappers.begin(); it != _wrappers.end();) {
+						Wrapper^ wrapper = it->second.Resolve<Wrapper>();
+						if (wrapper == nullptr || wrapper->GetImpl() == nullptr) {
+							it = _wrappers.erase(it);
+						} else {
+							++it;
+						}
+					}
+				}
+
+				rtc::CriticalSection _critSect;
+				std::unordered_map<Native*, Platform::WeakReference> _wrappers;
+				size_t _sweepSize;
+			};
+		}
+	}
+}  // namespace Org.WebRtc
+
+#endif  // ORG_WEBRTC_WRAPPERCACHE_H_
@@ -19,12 +19,21 @@
 #include <mfidl.h>
 #include <mfreadwrite.h>
 #include <wrl\implements.h>
+#include <codecapi.h>
+#include <algorithm>
+#include <atomic>
 #include <iomanip>
+#include "../Utils/GpuPipeline.h"
+#include "../Utils/MftCapabilities.h"
+#include "../Utils/PipelineTrace.h"
+#include "../Utils/ResourceSampler.h"
 #include "../Utils/Utils.h"
 #include "libyuv/convert.h"
+#include "libyuv/planar_functions.h"
 #include "webrtc/rtc_base/logging.h"
 #include "webrtc/rtc_base/checks.h"
 #include "webrtc/common_video/include/video_frame_buffer.h"
+#include "webrtc/api/video/i420_buffer.h"
 #include "webrtc/modules/video_coding/include/video_codec_interface.h"
 
 #pragma comment(lib, "mfreadwrite")
@@ -33,6 +42,53 @@
 
 namespace webrtc {
 
+namespace {
+std::atomic<int> gDecoderMode((int)H264DecoderMode::kPassthrough);
+}  // namespace
+
+void SetH264DecoderMode(H264DecoderMode mode) {
+  gDecoderMode = (int)mode;
+}
+
+H264DecoderMode GetH264DecoderMode() {
+  return (H264DecoderMode)gDecoderMode.load();
+}
+
+// Hands the events of an asynchronous MFT to the decoder until detached.
+// Media Foundation keeps a reference while an event is pending, which
+// can outlive the decoder.
+class DecoderEventCallback : public Microsoft::WRL::RuntimeClass<
+  Microsoft::WRL::RuntimeClassFlags<
+  Microsoft::WRL::RuntimeClassType::ClassicCom>,
+  IMFAsyncCallback> {
+ public:
+  explicit DecoderEventCallback(WinUWPH264DecoderImpl* decoder)
+    : decoder_(decoder) {}
+
+  void Detach() {
+    rtc::CritScope lock(&crit_);
+    decoder_ = nullptr;
+  }
+
+  // IMFAsyncCallback
+  IFACEMETHODIMP GetParameters(DWORD*, DWORD*) override {
+    // Implementation of this method is optional.
+    return E_NOTIMPL;
+  }
+  IFACEMETHODIMP Invoke(IMFAsyncResult* result) override {
+    rtc::CritScope lock(&crit_);
+    if (decoder_ != nullptr) {
+      decoder_->OnDecoderEvent(result);
+    }
+    return S_OK;
+  }
+
+ private:
+  // Held while an event is handled, Detach() waits for it.
+  rtc::CriticalSection crit_;
+  WinUWPH264DecoderImpl* decoder_;
+};
+
 //////////////////////////////////////////
 // H264 WinUWP Decoder Implementation
 //////////////////////////////////////////
@@ -40,29 +96,379 @@ namespace webrtc {
 WinUWPH264DecoderImpl::WinUWPH264DecoderImpl()
   : width_(0),
   height_(0),
-  decodeCompleteCallback_(nullptr) {
+  decodeCompleteCallback_(nullptr),
+  waitForKeyFrame_(false),
+  mode_(H264DecoderMode::kPassthrough),
+  decoderEventFailed_(false),
+  decoderInputRequests_(0),
+  decoderProvidesSamples_(false),
+  outputWidth_(0),
+  outputHeight_(0),
+  displayWidth_(0),
+  displayHeight_(0),
+  inputSampleTime_(0),
+  inputBufferSize_(0) {
+  outputSamplePool_ = Microsoft::WRL::Make<SamplePool>();
+  inputSamplePool_ = Microsoft::WRL::Make<SamplePool>();
+  inputSamplePool_->SetBufferFactory([](UINT32 size, UINT32,
+    IMFMediaBuffer** buffer) -> HRESULT {
+    return MFCreateMemoryBuffer(size, buffer);
+  });
+  AddAppSuspendObserver(this);
 }
 
 WinUWPH264DecoderImpl::~WinUWPH264DecoderImpl() {
   OutputDebugString(L"WinUWPH264DecoderImpl::~WinUWPH264DecoderImpl()\n");
+  RemoveAppSuspendObserver(this);
   Release();
 }
 
 int WinUWPH264DecoderImpl::InitDecode(const VideoCodec* inst,
   int number_of_cores) {
   LOG(LS_INFO) << "WinUWPH264DecoderImpl::InitDecode()\n";
-  // Nothing to do here, decoder acts as a passthrough
+  DetachDecoderEvents();
+  rtc::CritScope lock(&decodeCrit_);
+  mode_ = GetH264DecoderMode();
+  if (mode_ == H264DecoderMode::kPassthrough) {
+    // Nothing to do here, decoder acts as a passthrough
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
+  if (inst != nullptr) {
+    width_ = inst->width;
+    height_ = inst->height;
+  }
+  ShutdownDecoderMft();
+  if (FAILED(InitDecoderMft())) {
+    LOG(LS_WARNING) << "No H264 decoder MFT, falling back to passthrough.";
+    ShutdownDecoderMft();
+    mode_ = H264DecoderMode::kPassthrough;
+  }
   return WEBRTC_VIDEO_CODEC_OK;
 }
 
-ComPtr<IMFSample> FromEncodedImage(const EncodedImage& input_image) {
+HRESULT WinUWPH264DecoderImpl::InitDecoderMft() {
+  HRESULT hr = MFStartup(MF_VERSION);
+  if (FAILED(hr)) {
+    return hr;
+  }
+
+  std::vector<ComPtr<IMFActivate>> decoders = EnumerateH264Mfts(false);
+  if (decoders.empty()) {
+    MFShutdown();
+    return MF_E_TOPO_CODEC_NOT_FOUND;
+  }
+  decoderActivate_ = decoders[0];
+  ON_SUCCEEDED(decoderActivate_->ActivateObject(IID_PPV_ARGS(&decoder_)));
+
+  ComPtr<IMFAttributes> attributes;
+  ON_SUCCEEDED(decoder_->GetAttributes(&attributes));
+  if (SUCCEEDED(hr)) {
+    UINT32 async = FALSE;
+    if (SUCCEEDED(attributes->GetUINT32(MF_TRANSFORM_ASYNC, &async)) && async) {
+      ON_SUCCEEDED(attributes->SetUINT32(MF_TRANSFORM_ASYNC_UNLOCK, TRUE));
+      ON_SUCCEEDED(decoder_.As(&decoderEvents_));
+    }
+    attributes->SetUINT32(MF_LOW_LATENCY, TRUE);
+
+    // Decode straight into textures of the device shared with the
+    // media element.
+    UINT32 d3d11Aware = FALSE;
+    ComPtr<IMFDXGIDeviceManager> deviceManager = GetSharedDXGIDeviceManager();
+    if (deviceManager != nullptr &&
+      SUCCEEDED(attributes->GetUINT32(MF_SA_D3D11_AWARE, &d3d11Aware)) &&
+      d3d11Aware) {
+      if (FAILED(decoder_->ProcessMessage(MFT_MESSAGE_SET_D3D_MANAGER,
+        reinterpret_cast<ULONG_PTR>(deviceManager.Get())))) {
+        LOG(LS_WARNING) << "H264 decoder MFT rejected the D3D device, "
+          "decoding to system memory.";
+      }
+    }
+  }
+
+  // Without it the decoder holds pictures back for reordering.
+  ComPtr<ICodecAPI> codecApi;
+  if (SUCCEEDED(hr) && SUCCEEDED(decoder_.As(&codecApi))) {
+    VARIANT value;
+    VariantInit(&value);
+    value.vt = VT_UI4;
+    value.ulVal = TRUE;
+    codecApi->SetValue(&CODECAPI_AVLowLatencyMode, &value);
+  }
+
+  ComPtr<IMFMediaType> inputType;
+  ON_SUCCEEDED(MFCreateMediaType(&inputType));
+  ON_SUCCEEDED(inputType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video));
+  ON_SUCCEEDED(inputType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_H264));
+  ON_SUCCEEDED(inputType->SetUINT32(
+    MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive));
+  if (width_ > 0 && height_ > 0) {
+    ON_SUCCEEDED(MFSetAttributeSize(inputType.Get(),
+      MF_MT_FRAME_SIZE, width_, height_));
+  }
+  ON_SUCCEEDED(decoder_->SetInputType(0, inputType.Get(), 0));
+  ON_SUCCEEDED(SetDecoderOutputType());
+
+  ON_SUCCEEDED(decoder_->ProcessMessage(MFT_MESSAGE_NOTIFY_BEGIN_STREAMING, 0));
+  ON_SUCCEEDED(decoder_->ProcessMessage(MFT_MESSAGE_NOTIFY_START_OF_STREAM, 0));
+  if (SUCCEEDED(hr) && decoderEvents_ != nullptr) {
+    decoderEventCallback_ =
+      Microsoft::WRL::Make<DecoderEventCallback>(this);
+    hr = BeginGetDecoderEvent();
+  }
+
+  if (SUCCEEDED(hr)) {
+    LOG(LS_INFO) << "H264 decoder MFT ready, "
+      << (decoderEvents_ != nullptr ? "asynchronous" : "synchronous")
+      << (decoderProvidesSamples_ ? ", MFT allocated output" : "");
+  }
+  return hr;
+}
+
+void WinUWPH264DecoderImpl::ShutdownDecoderMft() {
+  // Only set if InitDecoderMft() failed past it, no event was handled.
+  if (decoderEventCallback_ != nullptr) {
+    decoderEventCallback_->Detach();
+    decoderEventCallback_.Reset();
+  }
+  decoderEventFailed_ = false;
+  if (decoder_ != nullptr) {
+    decoder_->ProcessMessage(MFT_MESSAGE_COMMAND_FLUSH, 0);
+    decoder_->ProcessMessage(MFT_MESSAGE_NOTIFY_END_STREAMING, 0);
+  }
+  decoderEvents_.Reset();
+  decoder_.Reset();
+  if (decoderActivate_ != nullptr) {
+    decoderActivate_->ShutdownObject();
+    decoderActivate_.Reset();
+    MFShutdown();
+  }
+  pendingInputSamples_.clear();
+  decoderInputRequests_ = 0;
+  sampleAttributeQueue_.clear();
+  outputSamplePool_->Reset();
+}
+
+HRESULT WinUWPH264DecoderImpl::SetDecoderOutputType() {
+  HRESULT hr = S_OK;
+  for (DWORD index = 0;; ++index) {
+    ComPtr<IMFMediaType> outputType;
+    hr = decoder_->GetOutputAvailableType(0, index, &outputType);
+    if (FAILED(hr)) {
+      return hr;
+    }
+    GUID subtype;
+    if (FAILED(outputType->GetGUID(MF_MT_SUBTYPE, &subtype)) ||
+      subtype != MFVideoFormat_NV12) {
+      continue;
+    }
+
+    ON_SUCCEEDED(decoder_->SetOutputType(0, outputType.Get(), 0));
+    ON_SUCCEEDED(MFGetAttributeSize(outputType.Get(), MF_MT_FRAME_SIZE,
+      &outputWidth_, &outputHeight_));
+    if (SUCCEEDED(hr)) {
+      // The frame size is aligned, the aperture is the actual picture.
+      MFVideoArea aperture;
+      if (SUCCEEDED(outputType->GetBlob(MF_MT_MINIMUM_DISPLAY_APERTURE,
+        reinterpret_cast<UINT8*>(&aperture), sizeof(aperture), nullptr))) {
+        displayWidth_ = aperture.Area.cx;
+        displayHeight_ = aperture.Area.cy;
+      } else {
+        displayWidth_ = outputWidth_;
+        displayHeight_ = outputHeight_;
+      }
+
+      MFT_OUTPUT_STREAM_INFO streamInfo;
+      ON_SUCCEEDED(decoder_->GetOutputStreamInfo(0, &streamInfo));
+      if (SUCCEEDED(hr)) {
+        decoderProvidesSamples_ = (streamInfo.dwFlags &
+          (MFT_OUTPUT_STREAM_PROVIDES_SAMPLES |
+           MFT_OUTPUT_STREAM_CAN_PROVIDE_SAMPLES)) != 0;
+      }
+    }
+    return hr;
+  }
+}
+
+HRESULT WinUWPH264DecoderImpl::DecodeSample(ComPtr<IMFSample> sample) {
+  if (decoderEvents_ != nullptr) {
+    if (pendingInputSamples_.size() >= kMaxPendingInputSamples) {
+      pendingInputSamples_.clear();
+      return MF_E_NOTACCEPTING;
+    }
+    pendingInputSamples_.push_back(sample);
+    // Otherwise fed on the next METransformNeedInput event.
+    return FeedPendingInputSamples();
+  }
+
+  HRESULT hr = decoder_->ProcessInput(0, sample.Get(), 0);
+  if (hr == MF_E_NOTACCEPTING) {
+    // Pictures are pending, collect them first.
+    hr = ProcessDecoderOutput();
+    if (SUCCEEDED(hr) || hr == MF_E_TRANSFORM_NEED_MORE_INPUT) {
+      hr = decoder_->ProcessInput(0, sample.Get(), 0);
+    }
+  }
+  if (FAILED(hr)) {
+    return hr;
+  }
+  do {
+    hr = ProcessDecoderOutput();
+  } while (SUCCEEDED(hr));
+  return hr == MF_E_TRANSFORM_NEED_MORE_INPUT ? S_OK : hr;
+}
+
+HRESULT WinUWPH264DecoderImpl::FeedPendingInputSamples() {
+  while (decoderInputRequests_ > 0 && !pendingInputSamples_.empty()) {
+    HRESULT hr = decoder_->ProcessInput(0,
+      pendingInputSamples_.front().Get(), 0);
+    if (FAILED(hr)) {
+      return hr;
+    }
+    pendingInputSamples_.pop_front();
+    --decoderInputRequests_;
+  }
+  return S_OK;
+}
+
+HRESULT WinUWPH264DecoderImpl::BeginGetDecoderEvent() {
+  return decoderEvents_->BeginGetEvent(decoderEventCallback_.Get(), nullptr);
+}
+
+void WinUWPH264DecoderImpl::OnDecoderEvent(IMFAsyncResult* result) {
+  rtc::CritScope lock(&decodeCrit_);
+  if (decoderEvents_ == nullptr) {
+    return;
+  }
+  ComPtr<IMFMediaEvent> event;
+  HRESULT hr = decoderEvents_->EndGetEvent(result, &event);
+  if (hr == MF_E_SHUTDOWN) {
+    return;
+  }
+  MediaEventType type;
+  ON_SUCCEEDED(event->GetType(&type));
+  if (SUCCEEDED(hr)) {
+    if (type == METransformNeedInput) {
+      ++decoderInputRequests_;
+      hr = FeedPendingInputSamples();
+    } else if (type == METransformHaveOutput) {
+      hr = ProcessDecoderOutput();
+      if (hr == MF_E_TRANSFORM_NEED_MORE_INPUT) {
+        hr = S_OK;
+      }
+    }
+  }
+  if (FAILED(hr)) {
+    // Reported by the next Decode(), the receiver then asks for a key
+    // frame.
+    LOG(LS_WARNING) << "H264 decoder MFT event failed, hr=" << hr;
+    decoderEventFailed_ = true;
+  }
+  hr = BeginGetDecoderEvent();
+  if (FAILED(hr) && hr != MF_E_SHUTDOWN) {
+    LOG(LS_ERROR) << "H264 decoder MFT events lost, hr=" << hr;
+  }
+}
+
+void WinUWPH264DecoderImpl::DetachDecoderEvents() {
+  ComPtr<DecoderEventCallback> callback;
+  {
+    rtc::CritScope lock(&decodeCrit_);
+    callback.Swap(decoderEventCallback_);
+  }
+  if (callback != nullptr) {
+    callback->Detach();
+  }
+}
+
+HRESULT WinUWPH264DecoderImpl::ProcessDecoderOutput() {
+  for (;;) {
+    HRESULT hr = S_OK;
+    ComPtr<IMFSample> sample;
+    if (!decoderProvidesSamples_) {
+      // Recycled once the renderer released the frame.
+      ON_SUCCEEDED(outputSamplePool_->GetSample(outputWidth_, outputHeight_,
+        sample.GetAddressOf()));
+      if (FAILED(hr)) {
+        return hr;
+      }
+    }
+
+    MFT_OUTPUT_DATA_BUFFER output = {};
+    output.dwStreamID = 0;
+    output.pSample = sample.Get();
+    DWORD status = 0;
+    hr = decoder_->ProcessOutput(0, 1, &output, &status);
+    if (output.pEvents != nullptr) {
+      output.pEvents->Release();
+    }
+    if (decoderProvidesSamples_ && output.pSample != nullptr) {
+      sample.Attach(output.pSample);
+    }
+
+    if (hr == MF_E_TRANSFORM_STREAM_CHANGE) {
+      // First picture or new resolution.
+      hr = SetDecoderOutputType();
+      if (FAILED(hr)) {
+        return hr;
+      }
+      continue;
+    }
+    if (SUCCEEDED(hr) && sample != nullptr) {
+      DeliverDecodedSample(sample);
+    }
+    return hr;
+  }
+}
+
+void WinUWPH264DecoderImpl::DeliverDecodedSample(ComPtr<IMFSample> sample) {
+  LONGLONG sampleTime = 0;
+  CachedFrameAttributes frameAttributes;
+  if (FAILED(sample->GetSampleTime(&sampleTime)) ||
+    !sampleAttributeQueue_.pop(sampleTime, frameAttributes)) {
+    return;
+  }
+  ScopedPipelineStage stage("H264Decoder.DeliverDecodedSample",
+    frameAttributes.timestamp);
+  TraceFrameFlowStep(kReceiveFrameFlow, frameAttributes.timestamp);
+
+  rtc::scoped_refptr<VideoFrameBuffer> buffer(
+    new rtc::RefCountedObject<DecodedSampleBuffer>(
+      sample, displayWidth_, displayHeight_, outputHeight_));
+  VideoFrame decodedFrame(buffer, frameAttributes.timestamp,
+    frameAttributes.renderTime, kVideoRotation_0);
+  decodedFrame.set_ntp_time_ms(frameAttributes.ntpTime);
+
+  rtc::CritScope lock(&crit_);
+  if (decodeCompleteCallback_ != nullptr) {
+    decodeCompleteCallback_->Decoded(decodedFrame);
+  }
+}
+
+ComPtr<IMFSample> WinUWPH264DecoderImpl::FromEncodedImage(
+  const EncodedImage& input_image) {
+  ScopedPipelineStage stage("H264Decoder.FromEncodedImage",
+    input_image._timeStamp);
   HRESULT hr = S_OK;
 
+  // The EncodedImage buffer is reused by the jitter buffer once Decode()
+  // returns, the renderer and the MFT need their own copy.
+  if (input_image._length > inputBufferSize_) {
+    UINT32 size = kMinInputBufferSize;
+    while (size < input_image._length) {
+      size *= 2;
+    }
+    LOG(LS_INFO) << "H264 decoder input buffers grown to " << size
+      << " bytes (hits=" << inputSamplePool_->GetHitCount()
+      << " misses=" << inputSamplePool_->GetMissCount() << ")";
+    inputBufferSize_ = size;
+  }
+
   ComPtr<IMFSample> sample;
-  hr = MFCreateSample(&sample);
+  hr = inputSamplePool_->GetSample(inputBufferSize_, 1, &sample);
 
   ComPtr<IMFMediaBuffer> mediaBuffer;
-  ON_SUCCEEDED(MFCreateMemoryBuffer((DWORD)input_image._length, &mediaBuffer));
+  ON_SUCCEEDED(sample->GetBufferByIndex(0, &mediaBuffer));
 
   BYTE* destBuffer = NULL;
   if (SUCCEEDED(hr)) {
@@ -78,8 +484,9 @@ ComPtr<IMFSample> FromEncodedImage(const EncodedImage& input_image) {
   ON_SUCCEEDED(mediaBuffer->SetCurrentLength((DWORD)input_image._length));
   ON_SUCCEEDED(mediaBuffer->Unlock());
 
-  ON_SUCCEEDED(sample->AddBuffer(mediaBuffer.Get()));
-
+  if (FAILED(hr)) {
+    return nullptr;
+  }
   return sample;
 }
 
@@ -102,15 +509,123 @@ private:
   ComPtr<IMFSample> _sample;
 };
 
+DecodedSampleBuffer::DecodedSampleBuffer(ComPtr<IMFSample> sample,
+  int width, int height, int surfaceHeight)
+  : NativeHandleBuffer(sample.Get(), width, height)
+  , sample_(sample)
+  , surfaceHeight_(surfaceHeight > 0 ? surfaceHeight : height) {
+}
+
+DecodedSampleBuffer::~DecodedSampleBuffer() {
+}
+
+rtc::scoped_refptr<I420BufferInterface> DecodedSampleBuffer::ToI420() {
+  // Each sink asks for its own copy, the frame is only read back once.
+  rtc::CritScope lock(&crit_);
+  if (i420Buffer_ != nullptr) {
+    return i420Buffer_;
+  }
+
+  HRESULT hr = S_OK;
+  ComPtr<IMFMediaBuffer> mediaBuffer;
+  ComPtr<IMF2DBuffer> imageBuffer;
+  ON_SUCCEEDED(sample_->GetBufferByIndex(0, &mediaBuffer));
+  ON_SUCCEEDED(mediaBuffer.As(&imageBuffer));
+
+  BYTE* scanline0 = nullptr;
+  LONG pitch = 0;
+  // Locking a DXGI surface buffer copies it to system memory.
+  ON_SUCCEEDED(imageBuffer->Lock2D(&scanline0, &pitch));
+  if (FAILED(hr)) {
+    return nullptr;
+  }
+
+  rtc::scoped_refptr<I420Buffer> i420Buffer = I420Buffer::Create(width_, height_);
+  libyuv::NV12ToI420(scanline0, pitch,
+    scanline0 + pitch * surfaceHeight_, pitch,
+    i420Buffer->MutableDataY(), i420Buffer->StrideY(),
+    i420Buffer->MutableDataU(), i420Buffer->StrideU(),
+    i420Buffer->MutableDataV(), i420Buffer->StrideV(),
+    width_, height_);
+  imageBuffer->Unlock2D();
+  i420Buffer_ = i420Buffer;
+  return i420Buffer;
+}
+
+HRESULT DecodedSampleBuffer::CopyToNV12(BYTE* dest, int destStride) {
+  HRESULT hr = S_OK;
+  ComPtr<IMFMediaBuffer> mediaBuffer;
+  ComPtr<IMF2DBuffer> imageBuffer;
+  ON_SUCCEEDED(sample_->GetBufferByIndex(0, &mediaBuffer));
+  ON_SUCCEEDED(mediaBuffer.As(&imageBuffer));
+
+  BYTE* scanline0 = nullptr;
+  LONG pitch = 0;
+  ON_SUCCEEDED(imageBuffer->Lock2D(&scanline0, &pitch));
+  if (FAILED(hr)) {
+    return hr;
+  }
+
+  libyuv::CopyPlane(scanline0, pitch, dest, destStride, width_, height_);
+  // With an odd width the last UV pair is wider than the Y row, it
+  // doesn't fit in a destination as wide as the frame.
+  int uvWidth = std::min((width_ + 1) / 2 * 2, destStride);
+  libyuv::CopyPlane(scanline0 + pitch * surfaceHeight_, pitch,
+    dest + destStride * height_, destStride, uvWidth, (height_ + 1) / 2);
+  imageBuffer->Unlock2D();
+  return S_OK;
+}
+
 int WinUWPH264DecoderImpl::Decode(const EncodedImage& input_image,
   bool missing_frames,
   const RTPFragmentationHeader* fragmentation,
   const CodecSpecificInfo* codec_specific_info,
   int64_t render_time_ms) {
+  ScopedPipelineStage stage("H264Decoder.Decode", input_image._timeStamp);
+  // Where the frame enters the wrapper on the receive side, the flow
+  // ends when the MediaElement gets its sample.
+  TraceFrameFlowBegin(kReceiveFrameFlow, input_image._timeStamp);
+  // Runs the decoder MFT synchronously.
+  ResourceSampler::RegisterCurrentThread("H264DecoderMF");
+
+  rtc::CritScope decodeLock(&decodeCrit_);
+  if (waitForKeyFrame_) {
+    if (input_image._frameType != kVideoFrameKey) {
+      // Has the receiver request a key frame.
+      return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+    waitForKeyFrame_ = false;
+  }
 
   UpdateVideoFrameDimensions(input_image);
   auto sample = FromEncodedImage(input_image);
 
+  if (sample != nullptr && mode_ == H264DecoderMode::kDecode) {
+    sample->SetSampleTime(++inputSampleTime_);
+    if (input_image._frameType == kVideoFrameKey) {
+      sample->SetUINT32(MFSampleExtension_CleanPoint, TRUE);
+    }
+    CachedFrameAttributes frameAttributes;
+    frameAttributes.timestamp = input_image._timeStamp;
+    frameAttributes.ntpTime = input_image.ntp_time_ms_;
+    frameAttributes.renderTime = render_time_ms;
+    sampleAttributeQueue_.push(inputSampleTime_, frameAttributes);
+
+    HRESULT hr = decoderEventFailed_ ? E_FAIL : DecodeSample(sample);
+    if (FAILED(hr)) {
+      LOG(LS_WARNING) << "H264 decoder MFT failed, hr=" << hr;
+      // Starts over from the next key frame.
+      decoder_->ProcessMessage(MFT_MESSAGE_COMMAND_FLUSH, 0);
+      decoder_->ProcessMessage(MFT_MESSAGE_NOTIFY_START_OF_STREAM, 0);
+      decoderInputRequests_ = 0;
+      decoderEventFailed_ = false;
+      pendingInputSamples_.clear();
+      sampleAttributeQueue_.clear();
+      return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
   if (sample != nullptr) {
     rtc::scoped_refptr<VideoFrameBuffer> buffer(new rtc::RefCountedObject<H264NativeHandleBuffer>(
       sample, width_, height_));
@@ -135,9 +650,30 @@ int WinUWPH264DecoderImpl::RegisterDecodeCompleteCallback(
 
 int WinUWPH264DecoderImpl::Release() {
   OutputDebugString(L"WinUWPH264DecoderImpl::Release()\n");
+  DetachDecoderEvents();
+  rtc::CritScope lock(&decodeCrit_);
+  ShutdownDecoderMft();
   return WEBRTC_VIDEO_CODEC_OK;
 }
 
+void WinUWPH264DecoderImpl::OnAppSuspending() {
+  rtc::CritScope lock(&decodeCrit_);
+  if (decoder_ != nullptr) {
+    decoder_->ProcessMessage(MFT_MESSAGE_COMMAND_FLUSH, 0);
+    decoder_->ProcessMessage(MFT_MESSAGE_NOTIFY_START_OF_STREAM, 0);
+  }
+  decoderInputRequests_ = 0;
+  pendingInputSamples_.clear();
+  sampleAttributeQueue_.clear();
+  outputSamplePool_->Reset();
+  inputSamplePool_->Reset();
+  waitForKeyFrame_ = true;
+}
+
+void WinUWPH264DecoderImpl::OnAppResuming() {
+  // The first frame decoded is the key frame waited for.
+}
+
 void WinUWPH264DecoderImpl::UpdateVideoFrameDimensions(const EncodedImage& input_image)
 {
   auto w = input_image._encodedWidth;
@@ -16,7 +16,10 @@
 #include <Mfreadwrite.h>
 #include <mferror.h>
 #include <wrl.h>
+#include <deque>
+#include "../Utils/AppSuspend.h"
 #include "../Utils/SampleAttributeQueue.h"
+#include "../Utils/SamplePool.h"
 #include "webrtc/api/video_codecs/video_decoder.h"
 #include "webrtc/rtc_base/criticalsection.h"
 
@@ -28,12 +31,29 @@ using Microsoft::WRL::ComPtr;
 
 namespace webrtc {
 
+enum class H264DecoderMode {
+  // Encoded samples are handed to the renderer, the media element
+  // decodes them.
+  kPassthrough,
+  // Decoded by a Media Foundation H264 MFT, hardware accelerated when
+  // available, into NV12 frames.  Falls back to kPassthrough if no
+  // decoder MFT can be set up.
+  kDecode
+};
+
+// Applies to the decoders initialized from then on.
+void SetH264DecoderMode(H264DecoderMode mode);
+H264DecoderMode GetH264DecoderMode();
+
 class NativeHandleBuffer : public VideoFrameBuffer {
  public:
   NativeHandleBuffer(void* native_handle, int width, int height)
     : native_handle_(native_handle),
     width_(width),
-    height_(height) { }
+    height_(height) {
+  }
+  virtual ~NativeHandleBuffer() {
+  }
 
   virtual Type type() const {
     return Type::kNative;
@@ -50,13 +70,81 @@ class NativeHandleBuffer : public VideoFrameBuffer {
     return native_handle_;
   }
 
+  // True if native_handle() is an IMFSample holding an encoded H264
+  // access unit, false if it holds a decoded NV12 picture.
+  virtual bool is_encoded() const {
+    return true;
+  }
+
  protected:
   void* native_handle_;
   const int width_;
   const int height_;
 };
 
-class WinUWPH264DecoderImpl : public VideoDecoder {
+// Used to store an NV12 IMFSample in a VideoFrame, a decoded one whose
+// buffer is typically a DXGI surface, or a captured one.  The encoder
+// copies the NV12 planes as they are.  ToI420() reads the picture back
+// into system memory once, only software consumers should need it.
+class DecodedSampleBuffer : public NativeHandleBuffer {
+ public:
+  // |surfaceHeight| is the height of the Y plane in the buffer, which can
+  // be larger than |height|.  0 if they are the same.
+  DecodedSampleBuffer(ComPtr<IMFSample> sample, int width, int height,
+    int surfaceHeight = 0);
+  virtual ~DecodedSampleBuffer();
+
+  bool is_encoded() const override {
+    return false;
+  }
+
+  rtc::scoped_refptr<I420BufferInterface> ToI420() override;
+
+  // Copies the NV12 planes to |dest|, the UV plane right after |height|
+  // rows of |destStride| bytes.
+  HRESULT CopyToNV12(BYTE* dest, int destStride);
+
+  IMFSample* sample() const { return sample_.Get(); }
+
+ private:
+  ComPtr<IMFSample> sample_;
+  const int surfaceHeight_;
+  rtc::CriticalSection crit_;
+  rtc::scoped_refptr<I420BufferInterface> i420Buffer_;
+};
+
+// The NativeHandleBuffer behind |buffer|, null for the other buffers,
+// including the kNative buffers of other origins.  VideoFrameBuffer has
+// no way to tell them apart, the type check only skips the cast for the
+// planar buffers.
+inline NativeHandleBuffer* AsNativeHandleBuffer(VideoFrameBuffer* buffer) {
+  if (buffer->type() != VideoFrameBuffer::Type::kNative) {
+    return nullptr;
+  }
+  return dynamic_cast<NativeHandleBuffer*>(buffer);
+}
+
+// Returns true if |buffer| carries an encoded H264 sample to be
+// decoded by the renderer.
+inline bool IsEncodedNativeBuffer(VideoFrameBuffer* buffer) {
+  NativeHandleBuffer* nativeBuffer = AsNativeHandleBuffer(buffer);
+  return nativeBuffer != nullptr && nativeBuffer->is_encoded();
+}
+
+// Returns |buffer| if it holds a decoded NV12 IMFSample, null for any
+// other buffer, including the native buffers of other origins.
+inline DecodedSampleBuffer* AsDecodedSampleBuffer(VideoFrameBuffer* buffer) {
+  NativeHandleBuffer* nativeBuffer = AsNativeHandleBuffer(buffer);
+  if (nativeBuffer == nullptr || nativeBuffer->is_encoded()) {
+    return nullptr;
+  }
+  // The only NativeHandleBuffer which isn't encoded.
+  return static_cast<DecodedSampleBuffer*>(nativeBuffer);
+}
+
+class DecoderEventCallback;
+
+class WinUWPH264DecoderImpl : public VideoDecoder, public AppSuspendObserver {
  public:
   WinUWPH264DecoderImpl();
 
@@ -76,14 +164,87 @@ class WinUWPH264DecoderImpl : public VideoDecoder {
 
   const char* ImplementationName() const override;
 
+  // === AppSuspendObserver overrides ===
+  // Flushes the MFT and drops the pooled samples, the MFT and its media
+  // types are kept.  The frames are then refused until a key frame,
+  // which has the receiver request one.
+  void OnAppSuspending() override;
+  void OnAppResuming() override;
+
  private:
   void UpdateVideoFrameDimensions(const EncodedImage& input_image);
+  // Copies the encoded frame into a recycled input sample.
+  ComPtr<IMFSample> FromEncodedImage(const EncodedImage& input_image);
+
+  // H264DecoderMode::kDecode
+  HRESULT InitDecoderMft();
+  void ShutdownDecoderMft();
+  HRESULT SetDecoderOutputType();
+  // Feeds |sample| to the MFT and delivers the pictures it returns.
+  HRESULT DecodeSample(ComPtr<IMFSample> sample);
+  // Asynchronous MFTs: the events are delivered to OnDecoderEvent() on
+  // a Media Foundation work queue, as the MFT queues them.
+  HRESULT BeginGetDecoderEvent();
+  void OnDecoderEvent(IMFAsyncResult* result);
+  // Waits for an event being handled, the following ones are dropped.
+  // Called without decodeCrit_, the callback takes it.
+  void DetachDecoderEvents();
+  // Answers the METransformNeedInput events with the pending samples.
+  HRESULT FeedPendingInputSamples();
+  HRESULT ProcessDecoderOutput();
+  void DeliverDecodedSample(ComPtr<IMFSample> sample);
+
+  // Encoded frames an asynchronous MFT may have queued before an error
+  // is reported to request a key frame.
+  static const size_t kMaxPendingInputSamples = 8;
+  // Smallest input buffer, enough for most delta frames.
+  static const UINT32 kMinInputBufferSize = 16 * 1024;
 
  private:
   uint32_t width_;
   uint32_t height_;
   rtc::CriticalSection crit_;
   DecodedImageCallback* decodeCompleteCallback_;
+  // Guards the decoder state against the suspend notifications, only
+  // contended then.
+  rtc::CriticalSection decodeCrit_;
+  // Set on suspend, until the next key frame.
+  bool waitForKeyFrame_;
+
+  H264DecoderMode mode_;
+  ComPtr<IMFActivate> decoderActivate_;
+  ComPtr<IMFTransform> decoder_;
+  // Null for synchronous MFTs.
+  ComPtr<IMFMediaEventGenerator> decoderEvents_;
+  ComPtr<DecoderEventCallback> decoderEventCallback_;
+  // An event failed to be handled, the next Decode() starts over.
+  bool decoderEventFailed_;
+  // METransformNeedInput events not answered yet.
+  uint32_t decoderInputRequests_;
+  std::deque<ComPtr<IMFSample>> pendingInputSamples_;
+  // The MFT allocates the output samples, typically D3D surfaces.
+  bool decoderProvidesSamples_;
+  // Otherwise they come from this pool.
+  ComPtr<SamplePool> outputSamplePool_;
+  UINT32 outputWidth_;
+  UINT32 outputHeight_;
+  UINT32 displayWidth_;
+  UINT32 displayHeight_;
+  // Input sample time, the frames are matched to their attributes by it.
+  LONGLONG inputSampleTime_;
+  // Encoded frames are copied into these, in both modes.  The buffers
+  // only grow so that the pool isn't rebuilt for every frame size.
+  ComPtr<SamplePool> inputSamplePool_;
+  UINT32 inputBufferSize_;
+
+  struct CachedFrameAttributes {
+    uint32_t timestamp;
+    int64_t ntpTime;
+    int64_t renderTime;
+  };
+  SampleAttributeQueue<CachedFrameAttributes> sampleAttributeQueue_;
+
+  friend class DecoderEventCallback;
 };  // end of WinUWPH264DecoderImpl class
 
 }  // namespace webrtc
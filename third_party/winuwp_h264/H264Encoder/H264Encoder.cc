@@ -20,16 +20,22 @@
 #include <codecapi.h>
 #include <mfreadwrite.h>
 #include <wrl\implements.h>
+#include <algorithm>
+#include <atomic>
 #include <sstream>
 #include <vector>
 #include <iomanip>
 
 #include "H264StreamSink.h"
 #include "H264MediaSink.h"
+#include "../H264Decoder/H264Decoder.h"
+#include "../Utils/MftCapabilities.h"
+#include "../Utils/ResourceSampler.h"
 #include "../Utils/Utils.h"
 #include "webrtc/modules/video_coding/include/video_codec_interface.h"
 #include "webrtc/rtc_base/timeutils.h"
 #include "libyuv/convert.h"
+#include "webrtc/api/video/i420_buffer.h"
 #include "webrtc/rtc_base/logging.h"
 #include "webrtc/rtc_base/win32.h"
 
@@ -40,6 +46,105 @@
 
 namespace webrtc {
 
+namespace {
+// With more frames in flight the encoder mostly adds latency.
+const uint32_t kDefaultMaxFramesInFlight = 3;
+std::atomic<uint32_t> gMaxFramesInFlight(kDefaultMaxFramesInFlight);
+std::atomic<int> gDropPolicy((int)H264EncoderDropPolicy::kDropNewest);
+std::atomic<uint32_t> gTemporalLayerCount(1);
+std::atomic<bool> gDirectSampleDelivery(false);
+// QP thresholds of the quality scaler with a software encoder.
+const int kLowH264QpThreshold = 24;
+const int kHighSoftwareH264QpThreshold = 33;
+// The encoder bitrate is never corrected below half of the target.
+const double kMinRateCorrection = 0.5;
+// Overshoot tolerated before correcting, none once packets are lost.
+const double kRateOvershootTolerance = 1.1;
+// 5% of 255.
+const uint32_t kPacketLossThreshold = 13;
+}  // namespace
+
+void SetH264EncoderMaxFramesInFlight(uint32_t maxFramesInFlight) {
+  gMaxFramesInFlight = maxFramesInFlight > 0 ? maxFramesInFlight : 1;
+}
+
+uint32_t GetH264EncoderMaxFramesInFlight() {
+  return gMaxFramesInFlight;
+}
+
+void SetH264EncoderDropPolicy(H264EncoderDropPolicy policy) {
+  gDropPolicy = (int)policy;
+}
+
+H264EncoderDropPolicy GetH264EncoderDropPolicy() {
+  return (H264EncoderDropPolicy)gDropPolicy.load();
+}
+
+void SetH264EncoderTemporalLayerCount(uint32_t temporalLayerCount) {
+  gTemporalLayerCount = std::min(std::max(temporalLayerCount, 1u),
+    kH264EncoderMaxTemporalLayers);
+}
+
+uint32_t GetH264EncoderTemporalLayerCount() {
+  return gTemporalLayerCount;
+}
+
+void SetH264EncoderDirectSampleDelivery(bool directDelivery) {
+  gDirectSampleDelivery = directDelivery;
+}
+
+bool GetH264EncoderDirectSampleDelivery() {
+  return gDirectSampleDelivery;
+}
+
+namespace {
+HRESULT CreateOutputMediaType(UINT32 width, UINT32 height,
+  UINT32 bitrateBps, UINT32 fps, IMFMediaType** mediaType) {
+  HRESULT hr = S_OK;
+  ComPtr<IMFMediaType> mediaTypeOut;
+  ON_SUCCEEDED(MFCreateMediaType(&mediaTypeOut));
+  ON_SUCCEEDED(mediaTypeOut->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video));
+  ON_SUCCEEDED(mediaTypeOut->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_H264));
+  // Lumia 635 and Lumia 1520 Windows phones don't work well
+  // with constrained baseline profile.
+  //ON_SUCCEEDED(mediaTypeOut->SetUINT32(MF_MT_MPEG2_PROFILE, eAVEncH264VProfile_ConstrainedBase));
+
+  // Weight*Height*2 kbit represents a good balance between video quality and
+  // the bandwidth that a 620 Windows phone can handle.
+  ON_SUCCEEDED(mediaTypeOut->SetUINT32(MF_MT_AVG_BITRATE, bitrateBps));
+  ON_SUCCEEDED(mediaTypeOut->SetUINT32(
+    MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive));
+  ON_SUCCEEDED(MFSetAttributeSize(mediaTypeOut.Get(),
+    MF_MT_FRAME_SIZE, width, height));
+  ON_SUCCEEDED(MFSetAttributeRatio(mediaTypeOut.Get(),
+    MF_MT_FRAME_RATE, fps, 1));
+  if (SUCCEEDED(hr)) {
+    *mediaType = mediaTypeOut.Detach();
+  }
+  return hr;
+}
+
+HRESULT CreateInputMediaType(UINT32 width, UINT32 height,
+  UINT32 fps, IMFMediaType** mediaType) {
+  HRESULT hr = S_OK;
+  ComPtr<IMFMediaType> mediaTypeIn;
+  ON_SUCCEEDED(MFCreateMediaType(&mediaTypeIn));
+  ON_SUCCEEDED(mediaTypeIn->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video));
+  ON_SUCCEEDED(mediaTypeIn->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_NV12));
+  ON_SUCCEEDED(mediaTypeIn->SetUINT32(
+    MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive));
+  ON_SUCCEEDED(mediaTypeIn->SetUINT32(MF_MT_ALL_SAMPLES_INDEPENDENT, TRUE));
+  ON_SUCCEEDED(MFSetAttributeSize(mediaTypeIn.Get(),
+    MF_MT_FRAME_SIZE, width, height));
+  ON_SUCCEEDED(MFSetAttributeRatio(mediaTypeIn.Get(),
+    MF_MT_FRAME_RATE, fps, 1));
+  if (SUCCEEDED(hr)) {
+    *mediaType = mediaTypeIn.Detach();
+  }
+  return hr;
+}
+}  // namespace
+
 //////////////////////////////////////////
 // H264 WinUWP Encoder Implementation
 //////////////////////////////////////////
@@ -48,17 +153,56 @@ WinUWPH264EncoderImpl::WinUWPH264EncoderImpl()
   : firstFrame_(true)
   , startTime_(0)
   , framePendingCount_(0)
+  , sinkWriterGeneration_(0)
+  , nextSinkWriterGeneration_(0)
   , frameCount_(0)
   , lastFrameDropped_(false)
   , currentWidth_(0)
   , currentHeight_(0)
   , currentBitrateBps_(0)
   , currentFps_(0)
-  , lastTimestampHns_(0) {
+  , rateCorrection_(1.0)
+  , encoderBitrateBps_(0)
+  , rateWindowStartMs_(0)
+  , rateWindowBytes_(0)
+  , packetLoss_(0)
+  , lastTimestampHns_(0)
+  , encodeLatency_("H264 encoder")
+  , inputBytesCopied_(0)
+  , bitstreamBytes_(0)
+  , framesDroppedPipelineFull_(0)
+  , framesDroppedWriteFailed_(0)
+  , framesPerTemporalLayer_()
+  , attributesLostReported_(0)
+  , attributesMissedReported_(0)
+  , lastStatsReportTime_(rtc::TimeMillis())
+  , frameMemory_("H264Encoder")
+  , keyFramePending_(false)
+  , screenContent_(false)
+  , rebuildPending_(false)
+  , rebuildWidth_(0)
+  , rebuildHeight_(0)
+  , rebuildDone_(true, true)
+  , pendingFrameScheduled_(false)
+  , pendingFrameTasks_(0)
+  , pendingFrameTasksDone_(true, true) {
+  inputSamplePool_ = Microsoft::WRL::Make<SamplePool>();
+  inputSamplePool_->SetBufferFactory([](UINT32 stride, UINT32 height,
+    IMFMediaBuffer** buffer) -> HRESULT {
+    // NV12 with the UV plane using the same stride as the Y plane.
+    return MFCreateMemoryBuffer(stride * height + stride * ((height + 1) / 2),
+      buffer);
+  });
+  AddAppSuspendObserver(this);
 }
 
 WinUWPH264EncoderImpl::~WinUWPH264EncoderImpl() {
+  RemoveAppSuspendObserver(this);
   Release();
+  LOG(LS_INFO) << "H264 encoder input sample pool hits="
+    << inputSamplePool_->GetHitCount()
+    << " misses=" << inputSamplePool_->GetMissCount();
+  inputSamplePool_->Shutdown();
 }
 
 int WinUWPH264EncoderImpl::InitEncode(const VideoCodec* inst,
@@ -68,6 +212,10 @@ int WinUWPH264EncoderImpl::InitEncode(const VideoCodec* inst,
   currentHeight_ = inst->height;
   currentBitrateBps_ = inst->targetBitrate > 0 ? inst->targetBitrate * 1024 : currentWidth_ * currentHeight_ * 2.0;
   currentFps_ = inst->maxFramerate;
+  screenContent_ = inst->mode == kScreensharing;
+  if (screenContent_) {
+    currentFps_ = std::min(currentFps_, kMaxScreenContentFps);
+  }
   return InitEncoderWithSettings(inst);
 }
 
@@ -78,76 +226,267 @@ int WinUWPH264EncoderImpl::InitEncoderWithSettings(const VideoCodec* inst) {
 
   ON_SUCCEEDED(MFStartup(MF_VERSION));
 
+  SinkWriterState state;
+  encoderBitrateBps_ = GetEncoderBitrateBps();
+  rateWindowStartMs_ = 0;
+  rateWindowBytes_ = 0;
+  ON_SUCCEEDED(CreateSinkWriter(currentWidth_, currentHeight_,
+    encoderBitrateBps_, currentFps_, &state));
+
+  codec_ = *inst;
+
+  if (SUCCEEDED(hr)) {
+    mediaSink_ = state.mediaSink;
+    sinkWriter_ = state.sinkWriter;
+    streamIndex_ = state.streamIndex;
+    mediaTypeOut_ = state.mediaTypeOut;
+    codecApi_ = state.codecApi;
+    inputDevice_ = state.inputDevice;
+    sinkWriterGeneration_ = state.generation;
+    inited_ = true;
+    lastTimeSettingsChanged_ = rtc::TimeMillis();
+    return WEBRTC_VIDEO_CODEC_OK;
+  } else {
+    return hr;
+  }
+}
+
+HRESULT WinUWPH264EncoderImpl::CreateSinkWriter(UINT32 width, UINT32 height,
+  UINT32 bitrateBps, UINT32 fps, SinkWriterState* state) {
+  HRESULT hr = S_OK;
+
   // output media type (h264)
   ComPtr<IMFMediaType> mediaTypeOut;
-  ON_SUCCEEDED(MFCreateMediaType(&mediaTypeOut));
-  ON_SUCCEEDED(mediaTypeOut->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video));
-  ON_SUCCEEDED(mediaTypeOut->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_H264));
-  // Lumia 635 and Lumia 1520 Windows phones don't work well
-  // with constrained baseline profile.
-  //ON_SUCCEEDED(mediaTypeOut->SetUINT32(MF_MT_MPEG2_PROFILE, eAVEncH264VProfile_ConstrainedBase));
-
-  // Weight*Height*2 kbit represents a good balance between video quality and
-  // the bandwidth that a 620 Windows phone can handle.
-  ON_SUCCEEDED(mediaTypeOut->SetUINT32(
-    MF_MT_AVG_BITRATE, currentBitrateBps_));
-  ON_SUCCEEDED(mediaTypeOut->SetUINT32(
-    MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive));
-  ON_SUCCEEDED(MFSetAttributeSize(mediaTypeOut.Get(),
-    MF_MT_FRAME_SIZE, currentWidth_, currentHeight_));
-  ON_SUCCEEDED(MFSetAttributeRatio(mediaTypeOut.Get(),
-    MF_MT_FRAME_RATE, currentFps_, 1));
+  ON_SUCCEEDED(CreateOutputMediaType(width, height, bitrateBps, fps,
+    &mediaTypeOut));
 
   // input media type (nv12)
   ComPtr<IMFMediaType> mediaTypeIn;
-  ON_SUCCEEDED(MFCreateMediaType(&mediaTypeIn));
-  ON_SUCCEEDED(mediaTypeIn->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video));
-  ON_SUCCEEDED(mediaTypeIn->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_NV12));
-  ON_SUCCEEDED(mediaTypeIn->SetUINT32(
-    MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive));
-  ON_SUCCEEDED(mediaTypeIn->SetUINT32(MF_MT_ALL_SAMPLES_INDEPENDENT, TRUE));
-  ON_SUCCEEDED(MFSetAttributeSize(mediaTypeIn.Get(),
-    MF_MT_FRAME_SIZE, currentWidth_, currentHeight_));
-  ON_SUCCEEDED(MFSetAttributeRatio(mediaTypeIn.Get(),
-    MF_MT_FRAME_RATE, currentFps_, 1));
+  ON_SUCCEEDED(CreateInputMediaType(width, height, fps, &mediaTypeIn));
 
   // Create the media sink
-  ON_SUCCEEDED(Microsoft::WRL::MakeAndInitialize<H264MediaSink>(&mediaSink_));
+  ComPtr<H264MediaSink> mediaSink;
+  ON_SUCCEEDED(Microsoft::WRL::MakeAndInitialize<H264MediaSink>(&mediaSink));
 
   // SinkWriter creation attributes
-  ON_SUCCEEDED(MFCreateAttributes(&sinkWriterCreationAttributes_, 1));
-  ON_SUCCEEDED(sinkWriterCreationAttributes_->SetUINT32(
-    MF_READWRITE_ENABLE_HARDWARE_TRANSFORMS, TRUE));
-  ON_SUCCEEDED(sinkWriterCreationAttributes_->SetUINT32(
+  // Skip looking for a hardware encoder when the probe found none.
+  H264MftCapabilities capabilities = GetH264MftCapabilities();
+  BOOL enableHardware = !capabilities.probed || capabilities.encoder.hardware;
+  ComPtr<IMFAttributes> sinkWriterCreationAttributes;
+  ON_SUCCEEDED(MFCreateAttributes(&sinkWriterCreationAttributes, 1));
+  ON_SUCCEEDED(sinkWriterCreationAttributes->SetUINT32(
+    MF_READWRITE_ENABLE_HARDWARE_TRANSFORMS, enableHardware));
+  ON_SUCCEEDED(sinkWriterCreationAttributes->SetUINT32(
     MF_SINK_WRITER_DISABLE_THROTTLING, TRUE));
-  ON_SUCCEEDED(sinkWriterCreationAttributes_->SetUINT32(
+  ON_SUCCEEDED(sinkWriterCreationAttributes->SetUINT32(
     MF_LOW_LATENCY, TRUE));
+  // Lets a hardware encoder take the textures of an app pushed source
+  // without reading them back.
+  ComPtr<IMFDXGIDeviceManager> deviceManager;
+  if (enableHardware) {
+    deviceManager = GetEncoderDXGIDeviceManager();
+  }
+  if (deviceManager != nullptr) {
+    ON_SUCCEEDED(sinkWriterCreationAttributes->SetUnknown(
+      MF_SINK_WRITER_D3D_MANAGER, deviceManager.Get()));
+  }
 
   // Create the sink writer
-  ON_SUCCEEDED(MFCreateSinkWriterFromMediaSink(mediaSink_.Get(),
-    sinkWriterCreationAttributes_.Get(), &sinkWriter_));
+  ComPtr<IMFSinkWriter> sinkWriter;
+  ON_SUCCEEDED(MFCreateSinkWriterFromMediaSink(mediaSink.Get(),
+    sinkWriterCreationAttributes.Get(), &sinkWriter));
 
   // Add the h264 output stream to the writer
-  ON_SUCCEEDED(sinkWriter_->AddStream(mediaTypeOut.Get(), &streamIndex_));
+  DWORD streamIndex = 0;
+  ON_SUCCEEDED(sinkWriter->AddStream(mediaTypeOut.Get(), &streamIndex));
 
-  // SinkWriter encoder properties
-  ON_SUCCEEDED(MFCreateAttributes(&sinkWriterEncoderAttributes_, 1));
-  ON_SUCCEEDED(sinkWriter_->SetInputMediaType(streamIndex_, mediaTypeIn.Get(), nullptr));
+  ON_SUCCEEDED(sinkWriter->SetInputMediaType(streamIndex, mediaTypeIn.Get(), nullptr));
 
   // Register this as the callback for encoded samples.
-  ON_SUCCEEDED(mediaSink_->RegisterEncodingCallback(this));
+  UINT32 generation = ++nextSinkWriterGeneration_;
+  ON_SUCCEEDED(mediaSink->RegisterEncodingCallback(this,
+    GetH264EncoderDirectSampleDelivery(), generation));
 
-  ON_SUCCEEDED(sinkWriter_->BeginWriting());
+  ON_SUCCEEDED(sinkWriter->BeginWriting());
 
-  codec_ = *inst;
+  if (SUCCEEDED(hr)) {
+    state->mediaSink = mediaSink;
+    state->sinkWriter = sinkWriter;
+    state->streamIndex = streamIndex;
+    state->mediaTypeOut = mediaTypeOut;
+    state->codecApi = GetEncoderCodecApi(sinkWriter.Get(), streamIndex);
+    state->inputDevice = GetDXGIManagerDevice(deviceManager.Get());
+    state->generation = generation;
+    UINT32 temporalLayerCount = GetH264EncoderTemporalLayerCount();
+    if (temporalLayerCount > 1) {
+      VARIANT value;
+      VariantInit(&value);
+      value.vt = VT_UI4;
+      value.ulVal = temporalLayerCount;
+      if (state->codecApi == nullptr ||
+        FAILED(state->codecApi->SetValue(
+          &CODECAPI_AVEncVideoTemporalLayerCount, &value))) {
+        LOG(LS_WARNING) << "H264 encoder doesn't support "
+          << temporalLayerCount << " temporal layers";
+      }
+    }
+    if (screenContent_ && state->codecApi != nullptr) {
+      // Sharp text matters more than the encoding time at these rates.
+      VARIANT value;
+      VariantInit(&value);
+      value.vt = VT_UI4;
+      value.ulVal = 100;
+      if (FAILED(state->codecApi->SetValue(
+        &CODECAPI_AVEncCommonQualityVsSpeed, &value))) {
+        LOG(LS_INFO) << "H264 encoder doesn't support the quality vs speed setting";
+      }
+    }
+  } else if (mediaSink != nullptr) {
+    sinkWriter.Reset();
+    mediaSink->Shutdown();
+  }
+  return hr;
+}
+
+ComPtr<ICodecAPI> WinUWPH264EncoderImpl::GetEncoderCodecApi(
+  IMFSinkWriter* sinkWriter, DWORD streamIndex) {
+  ComPtr<IMFSinkWriterEx> sinkWriterEx;
+  if (FAILED(sinkWriter->QueryInterface(IID_PPV_ARGS(&sinkWriterEx)))) {
+    return nullptr;
+  }
+  for (DWORD index = 0;; ++index) {
+    GUID category;
+    ComPtr<IMFTransform> transform;
+    if (FAILED(sinkWriterEx->GetTransformForStream(streamIndex, index,
+      &category, &transform))) {
+      return nullptr;
+    }
+    ComPtr<ICodecAPI> codecApi;
+    if (category == MFT_CATEGORY_VIDEO_ENCODER &&
+      SUCCEEDED(transform.As(&codecApi)) &&
+      codecApi->IsModifiable(&CODECAPI_AVEncCommonMeanBitRate) == S_OK) {
+      return codecApi;
+    }
+  }
+}
+
+bool WinUWPH264EncoderImpl::ChangeResolution(UINT32 width, UINT32 height) {
+  if (rebuildPending_) {
+    // The running rebuild picks up the latest size.
+    rebuildWidth_ = width;
+    rebuildHeight_ = height;
+    return false;
+  }
 
+  // Try to switch the running encoder first, hardware encoders
+  // usually accept a new frame size on the fly.
+  ComPtr<IMFSinkWriterEncoderConfig> encoderConfig;
+  ComPtr<IMFMediaType> mediaTypeOut;
+  ComPtr<IMFMediaType> mediaTypeIn;
+  HRESULT hr = mediaTypeOut_ != nullptr ? sinkWriter_.As(&encoderConfig) : E_NOTIMPL;
+  ON_SUCCEEDED(MFCreateMediaType(&mediaTypeOut));
+  ON_SUCCEEDED(mediaTypeOut_->CopyAllItems(mediaTypeOut.Get()));
+  ON_SUCCEEDED(MFSetAttributeSize(mediaTypeOut.Get(),
+    MF_MT_FRAME_SIZE, width, height));
+  ON_SUCCEEDED(encoderConfig->SetTargetMediaType(streamIndex_,
+    mediaTypeOut.Get(), nullptr));
   if (SUCCEEDED(hr)) {
-    inited_ = true;
+    ON_SUCCEEDED(CreateInputMediaType(width, height, currentFps_, &mediaTypeIn));
+    ON_SUCCEEDED(sinkWriter_->SetInputMediaType(streamIndex_,
+      mediaTypeIn.Get(), nullptr));
+    if (FAILED(hr)) {
+      // Put the output back to the size of the frames still written.
+      encoderConfig->SetTargetMediaType(streamIndex_,
+        mediaTypeOut_.Get(), nullptr);
+    }
+  }
+
+  if (SUCCEEDED(hr)) {
+    LOG(LS_INFO) << "Resolution changed to: " << width << "x" << height;
+    currentWidth_ = width;
+    currentHeight_ = height;
+    mediaTypeOut_ = mediaTypeOut;
+    // The first frame at the new size must be decodable on its own.
+    keyFramePending_ = true;
     lastTimeSettingsChanged_ = rtc::TimeMillis();
-    return WEBRTC_VIDEO_CODEC_OK;
-  } else {
-    return hr;
+    return true;
+  }
+
+  LOG(LS_INFO) << "Encoder can't change the resolution on the fly (hr="
+    << hr << "), building a new sink writer for "
+    << width << "x" << height;
+  rebuildPending_ = true;
+  rebuildWidth_ = width;
+  rebuildHeight_ = height;
+  rebuildDone_.Reset();
+  Concurrency::create_task([this] { RebuildSinkWriter(); });
+  return false;
+}
+
+void WinUWPH264EncoderImpl::RebuildSinkWriter() {
+  bool done = false;
+  while (!done) {
+    UINT32 width, height, bitrateBps, fps;
+    {
+      rtc::CritScope lock(&crit_);
+      width = rebuildWidth_;
+      height = rebuildHeight_;
+      bitrateBps = GetEncoderBitrateBps();
+      fps = currentFps_;
+    }
+
+    SinkWriterState state;
+    HRESULT hr = CreateSinkWriter(width, height, bitrateBps, fps, &state);
+
+    // Whichever sink writer isn't used anymore is shut down outside
+    // of the lock, see Release().
+    ComPtr<IMFSinkWriter> unusedSinkWriter = state.sinkWriter;
+    ComPtr<H264MediaSink> unusedMediaSink = state.mediaSink;
+    {
+      rtc::CritScope lock(&crit_);
+      if (!inited_ || FAILED(hr)) {
+        if (FAILED(hr)) {
+          LOG(LS_ERROR) << "Failed to create the sink writer for "
+            << width << "x" << height << " hr=" << hr;
+        }
+        rebuildPending_ = false;
+        done = true;
+      } else if (width == rebuildWidth_ && height == rebuildHeight_) {
+        unusedSinkWriter = sinkWriter_;
+        unusedMediaSink = mediaSink_;
+        mediaSink_ = state.mediaSink;
+        sinkWriter_ = state.sinkWriter;
+        streamIndex_ = state.streamIndex;
+        mediaTypeOut_ = state.mediaTypeOut;
+        codecApi_ = state.codecApi;
+        inputDevice_ = state.inputDevice;
+        sinkWriterGeneration_ = state.generation;
+        encoderBitrateBps_ = bitrateBps;
+        rateWindowStartMs_ = 0;
+        rateWindowBytes_ = 0;
+        currentWidth_ = width;
+        currentHeight_ = height;
+        // The frames still in the old sink writer are lost.
+        framePendingCount_ = 0;
+        _sampleAttributeQueue.clear();
+        frameMemory_.Set(0);
+        // A new encoder starts with a key frame.
+        keyFramePending_ = false;
+        lastTimeSettingsChanged_ = rtc::TimeMillis();
+        rebuildPending_ = false;
+        done = true;
+        LOG(LS_INFO) << "Resolution changed to: " << width << "x" << height
+          << " with a new sink writer";
+      }
+      // Otherwise the size changed again meanwhile, build another one.
+    }
+
+    unusedSinkWriter.Reset();
+    if (unusedMediaSink != nullptr) {
+      unusedMediaSink->Shutdown();
+    }
   }
+  rebuildDone_.Set();
 }
 
 int WinUWPH264EncoderImpl::RegisterEncodeCompleteCallback(
@@ -168,15 +507,19 @@ int WinUWPH264EncoderImpl::Release() {
     if (mediaSink_ != nullptr) {
       tmpMediaSink = mediaSink_;
     }
-    sinkWriterCreationAttributes_.Reset();
-    sinkWriterEncoderAttributes_.Reset();
     mediaSink_.Reset();
     startTime_ = 0;
     lastTimestampHns_ = 0;
     firstFrame_ = true;
     inited_ = false;
+    sinkWriterGeneration_ = 0;
     framePendingCount_ = 0;
     _sampleAttributeQueue.clear();
+    frameMemory_.Set(0);
+    pendingFrame_.reset();
+    codecApi_.Reset();
+    inputDevice_.Reset();
+    mediaTypeOut_.Reset();
     rtc::CritScope callbackLock(&callbackCrit_);
     encodedCompleteCallback_ = nullptr;
   }
@@ -184,36 +527,83 @@ int WinUWPH264EncoderImpl::Release() {
   if (tmpMediaSink != nullptr) {
     tmpMediaSink->Shutdown();
   }
+
+  // A sink writer being built in the background sees inited_ cleared
+  // and discards itself, a pending frame task writes nothing.
+  rebuildDone_.Wait(rtc::Event::kForever);
+  pendingFrameTasksDone_.Wait(rtc::Event::kForever);
   return WEBRTC_VIDEO_CODEC_OK;
 }
 
 ComPtr<IMFSample> WinUWPH264EncoderImpl::FromVideoFrame(const VideoFrame& frame) {
+  ScopedPipelineStage stage("H264Encoder.FromVideoFrame", frame.timestamp());
   HRESULT hr = S_OK;
   ComPtr<IMFSample> sample;
-  ON_SUCCEEDED(MFCreateSample(sample.GetAddressOf()));
+
+  VideoFrameBuffer* buffer = frame.video_frame_buffer().get();
+  bool sameSize = buffer->width() == (int)currentWidth_ &&
+    buffer->height() == (int)currentHeight_;
+
+  // NV12 samples, from the capturer or a decoder, are copied as they are
+  // instead of going through I420.  The other native buffers are only
+  // read through ToI420().
+  rtc::scoped_refptr<DecodedSampleBuffer> nv12Buffer =
+    sameSize ? AsDecodedSampleBuffer(buffer) : nullptr;
+  rtc::scoped_refptr<PlanarYuvBuffer> frameBuffer;
+  if (nv12Buffer != nullptr) {
+    // Copied below.
+  } else if (sameSize) {
+    frameBuffer = buffer->ToI420();
+  } else {
+    // A new sink writer is being built, see PrepareSample().  Keep feeding
+    // the current one at its own size until it is swapped in.
+    rtc::scoped_refptr<I420Buffer> scaledBuffer =
+      I420Buffer::Create(currentWidth_, currentHeight_);
+    scaledBuffer->ScaleFrom(*buffer->ToI420());
+    frameBuffer = scaledBuffer;
+  }
+  int stride = nv12Buffer != nullptr ? currentWidth_ : frameBuffer->StrideY();
+
+  // Textures of the device the sink writer was built with are written
+  // as they are, in a sample of their own.
+  ComPtr<IMFMediaBuffer> textureBuffer;
+  if (nv12Buffer != nullptr && inputDevice_ != nullptr) {
+    textureBuffer = GetNV12TextureBuffer(nv12Buffer->sample(),
+      inputDevice_.Get(), currentWidth_, currentHeight_);
+  }
+
+  if (textureBuffer != nullptr) {
+    ON_SUCCEEDED(MFCreateSample(sample.GetAddressOf()));
+    ON_SUCCEEDED(sample->AddBuffer(textureBuffer.Get()));
+  } else {
+    // The pool is rebuilt when the stride or the height changes.
+    ON_SUCCEEDED(inputSamplePool_->GetSample(stride,
+      currentHeight_, sample.GetAddressOf()));
+  }
 
   ComPtr<IMFAttributes> sampleAttributes;
   ON_SUCCEEDED(sample.As(&sampleAttributes));
 
-  rtc::scoped_refptr<PlanarYuvBuffer> frameBuffer = static_cast<PlanarYuvBuffer*>(frame.video_frame_buffer().get());
-
   if (SUCCEEDED(hr)) {
-    auto totalSize = frameBuffer->StrideY() * frameBuffer->height() +
-      frameBuffer->StrideU() * (frameBuffer->height() + 1) / 2 +
-      frameBuffer->StrideV() * (frameBuffer->height() + 1) / 2;
-
     ComPtr<IMFMediaBuffer> mediaBuffer;
-    ON_SUCCEEDED(MFCreateMemoryBuffer(totalSize, mediaBuffer.GetAddressOf()));
+    if (textureBuffer == nullptr) {
+      ON_SUCCEEDED(sample->GetBufferByIndex(0, mediaBuffer.GetAddressOf()));
+    }
 
     BYTE* destBuffer = nullptr;
-    if (SUCCEEDED(hr)) {
+    if (SUCCEEDED(hr) && mediaBuffer != nullptr) {
       DWORD cbMaxLength;
       DWORD cbCurrentLength;
       ON_SUCCEEDED(mediaBuffer->Lock(
         &destBuffer, &cbMaxLength, &cbCurrentLength));
     }
 
-    if (SUCCEEDED(hr)) {
+    if (SUCCEEDED(hr) && textureBuffer == nullptr) {
+      inputBytesCopied_ += currentWidth_ * currentHeight_ * 3 / 2;
+    }
+    if (SUCCEEDED(hr) && textureBuffer == nullptr && nv12Buffer != nullptr) {
+      hr = nv12Buffer->CopyToNV12(destBuffer, stride);
+    } else if (SUCCEEDED(hr) && textureBuffer == nullptr) {
       BYTE* destUV = destBuffer +
         (frameBuffer->StrideY() * frameBuffer->height());
       libyuv::I420ToNV12(
@@ -226,22 +616,6 @@ ComPtr<IMFSample> WinUWPH264EncoderImpl::FromVideoFrame(const VideoFrame& frame)
         frameBuffer->height());
     }
 
-    {
-      if (frameBuffer->width() != (int)currentWidth_ || frameBuffer->height() != (int)currentHeight_) {
-        EncodedImageCallback* tempCallback = encodedCompleteCallback_;
-        Release();
-        {
-          rtc::CritScope lock(&callbackCrit_);
-          encodedCompleteCallback_ = tempCallback;
-        }
-
-        currentWidth_ = frameBuffer->width();
-        currentHeight_ = frameBuffer->height();
-        InitEncoderWithSettings(&codec_);
-        LOG(LS_WARNING) << "Resolution changed to: " << frameBuffer->width() << "x" << frameBuffer->height();
-      }
-    }
-
     if (firstFrame_) {
       firstFrame_ = false;
       startTime_ = frame.timestamp();
@@ -263,20 +637,23 @@ ComPtr<IMFSample> WinUWPH264EncoderImpl::FromVideoFrame(const VideoFrame& frame)
       frameAttributes.timestamp = frame.timestamp();
       frameAttributes.ntpTime = frame.ntp_time_ms();
       frameAttributes.captureRenderTime = frame.render_time_ms();
-      frameAttributes.frameWidth = frame.width();
-      frameAttributes.frameHeight = frame.height();
+      frameAttributes.frameWidth = currentWidth_;
+      frameAttributes.frameHeight = currentHeight_;
+      frameAttributes.encodeStartTimeMs = rtc::TimeMillis();
       _sampleAttributeQueue.push(timestampHns, frameAttributes);
+      // From here on the frame is identified by its sample time.
+      TracePipelineFrameMapped(frame.timestamp(), timestampHns);
     }
 
-    ON_SUCCEEDED(mediaBuffer->SetCurrentLength(
-      frameBuffer->width() * frameBuffer->height() * 3 / 2));
+    if (mediaBuffer != nullptr) {
+      ON_SUCCEEDED(mediaBuffer->SetCurrentLength(
+        currentWidth_ * currentHeight_ * 3 / 2));
+    }
 
     if (destBuffer != nullptr) {
       mediaBuffer->Unlock();
     }
 
-    ON_SUCCEEDED(sample->AddBuffer(mediaBuffer.Get()));
-
     if (lastFrameDropped_) {
       lastFrameDropped_ = false;
       sampleAttributes->SetUINT32(MFSampleExtension_Discontinuity, TRUE);
@@ -290,6 +667,10 @@ int WinUWPH264EncoderImpl::Encode(
   const VideoFrame& frame,
   const CodecSpecificInfo* codec_specific_info,
   const std::vector<FrameType>* frame_types) {
+  ScopedPipelineStage stage("H264Encoder.Encode", frame.timestamp());
+  // Ends when the encoded frame is handed to the packetizer.
+  TraceFrameFlowBegin(kSendFrameFlow, frame.timestamp());
+  ResourceSampler::RegisterCurrentThread("H264EncoderInput");
   {
       rtc::CritScope lock(&crit_);
       if (!inited_) {
@@ -297,49 +678,304 @@ int WinUWPH264EncoderImpl::Encode(
     }
   }
 
-
+  bool keyFrameRequested = false;
   if (frame_types != nullptr) {
     for (auto frameType : *frame_types) {
       if (frameType == kVideoFrameKey) {
         LOG(LS_INFO) << "Key frame requested in H264 encoder.";
-        ComPtr<IMFSinkWriterEncoderConfig> encoderConfig;
-        sinkWriter_.As(&encoderConfig);
-        ComPtr<IMFAttributes> encoderAttributes;
-        MFCreateAttributes(&encoderAttributes, 1);
-        encoderAttributes->SetUINT32(CODECAPI_AVEncVideoForceKeyFrame, TRUE);
-        encoderConfig->PlaceEncodingParameters(streamIndex_, encoderAttributes.Get());
+        keyFrameRequested = true;
         break;
       }
     }
   }
 
+
+  // Held until the sample is written, the attributes are pushed in
+  // the order of the samples.
+  rtc::CritScope writeLock(&writeCrit_);
+  ComPtr<IMFSample> sample;
+  ComPtr<IMFSinkWriter> sinkWriter;
+  DWORD streamIndex;
+  {
+    rtc::CritScope lock(&crit_);
+    ReportStats();
+    // The key frame is forced on the next frame actually written,
+    // not on one which may get dropped.
+    keyFramePending_ = keyFrameRequested || keyFramePending_;
+    if (IsPipelineFull()) {
+      switch (GetH264EncoderDropPolicy()) {
+      case H264EncoderDropPolicy::kDropOldest:
+        // Keep the newest frame, it gets encoded as soon as the
+        // encoder returns a sample.
+        if (pendingFrame_ != nullptr) {
+          ++framesDroppedPipelineFull_;
+          TracePipelineFrameDropped("H264Encoder.Encode", "PipelineFull",
+            pendingFrame_->timestamp());
+        }
+        pendingFrame_.reset(new VideoFrame(frame));
+        return WEBRTC_VIDEO_CODEC_OK;
+      case H264EncoderDropPolicy::kKeepKeyFrames:
+        if (keyFrameRequested) {
+          // Exceed the depth rather than delaying the key frame.
+          break;
+        }
+        // Fall through.
+      case H264EncoderDropPolicy::kDropNewest:
+      default:
+        ++framesDroppedPipelineFull_;
+        TracePipelineFrameDropped("H264Encoder.Encode", "PipelineFull",
+          frame.timestamp());
+        return WEBRTC_VIDEO_CODEC_OK;
+      }
+    }
+    // A newer frame makes the pending one obsolete.
+    if (pendingFrame_ != nullptr) {
+      ++framesDroppedPipelineFull_;
+      TracePipelineFrameDropped("H264Encoder.Encode", "PipelineFull",
+        pendingFrame_->timestamp());
+      pendingFrame_.reset();
+    }
+    sample = PrepareSample(frame);
+    sinkWriter = sinkWriter_;
+    streamIndex = streamIndex_;
+  }
+
+  WriteSample(sinkWriter, streamIndex, sample, frame.timestamp());
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+bool WinUWPH264EncoderImpl::IsPipelineFull() {
+  uint32_t inFlight = _sampleAttributeQueue.size();
+  size_t frameBytes = (size_t)currentWidth_ * currentHeight_ * 3 / 2;
+  frameMemory_.Set(inFlight * frameBytes);
+  if (inFlight >= GetH264EncoderMaxFramesInFlight()) {
+    return true;
+  }
+  // One frame is always let through, the budget doesn't stall the
+  // encoder.
+  if (inFlight > 0 && frameMemory_.WouldExceedBudget(frameBytes)) {
+    frameMemory_.OnFrameDropped();
+    return true;
+  }
+  return false;
+}
+
+ComPtr<IMFSample> WinUWPH264EncoderImpl::PrepareSample(const VideoFrame& frame) {
+  if (frame.width() != (int)currentWidth_ || frame.height() != (int)currentHeight_) {
+    ChangeResolution(frame.width(), frame.height());
+  }
+  if (keyFramePending_) {
+    keyFramePending_ = false;
+    ComPtr<IMFSinkWriterEncoderConfig> encoderConfig;
+    sinkWriter_.As(&encoderConfig);
+    ComPtr<IMFAttributes> encoderAttributes;
+    MFCreateAttributes(&encoderAttributes, 1);
+    encoderAttributes->SetUINT32(CODECAPI_AVEncVideoForceKeyFrame, TRUE);
+    encoderConfig->PlaceEncodingParameters(streamIndex_, encoderAttributes.Get());
+  }
+  return FromVideoFrame(frame);
+}
+
+void WinUWPH264EncoderImpl::WriteSample(ComPtr<IMFSinkWriter> sinkWriter,
+  DWORD streamIndex, ComPtr<IMFSample> sample, uint32_t rtpTimestamp) {
   HRESULT hr = S_OK;
+  {
+    LONGLONG sampleTime = 0;
+    if (sample != nullptr) {
+      sample->GetSampleTime(&sampleTime);
+    }
+    ScopedPipelineStage writeStage("H264Encoder.WriteSample", sampleTime);
+    ON_SUCCEEDED(sinkWriter->WriteSample(streamIndex, sample.Get()));
+  }
 
-  codecSpecificInfo_ = codec_specific_info;
+  bool endOfSegment;
+  {
+    rtc::CritScope lock(&crit_);
+    if (FAILED(hr)) {
+      ++framesDroppedWriteFailed_;
+      TracePipelineFrameDropped("H264Encoder.WriteSample", "WriteSampleFailed",
+        rtpTimestamp);
+    }
+    // Some threads online mention this is useful to do regularly.
+    ++frameCount_;
+    endOfSegment = frameCount_ % 30 == 0;
+
+    ++framePendingCount_;
+  }
+  // Not under |crit_|: with direct sample delivery the sink writer may
+  // be calling OnH264Encoded(), which takes it.
+  if (endOfSegment) {
+    ON_SUCCEEDED(sinkWriter->NotifyEndOfSegment(streamIndex));
+  }
+}
 
+void WinUWPH264EncoderImpl::EncodePendingFrame() {
+  rtc::CritScope writeLock(&writeCrit_);
   ComPtr<IMFSample> sample;
+  ComPtr<IMFSinkWriter> sinkWriter;
+  DWORD streamIndex;
+  uint32_t rtpTimestamp;
   {
     rtc::CritScope lock(&crit_);
-    if (_sampleAttributeQueue.size() > 2) {
-      return WEBRTC_VIDEO_CODEC_OK;
+    if (!inited_ || pendingFrame_ == nullptr || IsPipelineFull()) {
+      return;
     }
-    sample = FromVideoFrame(frame);
+    std::unique_ptr<VideoFrame> frame(std::move(pendingFrame_));
+    rtpTimestamp = frame->timestamp();
+    sample = PrepareSample(*frame);
+    sinkWriter = sinkWriter_;
+    streamIndex = streamIndex_;
   }
+  WriteSample(sinkWriter, streamIndex, sample, rtpTimestamp);
+}
 
-  ON_SUCCEEDED(sinkWriter_->WriteSample(streamIndex_, sample.Get()));
+namespace {
+// Keeps a media buffer locked for the lifetime of the object.
+class ScopedMediaBufferLock {
+ public:
+  explicit ScopedMediaBufferLock(IMFMediaBuffer* buffer)
+    : buffer_(buffer), data_(nullptr), length_(0) {
+    DWORD maxLength;
+    if (FAILED(buffer_->Lock(&data_, &maxLength, &length_))) {
+      data_ = nullptr;
+      length_ = 0;
+    }
+  }
+  ~ScopedMediaBufferLock() {
+    if (data_ != nullptr) {
+      buffer_->Unlock();
+    }
+  }
+  BYTE* data() const { return data_; }
+  DWORD length() const { return length_; }
+
+ private:
+  IMFMediaBuffer* buffer_;
+  BYTE* data_;
+  DWORD length_;
+};
+}  // namespace
+
+void WinUWPH264EncoderImpl::ReportStats() {
+  int64_t now = rtc::TimeMillis();
+  if (now - lastStatsReportTime_ < kStatsReportIntervalMs) {
+    return;
+  }
+  encodeLatency_.Report();
+  {
+    rtc::CritScope lock(&callbackCrit_);
+    // Confirms the encoded frames reach the callback without a copy,
+    // only the input frames are.
+    int64_t elapsedMs = now - lastStatsReportTime_;
+    LOG(LS_INFO) << "H264 encoder bytes copied: input="
+      << inputBytesCopied_ * 1000 / elapsedMs << " B/s bitstream=0 B/s of "
+      << bitstreamBytes_ * 1000 / elapsedMs << " B/s";
+    inputBytesCopied_ = 0;
+    bitstreamBytes_ = 0;
+  }
+  if (framesDroppedPipelineFull_ > 0 || framesDroppedWriteFailed_ > 0) {
+    LOG(LS_INFO) << "H264 encoder dropped frames: pipeline full="
+      << framesDroppedPipelineFull_
+      << " write failed=" << framesDroppedWriteFailed_;
+  }
+  framesDroppedPipelineFull_ = 0;
+  framesDroppedWriteFailed_ = 0;
+  // Frames encoded but never delivered, or encoded as another frame.
+  uint64_t attributesLost = _sampleAttributeQueue.lost();
+  uint64_t attributesMissed = _sampleAttributeQueue.misses();
+  if (attributesLost != attributesLostReported_ ||
+    attributesMissed != attributesMissedReported_) {
+    LOG(LS_WARNING) << "H264 encoder frame attributes: lost="
+      << attributesLost - attributesLostReported_
+      << " encoded frames without attributes="
+      << attributesMissed - attributesMissedReported_;
+    attributesLostReported_ = attributesLost;
+    attributesMissedReported_ = attributesMissed;
+  }
+  if (GetH264EncoderTemporalLayerCount() > 1) {
+    rtc::CritScope lock(&callbackCrit_);
+    LOG(LS_INFO) << "H264 encoder frames per temporal layer: "
+      << framesPerTemporalLayer_[0] << " "
+      << framesPerTemporalLayer_[1] << " "
+      << framesPerTemporalLayer_[2];
+    for (auto& frames : framesPerTemporalLayer_) {
+      frames = 0;
+    }
+  }
+  lastStatsReportTime_ = now;
+}
 
-  rtc::CritScope lock(&crit_);
-  // Some threads online mention this is useful to do regularly.
-  ++frameCount_;
-  if (frameCount_ % 30 == 0) {
-    ON_SUCCEEDED(sinkWriter_->NotifyEndOfSegment(streamIndex_));
+void WinUWPH264EncoderImpl::OnAppSuspending() {
+  ComPtr<IMFSinkWriter> sinkWriter;
+  DWORD streamIndex;
+  {
+    rtc::CritScope lock(&crit_);
+    if (inited_) {
+      sinkWriter = sinkWriter_;
+      streamIndex = streamIndex_;
+    }
   }
+  // Flush() waits for the sink writer, crit_ isn't held meanwhile so that
+  // Encode() and the stream sink callbacks don't block on it.
+  if (sinkWriter != nullptr) {
+    // The samples in flight are discarded, they would be stale anyway.
+    HRESULT hr = sinkWriter->Flush(streamIndex);
+    if (FAILED(hr)) {
+      LOG(LS_WARNING) << "H264 encoder flush failed, hr=" << hr;
+    }
+  }
+  rtc::CritScope lock(&crit_);
+  framePendingCount_ = 0;
+  _sampleAttributeQueue.clear();
+  frameMemory_.Set(0);
+  pendingFrame_.reset();
+  inputSamplePool_->Reset();
+  // The receivers lost the frames, they resume from a key frame
+  // without having to ask for one.
+  keyFramePending_ = true;
+}
 
-  ++framePendingCount_;
-  return WEBRTC_VIDEO_CODEC_OK;
+void WinUWPH264EncoderImpl::OnAppResuming() {
+  // Nothing was torn down, the next frame restarts the pipeline.
+  LOG(LS_INFO) << "H264 encoder resuming at " << currentWidth_ << "x"
+    << currentHeight_;
+}
+
+void WinUWPH264EncoderImpl::OnH264Encoded(ComPtr<IMFSample> sample,
+  UINT32 generation) {
+  DeliverEncodedSample(sample, generation);
+  // The sample freed a slot in the pipeline.  Written from a task, the
+  // sink writer may be calling from its own ProcessSample().
+  {
+    rtc::CritScope lock(&crit_);
+    if (!inited_ || pendingFrame_ == nullptr || pendingFrameScheduled_) {
+      return;
+    }
+    pendingFrameScheduled_ = true;
+    ++pendingFrameTasks_;
+    pendingFrameTasksDone_.Reset();
+  }
+  Concurrency::create_task([this] {
+    {
+      rtc::CritScope lock(&crit_);
+      // A frame pending from now on gets its own task.
+      pendingFrameScheduled_ = false;
+    }
+    EncodePendingFrame();
+    rtc::CritScope lock(&crit_);
+    if (--pendingFrameTasks_ == 0) {
+      pendingFrameTasksDone_.Set();
+    }
+  });
 }
 
-void WinUWPH264EncoderImpl::OnH264Encoded(ComPtr<IMFSample> sample) {
+void WinUWPH264EncoderImpl::DeliverEncodedSample(ComPtr<IMFSample> sample,
+  UINT32 generation) {
+  LONGLONG sampleTime = 0;
+  sample->GetSampleTime(&sampleTime);
+  ScopedPipelineStage stage("H264Encoder.OnH264Encoded", sampleTime);
+  // Media Foundation work queue threads, the encoding itself.
+  ResourceSampler::RegisterCurrentThread("H264EncoderMF");
   DWORD totalLength;
   HRESULT hr = S_OK;
   ON_SUCCEEDED(sample->GetTotalLength(&totalLength));
@@ -348,28 +984,26 @@ void WinUWPH264EncoderImpl::OnH264Encoded(ComPtr<IMFSample> sample) {
   hr = sample->GetBufferByIndex(0, &buffer);
 
   if (SUCCEEDED(hr)) {
-    BYTE* byteBuffer;
-    DWORD maxLength;
-    DWORD curLength;
-    hr = buffer->Lock(&byteBuffer, &maxLength, &curLength);
-    if (FAILED(hr)) {
+    // The buffer stays locked until the callback returned, the
+    // EncodedImage points straight into it.
+    ScopedMediaBufferLock bufferLock(buffer.Get());
+    if (bufferLock.data() == nullptr) {
       return;
     }
+    DWORD curLength = bufferLock.length();
     if (curLength == 0) {
       LOG(LS_WARNING) << "Got empty sample.";
-      buffer->Unlock();
-      return;
-    }
-    std::vector<byte> sendBuffer;
-    sendBuffer.resize(curLength);
-    memcpy(sendBuffer.data(), byteBuffer, curLength);
-    hr = buffer->Unlock();
-    if (FAILED(hr)) {
+      TracePipelineFrameDropped("H264Encoder.OnH264Encoded", "EmptySample",
+        sampleTime);
       return;
     }
+    byte* bitstream = bufferLock.data();
 
-    // sendBuffer is not copied here.
-    EncodedImage encodedImage(sendBuffer.data(), curLength, curLength);
+    UpdateRateControl(curLength);
+
+    // The bitstream is not copied here.
+    EncodedImage encodedImage(bitstream, curLength, curLength);
+    encodedImage.qp_ = GetFrameQp(sample.Get(), bitstream, curLength);
 
     ComPtr<IMFAttributes> sampleAttributes;
     hr = sample.As(&sampleAttributes);
@@ -383,86 +1017,98 @@ void WinUWPH264EncoderImpl::OnH264Encoded(ComPtr<IMFSample> sample) {
       }
     }
 
-    // Scan for and create mark all fragments.
+    // Mark all fragments, access unit delimiters are ignored.
+    ScanNalUnits(bitstream, curLength, &nalUnits_);
+    uint8_t temporalLayerId = GetTemporalLayerId(bitstream, nalUnits_);
+    uint32_t fragCount = 0;
+    for (auto& nalUnit : nalUnits_) {
+      if (nalUnit.type != kNalUnitTypeAccessUnitDelimiter) {
+        ++fragCount;
+      }
+    }
     RTPFragmentationHeader fragmentationHeader;
+    fragmentationHeader.VerifyAndAllocateFragmentationHeader(fragCount);
     uint32_t fragIdx = 0;
-    for (uint32_t i = 0; i < sendBuffer.size() - 5; ++i) {
-      byte* ptr = sendBuffer.data() + i;
-      int prefixLengthFound = 0;
-      if (ptr[0] == 0x00 && ptr[1] == 0x00 && ptr[2] == 0x00 && ptr[3] == 0x01
-        && ((ptr[4] & 0x1f) != 0x09 /* ignore access unit delimiters */)) {
-        prefixLengthFound = 4;
-      } else if (ptr[0] == 0x00 && ptr[1] == 0x00 && ptr[2] == 0x01
-        && ((ptr[3] & 0x1f) != 0x09 /* ignore access unit delimiters */)) {
-        prefixLengthFound = 3;
+    for (auto& nalUnit : nalUnits_) {
+      if (nalUnit.type == kNalUnitTypeAccessUnitDelimiter) {
+        continue;
       }
 
       // Found a key frame, mark is as such in case
       // MFSampleExtension_CleanPoint wasn't set on the sample.
-      if (prefixLengthFound > 0 && (ptr[prefixLengthFound] & 0x1f) == 0x05) {
+      if (nalUnit.type == kNalUnitTypeIdr) {
         encodedImage._completeFrame = true;
         encodedImage._frameType = kVideoFrameKey;
       }
 
-      if (prefixLengthFound > 0) {
-        fragmentationHeader.VerifyAndAllocateFragmentationHeader(fragIdx + 1);
-        fragmentationHeader.fragmentationOffset[fragIdx] = i + prefixLengthFound;
-        fragmentationHeader.fragmentationLength[fragIdx] = 0;  // We'll set that later
-        // Set the length of the previous fragment.
-        if (fragIdx > 0) {
-          fragmentationHeader.fragmentationLength[fragIdx - 1] =
-            i - fragmentationHeader.fragmentationOffset[fragIdx - 1];
-        }
-        fragmentationHeader.fragmentationPlType[fragIdx] = 0;
-        fragmentationHeader.fragmentationTimeDiff[fragIdx] = 0;
-        ++fragIdx;
-        i += 5;
+      fragmentationHeader.fragmentationOffset[fragIdx] = nalUnit.offset;
+      fragmentationHeader.fragmentationLength[fragIdx] = 0;  // We'll set that later
+      // Set the length of the previous fragment.
+      if (fragIdx > 0) {
+        fragmentationHeader.fragmentationLength[fragIdx - 1] =
+          nalUnit.offset - nalUnit.prefixLength -
+          fragmentationHeader.fragmentationOffset[fragIdx - 1];
       }
+      fragmentationHeader.fragmentationPlType[fragIdx] = 0;
+      fragmentationHeader.fragmentationTimeDiff[fragIdx] = 0;
+      ++fragIdx;
     }
     // Set the length of the last fragment.
     if (fragIdx > 0) {
       fragmentationHeader.fragmentationLength[fragIdx - 1] =
-        sendBuffer.size() -
+        curLength -
         fragmentationHeader.fragmentationOffset[fragIdx - 1];
     }
 
     {
       rtc::CritScope lock(&callbackCrit_);
-      --framePendingCount_;
+      // A late sample of a replaced sink writer, its frames were already
+      // taken off the count and its attributes cleared.
+      if (generation != sinkWriterGeneration_) {
+        return;
+      }
+      int pending = framePendingCount_;
+      while (pending > 0 &&
+        !framePendingCount_.compare_exchange_weak(pending, pending - 1)) {
+      }
+      bitstreamBytes_ += curLength;
       if (encodedCompleteCallback_ == nullptr) {
         return;
       }
 
-      LONGLONG sampleTimestamp;
-      sample->GetSampleTime(&sampleTimestamp);
-
       CachedFrameAttributes frameAttributes;
-      if (_sampleAttributeQueue.pop(sampleTimestamp, frameAttributes)) {
+      if (_sampleAttributeQueue.pop(sampleTime, frameAttributes)) {
         encodedImage._timeStamp = frameAttributes.timestamp;
         encodedImage.ntp_time_ms_ = frameAttributes.ntpTime;
         encodedImage.capture_time_ms_ = frameAttributes.captureRenderTime;
         encodedImage._encodedWidth = frameAttributes.frameWidth;
         encodedImage._encodedHeight = frameAttributes.frameHeight;
+        encodeLatency_.Add(rtc::TimeMillis() - frameAttributes.encodeStartTimeMs);
+        TraceFrameFlowEnd(kSendFrameFlow, frameAttributes.timestamp);
       }
       else {
         // No point in confusing the callback with a frame that doesn't
         // have correct attributes.
+        TracePipelineFrameDropped("H264Encoder.OnH264Encoded",
+          "NoFrameAttributes", sampleTime);
         return;
       }
 
 
+      if (temporalLayerId < kH264EncoderMaxTemporalLayers) {
+        ++framesPerTemporalLayer_[temporalLayerId];
+      }
+
       if (encodedCompleteCallback_ != nullptr) {
+        // The layer of each frame travels in its prefix NAL units,
+        // CodecSpecificInfoH264 has no field for it.
         CodecSpecificInfo codecSpecificInfo;
-        if (codecSpecificInfo_ != nullptr) {
-          codecSpecificInfo = *codecSpecificInfo_;
-        }
-        else {
-          codecSpecificInfo.codecType = webrtc::kVideoCodecH264;
-          codecSpecificInfo.codecSpecific.H264.packetization_mode =
-            H264PacketizationMode::NonInterleaved;
-          encodedCompleteCallback_->OnEncodedImage(
-            encodedImage, &codecSpecificInfo, &fragmentationHeader);
-        }
+        codecSpecificInfo.codecType = webrtc::kVideoCodecH264;
+        codecSpecificInfo.codec_name = ImplementationName();
+        codecSpecificInfo.codecSpecific.H264.packetization_mode =
+          H264PacketizationMode::NonInterleaved;
+        encodedCompleteCallback_->OnEncodedImage(
+          encodedImage, &codecSpecificInfo, &fragmentationHeader);
       }
     }
   }
@@ -470,9 +1116,88 @@ void WinUWPH264EncoderImpl::OnH264Encoded(ComPtr<IMFSample> sample) {
 
 int WinUWPH264EncoderImpl::SetChannelParameters(
   uint32_t packetLoss, int64_t rtt) {
+  rtc::CritScope lock(&crit_);
+  packetLoss_ = packetLoss;
   return WEBRTC_VIDEO_CODEC_OK;
 }
 
+UINT32 WinUWPH264EncoderImpl::GetEncoderBitrateBps() const {
+  return (UINT32)(currentBitrateBps_ * rateCorrection_);
+}
+
+bool WinUWPH264EncoderImpl::ApplyEncoderBitrate() {
+  if (codecApi_ == nullptr) {
+    return false;
+  }
+  VARIANT value;
+  VariantInit(&value);
+  value.vt = VT_UI4;
+  value.ulVal = GetEncoderBitrateBps();
+  if (FAILED(codecApi_->SetValue(&CODECAPI_AVEncCommonMeanBitRate, &value))) {
+    return false;
+  }
+  encoderBitrateBps_ = value.ulVal;
+  return true;
+}
+
+void WinUWPH264EncoderImpl::UpdateRateControl(size_t encodedBytes) {
+  rtc::CritScope lock(&crit_);
+  int64_t now = rtc::TimeMillis();
+  if (rateWindowStartMs_ == 0) {
+    rateWindowStartMs_ = now;
+  }
+  rateWindowBytes_ += encodedBytes;
+  int64_t elapsedMs = now - rateWindowStartMs_;
+  if (elapsedMs < kRateControlWindowMs || currentBitrateBps_ == 0) {
+    return;
+  }
+  double ratio = (rateWindowBytes_ * 8 * 1000.0 / elapsedMs) /
+    currentBitrateBps_;
+  rateWindowStartMs_ = now;
+  rateWindowBytes_ = 0;
+
+  // Lowered at once by the overshoot, raised back a little at a time
+  // while the encoder stays under the target.
+  double tolerance = packetLoss_ > kPacketLossThreshold ?
+    1.0 : kRateOvershootTolerance;
+  double correction = rateCorrection_;
+  if (ratio > tolerance) {
+    correction /= ratio / tolerance;
+  } else if (ratio < 1.0) {
+    correction *= std::min(1.0 / ratio, 1.1);
+  }
+  correction = std::max(kMinRateCorrection, std::min(correction, 1.0));
+  if (correction == rateCorrection_) {
+    return;
+  }
+  rateCorrection_ = correction;
+
+  UINT32 bitrateBps = GetEncoderBitrateBps();
+  if (std::abs((int64_t)bitrateBps - (int64_t)encoderBitrateBps_) * 20 <
+    (int64_t)encoderBitrateBps_) {
+    return;
+  }
+  LOG(LS_INFO) << "H264 encoder produced " << (int)(ratio * 100)
+    << "% of " << currentBitrateBps_ << "bps, encoder bitrate set to "
+    << bitrateBps;
+  ApplyEncoderBitrate();
+}
+
+int WinUWPH264EncoderImpl::GetFrameQp(IMFSample* sample,
+  const uint8_t* bitstream, size_t length) {
+  // Reported by the Windows 8.1+ encoders, the QP is in the low 16 bits.
+  UINT64 encodeQp;
+  if (SUCCEEDED(sample->GetUINT64(MFSampleExtension_VideoEncodeQP, &encodeQp))) {
+    return (int)(encodeQp & 0xFFFF);
+  }
+  int qp;
+  bitstreamParser_.ParseBitstream(bitstream, length);
+  if (bitstreamParser_.GetLastSliceQp(&qp)) {
+    return qp;
+  }
+  return -1;
+}
+
 #define DYNAMIC_FPS
 #define DYNAMIC_BITRATE
 
@@ -485,6 +1210,9 @@ int WinUWPH264EncoderImpl::SetRates(
   if (new_framerate == 0) {
     return WEBRTC_VIDEO_CODEC_OK;
   }
+  if (screenContent_) {
+    new_framerate = std::min(new_framerate, kMaxScreenContentFps);
+  }
 
   rtc::CritScope lock(&crit_);
   if (sinkWriter_ == nullptr) {
@@ -493,11 +1221,16 @@ int WinUWPH264EncoderImpl::SetRates(
 
   bool bitrateUpdated = false;
   bool fpsUpdated = false;
+  UINT32 previousBitrateBps = currentBitrateBps_;
+  UINT32 previousFps = currentFps_;
 
 #ifdef DYNAMIC_BITRATE
   if (currentBitrateBps_ != (new_bitrate_kbit * 1024)) {
     currentBitrateBps_ = new_bitrate_kbit * 1024;
     bitrateUpdated = true;
+    // Measured against the previous target otherwise.
+    rateWindowStartMs_ = 0;
+    rateWindowBytes_ = 0;
   }
 #endif
 
@@ -509,9 +1242,41 @@ int WinUWPH264EncoderImpl::SetRates(
   }
 #endif
 
+  // Apply the changes to the running encoder when it supports it.
+  if (bitrateUpdated && ApplyEncoderBitrate()) {
+    bitrateUpdated = false;
+  }
+  if (fpsUpdated && mediaTypeOut_ != nullptr) {
+    ComPtr<IMFSinkWriterEncoderConfig> encoderConfig;
+    ComPtr<IMFMediaType> mediaType;
+    HRESULT hr = sinkWriter_.As(&encoderConfig);
+    ON_SUCCEEDED(MFCreateMediaType(&mediaType));
+    ON_SUCCEEDED(mediaTypeOut_->CopyAllItems(mediaType.Get()));
+    ON_SUCCEEDED(MFSetAttributeRatio(mediaType.Get(),
+      MF_MT_FRAME_RATE, currentFps_, 1));
+    ON_SUCCEEDED(mediaType->SetUINT32(MF_MT_AVG_BITRATE, GetEncoderBitrateBps()));
+    ON_SUCCEEDED(encoderConfig->SetTargetMediaType(streamIndex_,
+      mediaType.Get(), nullptr));
+    if (SUCCEEDED(hr)) {
+      mediaTypeOut_ = mediaType;
+      fpsUpdated = false;
+    }
+  }
+
   if (bitrateUpdated || fpsUpdated) {
-    if ((rtc::TimeMillis() - lastTimeSettingsChanged_) < 15000) {
+    // Release() can't wait for a rebuild or a pending frame task while
+    // crit_ is held, both need it to finish.  No task can start meanwhile,
+    // scheduling one takes crit_.
+    if (rebuildPending_ || pendingFrameTasks_ > 0 ||
+      (rtc::TimeMillis() - lastTimeSettingsChanged_) < 15000) {
       LOG(LS_INFO) << "Last time settings changed was too soon, skipping this SetRates().\n";
+      // Keep the change for the next SetRates().
+      if (bitrateUpdated) {
+        currentBitrateBps_ = previousBitrateBps;
+      }
+      if (fpsUpdated) {
+        currentFps_ = previousFps;
+      }
       return WEBRTC_VIDEO_CODEC_OK;
     }
 
@@ -528,6 +1293,16 @@ int WinUWPH264EncoderImpl::SetRates(
 }
 
 VideoEncoder::ScalingSettings WinUWPH264EncoderImpl::GetScalingSettings() const {
+  // Scaled down text is unreadable, screencasts drop frames instead.
+  if (screenContent_) {
+    return ScalingSettings(false);
+  }
+  // A software encoder is CPU bound, have the quality scaler step the
+  // resolution down sooner.
+  H264MftCapabilities capabilities = GetH264MftCapabilities();
+  if (capabilities.probed && !capabilities.encoder.hardware) {
+    return ScalingSettings(true, kLowH264QpThreshold, kHighSoftwareH264QpThreshold);
+  }
   return ScalingSettings(true);
 }
 
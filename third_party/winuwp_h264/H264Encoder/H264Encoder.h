@@ -15,12 +15,23 @@
 #include <mfidl.h>
 #include <Mfreadwrite.h>
 #include <mferror.h>
+#include <strmif.h>
+#include <codecapi.h>
+#include <atomic>
+#include <memory>
 #include <vector>
 #include "H264MediaSink.h"
 #include "IH264EncodingCallback.h"
+#include "../Utils/AppSuspend.h"
+#include "../Utils/GpuPipeline.h"
+#include "../Utils/NalScanner.h"
+#include "../Utils/PipelineTrace.h"
+#include "../Utils/FrameMemoryBudget.h"
 #include "../Utils/SampleAttributeQueue.h"
+#include "../Utils/SamplePool.h"
 #include "webrtc/api/video_codecs/video_encoder.h"
 #include "webrtc/rtc_base/criticalsection.h"
+#include "webrtc/rtc_base/event.h"
 #include "webrtc/modules/video_coding/utility/quality_scaler.h"
 #include "webrtc/common_video/h264/h264_bitstream_parser.h"
 
@@ -32,7 +43,39 @@ namespace webrtc {
 
 class H264MediaSink;
 
-class WinUWPH264EncoderImpl : public VideoEncoder, public IH264EncodingCallback {
+// What the encoder does with a frame arriving while the maximum number
+// of frames are in flight in the Media Foundation pipeline.
+enum class H264EncoderDropPolicy {
+  // The new frame is dropped.
+  kDropNewest,
+  // The new frame is kept, replacing an older one waiting for room, and
+  // encoded as soon as the encoder returns a sample.
+  kDropOldest,
+  // Like kDropNewest, except frames carrying a key frame request are
+  // always encoded, even if that exceeds the maximum.
+  kKeepKeyFrames
+};
+
+// Settings shared by all the encoders, applied from the next frame on.
+void SetH264EncoderMaxFramesInFlight(uint32_t maxFramesInFlight);
+uint32_t GetH264EncoderMaxFramesInFlight();
+void SetH264EncoderDropPolicy(H264EncoderDropPolicy policy);
+H264EncoderDropPolicy GetH264EncoderDropPolicy();
+// Number of temporal layers, 1 to kH264EncoderMaxTemporalLayers.  With
+// more than one the encoder tags the slices with SVC prefix NAL units
+// so that an SFU can drop the upper layers without transcoding.
+// Applied to the encoders created from then on.
+const uint32_t kH264EncoderMaxTemporalLayers = 3;
+void SetH264EncoderTemporalLayerCount(uint32_t temporalLayerCount);
+uint32_t GetH264EncoderTemporalLayerCount();
+// When set, the encoded samples are packetized on the thread the encoder
+// outputs them on instead of going through a work queue of the media
+// sink.  Applied to the encoders created from then on.
+void SetH264EncoderDirectSampleDelivery(bool directDelivery);
+bool GetH264EncoderDirectSampleDelivery();
+
+class WinUWPH264EncoderImpl : public VideoEncoder, public IH264EncodingCallback,
+  public AppSuspendObserver {
  public:
   WinUWPH264EncoderImpl();
 
@@ -52,43 +95,185 @@ class WinUWPH264EncoderImpl : public VideoEncoder, public IH264EncodingCallback
   const char* ImplementationName() const override;
 
   // === IH264EncodingCallback overrides ===
-  void OnH264Encoded(ComPtr<IMFSample> sample) override;
+  void OnH264Encoded(ComPtr<IMFSample> sample, UINT32 generation) override;
+
+  // === AppSuspendObserver overrides ===
+  // Drops the frames in flight and the pooled input samples, the sink
+  // writer is kept and the first frame after the resume is a key frame.
+  void OnAppSuspending() override;
+  void OnAppResuming() override;
 
  private:
   ComPtr<IMFSample> FromVideoFrame(const VideoFrame& frame);
+  // Follows resolution changes, forces a key frame if one is pending
+  // and converts |frame|.
+  // Called with crit_ held.
+  ComPtr<IMFSample> PrepareSample(const VideoFrame& frame);
+  // True if the maximum number of frames are in flight, or if one more
+  // would exceed the frame memory budget.  Called with crit_ held.
+  bool IsPipelineFull();
+  // Called with writeCrit_ held, from PrepareSample() on: the sample
+  // attributes are queued in the order the samples are written.
+  // |sinkWriter| is the one the sample was prepared for.
+  void WriteSample(ComPtr<IMFSinkWriter> sinkWriter, DWORD streamIndex,
+    ComPtr<IMFSample> sample, uint32_t rtpTimestamp);
+  // Writes the frame kept by the kDropOldest policy once there is room.
+  // Runs in a task started by OnH264Encoded().
+  void EncodePendingFrame();
+  void DeliverEncodedSample(ComPtr<IMFSample> sample, UINT32 generation);
   int InitEncoderWithSettings(const VideoCodec* inst);
 
+  // Sink writer and the objects tied to it.
+  struct SinkWriterState {
+    ComPtr<H264MediaSink> mediaSink;
+    ComPtr<IMFSinkWriter> sinkWriter;
+    DWORD streamIndex;
+    ComPtr<IMFMediaType> mediaTypeOut;
+    ComPtr<ICodecAPI> codecApi;
+    // Device of the textures the sink writer takes as they are, null
+    // if it only takes system memory samples.
+    ComPtr<ID3D11Device> inputDevice;
+    // Handed back with the encoded samples of the sink writer.
+    UINT32 generation;
+  };
+  // Only reads screenContent_, can run on any thread.
+  HRESULT CreateSinkWriter(UINT32 width, UINT32 height,
+    UINT32 bitrateBps, UINT32 fps, SinkWriterState* state);
+  // Rate control of the encoder transform, to change the bitrate
+  // without reinitializing the sink writer.  Null if not supported.
+  static ComPtr<ICodecAPI> GetEncoderCodecApi(IMFSinkWriter* sinkWriter,
+    DWORD streamIndex);
+  // Switches the running sink writer to |width|x|height|.  Returns
+  // false if the encoder doesn't support it, a new sink writer is then
+  // built in the background and frames must keep the current size
+  // until it is swapped in.  Called with crit_ held.
+  bool ChangeResolution(UINT32 width, UINT32 height);
+  void RebuildSinkWriter();
+  // Logs and traces the latency histogram and the dropped frames
+  // every kStatsReportIntervalMs.
+  void ReportStats();
+  // Compares the encoded bitrate to the target and corrects the rate
+  // given to the encoder when it overshoots.
+  void UpdateRateControl(size_t encodedBytes);
+  // Bitrate for the encoder, the target scaled by rateCorrection_.
+  // Called with crit_ held.
+  UINT32 GetEncoderBitrateBps() const;
+  // Sets the bitrate of the running encoder, false if not supported.
+  // Called with crit_ held.
+  bool ApplyEncoderBitrate();
+  // QP of the last slice of |bitstream|, -1 if unknown.
+  int GetFrameQp(IMFSample* sample, const uint8_t* bitstream, size_t length);
+
+  static const int64_t kStatsReportIntervalMs = 10000;
+  // Screen content rarely needs more, and text needs the bits.
+  static const uint32_t kMaxScreenContentFps = 15;
+  // Period the encoded bitrate is measured over.
+  static const int64_t kRateControlWindowMs = 2000;
+
  private:
+  // Serializes the writes to the sink writer, taken before crit_.  Not
+  // taken by the sink writer callbacks.
+  rtc::CriticalSection writeCrit_;
   rtc::CriticalSection crit_;
   rtc::CriticalSection callbackCrit_;
   bool inited_;
-  const CodecSpecificInfo* codecSpecificInfo_;
   ComPtr<IMFSinkWriter> sinkWriter_;
-  ComPtr<IMFAttributes> sinkWriterCreationAttributes_;
-  ComPtr<IMFAttributes> sinkWriterEncoderAttributes_;
   ComPtr<H264MediaSink> mediaSink_;
   EncodedImageCallback* encodedCompleteCallback_;
   DWORD streamIndex_;
   LONGLONG startTime_;
   LONGLONG lastTimestampHns_;
   bool firstFrame_;
-  int framePendingCount_;
+  // Samples written and not delivered yet.  Written under crit_ and
+  // delivered under callbackCrit_, never below 0.
+  std::atomic<int> framePendingCount_;
+  // Generation of the sink writer in use, 0 when there is none.  The
+  // samples of other generations come from a sink writer being shut
+  // down, they are ignored.
+  std::atomic<UINT32> sinkWriterGeneration_;
+  std::atomic<UINT32> nextSinkWriterGeneration_;
   DWORD frameCount_;
   bool lastFrameDropped_;
   UINT32 currentWidth_;
   UINT32 currentHeight_;
   UINT32 currentBitrateBps_;
   UINT32 currentFps_;
+  // Rate control, guarded by crit_.  The correction only lowers the
+  // bitrate, some encoders overshoot their target, more so right after
+  // a reinit.  It is kept across reinits.
+  double rateCorrection_;
+  UINT32 encoderBitrateBps_;
+  int64_t rateWindowStartMs_;
+  uint64_t rateWindowBytes_;
+  // Fraction lost reported by SetChannelParameters(), of 255.
+  uint32_t packetLoss_;
+  // Used when the encoder doesn't report the QP, only used by
+  // DeliverEncodedSample().
+  H264BitstreamParser bitstreamParser_;
 	int64_t lastTimeSettingsChanged_;
 
+  // Time from Encode() to the encoded sample reaching OnH264Encoded().
+  LatencyHistogram encodeLatency_;
+  // Bytes copied into the input samples since the last report, guarded by
+  // crit_.  The bitstream is never copied, |bitstreamBytes_| only counts
+  // the bytes delivered from the media buffers, guarded by callbackCrit_.
+  uint64_t inputBytesCopied_;
+  uint64_t bitstreamBytes_;
+  // Frames dropped by Encode() since the last report, by reason.
+  uint32_t framesDroppedPipelineFull_;
+  uint32_t framesDroppedWriteFailed_;
+  // Frames encoded in each temporal layer since the last report.
+  uint32_t framesPerTemporalLayer_[kH264EncoderMaxTemporalLayers];
+  // Totals of the attribute queue at the last report.
+  uint64_t attributesLostReported_;
+  uint64_t attributesMissedReported_;
+  int64_t lastStatsReportTime_;
+
   struct CachedFrameAttributes {
     uint32_t timestamp;
     uint64_t ntpTime;
     uint64_t captureRenderTime;
     uint32_t frameWidth;
     uint32_t frameHeight;
+    int64_t encodeStartTimeMs;
   };
   SampleAttributeQueue<CachedFrameAttributes> _sampleAttributeQueue;
+  // Input frames in flight, counted towards the frame memory budget.
+  FrameMemoryAccount frameMemory_;
+
+  // Newest frame not written yet because the pipeline was full,
+  // see H264EncoderDropPolicy::kDropOldest.
+  std::unique_ptr<VideoFrame> pendingFrame_;
+  bool keyFramePending_;
+  // Encoding a screencast: quality over speed, a low frame rate and no
+  // resolution steps.  Set by InitEncode().
+  bool screenContent_;
+  ComPtr<ICodecAPI> codecApi_;
+  // See SinkWriterState::inputDevice.
+  ComPtr<ID3D11Device> inputDevice_;
+  // Output type of the sink writer, updated by live frame rate changes.
+  ComPtr<IMFMediaType> mediaTypeOut_;
+
+  // Resolution of the sink writer being built by RebuildSinkWriter().
+  bool rebuildPending_;
+  UINT32 rebuildWidth_;
+  UINT32 rebuildHeight_;
+  // Signaled when no rebuild is running.
+  rtc::Event rebuildDone_;
+
+  // A task will write |pendingFrame_|, guarded by crit_ like the
+  // count of the tasks running.
+  bool pendingFrameScheduled_;
+  int pendingFrameTasks_;
+  // Signaled when no pending frame task is running.
+  rtc::Event pendingFrameTasksDone_;
+
+  // NAL units of the last encoded sample, kept to reuse the allocation.
+  std::vector<NalUnit> nalUnits_;
+
+  // NV12 input samples, recycled once the sink writer releases them.
+  // Keyed by the Y stride and the height of the captured frames.
+  ComPtr<SamplePool> inputSamplePool_;
 
   // Caching the codec received in InitEncode().
   VideoCodec codec_;
@@ -274,8 +274,9 @@ IFACEMETHODIMP H264MediaSink::OnClockSetRate(
 }
 
 HRESULT H264MediaSink::RegisterEncodingCallback(
-  IH264EncodingCallback *callback) {
-  return outputStream_->RegisterEncodingCallback(callback);
+  IH264EncodingCallback *callback, bool directDelivery, UINT32 generation) {
+  return outputStream_->RegisterEncodingCallback(callback, directDelivery,
+    generation);
 }
 
 }  // namespace webrtc
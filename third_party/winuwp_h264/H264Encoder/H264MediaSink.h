@@ -75,7 +75,9 @@ class H264MediaSink : public Microsoft::WRL::RuntimeClass<
   IFACEMETHOD(OnClockRestart) (MFTIME hnsSystemTime);
   IFACEMETHOD(OnClockSetRate) (MFTIME hnsSystemTime, float flRate);
 
-  HRESULT RegisterEncodingCallback(IH264EncodingCallback *callback);
+  // See H264StreamSink::RegisterEncodingCallback().
+  HRESULT RegisterEncodingCallback(IH264EncodingCallback *callback,
+    bool directDelivery, UINT32 generation);
 
  private:
   void HandleError(HRESULT hr);
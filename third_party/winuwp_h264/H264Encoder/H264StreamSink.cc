@@ -13,6 +13,7 @@
 #include <Windows.h>
 #include <mfapi.h>
 #include <mfidl.h>
+#include "../Utils/PipelineTrace.h"
 #include "../Utils/Utils.h"
 #include "webrtc/rtc_base/logging.h"
 
@@ -25,7 +26,13 @@ H264StreamSink::H264StreamSink()
   , state_(State_TypeNotSet)
   , isShutdown_(false)
   , workQueueId_(0)
-  , workQueueCB_(this, &H264StreamSink::OnDispatchWorkItem) {
+  , pendingOperations_(0)
+  , directDelivery_(false)
+  , delivering_(false)
+  , heldSamples_(0)
+  , workQueueCB_(this, &H264StreamSink::OnDispatchWorkItem)
+  , encodingCallback_(nullptr)
+  , encodingGeneration_(0) {
 }
 
 H264StreamSink::~H264StreamSink() {
@@ -182,20 +189,54 @@ IFACEMETHODIMP H264StreamSink::ProcessSample(IMFSample *pSample) {
     return E_INVALIDARG;
   }
 
+  LONGLONG sampleTime = 0;
+  pSample->GetSampleTime(&sampleTime);
+  ScopedPipelineStage stage("H264StreamSink.ProcessSample", sampleTime);
+
   HRESULT hr = S_OK;
+  bool deliver = false;
 
-  AutoLock lock(critSec_);
+  {
+    AutoLock lock(critSec_);
 
-  hr = CheckShutdown();
+    hr = CheckShutdown();
 
-  if (SUCCEEDED(hr)) {
-    hr = ValidateOperation(OpProcessSample);
+    if (SUCCEEDED(hr)) {
+      hr = ValidateOperation(OpProcessSample);
+    }
+
+    if (SUCCEEDED(hr)) {
+      if (directDelivery_ && !delivering_ && pendingOperations_ == 0 &&
+          sampleQueue_.empty()) {
+        // Nothing to keep the order with, no work item to allocate.
+        // The next sample is only requested once this one is delivered.
+        delivering_ = true;
+        deliver = true;
+      } else if (delivering_) {
+        // Its work item would deliver it before the direct one is done.
+        sampleQueue_.push_back(pSample);
+        ++heldSamples_;
+      } else {
+        sampleQueue_.push_back(pSample);
+
+        hr = QueueAsyncOperation(OpProcessSample);
+      }
+    }
   }
 
-  if (SUCCEEDED(hr)) {
-    sampleQueue_.push_back(pSample);
+  if (deliver) {
+    DeliverSample(pSample, "H264StreamSink.ProcessSample.Deliver");
 
-    hr = QueueAsyncOperation(OpProcessSample);
+    AutoLock lock(critSec_);
+    delivering_ = false;
+    hr = CheckShutdown();
+    for (; SUCCEEDED(hr) && heldSamples_ > 0; --heldSamples_) {
+      hr = QueueAsyncOperation(OpProcessSample);
+    }
+    heldSamples_ = 0;
+    if (SUCCEEDED(hr)) {
+      hr = QueueEvent(MEStreamSinkRequestSample, GUID_NULL, S_OK, nullptr);
+    }
   }
 
   return hr;
@@ -459,6 +500,10 @@ HRESULT H264StreamSink::QueueAsyncOperation(StreamOperation op, const PROPVARIAN
     hr = MFPutWorkItem2(workQueueId_, 0, &workQueueCB_, spOp.Get());
   }
 
+  if (SUCCEEDED(hr)) {
+    ++pendingOperations_;
+  }
+
   return hr;
 }
 
@@ -522,17 +567,33 @@ HRESULT H264StreamSink::OnDispatchWorkItem(IMFAsyncResult *pAsyncResult) {
   }
 
   if (SUCCEEDED(hr) && sample != nullptr) {
-    AutoLock lock(cbCritSec_);
-    if (encodingCallback_ != nullptr) {
-      encodingCallback_->OnH264Encoded(sample);
+    DeliverSample(sample.Get(), "H264StreamSink.OnDispatchWorkItem");
+  }
+
+  {
+    // Only once its sample is delivered, a direct one would overtake it.
+    AutoLock lock(critSec_);
+    if (pendingOperations_ > 0) {
+      --pendingOperations_;
     }
   }
 
   return hr;
 }
 
+void H264StreamSink::DeliverSample(IMFSample* sample, const char* stageName) {
+  LONGLONG sampleTime = 0;
+  sample->GetSampleTime(&sampleTime);
+  ScopedPipelineStage stage(stageName, sampleTime);
+  AutoLock lock(cbCritSec_);
+  if (encodingCallback_ != nullptr) {
+    encodingCallback_->OnH264Encoded(sample, encodingGeneration_);
+  }
+}
+
 bool H264StreamSink::DropSamplesFromQueue() {
   sampleQueue_.clear();
+  heldSamples_ = 0;
 
   return true;
 }
@@ -594,9 +655,14 @@ HRESULT AsyncStreamSinkOperation::GetPropVariant(PROPVARIANT* propVariant) {
 }
 
 HRESULT H264StreamSink::RegisterEncodingCallback(
-  IH264EncodingCallback *callback) {
+  IH264EncodingCallback *callback, bool directDelivery, UINT32 generation) {
+  {
+    AutoLock lock(critSec_);
+    directDelivery_ = directDelivery;
+  }
   AutoLock lock(cbCritSec_);
   encodingCallback_ = callback;
+  encodingGeneration_ = generation;
   return S_OK;
 }
 
@@ -112,7 +112,15 @@ class H264StreamSink : public Microsoft::WRL::RuntimeClass<
   // are valid from which states.
   static BOOL ValidStateMatrix[State_Count][Op_Count];
 
-  HRESULT RegisterEncodingCallback(IH264EncodingCallback *callback);
+  // With |directDelivery| the samples are handed to |callback| from
+  // ProcessSample(), on the thread of the sink writer, while no
+  // operation is waiting on the work queue.  The next sample is
+  // requested once the callback returned, the callback must not write
+  // to the sink writer.  Otherwise, and for the
+  // state changes, they go through the work queue.  |generation| is
+  // handed back with each sample.
+  HRESULT RegisterEncodingCallback(IH264EncodingCallback *callback,
+    bool directDelivery, UINT32 generation);
 
   H264StreamSink();
   virtual ~H264StreamSink();
@@ -139,6 +147,7 @@ class H264StreamSink : public Microsoft::WRL::RuntimeClass<
 
   bool        DropSamplesFromQueue();
   ComPtr<IMFSample> ProcessSamplesFromQueue();
+  void        DeliverSample(IMFSample* sample, const char* stageName);
   void        ProcessFormatChange();
 
   void        HandleError(HRESULT hr);
@@ -153,6 +162,15 @@ class H264StreamSink : public Microsoft::WRL::RuntimeClass<
   GUID                        guidCurrentSubtype_;
 
   DWORD                       workQueueId_;
+  // Operations put on the work queue and not dispatched yet, the
+  // samples can't skip them.
+  uint32_t                    pendingOperations_;
+  bool                        directDelivery_;
+  // A sample is being delivered from ProcessSample().  The samples
+  // arriving meanwhile are queued without their work item, which is
+  // queued once the delivery is done: |heldSamples_| of them.
+  bool                        delivering_;
+  uint32_t                    heldSamples_;
 
   ComPtr<IMFMediaSink>        spSink_;
   ComPtr<IMFMediaEventQueue>  spEventQueue_;
@@ -163,6 +181,7 @@ class H264StreamSink : public Microsoft::WRL::RuntimeClass<
   AsyncCallback<H264StreamSink>               workQueueCB_;
 
   IH264EncodingCallback*                      encodingCallback_;
+  UINT32                                      encodingGeneration_;
 };
 
 }  // namespace webrtc
@@ -17,7 +17,10 @@
 namespace webrtc {
 
 interface IH264EncodingCallback {
-    virtual void OnH264Encoded(Microsoft::WRL::ComPtr<IMFSample> sample) = 0;
+    // |generation| is the one the callback was registered with, it tells
+    // the samples of a sink writer being replaced from the current ones.
+    virtual void OnH264Encoded(Microsoft::WRL::ComPtr<IMFSample> sample,
+      UINT32 generation) = 0;
 };
 
 }  // namespace webrtc
@@ -0,0 +1,77 @@
+/*
+*  Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+#include "third_party/winuwp_h264/Utils/AppSuspend.h"
+
+#include <algorithm>
+#include <vector>
+#include "webrtc/rtc_base/criticalsection.h"
+#include "webrtc/rtc_base/logging.h"
+
+namespace webrtc {
+
+namespace {
+rtc::CriticalSection& ObserversLock() {
+  static rtc::CriticalSection lock;
+  return lock;
+}
+
+// Guarded by ObserversLock().
+std::vector<AppSuspendObserver*>& Observers() {
+  static std::vector<AppSuspendObserver*> observers;
+  return observers;
+}
+
+bool gSuspended = false;
+}  // namespace
+
+void AddAppSuspendObserver(AppSuspendObserver* observer) {
+  rtc::CritScope lock(&ObserversLock());
+  Observers().push_back(observer);
+}
+
+void RemoveAppSuspendObserver(AppSuspendObserver* observer) {
+  rtc::CritScope lock(&ObserversLock());
+  auto& observers = Observers();
+  observers.erase(std::remove(observers.begin(), observers.end(), observer),
+    observers.end());
+}
+
+void NotifyAppSuspending() {
+  rtc::CritScope lock(&ObserversLock());
+  if (gSuspended) {
+    return;
+  }
+  gSuspended = true;
+  LOG(LS_INFO) << "App suspending, trimming " << Observers().size()
+    << " codecs";
+  for (auto observer : Observers()) {
+    observer->OnAppSuspending();
+  }
+}
+
+void NotifyAppResuming() {
+  rtc::CritScope lock(&ObserversLock());
+  if (!gSuspended) {
+    return;
+  }
+  gSuspended = false;
+  LOG(LS_INFO) << "App resuming";
+  for (auto observer : Observers()) {
+    observer->OnAppResuming();
+  }
+}
+
+bool IsAppSuspended() {
+  rtc::CritScope lock(&ObserversLock());
+  return gSuspended;
+}
+
+}  // namespace webrtc
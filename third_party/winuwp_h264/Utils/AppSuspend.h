@@ -0,0 +1,43 @@
+/*
+*  Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+#ifndef THIRD_PARTY_H264_WINUWP_UTILS_APPSUSPEND_H_
+#define THIRD_PARTY_H264_WINUWP_UTILS_APPSUSPEND_H_
+
+namespace webrtc {
+
+// Told when the app is suspended and resumed.  On suspend the codecs
+// release the samples and queued frames they can do without, and keep
+// the transforms and their media types, so that on resume the calls go
+// on from the next key frame instead of rebuilding the pipelines.
+class AppSuspendObserver {
+ public:
+  virtual void OnAppSuspending() = 0;
+  virtual void OnAppResuming() = 0;
+
+ protected:
+  virtual ~AppSuspendObserver() {}
+};
+
+// The notifications are delivered with the registry locked, so once
+// RemoveAppSuspendObserver() returns, the observer isn't called
+// anymore.  Observers must not add or remove observers from them.
+void AddAppSuspendObserver(AppSuspendObserver* observer);
+void RemoveAppSuspendObserver(AppSuspendObserver* observer);
+
+// Called by the app lifecycle handlers, nothing happens if the state
+// doesn't change.
+void NotifyAppSuspending();
+void NotifyAppResuming();
+bool IsAppSuspended();
+
+}  // namespace webrtc
+
+#endif  // THIRD_PARTY_H264_WINUWP_UTILS_APPSUSPEND_H_
@@ -0,0 +1,122 @@
+/*
+*  Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+#include "third_party/winuwp_h264/Utils/FrameMemoryBudget.h"
+
+#include <algorithm>
+#include <vector>
+#include "webrtc/rtc_base/criticalsection.h"
+#include "webrtc/rtc_base/logging.h"
+
+namespace webrtc {
+
+namespace {
+std::atomic<uint64_t> gBudget(0);
+std::atomic<int64_t> gHeld(0);
+std::atomic<int64_t> gPeak(0);
+std::atomic<uint64_t> gBudgetDrops(0);
+std::atomic<bool> gOverBudgetLogged(false);
+
+// The accounts, only to report them.
+rtc::CriticalSection& AccountsLock() {
+  static rtc::CriticalSection lock;
+  return lock;
+}
+
+std::vector<FrameMemoryAccount*>& Accounts() {
+  static std::vector<FrameMemoryAccount*> accounts;
+  return accounts;
+}
+
+void UpdateHeld(int64_t delta) {
+  int64_t held = gHeld.fetch_add(delta, std::memory_order_relaxed) + delta;
+  int64_t peak = gPeak.load(std::memory_order_relaxed);
+  while (held > peak &&
+    !gPeak.compare_exchange_weak(peak, held, std::memory_order_relaxed)) {
+  }
+}
+}  // namespace
+
+void SetFrameMemoryBudget(uint64_t bytes) {
+  gBudget = bytes;
+  gOverBudgetLogged = false;
+}
+
+uint64_t GetFrameMemoryBudget() {
+  return gBudget;
+}
+
+int64_t GetFrameMemoryHeld() {
+  return gHeld.load(std::memory_order_relaxed);
+}
+
+int64_t GetFrameMemoryPeak() {
+  return gPeak.load(std::memory_order_relaxed);
+}
+
+uint64_t GetFrameMemoryBudgetDrops() {
+  return gBudgetDrops;
+}
+
+void GetFrameMemoryAccounts(std::map<std::string, int64_t>* accounts) {
+  rtc::CritScope lock(&AccountsLock());
+  for (auto account : Accounts()) {
+    (*accounts)[account->name()] += account->held();
+  }
+}
+
+FrameMemoryAccount::FrameMemoryAccount(const char* name)
+  : name_(name)
+  , held_(0) {
+  rtc::CritScope lock(&AccountsLock());
+  Accounts().push_back(this);
+}
+
+FrameMemoryAccount::~FrameMemoryAccount() {
+  {
+    rtc::CritScope lock(&AccountsLock());
+    auto& accounts = Accounts();
+    accounts.erase(std::remove(accounts.begin(), accounts.end(), this),
+      accounts.end());
+  }
+  UpdateHeld(-held_.exchange(0));
+}
+
+void FrameMemoryAccount::Add(size_t bytes) {
+  held_.fetch_add((int64_t)bytes, std::memory_order_relaxed);
+  UpdateHeld((int64_t)bytes);
+}
+
+void FrameMemoryAccount::Remove(size_t bytes) {
+  held_.fetch_sub((int64_t)bytes, std::memory_order_relaxed);
+  UpdateHeld(-(int64_t)bytes);
+}
+
+void FrameMemoryAccount::Set(size_t bytes) {
+  int64_t previous = held_.exchange((int64_t)bytes, std::memory_order_relaxed);
+  UpdateHeld((int64_t)bytes - previous);
+}
+
+bool FrameMemoryAccount::WouldExceedBudget(size_t bytes) const {
+  uint64_t budget = gBudget.load(std::memory_order_relaxed);
+  return budget > 0 &&
+    GetFrameMemoryHeld() + (int64_t)bytes > (int64_t)budget;
+}
+
+void FrameMemoryAccount::OnFrameDropped() {
+  ++gBudgetDrops;
+  if (!gOverBudgetLogged.exchange(true)) {
+    LOG(LS_WARNING) << "Video frame memory budget of " << gBudget
+      << " bytes exceeded by " << name_ << ", "
+      << GetFrameMemoryHeld() << " bytes held";
+  }
+}
+
+}  // namespace webrtc
@@ -0,0 +1,70 @@
+/*
+*  Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+#ifndef THIRD_PARTY_H264_WINUWP_UTILS_FRAMEMEMORYBUDGET_H_
+#define THIRD_PARTY_H264_WINUWP_UTILS_FRAMEMEMORYBUDGET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <string>
+
+namespace webrtc {
+
+// Process wide budget of the memory held by the video frames waiting in
+// the queues of the pipelines: encoder samples in flight, render queues.
+// The queues count what they hold with a FrameMemoryAccount and, once
+// the budget is exceeded, give up frames the way they do when full: the
+// encoder drops new frames, the renderers resume from the next IDR
+// frame.  0, the default, is no budget.
+void SetFrameMemoryBudget(uint64_t bytes);
+uint64_t GetFrameMemoryBudget();
+// Bytes held by all the accounts.
+int64_t GetFrameMemoryHeld();
+// Highest value of GetFrameMemoryHeld() since the process started.
+int64_t GetFrameMemoryPeak();
+// Frames given up because of the budget.
+uint64_t GetFrameMemoryBudgetDrops();
+// Bytes held by the live accounts, summed by name: the accounts of all
+// the renderers share one name, those of all the encoders another.
+void GetFrameMemoryAccounts(std::map<std::string, int64_t>* accounts);
+
+// Bytes held by one queue.  Thread safe, the held bytes are given back
+// when the account is destroyed.
+class FrameMemoryAccount {
+ public:
+  explicit FrameMemoryAccount(const char* name);
+  ~FrameMemoryAccount();
+
+  void Add(size_t bytes);
+  void Remove(size_t bytes);
+  // For the queues which know their total rather than each frame.
+  void Set(size_t bytes);
+  int64_t held() const {
+    return held_.load(std::memory_order_relaxed);
+  }
+  const char* name() const {
+    return name_;
+  }
+
+  // True if holding |bytes| more would exceed the budget.
+  bool WouldExceedBudget(size_t bytes) const;
+  // A frame was given up because of the budget.
+  void OnFrameDropped();
+
+ private:
+  const char* const name_;
+  std::atomic<int64_t> held_;
+};
+
+}  // namespace webrtc
+
+#endif  // THIRD_PARTY_H264_WINUWP_UTILS_FRAMEMEMORYBUDGET_H_
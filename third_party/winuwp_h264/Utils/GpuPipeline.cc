@@ -0,0 +1,150 @@
+/*
+*  Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+#include "third_party/winuwp_h264/Utils/GpuPipeline.h"
+
+#include <vector>
+#include "webrtc/rtc_base/criticalsection.h"
+
+using Microsoft::WRL::ComPtr;
+
+namespace {
+// The managers added for one device, oldest first.  A device keeps the
+// manager it was first added with until it has none left.
+struct DeviceManagers {
+  ComPtr<ID3D11Device> device;
+  ComPtr<IMFDXGIDeviceManager> manager;
+  std::vector<IMFDXGIDeviceManager*> added;
+};
+typedef std::vector<DeviceManagers> DeviceManagersList;
+
+rtc::CriticalSection gpuPipelineCrit_;
+bool gpuPipelineEnabled_ = false;
+// Guarded by gpuPipelineCrit_, the last added device last.
+DeviceManagersList sharedDeviceManagers_;
+DeviceManagersList encoderDeviceManagers_;
+
+void AddDeviceManager(DeviceManagersList* list,
+  IMFDXGIDeviceManager* deviceManager) {
+  if (deviceManager == nullptr) {
+    return;
+  }
+  ComPtr<ID3D11Device> device = GetDXGIManagerDevice(deviceManager);
+  rtc::CritScope lock(&gpuPipelineCrit_);
+  for (auto it = list->begin(); it != list->end(); ++it) {
+    if (it->device == device) {
+      DeviceManagers entry = *it;
+      entry.added.push_back(deviceManager);
+      list->erase(it);
+      list->push_back(entry);
+      return;
+    }
+  }
+  DeviceManagers entry;
+  entry.device = device;
+  entry.manager = deviceManager;
+  entry.added.push_back(deviceManager);
+  list->push_back(entry);
+}
+
+void RemoveDeviceManager(DeviceManagersList* list,
+  IMFDXGIDeviceManager* deviceManager) {
+  rtc::CritScope lock(&gpuPipelineCrit_);
+  for (auto it = list->begin(); it != list->end(); ++it) {
+    for (auto added = it->added.begin(); added != it->added.end(); ++added) {
+      if (*added == deviceManager) {
+        it->added.erase(added);
+        if (it->added.empty()) {
+          list->erase(it);
+        }
+        return;
+      }
+    }
+  }
+}
+}  // namespace
+
+void SetGpuPipelineEnabled(bool enabled) {
+  rtc::CritScope lock(&gpuPipelineCrit_);
+  gpuPipelineEnabled_ = enabled;
+}
+
+bool IsGpuPipelineEnabled() {
+  rtc::CritScope lock(&gpuPipelineCrit_);
+  return gpuPipelineEnabled_;
+}
+
+void AddSharedDXGIDeviceManager(IMFDXGIDeviceManager* deviceManager) {
+  AddDeviceManager(&sharedDeviceManagers_, deviceManager);
+}
+
+void RemoveSharedDXGIDeviceManager(IMFDXGIDeviceManager* deviceManager) {
+  RemoveDeviceManager(&sharedDeviceManagers_, deviceManager);
+}
+
+ComPtr<IMFDXGIDeviceManager> GetSharedDXGIDeviceManager() {
+  rtc::CritScope lock(&gpuPipelineCrit_);
+  if (!gpuPipelineEnabled_ || sharedDeviceManagers_.size() != 1) {
+    return nullptr;
+  }
+  return sharedDeviceManagers_.front().manager;
+}
+
+void AddEncoderDXGIDeviceManager(IMFDXGIDeviceManager* deviceManager) {
+  AddDeviceManager(&encoderDeviceManagers_, deviceManager);
+}
+
+void RemoveEncoderDXGIDeviceManager(IMFDXGIDeviceManager* deviceManager) {
+  RemoveDeviceManager(&encoderDeviceManagers_, deviceManager);
+}
+
+ComPtr<IMFDXGIDeviceManager> GetEncoderDXGIDeviceManager() {
+  rtc::CritScope lock(&gpuPipelineCrit_);
+  if (encoderDeviceManagers_.empty()) {
+    return nullptr;
+  }
+  return encoderDeviceManagers_.back().manager;
+}
+
+ComPtr<ID3D11Device> GetDXGIManagerDevice(IMFDXGIDeviceManager* deviceManager) {
+  ComPtr<ID3D11Device> device;
+  HANDLE deviceHandle = nullptr;
+  if (deviceManager == nullptr ||
+    FAILED(deviceManager->OpenDeviceHandle(&deviceHandle))) {
+    return device;
+  }
+  deviceManager->GetVideoService(deviceHandle, IID_PPV_ARGS(&device));
+  deviceManager->CloseDeviceHandle(deviceHandle);
+  return device;
+}
+
+ComPtr<IMFMediaBuffer> GetNV12TextureBuffer(IMFSample* sample,
+  ID3D11Device* device, UINT width, UINT height) {
+  ComPtr<IMFMediaBuffer> mediaBuffer;
+  ComPtr<IMFDXGIBuffer> dxgiBuffer;
+  ComPtr<ID3D11Texture2D> texture;
+  DWORD bufferCount = 0;
+  if (sample == nullptr || device == nullptr ||
+    FAILED(sample->GetBufferCount(&bufferCount)) || bufferCount != 1 ||
+    FAILED(sample->GetBufferByIndex(0, &mediaBuffer)) ||
+    FAILED(mediaBuffer.As(&dxgiBuffer)) ||
+    FAILED(dxgiBuffer->GetResource(IID_PPV_ARGS(&texture)))) {
+    return nullptr;
+  }
+  ComPtr<ID3D11Device> textureDevice;
+  texture->GetDevice(&textureDevice);
+  D3D11_TEXTURE2D_DESC desc;
+  texture->GetDesc(&desc);
+  if (textureDevice.Get() != device || desc.Format != DXGI_FORMAT_NV12 ||
+    desc.Width != width || desc.Height != height) {
+    return nullptr;
+  }
+  return mediaBuffer;
+}
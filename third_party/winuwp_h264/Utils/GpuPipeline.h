@@ -0,0 +1,52 @@
+/*
+*  Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+#ifndef THIRD_PARTY_H264_WINUWP_UTILS_GPUPIPELINE_H_
+#define THIRD_PARTY_H264_WINUWP_UTILS_GPUPIPELINE_H_
+
+#include <wrl.h>
+#include <d3d11.h>
+#include <mfidl.h>
+
+// Opt-in GPU video pipeline.  When enabled, the DXGI device manager the
+// media element hands to our media source is shared with the decoder so
+// decoded pictures can stay in D3D11 textures all the way to rendering.
+void SetGpuPipelineEnabled(bool enabled);
+bool IsGpuPipelineEnabled();
+
+// The media sources add the device manager their media element hands
+// them and remove it when they are shut down.  The managers are counted
+// by device, the decoders don't know which element will render their
+// pictures: GetSharedDXGIDeviceManager() returns a manager only while
+// all the live media sources render on the same device, null otherwise
+// or if the pipeline is disabled.
+void AddSharedDXGIDeviceManager(IMFDXGIDeviceManager* deviceManager);
+void RemoveSharedDXGIDeviceManager(IMFDXGIDeviceManager* deviceManager);
+Microsoft::WRL::ComPtr<IMFDXGIDeviceManager> GetSharedDXGIDeviceManager();
+
+// Device managers of the D3D11 devices apps push their textures from,
+// counted by device like the shared ones.  The H264 encoders built from
+// then on, with a hardware encoder, take the NV12 textures of the device
+// added last without reading them back, the textures of the other
+// devices are read back.  Regardless of IsGpuPipelineEnabled().
+void AddEncoderDXGIDeviceManager(IMFDXGIDeviceManager* deviceManager);
+void RemoveEncoderDXGIDeviceManager(IMFDXGIDeviceManager* deviceManager);
+Microsoft::WRL::ComPtr<IMFDXGIDeviceManager> GetEncoderDXGIDeviceManager();
+
+// The device behind |deviceManager|, null if it has none.
+Microsoft::WRL::ComPtr<ID3D11Device> GetDXGIManagerDevice(
+  IMFDXGIDeviceManager* deviceManager);
+
+// The buffer of |sample| if it is a |width|x|height| NV12 texture of
+// |device|, null otherwise.
+Microsoft::WRL::ComPtr<IMFMediaBuffer> GetNV12TextureBuffer(
+  IMFSample* sample, ID3D11Device* device, UINT width, UINT height);
+
+#endif  // THIRD_PARTY_H264_WINUWP_UTILS_GPUPIPELINE_H_
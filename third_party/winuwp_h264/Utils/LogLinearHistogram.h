@@ -0,0 +1,78 @@
+/*
+*  Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+#ifndef THIRD_PARTY_H264_WINUWP_UTILS_LOGLINEARHISTOGRAM_H_
+#define THIRD_PARTY_H264_WINUWP_UTILS_LOGLINEARHISTOGRAM_H_
+
+#include <stdint.h>
+#include <algorithm>
+
+namespace webrtc {
+
+// Buckets of a histogram in a fixed array, adding a value is constant
+// time.  The values below 16 have a bucket each, the larger ones 8
+// buckets per power of two, a percentile is at most 12.5% above the
+// value.  The values from 2^|kMaxOrder| on share the last bucket.  The
+// array and its counters belong to the user, they may be atomic.
+template <int kMaxOrder>
+class LogLinearBuckets {
+ public:
+  static const int kLinearBuckets = 16;
+  static const int kSubBuckets = 8;
+  static const int kCount = kLinearBuckets + (kMaxOrder - 4) * kSubBuckets;
+
+  // Bucket of |value|, which must not be negative.
+  static int Index(int64_t value) {
+    if (value < kLinearBuckets) {
+      return static_cast<int>(value);
+    }
+    int order = 4;
+    while (order < kMaxOrder && (value >> (order + 1)) != 0) {
+      ++order;
+    }
+    if (order >= kMaxOrder) {
+      return kCount - 1;
+    }
+    // The 3 bits after the highest one.
+    int subBucket = static_cast<int>(value >> (order - 3)) & (kSubBuckets - 1);
+    return kLinearBuckets + (order - 4) * kSubBuckets + subBucket;
+  }
+
+  static int64_t UpperBound(int index) {
+    if (index < kLinearBuckets) {
+      return index;
+    }
+    int order = 4 + (index - kLinearBuckets) / kSubBuckets;
+    int subBucket = (index - kLinearBuckets) % kSubBuckets;
+    int64_t width = int64_t(1) << (order - 3);
+    return (kSubBuckets + subBucket) * width + width - 1;
+  }
+
+  // Upper bound of the bucket holding the |percent| percentile of the
+  // |count| values in |buckets|, within their |min| and |max|.
+  template <typename Counter>
+  static int64_t Percentile(const Counter* buckets, uint64_t count,
+    int64_t min, int64_t max, int percent) {
+    // Rank of the value, from 1.
+    uint64_t rank = std::max<uint64_t>((count * percent + 99) / 100, 1);
+    uint64_t seen = 0;
+    for (int i = 0; i < kCount; ++i) {
+      seen += buckets[i];
+      if (seen >= rank) {
+        return std::min(std::max(UpperBound(i), min), max);
+      }
+    }
+    return max;
+  }
+};
+
+}  // namespace webrtc
+
+#endif  // THIRD_PARTY_H264_WINUWP_UTILS_LOGLINEARHISTOGRAM_H_
@@ -0,0 +1,301 @@
+/*
+*  Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+#include "third_party/winuwp_h264/Utils/MftCapabilities.h"
+
+#include <Windows.h>
+#include <mfapi.h>
+#include <mfidl.h>
+#include <mftransform.h>
+#include <strmif.h>
+#include <codecapi.h>
+#include <wrl.h>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <vector>
+
+#include "third_party/winuwp_h264/Utils/Utils.h"
+#include "webrtc/rtc_base/criticalsection.h"
+#include "webrtc/rtc_base/logging.h"
+#include "webrtc/rtc_base/timeutils.h"
+#include "webrtc/rtc_base/win32.h"
+
+#pragma comment(lib, "mfplat")
+#pragma comment(lib, "mfuuid.lib")
+
+using Microsoft::WRL::ComPtr;
+
+namespace webrtc {
+
+namespace {
+
+rtc::CriticalSection& CapabilitiesLock() {
+  static rtc::CriticalSection lock;
+  return lock;
+}
+
+H264MftCapabilities& Capabilities() {
+  static H264MftCapabilities capabilities;
+  return capabilities;
+}
+
+struct ProbeFormat {
+  uint32_t width;
+  uint32_t height;
+  uint32_t fps;
+};
+
+// Tried in order, the first one the MFT accepts is its limit.
+const ProbeFormat kProbeFormats[] = {
+  { 3840, 2160, 60 },
+  { 3840, 2160, 30 },
+  { 1920, 1080, 60 },
+  { 1920, 1080, 30 },
+  { 1280, 720, 30 },
+  { 640, 480, 30 },
+};
+
+std::string GetMftName(IMFActivate* activate) {
+  wchar_t* name = nullptr;
+  UINT32 length = 0;
+  if (FAILED(activate->GetAllocatedString(MFT_FRIENDLY_NAME_Attribute,
+    &name, &length))) {
+    return "unknown";
+  }
+  std::string result = rtc::ToUtf8(name, length);
+  CoTaskMemFree(name);
+  return result;
+}
+
+bool IsHardwareMft(IMFActivate* activate) {
+  UINT32 flags = 0;
+  return SUCCEEDED(activate->GetUINT32(MF_TRANSFORM_FLAGS_Attribute, &flags)) &&
+    (flags & MFT_ENUM_FLAG_HARDWARE) != 0;
+}
+
+// Lists the MFTs, cheap enough to decide whether the cache is still valid.
+std::string Fingerprint(const std::vector<ComPtr<IMFActivate>>& encoders,
+  const std::vector<ComPtr<IMFActivate>>& decoders) {
+  std::ostringstream fingerprint;
+  for (auto& mft : encoders) {
+    fingerprint << "E:" << GetMftName(mft.Get()) << ":" << IsHardwareMft(mft.Get()) << ";";
+  }
+  for (auto& mft : decoders) {
+    fingerprint << "D:" << GetMftName(mft.Get()) << ":" << IsHardwareMft(mft.Get()) << ";";
+  }
+  return fingerprint.str();
+}
+
+HRESULT CreateH264Type(const ProbeFormat& format, IMFMediaType** mediaType) {
+  HRESULT hr = S_OK;
+  ComPtr<IMFMediaType> type;
+  ON_SUCCEEDED(MFCreateMediaType(&type));
+  ON_SUCCEEDED(type->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video));
+  ON_SUCCEEDED(type->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_H264));
+  ON_SUCCEEDED(type->SetUINT32(MF_MT_AVG_BITRATE,
+    format.width * format.height * 2));
+  ON_SUCCEEDED(type->SetUINT32(
+    MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive));
+  ON_SUCCEEDED(MFSetAttributeSize(type.Get(),
+    MF_MT_FRAME_SIZE, format.width, format.height));
+  ON_SUCCEEDED(MFSetAttributeRatio(type.Get(),
+    MF_MT_FRAME_RATE, format.fps, 1));
+  if (SUCCEEDED(hr)) {
+    *mediaType = type.Detach();
+  }
+  return hr;
+}
+
+// Activates the MFT to find out its limits.
+H264MftInfo ProbeMft(IMFActivate* activate, bool encoder) {
+  H264MftInfo info;
+  info.available = true;
+  info.hardware = IsHardwareMft(activate);
+  info.name = GetMftName(activate);
+
+  ComPtr<IMFTransform> transform;
+  if (FAILED(activate->ActivateObject(IID_PPV_ARGS(&transform)))) {
+    return info;
+  }
+
+  // Asynchronous MFTs reject most calls until unlocked.
+  ComPtr<IMFAttributes> attributes;
+  UINT32 async = FALSE;
+  if (SUCCEEDED(transform->GetAttributes(&attributes)) &&
+    SUCCEEDED(attributes->GetUINT32(MF_TRANSFORM_ASYNC, &async)) && async) {
+    attributes->SetUINT32(MF_TRANSFORM_ASYNC_UNLOCK, TRUE);
+  }
+
+  ComPtr<ICodecAPI> codecApi;
+  if (SUCCEEDED(transform.As(&codecApi))) {
+    info.lowLatency =
+      codecApi->IsSupported(&CODECAPI_AVLowLatencyMode) == S_OK;
+  }
+  if (!info.lowLatency && attributes != nullptr) {
+    UINT32 lowLatency = FALSE;
+    info.lowLatency = SUCCEEDED(attributes->GetUINT32(MF_LOW_LATENCY, &lowLatency));
+  }
+
+  for (auto& format : kProbeFormats) {
+    ComPtr<IMFMediaType> type;
+    if (FAILED(CreateH264Type(format, &type))) {
+      break;
+    }
+    HRESULT hr = encoder ?
+      transform->SetOutputType(0, type.Get(), MFT_SET_TYPE_TEST_ONLY) :
+      transform->SetInputType(0, type.Get(), MFT_SET_TYPE_TEST_ONLY);
+    if (SUCCEEDED(hr)) {
+      info.maxWidth = format.width;
+      info.maxHeight = format.height;
+      info.maxFps = format.fps;
+      break;
+    }
+  }
+
+  activate->ShutdownObject();
+  return info;
+}
+
+void WriteInfo(std::ostream& out, const char* prefix, const H264MftInfo& info) {
+  out << prefix << ".available=" << info.available << "\n";
+  out << prefix << ".hardware=" << info.hardware << "\n";
+  out << prefix << ".lowLatency=" << info.lowLatency << "\n";
+  out << prefix << ".maxWidth=" << info.maxWidth << "\n";
+  out << prefix << ".maxHeight=" << info.maxHeight << "\n";
+  out << prefix << ".maxFps=" << info.maxFps << "\n";
+  out << prefix << ".name=" << info.name << "\n";
+}
+
+H264MftInfo ReadInfo(std::map<std::string, std::string>& values,
+  const std::string& prefix) {
+  H264MftInfo info;
+  info.available = values[prefix + ".available"] == "1";
+  info.hardware = values[prefix + ".hardware"] == "1";
+  info.lowLatency = values[prefix + ".lowLatency"] == "1";
+  info.maxWidth = strtoul(values[prefix + ".maxWidth"].c_str(), nullptr, 10);
+  info.maxHeight = strtoul(values[prefix + ".maxHeight"].c_str(), nullptr, 10);
+  info.maxFps = strtoul(values[prefix + ".maxFps"].c_str(), nullptr, 10);
+  info.name = values[prefix + ".name"];
+  return info;
+}
+
+bool LoadCache(const std::string& cacheFile, const std::string& fingerprint,
+  H264MftCapabilities* capabilities) {
+  std::ifstream in(cacheFile);
+  if (!in) {
+    return false;
+  }
+  std::map<std::string, std::string> values;
+  std::string line;
+  while (std::getline(in, line)) {
+    size_t separator = line.find('=');
+    if (separator != std::string::npos) {
+      values[line.substr(0, separator)] = line.substr(separator + 1);
+    }
+  }
+  if (values["fingerprint"] != fingerprint) {
+    return false;
+  }
+  capabilities->encoder = ReadInfo(values, "encoder");
+  capabilities->decoder = ReadInfo(values, "decoder");
+  capabilities->probed = true;
+  return true;
+}
+
+void SaveCache(const std::string& cacheFile, const std::string& fingerprint,
+  const H264MftCapabilities& capabilities) {
+  std::ofstream out(cacheFile, std::ios::trunc);
+  if (!out) {
+    LOG(LS_WARNING) << "Can't write the MFT capabilities to " << cacheFile;
+    return;
+  }
+  out << "fingerprint=" << fingerprint << "\n";
+  WriteInfo(out, "encoder", capabilities.encoder);
+  WriteInfo(out, "decoder", capabilities.decoder);
+}
+
+}  // namespace
+
+std::vector<ComPtr<IMFActivate>> EnumerateH264Mfts(bool encoder) {
+  std::vector<ComPtr<IMFActivate>> mfts;
+  MFT_REGISTER_TYPE_INFO h264Type = { MFMediaType_Video, MFVideoFormat_H264 };
+  UINT32 flags = MFT_ENUM_FLAG_HARDWARE | MFT_ENUM_FLAG_SYNCMFT |
+    MFT_ENUM_FLAG_ASYNCMFT | MFT_ENUM_FLAG_SORTANDFILTER;
+  IMFActivate** activates = nullptr;
+  UINT32 count = 0;
+  if (FAILED(MFTEnumEx(
+    encoder ? MFT_CATEGORY_VIDEO_ENCODER : MFT_CATEGORY_VIDEO_DECODER,
+    flags, encoder ? nullptr : &h264Type, encoder ? &h264Type : nullptr,
+    &activates, &count))) {
+    return mfts;
+  }
+  for (UINT32 i = 0; i < count; ++i) {
+    mfts.push_back(activates[i]);
+    activates[i]->Release();
+  }
+  CoTaskMemFree(activates);
+  return mfts;
+}
+
+void ProbeH264MftCapabilities(const std::string& cacheFile) {
+  int64_t startTime = rtc::TimeMillis();
+  if (FAILED(MFStartup(MF_VERSION))) {
+    return;
+  }
+
+  std::vector<ComPtr<IMFActivate>> encoders = EnumerateH264Mfts(true);
+  std::vector<ComPtr<IMFActivate>> decoders = EnumerateH264Mfts(false);
+  std::string fingerprint = Fingerprint(encoders, decoders);
+
+  H264MftCapabilities capabilities;
+  bool cached = !cacheFile.empty() &&
+    LoadCache(cacheFile, fingerprint, &capabilities);
+  if (!cached) {
+    if (!encoders.empty()) {
+      capabilities.encoder = ProbeMft(encoders[0].Get(), true);
+    }
+    if (!decoders.empty()) {
+      capabilities.decoder = ProbeMft(decoders[0].Get(), false);
+    }
+    capabilities.probed = true;
+    if (!cacheFile.empty()) {
+      SaveCache(cacheFile, fingerprint, capabilities);
+    }
+  }
+
+  LOG(LS_INFO) << "H264 encoder MFT: " << capabilities.encoder.name
+    << (capabilities.encoder.hardware ? " (hardware)" : " (software)")
+    << " max " << capabilities.encoder.maxWidth << "x"
+    << capabilities.encoder.maxHeight << "@" << capabilities.encoder.maxFps
+    << " low latency=" << capabilities.encoder.lowLatency;
+  LOG(LS_INFO) << "H264 decoder MFT: " << capabilities.decoder.name
+    << (capabilities.decoder.hardware ? " (hardware)" : " (software)");
+  LOG(LS_INFO) << "H264 MFT capabilities "
+    << (cached ? "loaded from cache" : "probed") << " in "
+    << (rtc::TimeMillis() - startTime) << "ms";
+
+  MFShutdown();
+
+  rtc::CritScope lock(&CapabilitiesLock());
+  Capabilities() = capabilities;
+}
+
+H264MftCapabilities GetH264MftCapabilities() {
+  rtc::CritScope lock(&CapabilitiesLock());
+  return Capabilities();
+}
+
+HRESULT KeepMediaFoundationStarted() {
+  static const HRESULT hr = MFStartup(MF_VERSION);
+  return hr;
+}
+
+}  // namespace webrtc
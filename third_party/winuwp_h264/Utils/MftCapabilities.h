@@ -0,0 +1,69 @@
+/*
+*  Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+#ifndef THIRD_PARTY_H264_WINUWP_UTILS_MFTCAPABILITIES_H_
+#define THIRD_PARTY_H264_WINUWP_UTILS_MFTCAPABILITIES_H_
+
+#include <mfidl.h>
+#include <stdint.h>
+#include <wrl.h>
+#include <string>
+#include <vector>
+
+namespace webrtc {
+
+// What the best H.264 encoder or decoder MFT of the device can do.
+struct H264MftInfo {
+  H264MftInfo()
+    : available(false), hardware(false), lowLatency(false),
+    maxWidth(0), maxHeight(0), maxFps(0) {}
+
+  bool available;
+  bool hardware;
+  bool lowLatency;
+  // 0 if unknown.
+  uint32_t maxWidth;
+  uint32_t maxHeight;
+  uint32_t maxFps;
+  // Friendly name, UTF-8.
+  std::string name;
+};
+
+struct H264MftCapabilities {
+  H264MftCapabilities() : probed(false) {}
+
+  bool probed;
+  H264MftInfo encoder;
+  H264MftInfo decoder;
+};
+
+// H.264 encoder or decoder MFTs of the device, the one Media Foundation
+// would pick first.  Hardware MFTs come before software ones.
+std::vector<Microsoft::WRL::ComPtr<IMFActivate>> EnumerateH264Mfts(
+  bool encoder);
+
+// Enumerates the H.264 MFTs with MFTEnumEx and probes the limits of the
+// one Media Foundation would pick.  Activating a hardware MFT is slow, so
+// the result is kept in |cacheFile| and reused as long as the list of
+// MFTs is the same.  Meant to be called once, off the UI thread, before
+// the first encoder is created.  |cacheFile| can be empty.
+void ProbeH264MftCapabilities(const std::string& cacheFile);
+
+// Result of the last ProbeH264MftCapabilities(), |probed| is false if it
+// wasn't called yet.
+H264MftCapabilities GetH264MftCapabilities();
+
+// Starts Media Foundation once and never shuts it down, so the MFStartup()
+// and MFShutdown() of each encoder and decoder stay cheap.  Thread safe.
+HRESULT KeepMediaFoundationStarted();
+
+}  // namespace webrtc
+
+#endif  // THIRD_PARTY_H264_WINUWP_UTILS_MFTCAPABILITIES_H_
@@ -0,0 +1,141 @@
+/*
+*  Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+#include "third_party/winuwp_h264/Utils/NalScanner.h"
+
+#include <wrl.h>
+#include <mfapi.h>
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <intrin.h>
+#include <emmintrin.h>
+#define NAL_SCANNER_SSE2
+#elif defined(_M_ARM) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define NAL_SCANNER_NEON
+#endif
+
+using Microsoft::WRL::ComPtr;
+
+// Guid of the sample attribute caching the NAL unit table.
+static const GUID GUID_NAL_UNITS = { 0x7d0c4b9e, 0x2f61, 0x4a53,
+  { 0xb8, 0x0e, 0x91, 0x3a, 0x6c, 0x27, 0xd4, 0x58 } };
+
+namespace {
+
+// |pos| is the offset of a 0x01 byte, records the NAL unit
+// if it is the end of a start code.
+inline void CheckStartCode(const uint8_t* data, size_t size, size_t pos,
+  std::vector<NalUnit>* nalUnits) {
+  if (pos < 2 || pos + 1 >= size || data[pos - 1] != 0 || data[pos - 2] != 0) {
+    return;
+  }
+  NalUnit nalUnit;
+  nalUnit.prefixLength = (pos >= 3 && data[pos - 3] == 0) ? 4 : 3;
+  nalUnit.offset = static_cast<uint32_t>(pos + 1);
+  nalUnit.length = 0;  // Set once the next start code is found.
+  nalUnit.type = data[pos + 1] & 0x1f;
+  if (!nalUnits->empty()) {
+    NalUnit& previous = nalUnits->back();
+    previous.length = static_cast<uint32_t>(pos + 1 - nalUnit.prefixLength) -
+      previous.offset;
+  }
+  nalUnits->push_back(nalUnit);
+}
+
+}  // namespace
+
+void ScanNalUnits(const uint8_t* data, size_t size,
+  std::vector<NalUnit>* nalUnits) {
+  nalUnits->clear();
+  size_t pos = 0;
+#if defined(NAL_SCANNER_SSE2)
+  const __m128i ones = _mm_set1_epi8(1);
+  for (; pos + 16 <= size; pos += 16) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, ones));
+    while (mask != 0) {
+      unsigned long bit;
+      _BitScanForward(&bit, mask);
+      CheckStartCode(data, size, pos + bit, nalUnits);
+      mask &= mask - 1;
+    }
+  }
+#elif defined(NAL_SCANNER_NEON)
+  const uint8x16_t ones = vdupq_n_u8(1);
+  for (; pos + 16 <= size; pos += 16) {
+    uint8x16_t matches = vceqq_u8(vld1q_u8(data + pos), ones);
+    uint8x8_t folded = vorr_u8(vget_low_u8(matches), vget_high_u8(matches));
+    if (vget_lane_u64(vreinterpret_u64_u8(folded), 0) == 0) {
+      continue;
+    }
+    for (size_t i = 0; i < 16; ++i) {
+      if (data[pos + i] == 0x01) {
+        CheckStartCode(data, size, pos + i, nalUnits);
+      }
+    }
+  }
+#endif
+  for (; pos < size; ++pos) {
+    if (data[pos] == 0x01) {
+      CheckStartCode(data, size, pos, nalUnits);
+    }
+  }
+  if (!nalUnits->empty()) {
+    NalUnit& last = nalUnits->back();
+    last.length = static_cast<uint32_t>(size) - last.offset;
+  }
+}
+
+uint8_t GetTemporalLayerId(const uint8_t* data,
+  const std::vector<NalUnit>& nalUnits) {
+  for (auto& nalUnit : nalUnits) {
+    // NAL header followed by the 3 bytes of the SVC extension,
+    // temporal_id is in the 3 high bits of the last one.
+    if (nalUnit.type == kNalUnitTypePrefix && nalUnit.length >= 4) {
+      return data[nalUnit.offset + 3] >> 5;
+    }
+  }
+  return 0;
+}
+
+HRESULT GetSampleNalUnits(IMFSample* sample, std::vector<NalUnit>* nalUnits) {
+  UINT32 blobSize;
+  if (SUCCEEDED(sample->GetBlobSize(GUID_NAL_UNITS, &blobSize))) {
+    nalUnits->resize(blobSize / sizeof(NalUnit));
+    if (nalUnits->empty()) {
+      return S_OK;
+    }
+    return sample->GetBlob(GUID_NAL_UNITS,
+      reinterpret_cast<UINT8*>(nalUnits->data()), blobSize, nullptr);
+  }
+
+  ComPtr<IMFMediaBuffer> buffer;
+  HRESULT hr = sample->GetBufferByIndex(0, &buffer);
+  if (FAILED(hr)) {
+    return hr;
+  }
+  BYTE* data;
+  DWORD maxLength, curLength;
+  hr = buffer->Lock(&data, &maxLength, &curLength);
+  if (FAILED(hr)) {
+    return hr;
+  }
+  ScanNalUnits(data, curLength, nalUnits);
+  buffer->Unlock();
+  if (nalUnits->empty()) {
+    return S_OK;
+  }
+
+  // Cache result
+  return sample->SetBlob(GUID_NAL_UNITS,
+    reinterpret_cast<const UINT8*>(nalUnits->data()),
+    static_cast<UINT32>(nalUnits->size() * sizeof(NalUnit)));
+}
@@ -0,0 +1,52 @@
+/*
+*  Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+#ifndef THIRD_PARTY_H264_WINUWP_UTILS_NALSCANNER_H_
+#define THIRD_PARTY_H264_WINUWP_UTILS_NALSCANNER_H_
+
+#include <mfidl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// H.264 NAL unit types the code cares about.
+enum NalUnitType : uint8_t {
+  kNalUnitTypeIdr = 5,
+  kNalUnitTypeAccessUnitDelimiter = 9,
+  // SVC extension heading the slices of a temporal layer.
+  kNalUnitTypePrefix = 14,
+};
+
+// One NAL unit of an Annex-B bitstream.
+struct NalUnit {
+  // Offset of the NAL header, right after the start code.
+  uint32_t offset;
+  // Length up to the next start code or the end of the bitstream.
+  uint32_t length;
+  // 3 or 4 bytes.
+  uint8_t prefixLength;
+  uint8_t type;
+};
+
+// Finds all the start codes of an Annex-B bitstream in a single pass.
+// Uses SSE2 or NEON to skip over the bytes that can't end a start code.
+void ScanNalUnits(const uint8_t* data, size_t size,
+  std::vector<NalUnit>* nalUnits);
+
+// Temporal layer of the access unit in |data|, read from its first
+// prefix NAL unit.  0 if the bitstream has no temporal layers.
+uint8_t GetTemporalLayerId(const uint8_t* data,
+  const std::vector<NalUnit>& nalUnits);
+
+// Gets the NAL units of the first buffer of |sample|.  The table is
+// cached as a sample attribute so following calls don't rescan.
+HRESULT GetSampleNalUnits(IMFSample* sample, std::vector<NalUnit>* nalUnits);
+
+#endif  // THIRD_PARTY_H264_WINUWP_UTILS_NALSCANNER_H_
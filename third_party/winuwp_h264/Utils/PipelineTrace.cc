@@ -0,0 +1,344 @@
+/*
+*  Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+#include "third_party/winuwp_h264/Utils/PipelineTrace.h"
+
+#include <Windows.h>
+#include <TraceLoggingProvider.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+#include <vector>
+#include "third_party/winuwp_h264/Utils/LogLinearHistogram.h"
+#include "webrtc/rtc_base/logging.h"
+
+// The GUID is the one derived from the name, as tracelog and WPR do
+// for a provider given as *WebRTCPipeline.
+TRACELOGGING_DEFINE_PROVIDER(
+  g_webRtcPipelineProvider,
+  "WebRTCPipeline",
+  (0xadd68ff9, 0x4a99, 0x5a13, 0xdd, 0x76, 0x8e, 0xce, 0x58, 0x6c, 0x64, 0xa7));
+
+namespace webrtc {
+
+namespace {
+// Registers the provider on first use, for the lifetime of the process.
+class ProviderRegistration {
+ public:
+  ProviderRegistration() {
+    TraceLoggingRegister(g_webRtcPipelineProvider);
+  }
+  ~ProviderRegistration() {
+    TraceLoggingUnregister(g_webRtcPipelineProvider);
+  }
+};
+
+bool IsTracingEnabled() {
+  static ProviderRegistration registration;
+  return TraceLoggingProviderEnabled(g_webRtcPipelineProvider, 0, 0);
+}
+
+// The durations from 2^26us on share the last bucket.
+typedef LogLinearBuckets<26> TimingBuckets;
+const int kTimingBucketCount = TimingBuckets::kCount;
+// More slots than the pipelines have stages, the others are not timed.
+const int kMaxTimedStages = 64;
+
+// A slot per stage name.  The names are literals, a stage finds its slot
+// by the address of its name without taking a lock, and the counters
+// are atomic.  The same stage may come with different pointers from
+// different modules, their slots are merged by name in the report.
+struct StageTiming {
+  std::atomic<const char*> name;
+  std::atomic<uint64_t> count;
+  std::atomic<int64_t> totalUs;
+  // Shifted by one, 0 if there is no duration yet.
+  std::atomic<int64_t> minUsPlusOne;
+  std::atomic<int64_t> maxUs;
+  std::atomic<uint32_t> buckets[kTimingBucketCount];
+};
+
+// Zero initialized, like any static.
+StageTiming g_stageTimings[kMaxTimedStages];
+std::atomic<bool> g_stageTimingEnabled(false);
+// Only for the reports, the stages never take it.
+rtc::CriticalSection g_stageTimingsReportCrit;
+
+StageTiming* FindStageTiming(const char* stage) {
+  size_t first = (reinterpret_cast<uintptr_t>(stage) >> 3) % kMaxTimedStages;
+  for (int i = 0; i < kMaxTimedStages; ++i) {
+    StageTiming* timing = &g_stageTimings[(first + i) % kMaxTimedStages];
+    const char* name = timing->name.load(std::memory_order_acquire);
+    if (name == nullptr) {
+      // Another thread may take the slot first, for the same stage or
+      // another one.
+      if (timing->name.compare_exchange_strong(name, stage,
+          std::memory_order_acq_rel)) {
+        return timing;
+      }
+    }
+    if (name == stage) {
+      return timing;
+    }
+  }
+  return nullptr;
+}
+
+// The slots of a stage added up, for the report.
+struct StageTotals {
+  const char* name;
+  uint64_t count;
+  int64_t totalUs;
+  int64_t minUs;
+  int64_t maxUs;
+  uint64_t buckets[kTimingBucketCount];
+};
+
+int64_t TimingPercentileUs(const StageTotals& totals, int percent) {
+  return TimingBuckets::Percentile(totals.buckets, totals.count,
+    totals.minUs, totals.maxUs, percent);
+}
+
+// Reads |counter|, zeroing it if |reset|.  A duration recorded meanwhile
+// may be split between this report and the next one.
+template <typename T>
+T TakeCounter(std::atomic<T>& counter, bool reset) {
+  return reset ? counter.exchange(0, std::memory_order_relaxed) :
+    counter.load(std::memory_order_relaxed);
+}
+}  // namespace
+
+void SetPipelineStageTimingEnabled(bool enabled) {
+  g_stageTimingEnabled = enabled;
+}
+
+bool IsPipelineStageTimingEnabled() {
+  return g_stageTimingEnabled.load(std::memory_order_relaxed);
+}
+
+void RecordPipelineStageDuration(const char* stage, int64_t durationUs) {
+  StageTiming* timing = FindStageTiming(stage);
+  if (timing == nullptr) {
+    return;
+  }
+  durationUs = std::max<int64_t>(durationUs, 0);
+  timing->buckets[TimingBuckets::Index(durationUs)].fetch_add(1,
+    std::memory_order_relaxed);
+  timing->count.fetch_add(1, std::memory_order_relaxed);
+  timing->totalUs.fetch_add(durationUs, std::memory_order_relaxed);
+  int64_t minUsPlusOne = timing->minUsPlusOne.load(std::memory_order_relaxed);
+  while ((minUsPlusOne == 0 || durationUs + 1 < minUsPlusOne) &&
+    !timing->minUsPlusOne.compare_exchange_weak(minUsPlusOne, durationUs + 1,
+      std::memory_order_relaxed)) {
+  }
+  int64_t maxUs = timing->maxUs.load(std::memory_order_relaxed);
+  while (durationUs > maxUs &&
+    !timing->maxUs.compare_exchange_weak(maxUs, durationUs,
+      std::memory_order_relaxed)) {
+  }
+}
+
+std::string GetPipelineStageTimingsJson(bool reset) {
+  rtc::CritScope lock(&g_stageTimingsReportCrit);
+  std::vector<StageTotals> stages;
+  for (int i = 0; i < kMaxTimedStages; ++i) {
+    StageTiming& timing = g_stageTimings[i];
+    const char* name = timing.name.load(std::memory_order_acquire);
+    if (name == nullptr) {
+      continue;
+    }
+    auto totals = std::find_if(stages.begin(), stages.end(),
+      [name](const StageTotals& stage) {
+        return strcmp(stage.name, name) == 0;
+      });
+    if (totals == stages.end()) {
+      StageTotals stage;
+      memset(&stage, 0, sizeof(stage));
+      stage.name = name;
+      totals = stages.insert(stages.end(), stage);
+    }
+    uint64_t count = TakeCounter(timing.count, reset);
+    int64_t minUsPlusOne = TakeCounter(timing.minUsPlusOne, reset);
+    int64_t maxUs = TakeCounter(timing.maxUs, reset);
+    if (minUsPlusOne != 0) {
+      totals->minUs = totals->count == 0 ? minUsPlusOne - 1 :
+        std::min(totals->minUs, minUsPlusOne - 1);
+    }
+    totals->maxUs = std::max(totals->maxUs, maxUs);
+    totals->count += count;
+    totals->totalUs += TakeCounter(timing.totalUs, reset);
+    for (int j = 0; j < kTimingBucketCount; ++j) {
+      totals->buckets[j] += TakeCounter(timing.buckets[j], reset);
+    }
+  }
+
+  std::ostringstream json;
+  json << "{\"stages\":[";
+  bool first = true;
+  for (const StageTotals& totals : stages) {
+    if (totals.count == 0) {
+      continue;
+    }
+    if (!first) {
+      json << ",";
+    }
+    first = false;
+    // The names are identifiers, nothing to escape.
+    json << "{\"name\":\"" << totals.name << "\""
+      << ",\"count\":" << totals.count
+      << ",\"totalUs\":" << totals.totalUs
+      << ",\"minUs\":" << totals.minUs
+      << ",\"maxUs\":" << totals.maxUs
+      << ",\"p50Us\":" << TimingPercentileUs(totals, 50)
+      << ",\"p90Us\":" << TimingPercentileUs(totals, 90)
+      << ",\"p99Us\":" << TimingPercentileUs(totals, 99) << "}";
+  }
+  json << "]}";
+  return json.str();
+}
+
+void TracePipelineStageStart(const char* stage, int64_t correlationId) {
+  if (!IsTracingEnabled()) {
+    return;
+  }
+  TraceLoggingWrite(g_webRtcPipelineProvider, "PipelineStage",
+    TraceLoggingOpcode(WINEVENT_OPCODE_START),
+    TraceLoggingString(stage, "Stage"),
+    TraceLoggingInt64(correlationId, "CorrelationId"));
+}
+
+void TracePipelineStageStop(const char* stage, int64_t correlationId) {
+  if (!IsTracingEnabled()) {
+    return;
+  }
+  TraceLoggingWrite(g_webRtcPipelineProvider, "PipelineStage",
+    TraceLoggingOpcode(WINEVENT_OPCODE_STOP),
+    TraceLoggingString(stage, "Stage"),
+    TraceLoggingInt64(correlationId, "CorrelationId"));
+}
+
+void TracePipelineFrameDropped(const char* stage, const char* reason,
+  int64_t correlationId) {
+  if (!IsTracingEnabled()) {
+    return;
+  }
+  TraceLoggingWrite(g_webRtcPipelineProvider, "PipelineFrameDropped",
+    TraceLoggingString(stage, "Stage"),
+    TraceLoggingString(reason, "Reason"),
+    TraceLoggingInt64(correlationId, "CorrelationId"));
+}
+
+void TracePipelineFrameMapped(uint32_t rtpTimestamp, int64_t sampleTime) {
+  if (!IsTracingEnabled()) {
+    return;
+  }
+  TraceLoggingWrite(g_webRtcPipelineProvider, "PipelineFrameMapped",
+    TraceLoggingUInt32(rtpTimestamp, "RtpTimestamp"),
+    TraceLoggingInt64(sampleTime, "SampleTime"));
+}
+
+const char kSendFrameFlow[] = "SendFrame";
+const char kReceiveFrameFlow[] = "ReceiveFrame";
+
+void TraceFrameFlowBegin(const char* flow, uint32_t rtpTimestamp) {
+  TRACE_EVENT_FLOW_BEGIN0("webrtc", flow, rtpTimestamp);
+}
+
+void TraceFrameFlowStep(const char* flow, uint32_t rtpTimestamp) {
+  TRACE_EVENT_FLOW_STEP0("webrtc", flow, rtpTimestamp, "step");
+}
+
+void TraceFrameFlowEnd(const char* flow, uint32_t rtpTimestamp) {
+  TRACE_EVENT_FLOW_END0("webrtc", flow, rtpTimestamp);
+}
+
+void TraceThreadCpuUsage(const char* name, double cpuUsage) {
+  if (!IsTracingEnabled()) {
+    return;
+  }
+  TraceLoggingWrite(g_webRtcPipelineProvider, "ThreadCpuUsage",
+    TraceLoggingString(name, "Thread"),
+    TraceLoggingFloat64(cpuUsage, "CpuUsage"));
+}
+
+void TraceProcessResourceUsage(double cpuUsage, int64_t workingSetBytes,
+  int64_t privateBytes) {
+  if (!IsTracingEnabled()) {
+    return;
+  }
+  TraceLoggingWrite(g_webRtcPipelineProvider, "ProcessResourceUsage",
+    TraceLoggingFloat64(cpuUsage, "CpuUsage"),
+    TraceLoggingInt64(workingSetBytes, "WorkingSetBytes"),
+    TraceLoggingInt64(privateBytes, "PrivateBytes"));
+}
+
+const uint32_t LatencyHistogram::kBucketBoundsMs[kBucketCount - 1] =
+  { 5, 10, 20, 33, 50, 100, 200 };
+
+LatencyHistogram::LatencyHistogram(const char* name)
+  : name_(name)
+  , count_(0)
+  , totalMs_(0)
+  , maxMs_(0) {
+  memset(buckets_, 0, sizeof(buckets_));
+}
+
+void LatencyHistogram::Add(int64_t latencyMs) {
+  if (latencyMs < 0) {
+    return;
+  }
+  int bucket = 0;
+  while (bucket < kBucketCount - 1 &&
+    latencyMs >= kBucketBoundsMs[bucket]) {
+    ++bucket;
+  }
+  rtc::CritScope lock(&crit_);
+  ++buckets_[bucket];
+  ++count_;
+  totalMs_ += latencyMs;
+  if (latencyMs > maxMs_) {
+    maxMs_ = latencyMs;
+  }
+}
+
+void LatencyHistogram::Report() {
+  rtc::CritScope lock(&crit_);
+  if (count_ == 0) {
+    return;
+  }
+  int64_t averageMs = totalMs_ / count_;
+  std::ostringstream buckets;
+  for (int i = 0; i < kBucketCount; ++i) {
+    if (i < kBucketCount - 1) {
+      buckets << " <" << kBucketBoundsMs[i] << "ms:" << buckets_[i];
+    } else {
+      buckets << " >=" << kBucketBoundsMs[i - 1] << "ms:" << buckets_[i];
+    }
+  }
+  LOG(LS_INFO) << name_ << " latency avg=" << averageMs << "ms max="
+    << maxMs_ << "ms" << buckets.str();
+  if (IsTracingEnabled()) {
+    TraceLoggingWrite(g_webRtcPipelineProvider, "PipelineLatencyHistogram",
+      TraceLoggingString(name_, "Name"),
+      TraceLoggingUInt32(count_, "Count"),
+      TraceLoggingInt64(averageMs, "AverageMs"),
+      TraceLoggingInt64(maxMs_, "MaxMs"),
+      TraceLoggingUInt32FixedArray(kBucketBoundsMs, kBucketCount - 1,
+        "BucketBoundsMs"),
+      TraceLoggingUInt32FixedArray(buckets_, kBucketCount, "Buckets"));
+  }
+  memset(buckets_, 0, sizeof(buckets_));
+  count_ = 0;
+  totalMs_ = 0;
+  maxMs_ = 0;
+}
+
+}  // namespace webrtc
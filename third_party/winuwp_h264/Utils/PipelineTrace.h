@@ -0,0 +1,115 @@
+/*
+*  Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+#ifndef THIRD_PARTY_H264_WINUWP_UTILS_PIPELINETRACE_H_
+#define THIRD_PARTY_H264_WINUWP_UTILS_PIPELINETRACE_H_
+
+#include <stdint.h>
+#include <string>
+#include "webrtc/rtc_base/criticalsection.h"
+#include "webrtc/rtc_base/timeutils.h"
+#include "webrtc/rtc_base/trace_event.h"
+
+namespace webrtc {
+
+// ETW events for the Media Foundation codec pipelines.  They are written
+// with TraceLogging by the WebRTCPipeline provider, whose GUID is derived
+// from its name, add68ff9-4a99-5a13-dd76-8ece586c64a7.  Each stage of a pipeline gets
+// a start and a stop event with a correlation id, the frame timestamp, to
+// follow a frame through the stages in WPA.  Media Foundation only carries
+// the sample time, stages running before it is assigned use the RTP
+// timestamp and TracePipelineFrameMapped() links the two.
+void TracePipelineStageStart(const char* stage, int64_t correlationId);
+void TracePipelineStageStop(const char* stage, int64_t correlationId);
+void TracePipelineFrameDropped(const char* stage, const char* reason,
+  int64_t correlationId);
+void TracePipelineFrameMapped(uint32_t rtpTimestamp, int64_t sampleTime);
+
+// Flow events of the WebRTC trace, captured by WebRTC::StartTracing().
+// chrome://tracing draws an arrow through the slices of a frame, from
+// the slice of the begin event to the one of the end event, across the
+// threads.  The frame is identified by its RTP timestamp, the only id
+// carried from the codecs to the renderers.  Must be called within a
+// slice, such as a ScopedPipelineStage.
+extern const char kSendFrameFlow[];
+extern const char kReceiveFrameFlow[];
+void TraceFrameFlowBegin(const char* flow, uint32_t rtpTimestamp);
+void TraceFrameFlowStep(const char* flow, uint32_t rtpTimestamp);
+void TraceFrameFlowEnd(const char* flow, uint32_t rtpTimestamp);
+
+// Resource usage measured by the ResourceSampler, in percent of one
+// processor for a thread and of all of them for the process.
+void TraceThreadCpuUsage(const char* name, double cpuUsage);
+void TraceProcessResourceUsage(double cpuUsage, int64_t workingSetBytes,
+  int64_t privateBytes);
+
+// Durations of the stages on real calls, the WebRtc.Benchmarks project
+// measures the same code on synthetic input.  Off by default, the
+// stages are only timed while it is on.  Recording a duration takes no
+// lock.
+void SetPipelineStageTimingEnabled(bool enabled);
+bool IsPipelineStageTimingEnabled();
+void RecordPipelineStageDuration(const char* stage, int64_t durationUs);
+// The durations since the last reset, one object per stage:
+// {"stages":[{"name":"H264Encoder.Encode","count":900,"totalUs":...,
+// "minUs":...,"maxUs":...,"p50Us":...,"p90Us":...,"p99Us":...}]}
+// The percentiles are upper bounds, at most 12.5% above the duration.
+std::string GetPipelineStageTimingsJson(bool reset);
+
+// Traces a stage for the lifetime of the object, to ETW and as a slice
+// of the WebRTC trace.  |stage| must be a literal.
+class ScopedPipelineStage {
+ public:
+  ScopedPipelineStage(const char* stage, int64_t correlationId)
+    : stage_(stage), correlationId_(correlationId),
+    startUs_(IsPipelineStageTimingEnabled() ? rtc::TimeMicros() : -1) {
+    TracePipelineStageStart(stage_, correlationId_);
+    TRACE_EVENT_BEGIN1("webrtc", stage_, "correlationId", correlationId_);
+  }
+  ~ScopedPipelineStage() {
+    TRACE_EVENT_END0("webrtc", stage_);
+    TracePipelineStageStop(stage_, correlationId_);
+    if (startUs_ >= 0) {
+      RecordPipelineStageDuration(stage_, rtc::TimeMicros() - startUs_);
+    }
+  }
+
+ private:
+  const char* stage_;
+  const int64_t correlationId_;
+  // -1 if the stage isn't timed.
+  const int64_t startUs_;
+};
+
+// Latency histogram with fixed buckets.  Can be added to from any thread.
+class LatencyHistogram {
+ public:
+  // Upper bounds of the buckets, the last bucket is open ended.
+  static const int kBucketCount = 8;
+  static const uint32_t kBucketBoundsMs[kBucketCount - 1];
+
+  explicit LatencyHistogram(const char* name);
+
+  void Add(int64_t latencyMs);
+  // Writes the histogram to the log and to ETW, then starts over.
+  void Report();
+
+ private:
+  const char* name_;
+  rtc::CriticalSection crit_;
+  uint32_t buckets_[kBucketCount];
+  uint32_t count_;
+  int64_t totalMs_;
+  int64_t maxMs_;
+};
+
+}  // namespace webrtc
+
+#endif  // THIRD_PARTY_H264_WINUWP_UTILS_PIPELINETRACE_H_
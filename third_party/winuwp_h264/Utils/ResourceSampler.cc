@@ -0,0 +1,213 @@
+/*
+*  Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+#include "third_party/winuwp_h264/Utils/ResourceSampler.h"
+
+#include <psapi.h>
+#include <algorithm>
+
+#include "third_party/winuwp_h264/Utils/PipelineTrace.h"
+#include "webrtc/rtc_base/thread.h"
+#include "webrtc/rtc_base/timeutils.h"
+
+namespace webrtc {
+
+namespace {
+enum {
+  MSG_SAMPLE,
+};
+
+// 100ns units.
+uint64_t ToCpuTime(const FILETIME& kernelTime, const FILETIME& userTime) {
+  ULARGE_INTEGER kernel;
+  kernel.LowPart = kernelTime.dwLowDateTime;
+  kernel.HighPart = kernelTime.dwHighDateTime;
+  ULARGE_INTEGER user;
+  user.LowPart = userTime.dwLowDateTime;
+  user.HighPart = userTime.dwHighDateTime;
+  return kernel.QuadPart + user.QuadPart;
+}
+
+bool GetThreadCpuTime(HANDLE thread, uint64_t* cpuTime) {
+  FILETIME creationTime, exitTime, kernelTime, userTime;
+  if (!GetThreadTimes(thread, &creationTime, &exitTime,
+    &kernelTime, &userTime)) {
+    return false;
+  }
+  *cpuTime = ToCpuTime(kernelTime, userTime);
+  return true;
+}
+
+uint64_t GetProcessCpuTime() {
+  FILETIME creationTime, exitTime, kernelTime, userTime;
+  if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime,
+    &kernelTime, &userTime)) {
+    return 0;
+  }
+  return ToCpuTime(kernelTime, userTime);
+}
+
+int ProcessorCount() {
+  SYSTEM_INFO info;
+  GetNativeSystemInfo(&info);
+  return std::max(1, (int)info.dwNumberOfProcessors);
+}
+}  // namespace
+
+ResourceSampler* ResourceSampler::Instance() {
+  static ResourceSampler* instance = new ResourceSampler();
+  return instance;
+}
+
+ResourceSampler::ResourceSampler()
+  : intervalMs_(1000)
+  , lastSampleMs_(0)
+  , lastProcessCpuTime_(0) {
+}
+
+ResourceSampler::~ResourceSampler() {
+  Stop();
+  for (auto& thread : threads_) {
+    CloseHandle(thread.handle);
+  }
+}
+
+void ResourceSampler::Start(int intervalMs) {
+  rtc::CritScope lock(&crit_);
+  intervalMs_ = std::max(intervalMs, 100);
+  if (thread_ != nullptr) {
+    return;
+  }
+  lastSampleMs_ = rtc::TimeMillis();
+  lastProcessCpuTime_ = GetProcessCpuTime();
+  thread_ = rtc::Thread::Create();
+  thread_->SetName("WebRTCResourceSampler", nullptr);
+  thread_->Start();
+  thread_->PostDelayed(RTC_FROM_HERE, intervalMs_, this, MSG_SAMPLE);
+}
+
+void ResourceSampler::Stop() {
+  std::unique_ptr<rtc::Thread> thread;
+  {
+    rtc::CritScope lock(&crit_);
+    thread = std::move(thread_);
+  }
+  // Stopped outside the lock, a sample can be waiting for it.
+  if (thread != nullptr) {
+    thread->Stop();
+  }
+}
+
+void ResourceSampler::RegisterCurrentThread(const char* name) {
+  // Empty until the thread registers.
+  thread_local std::string registeredName;
+  if (registeredName == name) {
+    return;
+  }
+  if (registeredName.empty()) {
+    Instance()->AddThread(name);
+  } else {
+    Instance()->RenameThread(name);
+  }
+  registeredName = name;
+}
+
+ResourceUsage ResourceSampler::GetLastUsage() {
+  rtc::CritScope lock(&crit_);
+  return lastUsage_;
+}
+
+void ResourceSampler::OnMessage(rtc::Message* msg) {
+  if (msg->message_id != MSG_SAMPLE) {
+    return;
+  }
+  Sample();
+  rtc::CritScope lock(&crit_);
+  if (thread_ != nullptr) {
+    thread_->PostDelayed(RTC_FROM_HERE, intervalMs_, this, MSG_SAMPLE);
+  }
+}
+
+void ResourceSampler::AddThread(const char* name) {
+  SampledThread thread;
+  thread.name = name;
+  thread.id = GetCurrentThreadId();
+  if (!DuplicateHandle(GetCurrentProcess(), GetCurrentThread(),
+    GetCurrentProcess(), &thread.handle,
+    THREAD_QUERY_LIMITED_INFORMATION | SYNCHRONIZE, FALSE, 0)) {
+    return;
+  }
+  GetThreadCpuTime(thread.handle, &thread.lastCpuTime);
+  rtc::CritScope lock(&crit_);
+  threads_.push_back(thread);
+}
+
+void ResourceSampler::RenameThread(const char* name) {
+  DWORD id = GetCurrentThreadId();
+  rtc::CritScope lock(&crit_);
+  // From the last one, a thread gone with the same id may not have been
+  // forgotten yet.
+  for (auto it = threads_.rbegin(); it != threads_.rend(); ++it) {
+    if (it->id == id) {
+      it->name = name;
+      return;
+    }
+  }
+}
+
+void ResourceSampler::Sample() {
+  static const int processorCount = ProcessorCount();
+  int64_t now = rtc::TimeMillis();
+  uint64_t processCpuTime = GetProcessCpuTime();
+  PROCESS_MEMORY_COUNTERS_EX memory = {};
+  memory.cb = sizeof(memory);
+  GetProcessMemoryInfo(GetCurrentProcess(),
+    reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&memory), sizeof(memory));
+
+  rtc::CritScope lock(&crit_);
+  int64_t elapsedMs = now - lastSampleMs_;
+  if (elapsedMs <= 0) {
+    return;
+  }
+  // CPU times are in 100ns, 10000 of them per millisecond.
+  double elapsed = (double)elapsedMs * 10000;
+
+  ResourceUsage usage;
+  usage.timestampMs = now;
+  usage.processCpuUsage = 100.0 * (processCpuTime - lastProcessCpuTime_) /
+    elapsed / processorCount;
+  usage.workingSetBytes = memory.WorkingSetSize;
+  usage.privateBytes = memory.PrivateUsage;
+  for (auto it = threads_.begin(); it != threads_.end();) {
+    uint64_t cpuTime = it->lastCpuTime;
+    GetThreadCpuTime(it->handle, &cpuTime);
+    usage.threadCpuUsage[it->name] +=
+      100.0 * (cpuTime - it->lastCpuTime) / elapsed;
+    it->lastCpuTime = cpuTime;
+    // Counted a last time, then forgotten.
+    if (WaitForSingleObject(it->handle, 0) == WAIT_OBJECT_0) {
+      CloseHandle(it->handle);
+      it = threads_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  lastSampleMs_ = now;
+  lastProcessCpuTime_ = processCpuTime;
+
+  TraceProcessResourceUsage(usage.processCpuUsage, usage.workingSetBytes,
+    usage.privateBytes);
+  for (auto& thread : usage.threadCpuUsage) {
+    TraceThreadCpuUsage(thread.first.c_str(), thread.second);
+  }
+  lastUsage_ = std::move(usage);
+}
+
+}  // namespace webrtc
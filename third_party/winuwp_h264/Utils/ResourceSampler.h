@@ -0,0 +1,97 @@
+/*
+*  Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+#ifndef THIRD_PARTY_H264_WINUWP_UTILS_RESOURCESAMPLER_H_
+#define THIRD_PARTY_H264_WINUWP_UTILS_RESOURCESAMPLER_H_
+
+#include <Windows.h>
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "webrtc/rtc_base/criticalsection.h"
+#include "webrtc/rtc_base/messagehandler.h"
+
+namespace rtc {
+  class Thread;
+}
+
+namespace webrtc {
+
+struct ResourceUsage {
+  ResourceUsage()
+    : timestampMs(0), processCpuUsage(0), workingSetBytes(0),
+    privateBytes(0) {}
+
+  int64_t timestampMs;
+  // Percent of all the processors of the device.
+  double processCpuUsage;
+  int64_t workingSetBytes;
+  int64_t privateBytes;
+  // Percent of one processor, summed over the threads with the name.
+  std::map<std::string, double> threadCpuUsage;
+};
+
+// Measures the CPU time of the registered threads and the memory of the
+// process.  Each sample is written to ETW with the pipeline events and
+// kept for the stats.  Threads register themselves, the threads of a
+// pool like the Media Foundation work queues share a name.
+class ResourceSampler : public rtc::MessageHandler {
+ public:
+  static ResourceSampler* Instance();
+
+  // Samples every |intervalMs| on a thread of its own, until Stop().
+  void Start(int intervalMs);
+  void Stop();
+
+  // Registers the calling thread under |name|, cheap enough to be called
+  // for each frame.  A thread registered again under another name, like
+  // a Media Foundation work queue thread running the work of an encoder
+  // then of a decoder, is renamed.  All its CPU time since the previous
+  // sample goes to the name it has then: the names of the threads of a
+  // pool shared by several pipelines are approximate.
+  static void RegisterCurrentThread(const char* name);
+
+  // The last sample, |timestampMs| is 0 before the first one.
+  ResourceUsage GetLastUsage();
+
+  // MessageHandler
+  void OnMessage(rtc::Message* msg) override;
+
+ private:
+  ResourceSampler();
+  ~ResourceSampler();
+
+  struct SampledThread {
+    SampledThread() : id(0), handle(nullptr), lastCpuTime(0) {}
+    std::string name;
+    DWORD id;
+    HANDLE handle;
+    uint64_t lastCpuTime;
+  };
+
+  void AddThread(const char* name);
+  // Renames the calling thread, already added.
+  void RenameThread(const char* name);
+  void Sample();
+
+  rtc::CriticalSection crit_;
+  std::unique_ptr<rtc::Thread> thread_;
+  int intervalMs_;
+  std::vector<SampledThread> threads_;
+  int64_t lastSampleMs_;
+  uint64_t lastProcessCpuTime_;
+  ResourceUsage lastUsage_;
+};
+
+}  // namespace webrtc
+
+#endif  // THIRD_PARTY_H264_WINUWP_UTILS_RESOURCESAMPLER_H_
@@ -11,61 +11,129 @@
 #ifndef THIRD_PARTY_H264_WINUWP_UTILS_SAMPLEATTRIBUTEQUEUE_H_
 #define THIRD_PARTY_H264_WINUWP_UTILS_SAMPLEATTRIBUTEQUEUE_H_
 
+#include <stddef.h>
 #include <stdint.h>
-#include <queue>
-#include <utility>
-#include <memory>
+#include <atomic>
 #include "webrtc/rtc_base/criticalsection.h"
 
 // A sorted queue with certain properties which makes it
 // good for mapping attributes to frames and samples.
 // The ids have to be in increasing order.
-template <typename T>
+// The entries live in a fixed ring, nothing is allocated once the
+// queue is built.  The lock is only held to move the ends of the
+// ring and copy one entry, size() doesn't take it.
+template <typename T, size_t kCapacity = 64>
 class SampleAttributeQueue {
  public:
   SampleAttributeQueue()
-  {
+    : head_(0),
+    count_(0),
+    lost_(0),
+    misses_(0) {
   }
   ~SampleAttributeQueue() {}
 
+  // The oldest entry is lost if the queue is full.
   void push(uint64_t id, const T& t) {
     rtc::CritScope lock(&_crit);
-    _attributes.push(std::make_pair(id, t));
+    size_t count = count_.load(std::memory_order_relaxed);
+    if (count == kCapacity) {
+      head_ = (head_ + 1) % kCapacity;
+      --count;
+      ++lost_;
+    }
+    Entry& entry = entries_[(head_ + count) % kCapacity];
+    entry.id = id;
+    entry.value = t;
+    count_.store(count + 1, std::memory_order_release);
   }
 
+  // Gets the attributes of |id| and removes them with the older
+  // entries, which are lost.  If |id| has no entry, gets the next one
+  // without removing it.  Returns false, and counts a miss, if there
+  // is no entry at or after |id|.
   bool pop(uint64_t id, T& outT) {
     rtc::CritScope lock(&_crit);
-    while (!_attributes.empty()) {
-      auto entry = _attributes.front();
-      if (entry.first > id) {
-        outT = entry.second;
-        return true;
-      } else if (entry.first == id) {
-        outT = entry.second;
-        _attributes.pop();
-        return true;
-      } else {
-        _attributes.pop();
+    size_t count = count_.load(std::memory_order_relaxed);
+    // The entries are sorted, the first one not older than |id| is
+    // found by bisection.  Usually the oldest one, which is checked
+    // first.  The ids are sample times in hns, which step by the frame
+    // duration and jump on frame rate changes and drops, so they can't
+    // index the ring directly.
+    size_t skipped = 0;
+    if (count > 0 && at(0).id < id) {
+      size_t low = 1;
+      size_t high = count;
+      while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (at(middle).id < id) {
+          low = middle + 1;
+        } else {
+          high = middle;
+        }
+      }
+      skipped = low;
+    }
+    if (skipped > 0) {
+      head_ = (head_ + skipped) % kCapacity;
+      count -= skipped;
+      lost_ += skipped;
+    }
+    bool found = false;
+    if (count > 0) {
+      const Entry& entry = at(0);
+      outT = entry.value;
+      found = true;
+      if (entry.id == id) {
+        head_ = (head_ + 1) % kCapacity;
+        --count;
       }
+    } else {
+      ++misses_;
     }
-    return false;
+    count_.store(count, std::memory_order_release);
+    return found;
   }
 
   void clear() {
     rtc::CritScope lock(&_crit);
-    while (!_attributes.empty()) {
-      _attributes.pop();
-    }
+    head_ = 0;
+    count_.store(0, std::memory_order_release);
   }
 
-  uint32_t size() {
-    rtc::CritScope lock(&_crit);
-    return static_cast<uint32_t>(_attributes.size());
+  uint32_t size() const {
+    return static_cast<uint32_t>(count_.load(std::memory_order_acquire));
+  }
+
+  // Entries removed without being matched, because a later id was
+  // popped or the queue was full.
+  uint64_t lost() const {
+    return lost_.load(std::memory_order_relaxed);
+  }
+
+  // Pops which found no entry.
+  uint64_t misses() const {
+    return misses_.load(std::memory_order_relaxed);
   }
 
 private:
+  struct Entry {
+    uint64_t id;
+    T value;
+  };
+
+  const Entry& at(size_t index) const {
+    return entries_[(head_ + index) % kCapacity];
+  }
+
   rtc::CriticalSection _crit;
-  std::queue<std::pair<uint64_t, const T>> _attributes;
+  Entry entries_[kCapacity];
+  // Guarded by |_crit|.
+  size_t head_;
+  // Only changed under |_crit|.
+  std::atomic<size_t> count_;
+  std::atomic<uint64_t> lost_;
+  std::atomic<uint64_t> misses_;
 };
 
 #endif  // THIRD_PARTY_H264_WINUWP_UTILS_SAMPLEATTRIBUTEQUEUE_H_
@@ -0,0 +1,161 @@
+/*
+*  Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+#include "third_party/winuwp_h264/Utils/SamplePool.h"
+
+#include <mfapi.h>
+#include <mferror.h>
+#include "Utils.h"
+#include "webrtc/rtc_base/logging.h"
+
+#pragma comment(lib, "mfplat")
+
+using Microsoft::WRL::ComPtr;
+
+// Guid of the sample attribute holding the pool generation
+// the sample was created for.
+static const GUID GUID_SAMPLE_POOL_GENERATION = { 0x3b1a7d52, 0x6e0c, 0x4f8a,
+  { 0x9c, 0x21, 0x5d, 0x47, 0xe3, 0x0b, 0x86, 0xf4 } };
+
+SamplePool::SamplePool()
+  : width_(0),
+  height_(0),
+  generation_(0),
+  isShutdown_(false),
+  hitCount_(0),
+  missCount_(0) {
+  bufferFactory_ = [](UINT32 width, UINT32 height,
+    IMFMediaBuffer** buffer) -> HRESULT {
+    return MFCreate2DMediaBuffer(width, height,
+      MFVideoFormat_NV12.Data1, FALSE, buffer);
+  };
+}
+
+SamplePool::~SamplePool() {
+  Shutdown();
+}
+
+void SamplePool::SetBufferFactory(BufferFactory bufferFactory) {
+  rtc::CritScope lock(&crit_);
+  bufferFactory_ = bufferFactory;
+  freeSamples_.clear();
+  ++generation_;
+}
+
+HRESULT SamplePool::GetSample(UINT32 width, UINT32 height,
+  IMFSample** sample) {
+  rtc::CritScope lock(&crit_);
+  if (isShutdown_) {
+    return MF_E_SHUTDOWN;
+  }
+
+  if (width != width_ || height != height_) {
+    LOG(LS_INFO) << "SamplePool resized from " << width_ << "x" << height_
+      << " to " << width << "x" << height << " (hits=" << hitCount_
+      << " misses=" << missCount_ << ")";
+    freeSamples_.clear();
+    ++generation_;
+    width_ = width;
+    height_ = height;
+  }
+
+  ComPtr<IMFSample> spSample;
+  if (!freeSamples_.empty()) {
+    spSample = freeSamples_.front();
+    freeSamples_.pop_front();
+    // Don't leak flags like discontinuity from the previous use.
+    spSample->DeleteAllItems();
+    spSample->SetUINT32(GUID_SAMPLE_POOL_GENERATION, generation_);
+    ++hitCount_;
+  } else {
+    HRESULT hr = CreateSample(&spSample);
+    if (FAILED(hr)) {
+      return hr;
+    }
+    ++missCount_;
+  }
+
+  // The allocator is cleared every time the sample comes back,
+  // so it has to be set again each time the sample is handed out.
+  ComPtr<IMFTrackedSample> trackedSample;
+  HRESULT hr = spSample.As(&trackedSample);
+  ON_SUCCEEDED(trackedSample->SetAllocator(this, nullptr));
+  if (FAILED(hr)) {
+    return hr;
+  }
+
+  *sample = spSample.Detach();
+  return S_OK;
+}
+
+void SamplePool::Reset() {
+  rtc::CritScope lock(&crit_);
+  freeSamples_.clear();
+  ++generation_;
+}
+
+void SamplePool::Shutdown() {
+  rtc::CritScope lock(&crit_);
+  freeSamples_.clear();
+  ++generation_;
+  isShutdown_ = true;
+}
+
+uint64_t SamplePool::GetHitCount() const {
+  rtc::CritScope lock(&crit_);
+  return hitCount_;
+}
+
+uint64_t SamplePool::GetMissCount() const {
+  rtc::CritScope lock(&crit_);
+  return missCount_;
+}
+
+IFACEMETHODIMP SamplePool::GetParameters(DWORD*, DWORD*) {
+  // Implementation of this method is optional.
+  return E_NOTIMPL;
+}
+
+IFACEMETHODIMP SamplePool::Invoke(IMFAsyncResult* pAsyncResult) {
+  ComPtr<IUnknown> object;
+  ComPtr<IMFSample> spSample;
+  HRESULT hr = pAsyncResult->GetObject(&object);
+  ON_SUCCEEDED(object.As(&spSample));
+  if (FAILED(hr)) {
+    return hr;
+  }
+
+  UINT32 generation;
+  if (FAILED(spSample->GetUINT32(GUID_SAMPLE_POOL_GENERATION, &generation))) {
+    return S_OK;
+  }
+
+  rtc::CritScope lock(&crit_);
+  if (!isShutdown_ && generation == generation_ &&
+    freeSamples_.size() < kMaxFreeSamples) {
+    freeSamples_.push_back(spSample);
+  }
+  return S_OK;
+}
+
+HRESULT SamplePool::CreateSample(IMFSample** sample) {
+  ComPtr<IMFTrackedSample> trackedSample;
+  ComPtr<IMFSample> spSample;
+  ComPtr<IMFMediaBuffer> mediaBuffer;
+  HRESULT hr = MFCreateTrackedSample(&trackedSample);
+  ON_SUCCEEDED(trackedSample.As(&spSample));
+  ON_SUCCEEDED(bufferFactory_(width_, height_, &mediaBuffer));
+  ON_SUCCEEDED(spSample->AddBuffer(mediaBuffer.Get()));
+  ON_SUCCEEDED(spSample->SetUINT32(GUID_SAMPLE_POOL_GENERATION, generation_));
+  if (SUCCEEDED(hr)) {
+    *sample = spSample.Detach();
+  }
+  return hr;
+}
@@ -0,0 +1,77 @@
+/*
+*  Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+#ifndef THIRD_PARTY_H264_WINUWP_UTILS_SAMPLEPOOL_H_
+#define THIRD_PARTY_H264_WINUWP_UTILS_SAMPLEPOOL_H_
+
+#include <wrl.h>
+#include <mfidl.h>
+#include <stdint.h>
+#include <functional>
+#include <list>
+#include "webrtc/rtc_base/criticalsection.h"
+
+// Pool of IMFSamples holding a single buffer of one fixed resolution.
+// Samples are created with MFCreateTrackedSample and come back to the
+// pool through Invoke() once the last reference held by Media Foundation
+// (or anyone else) is released.  Requesting a different resolution drops
+// the pool and starts a new one; samples still in flight from the old
+// resolution are released instead of being recycled.
+class SamplePool : public Microsoft::WRL::RuntimeClass<
+  Microsoft::WRL::RuntimeClassFlags<
+  Microsoft::WRL::RuntimeClassType::ClassicCom>,
+  IMFAsyncCallback> {
+ public:
+  typedef std::function<HRESULT(UINT32 width, UINT32 height,
+    IMFMediaBuffer** buffer)> BufferFactory;
+
+  SamplePool();
+  virtual ~SamplePool();
+
+  // Replaces the function used to allocate the sample buffers.
+  // Resets the pool.  By default an NV12 2D buffer is created.
+  void SetBufferFactory(BufferFactory bufferFactory);
+
+  // Gets a sample holding a width x height buffer, recycled if possible.
+  HRESULT GetSample(UINT32 width, UINT32 height, IMFSample** sample);
+
+  // Drops all the free samples.
+  void Reset();
+
+  // Drops all the free samples and stops recycling.
+  void Shutdown();
+
+  // Number of GetSample() calls served from / not served from the pool.
+  uint64_t GetHitCount() const;
+  uint64_t GetMissCount() const;
+
+  // IMFAsyncCallback
+  IFACEMETHOD(GetParameters)(DWORD* pdwFlags, DWORD* pdwQueue);
+  IFACEMETHOD(Invoke)(IMFAsyncResult* pAsyncResult);
+
+ private:
+  HRESULT CreateSample(IMFSample** sample);
+
+  // Upper bound of idle samples kept around.
+  static const size_t kMaxFreeSamples = 8;
+
+  rtc::CriticalSection crit_;
+  std::list<Microsoft::WRL::ComPtr<IMFSample>> freeSamples_;
+  BufferFactory bufferFactory_;
+  UINT32 width_;
+  UINT32 height_;
+  // Bumped on every reset, samples of an older generation are not recycled.
+  UINT32 generation_;
+  bool isShutdown_;
+  uint64_t hitCount_;
+  uint64_t missCount_;
+};
+
+#endif  // THIRD_PARTY_H264_WINUWP_UTILS_SAMPLEPOOL_H_
@@ -0,0 +1,94 @@
+/*
+*  Copyright (c) 2015 The WebRTC project authors. All Rights Reserved.
+*
+*  Use of this source code is governed by a BSD-style license
+*  that can be found in the LICENSE file in the root of the source
+*  tree. An additional intellectual property rights grant can be found
+*  in the file PATENTS.  All contributing project authors may
+*  be found in the AUTHORS file in the root of the source tree.
+*/
+
+#ifndef THIRD_PARTY_H264_WINUWP_UTILS_SPSCQUEUE_H_
+#define THIRD_PARTY_H264_WINUWP_UTILS_SPSCQUEUE_H_
+
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+
+// A bounded, lock-free, single-producer/single-consumer ring buffer.
+// push() must only be called from the producer thread, pop(), peek()
+// and front() only from the consumer thread.  size() and empty() are
+// safe from both, but only give a snapshot.
+template <typename T>
+class SpscQueue {
+ public:
+  explicit SpscQueue(size_t capacity)
+    : buffer_(capacity + 1),
+    head_(0),
+    tail_(0) {
+  }
+  ~SpscQueue() {}
+
+  // Returns false if the queue is full, the element is not queued then.
+  bool push(const T& t) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t next = increment(tail);
+    if (next == head_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    buffer_[tail] = t;
+    tail_.store(next, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T& outT) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    outT = buffer_[head];
+    head_.store(increment(head), std::memory_order_release);
+    return true;
+  }
+
+  // Gets the element |index| positions after the oldest one
+  // without removing it.
+  bool peek(size_t index, T& outT) const {
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t tail = tail_.load(std::memory_order_acquire);
+    size_t count = (tail + buffer_.size() - head) % buffer_.size();
+    if (index >= count) {
+      return false;
+    }
+    outT = buffer_[(head + index) % buffer_.size()];
+    return true;
+  }
+
+  size_t size() const {
+    size_t head = head_.load(std::memory_order_acquire);
+    size_t tail = tail_.load(std::memory_order_acquire);
+    return (tail + buffer_.size() - head) % buffer_.size();
+  }
+
+  bool empty() const {
+    return head_.load(std::memory_order_acquire) ==
+      tail_.load(std::memory_order_acquire);
+  }
+
+  size_t capacity() const {
+    return buffer_.size() - 1;
+  }
+
+ private:
+  size_t increment(size_t index) const {
+    return (index + 1) % buffer_.size();
+  }
+
+  std::vector<T> buffer_;
+  // Written by the consumer only.
+  std::atomic<size_t> head_;
+  // Written by the producer only.
+  std::atomic<size_t> tail_;
+};
+
+#endif  // THIRD_PARTY_H264_WINUWP_UTILS_SPSCQUEUE_H_